@@ -49,7 +49,7 @@ echo.
 
 if not exist "%OUT_DIR%" mkdir "%OUT_DIR%"
 
-echo [1/4] Compiling resources...
+echo [1/6] Compiling resources...
 rc.exe /nologo /fo "%OUT_DIR%\sshfs-ctx.res" "%SRC_DIR%\sshfs-ctx.rc"
 if errorlevel 1 (
     echo ERROR: Failed to compile resources
@@ -57,41 +57,128 @@ if errorlevel 1 (
 )
 echo   OK
 
-echo [2/4] Building sshfs-ctx.dll...
+echo [2/6] Building sshfs-ctx.dll...
 cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE ^
     "%SRC_DIR%\sshfs-ctx.c" ^
+    "%SRC_DIR%\sshfs-unc.c" ^
+    "%SRC_DIR%\sshfs-path.c" ^
+    "%SRC_DIR%\sshfs-thumb.c" ^
     "%OUT_DIR%\sshfs-ctx.res" ^
     /Fe:"%OUT_DIR%\sshfs-ctx.dll" ^
     /link /DEF:"%SRC_DIR%\sshfs-ctx.def" ^
-    ole32.lib shell32.lib shlwapi.lib advapi32.lib mpr.lib uuid.lib user32.lib gdi32.lib
+    ole32.lib shell32.lib shlwapi.lib advapi32.lib mpr.lib uuid.lib user32.lib gdi32.lib windowscodecs.lib
 if errorlevel 1 (
     echo ERROR: Failed to build sshfs-ctx.dll
     exit /b 1
 )
 echo   OK
 
-echo [3/4] Building sshfs-ssh.exe...
-cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE ^
+echo [3/7] Building sshfs-ssh.exe...
+if not exist "%OUT_DIR%\ssh-obj" mkdir "%OUT_DIR%\ssh-obj"
+cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE /Fo"%OUT_DIR%\ssh-obj\\" ^
     "%SRC_DIR%\sshfs-ssh.c" ^
+    "%SRC_DIR%\sshfs-ssh-transfer.c" ^
+    "%SRC_DIR%\sshfs-ssh-download.c" ^
+    "%SRC_DIR%\sshfs-ssh-upload.c" ^
+    "%SRC_DIR%\sshfs-ssh-hash.c" ^
+    "%SRC_DIR%\sshfs-ssh-search.c" ^
+    "%SRC_DIR%\sshfs-ssh-snapshot.c" ^
+    "%SRC_DIR%\sshfs-ssh-usage.c" ^
+    "%SRC_DIR%\sshfs-ssh-watch.c" ^
+    "%SRC_DIR%\sshfs-ssh-sync.c" ^
+    "%SRC_DIR%\sshfs-ssh-exec.c" ^
+    "%SRC_DIR%\sshfs-ssh-fanout.c" ^
+    "%SRC_DIR%\sshfs-ssh-bench.c" ^
+    "%SRC_DIR%\sshfs-ssh-broker.c" ^
+    "%SRC_DIR%\sshfs-ssh-thumbs.c" ^
+    "%SRC_DIR%\sshfs-cmdline.c" ^
+    "%SRC_DIR%\sshfs-unc.c" ^
+    "%SRC_DIR%\sshfs-path.c" ^
+    "%SRC_DIR%\sshfs-remote.c" ^
+    "%SRC_DIR%\sshfs-extract.c" ^
+    "%SRC_DIR%\sshfs-pack.c" ^
+    "%SRC_DIR%\sshfs-hash.c" ^
+    "%SRC_DIR%\sshfs-verify.c" ^
+    "%SRC_DIR%\sshfs-search.c" ^
+    "%SRC_DIR%\sshfs-index.c" ^
+    "%SRC_DIR%\sshfs-usage.c" ^
+    "%SRC_DIR%\sshfs-watch.c" ^
+    "%SRC_DIR%\sshfs-delta.c" ^
+    "%SRC_DIR%\sshfs-fanout.c" ^
+    "%SRC_DIR%\sshfs-bench.c" ^
+    "%SRC_DIR%\sshfs-broker.c" ^
+    "%SRC_DIR%\sshfs-cred.c" ^
+    "%SRC_DIR%\sshfs-tar.c" ^
+    "%SRC_DIR%\sshfs-thumb.c" ^
     /Fe:"%OUT_DIR%\sshfs-ssh.exe" ^
-    /link advapi32.lib mpr.lib shell32.lib shlwapi.lib user32.lib credui.lib
+    /link advapi32.lib bcrypt.lib mpr.lib shell32.lib shlwapi.lib user32.lib gdi32.lib comctl32.lib credui.lib ole32.lib uuid.lib
 if errorlevel 1 (
     echo ERROR: Failed to build sshfs-ssh.exe
     exit /b 1
 )
 echo   OK
 
-echo [4/4] Building sshfs-ssh-askpass.exe...
+:: The exec verb again as a console program, from the same objects
+echo [4/7] Building sshfs-exec.exe...
+cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE /Fo"%OUT_DIR%\\" ^
+    "%SRC_DIR%\sshfs-exec.c" ^
+    "%OUT_DIR%\ssh-obj\*.obj" ^
+    /Fe:"%OUT_DIR%\sshfs-exec.exe" ^
+    /link /SUBSYSTEM:CONSOLE advapi32.lib bcrypt.lib mpr.lib shell32.lib shlwapi.lib user32.lib gdi32.lib comctl32.lib credui.lib ole32.lib uuid.lib
+if errorlevel 1 (
+    echo ERROR: Failed to build sshfs-exec.exe
+    exit /b 1
+)
+rmdir /s /q "%OUT_DIR%\ssh-obj"
+echo   OK
+
+echo [5/7] Building sshfs-ssh-askpass.exe...
 cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE ^
     "%SRC_DIR%\sshfs-ssh-askpass.c" ^
+    "%SRC_DIR%\sshfs-broker.c" ^
+    "%SRC_DIR%\sshfs-hash.c" ^
     /Fe:"%OUT_DIR%\sshfs-ssh-askpass.exe" ^
-    /link /SUBSYSTEM:CONSOLE
+    /link advapi32.lib /SUBSYSTEM:CONSOLE
 if errorlevel 1 (
     echo ERROR: Failed to build sshfs-ssh-askpass.exe
     exit /b 1
 )
 echo   OK
 
+echo [6/7] Building sshfs-ssh-launcher.exe...
+cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE ^
+    "%SRC_DIR%\sshfs-ssh-launcher.c" ^
+    "%SRC_DIR%\sshfs-cmdline.c" ^
+    "%SRC_DIR%\sshfs-relay.c" ^
+    "%SRC_DIR%\sshfs-predict.c" ^
+    "%SRC_DIR%\sshfs-input.c" ^
+    "%SRC_DIR%\sshfs-stats.c" ^
+    "%SRC_DIR%\sshfs-record.c" ^
+    "%SRC_DIR%\sshfs-gzip.c" ^
+    "%SRC_DIR%\sshfs-cwd.c" ^
+    "%SRC_DIR%\sshfs-path.c" ^
+    "%SRC_DIR%\sshfs-reconnect.c" ^
+    "%SRC_DIR%\sshfs-remote.c" ^
+    /Fe:"%OUT_DIR%\sshfs-ssh-launcher.exe" ^
+    /link /SUBSYSTEM:CONSOLE
+if errorlevel 1 (
+    echo ERROR: Failed to build sshfs-ssh-launcher.exe
+    exit /b 1
+)
+echo   OK
+
+echo [7/7] Building sshfs-ssh-connect.exe...
+cl.exe /nologo /O2 /W3 /DUNICODE /D_UNICODE ^
+    "%SRC_DIR%\sshfs-ssh-connect.c" ^
+    "%SRC_DIR%\sshfs-connect.c" ^
+    /Fe:"%OUT_DIR%\sshfs-ssh-connect.exe" ^
+    /link /SUBSYSTEM:CONSOLE ws2_32.lib
+if errorlevel 1 (
+    echo ERROR: Failed to build sshfs-ssh-connect.exe
+    exit /b 1
+)
+echo   OK
+
 del /q "%OUT_DIR%\*.obj" 2>nul
 del /q "%OUT_DIR%\*.exp" 2>nul
 del /q "%OUT_DIR%\*.lib" 2>nul
@@ -101,7 +188,10 @@ echo.
 echo Build complete:
 echo   bin\sshfs-ctx.dll
 echo   bin\sshfs-ssh.exe
+echo   bin\sshfs-exec.exe
 echo   bin\sshfs-ssh-askpass.exe
+echo   bin\sshfs-ssh-launcher.exe
+echo   bin\sshfs-ssh-connect.exe
 echo.
 echo Next: install.bat (as admin)
 echo.
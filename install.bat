@@ -56,9 +56,14 @@ echo   OK
 
 :: Step 2: Copy files
 echo [2/3] Copying files to !TARGET_DIR!...
+:: A running credential broker (sshfs-ssh.exe --broker) keeps the old exe in use
+taskkill /f /im sshfs-ssh.exe >nul 2>&1
 copy /Y "!SRC_DIR!\sshfs-ctx.dll" "!TARGET_DIR!\" >nul
 copy /Y "!SRC_DIR!\sshfs-ssh.exe" "!TARGET_DIR!\" >nul
+copy /Y "!SRC_DIR!\sshfs-exec.exe" "!TARGET_DIR!\" >nul
 copy /Y "!SRC_DIR!\sshfs-ssh-askpass.exe" "!TARGET_DIR!\" >nul
+copy /Y "!SRC_DIR!\sshfs-ssh-launcher.exe" "!TARGET_DIR!\" >nul
+copy /Y "!SRC_DIR!\sshfs-ssh-connect.exe" "!TARGET_DIR!\" >nul
 echo   OK
 
 :: Step 3: Register the shell extension
@@ -0,0 +1,176 @@
+/**
+ * sshfs-bench.c
+ *
+ * Connection phase timing (see sshfs-bench.h)
+ */
+
+#include "sshfs-bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Lines that end a phase. The first match counts: ssh -v repeats some of
+ * them (e.g. per address tried).
+ */
+static const struct {
+    BenchPhase phase;
+    const char *pszText;
+} g_markers[] = {
+    {BENCH_RESOLVE, "debug1: Connecting to "},
+    {BENCH_CONNECT, "debug1: Connection established"},
+    {BENCH_KEX,     "debug1: SSH2_MSG_NEWKEYS received"},
+    {BENCH_AUTH,    "Authenticated to "},
+    {BENCH_AUTH,    "debug1: Authentication succeeded"},
+    {BENCH_SESSION, "#sshfs-bench session"},
+    {BENCH_CD,      "#sshfs-bench cd"},
+    {BENCH_SHELL,   "#sshfs-bench shell"},
+};
+
+static const char *g_names[BENCH_PHASES + 1] = {
+    "resolve", "connect", "kex", "auth", "session", "cd", "shell", "total"
+};
+
+void BenchRunInit(BenchRun *r)
+{
+    int i;
+
+    for (i = 0; i < BENCH_PHASES; i++)
+        r->msEnd[i] = -1;
+    r->szError[0] = '\0';
+    r->cbLine = 0;
+}
+
+static void ParseLine(BenchRun *r, const char *pszLine, double msNow)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(g_markers) / sizeof(g_markers[0]); i++)
+    {
+        if (strstr(pszLine, g_markers[i].pszText))
+        {
+            if (r->msEnd[g_markers[i].phase] < 0)
+                r->msEnd[g_markers[i].phase] = msNow;
+            return;
+        }
+    }
+
+    /* What ssh or the shell said when it failed */
+    if (pszLine[0] && strncmp(pszLine, "debug", 5) != 0 && strncmp(pszLine, "OpenSSH_", 8) != 0)
+        snprintf(r->szError, sizeof(r->szError), "%.*s", (int)sizeof(r->szError) - 1, pszLine);
+}
+
+void BenchFeed(BenchRun *r, const char *data, size_t len, double msNow)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        char c = data[i];
+
+        if (c == '\n' || c == '\r')
+        {
+            if (r->cbLine)
+            {
+                r->line[r->cbLine] = '\0';
+                ParseLine(r, r->line, msNow);
+                r->cbLine = 0;
+            }
+        }
+        else if (r->cbLine < sizeof(r->line) - 1)
+            r->line[r->cbLine++] = c;   /* Longer lines are cut: the markers are at the start */
+    }
+}
+
+BenchPhase BenchRunReached(const BenchRun *r)
+{
+    int i;
+
+    for (i = 0; i < BENCH_PHASES; i++)
+        if (r->msEnd[i] < 0)
+            return (BenchPhase)i;
+    return BENCH_PHASES;
+}
+
+const char *BenchPhaseName(BenchPhase phase)
+{
+    return phase <= BENCH_PHASES ? g_names[phase] : "?";
+}
+
+void BenchSeriesInit(BenchSeries *s)
+{
+    s->nOk = 0;
+    s->nRuns = 0;
+}
+
+int BenchSeriesAdd(BenchSeries *s, const BenchRun *r)
+{
+    double msPrev = 0;
+    int i;
+
+    s->nRuns++;
+    if (BenchRunReached(r) != BENCH_PHASES || s->nOk >= BENCH_MAX_RUNS)
+        return 0;
+
+    /* Phases are measured from the end of the previous one; a marker seen
+       out of order (both in one read) counts as taking no time */
+    for (i = 0; i < BENCH_PHASES; i++)
+    {
+        double ms = r->msEnd[i] - msPrev;
+
+        s->ms[i][s->nOk] = ms > 0 ? ms : 0;
+        if (r->msEnd[i] > msPrev)
+            msPrev = r->msEnd[i];
+    }
+    s->ms[BENCH_TOTAL][s->nOk] = msPrev;
+    s->nOk++;
+    return 1;
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+void BenchSummarize(double *pValues, size_t n, BenchStat *pStat)
+{
+    size_t rank95;
+
+    qsort(pValues, n, sizeof(double), CompareDouble);
+    pStat->min = pValues[0];
+    pStat->median = n % 2 ? pValues[n / 2] : (pValues[n / 2 - 1] + pValues[n / 2]) / 2;
+
+    /* Nearest rank: the smallest value with at least 95% at or below it */
+    rank95 = (n * 95 + 99) / 100;
+    pStat->p95 = pValues[rank95 - 1];
+}
+
+size_t BenchFormatSeries(BenchSeries *s, const char *pszLabel, char *out, size_t cbOut)
+{
+    size_t pos = 0;
+    int i, n;
+
+#define APPEND(...) \
+    do { \
+        n = snprintf(out + (pos < cbOut ? pos : cbOut), pos < cbOut ? cbOut - pos : 0, __VA_ARGS__); \
+        if (n > 0) pos += (size_t)n; \
+    } while (0)
+
+    APPEND("%s: %d of %d runs completed\n", pszLabel, (int)s->nOk, (int)s->nRuns);
+    if (s->nOk == 0)
+        return pos;
+
+    APPEND("  %-8s %10s %10s %10s\n", "phase", "min ms", "median ms", "p95 ms");
+    for (i = 0; i <= BENCH_PHASES; i++)
+    {
+        BenchStat stat;
+
+        BenchSummarize(s->ms[i], s->nOk, &stat);
+        APPEND("  %-8s %10.1f %10.1f %10.1f\n", g_names[i], stat.min, stat.median, stat.p95);
+    }
+#undef APPEND
+    return pos;
+}
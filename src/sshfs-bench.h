@@ -0,0 +1,91 @@
+/**
+ * sshfs-bench.h
+ *
+ * Connection phase timing for "sshfs-ssh --bench": where the time goes
+ * between starting ssh and having a shell in the folder. Each run is ssh -v
+ * with RemoteBuildBenchCommand() as the command, both output streams on one
+ * pipe; every line is stamped when it arrives and the phases end on
+ * OpenSSH's debug1 messages and the command's "#sshfs-bench" markers.
+ *
+ * Shared by sshfs-ssh.exe and the Linux sshfs-ssh, which only do the
+ * process handling and the clock.
+ */
+
+#ifndef SSHFS_BENCH_H
+#define SSHFS_BENCH_H
+
+#include <stddef.h>
+
+#define BENCH_MAX_RUNS      1000
+#define BENCH_DEFAULT_RUNS  5
+
+typedef enum {
+    BENCH_RESOLVE,      /* Config, name lookup: until "Connecting to" */
+    BENCH_CONNECT,      /* TCP handshake: until "Connection established" */
+    BENCH_KEX,          /* Version banners and key exchange: until NEWKEYS is received */
+    BENCH_AUTH,         /* Until "Authenticated to" ("Authentication succeeded" before 8.9) */
+    BENCH_SESSION,      /* Channel open, sshd starting the command in the login shell */
+    BENCH_CD,           /* cd into the folder */
+    BENCH_SHELL,        /* Interactive shell startup (rc files) */
+    BENCH_PHASES
+} BenchPhase;
+
+#define BENCH_TOTAL BENCH_PHASES    /* Column of the whole launch in BenchSeries */
+
+/**
+ * One run as it is read
+ */
+typedef struct BenchRun {
+    double msEnd[BENCH_PHASES];     /* Since ssh was started, < 0 until seen */
+    char szError[256];              /* Last line that was neither debug output nor a marker */
+    char line[1024];                /* Partial line carried between reads */
+    size_t cbLine;
+} BenchRun;
+
+void BenchRunInit(BenchRun *r);
+
+/**
+ * Feed output read msNow after ssh was started (CR/LF tolerant, lines may
+ * span reads)
+ */
+void BenchFeed(BenchRun *r, const char *data, size_t len, double msNow);
+
+/**
+ * The phase a run stopped before, BENCH_PHASES if it completed
+ */
+BenchPhase BenchRunReached(const BenchRun *r);
+
+const char *BenchPhaseName(BenchPhase phase);
+
+/**
+ * Phase durations of the completed runs of one variant
+ */
+typedef struct BenchSeries {
+    double ms[BENCH_PHASES + 1][BENCH_MAX_RUNS];
+    size_t nOk, nRuns;
+} BenchSeries;
+
+void BenchSeriesInit(BenchSeries *s);
+
+/**
+ * Count a run; its durations are kept if it completed. Returns 1 if it did.
+ */
+int BenchSeriesAdd(BenchSeries *s, const BenchRun *r);
+
+typedef struct BenchStat {
+    double min, median, p95;
+} BenchStat;
+
+/**
+ * Min, median and 95th percentile (nearest rank) of n values, which are
+ * sorted in place. n must be at least 1.
+ */
+void BenchSummarize(double *pValues, size_t n, BenchStat *pStat);
+
+/**
+ * Report of a series as a text table (one row per phase and the total, in
+ * milliseconds), headed by pszLabel. Sorts the series. Works like snprintf.
+ */
+size_t BenchFormatSeries(BenchSeries *s, const char *pszLabel, char *out, size_t cbOut);
+
+#endif /* SSHFS_BENCH_H */
@@ -0,0 +1,565 @@
+/**
+ * sshfs-broker.c
+ *
+ * Credential broker cache and protocol (see sshfs-broker.h)
+ */
+
+#ifdef _WIN32
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+#endif
+
+#include "sshfs-broker.h"
+#include "sshfs-hash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <sddl.h>
+#include <strsafe.h>
+#include <tlhelp32.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "advapi32.lib")
+#endif
+#endif
+
+void BrokerZero(void *p, size_t cb)
+{
+    volatile unsigned char *pb = (volatile unsigned char *)p;
+
+    while (cb--)
+        *pb++ = 0;
+}
+
+size_t BrokerHexEncode(const void *data, size_t cb, char *out, size_t cchOut)
+{
+    static const char digits[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+
+    for (i = 0; i < cb && i * 2 + 2 < cchOut; i++)
+    {
+        out[i * 2] = digits[p[i] >> 4];
+        out[i * 2 + 1] = digits[p[i] & 15];
+    }
+    if (cchOut)
+        out[i * 2 < cchOut ? i * 2 : cchOut - 1] = '\0';
+    return cb * 2;
+}
+
+static int HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+size_t BrokerHexDecode(const char *pszHex, size_t cchHex, void *out, size_t cbOut)
+{
+    unsigned char *p = (unsigned char *)out;
+    size_t i;
+
+    if (cchHex % 2 || cchHex / 2 > cbOut)
+        return (size_t)-1;
+    for (i = 0; i < cchHex / 2; i++)
+    {
+        int hi = HexDigit(pszHex[i * 2]), lo = HexDigit(pszHex[i * 2 + 1]);
+
+        if (hi < 0 || lo < 0)
+        {
+            BrokerZero(out, i);
+            return (size_t)-1;
+        }
+        p[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return cchHex / 2;
+}
+
+/**
+ * SHA-256 of a domain byte, the prekey, and two counters: the keystream
+ * blocks ('S') and grant tokens ('T') both come from here
+ */
+static void DeriveBlock(const Broker *b, char domain, unsigned long long n, unsigned int block,
+    unsigned char out[HASH_SIZE])
+{
+    unsigned char counters[12];
+    Sha256 h;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        counters[i] = (unsigned char)(n >> (8 * i));
+    for (i = 0; i < 4; i++)
+        counters[8 + i] = (unsigned char)(block >> (8 * i));
+
+    Sha256Init(&h);
+    Sha256Update(&h, &domain, 1);
+    Sha256Update(&h, b->prekey, sizeof(b->prekey));
+    Sha256Update(&h, counters, sizeof(counters));
+    Sha256Final(&h, out);
+    BrokerZero(&h, sizeof(h));
+}
+
+/**
+ * XOR data with the keystream for nonce (shields and unshields alike)
+ */
+static void Shield(const Broker *b, unsigned long long nonce, unsigned char *data, size_t cb)
+{
+    unsigned char stream[HASH_SIZE];
+    size_t i;
+
+    for (i = 0; i < cb; i++)
+    {
+        if (i % HASH_SIZE == 0)
+            DeriveBlock(b, 'S', nonce, (unsigned int)(i / HASH_SIZE), stream);
+        data[i] ^= stream[i % HASH_SIZE];
+    }
+    BrokerZero(stream, sizeof(stream));
+}
+
+static void StoreSecret(Broker *b, BrokerSecret *s, const unsigned char *data, size_t cb)
+{
+    s->nonce = b->nextNonce++;
+    s->cb = cb;
+    memcpy(s->data, data, cb);
+    Shield(b, s->nonce, s->data, cb);
+}
+
+/**
+ * "OK <hex>\n" of a stored secret, unshielded only on the way out
+ */
+static size_t FormatSecret(const Broker *b, const BrokerSecret *s, char *pszResponse, size_t cchResponse)
+{
+    unsigned char clear[BROKER_MAX_SECRET];
+    size_t cch;
+
+    if (cchResponse < 4 + s->cb * 2 + 2)
+        return (size_t)snprintf(pszResponse, cchResponse, "NO\n");
+    memcpy(clear, s->data, s->cb);
+    Shield(b, s->nonce, clear, s->cb);
+    memcpy(pszResponse, "OK ", 3);
+    cch = 3 + BrokerHexEncode(clear, s->cb, pszResponse + 3, cchResponse - 3);
+    BrokerZero(clear, sizeof(clear));
+    pszResponse[cch++] = '\n';
+    pszResponse[cch] = '\0';
+    return cch;
+}
+
+void BrokerInit(Broker *b, const void *prekey, size_t cbPrekey, int ttl)
+{
+    BrokerZero(b, sizeof(*b));
+    memcpy(b->prekey, prekey, cbPrekey < sizeof(b->prekey) ? cbPrekey : sizeof(b->prekey));
+    b->nextNonce = 1;
+    b->ttl = ttl > 0 ? ttl : 0;
+}
+
+void BrokerWipe(Broker *b)
+{
+    BrokerZero(b, sizeof(*b));
+}
+
+void BrokerSweep(Broker *b, long long now)
+{
+    int i;
+
+    for (i = 0; i < BROKER_MAX_ENTRIES; i++)
+        if (b->entries[i].expiry && b->entries[i].expiry <= now)
+            BrokerZero(&b->entries[i], sizeof(b->entries[i]));
+    for (i = 0; i < BROKER_MAX_GRANTS; i++)
+        if (b->grants[i].expiry && b->grants[i].expiry <= now)
+            BrokerZero(&b->grants[i], sizeof(b->grants[i]));
+}
+
+int BrokerIdle(const Broker *b)
+{
+    int i;
+
+    for (i = 0; i < BROKER_MAX_ENTRIES; i++)
+        if (b->entries[i].expiry)
+            return 0;
+    for (i = 0; i < BROKER_MAX_GRANTS; i++)
+        if (b->grants[i].expiry)
+            return 0;
+    return 1;
+}
+
+static BrokerEntry *FindEntry(Broker *b, const char *pszKey)
+{
+    int i;
+
+    for (i = 0; i < BROKER_MAX_ENTRIES; i++)
+        if (b->entries[i].expiry && strcmp(b->entries[i].szKey, pszKey) == 0)
+            return &b->entries[i];
+    return NULL;
+}
+
+/**
+ * A free slot, or the one stored longest ago when all are taken
+ */
+static BrokerEntry *NewEntry(Broker *b)
+{
+    BrokerEntry *pOldest = &b->entries[0];
+    int i;
+
+    for (i = 0; i < BROKER_MAX_ENTRIES; i++)
+    {
+        if (!b->entries[i].expiry)
+            return &b->entries[i];
+        if (b->entries[i].secret.nonce < pOldest->secret.nonce)
+            pOldest = &b->entries[i];
+    }
+    BrokerZero(pOldest, sizeof(*pOldest));
+    return pOldest;
+}
+
+static BrokerGrant *NewGrant(Broker *b)
+{
+    BrokerGrant *pOldest = &b->grants[0];
+    int i;
+
+    for (i = 0; i < BROKER_MAX_GRANTS; i++)
+    {
+        if (!b->grants[i].expiry)
+            return &b->grants[i];
+        if (b->grants[i].secret.nonce < pOldest->secret.nonce)
+            pOldest = &b->grants[i];
+    }
+    BrokerZero(pOldest, sizeof(*pOldest));
+    return pOldest;
+}
+
+/**
+ * Compare tokens without stopping at the first difference
+ */
+static int TokenEqual(const char *a, const char *b)
+{
+    unsigned char diff = 0;
+    int i;
+
+    for (i = 0; i < BROKER_TOKEN_LEN; i++)
+    {
+        diff |= (unsigned char)(a[i] ^ b[i]);
+        if (!b[i])
+            return 0;
+    }
+    return diff == 0 && b[BROKER_TOKEN_LEN] == '\0';
+}
+
+/**
+ * Split "WORD rest": *ppArg points after the space (or at the end)
+ */
+static int IsCommand(const char *pszRequest, const char *pszWord, const char **ppArg)
+{
+    size_t cch = strlen(pszWord);
+
+    if (strncmp(pszRequest, pszWord, cch) != 0 || (pszRequest[cch] != ' ' && pszRequest[cch] != '\0'))
+        return 0;
+    *ppArg = pszRequest[cch] ? pszRequest + cch + 1 : pszRequest + cch;
+    return 1;
+}
+
+static int ValidKey(const char *pszKey, size_t cch)
+{
+    size_t i;
+
+    if (cch == 0 || cch >= BROKER_MAX_KEY)
+        return 0;
+    for (i = 0; i < cch; i++)
+        if ((unsigned char)pszKey[i] <= ' ')
+            return 0;
+    return 1;
+}
+
+size_t BrokerHandle(Broker *b, const char *pszRequest, const BrokerPeer *peer, long long now,
+    char *pszResponse, size_t cchResponse)
+{
+    unsigned char secret[BROKER_MAX_SECRET];
+    const char *pszArg;
+    size_t cbSecret, cchResponseLen;
+
+    BrokerSweep(b, now);
+
+    if (peer->role == BROKER_PEER_LAUNCHER && IsCommand(pszRequest, "CRED", &pszArg))
+    {
+        BrokerEntry *e = ValidKey(pszArg, strlen(pszArg)) ? FindEntry(b, pszArg) : NULL;
+
+        if (e)
+            return FormatSecret(b, &e->secret, pszResponse, cchResponse);
+    }
+    else if (peer->role == BROKER_PEER_LAUNCHER && IsCommand(pszRequest, "PUT", &pszArg))
+    {
+        const char *pszHex = strchr(pszArg, ' ');
+
+        if (pszHex && ValidKey(pszArg, (size_t)(pszHex - pszArg)))
+        {
+            char szKey[BROKER_MAX_KEY];
+            BrokerEntry *e;
+
+            memcpy(szKey, pszArg, (size_t)(pszHex - pszArg));
+            szKey[pszHex - pszArg] = '\0';
+            pszHex++;
+            cbSecret = BrokerHexDecode(pszHex, strlen(pszHex), secret, sizeof(secret));
+            if (cbSecret != (size_t)-1 && cbSecret > 0)
+            {
+                if (b->ttl > 0)
+                {
+                    e = FindEntry(b, szKey);
+                    if (e)
+                        BrokerZero(&e->secret, sizeof(e->secret));
+                    else
+                    {
+                        e = NewEntry(b);
+                        memcpy(e->szKey, szKey, strlen(szKey) + 1);
+                    }
+                    StoreSecret(b, &e->secret, secret, cbSecret);
+                    e->expiry = now + b->ttl;
+                }
+                BrokerZero(secret, sizeof(secret));
+                return (size_t)snprintf(pszResponse, cchResponse, "OK\n");
+            }
+        }
+    }
+    else if (peer->role == BROKER_PEER_LAUNCHER && IsCommand(pszRequest, "GRANT", &pszArg))
+    {
+        cbSecret = BrokerHexDecode(pszArg, strlen(pszArg), secret, sizeof(secret));
+        if (cbSecret != (size_t)-1 && cbSecret > 0)
+        {
+            BrokerGrant *g = NewGrant(b);
+            unsigned char digest[HASH_SIZE];
+            char szHex[HASH_HEX_LEN + 1];
+
+            DeriveBlock(b, 'T', b->nextNonce++, 0, digest);
+            HashToHex(digest, szHex);
+            memcpy(g->szToken, szHex, BROKER_TOKEN_LEN);
+            g->szToken[BROKER_TOKEN_LEN] = '\0';
+            BrokerZero(digest, sizeof(digest));
+            BrokerZero(szHex, sizeof(szHex));
+
+            StoreSecret(b, &g->secret, secret, cbSecret);
+            BrokerZero(secret, sizeof(secret));
+            g->ownerPid = peer->pid;
+            g->sshPid = 0;
+            g->nUses = BROKER_GRANT_USES;
+            g->expiry = now + BROKER_GRANT_TTL;
+            return (size_t)snprintf(pszResponse, cchResponse, "OK %s\n", g->szToken);
+        }
+    }
+    else if (peer->role == BROKER_PEER_ASKPASS && IsCommand(pszRequest, "GET", &pszArg))
+    {
+        int i;
+
+        for (i = 0; i < BROKER_MAX_GRANTS; i++)
+        {
+            BrokerGrant *g = &b->grants[i];
+
+            if (!g->expiry || !TokenEqual(g->szToken, pszArg))
+                continue;
+
+            /* askpass <- ssh <- the launch that asked for the grant */
+            if (peer->grandparentPid != g->ownerPid || (g->sshPid && g->sshPid != peer->parentPid))
+                break;
+            g->sshPid = peer->parentPid;
+
+            cchResponseLen = FormatSecret(b, &g->secret, pszResponse, cchResponse);
+            if (--g->nUses <= 0)
+                BrokerZero(g, sizeof(*g));
+            return cchResponseLen;
+        }
+    }
+    else if (peer->role == BROKER_PEER_LAUNCHER && IsCommand(pszRequest, "CLEAR", &pszArg))
+    {
+        BrokerZero(b->entries, sizeof(b->entries));
+        BrokerZero(b->grants, sizeof(b->grants));
+        return (size_t)snprintf(pszResponse, cchResponse, "OK\n");
+    }
+
+    BrokerZero(secret, sizeof(secret));
+    return (size_t)snprintf(pszResponse, cchResponse, "NO\n");
+}
+
+#ifdef _WIN32
+/**
+ * The current user's SID as text (free with LocalFree)
+ */
+static LPWSTR GetUserSidString(void)
+{
+    HANDLE hToken;
+    BYTE buffer[256];
+    TOKEN_USER *pUser = (TOKEN_USER *)buffer;
+    DWORD cb = sizeof(buffer);
+    LPWSTR pszSid = NULL;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hToken))
+        return NULL;
+    if (!GetTokenInformation(hToken, TokenUser, pUser, cb, &cb) ||
+        !ConvertSidToStringSidW(pUser->User.Sid, &pszSid))
+        pszSid = NULL;
+    CloseHandle(hToken);
+    return pszSid;
+}
+
+BOOL BrokerPipeName(LPWSTR pszName, DWORD cchName)
+{
+    LPWSTR pszSid = GetUserSidString();
+    BOOL bOk;
+
+    if (!pszSid)
+        return FALSE;
+    bOk = SUCCEEDED(StringCchPrintfW(pszName, cchName, L"\\\\.\\pipe\\SSHFS-Win-Broker-%s", pszSid));
+    LocalFree(pszSid);
+    return bOk;
+}
+
+HANDLE BrokerCreatePipe(BOOL bFirst)
+{
+    WCHAR szPipe[256];
+    WCHAR szSddl[256];
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, FALSE};
+    LPWSTR pszSid = GetUserSidString();
+    HANDLE hPipe = INVALID_HANDLE_VALUE;
+
+    if (!pszSid)
+        return INVALID_HANDLE_VALUE;
+
+    /* Protected DACL: full access for the user, nothing for anyone else */
+    StringCchPrintfW(szSddl, 256, L"D:P(A;;GA;;;%s)", pszSid);
+    if (BrokerPipeName(szPipe, 256) &&
+        ConvertStringSecurityDescriptorToSecurityDescriptorW(szSddl, SDDL_REVISION_1,
+            &sa.lpSecurityDescriptor, NULL))
+    {
+        hPipe = CreateNamedPipeW(szPipe,
+            PIPE_ACCESS_DUPLEX | (bFirst ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+            PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, BROKER_MAX_LINE, BROKER_MAX_LINE, 0, &sa);
+        LocalFree(sa.lpSecurityDescriptor);
+    }
+    LocalFree(pszSid);
+    return hPipe;
+}
+
+/**
+ * TRUE if the process runs as the same user as we do
+ */
+static BOOL IsOwnUser(HANDLE hProcess)
+{
+    HANDLE hOurs, hTheirs;
+    BYTE ours[256], theirs[256];
+    DWORD cb;
+    BOOL bSame = FALSE;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &hOurs))
+        return FALSE;
+    if (OpenProcessToken(hProcess, TOKEN_QUERY, &hTheirs))
+    {
+        bSame = GetTokenInformation(hOurs, TokenUser, ours, sizeof(ours), &cb) &&
+            GetTokenInformation(hTheirs, TokenUser, theirs, sizeof(theirs), &cb) &&
+            EqualSid(((TOKEN_USER *)ours)->User.Sid, ((TOKEN_USER *)theirs)->User.Sid);
+        CloseHandle(hTheirs);
+    }
+    CloseHandle(hOurs);
+    return bSame;
+}
+
+BOOL BrokerProcessIs(DWORD dwPid, LPCWSTR pszExeName)
+{
+    WCHAR szExpected[MAX_PATH], szImage[MAX_PATH];
+    DWORD cchImage = MAX_PATH;
+    WCHAR *pSlash;
+    HANDLE hProcess;
+    BOOL bOk;
+
+    if (!GetModuleFileNameW(NULL, szExpected, MAX_PATH) || !(pSlash = wcsrchr(szExpected, L'\\')))
+        return FALSE;
+    pSlash[1] = L'\0';
+    StringCchCatW(szExpected, MAX_PATH, pszExeName);
+
+    hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, dwPid);
+    if (!hProcess)
+        return FALSE;
+    bOk = QueryFullProcessImageNameW(hProcess, 0, szImage, &cchImage) &&
+        CompareStringOrdinal(szImage, -1, szExpected, -1, TRUE) == CSTR_EQUAL &&
+        IsOwnUser(hProcess);
+    CloseHandle(hProcess);
+    return bOk;
+}
+
+DWORD BrokerParentPid(DWORD dwPid)
+{
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    PROCESSENTRY32W pe = {sizeof(pe)};
+    DWORD dwParent = 0;
+
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+        return 0;
+    if (Process32FirstW(hSnapshot, &pe))
+    {
+        do
+        {
+            if (pe.th32ProcessID == dwPid)
+            {
+                dwParent = pe.th32ParentProcessID;
+                break;
+            }
+        } while (Process32NextW(hSnapshot, &pe));
+    }
+    CloseHandle(hSnapshot);
+    return dwParent;
+}
+
+BOOL BrokerCall(const char *pszRequest, char *pszResponse, DWORD cchResponse)
+{
+    WCHAR szPipe[256];
+    HANDLE hPipe;
+    DWORD dwMode = PIPE_READMODE_MESSAGE;
+    DWORD dwServer = 0, cbRead = 0;
+    char szRequest[BROKER_MAX_LINE + 2];
+    BOOL bOk;
+
+    pszResponse[0] = '\0';
+    if (!BrokerPipeName(szPipe, 256) ||
+        FAILED(StringCchPrintfA(szRequest, sizeof(szRequest), "%s\n", pszRequest)))
+        return FALSE;
+
+    hPipe = CreateFileW(szPipe, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+        SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY &&
+        WaitNamedPipeW(szPipe, 2000))
+        hPipe = CreateFileW(szPipe, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+            SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE)
+    {
+        BrokerZero(szRequest, sizeof(szRequest));
+        return FALSE;
+    }
+
+    /* Secrets only go to the sshfs-ssh.exe next to us */
+    if (!GetNamedPipeServerProcessId(hPipe, &dwServer) || !BrokerProcessIs(dwServer, L"sshfs-ssh.exe"))
+    {
+        BrokerZero(szRequest, sizeof(szRequest));
+        CloseHandle(hPipe);
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+
+    SetNamedPipeHandleState(hPipe, &dwMode, NULL, NULL);
+    bOk = TransactNamedPipe(hPipe, szRequest, (DWORD)strlen(szRequest),
+        pszResponse, cchResponse - 1, &cbRead, NULL);
+    BrokerZero(szRequest, sizeof(szRequest));
+    CloseHandle(hPipe);
+    if (!bOk)
+        return FALSE;
+
+    pszResponse[cbRead] = '\0';
+    while (cbRead > 0 && (pszResponse[cbRead - 1] == '\n' || pszResponse[cbRead - 1] == '\r'))
+        pszResponse[--cbRead] = '\0';
+    return TRUE;
+}
+#endif
@@ -0,0 +1,178 @@
+/**
+ * sshfs-broker.h
+ *
+ * Credential broker: "sshfs-ssh.exe --broker" keeps the passwords found in
+ * Credential Manager for a while, so a second launch to the same host does
+ * not scan the vault again, and hands them to sshfs-ssh-askpass.exe
+ * without putting them in an environment block.
+ *
+ * Instead of the password, sshfs-ssh.exe gives ssh.exe a grant token
+ * (SSHFS_ASKPASS_TOKEN). Askpass redeems it over the broker's pipe. The
+ * broker only answers an askpass whose parent ssh was started by the
+ * process that asked for the grant, binds the grant to that ssh on first
+ * use, and forgets it after BROKER_GRANT_USES answers or
+ * BROKER_GRANT_TTL seconds, whichever comes first.
+ *
+ * Secrets are kept XORed with a keystream (SHA-256 in counter mode over
+ * a random per-process key and a per-secret nonce), so a stray memory
+ * dump or swapped page holds no password in the clear; the platform code
+ * locks the Broker in memory as well.
+ *
+ * Requests and answers are single lines; secrets travel as hex:
+ *
+ *   CRED <key>           OK <hex>   cached secret for key ("user@host:port")
+ *   PUT <key> <hex>      OK         remember a secret for the cache TTL
+ *   GRANT <hex>          OK <token> one-time handoff of a secret to askpass
+ *   GET <token>          OK <hex>   askpass redeeming a grant
+ *   CLEAR                OK         forget everything
+ *
+ * Anything refused or unknown is answered with NO. The core below is
+ * platform neutral; sockets, peer identification and locking of the
+ * Broker are left to the caller, which serializes calls to BrokerHandle.
+ */
+
+#ifndef SSHFS_BROKER_H
+#define SSHFS_BROKER_H
+
+#include <stddef.h>
+
+#define BROKER_MAX_ENTRIES      64
+#define BROKER_MAX_GRANTS       64
+#define BROKER_MAX_KEY          512
+#define BROKER_MAX_SECRET       1024        /* Bytes, UTF-8 */
+#define BROKER_MAX_LINE         (BROKER_MAX_KEY + BROKER_MAX_SECRET * 2 + 16)
+#define BROKER_PREKEY_SIZE      256
+#define BROKER_TOKEN_LEN        32
+#define BROKER_GRANT_TTL        120         /* Seconds to redeem a grant */
+#define BROKER_GRANT_USES       3           /* ssh asks again after a wrong password */
+#define BROKER_DEFAULT_TTL      900         /* Seconds a cached secret is kept */
+
+/**
+ * Who sent a request, as the platform code identified it
+ */
+typedef enum BrokerRole {
+    BROKER_PEER_UNTRUSTED,
+    BROKER_PEER_LAUNCHER,   /* sshfs-ssh.exe from the broker's own folder */
+    BROKER_PEER_ASKPASS     /* sshfs-ssh-askpass.exe from there */
+} BrokerRole;
+
+typedef struct BrokerPeer {
+    BrokerRole role;
+    unsigned long pid;
+    unsigned long parentPid;        /* For askpass: the ssh that ran it */
+    unsigned long grandparentPid;   /* and the process that ran ssh */
+} BrokerPeer;
+
+typedef struct BrokerSecret {
+    unsigned char data[BROKER_MAX_SECRET];
+    size_t cb;
+    unsigned long long nonce;
+} BrokerSecret;
+
+typedef struct BrokerEntry {
+    char szKey[BROKER_MAX_KEY];
+    BrokerSecret secret;
+    long long expiry;               /* 0: free */
+} BrokerEntry;
+
+typedef struct BrokerGrant {
+    char szToken[BROKER_TOKEN_LEN + 1];
+    BrokerSecret secret;
+    unsigned long ownerPid;         /* Process that asked for the grant */
+    unsigned long sshPid;           /* Bound on first redemption */
+    int nUses;
+    long long expiry;               /* 0: free */
+} BrokerGrant;
+
+typedef struct Broker {
+    BrokerEntry entries[BROKER_MAX_ENTRIES];
+    BrokerGrant grants[BROKER_MAX_GRANTS];
+    unsigned char prekey[BROKER_PREKEY_SIZE];
+    unsigned long long nextNonce;
+    int ttl;                        /* Seconds; 0 caches nothing */
+} Broker;
+
+/**
+ * Start an empty broker. prekey is cbPrekey random bytes (only the first
+ * BROKER_PREKEY_SIZE are used); ttl is how long PUT secrets are kept.
+ */
+void BrokerInit(Broker *b, const void *prekey, size_t cbPrekey, int ttl);
+
+/**
+ * Answer one request line (without the line end) from peer at now (Unix
+ * seconds). The answer, with "\n", goes to pszResponse, which should have
+ * room for BROKER_MAX_LINE. Returns its length.
+ */
+size_t BrokerHandle(Broker *b, const char *pszRequest, const BrokerPeer *peer, long long now,
+    char *pszResponse, size_t cchResponse);
+
+/**
+ * Wipe entries and grants that expired by now
+ */
+void BrokerSweep(Broker *b, long long now);
+
+/**
+ * 1 if nothing is held, i.e. the broker process may as well exit
+ */
+int BrokerIdle(const Broker *b);
+
+/**
+ * Wipe the whole broker, keys included
+ */
+void BrokerWipe(Broker *b);
+
+/**
+ * Overwrite memory in a way the compiler keeps
+ */
+void BrokerZero(void *p, size_t cb);
+
+/**
+ * Lowercase hex of cb bytes; works like snprintf
+ */
+size_t BrokerHexEncode(const void *data, size_t cb, char *out, size_t cchOut);
+
+/**
+ * Bytes of a hex string into out. Returns the count, or (size_t)-1 for
+ * bad hex or too little room.
+ */
+size_t BrokerHexDecode(const char *pszHex, size_t cchHex, void *out, size_t cbOut);
+
+#ifdef _WIN32
+/*
+ * Pipe client for sshfs-ssh.exe and sshfs-ssh-askpass.exe, and the checks
+ * the broker and its clients make of each other
+ */
+#include <windows.h>
+
+/**
+ * \\.\pipe\SSHFS-Win-Broker-<user SID>
+ */
+BOOL BrokerPipeName(LPWSTR pszName, DWORD cchName);
+
+/**
+ * TRUE if process dwPid runs pszExeName from the folder this program was
+ * started from, as the same user
+ */
+BOOL BrokerProcessIs(DWORD dwPid, LPCWSTR pszExeName);
+
+/**
+ * Parent process id (0 if the process is not found)
+ */
+DWORD BrokerParentPid(DWORD dwPid);
+
+/**
+ * A new instance of the broker's pipe (message mode, local clients, the
+ * current user only). bFirst fails if the pipe exists already, i.e. if
+ * another broker, or something posing as one, got there first.
+ */
+HANDLE BrokerCreatePipe(BOOL bFirst);
+
+/**
+ * Send one request to the running broker and read the answer line
+ * (without "\n"). Fails with ERROR_FILE_NOT_FOUND if no broker runs, and
+ * with ERROR_ACCESS_DENIED if the pipe is not served by our sshfs-ssh.exe.
+ */
+BOOL BrokerCall(const char *pszRequest, char *pszResponse, DWORD cchResponse);
+#endif
+
+#endif /* SSHFS_BROKER_H */
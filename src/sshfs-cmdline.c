@@ -0,0 +1,67 @@
+/**
+ * sshfs-cmdline.c
+ *
+ * CreateProcess command-line quoting (see sshfs-cmdline.h)
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <wchar.h>
+
+#include "sshfs-cmdline.h"
+
+BOOL AppendQuotedArg(LPWSTR pszCmdLine, size_t cchCmdLine, LPCWSTR pszArg)
+{
+    size_t start = wcslen(pszCmdLine);
+    size_t len = start;
+    size_t nSlashes = 0;
+
+    /* Room is checked for the closing quote and the terminator each time */
+    if (len + 3 > cchCmdLine)
+        return FALSE;
+    pszCmdLine[len++] = L'"';
+
+    for (LPCWSTR p = pszArg; *p; p++)
+    {
+        if (*p == L'\\')
+        {
+            nSlashes++;
+        }
+        else
+        {
+            /* Backslashes are only special in front of a quote: double them and escape it */
+            if (*p == L'"')
+            {
+                if (len + nSlashes + 3 >= cchCmdLine)
+                    goto overflow;
+                for (; nSlashes > 0; nSlashes--)
+                    pszCmdLine[len++] = L'\\';
+                pszCmdLine[len++] = L'\\';
+            }
+            nSlashes = 0;
+        }
+        if (len + 3 > cchCmdLine)
+            goto overflow;
+        pszCmdLine[len++] = *p;
+    }
+
+    /* ...and in front of the closing quote */
+    if (len + nSlashes + 2 > cchCmdLine)
+        goto overflow;
+    for (; nSlashes > 0; nSlashes--)
+        pszCmdLine[len++] = L'\\';
+
+    pszCmdLine[len++] = L'"';
+    pszCmdLine[len] = L'\0';
+    return TRUE;
+
+overflow:
+    pszCmdLine[start] = L'\0';
+    return FALSE;
+}
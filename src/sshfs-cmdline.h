@@ -0,0 +1,19 @@
+/**
+ * sshfs-cmdline.h
+ *
+ * CreateProcess command-line quoting shared by sshfs-ssh.exe and
+ * sshfs-ssh-launcher.exe
+ */
+
+#ifndef SSHFS_CMDLINE_H
+#define SSHFS_CMDLINE_H
+
+#include <windows.h>
+
+/**
+ * Append one argument to a CreateProcess command line, quoted by the CRT's
+ * argv rules. Returns FALSE, leaving pszCmdLine as it was, if it does not fit.
+ */
+BOOL AppendQuotedArg(LPWSTR pszCmdLine, size_t cchCmdLine, LPCWSTR pszArg);
+
+#endif /* SSHFS_CMDLINE_H */
@@ -0,0 +1,401 @@
+/**
+ * sshfs-connect.c
+ *
+ * Parallel connect and address cache (see sshfs-connect.h)
+ */
+
+#include "sshfs-connect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#define SOCKET_ERRNO()      WSAGetLastError()
+#define CONNECT_PENDING(e)  ((e) == WSAEWOULDBLOCK)
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#define SOCKET_ERRNO()      errno
+#define CONNECT_PENDING(e)  ((e) == EINPROGRESS)
+#endif
+
+static long long NowMs(void)
+{
+#ifdef _WIN32
+    return (long long)GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+static void SetBlocking(ConnectSocket s, int bBlocking)
+{
+#ifdef _WIN32
+    u_long nonBlocking = bBlocking ? 0 : 1;
+
+    ioctlsocket((SOCKET)s, FIONBIO, &nonBlocking);
+#else
+    int flags = fcntl(s, F_GETFL);
+
+    fcntl(s, F_SETFL, bBlocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+#endif
+}
+
+static void FormatSocketError(int err, const char *pszAddr, char *pszError, size_t cchError)
+{
+#ifdef _WIN32
+    snprintf(pszError, cchError, "%s: connect failed (error %d)", pszAddr, err);
+#else
+    snprintf(pszError, cchError, "%s: %s", pszAddr, strerror(err));
+#endif
+}
+
+void ConnectClose(ConnectSocket s)
+{
+#ifdef _WIN32
+    closesocket((SOCKET)s);
+#else
+    close(s);
+#endif
+}
+
+int ConnectResolve(const char *pszHost, const char *pszPort, ConnectTarget *t,
+    char *pszError, size_t cchError)
+{
+    struct addrinfo hints, *pList, *p;
+    char szV6[CONNECT_MAX_ADDRS][64], szV4[CONNECT_MAX_ADDRS][64];
+    size_t n6 = 0, n4 = 0, i6 = 0, i4 = 0;
+    int bV6First = 0;
+    int err;
+
+    t->nAddrs = 0;
+    snprintf(t->szPort, sizeof(t->szPort), "%s", pszPort);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    err = getaddrinfo(pszHost, pszPort, &hints, &pList);
+    if (err != 0)
+    {
+#ifdef _WIN32
+        snprintf(pszError, cchError, "%s: name lookup failed (error %d)", pszHost, err);
+#else
+        snprintf(pszError, cchError, "%s: %s", pszHost, gai_strerror(err));
+#endif
+        return 0;
+    }
+
+    for (p = pList; p; p = p->ai_next)
+    {
+        char szAddr[64];
+        int bV6 = p->ai_family == AF_INET6;
+
+        if ((p->ai_family != AF_INET && !bV6) ||
+            getnameinfo(p->ai_addr, (socklen_t)p->ai_addrlen, szAddr, sizeof(szAddr), NULL, 0, NI_NUMERICHOST) != 0)
+            continue;
+        if (n6 + n4 == 0)
+            bV6First = bV6;
+        if (bV6 && n6 < CONNECT_MAX_ADDRS)
+            memcpy(szV6[n6++], szAddr, sizeof(szAddr));
+        else if (!bV6 && n4 < CONNECT_MAX_ADDRS)
+            memcpy(szV4[n4++], szAddr, sizeof(szAddr));
+    }
+    freeaddrinfo(pList);
+
+    /* Alternate the families, so one that is broken costs one attempt delay */
+    while (t->nAddrs < CONNECT_MAX_ADDRS && (i6 < n6 || i4 < n4))
+    {
+        int bV6Turn = bV6First ? i6 <= i4 : i6 < i4;
+        int bV6 = bV6Turn ? i6 < n6 : i4 >= n4;
+
+        memcpy(t->szAddr[t->nAddrs++], bV6 ? szV6[i6++] : szV4[i4++], 64);
+    }
+
+    if (t->nAddrs == 0)
+    {
+        snprintf(pszError, cchError, "%s: no IPv4 or IPv6 address", pszHost);
+        return 0;
+    }
+    return 1;
+}
+
+int ConnectPrefer(ConnectTarget *t, const char *pszAddr)
+{
+    char szAddr[64];
+    size_t i;
+
+    for (i = 0; i < t->nAddrs; i++)
+    {
+        if (strcmp(t->szAddr[i], pszAddr) == 0)
+        {
+            memcpy(szAddr, t->szAddr[i], sizeof(szAddr));
+            memmove(t->szAddr[1], t->szAddr[0], i * sizeof(t->szAddr[0]));
+            memcpy(t->szAddr[0], szAddr, sizeof(szAddr));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Start a non-blocking connect to address i. Returns the socket, with
+ * *pbDone set if it connected at once; CONNECT_INVALID if it failed.
+ */
+static ConnectSocket StartAttempt(const ConnectTarget *t, size_t i, int *pbDone,
+    char *pszError, size_t cchError)
+{
+    struct addrinfo hints, *pAddr;
+    ConnectSocket s;
+    int err;
+
+    *pbDone = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    if (getaddrinfo(t->szAddr[i], t->szPort, &hints, &pAddr) != 0)
+    {
+        snprintf(pszError, cchError, "%s: bad address", t->szAddr[i]);
+        return CONNECT_INVALID;
+    }
+
+    s = (ConnectSocket)socket(pAddr->ai_family, SOCK_STREAM, IPPROTO_TCP);
+    if (s == CONNECT_INVALID)
+    {
+        FormatSocketError(SOCKET_ERRNO(), t->szAddr[i], pszError, cchError);
+        freeaddrinfo(pAddr);
+        return CONNECT_INVALID;
+    }
+    SetBlocking(s, 0);
+
+    if (connect(s, pAddr->ai_addr, (socklen_t)pAddr->ai_addrlen) == 0)
+        *pbDone = 1;
+    else if (!CONNECT_PENDING(err = SOCKET_ERRNO()))
+    {
+        FormatSocketError(err, t->szAddr[i], pszError, cchError);
+        ConnectClose(s);
+        s = CONNECT_INVALID;
+    }
+    freeaddrinfo(pAddr);
+    return s;
+}
+
+ConnectSocket ConnectRace(const ConnectTarget *t, int msDelay, int msTimeout, size_t *piWinner,
+    char *pszError, size_t cchError)
+{
+    ConnectSocket sockets[CONNECT_MAX_ADDRS];
+    ConnectSocket winner = CONNECT_INVALID;
+    long long msStart = NowMs();
+    long long msNext = msStart;
+    size_t nStarted = 0, nPending = 0, i;
+    int one = 1;
+
+    snprintf(pszError, cchError, "no address to connect to");
+    while (winner == CONNECT_INVALID)
+    {
+        fd_set writable, failed;
+        struct timeval tv;
+        long long msNow = NowMs(), msWait;
+        int maxFd = 0;
+
+        if (msTimeout > 0 && msNow - msStart >= msTimeout)
+        {
+            snprintf(pszError, cchError, "timed out after %d ms", msTimeout);
+            break;
+        }
+
+        /* Next attempt when its delay is up or nothing else is pending */
+        if (nStarted < t->nAddrs && (msNow >= msNext || nPending == 0))
+        {
+            int bDone;
+
+            sockets[nStarted] = StartAttempt(t, nStarted, &bDone, pszError, cchError);
+            if (sockets[nStarted] != CONNECT_INVALID)
+            {
+                nPending++;
+                if (bDone)
+                {
+                    winner = sockets[nStarted];
+                    *piWinner = nStarted;
+                }
+            }
+            nStarted++;
+            msNext = msNow + msDelay;
+            continue;
+        }
+        if (nPending == 0)
+            break;
+
+        FD_ZERO(&writable);
+        FD_ZERO(&failed);
+        for (i = 0; i < nStarted; i++)
+        {
+            if (sockets[i] == CONNECT_INVALID)
+                continue;
+            FD_SET(sockets[i], &writable);
+            FD_SET(sockets[i], &failed);
+            if ((int)sockets[i] > maxFd)
+                maxFd = (int)sockets[i];
+        }
+
+        msWait = nStarted < t->nAddrs ? msNext - msNow : 1000;
+        if (msTimeout > 0 && msStart + msTimeout - msNow < msWait)
+            msWait = msStart + msTimeout - msNow;
+        if (msWait < 0)
+            msWait = 0;
+        tv.tv_sec = (long)(msWait / 1000);
+        tv.tv_usec = (long)(msWait % 1000) * 1000;
+        if (select(maxFd + 1, NULL, &writable, &failed, &tv) <= 0)
+            continue;
+
+        for (i = 0; i < nStarted && winner == CONNECT_INVALID; i++)
+        {
+            int err = 0;
+            socklen_t cbErr = sizeof(err);
+
+            if (sockets[i] == CONNECT_INVALID ||
+                (!FD_ISSET(sockets[i], &writable) && !FD_ISSET(sockets[i], &failed)))
+                continue;
+
+            getsockopt(sockets[i], SOL_SOCKET, SO_ERROR, (char *)&err, &cbErr);
+            if (err == 0 && !FD_ISSET(sockets[i], &failed))
+            {
+                winner = sockets[i];
+                *piWinner = i;
+                continue;
+            }
+
+            /* Failed: the next address need not wait for the delay */
+            FormatSocketError(err, t->szAddr[i], pszError, cchError);
+            ConnectClose(sockets[i]);
+            sockets[i] = CONNECT_INVALID;
+            nPending--;
+            msNext = NowMs();
+        }
+    }
+
+    for (i = 0; i < nStarted; i++)
+    {
+        if (sockets[i] != CONNECT_INVALID && sockets[i] != winner)
+            ConnectClose(sockets[i]);
+    }
+    if (winner != CONNECT_INVALID)
+    {
+        /* ssh cannot set this through the proxy, and keystrokes should not wait */
+        SetBlocking(winner, 1);
+        setsockopt(winner, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+    }
+    return winner;
+}
+
+/**
+ * Split a cache line: returns 1 if it has all four fields
+ */
+static int ParseCacheLine(const char *pszLine, size_t cchLine, char *pszHost, char *pszPort,
+    char *pszAddr, long long *pExpiry)
+{
+    char szLine[512];
+
+    if (cchLine >= sizeof(szLine))
+        return 0;
+    memcpy(szLine, pszLine, cchLine);
+    szLine[cchLine] = '\0';
+    return sscanf(szLine, "%255s %15s %63s %lld", pszHost, pszPort, pszAddr, pExpiry) == 4;
+}
+
+int ConnectCacheFind(const char *pszText, const char *pszHost, const char *pszPort, long long now,
+    char *pszAddr, size_t cchAddr)
+{
+    const char *p = pszText;
+
+    while (*p)
+    {
+        const char *pEnd = strchr(p, '\n');
+        size_t cch = pEnd ? (size_t)(pEnd - p) : strlen(p);
+        char szHost[256], szPort[16], szAddr[64];
+        long long expiry;
+
+        if (ParseCacheLine(p, cch, szHost, szPort, szAddr, &expiry) &&
+            expiry > now && strcmp(szHost, pszHost) == 0 && strcmp(szPort, pszPort) == 0)
+        {
+            snprintf(pszAddr, cchAddr, "%s", szAddr);
+            return 1;
+        }
+        p += cch + (pEnd ? 1 : 0);
+    }
+    return 0;
+}
+
+size_t ConnectCacheUpdate(const char *pszText, const char *pszHost, const char *pszPort,
+    const char *pszAddr, long long now, char *out, size_t cbOut)
+{
+    char szNew[512];
+    const char *p;
+    size_t cbKept = 0, cbSkip, pos = 0;
+    int cbNew = 0;
+    int pass;
+
+    if (pszAddr)
+    {
+        cbNew = snprintf(szNew, sizeof(szNew), "%s %s %s %lld\n",
+            pszHost, pszPort, pszAddr, now + CONNECT_CACHE_TTL);
+        if (cbNew < 0 || (size_t)cbNew >= sizeof(szNew))
+            cbNew = 0;
+    }
+
+    /* Pass 0 measures what is kept, pass 1 writes it minus the oldest lines
+       that do not fit; the new entry goes last */
+    for (pass = 0; pass < 2; pass++)
+    {
+        cbSkip = cbKept + (size_t)cbNew > CONNECT_CACHE_MAX ? cbKept + (size_t)cbNew - CONNECT_CACHE_MAX : 0;
+        for (p = pszText; *p; )
+        {
+            const char *pEnd = strchr(p, '\n');
+            size_t cch = pEnd ? (size_t)(pEnd - p) : strlen(p);
+            char szHost[256], szPort[16], szAddr[64];
+            long long expiry;
+
+            if (ParseCacheLine(p, cch, szHost, szPort, szAddr, &expiry) && expiry > now &&
+                (strcmp(szHost, pszHost) != 0 || strcmp(szPort, pszPort) != 0))
+            {
+                if (pass == 0)
+                    cbKept += cch + 1;
+                else if (cbSkip > 0)
+                    cbSkip = cbSkip > cch + 1 ? cbSkip - (cch + 1) : 0;
+                else
+                {
+                    if (pos + cch + 1 < cbOut)
+                    {
+                        memcpy(out + pos, p, cch);
+                        out[pos + cch] = '\n';
+                    }
+                    pos += cch + 1;
+                }
+            }
+            p += cch + (pEnd ? 1 : 0);
+        }
+    }
+
+    if (pos + (size_t)cbNew < cbOut)
+        memcpy(out + pos, szNew, (size_t)cbNew);
+    pos += (size_t)cbNew;
+    if (cbOut > 0)
+        out[pos < cbOut ? pos : cbOut - 1] = '\0';
+    return pos;
+}
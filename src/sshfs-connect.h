@@ -0,0 +1,86 @@
+/**
+ * sshfs-connect.h
+ *
+ * Parallel TCP connect for sshfs-ssh-connect, the ProxyCommand helper
+ * (ParallelConnect). ssh tries a host's addresses one after the other, so
+ * a broken IPv6 route or an address behind a slow VPN holds a launch up
+ * for a whole connect timeout. Here the addresses are tried "happy
+ * eyeballs" style (RFC 8305): families interleaved, a new attempt started
+ * every CONNECT_ATTEMPT_DELAY_MS while the earlier ones are still pending,
+ * the first to connect wins. The winner is remembered per host and port
+ * for CONNECT_CACHE_TTL seconds and tried first next time.
+ *
+ * Sockets are Winsock on Windows and BSD sockets elsewhere; the cache is
+ * text handled in memory, the helpers read and replace the file.
+ */
+
+#ifndef SSHFS_CONNECT_H
+#define SSHFS_CONNECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONNECT_MAX_ADDRS           16
+#define CONNECT_ATTEMPT_DELAY_MS    250
+#define CONNECT_CACHE_TTL           (24 * 60 * 60)
+#define CONNECT_CACHE_MAX           4096            /* Bytes kept in the cache file */
+
+#ifdef _WIN32
+typedef uintptr_t ConnectSocket;                    /* SOCKET */
+#define CONNECT_INVALID ((ConnectSocket)~(uintptr_t)0)
+#else
+typedef int ConnectSocket;
+#define CONNECT_INVALID (-1)
+#endif
+
+/**
+ * The addresses of a host, numeric, in the order they are tried
+ */
+typedef struct ConnectTarget {
+    char szAddr[CONNECT_MAX_ADDRS][64];
+    size_t nAddrs;
+    char szPort[16];
+} ConnectTarget;
+
+/**
+ * Resolve pszHost (getaddrinfo's order, then alternating address families
+ * starting with the first one's). On Windows WSAStartup() must have been
+ * called. Returns 0 with a message in pszError if nothing was found.
+ */
+int ConnectResolve(const char *pszHost, const char *pszPort, ConnectTarget *t,
+    char *pszError, size_t cchError);
+
+/**
+ * Move pszAddr to the front if it is one of t's addresses. Returns 1 if it was.
+ */
+int ConnectPrefer(ConnectTarget *t, const char *pszAddr);
+
+/**
+ * Race connections to t's addresses: one more every msDelay, or at once when
+ * one fails. The winner is returned blocking, with TCP_NODELAY, its index in
+ * *piWinner; the others are closed. CONNECT_INVALID if all failed or
+ * msTimeout (0: none) passed, with the last error in pszError.
+ */
+ConnectSocket ConnectRace(const ConnectTarget *t, int msDelay, int msTimeout, size_t *piWinner,
+    char *pszError, size_t cchError);
+
+void ConnectClose(ConnectSocket s);
+
+/**
+ * Address remembered for pszHost/pszPort in cache text (lines of
+ * "host port address expiry"), if it has not expired by now (Unix time).
+ * Returns 1 and the address in pszAddr if there is one.
+ */
+int ConnectCacheFind(const char *pszText, const char *pszHost, const char *pszPort, long long now,
+    char *pszAddr, size_t cchAddr);
+
+/**
+ * New cache text with pszAddr remembered for pszHost/pszPort until
+ * now + CONNECT_CACHE_TTL, dropping expired entries and, past
+ * CONNECT_CACHE_MAX, the oldest ones. pszAddr NULL forgets the host.
+ * Works like snprintf.
+ */
+size_t ConnectCacheUpdate(const char *pszText, const char *pszHost, const char *pszPort,
+    const char *pszAddr, long long now, char *out, size_t cbOut);
+
+#endif /* SSHFS_CONNECT_H */
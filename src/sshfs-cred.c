@@ -0,0 +1,66 @@
+/**
+ * sshfs-cred.c
+ *
+ * Credential target matching (see sshfs-cred.h)
+ */
+
+#include "sshfs-cred.h"
+
+static CredChar Lower(CredChar c)
+{
+    return (c >= 'A' && c <= 'Z') ? (CredChar)(c + ('a' - 'A')) : c;
+}
+
+int CredPatternInit(CredPattern *p, const CredChar *pszUser, const CredChar *pszHost)
+{
+    size_t len = 0;
+
+    while (*pszUser && len < CRED_MAX_PATTERN)
+        p->text[len++] = Lower(*pszUser++);
+    if (len < CRED_MAX_PATTERN)
+        p->text[len++] = '@';
+    while (*pszHost && len < CRED_MAX_PATTERN)
+        p->text[len++] = Lower(*pszHost++);
+
+    p->len = len;
+    return !*pszUser && !*pszHost && len < CRED_MAX_PATTERN;
+}
+
+int CredTargetMatches(const CredPattern *p, const CredChar *pszTarget)
+{
+    const CredChar *t;
+
+    /* Lowercased as it goes instead of copying every target name first */
+    for (t = pszTarget; *t; t++)
+    {
+        size_t i;
+
+        if (Lower(*t) != p->text[0])
+            continue;
+        for (i = 1; i < p->len && t[i] && Lower(t[i]) == p->text[i]; i++)
+            ;
+        if (i == p->len)
+            return 1;
+        if (!t[i])
+            return 0;       /* Too little left for any later start */
+    }
+    return 0;
+}
+
+size_t CredFindTarget(const CredPattern *p, const CredChar *const *ppszTargets, size_t nTargets,
+    size_t iStart)
+{
+    size_t i;
+
+    for (i = iStart; i < nTargets; i++)
+        if (ppszTargets[i] && CredTargetMatches(p, ppszTargets[i]))
+            return i;
+    return nTargets;
+}
+
+int CredBlobIsUtf16(const void *blob, size_t cbBlob)
+{
+    const unsigned char *b = blob;
+
+    return cbBlob >= 4 && cbBlob % 2 == 0 && b[1] == 0 && b[3] == 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * sshfs-cred.h
+ *
+ * Matching of Credential Manager entries for sshfs-ssh.exe: which stored
+ * credential belongs to user@host, and how its password blob is encoded.
+ * SSHFS-Win and tools that mount with it name their credentials in
+ * different ways, so any target name that contains "user@host" (ignoring
+ * ASCII case) is taken.
+ *
+ * Strings are UTF-16 code units (WCHAR on Windows), so the enumeration
+ * loop needs no conversion per entry and the matching can be measured on
+ * Linux (sshfs-perf-cred.c).
+ */
+
+#ifndef SSHFS_CRED_H
+#define SSHFS_CRED_H
+
+#include <stddef.h>
+
+#define CRED_MAX_PATTERN 512
+
+typedef unsigned short CredChar;
+
+/**
+ * "user@host", lowercased once for all the targets it is compared with
+ */
+typedef struct CredPattern {
+    CredChar text[CRED_MAX_PATTERN];
+    size_t len;
+} CredPattern;
+
+/**
+ * Build the pattern for pszUser and pszHost. Returns 0 if it is too long.
+ */
+int CredPatternInit(CredPattern *p, const CredChar *pszUser, const CredChar *pszHost);
+
+/**
+ * 1 if pszTarget contains the pattern, ignoring ASCII case
+ */
+int CredTargetMatches(const CredPattern *p, const CredChar *pszTarget);
+
+/**
+ * Index of the first of ppszTargets from iStart on that matches (NULL
+ * entries never do), or nTargets
+ */
+size_t CredFindTarget(const CredPattern *p, const CredChar *const *ppszTargets, size_t nTargets,
+    size_t iStart);
+
+/**
+ * 1 if a password blob looks like UTF-16LE (even size, at least two
+ * characters, zero high bytes), 0 for the ANSI form some tools store
+ */
+int CredBlobIsUtf16(const void *blob, size_t cbBlob);
+
+#endif /* SSHFS_CRED_H */
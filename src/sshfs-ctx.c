@@ -2,11 +2,20 @@
  * sshfs-ctx.c
  *
  * Shell extension DLL for SSHFS-Win context menu
- * Provides "Open SSH Terminal Here" option only on SSHFS mounted drives
+ * Provides "Open SSH Terminal Here" only on SSHFS mounted drives, next to
+ * an "SSHFS" submenu with "Download via stream..." ("Upload here via
+ * stream" too on a folder background when files are on the clipboard),
+ * "Hash on server", "Compare with local folder...", "Search on server...",
+ * "Snapshot tree", "Disk usage on server", "Start or stop watching server
+ * changes" and "Sync file changes to server...", and "Copy/Move here on server" in the
+ * right-drag menu when the dragged items and the drop folder are on the
+ * same server (all run by sshfs-ssh.exe)
+ * Also provides thumbnails of images on SSHFS drives made on the server
+ * (sshfs-ssh.exe --thumbs), handing other files to the type's own provider
  *
  * This is a native Windows COM shell extension - no Cygwin dependencies
- * Compile with: cl /LD /O2 sshfs-ctx.c /link ole32.lib shell32.lib shlwapi.lib advapi32.lib mpr.lib
- * Or MinGW: gcc -shared -o sshfs-ctx.dll sshfs-ctx.c -lole32 -lshell32 -lshlwapi -ladvapi32 -lmpr -luuid
+ * Compile with: cl /LD /O2 sshfs-ctx.c sshfs-unc.c sshfs-path.c sshfs-thumb.c /link ole32.lib shell32.lib shlwapi.lib advapi32.lib mpr.lib windowscodecs.lib
+ * Or MinGW: gcc -shared -o sshfs-ctx.dll sshfs-ctx.c sshfs-unc.c sshfs-path.c sshfs-thumb.c -lole32 -lshell32 -lshlwapi -ladvapi32 -lmpr -luuid -lwindowscodecs
  */
 
 #define COBJMACROS
@@ -22,8 +31,12 @@
 #include <shlobj.h>
 #include <shlwapi.h>
 #include <shobjidl.h>
+#include <thumbcache.h>
+#include <wincodec.h>
 #include <strsafe.h>
 
+#include "sshfs-unc.h"
+
 /* Resource ID for embedded icon */
 #define IDI_MENUICON 101
 
@@ -31,6 +44,14 @@
 static const GUID CLSID_SSHFSContextMenu = 
     {0x7b3f4e8a, 0x1c2d, 0x4e5f, {0x9a, 0x8b, 0x0c, 0x1d, 0x2e, 0x3f, 0x4a, 0x5b}};
 
+/* {7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5C} - right-drag (drag and drop handler) */
+static const GUID CLSID_SSHFSDragDrop = 
+    {0x7b3f4e8a, 0x1c2d, 0x4e5f, {0x9a, 0x8b, 0x0c, 0x1d, 0x2e, 0x3f, 0x4a, 0x5c}};
+
+/* {7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5D} - thumbnails of images, made on the server */
+static const GUID CLSID_SSHFSThumbnail = 
+    {0x7b3f4e8a, 0x1c2d, 0x4e5f, {0x9a, 0x8b, 0x0c, 0x1d, 0x2e, 0x3f, 0x4a, 0x5d}};
+
 static HINSTANCE g_hInstance = NULL;
 static LONG g_RefCount = 0;
 static HBITMAP g_hMenuBitmap = NULL;
@@ -90,6 +111,25 @@ static BOOL IsSSHFSPath(LPCWSTR pszPath)
     return FALSE;
 }
 
+/**
+ * TRUE if more than one drive letter is an SSHFS mount, i.e. the same
+ * folder may be open on several servers
+ */
+static BOOL HasOtherSSHFSDrives(void)
+{
+    WCHAR szDrive[3] = {0, L':', 0};
+    DWORD dwDrives = GetLogicalDrives();
+    int d, nFound = 0;
+
+    for (d = 0; d < 26 && nFound < 2; d++)
+    {
+        szDrive[0] = (WCHAR)(L'A' + d);
+        if ((dwDrives & (1u << d)) && IsSSHFSPath(szDrive))
+            nFound++;
+    }
+    return nFound >= 2;
+}
+
 /**
  * Convert an HICON to HBITMAP with alpha channel for menu display
  * Windows Vista+ menus require 32-bit ARGB bitmaps for proper transparency
@@ -192,6 +232,51 @@ static BOOL GetInstallDir(LPWSTR pszPath, DWORD cchPath)
     return TRUE;
 }
 
+/**
+ * Start sshfs-ssh.exe with the given (already quoted) arguments
+ */
+static BOOL LaunchSSHFSSSH(LPCWSTR pszArgs)
+{
+    WCHAR szInstallDir[MAX_PATH];
+    WCHAR szExePath[MAX_PATH];
+    LPWSTR pszCmdLine;
+    size_t cchCmdLine = wcslen(pszArgs) + MAX_PATH + 16;
+    STARTUPINFOW si = {0};
+    PROCESS_INFORMATION pi = {0};
+    BOOL bResult;
+
+    pszCmdLine = CoTaskMemAlloc(cchCmdLine * sizeof(WCHAR));
+    if (!pszCmdLine)
+        return FALSE;
+
+    /* Build path to sshfs-ssh.exe */
+    GetInstallDir(szInstallDir, MAX_PATH);
+    StringCchPrintfW(szExePath, MAX_PATH, L"%sbin\\sshfs-ssh.exe", szInstallDir);
+
+    /* Build command line with quoted path */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" %s", szExePath, pszArgs);
+
+    /* Launch the SSH terminal opener */
+    si.cb = sizeof(si);
+    bResult = CreateProcessW(szExePath, pszCmdLine, NULL, NULL, FALSE,
+        0, NULL, NULL, &si, &pi);
+    if (!bResult)
+    {
+        /* Fallback: try without full path (if in PATH) */
+        StringCchPrintfW(pszCmdLine, cchCmdLine, L"sshfs-ssh.exe %s", pszArgs);
+        bResult = CreateProcessW(NULL, pszCmdLine, NULL, NULL, FALSE,
+            0, NULL, NULL, &si, &pi);
+    }
+    CoTaskMemFree(pszCmdLine);
+
+    if (!bResult)
+        return FALSE;
+
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return TRUE;
+}
+
 /* ------------------------------------------------------------------------- */
 /* IUnknown Implementation                                                    */
 /* ------------------------------------------------------------------------- */
@@ -203,6 +288,11 @@ struct SSHFSContextMenu
     LONG m_RefCount;
     WCHAR m_szPath[MAX_PATH];
     BOOL m_bIsSSHFS;
+    BOOL m_bBackground;         /* m_szPath is the folder the menu was opened in */
+
+    /* Drag and drop handler: m_szPath is the drop folder */
+    BOOL m_bDragDrop;
+    LPWSTR m_pszItems;          /* Dragged (or selected) items, quoted and space separated */
 };
 
 static HRESULT STDMETHODCALLTYPE ContextMenu_QueryInterface(
@@ -239,6 +329,7 @@ static ULONG STDMETHODCALLTYPE ContextMenu_Release(IContextMenu *This)
     LONG ref = InterlockedDecrement(&pExt->m_RefCount);
     if (ref == 0)
     {
+        CoTaskMemFree(pExt->m_pszItems);
         CoTaskMemFree(pExt);
         InterlockedDecrement(&g_RefCount);
     }
@@ -272,6 +363,128 @@ static ULONG STDMETHODCALLTYPE ShellExtInit_Release(IShellExtInit *This)
     return ContextMenu_Release((IContextMenu *)pExt);
 }
 
+/**
+ * Drag and drop handler: collect the dragged items if they and the drop
+ * folder are on one server. Drive letters are resolved once per run of
+ * items on the same drive, since WNetGetConnection is not free.
+ */
+static void InitializeDragDrop(SSHFSContextMenu *pExt, PCIDLIST_ABSOLUTE pidlFolder, IDataObject *pdtobj)
+{
+    FORMATETC fmt = {CF_HDROP, NULL, DVASPECT_CONTENT, -1, TYMED_HGLOBAL};
+    STGMEDIUM stg = {0};
+    SSHFSLocation *pTarget, *pItem;
+    WCHAR szItem[MAX_PATH];
+    WCHAR szLastDrive[3] = {0};
+    HDROP hDrop;
+    UINT nItems, i;
+    size_t cchItems, len;
+    BOOL bOk = FALSE;
+
+    if (!pidlFolder || !pdtobj || !SHGetPathFromIDListW(pidlFolder, pExt->m_szPath) ||
+        !IsSSHFSPath(pExt->m_szPath))
+        return;
+
+    pTarget = CoTaskMemAlloc(2 * sizeof(SSHFSLocation));
+    if (!pTarget)
+        return;
+    pItem = pTarget + 1;
+
+    if (ResolveSSHFSPath(pExt->m_szPath, pTarget) != RESOLVE_OK ||
+        FAILED(IDataObject_GetData(pdtobj, &fmt, &stg)))
+    {
+        CoTaskMemFree(pTarget);
+        return;
+    }
+
+    hDrop = (HDROP)GlobalLock(stg.hGlobal);
+    if (hDrop)
+    {
+        nItems = DragQueryFileW(hDrop, 0xFFFFFFFF, NULL, 0);
+        cchItems = (size_t)nItems * (MAX_PATH + 3) + 1;
+        pExt->m_pszItems = CoTaskMemAlloc(cchItems * sizeof(WCHAR));
+        bOk = pExt->m_pszItems != NULL && nItems > 0;
+        if (bOk)
+            pExt->m_pszItems[0] = L'\0';
+
+        for (i = 0; bOk && i < nItems; i++)
+        {
+            if (DragQueryFileW(hDrop, i, szItem, MAX_PATH) == 0)
+            {
+                bOk = FALSE;
+                break;
+            }
+
+            /* Drive and share roots cannot be copied or moved */
+            len = wcslen(szItem);
+            if (len == 0 || szItem[len - 1] == L'\\')
+            {
+                bOk = FALSE;
+                break;
+            }
+
+            if (szItem[1] != L':' || _wcsnicmp(szItem, szLastDrive, 2) != 0)
+            {
+                bOk = ResolveSSHFSPath(szItem, pItem) == RESOLVE_OK && SameSSHFSServer(pTarget, pItem);
+                StringCchCopyNW(szLastDrive, 3, szItem, szItem[1] == L':' ? 2 : 0);
+            }
+
+            if (bOk)
+            {
+                StringCchCatW(pExt->m_pszItems, cchItems, L" \"");
+                StringCchCatW(pExt->m_pszItems, cchItems, szItem);
+                StringCchCatW(pExt->m_pszItems, cchItems, L"\"");
+            }
+        }
+        GlobalUnlock(stg.hGlobal);
+    }
+    ReleaseStgMedium(&stg);
+    CoTaskMemFree(pTarget);
+
+    pExt->m_bIsSSHFS = bOk;
+}
+
+/**
+ * All selected items, quoted and space separated (for "Hash on server").
+ * Drive roots are left out. NULL if none remain.
+ */
+static LPWSTR QuoteSelection(HDROP hDrop)
+{
+    WCHAR szItem[MAX_PATH];
+    LPWSTR pszItems;
+    UINT nItems, i;
+    size_t cchItems;
+    BOOL bAny = FALSE;
+
+    nItems = DragQueryFileW(hDrop, 0xFFFFFFFF, NULL, 0);
+    cchItems = (size_t)nItems * (MAX_PATH + 3) + 1;
+    pszItems = CoTaskMemAlloc(cchItems * sizeof(WCHAR));
+    if (!pszItems)
+        return NULL;
+    pszItems[0] = L'\0';
+
+    for (i = 0; i < nItems; i++)
+    {
+        size_t len;
+
+        if (DragQueryFileW(hDrop, i, szItem, MAX_PATH) == 0)
+            continue;
+        len = wcslen(szItem);
+        if (len == 0 || szItem[len - 1] == L'\\')
+            continue;
+        StringCchCatW(pszItems, cchItems, L" \"");
+        StringCchCatW(pszItems, cchItems, szItem);
+        StringCchCatW(pszItems, cchItems, L"\"");
+        bAny = TRUE;
+    }
+
+    if (!bAny)
+    {
+        CoTaskMemFree(pszItems);
+        return NULL;
+    }
+    return pszItems;
+}
+
 static HRESULT STDMETHODCALLTYPE ShellExtInit_Initialize(
     IShellExtInit *This,
     PCIDLIST_ABSOLUTE pidlFolder,
@@ -287,6 +500,15 @@ static HRESULT STDMETHODCALLTYPE ShellExtInit_Initialize(
 
     pExt->m_szPath[0] = L'\0';
     pExt->m_bIsSSHFS = FALSE;
+    pExt->m_bBackground = FALSE;
+    CoTaskMemFree(pExt->m_pszItems);
+    pExt->m_pszItems = NULL;
+
+    if (pExt->m_bDragDrop)
+    {
+        InitializeDragDrop(pExt, pidlFolder, pdtobj);
+        return S_OK;
+    }
 
     /* Try to get the folder from data object (selected item) */
     if (pdtobj)
@@ -301,6 +523,8 @@ static HRESULT STDMETHODCALLTYPE ShellExtInit_Initialize(
                 {
                     pExt->m_bIsSSHFS = IsSSHFSPath(pExt->m_szPath);
                 }
+                if (pExt->m_bIsSSHFS)
+                    pExt->m_pszItems = QuoteSelection(hDrop);
                 GlobalUnlock(stg.hGlobal);
             }
             ReleaseStgMedium(&stg);
@@ -316,6 +540,7 @@ static HRESULT STDMETHODCALLTYPE ShellExtInit_Initialize(
         if (SHGetPathFromIDListW(pidlFolder, pExt->m_szPath))
         {
             pExt->m_bIsSSHFS = IsSSHFSPath(pExt->m_szPath);
+            pExt->m_bBackground = pExt->m_bIsSSHFS;
         }
     }
 
@@ -334,6 +559,123 @@ static IShellExtInitVtbl g_ShellExtInitVtbl = {
 /* ------------------------------------------------------------------------- */
 
 #define IDM_OPENSSH 0
+#define IDM_SERVERCOPY 1    /* Drag and drop menu */
+#define IDM_SERVERMOVE 2
+#define IDM_DOWNLOAD 3      /* Context menu, below IDM_OPENSSH */
+#define IDM_UPLOAD 4        /* Folder background, when files are on the clipboard */
+#define IDM_HASH 5
+#define IDM_COMPARE 6
+#define IDM_SEARCH 7
+#define IDM_SNAPSHOT 8
+#define IDM_USAGE 9
+#define IDM_WATCH 10      /* Starts or stops the mount's watcher */
+#define IDM_SYNC 11
+#define IDM_FANOUT 12
+
+/**
+ * What each command is called and what it starts
+ */
+typedef struct SSHFSVerb
+{
+    UINT id;
+    BOOL bDragDrop;             /* In the drag and drop menu, not the context menu */
+    LPCWSTR pszText;            /* In the menu; the context menu's below IDM_OPENSSH go in its submenu */
+    LPCSTR pszVerbA;
+    LPCWSTR pszVerbW;
+    LPCWSTR pszHelp;
+    LPCWSTR pszOption;          /* sshfs-ssh.exe option; NULL to open a terminal */
+    LPCWSTR pszFailure;         /* Shown if sshfs-ssh.exe could not be started */
+} SSHFSVerb;
+
+static const SSHFSVerb g_verbs[] = {
+    {IDM_OPENSSH, FALSE, L"Open SSH Terminal Here",
+        "sshfs_openssh", L"sshfs_openssh",
+        L"Open an SSH terminal to this location",
+        NULL, L"Failed to launch SSH terminal."},
+    {IDM_FANOUT, FALSE, L"Open SSH Terminal Here on all servers",
+        "sshfs_fanout", L"sshfs_fanout",
+        L"Open this folder on every SSHFS drive that has it, typing into all at once",
+        L"--fanout", L"Failed to start sshfs-ssh.exe."},
+    {IDM_SERVERCOPY, TRUE, L"Copy here on server",
+        "sshfs_servercopy", L"sshfs_servercopy",
+        L"Copy the items on the server without downloading them",
+        L"--copy", L"Failed to start the copy on the server."},
+    {IDM_SERVERMOVE, TRUE, L"Move here on server",
+        "sshfs_servermove", L"sshfs_servermove",
+        L"Move the items on the server without downloading them",
+        L"--move", L"Failed to start the copy on the server."},
+    {IDM_DOWNLOAD, FALSE, L"Download via stream...",
+        "sshfs_download", L"sshfs_download",
+        L"Download this folder as one compressed stream",
+        L"--download", L"Failed to start the download."},
+    {IDM_UPLOAD, FALSE, L"Upload here via stream",
+        "sshfs_upload", L"sshfs_upload",
+        L"Upload the copied files into this folder as one stream",
+        L"--upload", L"Failed to start the upload."},
+    {IDM_HASH, FALSE, L"Hash on server",
+        "sshfs_hash", L"sshfs_hash",
+        L"SHA-256 of the selected files, computed on the server",
+        L"--hash", L"Failed to start hashing on the server."},
+    {IDM_COMPARE, FALSE, L"Compare with local folder...",
+        "sshfs_compare", L"sshfs_compare",
+        L"Show the files that differ from a local folder, hashing both sides in place",
+        L"--compare", L"Failed to start hashing on the server."},
+    {IDM_SEARCH, FALSE, L"Search on server...",
+        "sshfs_search", L"sshfs_search",
+        L"Find files by name or content, searched by the server",
+        L"--search", L"Failed to start sshfs-ssh.exe."},
+    {IDM_SNAPSHOT, FALSE, L"Snapshot tree",
+        "sshfs_snapshot", L"sshfs_snapshot",
+        L"Index the whole mount locally and report what changed since the last snapshot",
+        L"--snapshot", L"Failed to start sshfs-ssh.exe."},
+    {IDM_USAGE, FALSE, L"Disk usage on server",
+        "sshfs_usage", L"sshfs_usage",
+        L"Folder sizes measured by du on the server, largest first",
+        L"--usage", L"Failed to start sshfs-ssh.exe."},
+    {IDM_WATCH, FALSE, L"Start or stop watching server changes",
+        "sshfs_watch", L"sshfs_watch",
+        L"Refresh Explorer when files on this mount change on the server, or stop doing so",
+        L"--watch", L"Failed to start sshfs-ssh.exe."},
+    {IDM_SYNC, FALSE, L"Sync file changes to server...",
+        "sshfs_sync", L"sshfs_sync",
+        L"Send only the changed blocks of a local file to its copy in this folder",
+        L"--sync", L"Failed to start sshfs-ssh.exe."}
+};
+
+static const SSHFSVerb *FindVerb(UINT_PTR idCmd, BOOL bDragDrop)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(g_verbs) / sizeof(g_verbs[0]); i++)
+    {
+        if (g_verbs[i].id == idCmd && g_verbs[i].bDragDrop == bDragDrop)
+            return &g_verbs[i];
+    }
+    return NULL;
+}
+
+/**
+ * Right-drag menu: offer copy/move on the server next to Explorer's own
+ */
+static HRESULT QueryDragDropMenu(HMENU hmenu, UINT indexMenu, UINT idCmdFirst, UINT idCmdLast)
+{
+    UINT idNext = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(g_verbs) / sizeof(g_verbs[0]); i++)
+    {
+        if (!g_verbs[i].bDragDrop || idCmdFirst + g_verbs[i].id > idCmdLast)
+            continue;
+        InsertMenuW(hmenu, indexMenu++, MF_BYPOSITION | MF_STRING,
+            idCmdFirst + g_verbs[i].id, g_verbs[i].pszText);
+        if (g_verbs[i].id >= idNext)
+            idNext = g_verbs[i].id + 1;
+    }
+    if (idNext)
+        InsertMenuW(hmenu, indexMenu, MF_BYPOSITION | MF_SEPARATOR, 0, NULL);
+
+    return MAKE_HRESULT(SEVERITY_SUCCESS, 0, idNext);
+}
 
 static HRESULT STDMETHODCALLTYPE ContextMenu_QueryContextMenu(
     IContextMenu *This,
@@ -345,7 +687,10 @@ static HRESULT STDMETHODCALLTYPE ContextMenu_QueryContextMenu(
 {
     SSHFSContextMenu *pExt = (SSHFSContextMenu *)This;
     MENUITEMINFOW mii = {0};
+    HMENU hSubMenu;
     HBITMAP hBmp;
+    UINT idNext = 0;
+    size_t i;
 
     /* Only add menu if this is an SSHFS path */
     if (!pExt->m_bIsSSHFS)
@@ -355,11 +700,17 @@ static HRESULT STDMETHODCALLTYPE ContextMenu_QueryContextMenu(
     if (uFlags & CMF_DEFAULTONLY)
         return MAKE_HRESULT(SEVERITY_SUCCESS, 0, 0);
 
+    if (pExt->m_bDragDrop)
+        return QueryDragDropMenu(hmenu, indexMenu, idCmdFirst, idCmdLast);
+
+    if (idCmdFirst + IDM_OPENSSH > idCmdLast)
+        return MAKE_HRESULT(SEVERITY_SUCCESS, 0, 0);
+
     mii.cbSize = sizeof(mii);
     mii.fMask = MIIM_ID | MIIM_STRING | MIIM_STATE;
     mii.fState = MFS_ENABLED;
     mii.wID = idCmdFirst + IDM_OPENSSH;
-    mii.dwTypeData = L"Open SSH Terminal Here";
+    mii.dwTypeData = (LPWSTR)FindVerb(IDM_OPENSSH, FALSE)->pszText;
 
     /* Add icon if available */
     hBmp = GetMenuBitmap();
@@ -371,8 +722,82 @@ static HRESULT STDMETHODCALLTYPE ContextMenu_QueryContextMenu(
 
     /* Insert at position 0 to place at top of context menu */
     InsertMenuItemW(hmenu, 0, TRUE, &mii);
+    idNext = IDM_OPENSSH + 1;
+
+    /* The rest go in one submenu below it, as many as Explorer has ids for.
+     * Nothing here asks the system or the server anything: whether there
+     * are other SSHFS drives or a watcher is running is found out on the
+     * click. */
+    hSubMenu = CreatePopupMenu();
+    if (!hSubMenu)
+        return MAKE_HRESULT(SEVERITY_SUCCESS, 0, idNext);
+    for (i = 0; i < sizeof(g_verbs) / sizeof(g_verbs[0]); i++)
+    {
+        if (g_verbs[i].bDragDrop || g_verbs[i].id == IDM_OPENSSH || idCmdFirst + g_verbs[i].id > idCmdLast)
+            continue;
 
-    return MAKE_HRESULT(SEVERITY_SUCCESS, 0, IDM_OPENSSH + 1);
+        /* The local files to send are the ones copied in Explorer */
+        if (g_verbs[i].id == IDM_UPLOAD && !(pExt->m_bBackground && IsClipboardFormatAvailable(CF_HDROP)))
+            continue;
+
+        AppendMenuW(hSubMenu, MF_STRING, idCmdFirst + g_verbs[i].id, g_verbs[i].pszText);
+        if (g_verbs[i].id >= idNext)
+            idNext = g_verbs[i].id + 1;
+    }
+    if (GetMenuItemCount(hSubMenu) <= 0)
+    {
+        DestroyMenu(hSubMenu);
+        return MAKE_HRESULT(SEVERITY_SUCCESS, 0, idNext);
+    }
+
+    mii.fMask = MIIM_SUBMENU | MIIM_STRING;
+    mii.hSubMenu = hSubMenu;
+    mii.dwTypeData = L"SSHFS";
+    InsertMenuItemW(hmenu, 1, TRUE, &mii);
+
+    return MAKE_HRESULT(SEVERITY_SUCCESS, 0, idNext);
+}
+
+/**
+ * --upload "<folder>" "<item>"... for the files on the clipboard
+ * (a root folder keeps its backslash escaped). NULL if there are none.
+ * Free with CoTaskMemFree.
+ */
+static LPWSTR BuildUploadArgs(LPCWSTR pszFolder)
+{
+    WCHAR szItem[MAX_PATH];
+    LPWSTR pszArgs = NULL;
+    HDROP hDrop;
+    UINT nItems, i;
+    size_t cchArgs;
+
+    if (!OpenClipboard(NULL))
+        return NULL;
+
+    hDrop = (HDROP)GetClipboardData(CF_HDROP);
+    nItems = hDrop ? DragQueryFileW(hDrop, 0xFFFFFFFF, NULL, 0) : 0;
+    if (nItems > 0)
+    {
+        cchArgs = (size_t)nItems * (MAX_PATH + 3) + MAX_PATH + 16;
+        pszArgs = CoTaskMemAlloc(cchArgs * sizeof(WCHAR));
+    }
+    if (pszArgs)
+    {
+        StringCchPrintfW(pszArgs, cchArgs, L"--upload \"%s%s\"",
+            pszFolder, pszFolder[wcslen(pszFolder) - 1] == L'\\' ? L"\\" : L"");
+        for (i = 0; i < nItems; i++)
+        {
+            /* Drive roots cannot be uploaded (and would escape the quote) */
+            if (DragQueryFileW(hDrop, i, szItem, MAX_PATH) == 0 || szItem[wcslen(szItem) - 1] == L'\\')
+                continue;
+            StringCchCatW(pszArgs, cchArgs, L" \"");
+            StringCchCatW(pszArgs, cchArgs, szItem);
+            StringCchCatW(pszArgs, cchArgs, L"\"");
+        }
+    }
+
+    CloseClipboard();
+    return pszArgs;
 }
 
 static HRESULT STDMETHODCALLTYPE ContextMenu_InvokeCommand(
@@ -380,50 +805,76 @@ static HRESULT STDMETHODCALLTYPE ContextMenu_InvokeCommand(
     CMINVOKECOMMANDINFO *pici)
 {
     SSHFSContextMenu *pExt = (SSHFSContextMenu *)This;
-    WCHAR szInstallDir[MAX_PATH];
-    WCHAR szExePath[MAX_PATH];
-    WCHAR szCmdLine[MAX_PATH * 2];
-    STARTUPINFOW si = {0};
-    PROCESS_INFORMATION pi = {0};
+    const SSHFSVerb *pVerb;
+    WCHAR szError[256];
+    LPCWSTR pszItems;
+    LPWSTR pszArgs;
+    size_t cchArgs;
+    UINT idCmd;
+    BOOL bResult;
 
     /* Check if invoked by command ID (not verb string) */
     if (HIWORD(pici->lpVerb) != 0)
         return E_INVALIDARG;
 
-    if (LOWORD(pici->lpVerb) != IDM_OPENSSH)
+    idCmd = LOWORD(pici->lpVerb);
+    pVerb = FindVerb(idCmd, pExt->m_bDragDrop);
+    if (!pVerb)
         return E_INVALIDARG;
 
     if (!pExt->m_bIsSSHFS || !pExt->m_szPath[0])
         return E_FAIL;
 
-    /* Build path to sshfs-ssh.exe */
-    GetInstallDir(szInstallDir, MAX_PATH);
-    StringCchPrintfW(szExePath, MAX_PATH, L"%sbin\\sshfs-ssh.exe", szInstallDir);
-
-    /* Build command line with quoted path */
-    StringCchPrintfW(szCmdLine, MAX_PATH * 2, L"\"%s\" \"%s\"", szExePath, pExt->m_szPath);
+    if (idCmd == IDM_FANOUT && !HasOtherSSHFSDrives())
+    {
+        MessageBoxW(NULL, L"This is the only SSHFS drive.\n\n"
+            L"A terminal is opened on every SSHFS drive that has the same folder.",
+            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONINFORMATION);
+        return S_OK;
+    }
 
-    /* Launch the SSH terminal opener */
-    si.cb = sizeof(si);
-    if (!CreateProcessW(szExePath, szCmdLine, NULL, NULL, FALSE, 
-        0, NULL, NULL, &si, &pi))
+    if (idCmd == IDM_UPLOAD)
     {
-        /* Fallback: try without full path (if in PATH) */
-        StringCchPrintfW(szCmdLine, MAX_PATH * 2, L"sshfs-ssh.exe \"%s\"", pExt->m_szPath);
-        if (!CreateProcessW(NULL, szCmdLine, NULL, NULL, FALSE,
-            0, NULL, NULL, &si, &pi))
+        pszArgs = BuildUploadArgs(pExt->m_szPath);
+        if (!pszArgs)
         {
-            MessageBoxW(NULL, L"Failed to launch SSH terminal.\n\n"
-                L"Make sure SSHFS-Win is properly installed.",
-                L"SSHFS-Win", MB_OK | MB_ICONERROR);
+            MessageBoxW(NULL, L"There are no files on the clipboard to upload.",
+                L"SSHFS-Win - Upload", MB_OK | MB_ICONINFORMATION);
             return E_FAIL;
         }
     }
+    else
+    {
+        /* <option> "<folder>" and the dragged or selected items of the
+         * verbs that take them (a root folder keeps its backslash escaped);
+         * a terminal gets the folder alone. --hash on its own items goes
+         * without the folder. */
+        pszItems = idCmd == IDM_SERVERCOPY || idCmd == IDM_SERVERMOVE || idCmd == IDM_HASH
+            ? pExt->m_pszItems : NULL;
+        cchArgs = (pszItems ? wcslen(pszItems) : 0) + MAX_PATH + 16;
+        pszArgs = CoTaskMemAlloc(cchArgs * sizeof(WCHAR));
+        if (!pszArgs)
+            return E_OUTOFMEMORY;
+        if (!pVerb->pszOption)
+            StringCchPrintfW(pszArgs, cchArgs, L"\"%s\"", pExt->m_szPath);
+        else if (idCmd == IDM_HASH && pszItems)
+            StringCchPrintfW(pszArgs, cchArgs, L"%s%s", pVerb->pszOption, pszItems);
+        else
+            StringCchPrintfW(pszArgs, cchArgs, L"%s \"%s%s\"%s",
+                pVerb->pszOption,
+                pExt->m_szPath,
+                pExt->m_szPath[wcslen(pExt->m_szPath) - 1] == L'\\' ? L"\\" : L"",
+                pszItems ? pszItems : L"");
+    }
 
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
+    bResult = LaunchSSHFSSSH(pszArgs);
+    CoTaskMemFree(pszArgs);
+    if (bResult)
+        return S_OK;
 
-    return S_OK;
+    StringCchPrintfW(szError, 256, L"%s\n\nMake sure SSHFS-Win is properly installed.", pVerb->pszFailure);
+    MessageBoxW(NULL, szError, L"SSHFS-Win", MB_OK | MB_ICONERROR);
+    return E_FAIL;
 }
 
 static HRESULT STDMETHODCALLTYPE ContextMenu_GetCommandString(
@@ -434,23 +885,23 @@ static HRESULT STDMETHODCALLTYPE ContextMenu_GetCommandString(
     CHAR *pszName,
     UINT cchMax)
 {
-    if (idCmd != IDM_OPENSSH)
+    SSHFSContextMenu *pExt = (SSHFSContextMenu *)This;
+    const SSHFSVerb *pVerb = FindVerb(idCmd, pExt->m_bDragDrop);
+
+    if (!pVerb)
         return E_INVALIDARG;
 
     switch (uType)
     {
     case GCS_HELPTEXTA:
-        StringCchCopyA(pszName, cchMax, "Open an SSH terminal to this location");
-        return S_OK;
+        return WideCharToMultiByte(CP_ACP, 0, pVerb->pszHelp, -1, pszName, (int)cchMax, NULL, NULL) ?
+            S_OK : E_FAIL;
     case GCS_HELPTEXTW:
-        StringCchCopyW((LPWSTR)pszName, cchMax, L"Open an SSH terminal to this location");
-        return S_OK;
+        return StringCchCopyW((LPWSTR)pszName, cchMax, pVerb->pszHelp);
     case GCS_VERBA:
-        StringCchCopyA(pszName, cchMax, "sshfs_openssh");
-        return S_OK;
+        return StringCchCopyA(pszName, cchMax, pVerb->pszVerbA);
     case GCS_VERBW:
-        StringCchCopyW((LPWSTR)pszName, cchMax, L"sshfs_openssh");
-        return S_OK;
+        return StringCchCopyW((LPWSTR)pszName, cchMax, pVerb->pszVerbW);
     }
 
     return E_INVALIDARG;
@@ -465,6 +916,503 @@ static IContextMenuVtbl g_ContextMenuVtbl = {
     ContextMenu_GetCommandString
 };
 
+/* ------------------------------------------------------------------------- */
+/* IThumbnailProvider Implementation                                          */
+/* ------------------------------------------------------------------------- */
+
+#define THUMB_POLL_MS           100
+#define THUMB_DEFAULT_WAIT_MS   1500
+#define THUMB_MAX_WAIT_MS       5000    /* Explorer's extraction threads are not to be held longer */
+
+/* Where Explorer looks up a file type's thumbnail provider */
+#define THUMB_SHELLEX_KEY       L"ShellEx\\{E357FCCD-A995-4576-B01F-234630154E96}"
+
+/**
+ * Thumbnails of images on SSHFS drives, made on the server
+ *
+ * Explorer draws an image's thumbnail by reading the whole file, which
+ * over SFTP costs more than the rest of listing the folder. This provider
+ * is registered for the image types instead: on an SSHFS drive it shows
+ * the cached thumbnail sshfs-ssh.exe --thumbs fetched for the file, and
+ * starts a batch for the folder on a miss. A file the batch has not got
+ * to yet keeps its icon; the batch tells the shell about each thumbnail
+ * it writes, and Explorer asks again. Anything it cannot serve (not
+ * on SSHFS, a size above the cached one, no thumbnailer on the server, a
+ * file the server could not read) goes to the provider registered for
+ * the type before ours, so the picture stays the same as without it.
+ */
+typedef struct SSHFSThumbProvider
+{
+    IThumbnailProviderVtbl *lpVtbl;
+    IInitializeWithItemVtbl *lpVtblInit;
+    LONG m_RefCount;
+    IShellItem *m_pItem;
+    WCHAR m_szPath[MAX_PATH];
+} SSHFSThumbProvider;
+
+static HRESULT STDMETHODCALLTYPE ThumbProvider_QueryInterface(
+    IThumbnailProvider *This, REFIID riid, void **ppvObject)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)This;
+
+    if (IsEqualIID(riid, &IID_IUnknown) || IsEqualIID(riid, &IID_IThumbnailProvider))
+    {
+        *ppvObject = &pThumb->lpVtbl;
+        InterlockedIncrement(&pThumb->m_RefCount);
+        return S_OK;
+    }
+    else if (IsEqualIID(riid, &IID_IInitializeWithItem))
+    {
+        *ppvObject = &pThumb->lpVtblInit;
+        InterlockedIncrement(&pThumb->m_RefCount);
+        return S_OK;
+    }
+
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+static ULONG STDMETHODCALLTYPE ThumbProvider_AddRef(IThumbnailProvider *This)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)This;
+    return InterlockedIncrement(&pThumb->m_RefCount);
+}
+
+static ULONG STDMETHODCALLTYPE ThumbProvider_Release(IThumbnailProvider *This)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)This;
+    LONG ref = InterlockedDecrement(&pThumb->m_RefCount);
+    if (ref == 0)
+    {
+        if (pThumb->m_pItem)
+            IShellItem_Release(pThumb->m_pItem);
+        CoTaskMemFree(pThumb);
+        InterlockedDecrement(&g_RefCount);
+    }
+    return ref;
+}
+
+static HRESULT STDMETHODCALLTYPE InitWithItem_QueryInterface(
+    IInitializeWithItem *This, REFIID riid, void **ppvObject)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)((BYTE *)This -
+        offsetof(SSHFSThumbProvider, lpVtblInit));
+    return ThumbProvider_QueryInterface((IThumbnailProvider *)pThumb, riid, ppvObject);
+}
+
+static ULONG STDMETHODCALLTYPE InitWithItem_AddRef(IInitializeWithItem *This)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)((BYTE *)This -
+        offsetof(SSHFSThumbProvider, lpVtblInit));
+    return ThumbProvider_AddRef((IThumbnailProvider *)pThumb);
+}
+
+static ULONG STDMETHODCALLTYPE InitWithItem_Release(IInitializeWithItem *This)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)((BYTE *)This -
+        offsetof(SSHFSThumbProvider, lpVtblInit));
+    return ThumbProvider_Release((IThumbnailProvider *)pThumb);
+}
+
+static HRESULT STDMETHODCALLTYPE InitWithItem_Initialize(
+    IInitializeWithItem *This, IShellItem *psi, DWORD grfMode)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)((BYTE *)This -
+        offsetof(SSHFSThumbProvider, lpVtblInit));
+    LPWSTR pszPath = NULL;
+
+    (void)grfMode;
+    if (pThumb->m_pItem)
+        return HRESULT_FROM_WIN32(ERROR_ALREADY_INITIALIZED);
+
+    pThumb->m_pItem = psi;
+    IShellItem_AddRef(psi);
+
+    /* Items without a file system path only ever go to the previous provider */
+    if (SUCCEEDED(IShellItem_GetDisplayName(psi, SIGDN_FILESYSPATH, &pszPath)))
+    {
+        StringCchCopyW(pThumb->m_szPath, MAX_PATH, pszPath);
+        CoTaskMemFree(pszPath);
+    }
+    return S_OK;
+}
+
+static IInitializeWithItemVtbl g_InitWithItemVtbl = {
+    InitWithItem_QueryInterface,
+    InitWithItem_AddRef,
+    InitWithItem_Release,
+    InitWithItem_Initialize
+};
+
+/**
+ * Hand the request to the provider that was registered for the file's
+ * type before ours (saved under our CLSID's Delegates key at registration)
+ */
+static HRESULT DelegateThumbnail(SSHFSThumbProvider *pThumb, UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha)
+{
+    WCHAR szKey[128];
+    WCHAR szClsid[64];
+    DWORD dwType, dwSize = sizeof(szClsid);
+    LPCWSTR pszExt = PathFindExtensionW(pThumb->m_szPath);
+    IThumbnailProvider *pPrev = NULL;
+    IInitializeWithItem *pInitItem = NULL;
+    IInitializeWithFile *pInitFile = NULL;
+    IInitializeWithStream *pInitStream = NULL;
+    IStream *pStream = NULL;
+    CLSID clsid;
+    HKEY hKey;
+    HRESULT hr;
+
+    if (!pszExt[0] || !StringFromGUID2(&CLSID_SSHFSThumbnail, szClsid, 64))
+        return E_FAIL;
+    StringCchPrintfW(szKey, 128, L"CLSID\\%s\\Delegates", szClsid);
+    if (RegOpenKeyExW(HKEY_CLASSES_ROOT, szKey, 0, KEY_READ, &hKey) != ERROR_SUCCESS)
+        return E_FAIL;
+    hr = RegQueryValueExW(hKey, pszExt, NULL, &dwType, (LPBYTE)szClsid, &dwSize) == ERROR_SUCCESS &&
+        dwType == REG_SZ ? S_OK : E_FAIL;
+    RegCloseKey(hKey);
+    szClsid[63] = L'\0';
+    if (FAILED(hr) || FAILED(CLSIDFromString(szClsid, &clsid)) || IsEqualCLSID(&clsid, &CLSID_SSHFSThumbnail))
+        return E_FAIL;
+
+    hr = CoCreateInstance(&clsid, NULL, CLSCTX_INPROC_SERVER, &IID_IThumbnailProvider, (void **)&pPrev);
+    if (FAILED(hr))
+        return hr;
+
+    /* Whichever way of initializing it supports, the richest first */
+    if (pThumb->m_pItem &&
+        SUCCEEDED(IThumbnailProvider_QueryInterface(pPrev, &IID_IInitializeWithItem, (void **)&pInitItem)))
+    {
+        hr = IInitializeWithItem_Initialize(pInitItem, pThumb->m_pItem, STGM_READ);
+        IInitializeWithItem_Release(pInitItem);
+    }
+    else if (pThumb->m_szPath[0] &&
+        SUCCEEDED(IThumbnailProvider_QueryInterface(pPrev, &IID_IInitializeWithFile, (void **)&pInitFile)))
+    {
+        hr = IInitializeWithFile_Initialize(pInitFile, pThumb->m_szPath, STGM_READ);
+        IInitializeWithFile_Release(pInitFile);
+    }
+    else if (SUCCEEDED(IThumbnailProvider_QueryInterface(pPrev, &IID_IInitializeWithStream, (void **)&pInitStream)))
+    {
+        hr = SHCreateStreamOnFileEx(pThumb->m_szPath, STGM_READ | STGM_SHARE_DENY_NONE, 0, FALSE, NULL, &pStream);
+        if (SUCCEEDED(hr))
+        {
+            hr = IInitializeWithStream_Initialize(pInitStream, pStream, STGM_READ);
+            IStream_Release(pStream);
+        }
+        IInitializeWithStream_Release(pInitStream);
+    }
+    else
+    {
+        hr = E_NOINTERFACE;
+    }
+
+    if (SUCCEEDED(hr))
+        hr = IThumbnailProvider_GetThumbnail(pPrev, cx, phbmp, pdwAlpha);
+    IThumbnailProvider_Release(pPrev);
+    return hr;
+}
+
+/**
+ * Read the cache entry for pszKey at mtime and size. Returns its kind, and
+ * for THUMB_IMAGE the whole file (free with CoTaskMemFree) and where the
+ * JPEG data is in it; 0 if there is no valid entry.
+ */
+static char ReadThumbEntry(const char *pszKey, long long mtime, int size,
+    BYTE **ppFile, size_t *pcbOffset, size_t *pcbData)
+{
+    WCHAR szFile[MAX_PATH];
+    LARGE_INTEGER liSize;
+    HANDLE hFile;
+    BYTE *pFile = NULL;
+    DWORD cbRead = 0;
+    ThumbKind kind = 0;
+
+    *ppFile = NULL;
+    if (!GetThumbEntryPath(pszKey, mtime, size, szFile, MAX_PATH))
+        return 0;
+    hFile = CreateFileW(szFile, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return 0;
+
+    if (GetFileSizeEx(hFile, &liSize) && liSize.QuadPart > 0 &&
+        liSize.QuadPart <= THUMB_MAX_DATA + 128 + MAX_PATH * 9)
+        pFile = CoTaskMemAlloc((SIZE_T)liSize.QuadPart);
+    if (pFile && ReadFile(hFile, pFile, (DWORD)liSize.QuadPart, &cbRead, NULL) &&
+        cbRead == (DWORD)liSize.QuadPart &&
+        ThumbCacheCheck(pFile, cbRead, pszKey, mtime, size, &kind, pcbOffset, pcbData))
+    {
+        if (kind == THUMB_IMAGE)
+        {
+            *ppFile = pFile;
+            pFile = NULL;
+        }
+    }
+    else
+    {
+        kind = 0;
+    }
+    CloseHandle(hFile);
+    CoTaskMemFree(pFile);
+    return (char)kind;
+}
+
+/**
+ * Decode a cached JPEG with WIC into a top-down 32bpp DIB no larger than
+ * cx on its longest side
+ */
+static HRESULT DecodeThumbnail(const BYTE *pData, size_t cbData, UINT cx, HBITMAP *phbmp)
+{
+    IWICImagingFactory *pFactory = NULL;
+    IWICStream *pStream = NULL;
+    IWICBitmapDecoder *pDecoder = NULL;
+    IWICBitmapFrameDecode *pFrame = NULL;
+    IWICBitmapScaler *pScaler = NULL;
+    IWICFormatConverter *pConverter = NULL;
+    IWICBitmapSource *pSource;
+    BITMAPINFO bmi = {0};
+    HBITMAP hbmp = NULL;
+    void *pvBits = NULL;
+    UINT w, h;
+    HRESULT hr;
+
+    hr = CoCreateInstance(&CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IWICImagingFactory, (void **)&pFactory);
+    if (SUCCEEDED(hr))
+        hr = IWICImagingFactory_CreateStream(pFactory, &pStream);
+    if (SUCCEEDED(hr))
+        hr = IWICStream_InitializeFromMemory(pStream, (BYTE *)pData, (DWORD)cbData);
+    if (SUCCEEDED(hr))
+        hr = IWICImagingFactory_CreateDecoderFromStream(pFactory, (IStream *)pStream, NULL,
+            WICDecodeMetadataCacheOnDemand, &pDecoder);
+    if (SUCCEEDED(hr))
+        hr = IWICBitmapDecoder_GetFrame(pDecoder, 0, &pFrame);
+    if (SUCCEEDED(hr))
+        hr = IWICBitmapFrameDecode_GetSize(pFrame, &w, &h);
+    if (FAILED(hr) || w == 0 || h == 0)
+        goto cleanup;
+
+    pSource = (IWICBitmapSource *)pFrame;
+    if (w > cx || h > cx)
+    {
+        if (w >= h)
+        {
+            h = h * cx / w > 0 ? h * cx / w : 1;
+            w = cx;
+        }
+        else
+        {
+            w = w * cx / h > 0 ? w * cx / h : 1;
+            h = cx;
+        }
+        hr = IWICImagingFactory_CreateBitmapScaler(pFactory, &pScaler);
+        if (SUCCEEDED(hr))
+            hr = IWICBitmapScaler_Initialize(pScaler, pSource, w, h, WICBitmapInterpolationModeFant);
+        if (FAILED(hr))
+            goto cleanup;
+        pSource = (IWICBitmapSource *)pScaler;
+    }
+
+    hr = IWICImagingFactory_CreateFormatConverter(pFactory, &pConverter);
+    if (SUCCEEDED(hr))
+        hr = IWICFormatConverter_Initialize(pConverter, pSource, &GUID_WICPixelFormat32bppBGRA,
+            WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom);
+    if (FAILED(hr))
+        goto cleanup;
+
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = (LONG)w;
+    bmi.bmiHeader.biHeight = -(LONG)h;      /* Top-down, as WIC copies */
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    hbmp = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+    if (!hbmp)
+    {
+        hr = E_OUTOFMEMORY;
+        goto cleanup;
+    }
+    hr = IWICFormatConverter_CopyPixels(pConverter, NULL, w * 4, w * 4 * h, (BYTE *)pvBits);
+    if (FAILED(hr))
+    {
+        DeleteObject(hbmp);
+        goto cleanup;
+    }
+    *phbmp = hbmp;
+
+cleanup:
+    if (pConverter) IWICFormatConverter_Release(pConverter);
+    if (pScaler) IWICBitmapScaler_Release(pScaler);
+    if (pFrame) IWICBitmapFrameDecode_Release(pFrame);
+    if (pDecoder) IWICBitmapDecoder_Release(pDecoder);
+    if (pStream) IWICStream_Release(pStream);
+    if (pFactory) IWICImagingFactory_Release(pFactory);
+    return FAILED(hr) ? hr : (*phbmp ? S_OK : E_FAIL);
+}
+
+/**
+ * Start the batch for the file's folder unless one is running, and wait
+ * a moment for the file's entry. S_OK once it is there (or the server
+ * answered that it has none), E_PENDING while the batch is still on it,
+ * an error if no batch could be started.
+ */
+static HRESULT WaitForThumbEntry(LPCWSTR pszFile, const char *pszKey, long long mtime, int size)
+{
+    WCHAR szFolder[MAX_PATH];
+    WCHAR szMutex[64];
+    WCHAR szFile[MAX_PATH];
+    LPWSTR pszArgs;
+    size_t cchArgs;
+    SSHFSLocation *pFolder;
+    HANDLE hMutex;
+    ULONGLONG deadline;
+    DWORD msWait;
+    BOOL bOk, bLaunched = FALSE;
+
+    StringCchCopyW(szFolder, MAX_PATH, pszFile);
+    PathRemoveFileSpecW(szFolder);
+    pFolder = CoTaskMemAlloc(sizeof(SSHFSLocation));
+    if (!pFolder)
+        return E_OUTOFMEMORY;
+    bOk = ResolveSSHFSPath(szFolder, pFolder) == RESOLVE_OK && GetThumbBatchName(pFolder, szMutex, 64) &&
+        GetThumbEntryPath(pszKey, mtime, size, szFile, MAX_PATH);
+    CoTaskMemFree(pFolder);
+    if (!bOk)
+        return E_FAIL;
+
+    hMutex = OpenMutexW(SYNCHRONIZE, FALSE, szMutex);
+    if (hMutex)
+    {
+        CloseHandle(hMutex);
+    }
+    else
+    {
+        /* --thumbs "<folder>" "<file>" (a root folder keeps its backslash escaped) */
+        cchArgs = wcslen(szFolder) + wcslen(pszFile) + 32;
+        pszArgs = CoTaskMemAlloc(cchArgs * sizeof(WCHAR));
+        if (!pszArgs)
+            return E_OUTOFMEMORY;
+        StringCchPrintfW(pszArgs, cchArgs, L"--thumbs \"%s%s\" \"%s\"", szFolder,
+            szFolder[wcslen(szFolder) - 1] == L'\\' ? L"\\" : L"", pszFile);
+        bLaunched = LaunchSSHFSSSH(pszArgs);
+        CoTaskMemFree(pszArgs);
+        if (!bLaunched)
+            return E_FAIL;
+    }
+
+    /* The batch sends this file first, so a fast server answers within
+     * the wait; a slow one gets to it later and the view asks again */
+    msWait = GetThumbnailSetting(L"WaitMs", THUMB_DEFAULT_WAIT_MS);
+    deadline = GetTickCount64() + (msWait < THUMB_MAX_WAIT_MS ? msWait : THUMB_MAX_WAIT_MS);
+    for (;;)
+    {
+        if (GetFileAttributesW(szFile) != INVALID_FILE_ATTRIBUTES)
+            return S_OK;
+        if (GetTickCount64() >= deadline)
+            break;
+        Sleep(THUMB_POLL_MS);
+    }
+
+    /* A batch that ended without it is not coming back for it */
+    if (bLaunched)
+        return E_PENDING;
+    hMutex = OpenMutexW(SYNCHRONIZE, FALSE, szMutex);
+    if (!hMutex)
+        return GetFileAttributesW(szFile) != INVALID_FILE_ATTRIBUTES ? S_OK : E_FAIL;
+    CloseHandle(hMutex);
+    return E_PENDING;
+}
+
+static HRESULT STDMETHODCALLTYPE ThumbProvider_GetThumbnail(
+    IThumbnailProvider *This, UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha)
+{
+    SSHFSThumbProvider *pThumb = (SSHFSThumbProvider *)This;
+    SSHFSLocation *pLoc = NULL;
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    char szKey[MAX_PATH * 9];
+    BYTE *pFile = NULL;
+    size_t cbOffset = 0, cbData = 0;
+    long long mtime;
+    int size = GetThumbnailSize();
+    char kind = 0;
+    HRESULT hr = E_FAIL;
+
+    *phbmp = NULL;
+    *pdwAlpha = WTSAT_UNKNOWN;
+
+    /* Larger than what the server makes: Explorer's own reads the file */
+    if (!pThumb->m_szPath[0] || cx > (UINT)size || !GetThumbnailSetting(L"Enabled", 1) ||
+        !IsSSHFSPath(pThumb->m_szPath))
+        goto fallback;
+
+    pLoc = CoTaskMemAlloc(sizeof(SSHFSLocation));
+    if (!pLoc || ResolveSSHFSPath(pThumb->m_szPath, pLoc) != RESOLVE_OK ||
+        !GetThumbKey(pLoc, pLoc->szRemotePath, szKey, sizeof(szKey)) ||
+        !GetFileAttributesExW(pThumb->m_szPath, GetFileExInfoStandard, &fad))
+        goto fallback;
+    mtime = FileTimeToUnixTime(&fad.ftLastWriteTime);
+
+    kind = ReadThumbEntry(szKey, mtime, size, &pFile, &cbOffset, &cbData);
+    if (!kind && !IsThumbToolMissing(pLoc))
+    {
+        hr = WaitForThumbEntry(pThumb->m_szPath, szKey, mtime, size);
+        if (hr == E_PENDING)
+        {
+            /* The icon for now, not Explorer's own reader: that would
+             * fetch the whole file the batch is making the thumbnail of */
+            CoTaskMemFree(pLoc);
+            return E_PENDING;
+        }
+        if (SUCCEEDED(hr))
+            kind = ReadThumbEntry(szKey, mtime, size, &pFile, &cbOffset, &cbData);
+    }
+
+    if (kind == THUMB_IMAGE)
+    {
+        hr = DecodeThumbnail(pFile + cbOffset, cbData, cx, phbmp);
+        CoTaskMemFree(pFile);
+        if (SUCCEEDED(hr))
+        {
+            *pdwAlpha = WTSAT_RGB;
+            CoTaskMemFree(pLoc);
+            return S_OK;
+        }
+    }
+
+fallback:
+    CoTaskMemFree(pLoc);
+    return DelegateThumbnail(pThumb, cx, phbmp, pdwAlpha);
+}
+
+static IThumbnailProviderVtbl g_ThumbProviderVtbl = {
+    ThumbProvider_QueryInterface,
+    ThumbProvider_AddRef,
+    ThumbProvider_Release,
+    ThumbProvider_GetThumbnail
+};
+
+static HRESULT CreateThumbProvider(REFIID riid, void **ppvObject)
+{
+    SSHFSThumbProvider *pThumb;
+    HRESULT hr;
+
+    pThumb = CoTaskMemAlloc(sizeof(SSHFSThumbProvider));
+    if (!pThumb)
+        return E_OUTOFMEMORY;
+
+    ZeroMemory(pThumb, sizeof(SSHFSThumbProvider));
+    pThumb->lpVtbl = &g_ThumbProviderVtbl;
+    pThumb->lpVtblInit = &g_InitWithItemVtbl;
+    pThumb->m_RefCount = 1;
+    InterlockedIncrement(&g_RefCount);
+
+    hr = ThumbProvider_QueryInterface((IThumbnailProvider *)pThumb, riid, ppvObject);
+    ThumbProvider_Release((IThumbnailProvider *)pThumb);
+
+    return hr;
+}
+
 /* ------------------------------------------------------------------------- */
 /* Class Factory Implementation                                               */
 /* ------------------------------------------------------------------------- */
@@ -473,6 +1421,8 @@ typedef struct ClassFactory
 {
     IClassFactoryVtbl *lpVtbl;
     LONG m_RefCount;
+    BOOL m_bDragDrop;       /* Creates drag and drop handlers */
+    BOOL m_bThumbnail;      /* Creates thumbnail providers */
 } ClassFactory;
 
 static HRESULT STDMETHODCALLTYPE ClassFactory_QueryInterface(
@@ -516,6 +1466,9 @@ static HRESULT STDMETHODCALLTYPE ClassFactory_CreateInstance(
     if (pUnkOuter != NULL)
         return CLASS_E_NOAGGREGATION;
 
+    if (((ClassFactory *)This)->m_bThumbnail)
+        return CreateThumbProvider(riid, ppvObject);
+
     pExt = CoTaskMemAlloc(sizeof(SSHFSContextMenu));
     if (!pExt)
         return E_OUTOFMEMORY;
@@ -524,6 +1477,7 @@ static HRESULT STDMETHODCALLTYPE ClassFactory_CreateInstance(
     pExt->lpVtbl = &g_ContextMenuVtbl;
     pExt->lpVtblShellExtInit = &g_ShellExtInitVtbl;
     pExt->m_RefCount = 1;
+    pExt->m_bDragDrop = ((ClassFactory *)This)->m_bDragDrop;
     InterlockedIncrement(&g_RefCount);
 
     hr = ContextMenu_QueryInterface((IContextMenu *)pExt, riid, ppvObject);
@@ -579,7 +1533,8 @@ STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID *ppv)
 
     *ppv = NULL;
 
-    if (!IsEqualCLSID(rclsid, &CLSID_SSHFSContextMenu))
+    if (!IsEqualCLSID(rclsid, &CLSID_SSHFSContextMenu) && !IsEqualCLSID(rclsid, &CLSID_SSHFSDragDrop) &&
+        !IsEqualCLSID(rclsid, &CLSID_SSHFSThumbnail))
         return CLASS_E_CLASSNOTAVAILABLE;
 
     pFactory = CoTaskMemAlloc(sizeof(ClassFactory));
@@ -588,6 +1543,8 @@ STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, LPVOID *ppv)
 
     pFactory->lpVtbl = &g_ClassFactoryVtbl;
     pFactory->m_RefCount = 1;
+    pFactory->m_bDragDrop = IsEqualCLSID(rclsid, &CLSID_SSHFSDragDrop);
+    pFactory->m_bThumbnail = IsEqualCLSID(rclsid, &CLSID_SSHFSThumbnail);
 
     HRESULT hr = ClassFactory_QueryInterface((IClassFactory *)pFactory, riid, ppv);
     ClassFactory_Release((IClassFactory *)pFactory);
@@ -600,11 +1557,199 @@ STDAPI DllCanUnloadNow(void)
     return (g_RefCount == 0) ? S_OK : S_FALSE;
 }
 
+/**
+ * Register the thumbnail provider for each image type (ThumbExtension()),
+ * keeping the provider the type had under our CLSID's Delegates key so
+ * files not on SSHFS still get theirs. Those that were set on the type
+ * itself (not through SystemFileAssociations) are also kept under
+ * Replaced, to be put back by DllUnregisterServer.
+ */
+static void RegisterThumbnailProvider(LPCWSTR pszModulePath, LPCWSTR pszClsid)
+{
+    WCHAR szSubKey[256];
+    WCHAR szExt[16];
+    WCHAR szPrev[64];
+    HKEY hKey, hDelegates = NULL, hReplaced = NULL;
+    DWORD dwDisp, dwType, dwSize;
+    const char *pszExt;
+    BOOL bOwn;
+    size_t i;
+
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s", pszClsid);
+    if (RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0,
+        KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, NULL, 0, REG_SZ,
+            (BYTE *)L"SSHFS-Win Thumbnails",
+            sizeof(L"SSHFS-Win Thumbnails"));
+        /* Runs in Explorer's isolated thumbnail host like any other provider;
+         * an earlier install opted out of that */
+        RegDeleteValueW(hKey, L"DisableProcessIsolation");
+        RegCloseKey(hKey);
+    }
+
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\InProcServer32", pszClsid);
+    if (RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0,
+        KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, NULL, 0, REG_SZ,
+            (BYTE *)pszModulePath, (DWORD)((wcslen(pszModulePath) + 1) * sizeof(WCHAR)));
+        RegSetValueExW(hKey, L"ThreadingModel", 0, REG_SZ,
+            (BYTE *)L"Apartment", sizeof(L"Apartment"));
+        RegCloseKey(hKey);
+    }
+
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\Delegates", pszClsid);
+    RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0, KEY_WRITE, NULL, &hDelegates, &dwDisp);
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\Replaced", pszClsid);
+    RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0, KEY_WRITE, NULL, &hReplaced, &dwDisp);
+
+    for (i = 0; (pszExt = ThumbExtension(i)) != NULL; i++)
+    {
+        MultiByteToWideChar(CP_ACP, 0, pszExt, -1, szExt, 16);
+        szPrev[0] = L'\0';
+        bOwn = FALSE;
+
+        StringCchPrintfW(szSubKey, 256, L"%s\\" THUMB_SHELLEX_KEY, szExt);
+        if (RegOpenKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+        {
+            dwSize = sizeof(szPrev);
+            if (RegQueryValueExW(hKey, NULL, NULL, &dwType, (LPBYTE)szPrev, &dwSize) != ERROR_SUCCESS ||
+                dwType != REG_SZ)
+                szPrev[0] = L'\0';
+            szPrev[63] = L'\0';
+            bOwn = szPrev[0] != L'\0';
+            RegCloseKey(hKey);
+        }
+        if (!szPrev[0])
+        {
+            StringCchPrintfW(szSubKey, 256, L"SystemFileAssociations\\%s\\" THUMB_SHELLEX_KEY, szExt);
+            if (RegOpenKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, KEY_READ, &hKey) == ERROR_SUCCESS)
+            {
+                dwSize = sizeof(szPrev);
+                if (RegQueryValueExW(hKey, NULL, NULL, &dwType, (LPBYTE)szPrev, &dwSize) != ERROR_SUCCESS ||
+                    dwType != REG_SZ)
+                    szPrev[0] = L'\0';
+                szPrev[63] = L'\0';
+                RegCloseKey(hKey);
+            }
+        }
+
+        /* Registering again keeps what was saved the first time */
+        if (szPrev[0] && _wcsicmp(szPrev, pszClsid) != 0)
+        {
+            if (hDelegates)
+                RegSetValueExW(hDelegates, szExt, 0, REG_SZ,
+                    (BYTE *)szPrev, (DWORD)((wcslen(szPrev) + 1) * sizeof(WCHAR)));
+            if (hReplaced && bOwn)
+                RegSetValueExW(hReplaced, szExt, 0, REG_SZ,
+                    (BYTE *)szPrev, (DWORD)((wcslen(szPrev) + 1) * sizeof(WCHAR)));
+        }
+
+        StringCchPrintfW(szSubKey, 256, L"%s\\" THUMB_SHELLEX_KEY, szExt);
+        if (RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0,
+            KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+        {
+            RegSetValueExW(hKey, NULL, 0, REG_SZ,
+                (BYTE *)pszClsid, (DWORD)((wcslen(pszClsid) + 1) * sizeof(WCHAR)));
+            RegCloseKey(hKey);
+        }
+    }
+
+    if (hDelegates)
+        RegCloseKey(hDelegates);
+    if (hReplaced)
+        RegCloseKey(hReplaced);
+
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE,
+        L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Shell Extensions\\Approved",
+        0, KEY_WRITE, &hKey) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, pszClsid, 0, REG_SZ,
+            (BYTE *)L"SSHFS-Win Thumbnails",
+            sizeof(L"SSHFS-Win Thumbnails"));
+        RegCloseKey(hKey);
+    }
+}
+
+/**
+ * Give each image type back the provider it had before
+ */
+static void UnregisterThumbnailProvider(LPCWSTR pszClsid)
+{
+    WCHAR szSubKey[256];
+    WCHAR szExt[16];
+    WCHAR szValue[64];
+    HKEY hKey, hReplaced = NULL;
+    DWORD dwType, dwSize;
+    const char *pszExt;
+    BOOL bOurs;
+    size_t i;
+
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\Replaced", pszClsid);
+    RegOpenKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, KEY_READ, &hReplaced);
+
+    for (i = 0; (pszExt = ThumbExtension(i)) != NULL; i++)
+    {
+        MultiByteToWideChar(CP_ACP, 0, pszExt, -1, szExt, 16);
+        StringCchPrintfW(szSubKey, 256, L"%s\\" THUMB_SHELLEX_KEY, szExt);
+
+        /* Only where ours is still the one set: another program may have taken over since */
+        bOurs = FALSE;
+        if (RegOpenKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, KEY_READ | KEY_WRITE, &hKey) != ERROR_SUCCESS)
+            continue;
+        dwSize = sizeof(szValue);
+        if (RegQueryValueExW(hKey, NULL, NULL, &dwType, (LPBYTE)szValue, &dwSize) == ERROR_SUCCESS &&
+            dwType == REG_SZ)
+        {
+            szValue[63] = L'\0';
+            bOurs = _wcsicmp(szValue, pszClsid) == 0;
+        }
+        if (bOurs)
+        {
+            dwSize = sizeof(szValue);
+            if (hReplaced && RegQueryValueExW(hReplaced, szExt, NULL, &dwType, (LPBYTE)szValue, &dwSize) ==
+                ERROR_SUCCESS && dwType == REG_SZ)
+            {
+                szValue[63] = L'\0';
+                RegSetValueExW(hKey, NULL, 0, REG_SZ,
+                    (BYTE *)szValue, (DWORD)((wcslen(szValue) + 1) * sizeof(WCHAR)));
+                bOurs = FALSE;
+            }
+        }
+        RegCloseKey(hKey);
+        if (bOurs)
+            RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+    }
+
+    if (hReplaced)
+        RegCloseKey(hReplaced);
+
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\Delegates", pszClsid);
+    RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\Replaced", pszClsid);
+    RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\InProcServer32", pszClsid);
+    RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s", pszClsid);
+    RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE,
+        L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Shell Extensions\\Approved",
+        0, KEY_WRITE, &hKey) == ERROR_SUCCESS)
+    {
+        RegDeleteValueW(hKey, pszClsid);
+        RegCloseKey(hKey);
+    }
+}
+
 /* For regsvr32 registration */
 STDAPI DllRegisterServer(void)
 {
     WCHAR szModulePath[MAX_PATH];
     WCHAR szClsid[] = L"{7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5B}";
+    WCHAR szDragClsid[] = L"{7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5C}";
+    WCHAR szThumbClsid[] = L"{7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5D}";
     WCHAR szSubKey[256];
     HKEY hKey;
     DWORD dwDisp;
@@ -685,6 +1830,60 @@ STDAPI DllRegisterServer(void)
         RegCloseKey(hKey);
     }
 
+    /* Register the right-drag handler (same DLL, second CLSID) */
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s", szDragClsid);
+    if (RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0,
+        KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, NULL, 0, REG_SZ,
+            (BYTE *)L"SSHFS-Win Drag and Drop",
+            sizeof(L"SSHFS-Win Drag and Drop"));
+        RegCloseKey(hKey);
+    }
+
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\InProcServer32", szDragClsid);
+    if (RegCreateKeyExW(HKEY_CLASSES_ROOT, szSubKey, 0, NULL, 0,
+        KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, NULL, 0, REG_SZ,
+            (BYTE *)szModulePath, (DWORD)((wcslen(szModulePath) + 1) * sizeof(WCHAR)));
+        RegSetValueExW(hKey, L"ThreadingModel", 0, REG_SZ,
+            (BYTE *)L"Apartment", sizeof(L"Apartment"));
+        RegCloseKey(hKey);
+    }
+
+    /* Dropping onto a folder (or into an open folder window) and onto a drive */
+    if (RegCreateKeyExW(HKEY_CLASSES_ROOT,
+        L"Directory\\shellex\\DragDropHandlers\\SSHFSWin", 0, NULL, 0,
+        KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, NULL, 0, REG_SZ,
+            (BYTE *)szDragClsid, sizeof(szDragClsid));
+        RegCloseKey(hKey);
+    }
+
+    if (RegCreateKeyExW(HKEY_CLASSES_ROOT,
+        L"Drive\\shellex\\DragDropHandlers\\SSHFSWin", 0, NULL, 0,
+        KEY_WRITE, NULL, &hKey, &dwDisp) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, NULL, 0, REG_SZ,
+            (BYTE *)szDragClsid, sizeof(szDragClsid));
+        RegCloseKey(hKey);
+    }
+
+    if (RegOpenKeyExW(HKEY_LOCAL_MACHINE,
+        L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Shell Extensions\\Approved",
+        0, KEY_WRITE, &hKey) == ERROR_SUCCESS)
+    {
+        RegSetValueExW(hKey, szDragClsid, 0, REG_SZ,
+            (BYTE *)L"SSHFS-Win Drag and Drop",
+            sizeof(L"SSHFS-Win Drag and Drop"));
+        RegCloseKey(hKey);
+    }
+
+    /* Thumbnails of images on SSHFS drives (same DLL, third CLSID) */
+    RegisterThumbnailProvider(szModulePath, szThumbClsid);
+
     /* Notify shell of changes */
     SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
 
@@ -694,6 +1893,8 @@ STDAPI DllRegisterServer(void)
 STDAPI DllUnregisterServer(void)
 {
     WCHAR szClsid[] = L"{7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5B}";
+    WCHAR szDragClsid[] = L"{7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5C}";
+    WCHAR szThumbClsid[] = L"{7B3F4E8A-1C2D-4E5F-9A8B-0C1D2E3F4A5D}";
     WCHAR szSubKey[256];
     HKEY hKey;
 
@@ -711,11 +1912,20 @@ STDAPI DllUnregisterServer(void)
     RegDeleteKeyW(HKEY_CLASSES_ROOT,
         L"Drive\\shellex\\ContextMenuHandlers\\000-SSHFSWin");
 
+    RegDeleteKeyW(HKEY_CLASSES_ROOT,
+        L"Directory\\shellex\\DragDropHandlers\\SSHFSWin");
+    RegDeleteKeyW(HKEY_CLASSES_ROOT,
+        L"Drive\\shellex\\DragDropHandlers\\SSHFSWin");
+
     /* Remove CLSID registration */
     StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\InProcServer32", szClsid);
     RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
     StringCchPrintfW(szSubKey, 256, L"CLSID\\%s", szClsid);
     RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s\\InProcServer32", szDragClsid);
+    RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
+    StringCchPrintfW(szSubKey, 256, L"CLSID\\%s", szDragClsid);
+    RegDeleteKeyW(HKEY_CLASSES_ROOT, szSubKey);
 
     /* Remove from approved list */
     if (RegOpenKeyExW(HKEY_LOCAL_MACHINE,
@@ -723,9 +1933,12 @@ STDAPI DllUnregisterServer(void)
         0, KEY_WRITE, &hKey) == ERROR_SUCCESS)
     {
         RegDeleteValueW(hKey, szClsid);
+        RegDeleteValueW(hKey, szDragClsid);
         RegCloseKey(hKey);
     }
 
+    UnregisterThumbnailProvider(szThumbClsid);
+
     /* Notify shell of changes */
     SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, NULL, NULL);
 
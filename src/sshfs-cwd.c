@@ -0,0 +1,305 @@
+/**
+ * sshfs-cwd.c
+ *
+ * Working directory reports in terminal output (see sshfs-cwd.h)
+ */
+
+#include "sshfs-cwd.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sshfs-path.h"
+
+enum {
+    CWD_TEXT,
+    CWD_ESC,                    /* After ESC */
+    CWD_OSC,                    /* After ESC ] */
+    CWD_OSC_ESC                 /* ESC inside an OSC: ST if '\' follows */
+};
+
+void CwdScanInit(CwdScanner *s)
+{
+    s->state = CWD_TEXT;
+    s->cbBody = 0;
+    s->bOverflow = 0;
+    s->szCwd[0] = '\0';
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Path of a file:// URI (the host is not checked: it names the server the
+ * shell runs on), percent-decoded. A bare absolute path is taken as is.
+ */
+static int DecodeFileUri(const char *pszUri, char *pszOut, size_t cchOut)
+{
+    const char *p = pszUri;
+    size_t pos = 0;
+
+    if (strncmp(p, "file://", 7) == 0)
+    {
+        p = strchr(p + 7, '/');
+        if (!p)
+            return 0;
+    }
+    else if (p[0] != '/')
+        return 0;
+
+    for (; *p; p++)
+    {
+        char c = *p;
+
+        if (c == '%' && HexValue(p[1]) >= 0 && HexValue(p[2]) >= 0)
+        {
+            c = (char)(HexValue(p[1]) * 16 + HexValue(p[2]));
+            p += 2;
+            if (c == '\0')
+                return 0;
+        }
+        if (pos + 1 >= cchOut)
+            return 0;
+        pszOut[pos++] = c;
+    }
+    pszOut[pos] = '\0';
+    return pos > 0;
+}
+
+/**
+ * An OSC sequence has ended: take it if it reports a directory
+ */
+static int FinishOsc(CwdScanner *s)
+{
+    char *pszBody = s->body;
+    size_t len;
+
+    if (s->bOverflow)
+        return 0;
+    s->body[s->cbBody] = '\0';
+
+    if (strncmp(pszBody, "7;", 2) == 0)
+        return DecodeFileUri(pszBody + 2, s->szCwd, sizeof(s->szCwd));
+
+    if (strncmp(pszBody, "9;9;", 4) == 0)
+    {
+        pszBody += 4;
+        len = strlen(pszBody);
+        if (len >= 2 && pszBody[0] == '"' && pszBody[len - 1] == '"')
+        {
+            pszBody[len - 1] = '\0';
+            pszBody++;
+        }
+        if (!pszBody[0])
+            return 0;
+        memcpy(s->szCwd, pszBody, strlen(pszBody) + 1);
+        return 1;
+    }
+    return 0;
+}
+
+size_t CwdScan(CwdScanner *s, const void *data, size_t cb)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i = 0, last = 0;
+
+    while (i < cb)
+    {
+        unsigned char c;
+
+        /* Plain text: skip straight to the next ESC */
+        if (s->state == CWD_TEXT)
+        {
+            const unsigned char *pEsc = (const unsigned char *)memchr(p + i, 0x1b, cb - i);
+            if (!pEsc)
+                break;
+            i = (size_t)(pEsc - p) + 1;
+            s->state = CWD_ESC;
+            continue;
+        }
+
+        c = p[i++];
+        switch (s->state)
+        {
+        case CWD_ESC:
+            if (c == ']')
+            {
+                s->state = CWD_OSC;
+                s->cbBody = 0;
+                s->bOverflow = 0;
+            }
+            else if (c != 0x1b)
+                s->state = CWD_TEXT;
+            break;
+
+        case CWD_OSC:
+            if (c == 0x07)
+            {
+                if (FinishOsc(s))
+                    last = i;
+                s->state = CWD_TEXT;
+            }
+            else if (c == 0x1b)
+                s->state = CWD_OSC_ESC;
+            else if (c == 0x18 || c == 0x1a)
+                s->state = CWD_TEXT;            /* CAN, SUB: sequence cancelled */
+            else if (s->cbBody < sizeof(s->body) - 1)
+                s->body[s->cbBody++] = (char)c;
+            else
+                s->bOverflow = 1;
+            break;
+
+        case CWD_OSC_ESC:
+            if (c == '\\')
+            {
+                if (FinishOsc(s))
+                    last = i;
+                s->state = CWD_TEXT;
+            }
+            else if (c == ']')
+            {
+                s->state = CWD_OSC;
+                s->cbBody = 0;
+                s->bOverflow = 0;
+            }
+            else
+                s->state = c == 0x1b ? CWD_ESC : CWD_TEXT;
+            break;
+        }
+    }
+    return last;
+}
+
+void CwdMapInit(CwdMap *m, const char *pszLocalRoot, const char *pszRemoteRoot,
+    const char *pszRemoteStart, char cSep)
+{
+    size_t len;
+
+    snprintf(m->szLocalRoot, sizeof(m->szLocalRoot), "%s", pszLocalRoot);
+    snprintf(m->szRemoteRoot, sizeof(m->szRemoteRoot), "%s", pszRemoteRoot);
+    snprintf(m->szRemoteStart, sizeof(m->szRemoteStart), "%s", pszRemoteStart);
+    m->szHome[0] = '\0';
+    m->cSep = cSep;
+    m->bFirst = 1;
+
+    len = strlen(m->szLocalRoot);
+    while (len > 1 && (m->szLocalRoot[len - 1] == cSep || m->szLocalRoot[len - 1] == '/'))
+        m->szLocalRoot[--len] = '\0';
+}
+
+/**
+ * The shell reported pszRemote first, which should be the start directory
+ * "~/<rest>": the home directory is what comes before <rest>
+ */
+static void LearnHome(CwdMap *m, const char *pszRemote)
+{
+    const char *pszRest = m->szRemoteStart + 1;
+    size_t cchRemote = strlen(pszRemote), cchRest;
+
+    if (m->szRemoteStart[0] != '~' || (pszRest[0] && pszRest[0] != '/'))
+        return;
+    while (*pszRest == '/')
+        pszRest++;
+    while (cchRemote > 1 && pszRemote[cchRemote - 1] == '/')
+        cchRemote--;
+
+    cchRest = strlen(pszRest);
+    if (cchRest == 0)
+    {
+        if (cchRemote < sizeof(m->szHome))
+            snprintf(m->szHome, sizeof(m->szHome), "%.*s", (int)cchRemote, pszRemote);
+        return;
+    }
+    if (cchRemote > cchRest + 1 && pszRemote[cchRemote - cchRest - 1] == '/' &&
+        strncmp(pszRemote + cchRemote - cchRest, pszRest, cchRest) == 0)
+    {
+        snprintf(m->szHome, sizeof(m->szHome), "%.*s", (int)(cchRemote - cchRest - 1), pszRemote);
+    }
+}
+
+int CwdMapToLocal(CwdMap *m, const char *pszRemote, char *pszOut, size_t cchOut)
+{
+    char szTilde[CWD_MAX];
+    char szRel[CWD_MAX];
+    const char *pszPath = pszRemote;
+    int bFirst = m->bFirst;
+    int n;
+
+    m->bFirst = 0;
+    if (pszRemote[0] != '/' && pszRemote[0] != '~')
+        return 0;
+
+    /* Home mounts: "/home/user/x" is "~/x" */
+    if (m->szRemoteRoot[0] == '~' && pszRemote[0] == '/')
+    {
+        size_t cchHome;
+
+        if (bFirst)
+            LearnHome(m, pszRemote);
+        cchHome = strlen(m->szHome);
+        if (cchHome == 0 || strncmp(pszRemote, m->szHome, cchHome) != 0 ||
+            (pszRemote[cchHome] && pszRemote[cchHome] != '/'))
+            return 0;
+        if ((size_t)snprintf(szTilde, sizeof(szTilde), "~%s", pszRemote + cchHome) >= sizeof(szTilde))
+            return 0;
+        pszPath = szTilde;
+    }
+
+    if (!RemotePathToLocal(pszPath, m->szRemoteRoot, m->cSep, szRel, sizeof(szRel)))
+        return 0;
+
+    /* A drive root needs its separator ("X:\", not "X:") */
+    if (szRel[0])
+        n = snprintf(pszOut, cchOut, "%s%c%s", m->szLocalRoot, m->cSep, szRel);
+    else if (m->szLocalRoot[0] && m->szLocalRoot[strlen(m->szLocalRoot) - 1] == ':')
+        n = snprintf(pszOut, cchOut, "%s%c", m->szLocalRoot, m->cSep);
+    else
+        n = snprintf(pszOut, cchOut, "%s", m->szLocalRoot);
+    return n > 0 && (size_t)n < cchOut;
+}
+
+size_t CwdFormatOsc7(const char *pszHost, const char *pszPath, char *pszOut, size_t cchOut)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const unsigned char *p = (const unsigned char *)pszPath;
+    int n = snprintf(pszOut, cchOut, "\x1b]7;file://%s", pszHost);
+    size_t pos;
+
+    if (n < 0 || (size_t)n >= cchOut)
+        return 0;
+    pos = (size_t)n;
+
+    for (; *p; p++)
+    {
+        if (pos + 3 + 2 >= cchOut)
+            return 0;
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+            strchr("/-._~", *p))
+        {
+            pszOut[pos++] = (char)*p;
+        }
+        else
+        {
+            pszOut[pos++] = '%';
+            pszOut[pos++] = hex[*p >> 4];
+            pszOut[pos++] = hex[*p & 15];
+        }
+    }
+    memcpy(pszOut + pos, "\x1b\\", 3);
+    return pos + 2;
+}
+
+size_t CwdFormatOsc99(const char *pszPath, char *pszOut, size_t cchOut)
+{
+    int n = snprintf(pszOut, cchOut, "\x1b]9;9;\"%s\"\x1b\\", pszPath);
+
+    return n > 0 && (size_t)n < cchOut ? (size_t)n : 0;
+}
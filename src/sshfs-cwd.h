@@ -0,0 +1,77 @@
+/**
+ * sshfs-cwd.h
+ *
+ * Remote working directory tracking for the terminal relay (--cwd-map).
+ * Shells that report their directory do so with OSC 7
+ * (ESC ] 7 ; file://host/path BEL, as VTE and most prompts send it) or
+ * OSC 9;9 (ESC ] 9 ; 9 ; "path" ST, the Windows Terminal form). The relay
+ * scans its output for them and maps the directory back to the local path
+ * of the same folder on the mount: the inverse of BuildFullRemotePath().
+ *
+ * Output without escape sequences costs one memchr() for ESC per chunk,
+ * which the C runtimes vectorize; only the bytes of OSC sequences are
+ * looked at one by one.
+ */
+
+#ifndef SSHFS_CWD_H
+#define SSHFS_CWD_H
+
+#include <stddef.h>
+
+#define CWD_MAX 4096            /* Longer OSC sequences are skipped */
+
+typedef struct CwdScanner {
+    int state;
+    size_t cbBody;
+    int bOverflow;
+    char body[CWD_MAX];         /* OSC sequence being read */
+    char szCwd[CWD_MAX];        /* Last directory reported (decoded) */
+} CwdScanner;
+
+void CwdScanInit(CwdScanner *s);
+
+/**
+ * Scan a chunk of output. Returns the offset just past the last directory
+ * report completed in it (s->szCwd holds the directory), or 0 if there was
+ * none. Sequences may be split across chunks.
+ */
+size_t CwdScan(CwdScanner *s, const void *data, size_t cb);
+
+/**
+ * How remote directories map to local ones: the mount's root on both sides
+ * and the remote directory the session started in. For home mounts
+ * ("~/...") the home directory is learned from the first absolute report,
+ * which is the start directory unless the shell's profile moved elsewhere.
+ */
+typedef struct CwdMap {
+    char szLocalRoot[CWD_MAX];  /* "X:" or "/mnt/server", without trailing separator */
+    char szRemoteRoot[CWD_MAX]; /* As FormatRemotePath() gives it: "/srv" or "~/proj" */
+    char szRemoteStart[CWD_MAX];
+    char szHome[CWD_MAX];       /* "" until known */
+    char cSep;                  /* Local separator */
+    int bFirst;
+} CwdMap;
+
+void CwdMapInit(CwdMap *m, const char *pszLocalRoot, const char *pszRemoteRoot,
+    const char *pszRemoteStart, char cSep);
+
+/**
+ * Local path of a reported remote directory. Returns 0 if it is outside
+ * the mount (or the home directory is not known yet).
+ */
+int CwdMapToLocal(CwdMap *m, const char *pszRemote, char *pszOut, size_t cchOut);
+
+/**
+ * OSC 7 for a local directory (percent-encoded file:// URI on pszHost),
+ * so a terminal opening a new tab starts it there. Returns the length, 0
+ * if it did not fit.
+ */
+size_t CwdFormatOsc7(const char *pszHost, const char *pszPath, char *pszOut, size_t cchOut);
+
+/**
+ * OSC 9;9 for a local directory (Windows Terminal). Returns the length, 0
+ * if it did not fit.
+ */
+size_t CwdFormatOsc99(const char *pszPath, char *pszOut, size_t cchOut);
+
+#endif /* SSHFS_CWD_H */
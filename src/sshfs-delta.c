@@ -0,0 +1,578 @@
+/**
+ * sshfs-delta.c
+ *
+ * Block matching against the server copy's block list (see sshfs-delta.h)
+ */
+
+#include "sshfs-delta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CRC_POLY        0x04C11DB7u     /* POSIX cksum, most significant bit first */
+#define CRC_X_INVERSE   0x82608EDBu     /* x^-1 modulo the polynomial */
+#define PROGRESS_STEP   (1024 * 1024)
+
+static unsigned int g_crcTable[256];
+
+/**
+ * Make room for nNeed items of cbItem bytes, doubling
+ */
+static int Grow(void **pp, size_t *pnAlloc, size_t nNeed, size_t cbItem)
+{
+    size_t nAlloc = *pnAlloc ? *pnAlloc : 256;
+    void *p;
+
+    if (nNeed <= *pnAlloc)
+        return 1;
+    while (nAlloc < nNeed)
+        nAlloc *= 2;
+    p = realloc(*pp, nAlloc * cbItem);
+    if (!p)
+        return 0;
+    *pp = p;
+    *pnAlloc = nAlloc;
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Product of two polynomials modulo CRC_POLY (bit 31 is x^31)
+ */
+static unsigned int MulMod(unsigned int a, unsigned int b)
+{
+    unsigned int r = 0;
+    int i;
+
+    for (i = 31; i >= 0; i--)
+    {
+        r = (r & 0x80000000u) ? (r << 1) ^ CRC_POLY : r << 1;
+        if ((b >> i) & 1)
+            r ^= a;
+    }
+    return r;
+}
+
+static void InitCrcTable(void)
+{
+    unsigned int i, j, c;
+
+    if (g_crcTable[1])
+        return;
+    for (i = 0; i < 256; i++)
+    {
+        c = i << 24;
+        for (j = 0; j < 8; j++)
+            c = (c & 0x80000000u) ? (c << 1) ^ CRC_POLY : c << 1;
+        g_crcTable[i] = c;
+    }
+}
+
+#define CRC_STEP(r, b) (((r) << 8) ^ g_crcTable[((r) >> 24) ^ (b)])
+
+static unsigned int CrcRegister(const unsigned char *p, size_t cb)
+{
+    unsigned int r = 0;
+    size_t i;
+
+    for (i = 0; i < cb; i++)
+        r = CRC_STEP(r, p[i]);
+    return r;
+}
+
+/**
+ * cksum's printed value to the register over the data alone: undo the
+ * final complement and the length bytes cksum appends (lowest first)
+ */
+static unsigned int CksumToRegister(unsigned int value, unsigned int cb)
+{
+    unsigned char len[4];
+    unsigned int xInv8 = 1, r = ~value;
+    int nLen = 0, i;
+
+    for (; cb > 0; cb >>= 8)
+        len[nLen++] = (unsigned char)(cb & 0xFF);
+    for (i = 0; i < 8; i++)
+        xInv8 = MulMod(xInv8, CRC_X_INVERSE);
+
+    /* A step is r' = (r ^ b << 24) * x^8 */
+    for (i = nLen - 1; i >= 0; i--)
+        r = MulMod(r, xInv8) ^ ((unsigned int)len[i] << 24);
+    return r;
+}
+
+/* ------------------------------------------------------------------------- */
+
+size_t DeltaBlockSize(unsigned long long cbFile)
+{
+    size_t cbBlock = DELTA_MIN_BLOCK;
+
+    while (cbBlock < DELTA_MAX_BLOCK && (unsigned long long)cbBlock * DELTA_TARGET_BLOCKS < cbFile)
+        cbBlock *= 2;
+    return cbBlock;
+}
+
+void DeltaSignatureInit(DeltaSignature *s, size_t cbBlock)
+{
+    memset(s, 0, sizeof(*s));
+    s->cbBlock = cbBlock;
+}
+
+void DeltaSignatureFree(DeltaSignature *s)
+{
+    free(s->pBlocks);
+    free(s->pOrder);
+    free(s->pTable);
+    DeltaSignatureInit(s, s->cbBlock);
+}
+
+static int ParseNumber(const char **pp, const char *end, unsigned long long *pValue)
+{
+    const char *p = *pp;
+    unsigned long long v = 0;
+
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (unsigned long long)(*p++ - '0');
+    if (p == *pp)
+        return 0;
+    *pp = p;
+    *pValue = v;
+    return 1;
+}
+
+static int TakeLine(DeltaSignature *s, const char *line, size_t cb)
+{
+    const char *p = line, *end = line + cb;
+    unsigned long long crc, len;
+    char szName[8];
+    DeltaBlock *b;
+
+    if (cb > 0 && line[cb - 1] == '\r')
+        end--, cb--;
+    if (cb == 0)
+        return 1;
+
+    if (line[0] == '#')
+    {
+        if (cb > 6 && memcmp(line, "#size ", 6) == 0)
+        {
+            p += 6;
+            s->bSize = ParseNumber(&p, end, &s->cbFile);
+        }
+        else if (cb == 4 && memcmp(line, "#end", 4) == 0)
+            s->bEnd = 1;
+        else if (cb == 3 && memcmp(line, "#ok", 3) == 0)
+            s->bOk = 1;
+        else if (cb == 9 && memcmp(line, "#mismatch", 9) == 0)
+            s->bMismatch = 1;
+        else if (cb == 8 && memcmp(line, "#notfile", 8) == 0)
+            s->bNotFile = 1;
+        else
+            s->nSkipped++;
+        return 1;
+    }
+
+    /* cksum: "<crc> <length>", then sha256sum: "<hex>  -" */
+    if (!s->bHaveCrc)
+    {
+        if (!ParseNumber(&p, end, &crc) || p >= end || *p++ != ' ' ||
+            !ParseNumber(&p, end, &len) || p != end || crc > 0xFFFFFFFFu || len == 0 || len > s->cbBlock)
+        {
+            s->nSkipped++;
+            return 1;
+        }
+        if (!Grow((void **)&s->pBlocks, &s->nAlloc, s->nBlocks + 1, sizeof(DeltaBlock)))
+            return 0;
+        b = &s->pBlocks[s->nBlocks];
+        b->cb = (unsigned int)len;
+        InitCrcTable();
+        b->crc = CksumToRegister((unsigned int)crc, b->cb);
+        s->bHaveCrc = 1;
+        return 1;
+    }
+
+    s->bHaveCrc = 0;
+    if (!HashParseLine(line, cb, s->pBlocks[s->nBlocks].digest, szName, sizeof(szName)))
+    {
+        s->nSkipped++;
+        return 1;
+    }
+    s->nBlocks++;
+    return 1;
+}
+
+int DeltaSignatureFeed(DeltaSignature *s, const char *data, size_t cb)
+{
+    while (cb > 0)
+    {
+        const char *pEnd = memchr(data, '\n', cb);
+        size_t n = pEnd ? (size_t)(pEnd - data) : cb;
+        int ok = 1;
+
+        if (s->cbLine > 0 || !pEnd)
+        {
+            /* A line cut by a read; one too long to be ours is dropped */
+            if (s->cbLine + n <= DELTA_LINE_MAX)
+                memcpy(s->line + s->cbLine, data, n);
+            s->cbLine += n;
+            if (pEnd)
+            {
+                if (s->cbLine <= DELTA_LINE_MAX)
+                    ok = TakeLine(s, s->line, s->cbLine);
+                else
+                    s->nSkipped++;
+                s->cbLine = 0;
+            }
+        }
+        else
+        {
+            ok = TakeLine(s, data, n);
+        }
+        if (!ok)
+            return 0;
+        if (!pEnd)
+            break;
+        data += n + 1;
+        cb -= n + 1;
+    }
+    return 1;
+}
+
+static const DeltaBlock *g_pSortBlocks;
+
+static int CompareBlockCrc(const void *a, const void *b)
+{
+    unsigned int ia = *(const unsigned int *)a, ib = *(const unsigned int *)b;
+    unsigned int ca = g_pSortBlocks[ia].crc, cb = g_pSortBlocks[ib].crc;
+
+    if (ca != cb)
+        return ca < cb ? -1 : 1;
+    return ia < ib ? -1 : ia > ib;
+}
+
+static size_t TableSlot(const DeltaSignature *s, unsigned int crc)
+{
+    return (size_t)((crc * 0x9E3779B1u) & (unsigned int)(s->nTable - 1));
+}
+
+int DeltaSignatureIndex(DeltaSignature *s)
+{
+    unsigned int xW = 0x100;    /* x^8 */
+    unsigned int xPow = 1;
+    size_t i, n;
+
+    InitCrcTable();
+    for (i = 0; i < s->nBlocks; i++)
+    {
+        if (s->pBlocks[i].cb != s->cbBlock && i + 1 < s->nBlocks)
+            return 0;
+    }
+
+    free(s->pOrder);
+    free(s->pTable);
+    s->pOrder = malloc((s->nBlocks + 1) * sizeof(unsigned int));
+    for (s->nTable = 16; s->nTable < s->nBlocks * 2; s->nTable *= 2)
+        ;
+    s->pTable = calloc(s->nTable, sizeof(unsigned int));
+    if (!s->pOrder || !s->pTable)
+        return 0;
+    memset(s->filter, 0, sizeof(s->filter));
+
+    for (i = 0, s->nOrder = 0; i < s->nBlocks; i++)
+    {
+        if (s->pBlocks[i].cb == s->cbBlock)
+            s->pOrder[s->nOrder++] = (unsigned int)i;
+    }
+    g_pSortBlocks = s->pBlocks;
+    qsort(s->pOrder, s->nOrder, sizeof(unsigned int), CompareBlockCrc);
+
+    /* Each distinct crc points at the first of its run in pOrder */
+    for (i = 0; i < s->nOrder; i++)
+    {
+        unsigned int crc = s->pBlocks[s->pOrder[i]].crc;
+        size_t slot;
+
+        s->filter[crc >> 19] |= (unsigned char)(1 << ((crc >> 16) & 7));
+        if (i > 0 && s->pBlocks[s->pOrder[i - 1]].crc == crc)
+            continue;
+        for (slot = TableSlot(s, crc); s->pTable[slot]; slot = (slot + 1) & (s->nTable - 1))
+            ;
+        s->pTable[slot] = (unsigned int)i + 1;
+    }
+
+    /* Rolling a byte out of a window: its register followed by cbBlock
+     * zero bytes, that is T[b] * x^(8 * cbBlock) */
+    for (n = s->cbBlock; n > 0; n >>= 1)
+    {
+        if (n & 1)
+            xPow = MulMod(xPow, xW);
+        xW = MulMod(xW, xW);
+    }
+    for (i = 0; i < 256; i++)
+        s->rollOut[i] = MulMod(g_crcTable[i], xPow);
+    return 1;
+}
+
+void DeltaMatchesFree(DeltaMatches *m)
+{
+    free(m->pMatches);
+    memset(m, 0, sizeof(*m));
+}
+
+/**
+ * The block to use for a window with register crc, or -1. iWant is
+ * preferred among blocks with the same content, so unchanged stretches
+ * become one long copy.
+ */
+static long long FindBlock(const DeltaSignature *s, unsigned int crc, const unsigned char *pWindow,
+    unsigned int iWant)
+{
+    size_t slot = TableSlot(s, crc);
+    unsigned char digest[HASH_SIZE];
+    long long iFound = -1;
+    int bHashed = 0;
+    unsigned int pos = 0;
+    Sha256 h;
+
+    for (; s->pTable[slot]; slot = (slot + 1) & (s->nTable - 1))
+    {
+        pos = s->pTable[slot] - 1;
+        if (s->pBlocks[s->pOrder[pos]].crc == crc)
+            break;
+    }
+    if (!s->pTable[slot])
+        return -1;
+
+    for (; pos < s->nOrder && s->pBlocks[s->pOrder[pos]].crc == crc; pos++)
+    {
+        const DeltaBlock *b = &s->pBlocks[s->pOrder[pos]];
+
+        if (!bHashed)
+        {
+            Sha256Init(&h);
+            Sha256Update(&h, pWindow, s->cbBlock);
+            Sha256Final(&h, digest);
+            bHashed = 1;
+        }
+        if (memcmp(b->digest, digest, HASH_SIZE) != 0)
+            continue;
+        if (s->pOrder[pos] == iWant)
+            return iWant;
+        if (iFound < 0)
+            iFound = s->pOrder[pos];
+    }
+    return iFound;
+}
+
+static int WindowIs(const DeltaBlock *b, const unsigned char *pWindow, size_t cb)
+{
+    unsigned char digest[HASH_SIZE];
+    Sha256 h;
+
+    Sha256Init(&h);
+    Sha256Update(&h, pWindow, cb);
+    Sha256Final(&h, digest);
+    return memcmp(digest, b->digest, HASH_SIZE) == 0;
+}
+
+static int AddMatch(DeltaMatches *m, unsigned long long offset, unsigned int iBlock)
+{
+    if (!Grow((void **)&m->pMatches, &m->nAlloc, m->nMatches + 1, sizeof(DeltaMatch)))
+        return 0;
+    m->pMatches[m->nMatches].offset = offset;
+    m->pMatches[m->nMatches].iBlock = iBlock;
+    m->nMatches++;
+    return 1;
+}
+
+unsigned long long DeltaRangeStart(const DeltaSignature *s, unsigned long long cbData, int iRange, int nRanges)
+{
+    unsigned long long nBlocks = cbData / s->cbBlock;
+
+    if (iRange >= nRanges)
+        return cbData;
+    return nBlocks * (unsigned long long)iRange / (unsigned long long)nRanges * s->cbBlock;
+}
+
+int DeltaScanRange(const DeltaSignature *s, const unsigned char *pData, unsigned long long cbData,
+    unsigned long long offStart, unsigned long long offEnd, DeltaMatches *pOut,
+    volatile unsigned long long *pcbDone, volatile int *pbCancel)
+{
+    const size_t cbBlock = s->cbBlock;
+    unsigned long long o = offStart;
+    unsigned long long oReport = offStart;
+    unsigned int iWant;
+    unsigned int r;
+    long long iBlock;
+
+    if (offEnd > cbData)
+        offEnd = cbData;
+    if (s->nOrder == 0 || cbData < cbBlock)
+        offEnd = offStart;
+    iWant = (unsigned int)(offStart / cbBlock);
+
+    while (o < offEnd && o + cbBlock <= cbData)
+    {
+        /* Unchanged stretches go block after block: try the next one
+         * straight away, which spares the weak checksum of the window */
+        iBlock = -1;
+        if (iWant < s->nBlocks && s->pBlocks[iWant].cb == cbBlock &&
+            WindowIs(&s->pBlocks[iWant], pData + o, cbBlock))
+        {
+            iBlock = iWant;
+        }
+        else
+        {
+            r = CrcRegister(pData + o, cbBlock);
+            for (;;)
+            {
+                /* Most windows are ruled out by the filter alone */
+                if (s->filter[r >> 19] & (1 << ((r >> 16) & 7)))
+                {
+                    iBlock = FindBlock(s, r, pData + o, iWant);
+                    if (iBlock >= 0)
+                        break;
+                }
+
+                /* Slide the window one byte */
+                if (++o >= offEnd || o + cbBlock > cbData)
+                    break;
+                r = CRC_STEP(r, pData[o + cbBlock - 1]) ^ s->rollOut[pData[o - 1]];
+
+                if (o - oReport >= PROGRESS_STEP)
+                {
+                    oReport = o;
+                    *pcbDone = o - offStart;
+                    if (pbCancel && *pbCancel)
+                        return 1;
+                }
+            }
+            if (iBlock < 0)
+                break;
+        }
+
+        if (!AddMatch(pOut, o, (unsigned int)iBlock))
+            return 0;
+        iWant = (unsigned int)iBlock + 1;
+        o += cbBlock;
+        oReport = o;
+        *pcbDone = (o < offEnd ? o : offEnd) - offStart;
+        if (pbCancel && *pbCancel)
+            return 1;
+    }
+    *pcbDone = offEnd > offStart ? offEnd - offStart : 0;
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int AddLiteral(DeltaPlan *pPlan, unsigned long long offset, unsigned long long cb)
+{
+    DeltaOp *op;
+
+    if (cb == 0)
+        return 1;
+    if (!Grow((void **)&pPlan->pOps, &pPlan->nAlloc, pPlan->nOps + 1, sizeof(DeltaOp)))
+        return 0;
+    op = &pPlan->pOps[pPlan->nOps++];
+    op->offset = offset;
+    op->cb = cb;
+    op->iBlock = 0;
+    op->nBlocks = 0;
+    pPlan->cbLiteral += cb;
+    return 1;
+}
+
+static int AddCopy(DeltaPlan *pPlan, unsigned long long offset, unsigned int iBlock, unsigned int cb)
+{
+    DeltaOp *op = pPlan->nOps > 0 ? &pPlan->pOps[pPlan->nOps - 1] : NULL;
+
+    pPlan->cbCopied += cb;
+    if (op && op->nBlocks > 0 && op->iBlock + op->nBlocks == iBlock && op->offset + op->cb == offset)
+    {
+        op->nBlocks++;
+        op->cb += cb;
+        return 1;
+    }
+    if (!Grow((void **)&pPlan->pOps, &pPlan->nAlloc, pPlan->nOps + 1, sizeof(DeltaOp)))
+        return 0;
+    op = &pPlan->pOps[pPlan->nOps++];
+    op->offset = offset;
+    op->cb = cb;
+    op->iBlock = iBlock;
+    op->nBlocks = 1;
+    return 1;
+}
+
+int DeltaBuildPlan(const DeltaSignature *s, const unsigned char *pData, unsigned long long cbData,
+    const DeltaMatches *pRanges, int nRanges, DeltaPlan *pPlan)
+{
+    unsigned long long covered = 0;
+    size_t i;
+    int k;
+
+    memset(pPlan, 0, sizeof(*pPlan));
+    for (k = 0; k < nRanges; k++)
+    {
+        for (i = 0; i < pRanges[k].nMatches; i++)
+        {
+            const DeltaMatch *m = &pRanges[k].pMatches[i];
+
+            if (m->offset < covered)
+                continue;
+            if (!AddLiteral(pPlan, covered, m->offset - covered) ||
+                !AddCopy(pPlan, m->offset, m->iBlock, (unsigned int)s->cbBlock))
+                return 0;
+            covered = m->offset + s->cbBlock;
+        }
+    }
+
+    /* The server copy's last block, when shorter, can only be at the end */
+    if (s->nBlocks > 0 && s->pBlocks[s->nBlocks - 1].cb < s->cbBlock)
+    {
+        const DeltaBlock *b = &s->pBlocks[s->nBlocks - 1];
+
+        if (cbData >= b->cb && cbData - b->cb >= covered &&
+            CrcRegister(pData + (cbData - b->cb), b->cb) == b->crc)
+        {
+            unsigned char digest[HASH_SIZE];
+            Sha256 h;
+
+            Sha256Init(&h);
+            Sha256Update(&h, pData + (cbData - b->cb), b->cb);
+            Sha256Final(&h, digest);
+            if (memcmp(digest, b->digest, HASH_SIZE) == 0)
+            {
+                if (!AddLiteral(pPlan, covered, cbData - b->cb - covered) ||
+                    !AddCopy(pPlan, cbData - b->cb, (unsigned int)(s->nBlocks - 1), b->cb))
+                    return 0;
+                covered = cbData;
+            }
+        }
+    }
+    if (!AddLiteral(pPlan, covered, cbData - covered))
+        return 0;
+
+    pPlan->bSame = cbData == s->cbFile &&
+        (cbData == 0 || (pPlan->nOps == 1 && pPlan->pOps[0].nBlocks == s->nBlocks && pPlan->pOps[0].iBlock == 0));
+    return 1;
+}
+
+void DeltaPlanFree(DeltaPlan *pPlan)
+{
+    free(pPlan->pOps);
+    memset(pPlan, 0, sizeof(*pPlan));
+}
+
+size_t DeltaFormatOp(const DeltaOp *pOp, char *out)
+{
+    int n;
+
+    if (pOp->nBlocks > 0)
+        n = snprintf(out, 48, "c %u %u\n", pOp->iBlock, pOp->nBlocks);
+    else
+        n = snprintf(out, 48, "l %llu\n", pOp->cb);
+    return n > 0 ? (size_t)n : 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * sshfs-delta.h
+ *
+ * Block matching for "Sync changes to server" in sshfs-ssh.exe, free of
+ * Windows: the parser for the block list the server sends, the scan of the
+ * local file for blocks the server already has, and the list of copy and
+ * literal operations that rebuilds the local file from the server's copy.
+ *
+ * It works like rsync, but with nothing installed on the server: the
+ * server's weak checksum of each block is the CRC printed by POSIX cksum,
+ * and its strong one sha256sum. CRC-32 can be rolled over a window one
+ * byte at a time like rsync's checksum, so blocks are found at any offset
+ * (after an insertion too). The scan of one range of the file is
+ * independent of the others, and the caller runs ranges on several threads.
+ */
+
+#ifndef SSHFS_DELTA_H
+#define SSHFS_DELTA_H
+
+#include <stddef.h>
+
+#include "sshfs-hash.h"
+
+#define DELTA_MIN_BLOCK     (64 * 1024)
+#define DELTA_MAX_BLOCK     (16 * 1024 * 1024)
+#define DELTA_TARGET_BLOCKS 4096        /* Each block costs a few processes on the server */
+#define DELTA_LINE_MAX      256
+
+typedef struct DeltaBlock {
+    unsigned int crc;               /* CRC register of the block's bytes (not cksum's final value) */
+    unsigned int cb;
+    unsigned char digest[HASH_SIZE];
+} DeltaBlock;
+
+typedef struct DeltaSignature {
+    size_t cbBlock;
+    unsigned long long cbFile;      /* The server copy's size, from "#size" */
+    DeltaBlock *pBlocks;
+    size_t nBlocks, nAlloc;
+    unsigned int *pOrder;           /* Full blocks sorted by crc, after DeltaSignatureIndex() */
+    size_t nOrder;
+    unsigned int *pTable;           /* crc -> position in pOrder + 1, open addressing */
+    size_t nTable;
+    unsigned int rollOut[256];      /* Register for a byte followed by a block of zeros */
+    unsigned char filter[8192];     /* Bit per top 16 bits of the full blocks' crcs */
+    int bHaveCrc;                   /* A cksum line is waiting for its sha256sum line */
+    int bSize, bEnd, bNotFile, bOk, bMismatch;
+    unsigned long nSkipped;
+    char line[DELTA_LINE_MAX];
+    size_t cbLine;
+} DeltaSignature;
+
+/**
+ * Block size for a file of cbFile bytes: a power of two giving about
+ * DELTA_TARGET_BLOCKS blocks, within DELTA_MIN_BLOCK and DELTA_MAX_BLOCK
+ */
+size_t DeltaBlockSize(unsigned long long cbFile);
+
+void DeltaSignatureInit(DeltaSignature *s, size_t cbBlock);
+void DeltaSignatureFree(DeltaSignature *s);
+
+/**
+ * Feed the server's output: "#size <n>", a cksum and a sha256sum line per
+ * block, "#end", then "#ok" or "#mismatch" once the file was rebuilt
+ * ("#notfile" if it is not a regular file). Lines may span reads.
+ * Returns 0 if out of memory.
+ */
+int DeltaSignatureFeed(DeltaSignature *s, const char *data, size_t cb);
+
+/**
+ * Build the lookup for DeltaScanRange() once the list is complete.
+ * Returns 0 if out of memory or a block does not have the block size
+ * (only the last may be shorter).
+ */
+int DeltaSignatureIndex(DeltaSignature *s);
+
+/**
+ * A block of the server copy found at an offset in the local file
+ */
+typedef struct DeltaMatch {
+    unsigned long long offset;
+    unsigned int iBlock;
+} DeltaMatch;
+
+typedef struct DeltaMatches {
+    DeltaMatch *pMatches;           /* By offset, not overlapping */
+    size_t nMatches, nAlloc;
+} DeltaMatches;
+
+void DeltaMatchesFree(DeltaMatches *m);
+
+/**
+ * Start of range iRange when the local file is scanned as nRanges ranges
+ * (nRanges for the end). Ranges start on block boundaries, where an
+ * unchanged file has its blocks, so a range takes up where the one before
+ * stopped.
+ */
+unsigned long long DeltaRangeStart(const DeltaSignature *s, unsigned long long cbData, int iRange, int nRanges);
+
+/**
+ * Find full blocks starting at offsets in [offStart, offEnd) of the local
+ * file pData (cbData bytes, all readable; windows may reach past offEnd).
+ * After a match the scan continues behind it, as rsync's does, so runs of
+ * equal blocks cost one strong hash per block. *pcbDone is the scanned
+ * length so far, *pbCancel (may be NULL) stops the scan when set.
+ * Returns 0 if out of memory.
+ */
+int DeltaScanRange(const DeltaSignature *s, const unsigned char *pData, unsigned long long cbData,
+    unsigned long long offStart, unsigned long long offEnd, DeltaMatches *pOut,
+    volatile unsigned long long *pcbDone, volatile int *pbCancel);
+
+/**
+ * Rebuild step: nBlocks blocks of the server copy from iBlock on, or
+ * (nBlocks 0) cb bytes of the local file from offset on
+ */
+typedef struct DeltaOp {
+    unsigned long long offset;
+    unsigned long long cb;
+    unsigned int iBlock;
+    unsigned int nBlocks;
+} DeltaOp;
+
+typedef struct DeltaPlan {
+    DeltaOp *pOps;
+    size_t nOps, nAlloc;
+    unsigned long long cbLiteral;   /* Bytes to send */
+    unsigned long long cbCopied;    /* Bytes taken from the server copy */
+    int bSame;                      /* The local file is the server copy */
+} DeltaPlan;
+
+/**
+ * Join the matches of consecutive ranges (pRanges[0] first) into a plan
+ * covering the whole local file. Matches overlapping an earlier one (at a
+ * range boundary) are dropped; the server copy's shorter last block is
+ * looked for at the end of the file. Returns 0 if out of memory.
+ */
+int DeltaBuildPlan(const DeltaSignature *s, const unsigned char *pData, unsigned long long cbData,
+    const DeltaMatches *pRanges, int nRanges, DeltaPlan *pPlan);
+
+void DeltaPlanFree(DeltaPlan *pPlan);
+
+/**
+ * One operation as the server's rebuild loop reads it: "c <block> <count>"
+ * or "l <length>", newline terminated. Returns the length written (out
+ * needs 48 bytes).
+ */
+size_t DeltaFormatOp(const DeltaOp *pOp, char *out);
+
+#endif /* SSHFS_DELTA_H */
@@ -0,0 +1,34 @@
+/**
+ * sshfs-exec.c
+ *
+ * Console front end of "sshfs-ssh.exe exec": sshfs-exec.exe <path> -- <command>...
+ *
+ * sshfs-ssh.exe is a GUI program, so cmd at the prompt and PowerShell
+ * return before it is done and without its exit status. This is the same
+ * verb (RunRemoteExec()) linked as a console program, which every shell
+ * waits for like any other command. It is built from sshfs-ssh.exe's
+ * objects; the console entry point here is the only difference.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <string.h>
+
+#include "sshfs-ssh.h"
+
+int wmain(int argc, wchar_t *argv[])
+{
+    if (argc < 3 || (argc == 3 && wcscmp(argv[2], L"--") == 0))
+    {
+        WriteExecError(GetStdHandle(STD_ERROR_HANDLE),
+            L"Usage: sshfs-exec.exe <path> -- <command> [<argument>...]\r\n");
+        return 255;
+    }
+    return RunRemoteExec(argv[1], argv + 2, argc - 2);
+}
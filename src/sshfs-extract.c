@@ -0,0 +1,618 @@
+/**
+ * sshfs-extract.c
+ *
+ * Pipelined tar extraction with a pool of file writers (see sshfs-extract.h)
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <strsafe.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-extract.h"
+#include "sshfs-tar.h"
+
+/* Room for the \\?\ root plus an archive path converted to UTF-16 */
+#define EXTRACT_PATH_CCH (MAX_PATH * 2 + TAR_MAX_PATH + 2)
+
+/* Queue accounting counts the job itself too, so empty files stay bounded */
+#define JOB_COST(j) ((j)->cb + sizeof(ExtractJob) + MAX_PATH)
+
+/**
+ * A small file, complete in memory, waiting for a writer thread
+ */
+typedef struct ExtractJob {
+    struct ExtractJob *next;
+    LPWSTR pszPath;
+    FILETIME ftWrite;
+    size_t cb;
+    size_t cbFilled;
+    char data[1];
+} ExtractJob;
+
+struct Extractor {
+    TarReader tr;
+    WCHAR szRoot[MAX_PATH * 2];     /* \\?\ form, no trailing backslash */
+    size_t cchRoot;
+
+    /* Entry being received */
+    LPWSTR pszPath;
+    LPWSTR pszLinkPath;
+    HANDLE hFile;                   /* Large file, written on the feeding thread */
+    ExtractJob *pJob;               /* Small file, collected for a writer */
+    FILETIME ftWrite;
+    BOOL bSkip;
+    BOOL bEnd;
+    BOOL bCorrupt;
+
+    /* Writer pool */
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cvWork;
+    CONDITION_VARIABLE cvSpace;
+    CONDITION_VARIABLE cvIdle;
+    ExtractJob *pHead, *pTail;
+    size_t cbQueued;
+    int nBusy;
+    BOOL bStop;
+    HANDLE hThreads[EXTRACT_MAX_WORKERS];
+    int nThreads;
+
+    /* Counters (files and errors are also bumped by the writers) */
+    volatile LONG nFiles;
+    volatile LONG nErrors;
+    unsigned long nDirs;
+    unsigned long nSkipped;
+    unsigned long long cbWritten;
+    WCHAR szFirstError[MAX_PATH + 64];
+};
+
+static void RecordError(Extractor *x, LPCWSTR pszPath, DWORD dwError)
+{
+    InterlockedIncrement(&x->nErrors);
+
+    EnterCriticalSection(&x->cs);
+    if (!x->szFirstError[0])
+    {
+        /* Show the path as the user picked it, without the \\?\ prefix */
+        if (wcsncmp(pszPath, x->szRoot, x->cchRoot) == 0 && pszPath[x->cchRoot] == L'\\')
+            pszPath += x->cchRoot + 1;
+        StringCchPrintfW(x->szFirstError, MAX_PATH + 64, L"%s (error %lu)", pszPath, dwError);
+    }
+    LeaveCriticalSection(&x->cs);
+}
+
+static void UnixTimeToFileTime(long long t, FILETIME *pft)
+{
+    ULARGE_INTEGER u;
+
+    if (t < 0)
+        t = 0;
+    u.QuadPart = ((ULONGLONG)t + 11644473600ULL) * 10000000ULL;
+    pft->dwLowDateTime = u.LowPart;
+    pft->dwHighDateTime = u.HighPart;
+}
+
+/**
+ * Root + archive path. "." components are dropped and characters Windows
+ * does not allow in names (including a trailing dot or space) become '_'.
+ * FALSE if nothing is left or the name does not convert.
+ */
+static BOOL BuildPath(const Extractor *x, const char *pszTarPath, LPWSTR pszOut)
+{
+    WCHAR szName[TAR_MAX_PATH];
+    LPWSTR src, out;
+    int cch;
+
+    cch = MultiByteToWideChar(CP_UTF8, 0, pszTarPath, -1, szName, TAR_MAX_PATH);
+    if (cch <= 0)
+        return FALSE;
+
+    memcpy(pszOut, x->szRoot, x->cchRoot * sizeof(WCHAR));
+    out = pszOut + x->cchRoot;
+
+    for (src = szName; *src; )
+    {
+        LPWSTR end = src;
+
+        while (*end && *end != L'/')
+            end++;
+
+        if (end - src > 0 && !(end - src == 1 && src[0] == L'.'))
+        {
+            *out++ = L'\\';
+            for (; src < end; src++)
+            {
+                WCHAR c = *src;
+                if (c < 0x20 || wcschr(L"<>:\"\\|?*", c))
+                    c = L'_';
+                *out++ = c;
+            }
+            if (out[-1] == L'.' || out[-1] == L' ')
+                out[-1] = L'_';
+        }
+
+        src = *end ? end + 1 : end;
+    }
+    *out = L'\0';
+
+    return out > pszOut + x->cchRoot;
+}
+
+/**
+ * Create the missing folders above pszPath (below the root)
+ */
+static void CreateParentDirs(const Extractor *x, LPCWSTR pszPath)
+{
+    size_t cch = wcslen(pszPath);
+    LPWSTR pszDir = malloc((cch + 1) * sizeof(WCHAR));
+    LPWSTR p;
+
+    if (!pszDir)
+        return;
+    memcpy(pszDir, pszPath, (cch + 1) * sizeof(WCHAR));
+
+    for (p = pszDir + x->cchRoot + 1; *p; p++)
+    {
+        if (*p == L'\\')
+        {
+            *p = L'\0';
+            CreateDirectoryW(pszDir, NULL);
+            *p = L'\\';
+        }
+    }
+    free(pszDir);
+}
+
+static HANDLE CreateDestFile(const Extractor *x, LPCWSTR pszPath)
+{
+    HANDLE hFile = CreateFileW(pszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    /* Archives normally list folders first, but do not rely on it */
+    if (hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PATH_NOT_FOUND)
+    {
+        CreateParentDirs(x, pszPath);
+        hFile = CreateFileW(pszPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    return hFile;
+}
+
+static BOOL WriteAll(HANDLE hFile, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        DWORD cbChunk = len > 0x40000000 ? 0x40000000 : (DWORD)len;
+        DWORD cbWritten;
+
+        if (!WriteFile(hFile, data, cbChunk, &cbWritten, NULL) || cbWritten == 0)
+            return FALSE;
+        data += cbWritten;
+        len -= cbWritten;
+    }
+    return TRUE;
+}
+
+static void WriteJob(Extractor *x, ExtractJob *pJob)
+{
+    HANDLE hFile = CreateDestFile(x, pJob->pszPath);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        RecordError(x, pJob->pszPath, GetLastError());
+        return;
+    }
+
+    if (!WriteAll(hFile, pJob->data, pJob->cbFilled))
+    {
+        RecordError(x, pJob->pszPath, GetLastError());
+        CloseHandle(hFile);
+        return;
+    }
+
+    SetFileTime(hFile, NULL, NULL, &pJob->ftWrite);
+    CloseHandle(hFile);
+    InterlockedIncrement(&x->nFiles);
+}
+
+static void FreeJob(ExtractJob *pJob)
+{
+    free(pJob->pszPath);
+    free(pJob);
+}
+
+static DWORD WINAPI WriterThread(LPVOID lpParam)
+{
+    Extractor *x = (Extractor *)lpParam;
+
+    for (;;)
+    {
+        ExtractJob *pJob;
+
+        EnterCriticalSection(&x->cs);
+        while (!x->pHead && !x->bStop)
+            SleepConditionVariableCS(&x->cvWork, &x->cs, INFINITE);
+        pJob = x->pHead;
+        if (!pJob)
+        {
+            LeaveCriticalSection(&x->cs);
+            break;
+        }
+        x->pHead = pJob->next;
+        if (!x->pHead)
+            x->pTail = NULL;
+        x->nBusy++;
+        LeaveCriticalSection(&x->cs);
+
+        WriteJob(x, pJob);
+
+        EnterCriticalSection(&x->cs);
+        x->cbQueued -= JOB_COST(pJob);
+        x->nBusy--;
+        WakeAllConditionVariable(&x->cvSpace);
+        if (!x->pHead && x->nBusy == 0)
+            WakeAllConditionVariable(&x->cvIdle);
+        LeaveCriticalSection(&x->cs);
+
+        FreeJob(pJob);
+    }
+    return 0;
+}
+
+/**
+ * Hand a complete small file to the writers, waiting for queue space
+ */
+static void Enqueue(Extractor *x, ExtractJob *pJob)
+{
+    EnterCriticalSection(&x->cs);
+    while (x->cbQueued > 0 && x->cbQueued + JOB_COST(pJob) > EXTRACT_QUEUE_BYTES)
+        SleepConditionVariableCS(&x->cvSpace, &x->cs, INFINITE);
+
+    pJob->next = NULL;
+    if (x->pTail)
+        x->pTail->next = pJob;
+    else
+        x->pHead = pJob;
+    x->pTail = pJob;
+    x->cbQueued += JOB_COST(pJob);
+    WakeConditionVariable(&x->cvWork);
+    LeaveCriticalSection(&x->cs);
+}
+
+/**
+ * Wait until every queued file is on disk
+ */
+static void Drain(Extractor *x)
+{
+    EnterCriticalSection(&x->cs);
+    while (x->pHead || x->nBusy > 0)
+        SleepConditionVariableCS(&x->cvIdle, &x->cs, INFINITE);
+    LeaveCriticalSection(&x->cs);
+}
+
+Extractor *ExtractorCreate(LPCWSTR pszDestDir, int nWorkers)
+{
+    Extractor *x;
+    WCHAR szFull[MAX_PATH];
+    SYSTEM_INFO si;
+    DWORD cch;
+    int i;
+
+    cch = GetFullPathNameW(pszDestDir, MAX_PATH, szFull, NULL);
+    if (cch == 0 || cch >= MAX_PATH)
+        return NULL;
+
+    x = calloc(1, sizeof(Extractor));
+    if (!x)
+        return NULL;
+    x->pszPath = malloc(EXTRACT_PATH_CCH * sizeof(WCHAR));
+    x->pszLinkPath = malloc(EXTRACT_PATH_CCH * sizeof(WCHAR));
+    if (!x->pszPath || !x->pszLinkPath)
+    {
+        free(x->pszPath);
+        free(x->pszLinkPath);
+        free(x);
+        return NULL;
+    }
+
+    /* Extended-length paths: deep trees easily pass MAX_PATH */
+    if (wcsncmp(szFull, L"\\\\?\\", 4) == 0)
+        StringCchCopyW(x->szRoot, MAX_PATH * 2, szFull);
+    else if (wcsncmp(szFull, L"\\\\", 2) == 0)
+        StringCchPrintfW(x->szRoot, MAX_PATH * 2, L"\\\\?\\UNC\\%s", szFull + 2);
+    else
+        StringCchPrintfW(x->szRoot, MAX_PATH * 2, L"\\\\?\\%s", szFull);
+    x->cchRoot = wcslen(x->szRoot);
+    while (x->cchRoot > 0 && x->szRoot[x->cchRoot - 1] == L'\\')
+        x->szRoot[--x->cchRoot] = L'\0';
+
+    TarReaderInit(&x->tr);
+    x->hFile = INVALID_HANDLE_VALUE;
+    InitializeCriticalSection(&x->cs);
+    InitializeConditionVariable(&x->cvWork);
+    InitializeConditionVariable(&x->cvSpace);
+    InitializeConditionVariable(&x->cvIdle);
+
+    if (nWorkers <= 0)
+    {
+        GetSystemInfo(&si);
+        nWorkers = (int)si.dwNumberOfProcessors;
+        if (nWorkers < 2)
+            nWorkers = 2;
+    }
+    if (nWorkers > EXTRACT_MAX_WORKERS)
+        nWorkers = EXTRACT_MAX_WORKERS;
+
+    for (i = 0; i < nWorkers; i++)
+    {
+        x->hThreads[x->nThreads] = CreateThread(NULL, 0, WriterThread, x, 0, NULL);
+        if (x->hThreads[x->nThreads])
+            x->nThreads++;
+    }
+
+    /* Without writers, small files would queue forever */
+    if (x->nThreads == 0)
+    {
+        ExtractorFinish(x, NULL);
+        return NULL;
+    }
+
+    return x;
+}
+
+static void BeginEntry(Extractor *x)
+{
+    const TarEntry *e = &x->tr.entry;
+    DWORD dwError;
+
+    x->bSkip = TRUE;
+
+    if (!TarPathIsSafe(e->szPath))
+    {
+        /* The archive's own "." entry is expected, anything else is noteworthy */
+        if (e->type != TAR_DIRECTORY)
+            x->nSkipped++;
+        return;
+    }
+    if (!BuildPath(x, e->szPath, x->pszPath))
+    {
+        x->nSkipped++;
+        return;
+    }
+
+    switch (e->type)
+    {
+    case TAR_DIRECTORY:
+        if (!CreateDirectoryW(x->pszPath, NULL))
+        {
+            dwError = GetLastError();
+            if (dwError == ERROR_PATH_NOT_FOUND)
+            {
+                CreateParentDirs(x, x->pszPath);
+                if (CreateDirectoryW(x->pszPath, NULL))
+                    dwError = ERROR_SUCCESS;
+                else
+                    dwError = GetLastError();
+            }
+            if (dwError != ERROR_SUCCESS && dwError != ERROR_ALREADY_EXISTS)
+            {
+                RecordError(x, x->pszPath, dwError);
+                return;
+            }
+        }
+        x->nDirs++;
+        return;
+
+    case TAR_FILE:
+        UnixTimeToFileTime(e->mtime, &x->ftWrite);
+        if (e->size <= EXTRACT_SMALL_FILE)
+        {
+            size_t cchPath = wcslen(x->pszPath) + 1;
+
+            x->pJob = malloc(offsetof(ExtractJob, data) + (size_t)e->size + 1);
+            if (x->pJob)
+                x->pJob->pszPath = malloc(cchPath * sizeof(WCHAR));
+            if (!x->pJob || !x->pJob->pszPath)
+            {
+                free(x->pJob);
+                x->pJob = NULL;
+                RecordError(x, x->pszPath, ERROR_NOT_ENOUGH_MEMORY);
+                return;
+            }
+            memcpy(x->pJob->pszPath, x->pszPath, cchPath * sizeof(WCHAR));
+            x->pJob->ftWrite = x->ftWrite;
+            x->pJob->cb = (size_t)e->size;
+            x->pJob->cbFilled = 0;
+        }
+        else
+        {
+            LARGE_INTEGER liSize;
+
+            x->hFile = CreateDestFile(x, x->pszPath);
+            if (x->hFile == INVALID_HANDLE_VALUE)
+            {
+                RecordError(x, x->pszPath, GetLastError());
+                return;
+            }
+
+            /* Allocate the whole file up front to keep it in one piece */
+            liSize.QuadPart = (LONGLONG)e->size;
+            if (SetFilePointerEx(x->hFile, liSize, NULL, FILE_BEGIN))
+                SetEndOfFile(x->hFile);
+            liSize.QuadPart = 0;
+            SetFilePointerEx(x->hFile, liSize, NULL, FILE_BEGIN);
+        }
+        x->bSkip = FALSE;
+        return;
+
+    case TAR_HARDLINK:
+        if (!TarPathIsSafe(e->szLink) || !BuildPath(x, e->szLink, x->pszLinkPath))
+        {
+            x->nSkipped++;
+            return;
+        }
+
+        /* The target may still be sitting in the writer queue */
+        Drain(x);
+        if (CreateHardLinkW(x->pszPath, x->pszLinkPath, NULL) ||
+            CopyFileW(x->pszLinkPath, x->pszPath, FALSE))
+            InterlockedIncrement(&x->nFiles);
+        else
+            RecordError(x, x->pszPath, GetLastError());
+        return;
+
+    default:
+        /* Symlinks need a privilege most users lack; devices make no sense here */
+        x->nSkipped++;
+        return;
+    }
+}
+
+static void WriteData(Extractor *x, const char *data, size_t len)
+{
+    x->cbWritten += len;
+
+    if (x->bSkip)
+        return;
+
+    if (x->pJob)
+    {
+        if (len > x->pJob->cb - x->pJob->cbFilled)
+            len = x->pJob->cb - x->pJob->cbFilled;
+        memcpy(x->pJob->data + x->pJob->cbFilled, data, len);
+        x->pJob->cbFilled += len;
+    }
+    else if (x->hFile != INVALID_HANDLE_VALUE)
+    {
+        if (!WriteAll(x->hFile, data, len))
+        {
+            RecordError(x, x->pszPath, GetLastError());
+            CloseHandle(x->hFile);
+            x->hFile = INVALID_HANDLE_VALUE;
+            x->bSkip = TRUE;
+        }
+    }
+}
+
+static void EndEntry(Extractor *x)
+{
+    if (x->pJob)
+    {
+        Enqueue(x, x->pJob);
+        x->pJob = NULL;
+    }
+    else if (x->hFile != INVALID_HANDLE_VALUE)
+    {
+        SetFileTime(x->hFile, NULL, NULL, &x->ftWrite);
+        CloseHandle(x->hFile);
+        x->hFile = INVALID_HANDLE_VALUE;
+        InterlockedIncrement(&x->nFiles);
+    }
+    x->bSkip = TRUE;
+}
+
+BOOL ExtractorFeed(Extractor *x, const char *data, size_t len)
+{
+    const char *pData = NULL;
+    size_t cbData = 0;
+    TarEvent ev;
+
+    if (x->bCorrupt)
+        return FALSE;
+
+    TarReaderSetInput(&x->tr, data, len);
+    while ((ev = TarReaderNext(&x->tr, &pData, &cbData)) > TAR_NEED_INPUT)
+    {
+        switch (ev)
+        {
+        case TAR_ENTRY:
+            BeginEntry(x);
+            break;
+        case TAR_DATA:
+            WriteData(x, pData, cbData);
+            break;
+        case TAR_ENTRY_END:
+            EndEntry(x);
+            break;
+        default:
+            x->bEnd = TRUE;
+            break;
+        }
+    }
+
+    if (ev == TAR_ERROR)
+    {
+        WCHAR szError[128];
+
+        x->bCorrupt = TRUE;
+        MultiByteToWideChar(CP_UTF8, 0, x->tr.szError, -1, szError, 128);
+        EnterCriticalSection(&x->cs);
+        StringCchPrintfW(x->szFirstError, MAX_PATH + 64, L"Download stream is corrupt: %s", szError);
+        LeaveCriticalSection(&x->cs);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL ExtractorAtEnd(const Extractor *x)
+{
+    return x->bEnd;
+}
+
+void ExtractorGetStats(const Extractor *x, ExtractStats *pStats)
+{
+    pStats->nFiles = (unsigned long)x->nFiles;
+    pStats->nDirs = x->nDirs;
+    pStats->nSkipped = x->nSkipped;
+    pStats->nErrors = (unsigned long)x->nErrors;
+    pStats->cbWritten = x->cbWritten;
+    EnterCriticalSection((LPCRITICAL_SECTION)&x->cs);
+    StringCchCopyW(pStats->szFirstError, MAX_PATH + 64, x->szFirstError);
+    LeaveCriticalSection((LPCRITICAL_SECTION)&x->cs);
+}
+
+void ExtractorFinish(Extractor *x, ExtractStats *pStats)
+{
+    int i;
+
+    /* A stream cut short leaves its last file incomplete: drop it */
+    if (x->pJob)
+    {
+        FreeJob(x->pJob);
+        x->pJob = NULL;
+    }
+    if (x->hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(x->hFile);
+        DeleteFileW(x->pszPath);
+        x->hFile = INVALID_HANDLE_VALUE;
+    }
+
+    EnterCriticalSection(&x->cs);
+    x->bStop = TRUE;
+    WakeAllConditionVariable(&x->cvWork);
+    LeaveCriticalSection(&x->cs);
+
+    /* Writers empty the queue before they see the stop flag */
+    if (x->nThreads > 0)
+        WaitForMultipleObjects((DWORD)x->nThreads, x->hThreads, TRUE, INFINITE);
+    for (i = 0; i < x->nThreads; i++)
+        CloseHandle(x->hThreads[i]);
+
+    if (pStats)
+        ExtractorGetStats(x, pStats);
+
+    DeleteCriticalSection(&x->cs);
+    TarReaderFree(&x->tr);
+    free(x->pszPath);
+    free(x->pszLinkPath);
+    free(x);
+}
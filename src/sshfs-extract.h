@@ -0,0 +1,64 @@
+/**
+ * sshfs-extract.h
+ *
+ * Pipelined tar extraction for the streamed download in sshfs-ssh.exe.
+ *
+ * The thread that reads the ssh pipe feeds the archive in as it arrives.
+ * It parses headers and creates directories itself (so they exist before
+ * anything inside them), writes large files directly, and hands small files
+ * to a pool of writer threads as complete in-memory jobs. On trees of many
+ * small files the per-file cost is CreateFile/CloseHandle on NTFS (plus the
+ * virus scanner's look at each new file), and that is what runs in parallel.
+ * Queued job memory is bounded; the feeding thread blocks when it is full,
+ * which pushes back on the pipe and ssh.
+ */
+
+#ifndef SSHFS_EXTRACT_H
+#define SSHFS_EXTRACT_H
+
+#include <windows.h>
+
+#define EXTRACT_MAX_WORKERS   8
+#define EXTRACT_SMALL_FILE    (1024 * 1024)         /* Larger files are written inline */
+#define EXTRACT_QUEUE_BYTES   (64 * 1024 * 1024)    /* Small file jobs waiting for a writer */
+
+typedef struct Extractor Extractor;
+
+typedef struct ExtractStats {
+    unsigned long nFiles;           /* Files and hard links written */
+    unsigned long nDirs;
+    unsigned long nSkipped;         /* Symlinks, special files, unsafe names */
+    unsigned long nErrors;          /* Entries that could not be written */
+    unsigned long long cbWritten;   /* Content bytes received so far */
+    WCHAR szFirstError[MAX_PATH + 64];
+} ExtractStats;
+
+/**
+ * Extract into pszDestDir (must exist). nWorkers = 0 picks one per CPU,
+ * capped at EXTRACT_MAX_WORKERS.
+ */
+Extractor *ExtractorCreate(LPCWSTR pszDestDir, int nWorkers);
+
+/**
+ * Feed the next piece of the archive. FALSE once the archive is corrupt;
+ * per-file errors are counted instead and do not stop extraction.
+ */
+BOOL ExtractorFeed(Extractor *x, const char *data, size_t len);
+
+/**
+ * TRUE once the archive's end marker has been seen
+ */
+BOOL ExtractorAtEnd(const Extractor *x);
+
+/**
+ * Counters so far (feeding thread only)
+ */
+void ExtractorGetStats(const Extractor *x, ExtractStats *pStats);
+
+/**
+ * Wait for queued files to be written, stop the writers and free everything.
+ * Final counters go to pStats (may be NULL).
+ */
+void ExtractorFinish(Extractor *x, ExtractStats *pStats);
+
+#endif /* SSHFS_EXTRACT_H */
@@ -0,0 +1,208 @@
+/**
+ * sshfs-fanout.c
+ *
+ * Broadcast ring and launch scheduling for fan-out terminals (see sshfs-fanout.h)
+ */
+
+#include "sshfs-fanout.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NOT_COUNTED (~0ULL)         /* pStartMs of a start that timed out */
+
+int FanoutInit(Fanout *f, size_t nSinks, size_t cbRing)
+{
+    memset(f, 0, sizeof(*f));
+    f->pRing = malloc(cbRing);
+    f->pSinks = calloc(nSinks ? nSinks : 1, sizeof(FanoutSink));
+    if (!f->pRing || !f->pSinks)
+    {
+        FanoutFree(f);
+        return 0;
+    }
+    f->cbRing = cbRing;
+    f->nSinks = nSinks;
+    return 1;
+}
+
+void FanoutFree(Fanout *f)
+{
+    free(f->pRing);
+    free(f->pSinks);
+    memset(f, 0, sizeof(*f));
+}
+
+size_t FanoutPush(Fanout *f, const void *data, size_t cb, unsigned long long nowMs)
+{
+    const unsigned char *p = data;
+    size_t nDropped = 0;
+    size_t i, off, run;
+
+    /* Only the last ring's worth of a huge push can be kept */
+    if (cb > f->cbRing)
+    {
+        f->head += cb - f->cbRing;
+        p += cb - f->cbRing;
+        cb = f->cbRing;
+    }
+
+    for (i = 0; i < f->nSinks; i++)
+    {
+        FanoutSink *k = &f->pSinks[i];
+        if (k->bDropped)
+            continue;
+        if (f->head + cb - k->pos > f->cbRing)
+        {
+            k->bDropped = 1;
+            f->nDropped++;
+            nDropped++;
+        }
+        else if (k->pos == f->head)
+        {
+            k->msProgress = nowMs;      /* The stall clock starts with pending input */
+        }
+    }
+
+    off = (size_t)(f->head & (f->cbRing - 1));
+    run = f->cbRing - off < cb ? f->cbRing - off : cb;
+    memcpy(f->pRing + off, p, run);
+    memcpy(f->pRing, p + run, cb - run);
+    f->head += cb;
+    return nDropped;
+}
+
+size_t FanoutRoom(Fanout *f, unsigned long long nowMs)
+{
+    unsigned long long lo = f->head;
+    size_t i;
+
+    for (i = 0; i < f->nSinks; i++)
+    {
+        FanoutSink *k = &f->pSinks[i];
+        if (k->bDropped)
+            continue;
+        if (f->head - k->pos > f->cbRing / 2 && nowMs - k->msProgress >= FANOUT_STALL_MS)
+        {
+            k->bDropped = 1;
+            f->nDropped++;
+            continue;
+        }
+        if (k->pos < lo)
+            lo = k->pos;
+    }
+    return f->cbRing - (size_t)(f->head - lo);
+}
+
+size_t FanoutPeek(const Fanout *f, size_t iSink, const unsigned char **ppData)
+{
+    const FanoutSink *k = &f->pSinks[iSink];
+    size_t off, cb;
+
+    if (k->bDropped || k->pos == f->head)
+        return 0;
+
+    off = (size_t)(k->pos & (f->cbRing - 1));
+    cb = (size_t)(f->head - k->pos);
+    if (cb > f->cbRing - off)
+        cb = f->cbRing - off;
+    *ppData = f->pRing + off;
+    return cb;
+}
+
+void FanoutConsume(Fanout *f, size_t iSink, size_t cb, unsigned long long nowMs)
+{
+    f->pSinks[iSink].pos += cb;
+    f->pSinks[iSink].msProgress = nowMs;
+}
+
+void FanoutDrop(Fanout *f, size_t iSink)
+{
+    if (!f->pSinks[iSink].bDropped)
+    {
+        f->pSinks[iSink].bDropped = 1;
+        f->nDropped++;
+    }
+}
+
+int FanoutScheduleInit(FanoutSchedule *s, size_t n, size_t maxStarting, unsigned long timeoutMs)
+{
+    memset(s, 0, sizeof(*s));
+    s->pStates = calloc(n ? n : 1, sizeof(FanoutState));
+    s->pStartMs = calloc(n ? n : 1, sizeof(unsigned long long));
+    if (!s->pStates || !s->pStartMs)
+    {
+        FanoutScheduleFree(s);
+        return 0;
+    }
+    s->n = n;
+    s->maxStarting = maxStarting ? maxStarting : 1;
+    s->timeoutMs = timeoutMs;
+    return 1;
+}
+
+void FanoutScheduleFree(FanoutSchedule *s)
+{
+    free(s->pStates);
+    free(s->pStartMs);
+    memset(s, 0, sizeof(*s));
+}
+
+long FanoutScheduleNext(FanoutSchedule *s, unsigned long long nowMs)
+{
+    size_t i;
+
+    /* Slow starts give their place to the next session */
+    for (i = 0; i < s->iNext && s->nStarting >= s->maxStarting; i++)
+    {
+        if (s->pStates[i] == FANOUT_STARTING && s->pStartMs[i] != NOT_COUNTED &&
+            nowMs - s->pStartMs[i] >= s->timeoutMs)
+        {
+            s->pStartMs[i] = NOT_COUNTED;
+            s->nStarting--;
+        }
+    }
+
+    if (s->iNext >= s->n || s->nStarting >= s->maxStarting)
+        return -1;
+
+    i = s->iNext++;
+    s->pStates[i] = FANOUT_STARTING;
+    s->pStartMs[i] = nowMs;
+    s->nStarting++;
+    return (long)i;
+}
+
+void FanoutScheduleDone(FanoutSchedule *s, size_t i, int bOk)
+{
+    if (s->pStates[i] != FANOUT_STARTING)
+        return;
+    if (s->pStartMs[i] != NOT_COUNTED)
+        s->nStarting--;
+    s->pStates[i] = bOk ? FANOUT_READY : FANOUT_FAILED;
+}
+
+unsigned long FanoutScheduleWait(const FanoutSchedule *s, unsigned long long nowMs)
+{
+    unsigned long long due = NOT_COUNTED;
+    size_t i;
+
+    /* Timeouts only matter while they keep a pending session waiting */
+    if (s->iNext >= s->n || s->nStarting < s->maxStarting)
+        return ~0UL;
+
+    for (i = 0; i < s->iNext; i++)
+    {
+        if (s->pStates[i] == FANOUT_STARTING && s->pStartMs[i] != NOT_COUNTED &&
+            s->pStartMs[i] + s->timeoutMs < due)
+            due = s->pStartMs[i] + s->timeoutMs;
+    }
+    if (due == NOT_COUNTED)
+        return ~0UL;
+    return due <= nowMs ? 0 : (unsigned long)(due - nowMs);
+}
+
+int FanoutScheduleStarted(const FanoutSchedule *s)
+{
+    return s->iNext >= s->n;
+}
@@ -0,0 +1,124 @@
+/**
+ * sshfs-fanout.h
+ *
+ * Broadcast input for "Open SSH Terminal Here" on every mount of the same
+ * tree: one stream of keystrokes goes to many sessions, each written on its
+ * own (a thread per session on Windows, a non-blocking descriptor on Linux).
+ *
+ * The stream is kept once, in a ring, and each session only has a read
+ * position in it, so typing costs the same with 100 sessions as with one.
+ * A session that stops reading falls behind on its own. Input is only held
+ * back (FanoutRoom()) while the ring is full, i.e. during a large paste, and
+ * then only for sessions still taking input: one that has taken nothing for
+ * FANOUT_STALL_MS is dropped instead of holding the others back.
+ *
+ * FanoutSchedule starts the sessions a few at a time: a session counts as
+ * starting until it reports ready (or FANOUT_START_TIMEOUT_MS passes), so
+ * dozens of ssh handshakes and terminal windows do not all land at once.
+ */
+
+#ifndef SSHFS_FANOUT_H
+#define SSHFS_FANOUT_H
+
+#include <stddef.h>
+
+#define FANOUT_RING_SIZE        (1024 * 1024)   /* Power of two */
+#define FANOUT_STALL_MS         2000
+#define FANOUT_MAX_STARTING     8
+#define FANOUT_START_TIMEOUT_MS 15000
+
+typedef struct FanoutSink {
+    unsigned long long pos;         /* Stream offset of the next byte to write */
+    unsigned long long msProgress;  /* Last write, or when input became pending */
+    int bDropped;
+} FanoutSink;
+
+typedef struct Fanout {
+    unsigned char *pRing;
+    size_t cbRing;
+    unsigned long long head;        /* Bytes pushed so far */
+    FanoutSink *pSinks;
+    size_t nSinks;
+    size_t nDropped;
+} Fanout;
+
+/**
+ * nSinks sessions, all starting at the beginning of the stream so a session
+ * that connects late still gets everything typed before. Returns 0 if out
+ * of memory.
+ */
+int FanoutInit(Fanout *f, size_t nSinks, size_t cbRing);
+void FanoutFree(Fanout *f);
+
+/**
+ * Append input for every session. Sessions the new bytes would overrun are
+ * dropped; returns how many were dropped by this call.
+ */
+size_t FanoutPush(Fanout *f, const void *data, size_t cb, unsigned long long nowMs);
+
+/**
+ * Bytes that can be pushed without overrunning a session, after dropping
+ * sessions that are far behind and have taken nothing for FANOUT_STALL_MS.
+ * The reader waits (and asks again) while this is below what it has.
+ */
+size_t FanoutRoom(Fanout *f, unsigned long long nowMs);
+
+/**
+ * The next contiguous run of bytes for sink iSink (0 if it is up to date or
+ * dropped). *ppData stays valid until the next FanoutPush().
+ */
+size_t FanoutPeek(const Fanout *f, size_t iSink, const unsigned char **ppData);
+
+/**
+ * Mark cb bytes of sink iSink written
+ */
+void FanoutConsume(Fanout *f, size_t iSink, size_t cb, unsigned long long nowMs);
+
+/**
+ * Stop writing to a sink (its session ended)
+ */
+void FanoutDrop(Fanout *f, size_t iSink);
+
+typedef enum {
+    FANOUT_PENDING,
+    FANOUT_STARTING,
+    FANOUT_READY,
+    FANOUT_FAILED
+} FanoutState;
+
+typedef struct FanoutSchedule {
+    FanoutState *pStates;
+    unsigned long long *pStartMs;
+    size_t n;
+    size_t nStarting, maxStarting;
+    size_t iNext;                   /* First session that may still be pending */
+    unsigned long timeoutMs;
+} FanoutSchedule;
+
+int FanoutScheduleInit(FanoutSchedule *s, size_t n, size_t maxStarting, unsigned long timeoutMs);
+void FanoutScheduleFree(FanoutSchedule *s);
+
+/**
+ * The next session to start now, or -1 if none may start yet. Sessions
+ * starting for longer than the timeout stop counting against the limit
+ * (they stay FANOUT_STARTING until reported).
+ */
+long FanoutScheduleNext(FanoutSchedule *s, unsigned long long nowMs);
+
+/**
+ * Report a session ready (bOk) or failed
+ */
+void FanoutScheduleDone(FanoutSchedule *s, size_t i, int bOk);
+
+/**
+ * Milliseconds until a starting session times out (0 if one already has),
+ * or ~0UL if nothing is waiting on a timeout
+ */
+unsigned long FanoutScheduleWait(const FanoutSchedule *s, unsigned long long nowMs);
+
+/**
+ * Every session has been started
+ */
+int FanoutScheduleStarted(const FanoutSchedule *s);
+
+#endif /* SSHFS_FANOUT_H */
@@ -0,0 +1,227 @@
+/**
+ * sshfs-gzip.c
+ *
+ * Fixed-Huffman deflate in gzip members (see sshfs-gzip.h)
+ */
+
+#include "sshfs-gzip.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH   3
+#define MAX_MATCH   258
+
+static const unsigned short g_lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char g_lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short g_distBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char g_distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/**
+ * Deflate's bit order: values LSB first, Huffman codes MSB first
+ */
+typedef struct BitWriter {
+    unsigned char *p, *end;
+    unsigned long long bits;
+    int nBits;
+    int bOverflow;
+} BitWriter;
+
+static void PutBits(BitWriter *w, unsigned int value, int nBits)
+{
+    w->bits |= (unsigned long long)value << w->nBits;
+    w->nBits += nBits;
+    while (w->nBits >= 8)
+    {
+        if (w->p < w->end)
+            *w->p++ = (unsigned char)w->bits;
+        else
+            w->bOverflow = 1;
+        w->bits >>= 8;
+        w->nBits -= 8;
+    }
+}
+
+static void PutCode(BitWriter *w, unsigned int code, int nBits)
+{
+    unsigned int reversed = 0;
+    int i;
+
+    for (i = 0; i < nBits; i++)
+        reversed |= ((code >> i) & 1) << (nBits - 1 - i);
+    PutBits(w, reversed, nBits);
+}
+
+/**
+ * Literal/length symbol in the fixed code (RFC 1951 3.2.6)
+ */
+static void PutSymbol(BitWriter *w, unsigned int sym)
+{
+    if (sym < 144)
+        PutCode(w, 0x30 + sym, 8);
+    else if (sym < 256)
+        PutCode(w, 0x190 + sym - 144, 9);
+    else if (sym < 280)
+        PutCode(w, sym - 256, 7);
+    else
+        PutCode(w, 0xC0 + sym - 280, 8);
+}
+
+static void PutMatch(BitWriter *w, int len, int dist)
+{
+    int i = 28, j = 29;
+
+    while (g_lengthBase[i] > len)
+        i--;
+    PutSymbol(w, 257 + (unsigned int)i);
+    PutBits(w, (unsigned int)(len - g_lengthBase[i]), g_lengthExtra[i]);
+
+    while (g_distBase[j] > dist)
+        j--;
+    PutCode(w, (unsigned int)j, 5);
+    PutBits(w, (unsigned int)(dist - g_distBase[j]), g_distExtra[j]);
+}
+
+static unsigned int Hash3(const unsigned char *p)
+{
+    return (((unsigned int)p[0] << 10) ^ ((unsigned int)p[1] << 5) ^ p[2]) & (GZIP_HASH_SIZE - 1);
+}
+
+int GzipInit(GzipCompressor *z)
+{
+    unsigned int i, k, c;
+
+    z->pHead = (int *)malloc(GZIP_HASH_SIZE * sizeof(int));
+    z->pPrev = (int *)malloc(GZIP_WINDOW * sizeof(int));
+    if (!z->pHead || !z->pPrev)
+    {
+        GzipFree(z);
+        return 0;
+    }
+
+    /* gzip's CRC-32 is the reflected one (unlike cksum's) */
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        z->crcTable[i] = c;
+    }
+    return 1;
+}
+
+void GzipFree(GzipCompressor *z)
+{
+    free(z->pHead);
+    free(z->pPrev);
+    z->pHead = NULL;
+    z->pPrev = NULL;
+}
+
+static void Insert(GzipCompressor *z, const unsigned char *in, int pos)
+{
+    unsigned int h = Hash3(in + pos);
+    z->pPrev[pos & (GZIP_WINDOW - 1)] = z->pHead[h];
+    z->pHead[h] = pos;
+}
+
+size_t GzipMember(GzipCompressor *z, const void *data, size_t cb, unsigned char *out, size_t cbOut)
+{
+    static const unsigned char header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+    const unsigned char *in = (const unsigned char *)data;
+    unsigned int crc = 0xFFFFFFFFu;
+    BitWriter w;
+    int n = (int)cb;
+    int i = 0;
+    size_t k;
+
+    if (cbOut < sizeof(header) + 8 || cb > 0x7FFFFFFF)
+        return 0;
+    memcpy(out, header, sizeof(header));
+    w.p = out + sizeof(header);
+    w.end = out + cbOut - 8;
+    w.bits = 0;
+    w.nBits = 0;
+    w.bOverflow = 0;
+
+    /* One final block with the fixed code */
+    PutBits(&w, 1, 1);
+    PutBits(&w, 1, 2);
+
+    memset(z->pHead, 0xff, GZIP_HASH_SIZE * sizeof(int));
+    while (i < n)
+    {
+        int bestLen = 0, bestDist = 0;
+
+        if (i + MIN_MATCH <= n)
+        {
+            int maxLen = n - i < MAX_MATCH ? n - i : MAX_MATCH;
+            int cand = z->pHead[Hash3(in + i)];
+            int chain = GZIP_MAX_CHAIN;
+
+            while (cand >= 0 && i - cand <= GZIP_WINDOW && chain-- > 0)
+            {
+                if (in[cand + bestLen] == in[i + bestLen])
+                {
+                    int len = 0;
+                    while (len < maxLen && in[cand + len] == in[i + len])
+                        len++;
+                    if (len > bestLen)
+                    {
+                        bestLen = len;
+                        bestDist = i - cand;
+                        if (len == maxLen)
+                            break;
+                    }
+                }
+                cand = z->pPrev[cand & (GZIP_WINDOW - 1)];
+            }
+            Insert(z, in, i);
+        }
+
+        if (bestLen >= MIN_MATCH)
+        {
+            int end = i + bestLen;
+
+            PutMatch(&w, bestLen, bestDist);
+            for (i++; i < end; i++)
+            {
+                if (i + MIN_MATCH <= n)
+                    Insert(z, in, i);
+            }
+        }
+        else
+        {
+            PutSymbol(&w, in[i]);
+            i++;
+        }
+    }
+    PutSymbol(&w, 256);
+    if (w.nBits > 0)
+        PutBits(&w, 0, 8 - w.nBits);
+    if (w.bOverflow)
+        return 0;
+
+    for (k = 0; k < cb; k++)
+        crc = z->crcTable[(crc ^ in[k]) & 0xff] ^ (crc >> 8);
+    crc ^= 0xFFFFFFFFu;
+
+    /* Trailer: CRC-32 and length, little endian (w.end left room for it) */
+    for (k = 0; k < 4; k++)
+        *w.p++ = (unsigned char)(crc >> (8 * k));
+    for (k = 0; k < 4; k++)
+        *w.p++ = (unsigned char)(cb >> (8 * k));
+    return (size_t)(w.p - out);
+}
@@ -0,0 +1,44 @@
+/**
+ * sshfs-gzip.h
+ *
+ * One-shot gzip compressor for session recordings (sshfs-record.c). Each
+ * call turns a buffer into one complete gzip member; members can simply be
+ * appended to a file, and gzip -d, zcat and zlib read them as one stream.
+ *
+ * Deflate with LZ77 matches and the fixed Huffman code only: well behind
+ * gzip -9, but terminal output repeats itself so much (escape sequences,
+ * prompts, columns) that matches do most of the work, and nothing has to
+ * be counted, built or sent per block.
+ */
+
+#ifndef SSHFS_GZIP_H
+#define SSHFS_GZIP_H
+
+#include <stddef.h>
+
+/* Output never exceeds this (9-bit literals, header and trailer) */
+#define GZIP_BOUND(cb)      ((cb) + (cb) / 8 + 64)
+
+#define GZIP_WINDOW         32768
+#define GZIP_HASH_SIZE      32768
+#define GZIP_MAX_CHAIN      32      /* Candidates tried per position */
+
+typedef struct GzipCompressor {
+    int *pHead;                     /* Last position per 3-byte hash */
+    int *pPrev;                     /* Previous position with the same hash, by position % window */
+    unsigned int crcTable[256];
+} GzipCompressor;
+
+/**
+ * Returns 0 if out of memory
+ */
+int GzipInit(GzipCompressor *z);
+void GzipFree(GzipCompressor *z);
+
+/**
+ * Compress cb bytes into one gzip member in out (GZIP_BOUND(cb) bytes is
+ * always enough). Returns the member's length, 0 if out was too small.
+ */
+size_t GzipMember(GzipCompressor *z, const void *data, size_t cb, unsigned char *out, size_t cbOut);
+
+#endif /* SSHFS_GZIP_H */
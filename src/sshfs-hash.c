@@ -0,0 +1,274 @@
+/**
+ * sshfs-hash.c
+ *
+ * SHA-256, sha256sum output parsing and channel scheduling (see sshfs-hash.h)
+ */
+
+#include "sshfs-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const unsigned int K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/**
+ * Process nBlocks 64 byte blocks
+ */
+static void Compress(unsigned int state[8], const unsigned char *p, size_t nBlocks)
+{
+    unsigned int w[64];
+
+    while (nBlocks--)
+    {
+        unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+        unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+        int i;
+
+        for (i = 0; i < 16; i++, p += 4)
+            w[i] = (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 | (unsigned int)p[2] << 8 | p[3];
+        for (; i < 64; i++)
+        {
+            unsigned int s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            unsigned int s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        for (i = 0; i < 64; i++)
+        {
+            unsigned int t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            unsigned int t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+void Sha256Init(Sha256 *h)
+{
+    static const unsigned int init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(h->state, init, sizeof(init));
+    h->cbTotal = 0;
+    h->cbBlock = 0;
+}
+
+void Sha256Update(Sha256 *h, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    h->cbTotal += len;
+
+    if (h->cbBlock > 0)
+    {
+        size_t n = 64 - h->cbBlock;
+        if (n > len)
+            n = len;
+        memcpy(h->block + h->cbBlock, p, n);
+        h->cbBlock += n;
+        p += n;
+        len -= n;
+        if (h->cbBlock < 64)
+            return;
+        Compress(h->state, h->block, 1);
+        h->cbBlock = 0;
+    }
+
+    /* Whole blocks straight from the caller's buffer */
+    Compress(h->state, p, len / 64);
+    p += len & ~(size_t)63;
+    len &= 63;
+
+    memcpy(h->block, p, len);
+    h->cbBlock = len;
+}
+
+void Sha256Final(Sha256 *h, unsigned char digest[HASH_SIZE])
+{
+    unsigned long long bits = h->cbTotal * 8;
+    int i;
+
+    h->block[h->cbBlock++] = 0x80;
+    if (h->cbBlock > 56)
+    {
+        memset(h->block + h->cbBlock, 0, 64 - h->cbBlock);
+        Compress(h->state, h->block, 1);
+        h->cbBlock = 0;
+    }
+    memset(h->block + h->cbBlock, 0, 56 - h->cbBlock);
+    for (i = 0; i < 8; i++)
+        h->block[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+    Compress(h->state, h->block, 1);
+
+    for (i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (unsigned char)(h->state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(h->state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(h->state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)h->state[i];
+    }
+}
+
+void HashToHex(const unsigned char digest[HASH_SIZE], char *out)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (int i = 0; i < HASH_SIZE; i++)
+    {
+        out[2 * i] = hex[digest[i] >> 4];
+        out[2 * i + 1] = hex[digest[i] & 15];
+    }
+    out[HASH_HEX_LEN] = '\0';
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int HashParseLine(const char *pszLine, size_t cchLine,
+    unsigned char digest[HASH_SIZE], char *pszName, size_t cbName)
+{
+    const char *p = pszLine, *end = pszLine + cchLine;
+    int bEscaped = 0;
+    size_t n = 0;
+
+    /* "\<hash>  <escaped name>" when the name has a backslash or newline */
+    if (p < end && *p == '\\')
+    {
+        bEscaped = 1;
+        p++;
+    }
+
+    if (end - p < HASH_HEX_LEN + 2)
+        return 0;
+    for (int i = 0; i < HASH_SIZE; i++)
+    {
+        int hi = HexValue(p[2 * i]), lo = HexValue(p[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return 0;
+        digest[i] = (unsigned char)(hi << 4 | lo);
+    }
+    p += HASH_HEX_LEN;
+
+    /* Two spaces (text mode) or space and '*' (binary mode) */
+    if (p[0] != ' ' || (p[1] != ' ' && p[1] != '*'))
+        return 0;
+    p += 2;
+
+    for (; p < end; p++)
+    {
+        char c = *p;
+
+        if (bEscaped && c == '\\')
+        {
+            if (++p == end)
+                return 0;
+            c = *p == 'n' ? '\n' : *p == 'r' ? '\r' : *p;
+        }
+        if (n + 1 >= cbName)
+            return 0;
+        pszName[n++] = c;
+    }
+    if (n == 0)
+        return 0;
+    pszName[n] = '\0';
+    return 1;
+}
+
+int HashChannelCount(size_t nFiles, unsigned long long cbTotal)
+{
+    unsigned long long n = cbTotal / HASH_CHANNEL_MIN_BYTES;
+
+    if (n > HASH_MAX_CHANNELS)
+        n = HASH_MAX_CHANNELS;
+    if (n > nFiles)
+        n = nFiles;
+    return n < 1 ? 1 : (int)n;
+}
+
+static const unsigned long long *g_pSortSizes;
+
+static int CompareSizeDesc(const void *a, const void *b)
+{
+    unsigned long long x = g_pSortSizes[*(const size_t *)a];
+    unsigned long long y = g_pSortSizes[*(const size_t *)b];
+
+    if (x != y)
+        return x < y ? 1 : -1;
+    /* Keep list order among equal sizes so the split is deterministic */
+    return *(const size_t *)a < *(const size_t *)b ? -1 : 1;
+}
+
+int HashSchedule(const unsigned long long *pSizes, size_t nFiles, int nChannels,
+    int *pChannel, unsigned long long *pLoad)
+{
+    unsigned long long load[HASH_MAX_CHANNELS] = {0};
+    size_t *order;
+    size_t i;
+
+    if (nChannels < 1)
+        nChannels = 1;
+    if (nChannels > HASH_MAX_CHANNELS)
+        nChannels = HASH_MAX_CHANNELS;
+
+    order = malloc((nFiles ? nFiles : 1) * sizeof(size_t));
+    if (!order)
+        return 0;
+    for (i = 0; i < nFiles; i++)
+        order[i] = i;
+
+    /* Called from one thread at a time (qsort has no context argument in C89) */
+    g_pSortSizes = pSizes;
+    qsort(order, nFiles, sizeof(size_t), CompareSizeDesc);
+    g_pSortSizes = NULL;
+
+    for (i = 0; i < nFiles; i++)
+    {
+        int best = 0;
+
+        for (int c = 1; c < nChannels; c++)
+        {
+            if (load[c] < load[best])
+                best = c;
+        }
+        pChannel[order[i]] = best;
+        /* Empty files still cost a file open on the server */
+        load[best] += pSizes[order[i]] + 1;
+    }
+
+    if (pLoad)
+    {
+        for (int c = 0; c < nChannels; c++)
+            pLoad[c] = load[c];
+    }
+    free(order);
+    return 1;
+}
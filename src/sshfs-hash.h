@@ -0,0 +1,67 @@
+/**
+ * sshfs-hash.h
+ *
+ * Pieces of "Hash on server" and "Compare with local folder" in
+ * sshfs-ssh.exe that do not depend on Windows: SHA-256 for the local side,
+ * the parser for sha256sum's output, and the split of a file list over
+ * several ssh channels.
+ *
+ * Each channel runs one sha256sum over its share of the files, so a channel
+ * takes as long as the bytes it was given. Shares are built largest file
+ * first onto the least loaded channel (LPT scheduling), which keeps the
+ * slowest channel within 4/3 of the best possible split.
+ */
+
+#ifndef SSHFS_HASH_H
+#define SSHFS_HASH_H
+
+#include <stddef.h>
+
+#define HASH_SIZE       32                  /* SHA-256 digest bytes */
+#define HASH_HEX_LEN    (HASH_SIZE * 2)
+#define HASH_MAX_CHANNELS 4
+
+/* Below this much data per channel another ssh connection costs more than it saves */
+#define HASH_CHANNEL_MIN_BYTES (64ULL * 1024 * 1024)
+
+typedef struct Sha256 {
+    unsigned int state[8];
+    unsigned long long cbTotal;
+    unsigned char block[64];
+    size_t cbBlock;
+} Sha256;
+
+void Sha256Init(Sha256 *h);
+void Sha256Update(Sha256 *h, const void *data, size_t len);
+void Sha256Final(Sha256 *h, unsigned char digest[HASH_SIZE]);
+
+/**
+ * Lowercase hex, NUL terminated (out needs HASH_HEX_LEN + 1)
+ */
+void HashToHex(const unsigned char digest[HASH_SIZE], char *out);
+
+/**
+ * Parse one line of "sha256sum" output (without the line end). Handles the
+ * escaped form GNU coreutils uses for names containing a backslash or a
+ * newline. The name goes to pszName (UTF-8 as the server printed it).
+ * Returns 1 on success, 0 for anything else (error messages, truncation).
+ */
+int HashParseLine(const char *pszLine, size_t cchLine,
+    unsigned char digest[HASH_SIZE], char *pszName, size_t cbName);
+
+/**
+ * How many channels a list of nFiles totalling cbTotal bytes is worth,
+ * between 1 and HASH_MAX_CHANNELS
+ */
+int HashChannelCount(size_t nFiles, unsigned long long cbTotal);
+
+/**
+ * Assign each file to one of nChannels (LPT: largest first, onto the least
+ * loaded). pChannel[i] receives the channel of file i; pLoad (may be NULL,
+ * nChannels entries) the load of each: bytes plus one per file, since an
+ * empty file still costs an open. Returns 0 if out of memory.
+ */
+int HashSchedule(const unsigned long long *pSizes, size_t nFiles, int nChannels,
+    int *pChannel, unsigned long long *pLoad);
+
+#endif /* SSHFS_HASH_H */
@@ -0,0 +1,820 @@
+/**
+ * sshfs-index.c
+ *
+ * Snapshot index of a remote tree (see sshfs-index.h)
+ */
+
+#include "sshfs-index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK     (16 * 1024 * 1024)
+#define WRITE_BUFFER    (1024 * 1024)
+
+static const char g_szMagic[8] = "SSHFSIX";
+
+typedef struct BuilderItem {
+    const char *pszPath;
+    unsigned long long size;
+    long long mtime;
+    unsigned int nBelow;
+    char type;
+} BuilderItem;
+
+struct IndexBuilder {
+    BuilderItem *pItems;
+    size_t nItems;
+    size_t nAlloc;
+    char **ppChunks;                /* Path strings, never moved once added */
+    size_t nChunks;
+    size_t nChunksAlloc;
+    size_t cbChunkUsed;
+    int bSorted;
+};
+
+/**
+ * Tree order: '/' sorts before every other byte, so a folder is directly
+ * followed by its contents ("a", "a/x", "a.b" rather than "a", "a.b", "a/x")
+ */
+static int ComparePaths(const char *a, const char *b)
+{
+    for (;; a++, b++)
+    {
+        unsigned char x = (unsigned char)*a, y = (unsigned char)*b;
+
+        if (x == y)
+        {
+            if (x == '\0')
+                return 0;
+            continue;
+        }
+        if (x == '/')
+            x = 1;
+        if (y == '/')
+            y = 1;
+        return x < y ? -1 : 1;
+    }
+}
+
+/**
+ * pszPath is somewhere below the folder pszDir (cchDir = strlen)
+ */
+static int IsBelow(const char *pszPath, const char *pszDir, size_t cchDir)
+{
+    return strncmp(pszPath, pszDir, cchDir) == 0 && pszPath[cchDir] == '/';
+}
+
+IndexBuilder *IndexBuilderCreate(void)
+{
+    return calloc(1, sizeof(IndexBuilder));
+}
+
+void IndexBuilderFree(IndexBuilder *b)
+{
+    if (!b)
+        return;
+    while (b->nChunks > 0)
+        free(b->ppChunks[--b->nChunks]);
+    free(b->ppChunks);
+    free(b->pItems);
+    free(b);
+}
+
+static const char *StorePath(IndexBuilder *b, const char *pszPath, size_t cch)
+{
+    char *p;
+
+    if (b->nChunks == 0 || cch + 1 > ARENA_CHUNK - b->cbChunkUsed)
+    {
+        if (b->nChunks == b->nChunksAlloc)
+        {
+            size_t nAlloc = b->nChunksAlloc ? b->nChunksAlloc * 2 : 16;
+            char **pp = realloc(b->ppChunks, nAlloc * sizeof(char *));
+            if (!pp)
+                return NULL;
+            b->ppChunks = pp;
+            b->nChunksAlloc = nAlloc;
+        }
+        b->ppChunks[b->nChunks] = malloc(ARENA_CHUNK);
+        if (!b->ppChunks[b->nChunks])
+            return NULL;
+        b->nChunks++;
+        b->cbChunkUsed = 0;
+    }
+
+    p = b->ppChunks[b->nChunks - 1] + b->cbChunkUsed;
+    memcpy(p, pszPath, cch + 1);
+    b->cbChunkUsed += cch + 1;
+    return p;
+}
+
+int IndexBuilderAdd(IndexBuilder *b, const char *pszPath, char type,
+    unsigned long long size, long long mtime)
+{
+    size_t cch = strlen(pszPath);
+    BuilderItem *item;
+
+    /* Such paths cannot be decoded again; leave them out */
+    if (cch == 0 || cch > INDEX_MAX_PATH)
+        return 1;
+
+    if (b->nItems == b->nAlloc)
+    {
+        size_t nAlloc = b->nAlloc ? b->nAlloc * 2 : 4096;
+        BuilderItem *pItems = realloc(b->pItems, nAlloc * sizeof(BuilderItem));
+        if (!pItems)
+            return 0;
+        b->pItems = pItems;
+        b->nAlloc = nAlloc;
+    }
+
+    item = &b->pItems[b->nItems];
+    item->pszPath = StorePath(b, pszPath, cch);
+    if (!item->pszPath)
+        return 0;
+    item->size = size;
+    item->mtime = mtime;
+    item->nBelow = 0;
+    item->type = type;
+    b->nItems++;
+    b->bSorted = 0;
+    return 1;
+}
+
+size_t IndexBuilderCount(const IndexBuilder *b)
+{
+    return b->nItems;
+}
+
+static int CompareItems(const void *a, const void *b)
+{
+    return ComparePaths(((const BuilderItem *)a)->pszPath, ((const BuilderItem *)b)->pszPath);
+}
+
+/**
+ * Sort into tree order and drop repeated paths
+ */
+static void BuilderSort(IndexBuilder *b)
+{
+    size_t i, n = 0;
+
+    if (b->bSorted)
+        return;
+    qsort(b->pItems, b->nItems, sizeof(BuilderItem), CompareItems);
+    for (i = 0; i < b->nItems; i++)
+    {
+        if (n > 0 && strcmp(b->pItems[n - 1].pszPath, b->pItems[i].pszPath) == 0)
+            continue;
+        b->pItems[n++] = b->pItems[i];
+    }
+    b->nItems = n;
+    b->bSorted = 1;
+}
+
+static const BuilderItem *BuilderFind(const IndexBuilder *b, const char *pszPath)
+{
+    size_t lo = 0, hi = b->nItems;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = ComparePaths(b->pItems[mid].pszPath, pszPath);
+
+        if (cmp == 0)
+            return &b->pItems[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+/**
+ * Folder sizes and counts: everything below a folder follows it directly,
+ * so one pass with a stack of the open folders adds them up
+ */
+static int ComputeTotals(IndexBuilder *b, unsigned long long *pcbTotal)
+{
+    size_t *pStack = malloc((INDEX_MAX_PATH / 2 + 2) * sizeof(size_t));
+    size_t nStack = 0, i;
+
+    if (!pStack)
+        return 0;
+    *pcbTotal = 0;
+
+    for (i = 0; i <= b->nItems; i++)
+    {
+        BuilderItem *item = i < b->nItems ? &b->pItems[i] : NULL;
+
+        /* Close the folders this entry is not in */
+        while (nStack > 0)
+        {
+            BuilderItem *dir = &b->pItems[pStack[nStack - 1]];
+
+            if (item && IsBelow(item->pszPath, dir->pszPath, strlen(dir->pszPath)))
+                break;
+            nStack--;
+            if (nStack > 0)
+            {
+                b->pItems[pStack[nStack - 1]].size += dir->size;
+                b->pItems[pStack[nStack - 1]].nBelow += dir->nBelow;
+            }
+        }
+        if (!item)
+            break;
+
+        item->nBelow = 0;
+        if (item->type == 'f')
+            *pcbTotal += item->size;
+        else
+            item->size = item->type == 'd' ? 0 : item->size;
+
+        if (nStack > 0)
+        {
+            BuilderItem *parent = &b->pItems[pStack[nStack - 1]];
+            parent->nBelow++;
+            if (item->type == 'f')
+                parent->size += item->size;
+        }
+        if (item->type == 'd' && nStack < INDEX_MAX_PATH / 2 + 2)
+            pStack[nStack++] = i;
+    }
+
+    free(pStack);
+    return 1;
+}
+
+static size_t VarintLength(size_t v)
+{
+    size_t n = 1;
+
+    while (v >= 0x80)
+    {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static size_t PutVarint(unsigned char *p, size_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80)
+    {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static size_t SharedPrefix(const char *a, const char *b)
+{
+    size_t n = 0;
+
+    while (a[n] && a[n] == b[n])
+        n++;
+    return n;
+}
+
+int IndexBuilderWrite(IndexBuilder *b, long long snapshotTime, IndexWriteFn fn, void *pContext)
+{
+    IndexHeader h;
+    unsigned long long *pRestarts = NULL;
+    unsigned char *pBuffer = NULL;
+    size_t nRestarts, cbBuffer = 0, i;
+    int ok = 0;
+
+    BuilderSort(b);
+    memset(&h, 0, sizeof(h));
+    if (!ComputeTotals(b, &h.cbTotal))
+        return 0;
+
+    nRestarts = (b->nItems + INDEX_RESTART - 1) / INDEX_RESTART;
+    pRestarts = malloc((nRestarts ? nRestarts : 1) * sizeof(unsigned long long));
+    pBuffer = malloc(WRITE_BUFFER);
+    if (!pRestarts || !pBuffer)
+        goto done;
+
+    /* Sizes first: the header leads the file */
+    for (i = 0; i < b->nItems; i++)
+    {
+        const char *psz = b->pItems[i].pszPath;
+        size_t cch = strlen(psz);
+        size_t shared = i % INDEX_RESTART ? SharedPrefix(b->pItems[i - 1].pszPath, psz) : 0;
+
+        if (i % INDEX_RESTART == 0)
+            pRestarts[i / INDEX_RESTART] = h.cbPaths;
+        h.cbPaths += VarintLength(shared) + VarintLength(cch - shared) + cch - shared;
+    }
+
+    memcpy(h.magic, g_szMagic, sizeof(h.magic));
+    h.version = INDEX_VERSION;
+    h.nRestart = INDEX_RESTART;
+    h.nEntries = b->nItems;
+    h.snapshotTime = snapshotTime;
+    if (!fn(&h, sizeof(h), pContext))
+        goto done;
+
+    for (i = 0; i < b->nItems; i++)
+    {
+        IndexEntry *e = (IndexEntry *)(pBuffer + cbBuffer);
+
+        memset(e, 0, sizeof(*e));
+        e->size = b->pItems[i].size;
+        e->mtime = b->pItems[i].mtime;
+        e->nBelow = b->pItems[i].nBelow;
+        e->type = b->pItems[i].type;
+        cbBuffer += sizeof(IndexEntry);
+        if (cbBuffer + sizeof(IndexEntry) > WRITE_BUFFER)
+        {
+            if (!fn(pBuffer, cbBuffer, pContext))
+                goto done;
+            cbBuffer = 0;
+        }
+    }
+    if (cbBuffer > 0 && !fn(pBuffer, cbBuffer, pContext))
+        goto done;
+    cbBuffer = 0;
+
+    if (nRestarts > 0 && !fn(pRestarts, nRestarts * sizeof(unsigned long long), pContext))
+        goto done;
+
+    for (i = 0; i < b->nItems; i++)
+    {
+        const char *psz = b->pItems[i].pszPath;
+        size_t cch = strlen(psz);
+        size_t shared = i % INDEX_RESTART ? SharedPrefix(b->pItems[i - 1].pszPath, psz) : 0;
+
+        if (cbBuffer + 20 + cch > WRITE_BUFFER)
+        {
+            if (!fn(pBuffer, cbBuffer, pContext))
+                goto done;
+            cbBuffer = 0;
+        }
+        cbBuffer += PutVarint(pBuffer + cbBuffer, shared);
+        cbBuffer += PutVarint(pBuffer + cbBuffer, cch - shared);
+        memcpy(pBuffer + cbBuffer, psz + shared, cch - shared);
+        cbBuffer += cch - shared;
+    }
+    if (cbBuffer > 0 && !fn(pBuffer, cbBuffer, pContext))
+        goto done;
+    ok = 1;
+
+done:
+    free(pRestarts);
+    free(pBuffer);
+    return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int IndexOpen(Index *ix, const void *pData, size_t cb)
+{
+    const unsigned char *p = (const unsigned char *)pData;
+    const IndexHeader *h = (const IndexHeader *)pData;
+    size_t left;
+
+    memset(ix, 0, sizeof(*ix));
+    if (cb < sizeof(IndexHeader) || memcmp(h->magic, g_szMagic, sizeof(h->magic)) != 0 ||
+        h->version != INDEX_VERSION || h->nRestart != INDEX_RESTART)
+        return 0;
+
+    left = cb - sizeof(IndexHeader);
+    if (h->nEntries > left / sizeof(IndexEntry))
+        return 0;
+    ix->nEntries = (size_t)h->nEntries;
+    left -= ix->nEntries * sizeof(IndexEntry);
+    ix->nRestarts = (ix->nEntries + INDEX_RESTART - 1) / INDEX_RESTART;
+    if (ix->nRestarts > left / sizeof(unsigned long long))
+        return 0;
+    left -= ix->nRestarts * sizeof(unsigned long long);
+    if (h->cbPaths > left)
+        return 0;
+
+    ix->pHeader = h;
+    ix->pEntries = (const IndexEntry *)(p + sizeof(IndexHeader));
+    ix->pRestarts = (const unsigned long long *)(ix->pEntries + ix->nEntries);
+    ix->pPaths = (const unsigned char *)(ix->pRestarts + ix->nRestarts);
+    ix->cbPaths = (size_t)h->cbPaths;
+    return 1;
+}
+
+static int GetVarint(const unsigned char *p, size_t cb, size_t *pOff, size_t *pValue)
+{
+    size_t v = 0;
+    int shift = 0;
+
+    while (*pOff < cb && shift < 35)
+    {
+        unsigned char c = p[(*pOff)++];
+
+        v |= (size_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+        {
+            *pValue = v;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+void IndexCursorSeek(IndexCursor *c, const Index *ix, size_t i)
+{
+    size_t block;
+
+    c->ix = ix;
+    c->cchPath = 0;
+    c->szPath[0] = '\0';
+    if (i >= ix->nEntries)
+    {
+        c->iNext = ix->nEntries;
+        c->off = ix->cbPaths;
+        return;
+    }
+
+    block = i / INDEX_RESTART;
+    c->iNext = block * INDEX_RESTART;
+    c->off = (size_t)ix->pRestarts[block];
+    while (c->iNext < i && IndexCursorNext(c))
+        ;
+}
+
+const IndexEntry *IndexCursorNext(IndexCursor *c)
+{
+    const Index *ix = c->ix;
+    size_t shared, cchSuffix;
+
+    if (c->iNext >= ix->nEntries || c->off > ix->cbPaths)
+        return NULL;
+    if (!GetVarint(ix->pPaths, ix->cbPaths, &c->off, &shared) ||
+        !GetVarint(ix->pPaths, ix->cbPaths, &c->off, &cchSuffix) ||
+        shared > c->cchPath || cchSuffix > INDEX_MAX_PATH - shared ||
+        cchSuffix > ix->cbPaths - c->off)
+    {
+        c->iNext = ix->nEntries;
+        return NULL;
+    }
+
+    memcpy(c->szPath + shared, ix->pPaths + c->off, cchSuffix);
+    c->off += cchSuffix;
+    c->cchPath = shared + cchSuffix;
+    c->szPath[c->cchPath] = '\0';
+    return &ix->pEntries[c->iNext++];
+}
+
+size_t IndexFind(const Index *ix, const char *pszPath)
+{
+    IndexCursor *c = malloc(sizeof(IndexCursor));
+    size_t lo = 0, hi = ix->nRestarts, found = (size_t)-1;
+
+    if (!c)
+        return found;
+
+    /* Last block starting at or before the path */
+    while (hi - lo > 1)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        IndexCursorSeek(c, ix, mid * INDEX_RESTART);
+        if (!IndexCursorNext(c))
+            break;
+        if (ComparePaths(c->szPath, pszPath) <= 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    IndexCursorSeek(c, ix, lo * INDEX_RESTART);
+    while (c->iNext < (lo + 1) * INDEX_RESTART && IndexCursorNext(c))
+    {
+        int cmp = ComparePaths(c->szPath, pszPath);
+
+        if (cmp == 0)
+            found = c->iNext - 1;
+        if (cmp >= 0)
+            break;
+    }
+    free(c);
+    return found;
+}
+
+static char LowerAscii(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+/**
+ * Glob with * and ?, ASCII case-insensitive; '*' backtracks to its last
+ * position only, which is enough without character classes
+ */
+static int GlobMatches(const char *s, const char *pat)
+{
+    const char *star = NULL, *resume = NULL;
+
+    while (*s)
+    {
+        if (*pat == '*')
+        {
+            star = pat++;
+            resume = s;
+        }
+        else if (*pat == '?' || (*pat && LowerAscii(*pat) == LowerAscii(*s)))
+        {
+            pat++;
+            s++;
+        }
+        else if (star)
+        {
+            pat = star + 1;
+            s = ++resume;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    while (*pat == '*')
+        pat++;
+    return *pat == '\0';
+}
+
+int IndexNameMatches(const char *pszPath, const char *pszPattern)
+{
+    const char *pszName = strrchr(pszPath, '/');
+
+    pszName = pszName ? pszName + 1 : pszPath;
+    if (strpbrk(pszPattern, "*?"))
+        return GlobMatches(pszName, pszPattern);
+
+    /* Plain text: anywhere in the name */
+    for (; *pszName; pszName++)
+    {
+        size_t i = 0;
+
+        while (pszPattern[i] && pszName[i] && LowerAscii(pszName[i]) == LowerAscii(pszPattern[i]))
+            i++;
+        if (!pszPattern[i])
+            return 1;
+    }
+    return pszPattern[0] == '\0';
+}
+
+/**
+ * Sort key of an entry for IndexLargest()/IndexNewest()
+ */
+static unsigned long long EntryKey(const IndexEntry *e, int bByTime)
+{
+    return bByTime ? (unsigned long long)e->mtime ^ 0x8000000000000000ULL : e->size;
+}
+
+/**
+ * The n entries with the largest keys: a min-heap of the best so far,
+ * so each entry costs a compare with the smallest kept
+ */
+static size_t TopEntries(const Index *ix, char type, int bByTime, size_t *pOut, size_t n)
+{
+    size_t nHeap = 0, i;
+
+    if (n == 0)
+        return 0;
+
+    for (i = 0; i < ix->nEntries; i++)
+    {
+        const IndexEntry *e = &ix->pEntries[i];
+        unsigned long long key = EntryKey(e, bByTime);
+        size_t pos;
+
+        if (e->type != type)
+            continue;
+        if (nHeap < n)
+        {
+            /* Sift up */
+            pos = nHeap++;
+            while (pos > 0 && EntryKey(&ix->pEntries[pOut[(pos - 1) / 2]], bByTime) > key)
+            {
+                pOut[pos] = pOut[(pos - 1) / 2];
+                pos = (pos - 1) / 2;
+            }
+            pOut[pos] = i;
+            continue;
+        }
+        if (key <= EntryKey(&ix->pEntries[pOut[0]], bByTime))
+            continue;
+
+        /* Replace the smallest and sift down */
+        pos = 0;
+        for (;;)
+        {
+            size_t child = 2 * pos + 1;
+
+            if (child >= nHeap)
+                break;
+            if (child + 1 < nHeap &&
+                EntryKey(&ix->pEntries[pOut[child + 1]], bByTime) < EntryKey(&ix->pEntries[pOut[child]], bByTime))
+                child++;
+            if (EntryKey(&ix->pEntries[pOut[child]], bByTime) >= key)
+                break;
+            pOut[pos] = pOut[child];
+            pos = child;
+        }
+        pOut[pos] = i;
+    }
+
+    /* Heap to descending order: repeatedly move the smallest to the end */
+    for (i = nHeap; i > 1; i--)
+    {
+        size_t last = pOut[i - 1], pos = 0;
+        unsigned long long key = EntryKey(&ix->pEntries[last], bByTime);
+
+        pOut[i - 1] = pOut[0];
+        for (;;)
+        {
+            size_t child = 2 * pos + 1;
+
+            if (child >= i - 1)
+                break;
+            if (child + 1 < i - 1 &&
+                EntryKey(&ix->pEntries[pOut[child + 1]], bByTime) < EntryKey(&ix->pEntries[pOut[child]], bByTime))
+                child++;
+            if (EntryKey(&ix->pEntries[pOut[child]], bByTime) >= key)
+                break;
+            pOut[pos] = pOut[child];
+            pos = child;
+        }
+        pOut[pos] = last;
+    }
+    return nHeap;
+}
+
+size_t IndexLargest(const Index *ix, char type, size_t *pOut, size_t n)
+{
+    return TopEntries(ix, type, 0, pOut, n);
+}
+
+size_t IndexNewest(const Index *ix, char type, size_t *pOut, size_t n)
+{
+    return TopEntries(ix, type, 1, pOut, n);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int IndexParseRecord(const char *pszRecord, char *pType, unsigned long long *pSize,
+    long long *pMtime, const char **ppszPath)
+{
+    const char *p = pszRecord;
+    unsigned long long size = 0;
+    long long mtime = 0;
+    int bNegative = 0;
+
+    if (!p[0] || p[1] != '\t')
+        return 0;
+    *pType = p[0];
+    p += 2;
+
+    if (*p < '0' || *p > '9')
+        return 0;
+    while (*p >= '0' && *p <= '9')
+        size = size * 10 + (unsigned long long)(*p++ - '0');
+    if (*p++ != '\t')
+        return 0;
+
+    /* %T@ is seconds with a fraction; before 1970 it is negative */
+    if (*p == '-')
+    {
+        bNegative = 1;
+        p++;
+    }
+    if (*p < '0' || *p > '9')
+        return 0;
+    while (*p >= '0' && *p <= '9')
+        mtime = mtime * 10 + (*p++ - '0');
+    if (*p == '.')
+    {
+        p++;
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    if (*p++ != '\t')
+        return 0;
+
+    if (p[0] == '.' && p[1] == '/')
+        p += 2;
+    if (!*p)
+        return 0;
+
+    *pSize = size;
+    *pMtime = bNegative ? -mtime : mtime;
+    *ppszPath = p;
+    return 1;
+}
+
+/**
+ * Folder part of pszPath ("" at the top), for comparing with the last one
+ */
+static size_t ParentLength(const char *pszPath)
+{
+    const char *pSlash = strrchr(pszPath, '/');
+    return pSlash ? (size_t)(pSlash - pszPath) : 0;
+}
+
+int IndexBuildDelta(const Index *pOld, IndexBuilder *pChanged, IndexBuilder *pListed,
+    IndexBuilder *pOut, IndexChangeFn fn, void *pContext)
+{
+    IndexCursor *c = malloc(sizeof(IndexCursor));
+    char *pszParent = malloc(INDEX_MAX_PATH + 1);
+    const IndexEntry *e;
+    size_t k = 0, cchParent = (size_t)-1;
+    int bParentKept = 0;
+    int ok = 0;
+
+    if (!c || !pszParent)
+        goto done;
+    BuilderSort(pChanged);
+    BuilderSort(pListed);
+
+    /* Both in tree order: walk the old index and the changes side by side */
+    IndexCursorSeek(c, pOld, 0);
+    while ((e = IndexCursorNext(c)) != NULL)
+    {
+        const BuilderItem *item = NULL;
+        size_t cch;
+
+        while (k < pChanged->nItems)
+        {
+            int cmp = ComparePaths(pChanged->pItems[k].pszPath, c->szPath);
+
+            if (cmp > 0)
+                break;
+            if (cmp == 0)
+            {
+                item = &pChanged->pItems[k++];
+                break;
+            }
+            /* Only in the new listing */
+            if (fn)
+                fn(INDEX_ADDED, pChanged->pItems[k].pszPath, pContext);
+            k++;
+        }
+
+        if (item)
+        {
+            if (fn && item->type != 'd' &&
+                (item->type != e->type || item->size != e->size || item->mtime != e->mtime))
+                fn(INDEX_CHANGED, item->pszPath, pContext);
+            continue;
+        }
+
+        /* Every folder that still exists is in the listing */
+        if (e->type == 'd')
+        {
+            if (fn)
+                fn(INDEX_REMOVED, c->szPath, pContext);
+            continue;
+        }
+
+        /* Kept if its folder exists and was not listed anew (entries
+         * in tree order share their folder, so look it up once) */
+        cch = ParentLength(c->szPath);
+        if (cch != cchParent || strncmp(pszParent, c->szPath, cch) != 0)
+        {
+            const BuilderItem *dir;
+
+            cchParent = cch;
+            memcpy(pszParent, c->szPath, cch);
+            pszParent[cch] = '\0';
+            dir = cch ? BuilderFind(pChanged, pszParent) : NULL;
+            bParentKept = (cch == 0 || (dir && dir->type == 'd')) && !BuilderFind(pListed, cch ? pszParent : ".");
+        }
+        if (!bParentKept)
+        {
+            if (fn)
+                fn(INDEX_REMOVED, c->szPath, pContext);
+            continue;
+        }
+        if (!IndexBuilderAdd(pOut, c->szPath, e->type, e->size, e->mtime))
+            goto done;
+    }
+
+    for (; k < pChanged->nItems; k++)
+    {
+        if (fn)
+            fn(INDEX_ADDED, pChanged->pItems[k].pszPath, pContext);
+    }
+    for (k = 0; k < pChanged->nItems; k++)
+    {
+        const BuilderItem *item = &pChanged->pItems[k];
+        if (!IndexBuilderAdd(pOut, item->pszPath, item->type, item->size, item->mtime))
+            goto done;
+    }
+    ok = 1;
+
+done:
+    free(c);
+    free(pszParent);
+    return ok;
+}
@@ -0,0 +1,170 @@
+/**
+ * sshfs-index.h
+ *
+ * Local index of a mount's remote tree for "Snapshot tree" in
+ * sshfs-ssh.exe: one find listing on the server, kept as a file that is
+ * memory-mapped and queried in place, so "where is X", "largest folders"
+ * and "changed since" never go through the drive.
+ *
+ * Entries are sorted in tree order (a folder directly followed by
+ * everything below it), which lets a folder's subtree be read as one
+ * range. Paths are front coded: each stores only what differs from the
+ * previous one, with a full path every INDEX_RESTART entries for binary
+ * search. The file is in the machine's byte order; a file from another
+ * byte order fails IndexOpen() and is rebuilt.
+ *
+ * Later snapshots list only what changed (IndexBuildDelta() below) and are
+ * merged into the previous index.
+ */
+
+#ifndef SSHFS_INDEX_H
+#define SSHFS_INDEX_H
+
+#include <stddef.h>
+
+#define INDEX_VERSION       1
+#define INDEX_RESTART       16          /* Entries per front coded block */
+#define INDEX_MAX_PATH      4096
+
+typedef struct IndexHeader {
+    char magic[8];                  /* "SSHFSIX\0" */
+    unsigned int version;
+    unsigned int nRestart;
+    unsigned long long nEntries;
+    unsigned long long cbPaths;
+    long long snapshotTime;         /* Server clock when the listing started */
+    unsigned long long cbTotal;     /* All file sizes */
+    unsigned long long reserved[2];
+} IndexHeader;
+
+typedef struct IndexEntry {
+    unsigned long long size;        /* Files: bytes; folders: all files below */
+    long long mtime;                /* Seconds since 1970 */
+    unsigned int nBelow;            /* Folders: entries below, which follow this one */
+    char type;                      /* As find's %y: f, d, l, ... */
+    char reserved[3];
+} IndexEntry;
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct IndexBuilder IndexBuilder;
+
+IndexBuilder *IndexBuilderCreate(void);
+void IndexBuilderFree(IndexBuilder *b);
+
+/**
+ * Add an entry; pszPath is relative to the listed folder, '/' separated,
+ * without "./". Returns 0 if out of memory.
+ */
+int IndexBuilderAdd(IndexBuilder *b, const char *pszPath, char type,
+    unsigned long long size, long long mtime);
+
+size_t IndexBuilderCount(const IndexBuilder *b);
+
+/**
+ * Receives the index file in order; returns 0 to abort
+ */
+typedef int (*IndexWriteFn)(const void *p, size_t cb, void *pContext);
+
+/**
+ * Sort the entries, fill in folder totals and write the index. Entries
+ * listed more than once are written once. Returns 0 on failure.
+ */
+int IndexBuilderWrite(IndexBuilder *b, long long snapshotTime, IndexWriteFn fn, void *pContext);
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct Index {
+    const IndexHeader *pHeader;
+    const IndexEntry *pEntries;
+    const unsigned long long *pRestarts;    /* Offsets into pPaths */
+    const unsigned char *pPaths;
+    size_t nEntries;
+    size_t nRestarts;
+    size_t cbPaths;
+} Index;
+
+/**
+ * Use an index file already in memory (normally mapped). Returns 0 if it is
+ * not an index of this version or is cut short.
+ */
+int IndexOpen(Index *ix, const void *pData, size_t cb);
+
+typedef struct IndexCursor {
+    const Index *ix;
+    size_t iNext;                   /* Entry the next IndexCursorNext() decodes */
+    size_t off;
+    size_t cchPath;
+    char szPath[INDEX_MAX_PATH + 1];
+} IndexCursor;
+
+/**
+ * Position the cursor so that IndexCursorNext() returns entry i
+ */
+void IndexCursorSeek(IndexCursor *c, const Index *ix, size_t i);
+
+/**
+ * Decode the next entry: its path goes to c->szPath, its index is
+ * c->iNext - 1. NULL at the end (or if the file is damaged).
+ */
+const IndexEntry *IndexCursorNext(IndexCursor *c);
+
+/**
+ * Entry with exactly this path ("" is not an entry), (size_t)-1 if none
+ */
+size_t IndexFind(const Index *ix, const char *pszPath);
+
+/**
+ * Match the last component of pszPath like find -iname: pszPattern with
+ * * and ?, or anywhere in the name when it has neither. ASCII letters
+ * ignore case.
+ */
+int IndexNameMatches(const char *pszPath, const char *pszPattern);
+
+/**
+ * Indexes of the (up to) n largest entries of the given type, largest
+ * first. Returns how many were found.
+ */
+size_t IndexLargest(const Index *ix, char type, size_t *pOut, size_t n);
+
+/**
+ * Indexes of the (up to) n most recently modified entries of the given
+ * type, newest first. Returns how many were found.
+ */
+size_t IndexNewest(const Index *ix, char type, size_t *pOut, size_t n);
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Parse one record of the snapshot listing, "%y\t%s\t%T@\t%P" (see
+ * RemoteBuildSnapshotCommand()). ppszPath points into pszRecord, after a
+ * leading "./" if there is one. Returns 0 if it is not such a record.
+ */
+int IndexParseRecord(const char *pszRecord, char *pType, unsigned long long *pSize,
+    long long *pMtime, const char **ppszPath);
+
+typedef enum {
+    INDEX_ADDED,
+    INDEX_CHANGED,
+    INDEX_REMOVED
+} IndexChange;
+
+/**
+ * Called for each difference IndexBuildDelta() finds (files and links;
+ * folders only when added or removed)
+ */
+typedef void (*IndexChangeFn)(IndexChange change, const char *pszPath, void *pContext);
+
+/**
+ * Apply a delta listing to pOld, adding the result to pOut.
+ *
+ * pChanged holds every folder and every entry modified since the old
+ * snapshot; pListed the folders modified since then, whose contents were
+ * listed in full ("." for the top), since only a listing tells what was
+ * deleted from a folder. Entries of unchanged folders carry over. Returns
+ * 0 if out of memory.
+ */
+int IndexBuildDelta(const Index *pOld, IndexBuilder *pChanged, IndexBuilder *pListed,
+    IndexBuilder *pOut, IndexChangeFn fn, void *pContext);
+
+#endif /* SSHFS_INDEX_H */
@@ -0,0 +1,210 @@
+/**
+ * sshfs-input.c
+ *
+ * Chunked, flow-controlled console input stage (see sshfs-input.h)
+ */
+
+#include "sshfs-input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MARKER_LEN 6                /* ESC [ 2 0 0 ~ */
+#define PASTE_OPEN (~0ULL)
+
+void InputPipelineInit(InputPipeline *ip)
+{
+    memset(ip, 0, sizeof(*ip));
+    ip->pasteEnd = PASTE_OPEN;
+}
+
+void InputPipelineFree(InputPipeline *ip)
+{
+    free(ip->queue);
+    memset(ip, 0, sizeof(*ip));
+}
+
+static int Append(InputPipeline *ip, const char *data, size_t len)
+{
+    if (len == 0)
+        return 1;
+
+    if (ip->tail + len > ip->cap)
+    {
+        /* Reclaim consumed space first, grow only if that is not enough */
+        if (ip->head > 0)
+        {
+            memmove(ip->queue, ip->queue + ip->head, ip->tail - ip->head);
+            ip->tail -= ip->head;
+            ip->head = 0;
+        }
+        if (ip->tail + len > ip->cap)
+        {
+            size_t cap = ip->cap ? ip->cap * 2 : 65536;
+            char *p;
+            while (cap < ip->tail + len)
+                cap *= 2;
+            p = realloc(ip->queue, cap);
+            if (!p)
+                return 0;
+            ip->queue = p;
+            ip->cap = cap;
+        }
+    }
+
+    memcpy(ip->queue + ip->tail, data, len);
+    ip->tail += len;
+    ip->cbQueuedTotal += len;
+    return 1;
+}
+
+/**
+ * Interrupt key while input is still queued: drop the backlog and send the
+ * key ahead of it, closing a paste the server has already seen start.
+ */
+static void Interrupt(InputPipeline *ip, char key)
+{
+    int bPasteOnWire = ip->pasteStart &&
+        ip->cbTakenTotal > ip->pasteStart - MARKER_LEN &&
+        (ip->pasteEnd == PASTE_OPEN || ip->cbTakenTotal < ip->pasteEnd + MARKER_LEN);
+
+    ip->cbTakenTotal += ip->tail - ip->head;
+    ip->head = ip->tail = 0;
+
+    ip->cbUrgent = 0;
+    if (bPasteOnWire)
+    {
+        memcpy(ip->urgent, "\x1b[201~", MARKER_LEN);
+        ip->cbUrgent = MARKER_LEN;
+    }
+    if (ip->pasteStart)
+    {
+        ip->stats.nCancelled++;
+        ip->pasteStart = 0;
+    }
+    ip->urgent[ip->cbUrgent++] = key;
+}
+
+int InputPipelineFeed(InputPipeline *ip, const char *data, size_t len, unsigned long long nowMs)
+{
+    static const char kMarker[] = "\x1b[20";
+    size_t runStart = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+
+        /* Track ESC [ 2 0 0 ~ / ESC [ 2 0 1 ~ across reads */
+        if (ip->markerState < 4)
+        {
+            ip->markerState = (c == kMarker[ip->markerState]) ? ip->markerState + 1 : (c == 0x1b);
+        }
+        else if (ip->markerState == 4)
+        {
+            if (c == '0' || c == '1')
+            {
+                ip->markerKind = c;
+                ip->markerState = 5;
+            }
+            else
+            {
+                ip->markerState = (c == 0x1b);
+            }
+        }
+        else
+        {
+            ip->markerState = (c == 0x1b);
+            if (c == '~')
+            {
+                /* Stream offset of the byte after this one */
+                unsigned long long pos = ip->cbQueuedTotal + (i - runStart) + 1;
+                if (ip->markerKind == '0')
+                {
+                    ip->bInPaste = 1;
+                    ip->pasteStart = pos;
+                    ip->pasteEnd = PASTE_OPEN;
+                    ip->msPasteStart = nowMs;
+                }
+                else if (ip->bInPaste)
+                {
+                    ip->bInPaste = 0;
+                    ip->pasteEnd = pos - MARKER_LEN;
+                }
+            }
+        }
+
+        /* Ctrl+C / Ctrl+\ outside paste content preempt a backlog */
+        if (!ip->bInPaste && (c == 0x03 || c == 0x1c) && ip->tail > ip->head)
+        {
+            Interrupt(ip, c);
+            runStart = i + 1;
+        }
+    }
+
+    return Append(ip, data + runStart, len - runStart);
+}
+
+size_t InputPipelineQueued(const InputPipeline *ip)
+{
+    return ip->tail - ip->head;
+}
+
+size_t InputPipelineTake(InputPipeline *ip, char *out, size_t cbOut, unsigned long long nowMs)
+{
+    size_t n;
+
+    if (ip->cbUrgent)
+    {
+        n = ip->cbUrgent < cbOut ? ip->cbUrgent : cbOut;
+        memcpy(out, ip->urgent, n);
+        ip->cbUrgent = 0;
+        return n;
+    }
+
+    n = ip->tail - ip->head;
+    if (n > INPUT_CHUNK_SIZE)
+        n = INPUT_CHUNK_SIZE;
+    if (n > cbOut)
+        n = cbOut;
+    if (n == 0)
+        return 0;
+
+    memcpy(out, ip->queue + ip->head, n);
+    ip->head += n;
+    ip->cbTakenTotal += n;
+    if (ip->head == ip->tail)
+        ip->head = ip->tail = 0;
+
+    /* Paste fully handed over (end marker included): record its throughput */
+    if (ip->pasteStart && ip->pasteEnd != PASTE_OPEN &&
+        ip->cbTakenTotal >= ip->pasteEnd + MARKER_LEN)
+    {
+        ip->stats.nPastes++;
+        ip->stats.cbLast = ip->pasteEnd - ip->pasteStart;
+        ip->stats.msLast = nowMs - ip->msPasteStart;
+        ip->pasteStart = 0;
+        ip->bReportPending = 1;
+    }
+
+    return n;
+}
+
+int InputPipelineTakePasteReport(InputPipeline *ip, InputPasteStats *pStats)
+{
+    if (!ip->bReportPending)
+        return 0;
+    ip->bReportPending = 0;
+    *pStats = ip->stats;
+    return 1;
+}
+
+void InputFormatPasteReport(const InputPasteStats *pStats, char *out, size_t cbOut)
+{
+    double mb = (double)pStats->cbLast / (1024.0 * 1024.0);
+    double secs = (double)pStats->msLast / 1000.0;
+
+    if (secs < 0.001)
+        secs = 0.001;
+    snprintf(out, cbOut, "pasted %.1f MB in %.1f s (%.1f MB/s)", mb, secs, mb / secs);
+}
@@ -0,0 +1,86 @@
+/**
+ * sshfs-input.h
+ *
+ * Input stage between the local console and the ssh pty.
+ *
+ * Keystrokes are queued in order and handed to a writer in bounded chunks,
+ * so a multi-megabyte paste never turns into one giant blocking write that
+ * freezes the console. Bracketed paste markers (ESC [200~ / ESC [201~) are
+ * tracked to measure paste throughput, and Ctrl+C / Ctrl+\ typed while a
+ * paste is still draining jump the queue: the unsent remainder is dropped
+ * and the paste is closed on the wire before the interrupt goes out.
+ *
+ * The caller stops reading input while InputPipelineQueued() is above
+ * INPUT_HIGH_WATER and resumes below INPUT_LOW_WATER.
+ */
+
+#ifndef SSHFS_INPUT_H
+#define SSHFS_INPUT_H
+
+#include <stddef.h>
+
+#define INPUT_CHUNK_SIZE  4096
+#define INPUT_HIGH_WATER  (1024 * 1024)
+#define INPUT_LOW_WATER   (256 * 1024)
+
+/**
+ * Throughput of the most recent completed paste
+ */
+typedef struct InputPasteStats {
+    unsigned long nPastes;          /* Pastes completed so far */
+    unsigned long nCancelled;       /* Pastes cut short by an interrupt key */
+    unsigned long long cbLast;      /* Bytes in the last paste (markers excluded) */
+    unsigned long long msLast;      /* First byte queued to last byte taken */
+} InputPasteStats;
+
+typedef struct InputPipeline {
+    char *queue;                    /* Pending bytes are queue[head..tail) */
+    size_t head, tail, cap;
+
+    char urgent[16];                /* Interrupt lane, always taken first */
+    size_t cbUrgent;
+
+    int markerState;                /* Bytes of ESC [ 2 0 x ~ matched so far */
+    int markerKind;                 /* '0' start, '1' end */
+    int bInPaste;                   /* Between markers on the input side */
+
+    unsigned long long cbQueuedTotal;   /* Absolute stream offsets */
+    unsigned long long cbTakenTotal;
+    unsigned long long pasteStart;      /* Offset just after the last start marker */
+    unsigned long long pasteEnd;        /* Offset of its end marker, ~0 while open */
+    unsigned long long msPasteStart;
+    int bReportPending;
+
+    InputPasteStats stats;
+} InputPipeline;
+
+void InputPipelineInit(InputPipeline *ip);
+void InputPipelineFree(InputPipeline *ip);
+
+/**
+ * Queue bytes read from the console. Returns 0 if memory ran out.
+ */
+int InputPipelineFeed(InputPipeline *ip, const char *data, size_t len, unsigned long long nowMs);
+
+/**
+ * Bytes waiting in the ordered queue (used for backpressure)
+ */
+size_t InputPipelineQueued(const InputPipeline *ip);
+
+/**
+ * Move the next chunk (urgent lane first) into out and return its length.
+ * At most INPUT_CHUNK_SIZE bytes are taken at once.
+ */
+size_t InputPipelineTake(InputPipeline *ip, char *out, size_t cbOut, unsigned long long nowMs);
+
+/**
+ * Returns 1 (once) after a paste has been fully handed to the writer
+ */
+int InputPipelineTakePasteReport(InputPipeline *ip, InputPasteStats *pStats);
+
+/**
+ * Format a paste report such as "pasted 4.2 MB in 1.3 s (3.2 MB/s)"
+ */
+void InputFormatPasteReport(const InputPasteStats *pStats, char *out, size_t cbOut);
+
+#endif /* SSHFS_INPUT_H */
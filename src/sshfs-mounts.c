@@ -0,0 +1,559 @@
+/**
+ * sshfs-mounts.c
+ *
+ * Indexed /proc/self/mountinfo table for resolving local paths on Linux
+ * sshfs mounts (see sshfs-mounts.h).
+ *
+ * Every mount point, not only sshfs ones, goes into the trie so that a
+ * different filesystem mounted inside an sshfs mount correctly shadows it.
+ */
+
+#define _GNU_SOURCE
+
+#include "sshfs-mounts.h"
+#include "sshfs-path.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MOUNT_NONE  (-1)        /* Trie node is not a mount point */
+#define MOUNT_OTHER (-2)        /* Trie node is a non-sshfs mount point */
+
+#define MOUNTINFO_PATH "/proc/self/mountinfo"
+
+/**
+ * Trie edge: (parent node, component name) -> child node
+ */
+typedef struct TrieEdge {
+    uint32_t parent;
+    uint32_t child;
+    uint32_t hash;
+    uint32_t nameOff;           /* Offset into the name arena */
+    uint32_t nameLen;
+} TrieEdge;
+
+struct MountTable {
+    int fd;                     /* mountinfo descriptor, -1 for parse-only tables */
+
+    SshfsMount *mounts;
+    size_t nMounts, capMounts;
+
+    int *nodeMount;             /* Per trie node: mount index, MOUNT_NONE or MOUNT_OTHER */
+    size_t nNodes, capNodes;
+
+    TrieEdge *edges;
+    size_t nEdges, capEdges;
+
+    uint32_t *slots;            /* Open-addressed edge index (edge + 1, 0 = empty) */
+    size_t capSlots;            /* Power of two, kept at most half full */
+
+    char *names;                /* Component name arena */
+    size_t cbNames, capNames;
+
+    char *strings;              /* Arena for SshfsMount strings */
+    size_t cbStrings, capStrings;
+};
+
+static uint32_t HashComponent(uint32_t parent, const char *name, size_t len)
+{
+    /* FNV-1a over the parent id and the component bytes */
+    uint32_t h = 2166136261u ^ parent;
+    h *= 16777619u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int Grow(void **pp, size_t *pCap, size_t need, size_t elemSize)
+{
+    size_t cap = *pCap ? *pCap : 16;
+    void *p;
+
+    if (need <= *pCap)
+        return 1;
+    while (cap < need)
+        cap *= 2;
+    p = realloc(*pp, cap * elemSize);
+    if (!p)
+        return 0;
+    *pp = p;
+    *pCap = cap;
+    return 1;
+}
+
+static int RebuildSlots(MountTable *mt, size_t capSlots)
+{
+    uint32_t *slots = calloc(capSlots, sizeof(uint32_t));
+    if (!slots)
+        return 0;
+
+    for (size_t e = 0; e < mt->nEdges; e++)
+    {
+        size_t i = mt->edges[e].hash & (capSlots - 1);
+        while (slots[i])
+            i = (i + 1) & (capSlots - 1);
+        slots[i] = (uint32_t)(e + 1);
+    }
+
+    free(mt->slots);
+    mt->slots = slots;
+    mt->capSlots = capSlots;
+    return 1;
+}
+
+/**
+ * Find the child of parent named name, optionally creating it
+ */
+static long FindChild(MountTable *mt, uint32_t parent, const char *name, size_t len, int bCreate)
+{
+    uint32_t hash = HashComponent(parent, name, len);
+    size_t i;
+
+    if (mt->capSlots)
+    {
+        for (i = hash & (mt->capSlots - 1); mt->slots[i]; i = (i + 1) & (mt->capSlots - 1))
+        {
+            TrieEdge *e = &mt->edges[mt->slots[i] - 1];
+            if (e->hash == hash && e->parent == parent && e->nameLen == len &&
+                memcmp(mt->names + e->nameOff, name, len) == 0)
+                return e->child;
+        }
+    }
+
+    if (!bCreate)
+        return -1;
+
+    if (!Grow((void **)&mt->edges, &mt->capEdges, mt->nEdges + 1, sizeof(TrieEdge)) ||
+        !Grow((void **)&mt->nodeMount, &mt->capNodes, mt->nNodes + 1, sizeof(int)) ||
+        !Grow((void **)&mt->names, &mt->capNames, mt->cbNames + len, 1))
+        return -1;
+
+    memcpy(mt->names + mt->cbNames, name, len);
+    mt->edges[mt->nEdges].parent = parent;
+    mt->edges[mt->nEdges].child = (uint32_t)mt->nNodes;
+    mt->edges[mt->nEdges].hash = hash;
+    mt->edges[mt->nEdges].nameOff = (uint32_t)mt->cbNames;
+    mt->edges[mt->nEdges].nameLen = (uint32_t)len;
+    mt->cbNames += len;
+    mt->nodeMount[mt->nNodes] = MOUNT_NONE;
+    mt->nEdges++;
+    mt->nNodes++;
+
+    if (mt->nEdges * 2 > mt->capSlots)
+    {
+        if (!RebuildSlots(mt, mt->capSlots ? mt->capSlots * 2 : 64))
+            return -1;
+    }
+    else
+    {
+        for (i = hash & (mt->capSlots - 1); mt->slots[i]; i = (i + 1) & (mt->capSlots - 1))
+            ;
+        mt->slots[i] = (uint32_t)mt->nEdges;
+    }
+
+    return (long)(mt->nNodes - 1);
+}
+
+/**
+ * Walk (and extend) the trie along pszPath, returning the final node
+ */
+static long InsertPath(MountTable *mt, const char *pszPath)
+{
+    long node = 0;
+    const char *p = pszPath;
+
+    while (*p)
+    {
+        const char *start;
+        while (*p == '/') p++;
+        if (!*p)
+            break;
+        start = p;
+        while (*p && *p != '/') p++;
+        node = FindChild(mt, (uint32_t)node, start, (size_t)(p - start), 1);
+        if (node < 0)
+            return -1;
+    }
+    return node;
+}
+
+/**
+ * Copy a mountinfo field into the string arena, decoding \NNN octal escapes.
+ * Returns the arena offset of the copy or -1 on allocation failure.
+ */
+static long StoreField(MountTable *mt, const char *field, size_t len)
+{
+    size_t off = mt->cbStrings;
+    char *out;
+
+    if (!Grow((void **)&mt->strings, &mt->capStrings, mt->cbStrings + len + 1, 1))
+        return -1;
+
+    out = mt->strings + off;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (field[i] == '\\' && i + 3 < len &&
+            field[i + 1] >= '0' && field[i + 1] <= '3' &&
+            field[i + 2] >= '0' && field[i + 2] <= '7' &&
+            field[i + 3] >= '0' && field[i + 3] <= '7')
+        {
+            *out++ = (char)(((field[i + 1] - '0') << 6) | ((field[i + 2] - '0') << 3) | (field[i + 3] - '0'));
+            i += 3;
+        }
+        else
+        {
+            *out++ = field[i];
+        }
+    }
+    *out++ = '\0';
+    mt->cbStrings = (size_t)(out - mt->strings);
+    return (long)off;
+}
+
+static void ResetTable(MountTable *mt)
+{
+    mt->nMounts = 0;
+    mt->nEdges = 0;
+    mt->cbNames = 0;
+    mt->cbStrings = 0;
+    if (mt->capSlots)
+        memset(mt->slots, 0, mt->capSlots * sizeof(uint32_t));
+
+    /* Node 0 is the root directory */
+    mt->nNodes = 0;
+    if (Grow((void **)&mt->nodeMount, &mt->capNodes, 1, sizeof(int)))
+    {
+        mt->nodeMount[0] = MOUNT_NONE;
+        mt->nNodes = 1;
+    }
+}
+
+/**
+ * Parse one mountinfo line:
+ *   id parent major:minor root mountpoint options [optional...] - fstype source superoptions
+ */
+static int ParseLine(MountTable *mt, const char *line, size_t len)
+{
+    const char *fields[16];
+    size_t lens[16];
+    size_t nFields = 0;
+    size_t sep = 0;
+    const char *p = line, *end = line + len;
+    long node;
+
+    while (p < end && nFields < 16)
+    {
+        const char *start;
+        while (p < end && *p == ' ') p++;
+        if (p >= end)
+            break;
+        start = p;
+        while (p < end && *p != ' ') p++;
+        fields[nFields] = start;
+        lens[nFields] = (size_t)(p - start);
+        if (!sep && nFields >= 6 && lens[nFields] == 1 && *start == '-')
+            sep = nFields;
+        nFields++;
+    }
+
+    if (!sep || nFields < sep + 3)
+        return 1;       /* Malformed line: skip it */
+
+    {
+        const char *fstype = fields[sep + 1];
+        size_t fstypeLen = lens[sep + 1];
+        long mpOff = StoreField(mt, fields[4], lens[4]);
+        if (mpOff < 0)
+            return 0;
+
+        node = InsertPath(mt, mt->strings + mpOff);
+        if (node < 0)
+            return 0;
+
+        if (!(fstypeLen == 10 && memcmp(fstype, "fuse.sshfs", 10) == 0))
+        {
+            /* Later mounts on the same point hide earlier ones */
+            mt->nodeMount[node] = MOUNT_OTHER;
+            mt->cbStrings = (size_t)mpOff;
+            return 1;
+        }
+
+        {
+            long srcOff = StoreField(mt, fields[sep + 2], lens[sep + 2]);
+            long rootOff = StoreField(mt, fields[3], lens[3]);
+            char *src, *host, *path, *colon;
+            SshfsMount *m;
+            int bRootMount;
+
+            if (srcOff < 0 || rootOff < 0)
+                return 0;
+            if (!Grow((void **)&mt->mounts, &mt->capMounts, mt->nMounts + 1, sizeof(SshfsMount)))
+                return 0;
+
+            /* Source is [user@]host:path, host may be a bracketed IPv6 literal */
+            src = mt->strings + srcOff;
+            host = strchr(src, '@');
+            host = host ? host + 1 : src;
+            if (*host == '[')
+            {
+                char *close = strchr(host, ']');
+                colon = close ? strchr(close, ':') : NULL;
+                if (close)
+                {
+                    memmove(host, host + 1, (size_t)(close - host - 1));
+                    close[-1] = '\0';
+                }
+            }
+            else
+            {
+                colon = strchr(host, ':');
+            }
+            if (colon)
+            {
+                *colon = '\0';
+                path = colon + 1;
+            }
+            else
+            {
+                path = src + strlen(src);   /* No path: home directory */
+            }
+
+            /* Decided by the source alone: the bind root appended below
+             * always starts with '/', even on a home-relative mount */
+            bRootMount = (path[0] == '/');
+
+            /* A bind mount of a subdirectory shows that directory as its root */
+            if (strcmp(mt->strings + rootOff, "/") != 0)
+            {
+                long baseOff;
+                size_t pathLen = strlen(path), rootLen = strlen(mt->strings + rootOff);
+                char *tmp = malloc(pathLen + rootLen + 1);
+                if (!tmp)
+                    return 0;
+                memcpy(tmp, path, pathLen);
+                memcpy(tmp + pathLen, mt->strings + rootOff, rootLen + 1);
+                /* Arena may move: re-derive pointers from offsets afterwards */
+                baseOff = StoreField(mt, tmp, pathLen + rootLen);
+                free(tmp);
+                if (baseOff < 0)
+                    return 0;
+                path = mt->strings + baseOff;
+                src = mt->strings + srcOff;
+            }
+
+            m = &mt->mounts[mt->nMounts];
+            /* Store offsets now, convert to pointers once the arena is final */
+            m->pszMountPoint = (char *)(uintptr_t)mpOff;
+            m->pszTarget = (char *)(uintptr_t)srcOff;
+            m->pszBasePath = (char *)(uintptr_t)(path - mt->strings);
+            m->bRootMount = bRootMount;
+            mt->nodeMount[node] = (int)mt->nMounts;
+            mt->nMounts++;
+        }
+    }
+    return 1;
+}
+
+int MountTableParse(MountTable *mt, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+
+    ResetTable(mt);
+    if (mt->nNodes == 0)
+        return 0;
+
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t lineLen = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        if (!ParseLine(mt, p, lineLen))
+            return 0;
+        p += lineLen + 1;
+    }
+
+    /* Fix up arena offsets now that no more reallocation can happen */
+    for (size_t i = 0; i < mt->nMounts; i++)
+    {
+        SshfsMount *m = &mt->mounts[i];
+        m->pszMountPoint = mt->strings + (uintptr_t)m->pszMountPoint;
+        m->pszTarget = mt->strings + (uintptr_t)m->pszTarget;
+        m->pszBasePath = mt->strings + (uintptr_t)m->pszBasePath;
+    }
+    return 1;
+}
+
+/**
+ * Read the whole of mountinfo from the start
+ */
+static int ReloadFromFd(MountTable *mt)
+{
+    size_t cap = 65536, len = 0;
+    char *buf = malloc(cap);
+    int bOk;
+
+    if (!buf || lseek(mt->fd, 0, SEEK_SET) < 0)
+    {
+        free(buf);
+        return 0;
+    }
+
+    for (;;)
+    {
+        ssize_t n;
+        if (len == cap)
+        {
+            char *nb = realloc(buf, cap * 2);
+            if (!nb)
+            {
+                free(buf);
+                return 0;
+            }
+            buf = nb;
+            cap *= 2;
+        }
+        n = read(mt->fd, buf + len, cap - len);
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+    }
+
+    bOk = MountTableParse(mt, buf, len);
+    free(buf);
+    return bOk;
+}
+
+MountTable *MountTableCreate(void)
+{
+    MountTable *mt = calloc(1, sizeof(MountTable));
+    if (!mt)
+        return NULL;
+    mt->fd = -1;
+    ResetTable(mt);
+    return mt;
+}
+
+MountTable *MountTableOpen(void)
+{
+    MountTable *mt = MountTableCreate();
+    if (!mt)
+        return NULL;
+
+    mt->fd = open(MOUNTINFO_PATH, O_RDONLY | O_CLOEXEC);
+    if (mt->fd < 0 || !ReloadFromFd(mt))
+    {
+        MountTableClose(mt);
+        return NULL;
+    }
+    return mt;
+}
+
+int MountTableRefresh(MountTable *mt)
+{
+    struct pollfd pfd;
+
+    if (mt->fd < 0)
+        return 0;
+
+    /* The kernel raises POLLPRI (and POLLERR) on mountinfo when the namespace changes */
+    pfd.fd = mt->fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLPRI | POLLERR)))
+        return 0;
+
+    return ReloadFromFd(mt);
+}
+
+const SshfsMount *MountTableLookup(MountTable *mt, const char *pszPath, const char **ppszSubPath)
+{
+    long node = 0;
+    int best = mt->nodeMount[0];
+    const char *bestEnd = pszPath;
+    const char *p = pszPath;
+
+    while (*p)
+    {
+        const char *start;
+        while (*p == '/') p++;
+        if (!*p)
+            break;
+        start = p;
+        while (*p && *p != '/') p++;
+        node = FindChild(mt, (uint32_t)node, start, (size_t)(p - start), 0);
+        if (node < 0)
+            break;
+        if (mt->nodeMount[node] != MOUNT_NONE)
+        {
+            best = mt->nodeMount[node];
+            bestEnd = p;
+        }
+    }
+
+    if (best < 0)
+        return NULL;
+
+    if (ppszSubPath)
+        *ppszSubPath = bestEnd;
+    return &mt->mounts[best];
+}
+
+int MountTableResolve(MountTable *mt, const char *pszPath,
+    char *pszTarget, size_t cchTarget,
+    char *pszRemotePath, size_t cchRemotePath)
+{
+    const char *pszSub;
+    const SshfsMount *m;
+    char *pszCombined;
+    size_t cbBase, cbSub;
+    int bOk;
+
+    MountTableRefresh(mt);
+
+    m = MountTableLookup(mt, pszPath, &pszSub);
+    if (!m)
+        return 0;
+
+    if ((size_t)snprintf(pszTarget, cchTarget, "%s", m->pszTarget) >= cchTarget)
+        return 0;
+
+    /* Combine mount base and local sub path, as BuildFullRemotePath does for UNC */
+    cbBase = strlen(m->pszBasePath);
+    cbSub = strlen(pszSub);
+    pszCombined = malloc(cbBase + cbSub + 1);
+    if (!pszCombined)
+        return 0;
+    memcpy(pszCombined, m->pszBasePath, cbBase);
+    memcpy(pszCombined + cbBase, pszSub, cbSub + 1);
+
+    bOk = FormatRemotePath(pszCombined, m->bRootMount, pszRemotePath, cchRemotePath);
+    free(pszCombined);
+    return bOk;
+}
+
+size_t MountTableCount(const MountTable *mt)
+{
+    return mt->nMounts;
+}
+
+void MountTableClose(MountTable *mt)
+{
+    if (!mt)
+        return;
+    if (mt->fd >= 0)
+        close(mt->fd);
+    free(mt->mounts);
+    free(mt->nodeMount);
+    free(mt->edges);
+    free(mt->slots);
+    free(mt->names);
+    free(mt->strings);
+    free(mt);
+}
@@ -0,0 +1,74 @@
+/**
+ * sshfs-mounts.h
+ *
+ * Linux counterpart of ParseSSHFSUNCPath/GetDriveUNCPath: maps a local path
+ * under a fuse.sshfs mount to the ssh target and remote directory.
+ *
+ * /proc/self/mountinfo is parsed once into a path-component trie of every
+ * mount point, so a lookup costs one hash probe per path component. The
+ * table is only re-read when the kernel flags mountinfo with POLLPRI.
+ */
+
+#ifndef SSHFS_MOUNTS_H
+#define SSHFS_MOUNTS_H
+
+#include <stddef.h>
+
+/**
+ * One fuse.sshfs mount
+ */
+typedef struct SshfsMount {
+    char *pszMountPoint;    /* Local mount point (octal escapes decoded) */
+    char *pszTarget;        /* user@host (or host) from the mount source */
+    char *pszBasePath;      /* Remote path from the mount source, "" for home */
+    int bRootMount;         /* Base path is absolute rather than home-relative */
+} SshfsMount;
+
+typedef struct MountTable MountTable;
+
+/**
+ * Open /proc/self/mountinfo and build the table. Returns NULL on failure.
+ */
+MountTable *MountTableOpen(void);
+
+/**
+ * Create an empty table that is only fed through MountTableParse
+ * (no mountinfo descriptor, MountTableRefresh is a no-op)
+ */
+MountTable *MountTableCreate(void);
+
+/**
+ * Replace the table contents with the mountinfo text in buf
+ */
+int MountTableParse(MountTable *mt, const char *buf, size_t len);
+
+/**
+ * Re-read mountinfo if the kernel signalled a change since the last read.
+ * Returns 1 if the table was rebuilt.
+ */
+int MountTableRefresh(MountTable *mt);
+
+/**
+ * Find the sshfs mount owning an absolute, canonical local path.
+ * On success *ppszSubPath points into pszPath at the mount-relative
+ * remainder ("" or "/..."). Returns NULL if the innermost mount covering
+ * the path is not sshfs.
+ */
+const SshfsMount *MountTableLookup(MountTable *mt, const char *pszPath, const char **ppszSubPath);
+
+/**
+ * Resolve a local path to the ssh target and the remote path to cd into,
+ * using the same remote path builder as the Windows UNC code.
+ */
+int MountTableResolve(MountTable *mt, const char *pszPath,
+    char *pszTarget, size_t cchTarget,
+    char *pszRemotePath, size_t cchRemotePath);
+
+/**
+ * Number of sshfs mounts currently in the table
+ */
+size_t MountTableCount(const MountTable *mt);
+
+void MountTableClose(MountTable *mt);
+
+#endif /* SSHFS_MOUNTS_H */
@@ -0,0 +1,496 @@
+/**
+ * sshfs-pack.c
+ *
+ * Local tree to tar stream producer (see sshfs-pack.h)
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-pack.h"
+#include "sshfs-tar.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "shlwapi.lib")
+#endif
+
+/* Extended-length paths while walking: node_modules-style trees pass MAX_PATH */
+#define PACK_PATH_CCH 32768
+
+/* Extensions whose content does not shrink any further */
+static const LPCWSTR g_compressedExts[] = {
+    L".7z", L".avi", L".bz2", L".docx", L".gif", L".gz", L".jar", L".jpeg",
+    L".jpg", L".mkv", L".mov", L".mp3", L".mp4", L".nupkg", L".pdf", L".png",
+    L".pptx", L".rar", L".tgz", L".webp", L".whl", L".xlsx", L".xz", L".zip",
+    L".zst"
+};
+
+struct Packer {
+    LPWSTR *ppszItems;
+    int nItems;
+    HANDLE hOut;
+    HANDLE hThread;
+    volatile LONG bCancel;
+
+    BOOL bScanOnly;
+    PackTotals totals;
+
+    /* Walk state */
+    LPWSTR pszPath;                 /* \\?\ local path */
+    char szName[TAR_MAX_PATH];      /* Archive name, UTF-8 */
+    TarEntry entry;
+
+    char *pBuffer;
+    size_t cbBuffer;
+
+    volatile LONG nFiles;
+    volatile LONGLONG cbSent;
+    unsigned long nSkipped;
+    unsigned long nErrors;
+    BOOL bBrokenPipe;
+    WCHAR szFirstError[MAX_PATH + 64];
+};
+
+static void RecordError(Packer *p, LPCWSTR pszPath, DWORD dwError)
+{
+    p->nErrors++;
+    if (!p->szFirstError[0])
+    {
+        if (wcsncmp(pszPath, L"\\\\?\\UNC\\", 8) == 0)
+            StringCchPrintfW(p->szFirstError, MAX_PATH + 64, L"\\\\%s (error %lu)", pszPath + 8, dwError);
+        else
+            StringCchPrintfW(p->szFirstError, MAX_PATH + 64, L"%s (error %lu)",
+                wcsncmp(pszPath, L"\\\\?\\", 4) == 0 ? pszPath + 4 : pszPath, dwError);
+    }
+}
+
+static long long FileTimeToUnix(const FILETIME *pft)
+{
+    ULARGE_INTEGER u;
+
+    u.LowPart = pft->dwLowDateTime;
+    u.HighPart = pft->dwHighDateTime;
+    return (long long)(u.QuadPart / 10000000ULL) - 11644473600LL;
+}
+
+static BOOL IsCompressedName(LPCWSTR pszName)
+{
+    LPCWSTR pszExt = PathFindExtensionW(pszName);
+
+    for (size_t i = 0; i < sizeof(g_compressedExts) / sizeof(g_compressedExts[0]); i++)
+    {
+        if (_wcsicmp(pszExt, g_compressedExts[i]) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL Flush(Packer *p)
+{
+    size_t off = 0;
+
+    while (off < p->cbBuffer && !p->bBrokenPipe)
+    {
+        DWORD cbWritten;
+        if (!WriteFile(p->hOut, p->pBuffer + off, (DWORD)(p->cbBuffer - off), &cbWritten, NULL))
+            p->bBrokenPipe = TRUE;
+        else
+            off += cbWritten;
+    }
+    p->cbBuffer = 0;
+    return !p->bBrokenPipe;
+}
+
+/**
+ * Make room for cb more bytes in the batch buffer
+ */
+static BOOL Reserve(Packer *p, size_t cb)
+{
+    if (p->cbBuffer + cb > PACK_BUFFER_SIZE)
+        return Flush(p);
+    return !p->bBrokenPipe;
+}
+
+static BOOL PutZeros(Packer *p, size_t cb)
+{
+    if (!Reserve(p, cb))
+        return FALSE;
+    memset(p->pBuffer + p->cbBuffer, 0, cb);
+    p->cbBuffer += cb;
+    return TRUE;
+}
+
+static BOOL PutHeader(Packer *p)
+{
+    size_t cb;
+
+    if (!Reserve(p, TAR_HEADER_MAX))
+        return FALSE;
+    cb = TarFormatHeader(&p->entry, p->pBuffer + p->cbBuffer, PACK_BUFFER_SIZE - p->cbBuffer);
+    if (cb == 0)
+    {
+        RecordError(p, p->pszPath, ERROR_FILENAME_EXCED_RANGE);
+        return FALSE;
+    }
+    p->cbBuffer += cb;
+    return TRUE;
+}
+
+/**
+ * Header, content read straight into the batch buffer, padding. A file
+ * that shrinks while being read is padded with zeros to its announced size.
+ */
+static void PackFile(Packer *p, const WIN32_FIND_DATAW *pfd)
+{
+    unsigned long long cbLeft;
+    HANDLE hFile;
+
+    hFile = CreateFileW(p->pszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        RecordError(p, p->pszPath, GetLastError());
+        return;
+    }
+
+    p->entry.type = TAR_FILE;
+    p->entry.size = ((unsigned long long)pfd->nFileSizeHigh << 32) | pfd->nFileSizeLow;
+    p->entry.mtime = FileTimeToUnix(&pfd->ftLastWriteTime);
+    p->entry.mode = 0644;
+    if (!PutHeader(p))
+    {
+        CloseHandle(hFile);
+        return;
+    }
+
+    for (cbLeft = p->entry.size; cbLeft > 0 && !p->bBrokenPipe; )
+    {
+        DWORD cbWant, cbRead = 0;
+
+        if (p->cbBuffer == PACK_BUFFER_SIZE && !Flush(p))
+            break;
+        cbWant = (DWORD)(PACK_BUFFER_SIZE - p->cbBuffer);
+        if (cbWant > cbLeft)
+            cbWant = (DWORD)cbLeft;
+
+        /* A cancelled archive is abandoned, there is no point in finishing it */
+        if (p->bCancel)
+        {
+            CloseHandle(hFile);
+            return;
+        }
+
+        if (!ReadFile(hFile, p->pBuffer + p->cbBuffer, cbWant, &cbRead, NULL) || cbRead == 0)
+        {
+            RecordError(p, p->pszPath, cbRead == 0 ? ERROR_HANDLE_EOF : GetLastError());
+            while (cbLeft > 0 && !p->bBrokenPipe)
+            {
+                size_t n = cbLeft > PACK_BUFFER_SIZE ? PACK_BUFFER_SIZE : (size_t)cbLeft;
+                if (!PutZeros(p, n))
+                    break;
+                InterlockedExchangeAdd64(&p->cbSent, (LONGLONG)n);
+                cbLeft -= n;
+            }
+            break;
+        }
+
+        p->cbBuffer += cbRead;
+        cbLeft -= cbRead;
+        InterlockedExchangeAdd64(&p->cbSent, (LONGLONG)cbRead);
+    }
+    CloseHandle(hFile);
+
+    PutZeros(p, TAR_PADDING(p->entry.size));
+    InterlockedIncrement(&p->nFiles);
+}
+
+/**
+ * Append "\<name>" to the local path and "/<name>" to the archive name
+ */
+static BOOL PushName(Packer *p, LPCWSTR pszName, size_t *pcchPath, size_t *pcbName)
+{
+    size_t cchName = wcslen(pszName);
+    int cb;
+
+    if (*pcchPath + cchName + 2 >= PACK_PATH_CCH)
+        return FALSE;
+    p->pszPath[(*pcchPath)++] = L'\\';
+    memcpy(p->pszPath + *pcchPath, pszName, (cchName + 1) * sizeof(WCHAR));
+    *pcchPath += cchName;
+
+    if (*pcbName > 0)
+        p->szName[(*pcbName)++] = '/';
+    cb = WideCharToMultiByte(CP_UTF8, 0, pszName, (int)cchName,
+        p->szName + *pcbName, (int)(TAR_MAX_PATH - *pcbName - 1), NULL, NULL);
+    if (cb <= 0)
+        return FALSE;
+    *pcbName += (size_t)cb;
+    p->szName[*pcbName] = '\0';
+    return TRUE;
+}
+
+static void Walk(Packer *p, size_t cchPath, size_t cbName, const WIN32_FIND_DATAW *pfd);
+
+static void WalkDirectory(Packer *p, size_t cchPath, size_t cbName)
+{
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind;
+
+    if (cchPath + 3 >= PACK_PATH_CCH)
+        return;
+    StringCchCopyW(p->pszPath + cchPath, PACK_PATH_CCH - cchPath, L"\\*");
+
+    hFind = FindFirstFileExW(p->pszPath, FindExInfoBasic, &fd, FindExSearchNameMatch,
+        NULL, FIND_FIRST_EX_LARGE_FETCH);
+    p->pszPath[cchPath] = L'\0';
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        RecordError(p, p->pszPath, GetLastError());
+        return;
+    }
+
+    do
+    {
+        if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0)
+            continue;
+        Walk(p, cchPath, cbName, &fd);
+        p->pszPath[cchPath] = L'\0';
+        p->szName[cbName] = '\0';
+    } while (!p->bCancel && !p->bBrokenPipe && FindNextFileW(hFind, &fd));
+
+    FindClose(hFind);
+}
+
+/**
+ * One directory entry: count it (scan) or send it, recursing into folders
+ */
+static void Walk(Packer *p, size_t cchPath, size_t cbName, const WIN32_FIND_DATAW *pfd)
+{
+    if (!PushName(p, pfd->cFileName, &cchPath, &cbName))
+    {
+        if (!p->bScanOnly)
+            RecordError(p, pfd->cFileName, ERROR_FILENAME_EXCED_RANGE);
+        return;
+    }
+
+    if (pfd->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+    {
+        /* Following links could leave the tree or loop */
+        if (!p->bScanOnly)
+            p->nSkipped++;
+        return;
+    }
+
+    p->entry.size = 0;
+    p->entry.szLink[0] = '\0';
+    StringCchCopyA(p->entry.szPath, TAR_MAX_PATH, p->szName);
+
+    if (pfd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        if (p->bScanOnly)
+        {
+            p->totals.nDirs++;
+        }
+        else
+        {
+            p->entry.type = TAR_DIRECTORY;
+            p->entry.mtime = FileTimeToUnix(&pfd->ftLastWriteTime);
+            p->entry.mode = 0755;
+            if (!PutHeader(p))
+                return;
+        }
+        WalkDirectory(p, cchPath, cbName);
+        return;
+    }
+
+    if (p->bScanOnly)
+    {
+        unsigned long long size = ((unsigned long long)pfd->nFileSizeHigh << 32) | pfd->nFileSizeLow;
+        p->totals.nFiles++;
+        p->totals.cbTotal += size;
+        if (IsCompressedName(pfd->cFileName))
+            p->totals.cbCompressed += size;
+        return;
+    }
+
+    PackFile(p, pfd);
+}
+
+/**
+ * Each item goes into the archive under its own name
+ */
+static void WalkItems(Packer *p)
+{
+    int i;
+
+    for (i = 0; i < p->nItems && !p->bCancel && !p->bBrokenPipe; i++)
+    {
+        WCHAR szFull[MAX_PATH];
+        WIN32_FIND_DATAW fd = {0};
+        WIN32_FILE_ATTRIBUTE_DATA fad;
+        size_t cchPath;
+        DWORD cch;
+        LPWSTR pszName;
+
+        cch = GetFullPathNameW(p->ppszItems[i], MAX_PATH, szFull, NULL);
+        if (cch == 0 || cch >= MAX_PATH)
+        {
+            RecordError(p, p->ppszItems[i], ERROR_BAD_PATHNAME);
+            continue;
+        }
+        PathRemoveBackslashW(szFull);
+        if (!GetFileAttributesExW(szFull, GetFileExInfoStandard, &fad))
+        {
+            RecordError(p, szFull, GetLastError());
+            continue;
+        }
+
+        /* The walk appends "\<name>" to the parent */
+        pszName = PathFindFileNameW(szFull);
+        if (pszName == szFull || !*pszName)
+        {
+            RecordError(p, szFull, ERROR_BAD_PATHNAME);
+            continue;
+        }
+        fd.dwFileAttributes = fad.dwFileAttributes;
+        fd.ftLastWriteTime = fad.ftLastWriteTime;
+        fd.nFileSizeHigh = fad.nFileSizeHigh;
+        fd.nFileSizeLow = fad.nFileSizeLow;
+        StringCchCopyW(fd.cFileName, MAX_PATH, pszName);
+        pszName[-1] = L'\0';
+
+        if (wcsncmp(szFull, L"\\\\", 2) == 0)
+            StringCchPrintfW(p->pszPath, PACK_PATH_CCH, L"\\\\?\\UNC\\%s", szFull + 2);
+        else
+            StringCchPrintfW(p->pszPath, PACK_PATH_CCH, L"\\\\?\\%s", szFull);
+        cchPath = wcslen(p->pszPath);
+        if (cchPath > 0 && p->pszPath[cchPath - 1] == L'\\')
+            p->pszPath[--cchPath] = L'\0';
+
+        p->szName[0] = '\0';
+        Walk(p, cchPath, 0, &fd);
+    }
+}
+
+static Packer *NewPacker(LPWSTR const *ppszItems, int nItems)
+{
+    Packer *p = calloc(1, sizeof(Packer));
+
+    if (!p)
+        return NULL;
+    p->pszPath = malloc(PACK_PATH_CCH * sizeof(WCHAR));
+    p->ppszItems = (LPWSTR *)ppszItems;
+    p->nItems = nItems;
+    p->hOut = INVALID_HANDLE_VALUE;
+    if (!p->pszPath)
+    {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+static void FreePacker(Packer *p)
+{
+    free(p->pszPath);
+    free(p->pBuffer);
+    free(p);
+}
+
+void PackScan(LPWSTR const *ppszItems, int nItems, PackTotals *pTotals)
+{
+    Packer *p = NewPacker(ppszItems, nItems);
+
+    memset(pTotals, 0, sizeof(*pTotals));
+    if (!p)
+        return;
+    p->bScanOnly = TRUE;
+    WalkItems(p);
+    *pTotals = p->totals;
+    FreePacker(p);
+}
+
+BOOL PackWorthCompressing(const PackTotals *pTotals)
+{
+    return pTotals->cbCompressed * 2 < pTotals->cbTotal || pTotals->cbTotal == 0;
+}
+
+static DWORD WINAPI PackerThread(LPVOID lpParam)
+{
+    Packer *p = (Packer *)lpParam;
+
+    WalkItems(p);
+
+    /* End of archive, then EOF for the remote tar */
+    if (!p->bCancel && !p->bBrokenPipe && PutZeros(p, 2 * TAR_BLOCK_SIZE))
+        Flush(p);
+    CloseHandle(p->hOut);
+    p->hOut = INVALID_HANDLE_VALUE;
+    return 0;
+}
+
+Packer *PackerStart(LPWSTR const *ppszItems, int nItems, HANDLE hOut)
+{
+    Packer *p = NewPacker(ppszItems, nItems);
+
+    if (p)
+        p->pBuffer = malloc(PACK_BUFFER_SIZE);
+    if (!p || !p->pBuffer)
+    {
+        if (p)
+            FreePacker(p);
+        CloseHandle(hOut);
+        return NULL;
+    }
+
+    p->hOut = hOut;
+    p->hThread = CreateThread(NULL, 0, PackerThread, p, 0, NULL);
+    if (!p->hThread)
+    {
+        CloseHandle(hOut);
+        FreePacker(p);
+        return NULL;
+    }
+    return p;
+}
+
+BOOL PackerWait(Packer *p, DWORD dwMilliseconds)
+{
+    return WaitForSingleObject(p->hThread, dwMilliseconds) == WAIT_OBJECT_0;
+}
+
+void PackerGetProgress(Packer *p, unsigned long *pnFiles, unsigned long long *pcbSent)
+{
+    *pnFiles = (unsigned long)InterlockedCompareExchange(&p->nFiles, 0, 0);
+    *pcbSent = (unsigned long long)InterlockedCompareExchange64(&p->cbSent, 0, 0);
+}
+
+void PackerCancel(Packer *p)
+{
+    InterlockedExchange(&p->bCancel, 1);
+}
+
+void PackerFinish(Packer *p, PackResult *pResult)
+{
+    WaitForSingleObject(p->hThread, INFINITE);
+    CloseHandle(p->hThread);
+
+    pResult->nFiles = (unsigned long)p->nFiles;
+    pResult->nSkipped = p->nSkipped;
+    pResult->nErrors = p->nErrors;
+    pResult->cbSent = (unsigned long long)p->cbSent;
+    pResult->bBrokenPipe = p->bBrokenPipe;
+    StringCchCopyW(pResult->szFirstError, MAX_PATH + 64, p->szFirstError);
+
+    FreePacker(p);
+}
@@ -0,0 +1,76 @@
+/**
+ * sshfs-pack.h
+ *
+ * Producer side of the streamed upload in sshfs-ssh.exe: walks local files
+ * and folders on its own thread and writes them as one tar archive into the
+ * pipe that feeds ssh (and "tar xf -" on the server). The pipe is the queue:
+ * reading local files overlaps with ssh compressing and sending, and a slow
+ * link simply blocks the producer.
+ *
+ * Symlinks and junctions are skipped rather than followed.
+ */
+
+#ifndef SSHFS_PACK_H
+#define SSHFS_PACK_H
+
+#include <windows.h>
+
+#define PACK_BUFFER_SIZE (1024 * 1024)      /* Headers and content are batched up to this */
+
+typedef struct PackTotals {
+    unsigned long nFiles;
+    unsigned long nDirs;
+    unsigned long long cbTotal;
+    unsigned long long cbCompressed;        /* In formats that are already compressed */
+} PackTotals;
+
+typedef struct PackResult {
+    unsigned long nFiles;                   /* Files sent */
+    unsigned long nSkipped;                 /* Links and junctions */
+    unsigned long nErrors;                  /* Files or folders that could not be read */
+    unsigned long long cbSent;              /* Content bytes */
+    BOOL bBrokenPipe;                       /* ssh went away before the end */
+    WCHAR szFirstError[MAX_PATH + 64];
+} PackResult;
+
+typedef struct Packer Packer;
+
+/**
+ * Count what the items contain (one metadata pass, nothing is read)
+ */
+void PackScan(LPWSTR const *ppszItems, int nItems, PackTotals *pTotals);
+
+/**
+ * TRUE when compressing the stream is likely to pay off: most of the bytes
+ * are not in formats that are compressed already (archives, media, ...)
+ */
+BOOL PackWorthCompressing(const PackTotals *pTotals);
+
+/**
+ * Start packing the items (each one lands in the archive under its own
+ * name) into hOut. The packer owns hOut and closes it when done, which is
+ * the end of input for the remote tar.
+ */
+Packer *PackerStart(LPWSTR const *ppszItems, int nItems, HANDLE hOut);
+
+/**
+ * Wait up to dwMilliseconds. TRUE once the archive is complete or aborted.
+ */
+BOOL PackerWait(Packer *p, DWORD dwMilliseconds);
+
+/**
+ * Progress so far, safe to call while the packer runs
+ */
+void PackerGetProgress(Packer *p, unsigned long *pnFiles, unsigned long long *pcbSent);
+
+/**
+ * Stop at the next file or read
+ */
+void PackerCancel(Packer *p);
+
+/**
+ * Wait for the packer thread, free it and report the outcome
+ */
+void PackerFinish(Packer *p, PackResult *pResult);
+
+#endif /* SSHFS_PACK_H */
@@ -0,0 +1,261 @@
+/**
+ * sshfs-path.c
+ *
+ * Portable remote path helpers (see sshfs-path.h)
+ */
+
+#include "sshfs-path.h"
+
+#include <string.h>
+
+int FormatRemotePath(const char *pszCombined, int bRootMount, char *pszOut, size_t cchOut)
+{
+    const char *pszPrefix;
+    const char *src;
+    size_t pos = 0;
+    int lastWasSlash = 0;
+    int bFits = 1;
+
+    if (cchOut == 0)
+        return 0;
+
+    if (bRootMount)
+    {
+        /* Root mount: path is absolute from / */
+        pszPrefix = (pszCombined[0] == '/') ? "" : "/";
+    }
+    else
+    {
+        /* Home mount: path is relative to home directory (~) */
+        if (pszCombined[0] == '/')
+            pszPrefix = "~";
+        else if (pszCombined[0])
+            pszPrefix = "~/";
+        else
+            pszPrefix = "~";
+    }
+
+    /* Emit prefix then path, collapsing double slashes as we go */
+    for (int part = 0; part < 2; part++)
+    {
+        for (src = part ? pszCombined : pszPrefix; *src; src++)
+        {
+            if (*src == '/')
+            {
+                if (lastWasSlash)
+                    continue;
+                lastWasSlash = 1;
+            }
+            else
+            {
+                lastWasSlash = 0;
+            }
+
+            if (pos + 1 >= cchOut)
+            {
+                bFits = 0;
+                break;
+            }
+            pszOut[pos++] = *src;
+        }
+    }
+    pszOut[pos] = '\0';
+
+    return bFits;
+}
+
+/**
+ * Length of pszBase without trailing slashes (but "/" stays "/")
+ */
+static size_t BaseLength(const char *pszBase)
+{
+    size_t len = strlen(pszBase);
+
+    while (len > 1 && pszBase[len - 1] == '/')
+        len--;
+    return len;
+}
+
+int RemotePathToLocal(const char *pszRemote, const char *pszRemoteBase, char cSep,
+    char *pszOut, size_t cchOut)
+{
+    const char *src = pszRemote;
+    size_t pos = 0;
+
+    if (cchOut == 0)
+        return 0;
+    pszOut[0] = '\0';
+
+    /* Absolute ("/..." or "~..."): must start with the base, component-wise */
+    if (src[0] == '/' || src[0] == '~')
+    {
+        size_t cchBase = BaseLength(pszRemoteBase);
+
+        if (strncmp(src, pszRemoteBase, cchBase) != 0)
+            return 0;
+        src += cchBase;
+        if (*src && *src != '/' && !(cchBase == 1 && pszRemoteBase[0] == '/'))
+            return 0;
+    }
+
+    /* Copy the components, dropping empty and "." ones */
+    while (*src)
+    {
+        const char *end;
+        size_t n;
+
+        while (*src == '/')
+            src++;
+        end = src;
+        while (*end && *end != '/')
+            end++;
+        n = (size_t)(end - src);
+
+        if (n == 0 || (n == 1 && src[0] == '.'))
+        {
+            src = end;
+            continue;
+        }
+        if (n == 2 && src[0] == '.' && src[1] == '.')
+            return 0;
+
+        if (pos + (pos > 0) + n + 1 > cchOut)
+            return 0;
+        if (pos > 0)
+            pszOut[pos++] = cSep;
+        memcpy(pszOut + pos, src, n);
+        pos += n;
+        src = end;
+    }
+    pszOut[pos] = '\0';
+    return 1;
+}
+
+/**
+ * Copy n bytes of src as a string, cut short to fit cbDst
+ */
+static void CopyPart(char *pszDst, size_t cbDst, const char *src, size_t n)
+{
+    if (n >= cbDst)
+        n = cbDst - 1;
+    memcpy(pszDst, src, n);
+    pszDst[n] = '\0';
+}
+
+/**
+ * pszPrefix (lowercase), in any case, followed by a separator
+ */
+static int HasSharePrefix(const char *p, const char *pszPrefix)
+{
+    for (; *pszPrefix; p++, pszPrefix++)
+    {
+        char c = (*p >= 'A' && *p <= 'Z') ? (char)(*p + ('a' - 'A')) : *p;
+        if (c != *pszPrefix)
+            return 0;
+    }
+    return *p == '\\' || *p == '/';
+}
+
+int ParseSSHFSInstance(const char *pszUNC, SSHFSInstance *pInst)
+{
+    /* Longest first: "sshfs" is a prefix of the others */
+    static const struct {
+        const char *pszShare;
+        MountType mountType;
+    } shares[] = {
+        {"sshfs.kr", MOUNT_TYPE_KEY_ROOT},
+        {"sshfs.k", MOUNT_TYPE_KEY},
+        {"sshfs.r", MOUNT_TYPE_PASSWORD_ROOT},
+        {"sshfs", MOUNT_TYPE_PASSWORD}
+    };
+    const char *p = pszUNC;
+    const char *pInstance, *pEnd, *pPath, *pAt, *pBang, *pEquals;
+    size_t i;
+
+    if (!pszUNC || strlen(pszUNC) < 10)
+        return 0;
+
+    while (*p == '\\')
+        p++;
+
+    for (i = 0; i < sizeof(shares) / sizeof(shares[0]); i++)
+        if (HasSharePrefix(p, shares[i].pszShare))
+            break;
+    if (i == sizeof(shares) / sizeof(shares[0]))
+        return 0;
+    pInst->mountType = shares[i].mountType;
+    p += strlen(shares[i].pszShare) + 1;
+
+    pInstance = p;
+    pEnd = p + strcspn(p, "\\/");
+    pPath = *pEnd ? pEnd + 1 : pEnd;
+
+    pEquals = memchr(pInstance, '=', (size_t)(pEnd - pInstance));
+    if (pEquals)
+        pInstance = pEquals + 1;
+
+    pAt = memchr(pInstance, '@', (size_t)(pEnd - pInstance));
+    if (!pAt)
+        return 0;
+    CopyPart(pInst->szUser, sizeof(pInst->szUser), pInstance, (size_t)(pAt - pInstance));
+
+    pBang = memchr(pAt + 1, '!', (size_t)(pEnd - pAt - 1));
+    if (pBang)
+    {
+        CopyPart(pInst->szHost, sizeof(pInst->szHost), pAt + 1, (size_t)(pBang - pAt - 1));
+        CopyPart(pInst->szPort, sizeof(pInst->szPort), pBang + 1, (size_t)(pEnd - pBang - 1));
+    }
+    else
+    {
+        CopyPart(pInst->szHost, sizeof(pInst->szHost), pAt + 1, (size_t)(pEnd - pAt - 1));
+        pInst->szPort[0] = '\0';
+    }
+
+    CopyPart(pInst->szBasePath, sizeof(pInst->szBasePath), pPath, strlen(pPath));
+    for (char *q = pInst->szBasePath; *q; q++)
+        if (*q == '\\')
+            *q = '/';
+
+    return 1;
+}
+
+int BuildMountedRemotePath(const char *pszLocalPath, const char *pszUNCPath, int bRootMount,
+    char *pszOut, size_t cchOut)
+{
+    char szCombined[4096];
+    const char *pszRest = "";
+    const char *pszSub = "";
+    size_t cchRest, cchSub = 0;
+
+    /* \\server\share<rest>: <rest> is where the share starts on the server */
+    if (pszUNCPath && pszUNCPath[0])
+    {
+        const char *p = pszUNCPath;
+        while (*p == '\\')
+            p++;
+        p += strcspn(p, "\\/");
+        if (*p)
+            p++;
+        pszRest = p + strcspn(p, "\\/");
+    }
+    cchRest = strlen(pszRest);
+
+    if (pszLocalPath[0] && pszLocalPath[1] == ':' && pszLocalPath[2])
+    {
+        pszSub = pszLocalPath + 2;
+        cchSub = strlen(pszSub);
+    }
+
+    if (cchRest + cchSub >= sizeof(szCombined))
+        return 0;
+    memcpy(szCombined, pszRest, cchRest);
+    memcpy(szCombined + cchRest, pszSub, cchSub);
+    szCombined[cchRest + cchSub] = '\0';
+
+    for (char *q = szCombined; *q; q++)
+        if (*q == '\\')
+            *q = '/';
+
+    /* Root/home prefix and slash cleanup are shared with the Linux resolver */
+    return FormatRemotePath(szCombined, bRootMount, pszOut, cchOut);
+}
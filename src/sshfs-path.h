@@ -0,0 +1,77 @@
+/**
+ * sshfs-path.h
+ *
+ * Portable remote path helpers shared by the Windows UNC resolver in
+ * sshfs-unc.c and the Linux mountinfo resolver in sshfs-mounts.c, and the
+ * UNC parsing itself, so it can be measured on Linux (sshfs-perf-path.c).
+ *
+ * All strings are UTF-8; the Windows callers convert at the boundary.
+ */
+
+#ifndef SSHFS_PATH_H
+#define SSHFS_PATH_H
+
+#include <stddef.h>
+
+/**
+ * Turn a mount-relative path (mount base + local sub path, '/' separated)
+ * into the path ssh should use on the server.
+ *
+ * Root mounts are absolute from '/', home mounts are relative to '~'.
+ * Runs of slashes are collapsed. Returns 0 if the result was truncated.
+ */
+int FormatRemotePath(const char *pszCombined, int bRootMount, char *pszOut, size_t cchOut);
+
+/**
+ * The inverse of FormatRemotePath() below a known point: map a remote path
+ * back to the local sub path under which the mount shows it.
+ *
+ * pszRemoteBase is the remote path of some local folder (as produced for
+ * it by FormatRemotePath()); pszRemote is either below it ("~/src/a.c"
+ * under "~/src") or relative to it ("a.c", "./lib/b.c", as tools print
+ * them after "cd <base>"). The result is the part below the base with
+ * '.' components and repeated slashes dropped, joined with cSep ("" for
+ * the base itself). Returns 0 if the path is not below the base, contains
+ * "..", or did not fit.
+ */
+int RemotePathToLocal(const char *pszRemote, const char *pszRemoteBase, char cSep,
+    char *pszOut, size_t cchOut);
+
+/**
+ * Mount type enumeration
+ */
+typedef enum {
+    MOUNT_TYPE_PASSWORD,        /* \\sshfs\... - password auth */
+    MOUNT_TYPE_PASSWORD_ROOT,   /* \\sshfs.r\... - password auth, root path */
+    MOUNT_TYPE_KEY,             /* \\sshfs.k\... - key auth */
+    MOUNT_TYPE_KEY_ROOT         /* \\sshfs.kr\... - key auth, root path */
+} MountType;
+
+/**
+ * The parts of \\sshfs[.r|.k|.kr]\[instance=]user@host[!port][\path], sized
+ * for the UTF-8 form of SSHFSLocation's fields
+ */
+typedef struct SSHFSInstance {
+    char szUser[128 * 3];
+    char szHost[256 * 3];
+    char szPort[16 * 3];
+    char szBasePath[260 * 3];   /* '/' separated, "" for none */
+    MountType mountType;
+} SSHFSInstance;
+
+/**
+ * Parse an SSHFS-Win UNC path ('\\' or '/' separated after the prefix).
+ * Fields that do not fit are cut short. Returns 0 if it is not one.
+ */
+int ParseSSHFSInstance(const char *pszUNC, SSHFSInstance *pInst);
+
+/**
+ * The path on the server for pszLocalPath ("X:\sub\dir" or "X:") on the
+ * drive mapped to pszUNCPath: the UNC path's part after the share, then
+ * the local sub path, through FormatRemotePath(). Returns 0 if the result
+ * was truncated.
+ */
+int BuildMountedRemotePath(const char *pszLocalPath, const char *pszUNCPath, int bRootMount,
+    char *pszOut, size_t cchOut);
+
+#endif /* SSHFS_PATH_H */
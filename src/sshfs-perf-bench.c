@@ -0,0 +1,180 @@
+/**
+ * sshfs-perf-bench.c
+ *
+ * Test of sshfs-bench.c: the parser that splits ssh -v output and the
+ * session's markers into the phases of connecting. Checked on a known
+ * transcript and against the bench command run with /bin/sh after a
+ * stand-in ssh -v, then timed on 64 KB of ssh -vvv output.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-bench sshfs-perf-bench.c sshfs-perf.c sshfs-bench.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-bench.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* ssh -v up to the session, as OpenSSH 9 prints it */
+static const char g_szSshVerbose[] =
+    "OpenSSH_9.6p1 Ubuntu-3ubuntu13, OpenSSL 3.0.13 30 Jan 2024\r\n"
+    "debug1: Reading configuration data /etc/ssh/ssh_config\r\n"
+    "debug1: Connecting to bench [192.0.2.1] port 22.\r\n"
+    "debug1: Connection established.\r\n"
+    "debug1: Local version string SSH-2.0-OpenSSH_9.6p1\r\n"
+    "debug1: SSH2_MSG_KEXINIT sent\r\n"
+    "debug1: SSH2_MSG_NEWKEYS received\r\n"
+    "debug1: Will attempt key: /home/perf/.ssh/id_ed25519\r\n"
+    "Authenticated to bench ([192.0.2.1]:22) using \"publickey\".\r\n"
+    "debug1: channel 0: new session [client-session] (inactive timeout: 0)\r\n";
+
+static char *g_pBenchOut;
+static size_t g_cbBenchOut;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    /* A run of ssh -vvv: every packet logged before the markers */
+    g_pBenchOut = malloc(PERF_OUTPUT_SIZE);
+    if (!g_pBenchOut)
+        return 0;
+    pos = (size_t)sprintf(g_pBenchOut, "%s", g_szSshVerbose);
+    for (i = 0; pos + 256 < PERF_OUTPUT_SIZE; i++)
+        pos += (size_t)sprintf(g_pBenchOut + pos, "debug3: receive packet: type %zu\r\n"
+            "debug2: channel 0: rcvd adjust %zu\r\n", 90 + i % 10, i * 4096);
+    pos += (size_t)sprintf(g_pBenchOut + pos, "#sshfs-bench session\r\n#sshfs-bench cd\r\n#sshfs-bench shell\r\n");
+    g_cbBenchOut = pos;
+    return 1;
+}
+
+static void BenchBenchFeed(size_t nOps)
+{
+    static BenchRun run;
+    size_t i, pos, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        BenchRunInit(&run);
+        for (pos = 0; pos < g_cbBenchOut; pos += 1500)
+            BenchFeed(&run, g_pBenchOut + pos, g_cbBenchOut - pos < 1500 ? g_cbBenchOut - pos : 1500, (double)pos);
+        n += (size_t)BenchRunReached(&run);
+    }
+    g_sink += n;
+}
+
+/* Feed a run in small uneven reads, the clock a millisecond per read */
+static void FeedBench(BenchRun *r, const char *data, size_t len, double *pMs)
+{
+    size_t pos, cb;
+
+    for (pos = 0; pos < len; pos += cb)
+    {
+        cb = 1 + pos % 13;
+        if (cb > len - pos)
+            cb = len - pos;
+        *pMs += 1;
+        BenchFeed(r, data + pos, cb, *pMs);
+    }
+}
+
+static int CheckBenchParse(void)
+{
+    static BenchSeries series;
+    static const char szOld[] = "debug1: Connecting to a\ndebug1: Connection established.\n"
+        "debug1: SSH2_MSG_NEWKEYS received\ndebug1: Authentication succeeded (publickey).\n"
+        "#sshfs-bench cd\n#sshfs-bench session\n#sshfs-bench shell\n";
+    static const char szRefused[] = "ssh: connect to host bench port 22: Connection refused\r";
+    double values[20];
+    char szReport[2048];
+    BenchRun run;
+    BenchStat stat;
+    double ms = 0;
+    int bOk, i;
+
+    /* Markers of OpenSSH before 8.9, two of them out of order */
+    BenchRunInit(&run);
+    FeedBench(&run, szOld, sizeof(szOld) - 1, &ms);
+    BenchSeriesInit(&series);
+    bOk = Expect(BenchRunReached(&run) == BENCH_PHASES && BenchSeriesAdd(&series, &run) &&
+        series.ms[BENCH_CD][0] == 0 && series.ms[BENCH_SESSION][0] > 0 &&
+        series.ms[BENCH_TOTAL][0] == run.msEnd[BENCH_SHELL], "old markers, out of order");
+
+    /* A failed run keeps the last line that was not debug output */
+    BenchRunInit(&run);
+    BenchFeed(&run, g_szSshVerbose, (size_t)(strstr(g_szSshVerbose, "debug1: Connection established") - g_szSshVerbose), 5);
+    BenchFeed(&run, szRefused, sizeof(szRefused) - 1, 6);
+    bOk &= Expect(BenchRunReached(&run) == BENCH_CONNECT && !BenchSeriesAdd(&series, &run) &&
+        strcmp(run.szError, "ssh: connect to host bench port 22: Connection refused") == 0 &&
+        series.nOk == 1 && series.nRuns == 2, "failed run");
+
+    for (i = 0; i < 20; i++)
+        values[i] = 20 - i;
+    BenchSummarize(values, 20, &stat);
+    bOk &= Expect(stat.min == 1 && stat.median == 10.5 && stat.p95 == 19, "min, median, p95");
+    BenchFormatSeries(&series, "default", szReport, sizeof(szReport));
+    bOk &= Expect(strstr(szReport, "default: 1 of 2 runs completed\n") == szReport &&
+        strstr(szReport, "\n  total ") && BenchFormatSeries(&series, "default", NULL, 0) == strlen(szReport),
+        "report");
+    return bOk;
+}
+
+/**
+ * The bench command run for real with /bin/sh after a stand-in for ssh -v,
+ * both streams on one pipe as ssh gives them: every phase has to be seen,
+ * and a folder that is missing has to stop the run before "cd"
+ */
+static int CheckBenchScript(void)
+{
+    static char szOut[8192];
+    char szDir[256], szPath[PATH_MAX], szCmd[PATH_MAX + 1024];
+    size_t cbCmd, cbOut;
+    BenchRun run;
+    double ms = 0;
+    int bOk;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szPath, sizeof(szPath), "%s/tree", szDir);
+    mkdir(szPath, 0755);
+    cbCmd = RemoteBuildBenchCommand(szPath, szCmd, sizeof(szCmd));
+    bOk = Expect(cbCmd < sizeof(szCmd) && WriteScratchFile(szDir, "bench.sh", szCmd, cbCmd) &&
+        WriteScratchFile(szDir, "ssh-v.txt", g_szSshVerbose, sizeof(g_szSshVerbose) - 1), "bench script");
+
+    snprintf(szCmd, sizeof(szCmd), "cd '%s' && cat ssh-v.txt && SHELL=/bin/sh sh bench.sh 2>&1", szDir);
+    RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    BenchRunInit(&run);
+    FeedBench(&run, szOut, cbOut, &ms);
+    bOk &= Expect(BenchRunReached(&run) == BENCH_PHASES && run.msEnd[BENCH_AUTH] < run.msEnd[BENCH_SESSION] &&
+        run.msEnd[BENCH_CD] < run.msEnd[BENCH_SHELL], "all phases");
+
+    snprintf(szPath, sizeof(szPath), "%s/missing", szDir);
+    cbCmd = RemoteBuildBenchCommand(szPath, szCmd, sizeof(szCmd));
+    bOk &= Expect(WriteScratchFile(szDir, "bench.sh", szCmd, cbCmd), "bench script");
+    snprintf(szCmd, sizeof(szCmd), "cd '%s' && cat ssh-v.txt && SHELL=/bin/sh sh bench.sh 2>&1", szDir);
+    RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    BenchRunInit(&run);
+    FeedBench(&run, szOut, cbOut, &ms);
+    bOk &= Expect(BenchRunReached(&run) == BENCH_CD && strstr(run.szError, "missing"), "missing folder");
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static int CheckBench(void)
+{
+    return CheckBenchParse() & CheckBenchScript();
+}
+
+static const MicroBench g_benches[] = {
+    {"bench-feed-64k",       BenchBenchFeed,     CheckBench,         2000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
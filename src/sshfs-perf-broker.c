@@ -0,0 +1,157 @@
+/**
+ * sshfs-perf-broker.c
+ *
+ * Test of sshfs-broker.c: the credential broker's cache and line protocol.
+ * Checked against its rules for who may store, read and redeem, with
+ * grants bound to one ssh and refused to other peers, then timed on a
+ * launch: a cached secret looked up among 64, granted and redeemed.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-broker sshfs-perf-broker.c sshfs-perf.c sshfs-broker.c sshfs-hash.c
+ */
+
+#define _GNU_SOURCE
+
+#include "sshfs-perf.h"
+#include "sshfs-broker.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static unsigned char g_prekey[BROKER_PREKEY_SIZE];
+
+static int SetUp(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(g_prekey); i++)
+        g_prekey[i] = (unsigned char)(i * 2654435761u >> 13);
+    return 1;
+}
+
+/**
+ * A launch as the broker sees it: a cached secret looked up among 64,
+ * granted to askpass and redeemed
+ */
+static void BenchBroker(size_t nOps)
+{
+    static Broker b;
+    static const BrokerPeer launcher = {BROKER_PEER_LAUNCHER, 100, 1, 0};
+    static const BrokerPeer askpass = {BROKER_PEER_ASKPASS, 300, 200, 100};
+    char szRequest[BROKER_MAX_LINE], szResponse[BROKER_MAX_LINE], szHex[64];
+    size_t i, cb, n = 0;
+
+    BrokerInit(&b, g_prekey, BROKER_PREKEY_SIZE, BROKER_DEFAULT_TTL);
+    BrokerHexEncode("perf", 4, szHex, sizeof(szHex));
+    for (i = 0; i < BROKER_MAX_ENTRIES; i++)
+    {
+        snprintf(szRequest, sizeof(szRequest), "PUT perf@host-%zu:22 %s", i, szHex);
+        BrokerHandle(&b, szRequest, &launcher, 1000, szResponse, sizeof(szResponse));
+    }
+    for (i = 0; i < nOps; i++)
+    {
+        snprintf(szRequest, sizeof(szRequest), "CRED perf@host-%zu:22", i % BROKER_MAX_ENTRIES);
+        BrokerHandle(&b, szRequest, &launcher, 1000, szResponse, sizeof(szResponse));
+        cb = strlen(szResponse);
+        snprintf(szRequest, sizeof(szRequest), "GRANT %.*s", (int)(cb > 4 ? cb - 4 : 0), szResponse + 3);
+        BrokerHandle(&b, szRequest, &launcher, 1000, szResponse, sizeof(szResponse));
+        snprintf(szRequest, sizeof(szRequest), "GET %.*s", BROKER_TOKEN_LEN, szResponse + 3);
+        for (cb = 0; cb < BROKER_GRANT_USES; cb++)
+            n += BrokerHandle(&b, szRequest, &askpass, 1000, szResponse, sizeof(szResponse));
+    }
+    BrokerWipe(&b);
+    g_sink += n;
+}
+
+/**
+ * One request; the answer without its "\n"
+ */
+static const char *CallBroker(Broker *b, const BrokerPeer *peer, long long now, const char *pszFormat, ...)
+{
+    static char szResponse[BROKER_MAX_LINE];
+    char szRequest[BROKER_MAX_LINE];
+    va_list ap;
+    size_t cb;
+
+    va_start(ap, pszFormat);
+    vsnprintf(szRequest, sizeof(szRequest), pszFormat, ap);
+    va_end(ap);
+    cb = BrokerHandle(b, szRequest, peer, now, szResponse, sizeof(szResponse));
+    if (cb > 0 && szResponse[cb - 1] == '\n')
+        szResponse[cb - 1] = '\0';
+    return szResponse;
+}
+
+static int CheckBroker(void)
+{
+    static Broker b;
+    static const BrokerPeer launcher = {BROKER_PEER_LAUNCHER, 100, 1, 0};
+    static const BrokerPeer other = {BROKER_PEER_LAUNCHER, 101, 1, 0};
+    static const BrokerPeer untrusted = {BROKER_PEER_UNTRUSTED, 102, 1, 0};
+    static const BrokerPeer askpass = {BROKER_PEER_ASKPASS, 300, 200, 100};
+    static const BrokerPeer askpass2 = {BROKER_PEER_ASKPASS, 301, 201, 100};
+    static const BrokerPeer stranger = {BROKER_PEER_ASKPASS, 302, 202, 999};
+    char szHex[64], szToken[BROKER_TOKEN_LEN + 1], szSecret[16];
+    unsigned char prekey[BROKER_PREKEY_SIZE];
+    int bOk, i;
+
+    for (i = 0; i < BROKER_PREKEY_SIZE; i++)
+        prekey[i] = (unsigned char)(i * 7 + 3);
+    BrokerInit(&b, prekey, sizeof(prekey), BROKER_DEFAULT_TTL);
+    BrokerHexEncode("s3cret pass", 11, szHex, sizeof(szHex));
+    bOk = Expect(strcmp(szHex, "7333637265742070617373") == 0 && BrokerHexDecode(szHex, strlen(szHex), szSecret,
+        sizeof(szSecret)) == 11 && memcmp(szSecret, "s3cret pass", 11) == 0 &&
+        BrokerHexDecode("abc", 3, szSecret, sizeof(szSecret)) == (size_t)-1 &&
+        BrokerHexDecode("zz", 2, szSecret, sizeof(szSecret)) == (size_t)-1, "hex");
+
+    /* The cache: only for the launcher, kept shielded, until the TTL */
+    bOk &= Expect(strcmp(CallBroker(&b, &launcher, 1000, "PUT perf@bench:22 %s", szHex), "OK") == 0 &&
+        strcmp(CallBroker(&b, &untrusted, 1000, "PUT evil@bench:22 %s", szHex), "NO") == 0, "put");
+    bOk &= Expect(memmem(&b, sizeof(b), "s3cret", 6) == NULL, "no secret in the clear");
+    bOk &= Expect(strncmp(CallBroker(&b, &other, 1500, "CRED perf@bench:22"), "OK ", 3) == 0 &&
+        strcmp(CallBroker(&b, &launcher, 1500, "CRED perf@bench:22") + 3, szHex) == 0 &&
+        strcmp(CallBroker(&b, &askpass, 1500, "CRED perf@bench:22"), "NO") == 0 &&
+        strcmp(CallBroker(&b, &launcher, 1500, "CRED perf@bench:2222"), "NO") == 0, "cred");
+    bOk &= Expect(strcmp(CallBroker(&b, &launcher, 1000 + BROKER_DEFAULT_TTL, "CRED perf@bench:22"), "NO") == 0,
+        "cache TTL");
+
+    /* A grant: askpass under an ssh of the launch that asked, bound to
+     * the first ssh, BROKER_GRANT_USES answers */
+    snprintf(szToken, sizeof(szToken), "%s", CallBroker(&b, &launcher, 2000, "GRANT %s", szHex) + 3);
+    bOk &= Expect(strlen(szToken) == BROKER_TOKEN_LEN &&
+        strcmp(CallBroker(&b, &launcher, 2000, "GET %s", szToken), "NO") == 0 &&
+        strcmp(CallBroker(&b, &stranger, 2000, "GET %s", szToken), "NO") == 0, "grant refused to others");
+    bOk &= Expect(strcmp(CallBroker(&b, &askpass, 2001, "GET %s", szToken) + 3, szHex) == 0 &&
+        strcmp(CallBroker(&b, &askpass2, 2001, "GET %s", szToken), "NO") == 0 &&
+        strcmp(CallBroker(&b, &askpass, 2002, "GET %s", szToken) + 3, szHex) == 0 &&
+        strcmp(CallBroker(&b, &askpass, 2003, "GET %s", szToken) + 3, szHex) == 0 &&
+        strcmp(CallBroker(&b, &askpass, 2004, "GET %s", szToken), "NO") == 0, "grant bound and used up");
+    snprintf(szToken, sizeof(szToken), "%s", CallBroker(&b, &launcher, 3000, "GRANT %s", szHex) + 3);
+    bOk &= Expect(strcmp(CallBroker(&b, &askpass, 3000 + BROKER_GRANT_TTL, "GET %s", szToken), "NO") == 0,
+        "grant TTL");
+    szToken[0] = szToken[0] == 'a' ? 'b' : 'a';
+    bOk &= Expect(strcmp(CallBroker(&b, &askpass, 3000, "GET %s", szToken), "NO") == 0 &&
+        strcmp(CallBroker(&b, &launcher, 3000, "GRANT zz"), "NO") == 0 &&
+        strcmp(CallBroker(&b, &launcher, 3000, "PUT bad key %s", szHex), "NO") == 0 &&
+        strcmp(CallBroker(&b, &launcher, 3000, "HELLO"), "NO") == 0, "malformed requests");
+
+    CallBroker(&b, &launcher, 4000, "PUT perf@bench:22 %s", szHex);
+    bOk &= Expect(!BrokerIdle(&b) && strcmp(CallBroker(&b, &launcher, 4000, "CLEAR"), "OK") == 0 &&
+        BrokerIdle(&b) && strcmp(CallBroker(&b, &launcher, 4000, "CRED perf@bench:22"), "NO") == 0, "clear");
+
+    /* TTL 0 answers PUT but keeps nothing */
+    BrokerInit(&b, prekey, sizeof(prekey), 0);
+    bOk &= Expect(strcmp(CallBroker(&b, &launcher, 1000, "PUT perf@bench:22 %s", szHex), "OK") == 0 &&
+        BrokerIdle(&b), "no cache");
+    BrokerWipe(&b);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"broker-launch",        BenchBroker,        CheckBroker,        20000,  200000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
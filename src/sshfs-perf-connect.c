@@ -0,0 +1,250 @@
+/**
+ * sshfs-perf-connect.c
+ *
+ * Test of sshfs-connect.c: the connect cache and the address race of the
+ * parallel connect helper. Checked on the cache's update, expiry and size
+ * cap, and by racing on loopback against addresses that refuse or never
+ * answer, then timed on a full cache and on races won at once.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-connect sshfs-perf-connect.c sshfs-perf.c sshfs-connect.c
+ */
+
+#define _GNU_SOURCE
+
+#include "sshfs-perf.h"
+#include "sshfs-connect.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static char g_szConnectCache[CONNECT_CACHE_MAX + 512];
+
+static int SetUp(void)
+{
+    size_t i;
+
+    /* A full connect cache */
+    for (i = 0; i < 200; i++)
+    {
+        char szHost[32], szNew[sizeof(g_szConnectCache)];
+        size_t cb;
+
+        snprintf(szHost, sizeof(szHost), "host-%zu.example", i % 150);
+        cb = ConnectCacheUpdate(g_szConnectCache, szHost, "22", i % 2 ? "192.0.2.1" : "2001:db8::1",
+            1700000000 - (long long)i, szNew, sizeof(szNew));
+        memcpy(g_szConnectCache, szNew, cb + 1);
+    }
+    return 1;
+}
+
+/**
+ * A listener on loopback, the port chosen by the system if 0
+ */
+static int OpenListener(const char *pszAddr, int port, int backlog)
+{
+    struct sockaddr_in sin;
+    int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+    if (fd < 0)
+        return -1;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons((unsigned short)port);
+    inet_pton(AF_INET, pszAddr, &sin.sin_addr);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 || listen(fd, backlog) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int ListenerPort(int fd)
+{
+    struct sockaddr_in sin;
+    socklen_t cb = sizeof(sin);
+
+    return getsockname(fd, (struct sockaddr *)&sin, &cb) == 0 ? ntohs(sin.sin_port) : 0;
+}
+
+static void BenchConnectCache(size_t nOps)
+{
+    static char szOut[CONNECT_CACHE_MAX + 512];
+    char szAddr[64], szHost[32];
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        snprintf(szHost, sizeof(szHost), "host-%zu.example", i % 64);
+        n += (size_t)ConnectCacheFind(g_szConnectCache, szHost, "22", 1700000000, szAddr, sizeof(szAddr));
+        n += ConnectCacheUpdate(g_szConnectCache, szHost, "22", "192.0.2.7", 1700000000, szOut, sizeof(szOut));
+    }
+    g_sink += n;
+}
+
+/**
+ * A race won at once on loopback: connect, accept and close
+ */
+static void BenchConnectRace(size_t nOps)
+{
+    ConnectTarget t;
+    ConnectSocket s;
+    char szError[256];
+    size_t i, iWinner, n = 0;
+    int fdListen = OpenListener("127.0.0.1", 0, 64), fd;
+
+    if (fdListen < 0)
+        return;
+    memset(&t, 0, sizeof(t));
+    snprintf(t.szAddr[0], sizeof(t.szAddr[0]), "127.0.0.1");
+    snprintf(t.szPort, sizeof(t.szPort), "%d", ListenerPort(fdListen));
+    t.nAddrs = 1;
+    for (i = 0; i < nOps; i++)
+    {
+        s = ConnectRace(&t, CONNECT_ATTEMPT_DELAY_MS, 2000, &iWinner, szError, sizeof(szError));
+        if (s == CONNECT_INVALID)
+            break;
+        fd = accept(fdListen, NULL, NULL);
+        if (fd >= 0)
+            close(fd);
+        ConnectClose(s);
+        n++;
+    }
+    close(fdListen);
+    g_sink += n;
+}
+
+static int CheckConnectCache(void)
+{
+    char szText[CONNECT_CACHE_MAX + 512], szNew[CONNECT_CACHE_MAX + 512], szAddr[64], szHost[64];
+    size_t cb;
+    int bOk, i;
+
+    ConnectCacheUpdate("", "bench", "22", "192.0.2.1", 1000, szText, sizeof(szText));
+    ConnectCacheUpdate(szText, "other", "2222", "2001:db8::1", 1000, szNew, sizeof(szNew));
+    bOk = Expect(ConnectCacheFind(szNew, "bench", "22", 1000 + CONNECT_CACHE_TTL - 1, szAddr, sizeof(szAddr)) &&
+        strcmp(szAddr, "192.0.2.1") == 0 && !ConnectCacheFind(szNew, "bench", "2222", 1000, szAddr, sizeof(szAddr)) &&
+        ConnectCacheFind(szNew, "other", "2222", 1000, szAddr, sizeof(szAddr)) && strcmp(szAddr, "2001:db8::1") == 0,
+        "entries by host and port");
+    bOk &= Expect(!ConnectCacheFind(szNew, "bench", "22", 1000 + CONNECT_CACHE_TTL, szAddr, sizeof(szAddr)),
+        "expired");
+
+    /* A new winner replaces the old one, NULL forgets the host */
+    ConnectCacheUpdate(szNew, "bench", "22", "192.0.2.2", 2000, szText, sizeof(szText));
+    bOk &= Expect(ConnectCacheFind(szText, "bench", "22", 2000, szAddr, sizeof(szAddr)) &&
+        strcmp(szAddr, "192.0.2.2") == 0 && strstr(szText, "192.0.2.1") == NULL, "replaced");
+    ConnectCacheUpdate(szText, "bench", "22", NULL, 2000, szNew, sizeof(szNew));
+    bOk &= Expect(!ConnectCacheFind(szNew, "bench", "22", 2000, szAddr, sizeof(szAddr)) &&
+        ConnectCacheFind(szNew, "other", "2222", 2000, szAddr, sizeof(szAddr)), "forgotten");
+
+    /* Past CONNECT_CACHE_MAX the oldest go; junk and expired lines too */
+    snprintf(szText, sizeof(szText), "junk\nold 22 192.0.2.3 5\n");
+    for (i = 0; i < 200; i++)
+    {
+        snprintf(szHost, sizeof(szHost), "host-%d.example", i);
+        cb = ConnectCacheUpdate(szText, szHost, "22", "192.0.2.4", 3000 + i, szNew, sizeof(szNew));
+        memcpy(szText, szNew, cb + 1);
+    }
+    bOk &= Expect(cb <= CONNECT_CACHE_MAX && strncmp(szText, "host-", 5) == 0 &&
+        ConnectCacheFind(szText, "host-199.example", "22", 3200, szAddr, sizeof(szAddr)) &&
+        !ConnectCacheFind(szText, "host-0.example", "22", 3200, szAddr, sizeof(szAddr)), "oldest dropped");
+    return bOk;
+}
+
+static double RaceMs(ConnectTarget *t, int msTimeout, size_t *piWinner, int *pbConnected)
+{
+    unsigned long long ns = NowNs();
+    char szError[256];
+    ConnectSocket s = ConnectRace(t, CONNECT_ATTEMPT_DELAY_MS, msTimeout, piWinner, szError, sizeof(szError));
+
+    *pbConnected = s != CONNECT_INVALID;
+    if (s != CONNECT_INVALID)
+        ConnectClose(s);
+    return (double)(NowNs() - ns) / 1e6;
+}
+
+/**
+ * Races on loopback: 127.0.0.1 listens, 127.0.0.2 refuses, and 127.0.0.3
+ * listens with a full backlog, so its SYNs go unanswered like those of a
+ * broken route
+ */
+static int CheckConnectRace(void)
+{
+    ConnectTarget t;
+    size_t iWinner = 99;
+    int fdGood, fdHole, port, bConnected, bOk, i;
+    int fdFill[4];
+    char szError[256];
+    double ms;
+
+    bOk = Expect(ConnectResolve("127.0.0.1", "22", &t, szError, sizeof(szError)) && t.nAddrs == 1 &&
+        strcmp(t.szAddr[0], "127.0.0.1") == 0 && strcmp(t.szPort, "22") == 0, "numeric address");
+
+    fdGood = OpenListener("127.0.0.1", 0, 16);
+    port = fdGood >= 0 ? ListenerPort(fdGood) : 0;
+    fdHole = port ? OpenListener("127.0.0.3", port, 0) : -1;
+    if (fdHole < 0)
+    {
+        if (fdGood >= 0)
+            close(fdGood);
+        return bOk & Expect(0, "loopback listeners");
+    }
+    for (i = 0; i < 4; i++)
+    {
+        struct sockaddr_in sin;
+
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons((unsigned short)port);
+        inet_pton(AF_INET, "127.0.0.3", &sin.sin_addr);
+        fdFill[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        connect(fdFill[i], (struct sockaddr *)&sin, sizeof(sin));
+    }
+    usleep(50000);
+
+    memset(&t, 0, sizeof(t));
+    snprintf(t.szPort, sizeof(t.szPort), "%d", port);
+    snprintf(t.szAddr[0], sizeof(t.szAddr[0]), "127.0.0.2");
+    snprintf(t.szAddr[1], sizeof(t.szAddr[1]), "127.0.0.1");
+    t.nAddrs = 2;
+    ms = RaceMs(&t, 2000, &iWinner, &bConnected);
+    bOk &= Expect(bConnected && iWinner == 1 && ms < CONNECT_ATTEMPT_DELAY_MS / 2, "refused address skipped at once");
+
+    snprintf(t.szAddr[0], sizeof(t.szAddr[0]), "127.0.0.3");
+    ms = RaceMs(&t, 2000, &iWinner, &bConnected);
+    bOk &= Expect(bConnected && iWinner == 1 && ms >= CONNECT_ATTEMPT_DELAY_MS * 0.8 &&
+        ms < CONNECT_ATTEMPT_DELAY_MS * 4, "next address after the delay");
+    bOk &= Expect(ConnectPrefer(&t, "127.0.0.1") && strcmp(t.szAddr[0], "127.0.0.1") == 0 &&
+        !ConnectPrefer(&t, "127.0.0.9"), "cached winner first");
+    ms = RaceMs(&t, 2000, &iWinner, &bConnected);
+    bOk &= Expect(bConnected && iWinner == 0 && ms < CONNECT_ATTEMPT_DELAY_MS / 2, "cached winner at once");
+
+    snprintf(t.szAddr[0], sizeof(t.szAddr[0]), "127.0.0.3");
+    t.nAddrs = 1;
+    ms = RaceMs(&t, 300, &iWinner, &bConnected);
+    bOk &= Expect(!bConnected && ms >= 250 && ms < 1500, "timeout");
+    snprintf(t.szAddr[0], sizeof(t.szAddr[0]), "127.0.0.2");
+    ms = RaceMs(&t, 2000, &iWinner, &bConnected);
+    bOk &= Expect(!bConnected && ms < CONNECT_ATTEMPT_DELAY_MS, "all refused");
+
+    for (i = 0; i < 4; i++)
+        close(fdFill[i]);
+    close(fdHole);
+    close(fdGood);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"connect-cache-4k",     BenchConnectCache,  CheckConnectCache,  2000,   1000000},
+    {"connect-race-loopback",BenchConnectRace,   CheckConnectRace,   500,    2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,91 @@
+/**
+ * sshfs-perf-cred.c
+ *
+ * Test of sshfs-cred.c: finding the stored password for user@host among
+ * the targets of a crowded Credential Manager, as every launch with a
+ * password does. Checked and timed with 512 targets where the only match
+ * is the last and differs in case.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-cred sshfs-perf-cred.c sshfs-perf.c sshfs-cred.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-cred.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PERF_CRED_TARGETS   512
+
+static CredChar *g_ppCredTargets[PERF_CRED_TARGETS];
+static CredPattern g_credPattern;
+
+/**
+ * UTF-16 copy of an ASCII string
+ */
+static CredChar *Utf16Dup(const char *psz)
+{
+    size_t n = strlen(psz), i;
+    CredChar *p = malloc((n + 1) * sizeof(CredChar));
+
+    if (!p)
+        return NULL;
+    for (i = 0; i <= n; i++)
+        p[i] = (unsigned char)psz[i];
+    return p;
+}
+
+static int SetUp(void)
+{
+    CredChar *pUser, *pHost;
+    char szTarget[256];
+    size_t i;
+
+    /* The one we want is the last */
+    for (i = 0; i < PERF_CRED_TARGETS; i++)
+    {
+        if (i == PERF_CRED_TARGETS - 1)
+            snprintf(szTarget, sizeof(szTarget), "sshfs-win:Alice@Files.Example.com");
+        else if (i % 3 == 0)
+            snprintf(szTarget, sizeof(szTarget), "MicrosoftAccount:user=alice%zu@outlook.com", i);
+        else if (i % 3 == 1)
+            snprintf(szTarget, sizeof(szTarget), "git:https://alice@github.com/org/repo-%zu", i);
+        else
+            snprintf(szTarget, sizeof(szTarget), "sshfs-win:alice@files%zu.example.com", i);
+        g_ppCredTargets[i] = Utf16Dup(szTarget);
+        if (!g_ppCredTargets[i])
+            return 0;
+    }
+    pUser = Utf16Dup("alice");
+    pHost = Utf16Dup("files.example.com");
+    if (!pUser || !pHost || !CredPatternInit(&g_credPattern, pUser, pHost))
+        return 0;
+    free(pUser);
+    free(pHost);
+    return 1;
+}
+
+static void BenchCredMatch(size_t nOps)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+        n += CredFindTarget(&g_credPattern, (const CredChar *const *)g_ppCredTargets, PERF_CRED_TARGETS, 0);
+    g_sink += n;
+}
+
+static int CheckCredMatch(void)
+{
+    return Expect(CredFindTarget(&g_credPattern, (const CredChar *const *)g_ppCredTargets,
+        PERF_CRED_TARGETS, 0) == PERF_CRED_TARGETS - 1, "the only matching target, case differing");
+}
+
+static const MicroBench g_benches[] = {
+    {"cred-match-512",       BenchCredMatch,     CheckCredMatch,     4000,   1000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,68 @@
+/**
+ * sshfs-perf-cwd.c
+ *
+ * Test of sshfs-cwd.c: the scanner for the shell's directory reports,
+ * which sees all terminal output while directory tracking is on. Checked
+ * on a listing with a report every 64 rows and on a report fed a byte at
+ * a time, then timed on 64 KB of that listing in pty-sized reads.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-cwd sshfs-perf-cwd.c sshfs-perf.c sshfs-cwd.c sshfs-path.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-cwd.h"
+
+#include <string.h>
+
+static char *g_pOutput;
+
+static int SetUp(void)
+{
+    g_pOutput = MakeTerminalOutput(PERF_OUTPUT_SIZE);
+    return g_pOutput != NULL;
+}
+
+static void BenchCwdScan(size_t nOps)
+{
+    static CwdScanner scanner;
+    size_t i, n = 0;
+
+    CwdScanInit(&scanner);
+    for (i = 0; i < nOps; i++)
+    {
+        size_t pos;
+
+        for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+            n += CwdScan(&scanner, g_pOutput + pos, 4096);
+    }
+    g_sink += n + (unsigned char)scanner.szCwd[1];
+}
+
+static int CheckCwdScan(void)
+{
+    static CwdScanner scanner;
+    const char *pszReport = "\x1b]7;file://host/home/alice/my%20dir\x07$ ";
+    size_t pos;
+    int bOk;
+
+    CwdScanInit(&scanner);
+    for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+        CwdScan(&scanner, g_pOutput + pos, 4096);
+    bOk = Expect(strncmp(scanner.szCwd, "/home/alice/project/dir-", 24) == 0, "last report in the listing");
+
+    /* One byte at a time, percent-decoded */
+    CwdScanInit(&scanner);
+    for (pos = 0; pszReport[pos]; pos++)
+        CwdScan(&scanner, pszReport + pos, 1);
+    bOk &= Expect(strcmp(scanner.szCwd, "/home/alice/my dir") == 0, "report fed a byte at a time");
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"cwd-scan-64k",         BenchCwdScan,       CheckCwdScan,       4000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,314 @@
+/**
+ * sshfs-perf-delta.c
+ *
+ * Test of sshfs-delta.c: the rolling-checksum scan of "Sync file changes
+ * to server". Checked against the block list the sync script prints under
+ * /bin/sh for a scratch file and the file it rebuilds from the plan, then
+ * timed scanning a 4 MB file with 100 bytes inserted in the middle.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-delta sshfs-perf-delta.c sshfs-perf.c sshfs-delta.c sshfs-hash.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-delta.h"
+#include "sshfs-hash.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PERF_DELTA_SIZE     (4 * 1024 * 1024)
+#define PERF_DELTA_CHECK_SIZE 1000000       /* Ends in a short block */
+
+static unsigned char *g_pDeltaServer;
+static unsigned char *g_pDeltaLocal;
+static DeltaSignature g_deltaSig;
+
+/**
+ * POSIX cksum: CRC-32 over the data and then its length, lowest byte
+ * first, complemented
+ */
+static unsigned int PosixCksum(const unsigned char *p, size_t cb)
+{
+    static unsigned int table[256];
+    unsigned int crc = 0, i, j;
+    size_t n;
+
+    if (!table[1])
+    {
+        for (i = 0; i < 256; i++)
+        {
+            for (crc = i << 24, j = 0; j < 8; j++)
+                crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04C11DB7u : crc << 1;
+            table[i] = crc;
+        }
+        crc = 0;
+    }
+    for (n = 0; n < cb; n++)
+        crc = (crc << 8) ^ table[(crc >> 24) ^ p[n]];
+    for (n = cb; n > 0; n >>= 8)
+        crc = (crc << 8) ^ table[(crc >> 24) ^ (n & 0xFF)];
+    return ~crc;
+}
+
+/**
+ * The block list the sync's server side prints for pData
+ */
+static size_t FormatSignature(const unsigned char *pData, size_t cbData, size_t cbBlock, char *out)
+{
+    unsigned char digest[HASH_SIZE];
+    char szHex[HASH_SIZE * 2 + 1];
+    size_t o, cb, n;
+    Sha256 h;
+
+    n = (size_t)sprintf(out, "#size %zu\n", cbData);
+    for (o = 0; o < cbData; o += cb)
+    {
+        cb = cbData - o < cbBlock ? cbData - o : cbBlock;
+        Sha256Init(&h);
+        Sha256Update(&h, pData + o, cb);
+        Sha256Final(&h, digest);
+        HashToHex(digest, szHex);
+        n += (size_t)sprintf(out + n, "%u %zu\n%s  -\n", PosixCksum(pData + o, cb), cb, szHex);
+    }
+    return n + (size_t)sprintf(out + n, "#end\n");
+}
+
+static int SetUp(void)
+{
+    size_t i, pos;
+    char *pSig;
+
+    /* A file on the server, and the local one with 100 bytes inserted */
+    g_pDeltaServer = malloc(PERF_DELTA_SIZE);
+    g_pDeltaLocal = malloc(PERF_DELTA_SIZE + 100);
+    if (!g_pDeltaServer || !g_pDeltaLocal)
+        return 0;
+    for (pos = 0, i = 12345; pos < PERF_DELTA_SIZE; pos++)
+    {
+        i = i * 1103515245 + 12345;
+        g_pDeltaServer[pos] = (unsigned char)(i >> 16);
+    }
+    memcpy(g_pDeltaLocal, g_pDeltaServer, PERF_DELTA_SIZE / 2);
+    memset(g_pDeltaLocal + PERF_DELTA_SIZE / 2, 'x', 100);
+    memcpy(g_pDeltaLocal + PERF_DELTA_SIZE / 2 + 100, g_pDeltaServer + PERF_DELTA_SIZE / 2, PERF_DELTA_SIZE / 2);
+
+    pSig = malloc(PERF_DELTA_SIZE / DELTA_MIN_BLOCK * 128 + 256);
+    DeltaSignatureInit(&g_deltaSig, DELTA_MIN_BLOCK);
+    if (!pSig || !DeltaSignatureFeed(&g_deltaSig, pSig, FormatSignature(g_pDeltaServer, PERF_DELTA_SIZE,
+        DELTA_MIN_BLOCK, pSig)) || !DeltaSignatureIndex(&g_deltaSig))
+    {
+        free(pSig);
+        return 0;
+    }
+    free(pSig);
+    return 1;
+}
+
+static void BenchDeltaScan(size_t nOps)
+{
+    DeltaMatches matches[4];
+    volatile unsigned long long cbDone;
+    DeltaPlan plan;
+    size_t i, n = 0;
+    int r;
+
+    for (i = 0; i < nOps; i++)
+    {
+        memset(matches, 0, sizeof(matches));
+        memset(&plan, 0, sizeof(plan));
+        for (r = 0; r < 4; r++)
+            DeltaScanRange(&g_deltaSig, g_pDeltaLocal, PERF_DELTA_SIZE + 100, DeltaRangeStart(&g_deltaSig,
+                PERF_DELTA_SIZE + 100, r, 4), DeltaRangeStart(&g_deltaSig, PERF_DELTA_SIZE + 100, r + 1, 4),
+                &matches[r], &cbDone, NULL);
+        DeltaBuildPlan(&g_deltaSig, g_pDeltaLocal, PERF_DELTA_SIZE + 100, matches, 4, &plan);
+        n += plan.nOps + (size_t)plan.cbLiteral;
+        DeltaPlanFree(&plan);
+        for (r = 0; r < 4; r++)
+            DeltaMatchesFree(&matches[r]);
+    }
+    g_sink += n;
+}
+
+/**
+ * Plan how to rebuild pData from the server copy s describes, scanning it
+ * as nRanges ranges like the sync does on its threads
+ */
+static int PlanDelta(const DeltaSignature *s, const unsigned char *pData, size_t cbData, int nRanges, DeltaPlan *pPlan)
+{
+    DeltaMatches matches[8];
+    volatile unsigned long long cbDone;
+    int r, bOk = 1;
+
+    memset(matches, 0, sizeof(matches));
+    memset(pPlan, 0, sizeof(*pPlan));
+    for (r = 0; r < nRanges; r++)
+        bOk &= DeltaScanRange(s, pData, cbData, DeltaRangeStart(s, cbData, r, nRanges),
+            DeltaRangeStart(s, cbData, r + 1, nRanges), &matches[r], &cbDone, NULL);
+    bOk = bOk && DeltaBuildPlan(s, pData, cbData, matches, nRanges, pPlan);
+    for (r = 0; r < nRanges; r++)
+        DeltaMatchesFree(&matches[r]);
+    return bOk;
+}
+
+/**
+ * The sync's input after the block list: "#apply", the operations, then
+ * the literal bytes in their order
+ */
+static size_t FormatApply(const DeltaPlan *pPlan, const unsigned char *pData, size_t cbData, char *out)
+{
+    unsigned char digest[HASH_SIZE];
+    char szHex[HASH_SIZE * 2 + 1];
+    size_t cb, k;
+    Sha256 h;
+
+    Sha256Init(&h);
+    Sha256Update(&h, pData, cbData);
+    Sha256Final(&h, digest);
+    HashToHex(digest, szHex);
+    cb = (size_t)sprintf(out, "#apply %s %zu\n", szHex, cbData);
+    for (k = 0; k < pPlan->nOps; k++)
+        cb += DeltaFormatOp(&pPlan->pOps[k], out + cb);
+    cb += (size_t)sprintf(out + cb, ".\n");
+    for (k = 0; k < pPlan->nOps; k++)
+    {
+        if (pPlan->pOps[k].nBlocks == 0)
+        {
+            memcpy(out + cb, pData + pPlan->pOps[k].offset, (size_t)pPlan->pOps[k].cb);
+            cb += (size_t)pPlan->pOps[k].cb;
+        }
+    }
+    return cb;
+}
+
+static int CheckDeltaScan(void)
+{
+    static DeltaSignature s;
+    size_t cbSig, cbLocal = PERF_DELTA_CHECK_SIZE + 100;
+    unsigned char *pLocal = malloc(cbLocal);
+    char *pSig = malloc(PERF_DELTA_CHECK_SIZE / DELTA_MIN_BLOCK * 128 + 256);
+    DeltaPlan plan;
+    int bOk;
+
+    if (!pLocal || !pSig)
+    {
+        free(pLocal);
+        free(pSig);
+        return Expect(0, "out of memory");
+    }
+
+    /* An unchanged file is the server copy, in any number of ranges */
+    cbSig = FormatSignature(g_pDeltaServer, PERF_DELTA_CHECK_SIZE, DELTA_MIN_BLOCK, pSig);
+    DeltaSignatureInit(&s, DELTA_MIN_BLOCK);
+    bOk = Expect(DeltaSignatureFeed(&s, pSig, cbSig) && s.bEnd && s.cbFile == PERF_DELTA_CHECK_SIZE &&
+        s.nBlocks == (PERF_DELTA_CHECK_SIZE + DELTA_MIN_BLOCK - 1) / DELTA_MIN_BLOCK && DeltaSignatureIndex(&s),
+        "block list");
+    bOk &= Expect(PlanDelta(&s, g_pDeltaServer, PERF_DELTA_CHECK_SIZE, 3, &plan) && plan.bSame, "unchanged file");
+    DeltaPlanFree(&plan);
+
+    /* 100 bytes inserted and one changed: the blocks are found again
+     * behind the insertion, and only two blocks' worth is sent */
+    memcpy(pLocal, g_pDeltaServer, 300000);
+    memset(pLocal + 300000, 'x', 100);
+    memcpy(pLocal + 300100, g_pDeltaServer + 300000, PERF_DELTA_CHECK_SIZE - 300000);
+    pLocal[650100] ^= 0xFF;
+    bOk &= Expect(PlanDelta(&s, pLocal, cbLocal, 3, &plan) && !plan.bSame &&
+        plan.cbLiteral <= 2 * DELTA_MIN_BLOCK + 100 && plan.cbLiteral + plan.cbCopied == cbLocal, "changed file");
+    DeltaPlanFree(&plan);
+    DeltaSignatureFree(&s);
+
+    free(pLocal);
+    free(pSig);
+    return bOk;
+}
+
+/**
+ * The sync script run for real on a scratch file: its block list has to
+ * match the one computed here, and the plan sent back has to rebuild
+ * the local file on the "server"
+ */
+static int CheckDeltaScript(void)
+{
+    static DeltaSignature s, local;
+    char szDir[256], szFile[PATH_MAX], szCmd[PATH_MAX + 4096], szOut[8192];
+    size_t cbOut, cbIn, cbLocal = PERF_DELTA_CHECK_SIZE + 100;
+    unsigned char *pLocal = malloc(cbLocal);
+    char *pIn = malloc(cbLocal + 65536);
+    char *pSig = malloc(PERF_DELTA_CHECK_SIZE / DELTA_MIN_BLOCK * 128 + 256);
+    DeltaPlan plan;
+    FILE *f;
+    int bOk, status;
+
+    if (!pLocal || !pIn || !pSig || !MakeScratch(szDir, sizeof(szDir)))
+    {
+        free(pLocal);
+        free(pIn);
+        free(pSig);
+        return Expect(0, "scratch file");
+    }
+    bOk = Expect(WriteScratchFile(szDir, "data.bin", (const char *)g_pDeltaServer, PERF_DELTA_CHECK_SIZE),
+        "scratch file");
+    snprintf(szFile, sizeof(szFile), "%s/data.bin", szDir);
+    RemoteBuildDeltaCommand(szFile, DELTA_MIN_BLOCK, szCmd, sizeof(szCmd));
+
+    /* Without "#apply" the server stops after the block list */
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    DeltaSignatureInit(&s, DELTA_MIN_BLOCK);
+    DeltaSignatureInit(&local, DELTA_MIN_BLOCK);
+    DeltaSignatureFeed(&local, pSig, FormatSignature(g_pDeltaServer, PERF_DELTA_CHECK_SIZE, DELTA_MIN_BLOCK, pSig));
+    bOk &= Expect(status == 0 && DeltaSignatureFeed(&s, szOut, cbOut) && s.bEnd && s.nSkipped == 0 &&
+        s.nBlocks == local.nBlocks && memcmp(s.pBlocks, local.pBlocks, s.nBlocks * sizeof(DeltaBlock)) == 0,
+        "cksum and sha256sum block list");
+    bOk &= Expect(DeltaSignatureIndex(&s), "block list index");
+
+    memcpy(pLocal, g_pDeltaServer, 300000);
+    memset(pLocal + 300000, 'x', 100);
+    memcpy(pLocal + 300100, g_pDeltaServer + 300000, PERF_DELTA_CHECK_SIZE - 300000);
+    pLocal[650100] ^= 0xFF;
+    bOk &= Expect(PlanDelta(&s, pLocal, cbLocal, 2, &plan), "plan");
+    cbIn = FormatApply(&plan, pLocal, cbLocal, pIn);
+    DeltaPlanFree(&plan);
+    DeltaSignatureFree(&s);
+    DeltaSignatureInit(&s, DELTA_MIN_BLOCK);
+
+    /* The block list again, then the rebuild */
+    status = RunScript(szCmd, pIn, cbIn, szOut, sizeof(szOut), &cbOut);
+    DeltaSignatureFeed(&s, szOut, cbOut);
+    bOk &= Expect(status == 0 && s.bOk && !s.bMismatch, "rebuilt on the server");
+    f = fopen(szFile, "rb");
+    bOk &= Expect(f && fread(pIn, 1, cbLocal + 1, f) == cbLocal && memcmp(pIn, pLocal, cbLocal) == 0,
+        "server file is the local file");
+    if (f)
+        fclose(f);
+    DeltaSignatureFree(&s);
+    DeltaSignatureFree(&local);
+
+    snprintf(szFile, sizeof(szFile), "%s/missing.bin", szDir);
+    RemoteBuildDeltaCommand(szFile, DELTA_MIN_BLOCK, szCmd, sizeof(szCmd));
+    RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    DeltaSignatureFeed(&s, szOut, cbOut);
+    bOk &= Expect(s.bNotFile, "not a file");
+    DeltaSignatureFree(&s);
+
+    RemoveScratch(szDir);
+    free(pLocal);
+    free(pIn);
+    free(pSig);
+    return bOk;
+}
+
+static int CheckDelta(void)
+{
+    return CheckDeltaScan() & CheckDeltaScript();
+}
+
+static const MicroBench g_benches[] = {
+    {"delta-scan-4m",        BenchDeltaScan,     CheckDelta,         10,     100000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
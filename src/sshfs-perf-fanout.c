@@ -0,0 +1,199 @@
+/**
+ * sshfs-perf-fanout.c
+ *
+ * Test of sshfs-fanout.c: the broadcast ring that feeds one console's
+ * input to every session, and the schedule that starts the sessions a few
+ * at a time. Checked with a session that stops reading and with slow and
+ * failing starts, then timed on a 1 MB paste into 100 sessions and on
+ * starting 1000.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-fanout sshfs-perf-fanout.c sshfs-perf.c sshfs-fanout.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-fanout.h"
+
+#include <string.h>
+
+static char *g_pPaste;
+
+static int SetUp(void)
+{
+    g_pPaste = MakePaste(PERF_PASTE_SIZE);
+    return g_pPaste != NULL;
+}
+
+/**
+ * A 1 MB paste into 100 sessions, 4 KB at a time as the console reader
+ * takes it, each session writing what it can after every push
+ */
+static void BenchFanoutPaste(size_t nOps)
+{
+    static Fanout f;
+    const unsigned char *p;
+    size_t i, k, pos, cb, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        if (!FanoutInit(&f, 100, FANOUT_RING_SIZE / 4))
+            return;
+        for (pos = 0; pos < PERF_PASTE_SIZE; pos += 4096)
+        {
+            if (FanoutRoom(&f, 0) < 4096)
+                break;
+            FanoutPush(&f, g_pPaste + pos, 4096, 0);
+            for (k = 0; k < f.nSinks; k++)
+            {
+                while ((cb = FanoutPeek(&f, k, &p)) > 0)
+                {
+                    n += p[0];
+                    FanoutConsume(&f, k, cb, 0);
+                }
+            }
+        }
+        n += f.nDropped;
+        FanoutFree(&f);
+    }
+    g_sink += n;
+}
+
+static void BenchFanoutSchedule(size_t nOps)
+{
+    static FanoutSchedule s;
+    unsigned long long ms;
+    size_t i, n = 0;
+    long j;
+
+    for (i = 0; i < nOps; i++)
+    {
+        if (!FanoutScheduleInit(&s, 1000, FANOUT_MAX_STARTING, FANOUT_START_TIMEOUT_MS))
+            return;
+        for (ms = 0; !FanoutScheduleStarted(&s); ms += 100)
+        {
+            while ((j = FanoutScheduleNext(&s, ms)) >= 0)
+            {
+                /* Every third session is slow to answer */
+                if (j % 3)
+                    FanoutScheduleDone(&s, (size_t)j, j % 7 != 0);
+                n++;
+            }
+            n += FanoutScheduleWait(&s, ms) & 1;
+        }
+        FanoutScheduleFree(&s);
+    }
+    g_sink += n;
+}
+
+/* What sink k has pending, all of it (across the ring's end) */
+static size_t TakeFanout(Fanout *f, size_t k, char *out, unsigned long long nowMs)
+{
+    const unsigned char *p;
+    size_t cb, cbOut = 0;
+
+    while ((cb = FanoutPeek(f, k, &p)) > 0)
+    {
+        memcpy(out + cbOut, p, cb);
+        cbOut += cb;
+        FanoutConsume(f, k, cb, nowMs);
+    }
+    out[cbOut] = '\0';
+    return cbOut;
+}
+
+static int CheckFanoutRing(void)
+{
+    const unsigned char *p;
+    char sz[64];
+    Fanout f;
+    int bOk;
+
+    if (!FanoutInit(&f, 3, 16))
+        return Expect(0, "out of memory");
+
+    /* Each session reads on its own; room is what the slowest left */
+    FanoutPush(&f, "hello", 5, 0);
+    bOk = Expect(TakeFanout(&f, 0, sz, 10) == 5 && strcmp(sz, "hello") == 0 && FanoutRoom(&f, 10) == 11,
+        "one stream, own positions");
+    TakeFanout(&f, 1, sz, 10);
+    TakeFanout(&f, 2, sz, 10);
+    bOk &= Expect(FanoutRoom(&f, 10) == 16 && TakeFanout(&f, 0, sz, 10) == 0, "all caught up");
+
+    /* Across the ring's end */
+    FanoutPush(&f, "0123456789", 10, 20);
+    FanoutPush(&f, "abcdef", 6, 20);
+    bOk &= Expect(TakeFanout(&f, 0, sz, 20) == 16 && strcmp(sz, "0123456789abcdef") == 0 &&
+        FanoutRoom(&f, 20) == 0, "wrapped stream");
+
+    /* A push that would overrun a session drops it, not the others */
+    TakeFanout(&f, 1, sz, 20);
+    bOk &= Expect(FanoutPush(&f, "!", 1, 30) == 1 && f.nDropped == 1 && FanoutPeek(&f, 2, &p) == 0,
+        "overrun session dropped");
+    bOk &= Expect(TakeFanout(&f, 1, sz, 30) == 1 && TakeFanout(&f, 0, sz, 30) == 1 && strcmp(sz, "!") == 0,
+        "others carry on");
+
+    /* Far behind and idle for FANOUT_STALL_MS: dropped by FanoutRoom */
+    FanoutPush(&f, "0123456789", 10, 1000);
+    TakeFanout(&f, 0, sz, 1000);
+    bOk &= Expect(FanoutRoom(&f, 1000 + FANOUT_STALL_MS - 1) == 6 && f.nDropped == 1, "not stalled yet");
+    bOk &= Expect(FanoutRoom(&f, 1000 + FANOUT_STALL_MS) == 16 && f.nDropped == 2, "stalled session dropped");
+    FanoutDrop(&f, 1);
+    FanoutDrop(&f, 0);
+    bOk &= Expect(f.nDropped == 3, "drop counted once");
+    FanoutFree(&f);
+
+    /* A paste larger than the ring keeps its end */
+    if (!FanoutInit(&f, 1, 16))
+        return Expect(0, "out of memory");
+    FanoutPush(&f, "0123456789abcdefghij", 20, 0);
+    bOk &= Expect(f.nDropped == 1, "huge push");
+    FanoutFree(&f);
+    return bOk;
+}
+
+static int CheckFanoutSchedule(void)
+{
+    FanoutSchedule s;
+    long got[FANOUT_MAX_STARTING + 1];
+    int bOk = 1, i;
+
+    if (!FanoutScheduleInit(&s, 20, FANOUT_MAX_STARTING, FANOUT_START_TIMEOUT_MS))
+        return Expect(0, "out of memory");
+
+    /* A few at a time */
+    for (i = 0; i <= FANOUT_MAX_STARTING; i++)
+        got[i] = FanoutScheduleNext(&s, 0);
+    for (i = 0; i < FANOUT_MAX_STARTING; i++)
+        bOk &= Expect(got[i] == i, "sessions started in order");
+    bOk &= Expect(got[FANOUT_MAX_STARTING] == -1 && FanoutScheduleWait(&s, 1000) == FANOUT_START_TIMEOUT_MS - 1000,
+        "limit reached, waiting on the first timeout");
+
+    /* A ready session makes room, a failed one too */
+    FanoutScheduleDone(&s, 3, 1);
+    FanoutScheduleDone(&s, 5, 0);
+    bOk &= Expect(FanoutScheduleNext(&s, 2000) == 8 && FanoutScheduleNext(&s, 2000) == 9 &&
+        FanoutScheduleNext(&s, 2000) == -1 && s.pStates[3] == FANOUT_READY && s.pStates[5] == FANOUT_FAILED,
+        "done sessions make room");
+
+    /* A slow start stops counting, but can still report */
+    bOk &= Expect(FanoutScheduleWait(&s, FANOUT_START_TIMEOUT_MS) == 0 &&
+        FanoutScheduleNext(&s, FANOUT_START_TIMEOUT_MS) == 10 && FanoutScheduleNext(&s, FANOUT_START_TIMEOUT_MS) == 11,
+        "timed out starts give their place");
+    FanoutScheduleDone(&s, 0, 1);
+    bOk &= Expect(s.pStates[0] == FANOUT_READY && s.nStarting == FANOUT_MAX_STARTING, "late ready");
+
+    for (i = 0; i < 20 && !FanoutScheduleStarted(&s); i++)
+        FanoutScheduleNext(&s, 60000);
+    bOk &= Expect(FanoutScheduleStarted(&s) && FanoutScheduleWait(&s, 60000) == ~0UL, "all started");
+    FanoutScheduleFree(&s);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"fanout-paste-1m-100",  BenchFanoutPaste,   CheckFanoutRing,    5,      100000000},
+    {"fanout-schedule-1000", BenchFanoutSchedule,CheckFanoutSchedule,50,    20000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
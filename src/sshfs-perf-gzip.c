@@ -0,0 +1,123 @@
+/**
+ * sshfs-perf-gzip.c
+ *
+ * Test of sshfs-gzip.c: the deflate compressor of session recordings.
+ * Members of empty, tiny, repetitive, random and terminal data are checked
+ * by inflating them with gzip -d, one by one and appended to each other,
+ * then compressing 64 KB of terminal output is timed.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-gzip sshfs-perf-gzip.c sshfs-perf.c sshfs-gzip.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-gzip.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PERF_NOISE_SIZE     100000
+
+static char *g_pOutput;
+static unsigned char *g_pNoise;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    g_pOutput = MakeTerminalOutput(PERF_OUTPUT_SIZE);
+    g_pNoise = malloc(PERF_NOISE_SIZE);
+    if (!g_pOutput || !g_pNoise)
+        return 0;
+    /* Bytes that do not compress */
+    for (pos = 0, i = 12345; pos < PERF_NOISE_SIZE; pos++)
+    {
+        i = i * 1103515245 + 12345;
+        g_pNoise[pos] = (unsigned char)(i >> 16);
+    }
+    return 1;
+}
+
+static void BenchGzip(size_t nOps)
+{
+    static GzipCompressor z;
+    static unsigned char out[GZIP_BOUND(PERF_OUTPUT_SIZE)];
+    size_t i, n = 0;
+
+    if (!GzipInit(&z))
+        return;
+    for (i = 0; i < nOps; i++)
+        n += GzipMember(&z, g_pOutput, PERF_OUTPUT_SIZE, out, sizeof(out));
+    GzipFree(&z);
+    g_sink += n;
+}
+
+/**
+ * Members from GzipMember() have to inflate with gzip, one by one and
+ * appended to each other as a recording's batches are
+ */
+static int CheckGzip(void)
+{
+    static GzipCompressor z;
+    static char szOut[512 * 1024];
+    static MemBuffer all, plain;
+    const char *apData[5];
+    size_t acb[5], cbOut, cbMember, i;
+    unsigned char *pMember = malloc(GZIP_BOUND(256 * 1024));
+    char *pRepeat = malloc(200000);
+    char szDir[256];
+    int bOk = 1;
+
+    if (!pMember || !pRepeat || !GzipInit(&z) || !MakeScratch(szDir, sizeof(szDir)))
+    {
+        free(pMember);
+        free(pRepeat);
+        return Expect(0, "scratch folder");
+    }
+    for (i = 0; i < 200000; i++)
+        pRepeat[i] = "\x1b[0m$ ls -l\r\n"[i % 13];
+    apData[0] = "";
+    acb[0] = 0;
+    apData[1] = "a";
+    acb[1] = 1;
+    apData[2] = g_pOutput;
+    acb[2] = PERF_OUTPUT_SIZE;
+    apData[3] = pRepeat;
+    acb[3] = 200000;
+    apData[4] = (const char *)g_pNoise;
+    acb[4] = 100000;
+
+    all.cb = plain.cb = 0;
+    for (i = 0; i < 5; i++)
+    {
+        cbMember = GzipMember(&z, apData[i], acb[i], pMember, GZIP_BOUND(acb[i]));
+        bOk &= Expect(cbMember > 0 && cbMember <= GZIP_BOUND(acb[i]) && AppendMem(pMember, cbMember, &all) &&
+            AppendMem(apData[i], acb[i], &plain), "member within its bound");
+        if (i == 2)
+        {
+            bOk &= Expect(cbMember < acb[i] / 2, "terminal output compressed");
+            bOk &= Expect(WriteScratchFile(szDir, "one.gz", (const char *)pMember, cbMember) &&
+                Gunzip(szDir, "one.gz", szOut, sizeof(szOut), &cbOut) == 0 && cbOut == acb[i] &&
+                memcmp(szOut, apData[i], cbOut) == 0, "gzip -d reads a member");
+        }
+        if (i == 3)
+            bOk &= Expect(cbMember < acb[i] / 50, "long matches");
+    }
+    bOk &= Expect(WriteScratchFile(szDir, "all.gz", all.p, all.cb) &&
+        Gunzip(szDir, "all.gz", szOut, sizeof(szOut), &cbOut) == 0 && cbOut == plain.cb &&
+        memcmp(szOut, plain.p, cbOut) == 0, "gzip -d reads appended members as one stream");
+
+    RemoveScratch(szDir);
+    GzipFree(&z);
+    free(pMember);
+    free(pRepeat);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"gzip-64k",             BenchGzip,          CheckGzip,          200,    5000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
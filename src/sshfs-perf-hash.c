@@ -0,0 +1,211 @@
+/**
+ * sshfs-perf-hash.c
+ *
+ * Test of sshfs-hash.c: SHA-256, the sha256sum output parser and the split
+ * of files over hash channels. SHA-256 is checked against the standard
+ * test vectors, and the hash script is run with /bin/sh on a scratch
+ * folder and its output checked against the local hashes. Then timed on
+ * 1 MB, 10000 files and 64 KB of sha256sum output.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-hash sshfs-perf-hash.c sshfs-perf.c sshfs-hash.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-hash.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static char *g_pPaste;
+static char *g_pHashOut;
+static size_t g_cbHashOut;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    g_pPaste = MakePaste(PERF_PASTE_SIZE);
+    if (!g_pPaste)
+        return 0;
+
+    /* sha256sum over a tree, one name in sixteen escaped */
+    g_pHashOut = malloc(PERF_OUTPUT_SIZE);
+    if (!g_pHashOut)
+        return 0;
+    for (pos = 0, i = 0; pos + 256 < PERF_OUTPUT_SIZE; i++)
+        pos += (size_t)sprintf(g_pHashOut + pos, i % 16 ? "%064zx  ./src/module-%zu/file-%zu.c\n" :
+            "\\%064zx  ./src/module-%zu/back\\\\slash-%zu.c\n", i * 2654435761u, i / 32, i);
+    g_cbHashOut = pos;
+    return 1;
+}
+
+static void BenchSha256(size_t nOps)
+{
+    unsigned char digest[HASH_SIZE];
+    Sha256 h;
+    size_t i;
+
+    /* The local side of "Compare with local folder": 1 MB per op */
+    for (i = 0; i < nOps; i++)
+    {
+        Sha256Init(&h);
+        Sha256Update(&h, g_pPaste, PERF_PASTE_SIZE);
+        Sha256Final(&h, digest);
+        g_sink += digest[i % HASH_SIZE];
+    }
+}
+
+static void BenchHashSchedule(size_t nOps)
+{
+    static unsigned long long sizes[10000];
+    static int channels[10000];
+    unsigned long long load[HASH_MAX_CHANNELS];
+    size_t i, n = 0;
+
+    /* A photo library: sizes spread over three orders of magnitude */
+    for (i = 0; i < 10000; i++)
+        sizes[i] = 100000 + (i * 7919 % 10007) * (i % 3 == 0 ? 1000 : 10);
+    for (i = 0; i < nOps; i++)
+        n += (size_t)HashSchedule(sizes, 10000, HASH_MAX_CHANNELS, channels, load) + (size_t)channels[i % 10000];
+    g_sink += n;
+}
+
+static void BenchHashParse(size_t nOps)
+{
+    unsigned char digest[HASH_SIZE];
+    char szName[256];
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        const char *p = g_pHashOut, *end = g_pHashOut + g_cbHashOut, *eol;
+
+        for (; p < end && (eol = memchr(p, '\n', (size_t)(end - p))) != NULL; p = eol + 1)
+            n += (size_t)HashParseLine(p, (size_t)(eol - p), digest, szName, sizeof(szName));
+    }
+    g_sink += n;
+}
+
+static void Sha256Hex(const void *data, size_t len, char *pszHex)
+{
+    unsigned char digest[HASH_SIZE];
+    Sha256 h;
+
+    Sha256Init(&h);
+    Sha256Update(&h, data, len);
+    Sha256Final(&h, digest);
+    HashToHex(digest, pszHex);
+}
+
+static int CheckSha256(void)
+{
+    char szHex[HASH_HEX_LEN + 1], szHex2[HASH_HEX_LEN + 1], block[1000];
+    unsigned char digest[HASH_SIZE];
+    Sha256 h;
+    size_t i, n;
+    int bOk;
+
+    /* FIPS 180-2 vectors, and a long input fed in uneven pieces */
+    Sha256Hex("", 0, szHex);
+    bOk = Expect(strcmp(szHex, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855") == 0, "empty");
+    Sha256Hex("abc", 3, szHex);
+    bOk &= Expect(strcmp(szHex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0, "abc");
+    Sha256Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, szHex);
+    bOk &= Expect(strcmp(szHex, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1") == 0, "two blocks");
+    memset(block, 'a', sizeof(block));
+    Sha256Init(&h);
+    for (i = 0; i < 1000000; i += n)
+    {
+        n = 1 + i % 997;
+        if (n > 1000000 - i)
+            n = 1000000 - i;
+        Sha256Update(&h, block, n);
+    }
+    Sha256Final(&h, digest);
+    HashToHex(digest, szHex2);
+    bOk &= Expect(strcmp(szHex2, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0") == 0, "a million a's");
+    return bOk;
+}
+
+static int CheckHashSchedule(void)
+{
+    static const unsigned long long sizes[] = {70, 10, 60, 50, 20, 40, 30, 0};
+    int channels[8];
+    unsigned long long load[3];
+    int bOk;
+
+    bOk = Expect(HashChannelCount(1000, 10 * HASH_CHANNEL_MIN_BYTES) == HASH_MAX_CHANNELS &&
+        HashChannelCount(2, 10 * HASH_CHANNEL_MIN_BYTES) == 2 && HashChannelCount(1000, 1000) == 1, "channel count");
+
+    /* Largest first onto the least loaded: the three largest files start the three channels */
+    bOk &= Expect(HashSchedule(sizes, 8, 3, channels, load), "schedule");
+    bOk &= Expect(load[0] + load[1] + load[2] == 288 && channels[0] != channels[2] && channels[0] != channels[3] &&
+        load[0] <= 128 && load[1] <= 128 && load[2] <= 128, "loads within 4/3 of an even split");
+    return bOk;
+}
+
+/**
+ * The hash script runs sha256sum over a NUL separated list in a scratch
+ * folder; every line it prints must parse and match the local SHA-256
+ */
+static int CheckHashScript(void)
+{
+    static const char szList[] = "./a.txt\0./sub/back\\slash\0./sub/new\nline\0./missing\0";
+    static const char szEscaped[] = "\\ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad  ./a\\\\b\\nc";
+    static const char *const ppszNames[] = {"a.txt", "sub/back\\slash", "sub/new\nline"};
+    char szDir[256], szOut[4096], szCmd[PATH_MAX + 256], szSub[PATH_MAX];
+    char szName[256], szHex[HASH_HEX_LEN + 1], szLocal[HASH_HEX_LEN + 1];
+    unsigned char digest[HASH_SIZE];
+    size_t i, cbOut, nMatched = 0;
+    char *pLine, *pEnd;
+    int bOk, status;
+
+    bOk = Expect(HashParseLine(szEscaped, sizeof(szEscaped) - 1, digest, szName, sizeof(szName)) &&
+        strcmp(szName, "./a\\b\nc") == 0 && digest[0] == 0xba, "escaped line");
+    bOk &= Expect(!HashParseLine("sha256sum: ./x: No such file or directory", 41, digest, szName, sizeof(szName)),
+        "error line");
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szSub, sizeof(szSub), "%s/sub", szDir);
+    mkdir(szSub, 0755);
+    for (i = 0; i < 3; i++)
+        bOk &= Expect(WriteScratchFile(szDir, ppszNames[i], g_pPaste + i * 1000, 5000 + i * 70000), "scratch files");
+
+    RemoteBuildHashCommand(szDir, szCmd, sizeof(szCmd));
+    status = RunScript(szCmd, szList, sizeof(szList) - 1, szOut, sizeof(szOut), &cbOut);
+    bOk &= Expect(status != 0, "missing file reported in the exit status");
+
+    for (pLine = szOut; (pEnd = strchr(pLine, '\n')) != NULL; pLine = pEnd + 1)
+    {
+        if (!HashParseLine(pLine, (size_t)(pEnd - pLine), digest, szName, sizeof(szName)))
+            continue;
+        HashToHex(digest, szHex);
+        for (i = 0; i < 3; i++)
+        {
+            if (strncmp(szName, "./", 2) == 0 && strcmp(szName + 2, ppszNames[i]) == 0)
+            {
+                Sha256Hex(g_pPaste + i * 1000, 5000 + i * 70000, szLocal);
+                nMatched += strcmp(szHex, szLocal) == 0;
+            }
+        }
+    }
+    bOk &= Expect(nMatched == 3, "server hashes match the local ones");
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"sha256-1m",            BenchSha256,        CheckSha256,        30,     20000000},
+    {"hash-schedule-10000",  BenchHashSchedule,  CheckHashSchedule,  200,    5000000},
+    {"hash-parse-64k",       BenchHashParse,     CheckHashScript,    2000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
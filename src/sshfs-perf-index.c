@@ -0,0 +1,264 @@
+/**
+ * sshfs-perf-index.c
+ *
+ * Test of sshfs-index.c: the snapshot tree index. Checked by snapshotting
+ * a scratch folder with the snapshot command under /bin/sh, changing it
+ * and merging the delta listing, which has to match a full rebuild. Then
+ * timed building and searching a 50000-entry index.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-index sshfs-perf-index.c sshfs-perf.c sshfs-index.c sshfs-search.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-index.h"
+#include "sshfs-search.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define PERF_INDEX_FILES    50000
+
+static char *g_pPaste;
+static char *g_pListing;
+static size_t g_cbListing;
+static Index g_index;
+
+static int SetUp(void)
+{
+    IndexBuilder *b;
+    static MemBuffer mb;
+    const char *p, *pszPath;
+    unsigned long long size;
+    long long mtime;
+    size_t i, pos;
+    char type;
+
+    g_pPaste = MakePaste(PERF_PASTE_SIZE);
+    if (!g_pPaste)
+        return 0;
+
+    /* A snapshot listing of a source tree, and its index */
+    g_pListing = malloc((size_t)PERF_INDEX_FILES * 64 + 4096);
+    if (!g_pListing)
+        return 0;
+    pos = (size_t)sprintf(g_pListing, "d\t4096\t1700000000.0000000000\tsrc") + 1;
+    for (i = 0; i < PERF_INDEX_FILES; i++)
+    {
+        if (i % 100 == 0)
+            pos += (size_t)sprintf(g_pListing + pos, "d\t4096\t1700000000.0000000000\tsrc/module-%zu", i / 100) + 1;
+        pos += (size_t)sprintf(g_pListing + pos, "f\t%zu\t%zu.5000000000\tsrc/module-%zu/file-%zu.c",
+            i * 37 % 100000, 1600000000 + i, i / 100, i % 100) + 1;
+    }
+    g_cbListing = pos;
+
+    b = IndexBuilderCreate();
+    for (p = g_pListing; b && p < g_pListing + g_cbListing; p += strlen(p) + 1)
+        if (IndexParseRecord(p, &type, &size, &mtime, &pszPath))
+            IndexBuilderAdd(b, pszPath, type, size, mtime);
+    if (!b || !IndexBuilderWrite(b, 1700000000, AppendMem, &mb) || !IndexOpen(&g_index, mb.p, mb.cb))
+        return 0;
+    IndexBuilderFree(b);
+    return 1;
+}
+
+static void BenchIndexBuild(size_t nOps)
+{
+    size_t i, n = 0;
+
+    /* A snapshot listing parsed, sorted and written, as "Snapshot tree" does */
+    for (i = 0; i < nOps; i++)
+    {
+        IndexBuilder *b = IndexBuilderCreate();
+        MemBuffer mb = {NULL, 0, 0};
+        const char *p = g_pListing, *end = g_pListing + g_cbListing, *pszPath;
+        unsigned long long size;
+        long long mtime;
+        char type;
+
+        for (; b && p < end; p += strlen(p) + 1)
+            if (IndexParseRecord(p, &type, &size, &mtime, &pszPath))
+                IndexBuilderAdd(b, pszPath, type, size, mtime);
+        if (b && IndexBuilderWrite(b, 1700000000, AppendMem, &mb))
+            n += mb.cb;
+        IndexBuilderFree(b);
+        free(mb.p);
+    }
+    g_sink += n;
+}
+
+static void BenchIndexFind(size_t nOps)
+{
+    char szPath[128];
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        snprintf(szPath, sizeof(szPath), "src/module-%zu/file-%zu.c", (i * 7) % 500, (i * 13) % 100);
+        n += IndexFind(&g_index, szPath) != (size_t)-1;
+    }
+    g_sink += n;
+}
+
+typedef struct SnapshotCheck {
+    IndexBuilder *pEntries;
+    IndexBuilder *pListed;
+    long long snapshotTime;
+    char szChanges[512];            /* "+path|" added, "*path|" changed, "-path|" removed */
+    size_t cbChanges;
+} SnapshotCheck;
+
+/* The same dispatch as the snapshot verb: records come through the search parser */
+static void TakeSnapshotRecord(const SearchResult *r, void *pContext)
+{
+    SnapshotCheck *sc = pContext;
+    const char *pszPath;
+    unsigned long long size;
+    long long mtime;
+    char type;
+
+    if (strncmp(r->pszPath, "#time ", 6) == 0)
+        sc->snapshotTime = atoll(r->pszPath + 6);
+    else if (strncmp(r->pszPath, "#list ", 6) == 0)
+        IndexBuilderAdd(sc->pListed, strncmp(r->pszPath + 6, "./", 2) == 0 ? r->pszPath + 8 : r->pszPath + 6, 'd', 0, 0);
+    else if (IndexParseRecord(r->pszPath, &type, &size, &mtime, &pszPath))
+        IndexBuilderAdd(sc->pEntries, pszPath, type, size, mtime);
+}
+
+static void TakeSnapshotChange(IndexChange change, const char *pszPath, void *pContext)
+{
+    SnapshotCheck *sc = pContext;
+    int cch = snprintf(sc->szChanges + sc->cbChanges, sizeof(sc->szChanges) - sc->cbChanges, "%c%s|",
+        "+*-"[change], pszPath);
+
+    if (cch > 0 && (size_t)cch < sizeof(sc->szChanges) - sc->cbChanges)
+        sc->cbChanges += (size_t)cch;
+}
+
+static int RunSnapshot(const char *pszDir, long long since, SnapshotCheck *sc)
+{
+    static char szOut[16384];
+    char szCmd[PATH_MAX + 1024];
+    SearchParser parser;
+    size_t cbOut;
+    int status;
+
+    sc->pEntries = IndexBuilderCreate();
+    sc->pListed = IndexBuilderCreate();
+    sc->snapshotTime = -1;
+    RemoteBuildSnapshotCommand(pszDir, since, szCmd, sizeof(szCmd));
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    if (!sc->pEntries || !sc->pListed || !SearchParserInit(&parser, 0))
+        return -1;
+    SearchParserFeed(&parser, szOut, cbOut, TakeSnapshotRecord, sc);
+    SearchParserFree(&parser);
+    return status;
+}
+
+static void AgeScratchEntry(const char *pszDir, const char *pszName)
+{
+    char szPath[PATH_MAX];
+    struct timeval tv[2] = {{1500000000, 0}, {1500000000, 0}};
+
+    snprintf(szPath, sizeof(szPath), "%s/%s", pszDir, pszName);
+    utimes(szPath, tv);
+}
+
+/**
+ * Snapshot a scratch folder with the real listing script, query the
+ * index, then change the folder and merge a delta listing into it
+ */
+static int CheckIndexSnapshot(void)
+{
+    static const char *const ppszAged[] = {"a/x.txt", "a/b/y.bin", "a/b", "top.md", "a", "."};
+    char szDir[256], szPath[PATH_MAX];
+    MemBuffer mb = {NULL, 0, 0}, mbMerged = {NULL, 0, 0};
+    SnapshotCheck sc, delta;
+    IndexBuilder *pMerged = NULL;
+    IndexCursor cursor;
+    Index ix, ixMerged;
+    size_t i, largest[2];
+    int bOk;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szPath, sizeof(szPath), "%s/a", szDir);
+    mkdir(szPath, 0755);
+    snprintf(szPath, sizeof(szPath), "%s/a/b", szDir);
+    mkdir(szPath, 0755);
+    bOk = Expect(WriteScratchFile(szDir, "a/x.txt", g_pPaste, 100) && WriteScratchFile(szDir, "a/b/y.bin", g_pPaste, 2000) &&
+        WriteScratchFile(szDir, "top.md", g_pPaste, 10), "scratch files");
+    for (i = 0; i < sizeof(ppszAged) / sizeof(ppszAged[0]); i++)
+        AgeScratchEntry(szDir, ppszAged[i]);
+
+    memset(&sc, 0, sizeof(sc));
+    bOk &= Expect(RunSnapshot(szDir, -1, &sc) == 0 && sc.snapshotTime > 0 && IndexBuilderCount(sc.pEntries) == 5,
+        "full listing");
+    bOk &= Expect(IndexBuilderWrite(sc.pEntries, sc.snapshotTime, AppendMem, &mb) && IndexOpen(&ix, mb.p, mb.cb),
+        "index written and opened");
+    if (!bOk)
+        goto cleanup;
+
+    /* Tree order, folder totals and the queries */
+    IndexCursorSeek(&cursor, &ix, 0);
+    bOk &= Expect(IndexCursorNext(&cursor) && strcmp(cursor.szPath, "a") == 0 && IndexCursorNext(&cursor) &&
+        strcmp(cursor.szPath, "a/b") == 0, "tree order");
+    i = IndexFind(&ix, "a");
+    bOk &= Expect(i != (size_t)-1 && ix.pEntries[i].type == 'd' && ix.pEntries[i].size == 2100 &&
+        ix.pEntries[i].nBelow == 3 && ix.pEntries[i].mtime == 1500000000, "folder total");
+    bOk &= Expect(IndexLargest(&ix, 'f', largest, 2) == 2 && largest[0] == IndexFind(&ix, "a/b/y.bin") &&
+        IndexFind(&ix, "a/x") == (size_t)-1 && IndexNameMatches("a/b/y.bin", "*.BIN") &&
+        IndexNameMatches("a/b/y.bin", "Y.b") && !IndexNameMatches("a/b/y.bin", "x"), "queries");
+
+    /* One file removed, one added: only folder a is listed again */
+    snprintf(szPath, sizeof(szPath), "%s/a/x.txt", szDir);
+    remove(szPath);
+    bOk &= Expect(WriteScratchFile(szDir, "a/new.txt", g_pPaste, 300), "scratch change");
+    memset(&delta, 0, sizeof(delta));
+    pMerged = IndexBuilderCreate();
+    bOk &= Expect(pMerged && RunSnapshot(szDir, sc.snapshotTime, &delta) == 0 &&
+        IndexBuildDelta(&ix, delta.pEntries, delta.pListed, pMerged, TakeSnapshotChange, &delta), "delta listing");
+    bOk &= Expect(strstr(delta.szChanges, "+a/new.txt|") && strstr(delta.szChanges, "-a/x.txt|") &&
+        delta.cbChanges == strlen("+a/new.txt|-a/x.txt|"), "changes found");
+    bOk &= Expect(IndexBuilderWrite(pMerged, delta.snapshotTime, AppendMem, &mbMerged) &&
+        IndexOpen(&ixMerged, mbMerged.p, mbMerged.cb) && IndexFind(&ixMerged, "a/x.txt") == (size_t)-1 &&
+        IndexFind(&ixMerged, "a/b/y.bin") != (size_t)-1 && ixMerged.pEntries[IndexFind(&ixMerged, "a")].size == 2300,
+        "merged index");
+
+    IndexBuilderFree(delta.pEntries);
+    IndexBuilderFree(delta.pListed);
+cleanup:
+    IndexBuilderFree(pMerged);
+    IndexBuilderFree(sc.pEntries);
+    IndexBuilderFree(sc.pListed);
+    free(mb.p);
+    free(mbMerged.p);
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static int CheckIndexFind(void)
+{
+    size_t i = IndexFind(&g_index, "src/module-7/file-42.c");
+    IndexCursor cursor;
+
+    IndexCursorSeek(&cursor, &g_index, i);
+    return Expect(g_index.nEntries == PERF_INDEX_FILES + PERF_INDEX_FILES / 100 + 1, "entries in the large index") &
+        Expect(i != (size_t)-1 && IndexCursorNext(&cursor) && strcmp(cursor.szPath, "src/module-7/file-42.c") == 0,
+            "find in the large index") &
+        Expect(IndexFind(&g_index, "src/module-7/file-420.c") == (size_t)-1, "no such entry");
+}
+
+static const MicroBench g_benches[] = {
+    {"index-build-50000",    BenchIndexBuild,    CheckIndexSnapshot, 10,     200000000},
+    {"index-find",           BenchIndexFind,     CheckIndexFind,     400000, 20000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
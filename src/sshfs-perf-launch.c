@@ -0,0 +1,224 @@
+/**
+ * sshfs-perf-launch.c
+ *
+ * Launch benchmark: sshfs-ssh-launcher run end to end on a pty against a
+ * stand-in ssh (sshfs-perf-ssh.c), from start to the password answered and
+ * the shell up, and to a burst of output relayed. Reports the median and
+ * 95th percentile of --runs launches in milliseconds.
+ *
+ * Usage: sshfs-perf-launch [--quick] [--check] [--runs <n>] [--output-kb <n>] <launcher> <ssh_dir>
+ *
+ * ssh_dir holds the stand-in as "ssh" and is put first in the launcher's
+ * PATH. With --check the exit status is 1 if a launch failed or a result
+ * is over its limit. --quick runs at most 5 launches.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-launch sshfs-perf-launch.c sshfs-perf.c sshfs-relay.c -lutil
+ */
+
+#define _GNU_SOURCE
+
+#include "sshfs-perf.h"
+#include "sshfs-relay.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PERF_MAX_RUNS       1000
+#define PERF_LAUNCH_TIMEOUT 10000           /* ms for one launch */
+#define PERF_PASSWORD       "perf"
+
+#define LAUNCH_READY_LIMIT_MS   500.0
+#define LAUNCH_DONE_LIMIT_MS    3000.0
+
+typedef struct LaunchTimes {
+    double msReady;     /* Start to "#sshfs-perf ready": prompt found, password sent, shell up */
+    double msDone;      /* Start to "#sshfs-perf done": the output relayed */
+    double msExit;      /* Start to the launcher exiting */
+} LaunchTimes;
+
+/**
+ * Run the launcher once on a new pty against the stand-in ssh in pszSshDir.
+ * Returns 0 with a message on stderr if it failed or timed out.
+ */
+static int LaunchOnce(const char *pszLauncher, const char *pszSshDir, int kbOutput, LaunchTimes *t)
+{
+    struct winsize ws = {24, 80, 0, 0};
+    PromptMatcher pmReady, pmDone;
+    unsigned long long start;
+    char buffer[16384];
+    int passFds[2];
+    int fd, status;
+    int bReady = 0, bDone = 0;
+    pid_t pid;
+
+    if (pipe(passFds) != 0)
+        return 0;
+    if (write(passFds[1], PERF_PASSWORD, strlen(PERF_PASSWORD)) < 0)
+    {
+        close(passFds[0]);
+        close(passFds[1]);
+        return 0;
+    }
+    close(passFds[1]);
+
+    PromptMatcherInit(&pmReady, "#sshfs-perf ready");
+    PromptMatcherInit(&pmDone, "#sshfs-perf done");
+
+    start = NowNs();
+    pid = forkpty(&fd, NULL, NULL, &ws);
+    if (pid < 0)
+    {
+        fprintf(stderr, "forkpty failed: %s\n", strerror(errno));
+        close(passFds[0]);
+        return 0;
+    }
+    if (pid == 0)
+    {
+        char szPath[8192];
+        char szFd[16];
+        char szKb[16];
+        const char *pszPath = getenv("PATH");
+
+        snprintf(szPath, sizeof(szPath), "%s:%s", pszSshDir, pszPath ? pszPath : "/usr/bin:/bin");
+        snprintf(szFd, sizeof(szFd), "%d", passFds[0]);
+        snprintf(szKb, sizeof(szKb), "%d", kbOutput);
+        setenv("PATH", szPath, 1);
+        setenv("SSHFS_PERF_OUTPUT_KB", szKb, 1);
+        setenv("SSHFS_PERF_PASSWORD", PERF_PASSWORD, 1);
+        execl(pszLauncher, pszLauncher, "perf@bench", szFd, "true", (char *)NULL);
+        fprintf(stderr, "Could not run %s: %s\n", pszLauncher, strerror(errno));
+        _exit(127);
+    }
+    close(passFds[0]);
+
+    /* Until the pty closes (EIO once the launcher and the stand-in are gone) */
+    for (;;)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int msLeft = PERF_LAUNCH_TIMEOUT - (int)((NowNs() - start) / 1000000ULL);
+        ssize_t n;
+
+        if (msLeft <= 0 || poll(&pfd, 1, msLeft) <= 0)
+        {
+            fprintf(stderr, "launch timed out (%s)\n", bReady ? "after login" : "before login");
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            close(fd);
+            return 0;
+        }
+
+        n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        if (!bReady && PromptMatcherFeed(&pmReady, buffer, (size_t)n))
+        {
+            bReady = 1;
+            t->msReady = (double)(NowNs() - start) / 1e6;
+        }
+        if (bReady && !bDone && PromptMatcherFeed(&pmDone, buffer, (size_t)n))
+        {
+            bDone = 1;
+            t->msDone = (double)(NowNs() - start) / 1e6;
+        }
+    }
+
+    waitpid(pid, &status, 0);
+    t->msExit = (double)(NowNs() - start) / 1e6;
+    close(fd);
+
+    if (!bDone || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "launch failed: %s, exit status %d\n",
+            bReady ? (bDone ? "output complete" : "output cut short") : "never logged in",
+            WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        return 0;
+    }
+    return 1;
+}
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Nearest-rank percentile of n sorted values
+ */
+static double Percentile(const double *sorted, int n, int pct)
+{
+    int rank = (pct * n + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void RunLaunch(const char *pszLauncher, const char *pszSshDir, int nRuns, int kbOutput)
+{
+    static double ready[PERF_MAX_RUNS], done[PERF_MAX_RUNS], total[PERF_MAX_RUNS];
+    char szName[64];
+    int i;
+
+    for (i = 0; i < nRuns; i++)
+    {
+        LaunchTimes t;
+
+        if (!LaunchOnce(pszLauncher, pszSshDir, kbOutput, &t))
+        {
+            PrintFailed("launch-ready", "ms", LAUNCH_READY_LIMIT_MS);
+            return;
+        }
+        ready[i] = t.msReady;
+        done[i] = t.msDone;
+        total[i] = t.msExit;
+    }
+
+    qsort(ready, (size_t)nRuns, sizeof(double), CompareDouble);
+    qsort(done, (size_t)nRuns, sizeof(double), CompareDouble);
+    qsort(total, (size_t)nRuns, sizeof(double), CompareDouble);
+
+    PrintResult("launch-ready-p50", Percentile(ready, nRuns, 50), "ms", LAUNCH_READY_LIMIT_MS);
+    PrintResult("launch-ready-p95", Percentile(ready, nRuns, 95), "ms", LAUNCH_READY_LIMIT_MS * 2);
+    snprintf(szName, sizeof(szName), "launch-output-%dk-p50", kbOutput);
+    PrintResult(szName, Percentile(done, nRuns, 50), "ms", LAUNCH_DONE_LIMIT_MS);
+    PrintResult("launch-exit-p50", Percentile(total, nRuns, 50), "ms", LAUNCH_DONE_LIMIT_MS);
+}
+
+int main(int argc, char *argv[])
+{
+    int bQuick = 0, bCheck = 0;
+    int nRuns = 20, kbOutput = 1024;
+    int argi;
+
+    for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "--quick") == 0)
+            bQuick = 1;
+        else if (strcmp(argv[argi], "--check") == 0)
+            bCheck = 1;
+        else if (strcmp(argv[argi], "--runs") == 0 && argi + 1 < argc)
+            nRuns = atoi(argv[++argi]);
+        else if (strcmp(argv[argi], "--output-kb") == 0 && argi + 1 < argc)
+            kbOutput = atoi(argv[++argi]);
+        else
+            break;
+    }
+    if (argc - argi != 2 || nRuns < 1 || nRuns > PERF_MAX_RUNS || kbOutput < 0)
+    {
+        fprintf(stderr, "Usage: %s [--quick] [--check] [--runs <n>] [--output-kb <n>] <launcher> <ssh_dir>\n",
+            argv[0]);
+        return 2;
+    }
+
+    PrintHeader();
+    RunLaunch(argv[argi], argv[argi + 1], bQuick && nRuns > 5 ? 5 : nRuns, kbOutput);
+    return bCheck && PerfFailed() ? 1 : 0;
+}
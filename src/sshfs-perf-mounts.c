@@ -0,0 +1,128 @@
+/**
+ * sshfs-perf-mounts.c
+ *
+ * Test of sshfs-mounts.c: the indexed mountinfo table the Linux tools
+ * resolve a path with. Checked on nested, bind and shadowing mounts, then
+ * timed parsing and looking up paths in a table of 4000 mounts.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-mounts sshfs-perf-mounts.c sshfs-perf.c sshfs-mounts.c sshfs-path.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-mounts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PERF_MOUNTS         4000            /* Lines of mountinfo: containers, snaps, autofs */
+
+static char *g_pMountInfo;
+static size_t g_cbMountInfo;
+static MountTable *g_pMounts;
+
+static int SetUp(void)
+{
+    size_t i, pos = 0;
+
+    /* A crowded mount table: one sshfs mount in eight among overlays and tmpfs */
+    g_pMountInfo = malloc((size_t)PERF_MOUNTS * 256);
+    if (!g_pMountInfo)
+        return 0;
+    for (i = 0; i < PERF_MOUNTS; i++)
+    {
+        if (i % 8 == 0)
+            pos += (size_t)sprintf(g_pMountInfo + pos, "%zu 30 0:%zu / /home/alice/mnt/srv%zu rw,nosuid,nodev "
+                "shared:%zu - fuse.sshfs alice@files%zu.example.com:/srv/data%zu rw,user_id=1000\n",
+                i + 100, i + 50, i, i, i % 64, i);
+        else
+            pos += (size_t)sprintf(g_pMountInfo + pos, "%zu 29 0:%zu / /var/lib/containers/c%zu/merged/layer%zu "
+                "rw,relatime - %s overlay rw,lowerdir=/l%zu\n",
+                i + 100, i + 50, i / 8, i % 8, i % 2 ? "overlay" : "tmpfs", i);
+    }
+    g_cbMountInfo = pos;
+
+    g_pMounts = MountTableCreate();
+    return g_pMounts && MountTableParse(g_pMounts, g_pMountInfo, g_cbMountInfo);
+}
+
+static void BenchMountParse(size_t nOps)
+{
+    MountTable *mt = MountTableCreate();
+    size_t i, n = 0;
+
+    for (i = 0; mt && i < nOps; i++)
+        n += (size_t)MountTableParse(mt, g_pMountInfo, g_cbMountInfo) + MountTableCount(mt);
+    MountTableClose(mt);
+    g_sink += n;
+}
+
+static void BenchMountLookup(size_t nOps)
+{
+    char szPath[256];
+    const char *pszSub;
+    size_t i, n = 0;
+
+    /* A file a few levels into one of the mounts, and a path on no mount */
+    for (i = 0; i < nOps; i++)
+    {
+        if (i & 1)
+            snprintf(szPath, sizeof(szPath), "/home/alice/mnt/srv%zu/projects/app/src/main.c", (i * 8) % PERF_MOUNTS);
+        else
+            snprintf(szPath, sizeof(szPath), "/var/lib/containers/c%zu/merged/layer3/usr/bin", i % (PERF_MOUNTS / 8));
+        n += MountTableLookup(g_pMounts, szPath, &pszSub) != NULL;
+    }
+    g_sink += n;
+}
+
+static int CheckMountParse(void)
+{
+    static const char szInfo[] =
+        "22 1 8:1 / / rw - ext4 /dev/sda1 rw\n"
+        "40 22 0:40 / /home/alice/mnt rw - fuse.sshfs alice@files.example.com: rw\n"
+        "41 22 0:41 /sub /home/alice/sub rw - fuse.sshfs alice@files.example.com: rw\n"
+        "42 22 0:42 /logs /home/alice/logs rw - fuse.sshfs root@[fe80::1]:/var rw\n"
+        "43 22 0:43 / /home/alice/my\\040drive rw - fuse.sshfs bob@nas:data rw\n"
+        "44 40 0:44 / /home/alice/mnt/tmp rw - tmpfs tmpfs rw\n";
+    MountTable *mt = MountTableCreate();
+    char szTarget[256], szRemote[512];
+    int bOk;
+
+    if (!mt)
+        return Expect(0, "out of memory");
+    bOk = Expect(MountTableParse(mt, szInfo, sizeof(szInfo) - 1) && MountTableCount(mt) == 4, "four sshfs mounts");
+    bOk &= Expect(MountTableResolve(mt, "/home/alice/mnt/src", szTarget, sizeof(szTarget), szRemote, sizeof(szRemote)) &&
+        strcmp(szTarget, "alice@files.example.com") == 0 && strcmp(szRemote, "~/src") == 0, "home mount");
+    bOk &= Expect(MountTableResolve(mt, "/home/alice/sub/x", szTarget, sizeof(szTarget), szRemote, sizeof(szRemote)) &&
+        strcmp(szRemote, "~/sub/x") == 0, "bind mount of a home subdirectory stays in home");
+    bOk &= Expect(MountTableResolve(mt, "/home/alice/logs", szTarget, sizeof(szTarget), szRemote, sizeof(szRemote)) &&
+        strcmp(szTarget, "root@fe80::1") == 0 && strcmp(szRemote, "/var/logs") == 0, "bind mount below a root path");
+    bOk &= Expect(MountTableResolve(mt, "/home/alice/my drive/a", szTarget, sizeof(szTarget), szRemote, sizeof(szRemote)) &&
+        strcmp(szRemote, "~/data/a") == 0, "escaped mount point");
+    bOk &= Expect(!MountTableResolve(mt, "/home/alice/mnt/tmp/a", szTarget, sizeof(szTarget), szRemote, sizeof(szRemote)),
+        "tmpfs mounted inside the sshfs mount");
+    MountTableClose(mt);
+    return bOk;
+}
+
+static int CheckMountLookup(void)
+{
+    const SshfsMount *m;
+    const char *pszSub = NULL;
+
+    m = MountTableLookup(g_pMounts, "/home/alice/mnt/srv808/a/b", &pszSub);
+    return Expect(MountTableCount(g_pMounts) == PERF_MOUNTS / 8, "sshfs mounts in the large table") &
+        Expect(m && strcmp(m->pszBasePath, "/srv/data808") == 0 && pszSub && strcmp(pszSub, "/a/b") == 0,
+            "lookup in the large table") &
+        Expect(!MountTableLookup(g_pMounts, "/home/alice/mnt/srv8080", &pszSub), "no mount with that name");
+}
+
+static const MicroBench g_benches[] = {
+    {"mount-parse-4000",     BenchMountParse,    CheckMountParse,    100,    20000000},
+    {"mount-lookup",         BenchMountLookup,   CheckMountLookup,   400000, 5000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,99 @@
+/**
+ * sshfs-perf-path.c
+ *
+ * Test of sshfs-path.c: parsing \\sshfs\... UNC paths and building the
+ * remote path for a folder on the drive, the first thing every verb does.
+ * Checked on home, root and key mounts, then timed over a set of drives
+ * and folders.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-path sshfs-perf-path.c sshfs-perf.c sshfs-path.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-path.h"
+
+#include <string.h>
+
+static const char *const g_ppszUNC[] = {
+    "\\\\sshfs\\alice@files.example.com",
+    "\\\\sshfs.r\\alice@files.example.com!2222\\srv\\projects",
+    "\\\\sshfs.k\\build=ci@10.0.0.12\\work\\src\\lib",
+    "\\\\sshfs.kr\\root@nas\\volume1\\photos\\2024",
+    "\\\\SSHFS\\bob@Host-With-A-Longer-Name.internal.example.org!22\\home\\bob\\documents",
+    "\\\\sshfs.r/carol@[fe80::1]/var/log",
+    "\\\\sshfs\\dave@h\\",
+    "\\\\sshfs\\not-an-instance\\path"
+};
+#define PERF_UNC_COUNT PERF_COUNT(g_ppszUNC)
+
+static const char *const g_ppszLocal[] = {
+    "X:",
+    "X:\\src",
+    "Y:\\src\\lib\\net\\http",
+    "Z:\\a\\..\\b\\.\\c",
+    "W:\\Documents\\Reports\\2024\\Q3\\final\\draft\\v2\\appendix"
+};
+#define PERF_LOCAL_COUNT PERF_COUNT(g_ppszLocal)
+
+static void BenchUncParse(size_t nOps)
+{
+    SSHFSInstance inst;
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+        n += (size_t)ParseSSHFSInstance(g_ppszUNC[i % PERF_UNC_COUNT], &inst) + inst.szHost[0];
+    g_sink += n;
+}
+
+static void BenchRemotePath(size_t nOps)
+{
+    char szOut[1024];
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        BuildMountedRemotePath(g_ppszLocal[i % PERF_LOCAL_COUNT], g_ppszUNC[i % (PERF_UNC_COUNT - 1)],
+            (int)(i & 1), szOut, sizeof(szOut));
+        n += (unsigned char)szOut[1];
+    }
+    g_sink += n;
+}
+
+static int CheckUncParse(void)
+{
+    SSHFSInstance inst;
+    int bOk;
+
+    bOk = Expect(ParseSSHFSInstance("\\\\sshfs.r\\alice@files.example.com!2222\\srv\\projects", &inst) &&
+        strcmp(inst.szUser, "alice") == 0 && strcmp(inst.szHost, "files.example.com") == 0 &&
+        strcmp(inst.szPort, "2222") == 0 && strcmp(inst.szBasePath, "srv/projects") == 0 &&
+        inst.mountType == MOUNT_TYPE_PASSWORD_ROOT, "root mount with port and base path");
+    bOk &= Expect(ParseSSHFSInstance("\\\\sshfs.kr\\root@nas\\volume1", &inst) &&
+        strcmp(inst.szPort, "") == 0 && inst.mountType == MOUNT_TYPE_KEY_ROOT, "key root mount");
+    bOk &= Expect(!ParseSSHFSInstance("\\\\sshfs\\not-an-instance\\path", &inst), "instance without a user");
+    return bOk;
+}
+
+static int CheckRemotePath(void)
+{
+    char szOut[1024];
+    int bOk;
+
+    BuildMountedRemotePath("Y:\\src\\lib", "\\\\sshfs.k\\ci@10.0.0.12\\work", 0, szOut, sizeof(szOut));
+    bOk = Expect(strcmp(szOut, "~/work/src/lib") == 0, "home mount below a base path");
+    BuildMountedRemotePath("X:", "\\\\sshfs\\alice@h", 0, szOut, sizeof(szOut));
+    bOk &= Expect(strcmp(szOut, "~") == 0, "drive root of a home mount");
+    BuildMountedRemotePath("X:\\var\\log", "\\\\sshfs.r\\alice@h", 1, szOut, sizeof(szOut));
+    bOk &= Expect(strcmp(szOut, "/var/log") == 0, "root mount");
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"unc-parse",            BenchUncParse,      CheckUncParse,      400000, 5000},
+    {"remote-path",          BenchRemotePath,    CheckRemotePath,    400000, 10000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, NULL, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,346 @@
+/**
+ * sshfs-perf-predict.c
+ *
+ * Test of sshfs-predict.c: predictive local echo. Checked by replaying a
+ * session against a line editor whose echo comes three keys late, on a
+ * small terminal model that has to end up showing what the server drew,
+ * then timed on a fast typist and on 64 KB of output passing through.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-predict sshfs-perf-predict.c sshfs-perf.c sshfs-predict.c sshfs-relay.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-predict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *g_pOutput;
+
+static int SetUp(void)
+{
+    g_pOutput = MakeTerminalOutput(PERF_OUTPUT_SIZE);
+    return g_pOutput != NULL;
+}
+
+static void BenchPredictTyping(size_t nOps)
+{
+    static PredictEngine pe;
+    static PredictFrame frame;
+    char echo[PREDICT_ECHO_SIZE];
+    size_t i, n = 0;
+
+    /* A confident engine on a fast typist: each key drawn, then its echo confirms it */
+    PredictInit(&pe, 1);
+    PredictResize(&pe, 120);
+    for (i = 0; i < nOps; i++)
+    {
+        char c = (char)('a' + i % 26);
+
+        if (i % 64 == 0)
+            PredictOutput(&pe, "\r\n$ ", 4, &frame);
+        n += PredictInput(&pe, &c, 1, echo, sizeof(echo));
+        PredictOutput(&pe, &c, 1, &frame);
+        n += frame.cbPrefix + frame.cbSuffix;
+    }
+    g_sink += n + pe.nConfirmed;
+}
+
+static void BenchPredictOutput(size_t nOps)
+{
+    static PredictEngine pe;
+    static PredictFrame frame;
+    size_t i, n = 0;
+
+    PredictInit(&pe, 1);
+    for (i = 0; i < nOps; i++)
+    {
+        size_t pos;
+
+        for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+        {
+            PredictOutput(&pe, g_pOutput + pos, 4096, &frame);
+            n += frame.cbPrefix + pe.server.col;
+        }
+    }
+    g_sink += n;
+}
+
+/**
+ * The user's terminal, reduced to the cursor line: what the engine's echo
+ * and frames around the server's output leave on it
+ */
+typedef struct ReplayTerm {
+    char cells[128];
+    char underline[128];
+    size_t cLen, col;
+    int bUnderline;
+    int escState;
+    char params[16];
+    size_t cbParams;
+} ReplayTerm;
+
+static void ReplayTermFeed(ReplayTerm *t, const char *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        char c = data[i];
+        size_t n;
+
+        if (t->escState == 1)
+        {
+            t->escState = (c == '[') ? 2 : 0;
+            t->cbParams = 0;
+            continue;
+        }
+        if (t->escState == 2)
+        {
+            if ((c >= '0' && c <= '9') || c == ';')
+            {
+                if (t->cbParams < sizeof(t->params) - 1)
+                    t->params[t->cbParams++] = c;
+                continue;
+            }
+            t->params[t->cbParams] = '\0';
+            n = (size_t)atoi(t->params);
+            if (c == 'm')
+                t->bUnderline = (n == 4);
+            else if (c == 'C')
+                t->col += n ? n : 1;
+            else if (c == 'D')
+                t->col -= (n ? n : 1) < t->col ? (n ? n : 1) : t->col;
+            else if (c == 'K' && t->col < t->cLen)
+                t->cLen = t->col;
+            t->escState = 0;
+            continue;
+        }
+
+        if (c == 0x1b)
+            t->escState = 1;
+        else if (c == '\r')
+            t->col = 0;
+        else if (c == '\n')
+            t->cLen = 0;
+        else if (c == '\b')
+            t->col -= t->col > 0;
+        else if (c >= 0x20 && c < 0x7f && t->col < sizeof(t->cells))
+        {
+            while (t->cLen < t->col)
+            {
+                t->cells[t->cLen] = ' ';
+                t->underline[t->cLen++] = 0;
+            }
+            t->cells[t->col] = c;
+            t->underline[t->col] = (char)t->bUnderline;
+            if (++t->col > t->cLen)
+                t->cLen = t->col;
+        }
+    }
+}
+
+/* Does the terminal show the text with the cursor at col, and nothing underlined if bSettled? */
+static int ReplayTermShows(const ReplayTerm *t, const char *pszText, size_t col, int bSettled)
+{
+    size_t i, cLen = t->cLen, cchText = strlen(pszText);
+
+    /* Trailing blanks look the same as no cells */
+    while (cLen > 0 && t->cells[cLen - 1] == ' ')
+        cLen--;
+    while (cchText > 0 && pszText[cchText - 1] == ' ')
+        cchText--;
+    if (cLen != cchText || memcmp(t->cells, pszText, cLen) != 0 || t->col != col)
+        return 0;
+    for (i = 0; bSettled && i < t->cLen; i++)
+        if (t->underline[i])
+            return 0;
+    return 1;
+}
+
+/**
+ * A line editor on the server: its line, and the echo readline would send
+ * for a key (moving left with backspaces, erasing with blanks or EL)
+ */
+typedef struct ReplayShell {
+    char szLine[128];           /* Prompt, then the input */
+    size_t cLen, cur;
+} ReplayShell;
+
+static size_t ReplayShellKey(ReplayShell *sh, const char *pKey, char *out)
+{
+    size_t cb = 0, i;
+
+    if (pKey[0] == 0x1b && pKey[2] == 'D')
+    {
+        if (sh->cur > 2)
+        {
+            sh->cur--;
+            out[cb++] = '\b';
+        }
+    }
+    else if (pKey[0] == 0x1b && pKey[2] == 'C')
+    {
+        if (sh->cur < sh->cLen)
+            out[cb++] = sh->szLine[sh->cur++];
+    }
+    else if (pKey[0] == 0x7f)
+    {
+        if (sh->cur > 2)
+        {
+            memmove(sh->szLine + sh->cur - 1, sh->szLine + sh->cur, sh->cLen - sh->cur);
+            sh->cLen--;
+            sh->cur--;
+            out[cb++] = '\b';
+            if (sh->cur == sh->cLen)
+                cb += (size_t)sprintf(out + cb, "\x1b[K");
+            else
+            {
+                for (i = sh->cur; i < sh->cLen; i++)
+                    out[cb++] = sh->szLine[i];
+                out[cb++] = ' ';
+                for (i = sh->cur; i <= sh->cLen; i++)
+                    out[cb++] = '\b';
+            }
+        }
+    }
+    else
+    {
+        memmove(sh->szLine + sh->cur + 1, sh->szLine + sh->cur, sh->cLen - sh->cur);
+        sh->szLine[sh->cur] = pKey[0];
+        sh->cLen++;
+        for (i = sh->cur; i < sh->cLen; i++)
+            out[cb++] = sh->szLine[i];
+        for (i = sh->cur + 1; i < sh->cLen; i++)
+            out[cb++] = '\b';
+        sh->cur++;
+    }
+    sh->szLine[sh->cLen] = '\0';
+    return cb;
+}
+
+static void ReplayOutput(PredictEngine *pe, ReplayTerm *t, const char *data, size_t len)
+{
+    static PredictFrame frame;
+
+    PredictOutput(pe, data, len, &frame);
+    ReplayTermFeed(t, frame.prefix, frame.cbPrefix);
+    ReplayTermFeed(t, data, len);
+    ReplayTermFeed(t, frame.suffix, frame.cbSuffix);
+}
+
+static int CheckPredictReplay(void)
+{
+    /* Type a command, then go back into it to edit; the echo runs three keys behind */
+    static const char *const ppszKeys[] = {
+        "l", "s", " ", "-", "l", "a", " ", "s", "r", "c",
+        "\x1b[D", "\x1b[D", "\x1b[D", "\x1b[D", "X", "Y", "\x7f", "\x1bOD", "\x1b[C", "\x1b[C", "\x7f", "\x7f",
+        "\x1b[C", "\x1b[C", "\x1b[C", "\x7f", "\x7f"
+    };
+    enum { nKeys = sizeof(ppszKeys) / sizeof(ppszKeys[0]), nDelay = 3 };
+    static PredictEngine pe;
+    static char echoes[nKeys][256];
+    size_t cbEchoes[nKeys];
+    char echo[PREDICT_ECHO_SIZE];
+    ReplayShell sh = {"$ ", 2, 2};
+    ReplayTerm t;
+    size_t i, nSent = 0, cb;
+    int bOk = 1, bShown = 1;
+
+    memset(&t, 0, sizeof(t));
+    PredictInit(&pe, 1);
+    PredictResize(&pe, 80);
+    ReplayOutput(&pe, &t, "\r\n$ ", 4);
+
+    for (i = 0; i < nKeys; i++)
+    {
+        const char *pKey = ppszKeys[i];
+
+        cb = PredictInput(&pe, pKey, strlen(pKey), echo, sizeof(echo));
+        ReplayTermFeed(&t, echo, cb);
+        if (i == 0)
+            bOk &= Expect(cb == 0, "nothing predicted before the server has echoed");
+        cbEchoes[i] = ReplayShellKey(&sh, pKey, echoes[i]);
+
+        /* Deliver late echoes: every fourth pair in one read, mid-line redraws split in two */
+        while (nSent + nDelay <= i)
+        {
+            if (nSent % 4 == 3 && nSent + 1 + nDelay <= i)
+            {
+                char merged[512];
+                memcpy(merged, echoes[nSent], cbEchoes[nSent]);
+                memcpy(merged + cbEchoes[nSent], echoes[nSent + 1], cbEchoes[nSent + 1]);
+                ReplayOutput(&pe, &t, merged, cbEchoes[nSent] + cbEchoes[nSent + 1]);
+                nSent += 2;
+            }
+            else
+            {
+                size_t cbFirst = cbEchoes[nSent] > 2 ? cbEchoes[nSent] / 2 : cbEchoes[nSent];
+                ReplayOutput(&pe, &t, echoes[nSent], cbFirst);
+                ReplayOutput(&pe, &t, echoes[nSent] + cbFirst, cbEchoes[nSent] - cbFirst);
+                nSent++;
+            }
+        }
+
+        /* Once the first echo is in, the user sees every key at once */
+        if (nSent > 0 && !ReplayTermShows(&t, sh.szLine, sh.cur, 0))
+            bShown = 0;
+    }
+    bOk &= Expect(bShown, "typed line shown before its echo");
+
+    for (; nSent < nKeys; nSent++)
+        ReplayOutput(&pe, &t, echoes[nSent], cbEchoes[nSent]);
+    bOk &= Expect(ReplayTermShows(&t, sh.szLine, sh.cur, 1), "terminal matches the server once echoed");
+    bOk &= Expect(pe.nPending == 0 && pe.nConfirmed == nKeys && pe.nMispredicted == 0, "every key confirmed");
+
+    /* The server answers differently: the guess is erased and its output stands */
+    cb = PredictInput(&pe, "\r", 1, echo, sizeof(echo));
+    ReplayOutput(&pe, &t, "\r\n$ ", 4);
+    cb += PredictInput(&pe, "ab", 2, echo, sizeof(echo));
+    ReplayTermFeed(&t, echo, cb);
+    ReplayOutput(&pe, &t, "A", 1);
+    ReplayOutput(&pe, &t, "B", 1);
+    bOk &= Expect(ReplayTermShows(&t, "$ AB", 4, 1) && pe.nMispredicted == 1 && pe.nPending == 0,
+        "misprediction erased");
+
+    /* Nothing is drawn at a password prompt */
+    ReplayOutput(&pe, &t, "\r\n[sudo] password for alice: ", 29);
+    bOk &= Expect(PredictInput(&pe, "secret", 6, echo, sizeof(echo)) == 0 && pe.nPending == 0,
+        "password not echoed");
+    return bOk;
+}
+
+static int CheckPredictOutput(void)
+{
+    static const char szPrompt[] = "\r\n\x1b]0;alice@files: ~\x07\x1b[01;32m$\x1b[0m ";
+    static PredictEngine pe;
+    static PredictFrame frame;
+    char echo[PREDICT_ECHO_SIZE];
+    size_t pos;
+    int bOk;
+
+    /* Through a screenful of listing to the prompt after it */
+    PredictInit(&pe, 1);
+    for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+        PredictOutput(&pe, g_pOutput + pos, 4096, &frame);
+    PredictOutput(&pe, szPrompt, sizeof(szPrompt) - 1, &frame);
+    bOk = Expect(pe.bLineKnown && pe.server.col == 2 && strncmp(pe.server.cells, "$ ", 2) == 0, "prompt line");
+
+    /* A full-screen editor takes the line away; keys are left to the server */
+    PredictOutput(&pe, "\x1b[?1049h\x1b[H", strlen("\x1b[?1049h\x1b[H"), &frame);
+    bOk &= Expect(PredictInput(&pe, "ihello", 6, echo, sizeof(echo)) == 0 && pe.nPending == 0, "full screen");
+    PredictOutput(&pe, "\x1b[?1049l\r\n$ ", strlen("\x1b[?1049l\r\n$ "), &frame);
+    bOk &= Expect(!pe.bFullScreen && pe.bLineKnown && pe.server.col == 2, "back at the prompt");
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"predict-typing",       BenchPredictTyping, CheckPredictReplay, 400000, 5000},
+    {"predict-output-64k",   BenchPredictOutput, CheckPredictOutput, 4000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,182 @@
+/**
+ * sshfs-perf-reconnect.c
+ *
+ * Test of sshfs-reconnect.c: the relay's reconnect state machine and the
+ * command of each attempt. Checked against the backoff, the messages of
+ * an outage and the attempt command's directory report under /bin/sh,
+ * then timed going through a dropped connection's attempts.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-reconnect sshfs-perf-reconnect.c sshfs-perf.c sshfs-reconnect.c sshfs-remote.c sshfs-cwd.c sshfs-path.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-reconnect.h"
+#include "sshfs-cwd.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * An outage as the relay goes through it: the session drops, an attempt
+ * fails, the next one reconnects, with the messages for each
+ */
+static void BenchReconnect(size_t nOps)
+{
+    char szMessage[256];
+    unsigned long long now = 1000;
+    size_t i, n = 0;
+    Reconnect r;
+
+    ReconnectInit(&r, 1);
+    ReconnectAttempt(&r, now);
+    ReconnectUp(&r, now);
+    for (i = 0; i < nOps; i++)
+    {
+        now += RECONNECT_STABLE_MS;
+        ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, now);
+        n += ReconnectFormatLost(&r, now, szMessage, sizeof(szMessage));
+        now = r.msRetry;
+        ReconnectAttempt(&r, now);
+        ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, now + 100);
+        n += ReconnectFormatLost(&r, now + 100, szMessage, sizeof(szMessage));
+        now = r.msRetry;
+        ReconnectAttempt(&r, now);
+        if (ReconnectUp(&r, now + 50))
+            n += ReconnectFormatUp(&r, now + 50, szMessage, sizeof(szMessage));
+    }
+    g_sink += n;
+}
+
+static int CheckReconnectState(void)
+{
+    char szMessage[256];
+    unsigned long long rng = 7;
+    unsigned i, ms, msMin = ~0u, msMax = 0;
+    Reconnect r;
+    int bOk;
+
+    /* Never up: a wrong host fails at once */
+    ReconnectInit(&r, 1);
+    ReconnectAttempt(&r, 0);
+    bOk = Expect(ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, 100) == RECONNECT_DONE, "no retry before the first login");
+
+    /* Lost after a while: a new outage, the first delay */
+    ReconnectInit(&r, 1);
+    ReconnectAttempt(&r, 1000);
+    bOk &= Expect(ReconnectUp(&r, 2000) == 0 && r.phase == RECONNECT_LIVE, "first login");
+    bOk &= Expect(ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, 60000) == RECONNECT_WAITING && r.nFailed == 0 &&
+        r.msLost == 60000 && r.msRetry >= 60000 + RECONNECT_BASE_MS / 2 && r.msRetry <= 60000 + RECONNECT_BASE_MS,
+        "loss");
+    ReconnectFormatLost(&r, 60000, szMessage, sizeof(szMessage));
+    bOk &= Expect(strstr(szMessage, "Connection lost. Reconnecting in 0.") != NULL, "loss message");
+    bOk &= Expect(ReconnectOnKey(&r, 'x', 60001) == RECONNECT_KEY_NONE &&
+        ReconnectOnKey(&r, '\r', 60001) == RECONNECT_KEY_RETRY && ReconnectDelay(&r, 60001) == 0, "Enter retries");
+
+    /* A failed attempt backs off further */
+    ReconnectAttempt(&r, 60001);
+    bOk &= Expect(ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, 64200) == RECONNECT_WAITING && r.nFailed == 1 &&
+        ReconnectDelay(&r, 64200) >= RECONNECT_BASE_MS && ReconnectDelay(&r, 64200) <= 2 * RECONNECT_BASE_MS,
+        "failed attempt");
+    ReconnectFormatLost(&r, 64200, szMessage, sizeof(szMessage));
+    bOk &= Expect(strstr(szMessage, "Attempt 1 failed, down 4.2s. Next in ") != NULL, "failed attempt message");
+
+    /* Up again after the delay; the backoff resets once it stays up */
+    ReconnectAttempt(&r, r.msRetry);
+    bOk &= Expect(ReconnectTick(&r, r.msAttempt + RECONNECT_STABLE_MS - 1) == 0 &&
+        ReconnectTick(&r, r.msAttempt + RECONNECT_STABLE_MS) == 1 && r.phase == RECONNECT_LIVE,
+        "a quiet shell counts as up");
+    ReconnectFormatUp(&r, 60000 + 187000, szMessage, sizeof(szMessage));
+    bOk &= Expect(strstr(szMessage, "Reconnected after 3m 07s (2 attempts)") != NULL, "reconnect message");
+    bOk &= Expect(r.nFailed == 1 && (ReconnectTick(&r, r.msLive + RECONNECT_STABLE_MS), r.nFailed == 0),
+        "backoff reset");
+
+    /* Dropped again right away: not a new outage */
+    ReconnectInit(&r, 1);
+    ReconnectAttempt(&r, 0);
+    ReconnectUp(&r, 0);
+    ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, 50000);
+    ReconnectAttempt(&r, r.msRetry);
+    ReconnectUp(&r, r.msRetry);
+    bOk &= Expect(ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, r.msLive + 1000) == RECONNECT_WAITING &&
+        r.nFailed == 1 && r.msLost == 50000, "flapping session");
+
+    /* The shell's own exit, q, and the give-up limit end it */
+    bOk &= Expect(ReconnectOnKey(&r, 'q', r.msRetry) == RECONNECT_KEY_GIVE_UP && r.phase == RECONNECT_DONE,
+        "q gives up");
+    ReconnectFormatGiveUp(&r, 50000 + 3723000, szMessage, sizeof(szMessage));
+    bOk &= Expect(strstr(szMessage, "Gave up reconnecting after 1h 02m") != NULL, "give-up message");
+    ReconnectInit(&r, 1);
+    ReconnectAttempt(&r, 0);
+    ReconnectUp(&r, 0);
+    bOk &= Expect(ReconnectExit(&r, 1, 1000) == RECONNECT_DONE && r.exitCode == 1, "shell exit code");
+    ReconnectInit(&r, 1);
+    ReconnectAttempt(&r, 0);
+    ReconnectUp(&r, 0);
+    ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, 1000);
+    ReconnectAttempt(&r, 2000);
+    bOk &= Expect(ReconnectExit(&r, RECONNECT_EXIT_TRANSPORT, 1000 + RECONNECT_GIVE_UP_MS) == RECONNECT_DONE,
+        "give up after an hour");
+
+    /* Equal jitter: half the ceiling plus up to the other half, capped */
+    for (i = 0; i < 10000; i++)
+    {
+        ms = ReconnectBackoff(20, &rng);
+        msMin = ms < msMin ? ms : msMin;
+        msMax = ms > msMax ? ms : msMax;
+    }
+    bOk &= Expect(msMin >= RECONNECT_CAP_MS / 2 && msMax <= RECONNECT_CAP_MS && msMax - msMin > RECONNECT_CAP_MS / 4,
+        "backoff cap and jitter");
+    return bOk;
+}
+
+/**
+ * The attempt command run by /bin/sh: the OSC 7 report of the directory
+ * it resumed in, then the shell
+ */
+static int CheckReconnectScript(void)
+{
+    char szDir[256], szPath[PATH_MAX], szCmd[PATH_MAX * 4 + 256], szOut[PATH_MAX + 256];
+    size_t cbOut, off;
+    CwdScanner scanner;
+    int bOk, status;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szPath, sizeof(szPath), "%s/it's a dir", szDir);
+    mkdir(szPath, 0755);
+
+    ReconnectBuildCommand(szPath, "echo shell-ran", szCmd, sizeof(szCmd));
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    CwdScanInit(&scanner);
+    off = CwdScan(&scanner, szOut, cbOut);
+    bOk = Expect(status == 0 && off > 0 && strcmp(scanner.szCwd, szPath) == 0, "directory report");
+    bOk &= Expect(cbOut - off == 10 && memcmp(szOut + off, "shell-ran\n", 10) == 0, "shell after the report");
+
+    /* A folder that is gone: the shell still starts, where ssh left it */
+    snprintf(szPath, sizeof(szPath), "%s/gone", szDir);
+    ReconnectBuildCommand(szPath, "echo shell-ran", szCmd, sizeof(szCmd));
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    CwdScanInit(&scanner);
+    off = CwdScan(&scanner, szOut, cbOut);
+    bOk &= Expect(status == 0 && off > 0 && strcmp(scanner.szCwd, szPath) != 0 &&
+        strstr(szOut + off, "shell-ran") != NULL, "missing directory");
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static int CheckReconnect(void)
+{
+    return CheckReconnectState() & CheckReconnectScript();
+}
+
+static const MicroBench g_benches[] = {
+    {"reconnect-outage",     BenchReconnect,     CheckReconnect,     200000, 10000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, NULL, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,140 @@
+/**
+ * sshfs-perf-record.c
+ *
+ * Test of sshfs-record.c: the queue between the relay's output thread and
+ * the recorder, and the writer that turns it into a gzipped asciicast.
+ * Checked by inflating a recording with gzip -d, with output dropped and
+ * marked when the queue is full, then timed on 64 KB of terminal output.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-record sshfs-perf-record.c sshfs-perf.c sshfs-record.c sshfs-gzip.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-record.h"
+
+#include <string.h>
+
+static char *g_pOutput;
+static char *g_pPaste;
+
+static int SetUp(void)
+{
+    g_pOutput = MakeTerminalOutput(PERF_OUTPUT_SIZE);
+    g_pPaste = MakePaste(PERF_PASTE_SIZE);
+    return g_pOutput && g_pPaste;
+}
+
+static int CountWrite(const void *data, size_t cb, void *pContext)
+{
+    (void)data;
+    *(size_t *)pContext += cb;
+    return 1;
+}
+
+/**
+ * 64 KB of terminal output through the queue and the writer in 4 KB
+ * reads, as the relay's two threads pass it
+ */
+static void BenchRecord(size_t nOps)
+{
+    static RecordQueue q;
+    static RecordWriter w;
+    size_t i, pos, n = 0;
+    int bWake;
+
+    if (!RecordQueueInit(&q, RECORD_SAMPLE))
+        return;
+    for (i = 0; i < nOps; i++)
+    {
+        if (!RecordWriterInit(&w, CountWrite, &n, 80, 24, 1700000000, "perf", 0))
+            break;
+        for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+            RecordOffer(&q, g_pOutput + pos, 4096, pos / 64, &bWake);
+        RecordWriterPump(&w, &q, 2000, 1);
+        RecordWriterFree(&w);
+    }
+    RecordQueueFree(&q);
+    g_sink += n;
+}
+
+/**
+ * A recording made through the queue and writer, inflated with gzip:
+ * UTF-8 cut between reads, lost output and batches by time
+ */
+static int CheckRecord(void)
+{
+    static const char szExpected[] =
+        "{\"version\": 2, \"width\": 80, \"height\": 24, \"timestamp\": 1700000000, "
+        "\"title\": \"perf \\\"rec\\\"\", \"env\": {\"TERM\": \"xterm-256color\"}}\n"
+        "[0.000, \"o\", \"hello\\r\\n\"]\n"
+        "[0.500, \"o\", \"caf\"]\n"
+        "[0.600, \"o\", \"\xC3\xA9 \\u001b[0m\\\"q\\\"\"]\n"
+        "[1.000, \"m\", \"dropped 65537 bytes\"]\n"
+        "[1.000, \"o\", \"after\"]\n"
+        "[1.500, \"o\", \"end\"]\n"
+        "[2.000, \"o\", \"\\ufffd\"]\n"
+        "[2.000, \"m\", \"dropped 70000 bytes\"]\n";
+    static RecordQueue q;
+    static RecordWriter w;
+    static MemBuffer mb;
+    static char szOut[4096];
+    char szDir[256];
+    size_t cbOut, cbFirst, i, nQueued = 0;
+    RecordResult result = RECORD_QUEUED;
+    int bOk, bWake;
+
+    if (!RecordQueueInit(&q, RECORD_SAMPLE))
+        return Expect(0, "out of memory");
+    mb.cb = 0;
+    if (!RecordWriterInit(&w, AppendMem, &mb, 80, 24, 1700000000, "perf \"rec\"", 1000))
+        return Expect(0, "out of memory");
+
+    bOk = Expect(RecordOffer(&q, "hello\r\n", 7, 1000, &bWake) == RECORD_QUEUED && !bWake, "queued");
+    RecordOffer(&q, "caf\xC3", 4, 1500, &bWake);
+    RecordOffer(&q, "\xA9 \x1b[0m\"q\"", 9, 1600, &bWake);
+    bOk &= Expect(RecordWriterPump(&w, &q, 1700, 0) && mb.cb == 0, "batch waits for RECORD_BATCH_MS");
+    bOk &= Expect(RecordOffer(&q, g_pPaste, RECORD_CHUNK_MAX + 1, 1800, &bWake) == RECORD_DROPPED,
+        "chunk too large");
+    RecordOffer(&q, "after", 5, 2000, &bWake);
+    bOk &= Expect(RecordWriterPump(&w, &q, 2100, 0) && mb.cb > 0, "batch written after RECORD_BATCH_MS");
+    cbFirst = mb.cb;
+    RecordOffer(&q, "end\xE2\x82", 5, 2500, &bWake);
+    RecordOffer(&q, g_pPaste, 70000, 2600, &bWake);
+    bOk &= Expect(RecordWriterPump(&w, &q, 3000, 1) && mb.cb > cbFirst && w.cbWritten == mb.cb, "final batch");
+    RecordWriterFree(&w);
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    bOk &= Expect(WriteScratchFile(szDir, "rec.cast.gz", mb.p, mb.cb) &&
+        Gunzip(szDir, "rec.cast.gz", szOut, sizeof(szOut), &cbOut) == 0 &&
+        strcmp(szOut, szExpected) == 0, "asciicast stream");
+    RemoveScratch(szDir);
+
+    /* A writer that stops reading: every RECORD_SAMPLE_EVERY-th chunk past
+     * half the ring, then nothing, and the relay never waits */
+    for (i = 0; i < 100; i++)
+        nQueued += RecordOffer(&q, g_pPaste, RECORD_CHUNK_MAX, 4000, &bWake) == RECORD_QUEUED;
+    bOk &= Expect(nQueued > RECORD_RING_SIZE / 2 / RECORD_CHUNK_MAX && nQueued < RECORD_RING_SIZE / RECORD_CHUNK_MAX &&
+        bWake && q.cbRecordedTotal + q.cbDroppedTotal == 100LL * RECORD_CHUNK_MAX + 7 + 4 + 9 + 5 + 5 +
+        RECORD_CHUNK_MAX + 1 + 70000, "sampled while behind");
+    RecordQueueFree(&q);
+
+    /* RECORD_BLOCK keeps everything and reports a full ring instead */
+    if (!RecordQueueInit(&q, RECORD_BLOCK))
+        return Expect(0, "out of memory");
+    for (i = 0; i < 100 && (result = RecordOffer(&q, g_pPaste, RECORD_CHUNK_MAX, 4000, &bWake)) == RECORD_QUEUED; i++)
+        ;
+    bOk &= Expect(i > RECORD_RING_SIZE / 2 / RECORD_CHUNK_MAX && i < RECORD_RING_SIZE / RECORD_CHUNK_MAX &&
+        result == RECORD_FULL && bWake && q.cbDroppedTotal == 0, "full ring, nothing dropped");
+    RecordQueueFree(&q);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"record-64k",           BenchRecord,        CheckRecord,        200,    10000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
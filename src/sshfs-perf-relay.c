@@ -0,0 +1,65 @@
+/**
+ * sshfs-perf-relay.c
+ *
+ * Test of sshfs-relay.c: the password prompt matcher, which both launchers
+ * run over every read of terminal output until the prompt has been
+ * answered. Checked on a listing with no prompt and on a prompt cut by a
+ * read, then timed on 64 KB of output in pty-sized reads.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-relay sshfs-perf-relay.c sshfs-perf.c sshfs-relay.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-relay.h"
+
+static char *g_pOutput;
+
+static int SetUp(void)
+{
+    g_pOutput = MakeTerminalOutput(PERF_OUTPUT_SIZE);
+    return g_pOutput != NULL;
+}
+
+static void BenchPromptDetect(size_t nOps)
+{
+    PromptMatcher pm;
+    size_t i, n = 0;
+
+    PromptMatcherInit(&pm, "password:");
+    for (i = 0; i < nOps; i++)
+    {
+        size_t pos;
+
+        /* In reads of a typical pty size */
+        for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+            n += PromptMatcherFeed(&pm, g_pOutput + pos, 4096);
+    }
+    g_sink += n;
+}
+
+static int CheckPromptDetect(void)
+{
+    PromptMatcher pm;
+    size_t pos, nFound = 0;
+    int bOk;
+
+    PromptMatcherInit(&pm, "password:");
+    for (pos = 0; pos < PERF_OUTPUT_SIZE; pos += 4096)
+        nFound += PromptMatcherFeed(&pm, g_pOutput + pos, 4096) != 0;
+    bOk = Expect(nFound == 0, "no prompt in a listing");
+
+    /* Split across reads and in another case */
+    PromptMatcherReset(&pm);
+    bOk &= Expect(!PromptMatcherFeed(&pm, "alice@host's PASS", 17) && PromptMatcherFeed(&pm, "word: ", 6),
+        "prompt cut by a read");
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"prompt-detect-64k",    BenchPromptDetect,  CheckPromptDetect,  4000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,303 @@
+/**
+ * sshfs-perf-remote.c
+ *
+ * Test of sshfs-remote.c: the server-side scripts and what parses their
+ * output. The copy/move script is run with /bin/sh in a scratch folder
+ * and its progress lines parsed, and the attach command is run against
+ * stand-in tmux and screen. The parsers and builders are then timed on a
+ * large selection and a copy of many small items.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-remote sshfs-perf-remote.c sshfs-perf.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static char *g_pProgress;
+static size_t g_cbProgress;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    /* A copy of many small items, as the transfer script reports it */
+    g_pProgress = malloc(PERF_OUTPUT_SIZE);
+    if (!g_pProgress)
+        return 0;
+    pos = (size_t)sprintf(g_pProgress, "#sshfs-total 4194304\n");
+    for (i = 1; pos + 128 < PERF_OUTPUT_SIZE; i++)
+        pos += (size_t)sprintf(g_pProgress + pos, "#sshfs-item %zu 4000 photo-%06zu.jpg\n#sshfs-kb %zu\n", i, i, i * 1024);
+    g_cbProgress = pos;
+    return 1;
+}
+
+static void BenchTransferProgress(size_t nOps)
+{
+    static RemoteProgress rp;
+    size_t i, pos, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        RemoteProgressInit(&rp);
+        for (pos = 0; pos < g_cbProgress; pos += 4096)
+            n += (size_t)RemoteProgressFeed(&rp, g_pProgress + pos, g_cbProgress - pos < 4096 ? g_cbProgress - pos : 4096);
+    }
+    g_sink += n + (size_t)rp.kbDone;
+}
+
+static void BenchTransferCommand(size_t nOps)
+{
+    static char szCmd[256 * 1024];
+    const char *ppszSources[1000];
+    char names[1000][64];
+    size_t i, n = 0;
+
+    /* A large selection dragged to another folder, names that need quoting included */
+    for (i = 0; i < 1000; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "/srv/photos/2024/it's day %zu/IMG_%04zu.jpg", i / 50, i);
+        ppszSources[i] = names[i];
+    }
+    for (i = 0; i < nOps; i++)
+        n += RemoteBuildTransferCommand(i & 1 ? REMOTE_MOVE : REMOTE_COPY, "~/archive/2024",
+            ppszSources, 1000, szCmd, sizeof(szCmd));
+    g_sink += n;
+}
+
+static void BenchSessionName(size_t nOps)
+{
+    char szName[REMOTE_SESSION_NAME_MAX];
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+        n += RemoteSessionName("alice", "files.example.com", i & 1 ? "2222" : "",
+            "/srv/projects/sshfs-win/src/", szName, sizeof(szName));
+    g_sink += n;
+}
+
+/**
+ * The attach command of a launch, with the idle sessions reaped
+ */
+static void BenchAttachCommand(size_t nOps)
+{
+    char szName[REMOTE_SESSION_NAME_MAX], szCmd[2048];
+    size_t i, n = 0;
+
+    RemoteSessionName("alice", "files.example.com", "", "/srv/projects/sshfs-win/src/", szName, sizeof(szName));
+    for (i = 0; i < nOps; i++)
+        n += RemoteBuildAttachCommand(szName, (int)(i & 7) * 24, szCmd, sizeof(szCmd));
+    g_sink += n;
+}
+
+/* Feed output in small uneven reads, so lines span them */
+static void FeedProgress(RemoteProgress *rp, const char *data, size_t len)
+{
+    size_t pos, cb;
+
+    for (pos = 0; pos < len; pos += cb)
+    {
+        cb = 1 + pos % 7;
+        if (cb > len - pos)
+            cb = len - pos;
+        RemoteProgressFeed(rp, data + pos, cb);
+    }
+}
+
+static int CheckTransferProgress(void)
+{
+    static const char szOut[] =
+        "#sshfs-total 2048\r\n#sshfs-item 1 2 my file.iso\r\n#sshfs-kb 512\r\n"
+        "cp: cannot stat 'x': Permission denied\r\n#sshfs-kb 1500\n#sshfs-item 2 2 b\n#sshfs-done\n";
+    RemoteProgress rp;
+    unsigned long long done, total;
+    int bOk;
+
+    RemoteProgressInit(&rp);
+    FeedProgress(&rp, szOut, 63);
+    RemoteProgressPosition(&rp, &done, &total);
+    bOk = Expect(rp.nItem == 1 && strcmp(rp.szItem, "my file.iso") == 0 && done == 512 && total == 2048, "mid copy");
+    FeedProgress(&rp, szOut + 63, sizeof(szOut) - 1 - 63);
+    RemoteProgressPosition(&rp, &done, &total);
+    bOk &= Expect(rp.bDone && done == 2048 && strcmp(rp.szErrors, "cp: cannot stat 'x': Permission denied\n") == 0,
+        "copy done, error kept");
+
+    /* Moves report items only */
+    RemoteProgressInit(&rp);
+    FeedProgress(&rp, "#sshfs-item 3 4 c\n", 18);
+    RemoteProgressPosition(&rp, &done, &total);
+    return bOk & Expect(done == 2 && total == 4, "move position");
+}
+
+/**
+ * The copy and move scripts run for real in a scratch folder
+ */
+static int CheckTransferScript(void)
+{
+    char szDir[256], szSrc[PATH_MAX], szDst[PATH_MAX], szSub[PATH_MAX], szA[PATH_MAX], szOut[4096];
+    char szCmd[4 * PATH_MAX + 2048];
+    const char *ppszSources[2];
+    static char data[40000];
+    RemoteProgress rp;
+    int bOk, status;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szSrc, sizeof(szSrc), "%s/src", szDir);
+    snprintf(szDst, sizeof(szDst), "%s/it's here", szDir);
+    snprintf(szSub, sizeof(szSub), "%s/src/sub dir", szDir);
+    snprintf(szA, sizeof(szA), "%s/src/a.txt", szDir);
+    memset(data, 'x', sizeof(data));
+    mkdir(szSrc, 0755);
+    mkdir(szDst, 0755);
+    mkdir(szSub, 0755);
+    bOk = Expect(WriteScratchFile(szDir, "src/a.txt", data, sizeof(data)) &&
+        WriteScratchFile(szDir, "src/sub dir/b.bin", data, 100), "scratch files");
+
+    ppszSources[0] = szA;
+    ppszSources[1] = szSub;
+    RemoteBuildTransferCommand(REMOTE_COPY, szDst, ppszSources, 2, szCmd, sizeof(szCmd));
+    RemoteProgressInit(&rp);
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), NULL);
+    FeedProgress(&rp, szOut, strlen(szOut));
+    /* du of a fresh copy need not match the source's to the block */
+    bOk &= Expect(status == 0 && rp.bDone && rp.nItems == 2 && rp.kbTotal > 0 && rp.kbDone > 0 &&
+        ScratchExists(szDir, "it's here/a.txt") && ScratchExists(szDir, "it's here/sub dir/b.bin") &&
+        ScratchExists(szDir, "src/a.txt"), "copy");
+
+    /* Again: nothing is overwritten */
+    RemoteProgressInit(&rp);
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), NULL);
+    FeedProgress(&rp, szOut, strlen(szOut));
+    bOk &= Expect(status == REMOTE_EXIT_EXISTS && rp.bExists && strcmp(rp.szItem, "a.txt") == 0 && !rp.bDone,
+        "copy onto existing names");
+
+    ppszSources[0] = szA;
+    RemoteBuildTransferCommand(REMOTE_MOVE, szSub, ppszSources, 1, szCmd, sizeof(szCmd));
+    RemoteProgressInit(&rp);
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), NULL);
+    FeedProgress(&rp, szOut, strlen(szOut));
+    bOk &= Expect(status == 0 && rp.bDone && rp.nItems == 1 && !ScratchExists(szDir, "src/a.txt") &&
+        ScratchExists(szDir, "src/sub dir/a.txt"), "move");
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static int CheckSessionName(void)
+{
+    char szA[REMOTE_SESSION_NAME_MAX], szB[REMOTE_SESSION_NAME_MAX];
+    int bOk;
+
+    RemoteSessionName("alice", "Files.Example.com", "", "~/", szA, sizeof(szA));
+    RemoteSessionName("alice", "files.example.com", "22", "", szB, sizeof(szB));
+    bOk = Expect(strcmp(szA, szB) == 0, "home, host case and default port normalized");
+    RemoteSessionName("alice", "files.example.com", "", "/srv/my app!/", szA, sizeof(szA));
+    bOk &= Expect(strncmp(szA, "sshfs-my_app_-", 14) == 0 && strlen(szA) == 26, "label and hash");
+    RemoteSessionName("alice", "files.example.com", "", "/srv/other/my app!", szB, sizeof(szB));
+    bOk &= Expect(strcmp(szA, szB) != 0, "same label, other folder");
+    return bOk;
+}
+
+/**
+ * Run the attach command with PATH set to pszPath and a stand-in login
+ * shell; stand-in multiplexers print what they were asked to do
+ */
+static int RunAttach(const char *pszDir, const char *pszPath, const char *pszEnv, const char *pszAttach,
+    char *out, size_t cbOut)
+{
+    char szCmd[PATH_MAX * 2 + 4096];
+    size_t cbOut2;
+
+    snprintf(szCmd, sizeof(szCmd), "PATH='%s'; SHELL='%s/shell'; %s export PATH SHELL; %s",
+        pszPath, pszDir, pszEnv, pszAttach);
+    return RunScript(szCmd, NULL, 0, out, cbOut, &cbOut2);
+}
+
+static int CheckAttachScript(void)
+{
+    char szDir[256], szPath[PATH_MAX], szName[REMOTE_SESSION_NAME_MAX], szAttach[2048], szScript[1024];
+    char szOut[1024], szWant[256];
+    int bOk, status;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    RemoteSessionName("alice", "files.example.com", "", "/srv/app", szName, sizeof(szName));
+
+    /*
+     * tmux lists our own session, one idle for ages, one attached, one
+     * active in the future and one that is not ours: only the idle one goes
+     */
+    snprintf(szScript, sizeof(szScript),
+        "#!/bin/sh\n"
+        "case $1 in\n"
+        "ls) printf '%%s\\n' 'sshfs-old 0 1' 'sshfs-busy 1 1' 'sshfs-fresh 0 99999999999' 'mine 0 1' '%s 0 1';;\n"
+        "new-session) echo \"tmux $*\"; exit ${TMUX_FAIL:-0};;\n"
+        "*) echo \"tmux $*\";;\n"
+        "esac\n", szName);
+    snprintf(szPath, sizeof(szPath), "%s/tmux-bin", szDir);
+    mkdir(szPath, 0755);
+    bOk = Expect(WriteScratchFile(szDir, "tmux-bin/tmux", szScript, strlen(szScript)) &&
+        WriteScratchFile(szDir, "shell", "#!/bin/sh\necho shell-ran\n", 25), "stand-ins");
+    snprintf(szScript, sizeof(szScript),
+        "#!/bin/sh\n"
+        "case $1 in\n"
+        "-ls) printf 'There is a screen on:\\n\\t4242.%%s\\t(Detached)\\n1 Socket in /tmp/screens.\\n' ${SCREEN_SESSION:-other};;\n"
+        "*) echo \"screen $*\";;\n"
+        "esac\n");
+    snprintf(szPath, sizeof(szPath), "%s/screen-bin", szDir);
+    mkdir(szPath, 0755);
+    bOk &= Expect(WriteScratchFile(szDir, "screen-bin/screen", szScript, strlen(szScript)), "stand-ins");
+    snprintf(szPath, sizeof(szPath), "%s/tmux-bin/tmux", szDir);
+    chmod(szPath, 0755);
+    snprintf(szPath, sizeof(szPath), "%s/screen-bin/screen", szDir);
+    chmod(szPath, 0755);
+    snprintf(szPath, sizeof(szPath), "%s/shell", szDir);
+    chmod(szPath, 0755);
+
+    RemoteBuildAttachCommand(szName, 24, szAttach, sizeof(szAttach));
+    bOk &= Expect(strchr(szAttach, '"') == NULL, "no double quotes");
+    snprintf(szPath, sizeof(szPath), "%s/tmux-bin:/usr/bin:/bin", szDir);
+    status = RunAttach(szDir, szPath, "", szAttach, szOut, sizeof(szOut));
+    snprintf(szWant, sizeof(szWant), "tmux kill-session -t =sshfs-old\ntmux new-session -A -s %s\n", szName);
+    bOk &= Expect(status == 0 && strcmp(szOut, szWant) == 0, "tmux attach, idle sessions reaped");
+    status = RunAttach(szDir, szPath, "TMUX_FAIL=1; export TMUX_FAIL;", szAttach, szOut, sizeof(szOut));
+    snprintf(szWant, sizeof(szWant), "tmux kill-session -t =sshfs-old\ntmux new-session -A -s %s\nshell-ran\n", szName);
+    bOk &= Expect(status == 0 && strcmp(szOut, szWant) == 0, "shell when tmux fails");
+
+    /* screen without tmux: reattach when the session is listed, else start it */
+    RemoteBuildAttachCommand(szName, 0, szAttach, sizeof(szAttach));
+    snprintf(szPath, sizeof(szPath), "%s/screen-bin", szDir);
+    status = RunAttach(szDir, szPath, "", szAttach, szOut, sizeof(szOut));
+    snprintf(szWant, sizeof(szWant), "screen -S %s\n", szName);
+    bOk &= Expect(status == 0 && strcmp(szOut, szWant) == 0, "screen session started");
+    snprintf(szScript, sizeof(szScript), "SCREEN_SESSION=%s; export SCREEN_SESSION;", szName);
+    status = RunAttach(szDir, szPath, szScript, szAttach, szOut, sizeof(szOut));
+    snprintf(szWant, sizeof(szWant), "screen -x %s\n", szName);
+    bOk &= Expect(status == 0 && strcmp(szOut, szWant) == 0, "screen session reattached");
+
+    /* Neither installed: the login shell */
+    snprintf(szPath, sizeof(szPath), "%s/none", szDir);
+    status = RunAttach(szDir, szPath, "", szAttach, szOut, sizeof(szOut));
+    bOk &= Expect(status == 0 && strcmp(szOut, "shell-ran\n") == 0, "shell without a multiplexer");
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"transfer-progress-64k", BenchTransferProgress, CheckTransferProgress, 500, 2000000},
+    {"transfer-command-1000", BenchTransferCommand, CheckTransferScript, 500,  200000},
+    {"attach-command",       BenchAttachCommand, CheckAttachScript,  400000, 5000},
+    {"session-name",         BenchSessionName,   CheckSessionName,   400000, 5000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,146 @@
+/**
+ * sshfs-perf-search.c
+ *
+ * Test of sshfs-search.c: the parser of the server's find, grep and rg
+ * output. Checked against the name and content searches run with /bin/sh
+ * on a scratch folder, then timed on 64 KB of content results.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-search sshfs-perf-search.c sshfs-perf.c sshfs-search.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-search.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static char *g_pSearchOut;
+static size_t g_cbSearchOut;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    /* A content search over a source tree: "path\0line:text\n" */
+    g_pSearchOut = malloc(PERF_OUTPUT_SIZE);
+    if (!g_pSearchOut)
+        return 0;
+    for (pos = 0, i = 0; pos + 256 < PERF_OUTPUT_SIZE; i++)
+    {
+        pos += (size_t)sprintf(g_pSearchOut + pos, "./src/module-%zu/file-%zu.c", i / 16, i / 4);
+        g_pSearchOut[pos++] = '\0';
+        pos += (size_t)sprintf(g_pSearchOut + pos, "%zu:    if (needle_%zu != NULL && strcmp(needle_%zu, key) == 0)\n",
+            i * 7 + 1, i, i);
+    }
+    g_cbSearchOut = pos;
+    return 1;
+}
+
+static void CountSearchResult(const SearchResult *pResult, void *pContext)
+{
+    *(size_t *)pContext += pResult->nLine + (unsigned char)pResult->pszText[0];
+}
+
+static void BenchSearchParse(size_t nOps)
+{
+    static SearchParser parser;
+    size_t i, pos, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        if (!SearchParserInit(&parser, 1))
+            return;
+        for (pos = 0; pos < g_cbSearchOut; pos += 4096)
+            SearchParserFeed(&parser, g_pSearchOut + pos, g_cbSearchOut - pos < 4096 ? g_cbSearchOut - pos : 4096,
+                CountSearchResult, &n);
+        SearchParserFree(&parser);
+    }
+    g_sink += n;
+}
+
+typedef struct SearchCheck {
+    char szResults[1024];           /* "path:line:text|" per result */
+    size_t cb;
+} SearchCheck;
+
+static void TakeSearchResult(const SearchResult *pResult, void *pContext)
+{
+    SearchCheck *sc = pContext;
+    int cch = snprintf(sc->szResults + sc->cb, sizeof(sc->szResults) - sc->cb, "%s:%lu:%s|",
+        pResult->pszPath, pResult->nLine, pResult->pszText);
+
+    if (cch > 0 && (size_t)cch < sizeof(sc->szResults) - sc->cb)
+        sc->cb += (size_t)cch;
+}
+
+/* Run a search script on the scratch folder and parse its output in small uneven reads */
+static int RunSearch(const char *pszDir, RemoteSearchMode mode, const char *pszQuery, SearchCheck *sc)
+{
+    static char szOut[16384];
+    char szCmd[PATH_MAX + 1024];
+    SearchParser parser;
+    size_t cbOut, pos, cb;
+    int status;
+
+    memset(sc, 0, sizeof(*sc));
+    RemoteBuildSearchCommand(pszDir, mode, pszQuery, szCmd, sizeof(szCmd));
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    if (!SearchParserInit(&parser, mode == REMOTE_SEARCH_CONTENTS))
+        return -1;
+    for (pos = 0; pos < cbOut; pos += cb)
+    {
+        cb = 1 + pos % 13;
+        if (cb > cbOut - pos)
+            cb = cbOut - pos;
+        SearchParserFeed(&parser, szOut + pos, cb, TakeSearchResult, sc);
+    }
+    SearchParserFree(&parser);
+    return status;
+}
+
+/**
+ * Both searches run for real on a scratch folder; results are sorted by
+ * the order find and grep walk the tree, so each is looked up on its own
+ */
+static int CheckSearchScript(void)
+{
+    char szDir[256], szSub[PATH_MAX];
+    SearchCheck sc;
+    int bOk, status;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szSub, sizeof(szSub), "%s/src dir", szDir);
+    mkdir(szSub, 0755);
+    bOk = Expect(WriteScratchFile(szDir, "notes.txt", "hello\nThe NEEDLE's eye\nbye\n", 27) &&
+        WriteScratchFile(szDir, "src dir/needle.c", "int x;\n", 7) &&
+        WriteScratchFile(szDir, "src dir/binary.bin", "needle\0\1\2", 9) &&
+        WriteScratchFile(szDir, "haystack.md", "no match\n", 9), "scratch files");
+
+    status = RunSearch(szDir, REMOTE_SEARCH_NAMES, "Needle", &sc);
+    bOk &= Expect(status == 0 && strcmp(sc.szResults, "src dir/needle.c:0:|") == 0, "name search");
+    status = RunSearch(szDir, REMOTE_SEARCH_NAMES, "*.md", &sc);
+    bOk &= Expect(status == 0 && strcmp(sc.szResults, "haystack.md:0:|") == 0, "name search with a pattern");
+
+    status = RunSearch(szDir, REMOTE_SEARCH_CONTENTS, "needle's", &sc);
+    bOk &= Expect(status == 0 && strcmp(sc.szResults, "notes.txt:2:The NEEDLE's eye|") == 0,
+        "content search, quote and case");
+    status = RunSearch(szDir, REMOTE_SEARCH_CONTENTS, "no such text", &sc);
+    bOk &= Expect(status == 1 && sc.cb == 0, "content search without a match");
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"search-parse-64k",     BenchSearchParse,   CheckSearchScript,  2000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
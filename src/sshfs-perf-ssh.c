@@ -0,0 +1,159 @@
+/**
+ * sshfs-perf-ssh.c
+ *
+ * Stand-in for ssh in the launch benchmark (sshfs-perf-launch.c): installed
+ * as "ssh" in a folder of its own that sshfs-perf-launch puts first in the
+ * launcher's PATH. It ignores its arguments and behaves like an ssh login
+ * with a password on a pty:
+ *
+ *   - prints "perf@bench's password: " and reads a line with echo off
+ *   - prints "Permission denied" and exits with 255 unless the line is
+ *     $SSHFS_PERF_PASSWORD ("perf" if unset)
+ *   - prints "#sshfs-perf ready", $SSHFS_PERF_OUTPUT_KB kilobytes of
+ *     listing-like output (0 if unset), "#sshfs-perf done" and exits with 0
+ *
+ * $SSHFS_PERF_DELAY_MS adds that much delay before the prompt and after the
+ * password, for a round trip to a server.
+ *
+ * Run as "magick" it stands in for ImageMagick in the thumbnail benchmark
+ * (sshfs-perf-thumbs.c), which runs the real server script locally: for
+ * "magick <file>[0] ... -thumbnail <n>x<n>> ... jpg:<out>" it writes a
+ * JPEG-framed blob of n*n/8 bytes to <out>, and fails for an empty or
+ * missing file the way a real decoder fails for a broken image.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static void Delay(long ms)
+{
+    struct timespec ts;
+
+    if (ms <= 0)
+        return;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static long GetEnvNumber(const char *pszName)
+{
+    const char *psz = getenv(pszName);
+    return psz ? strtol(psz, NULL, 10) : 0;
+}
+
+/**
+ * The "magick" stand-in; the bytes depend on the input so a mixup shows
+ */
+static int RunMagick(int argc, char *argv[])
+{
+    char szInput[4096];
+    const char *pszOutput = NULL;
+    unsigned char seed = 0;
+    long size = 0, cb, i;
+    FILE *f;
+    int c, argi;
+
+    if (argc < 3)
+        return 1;
+    snprintf(szInput, sizeof(szInput), "%s", argv[1]);
+    if (strlen(szInput) > 3 && strcmp(szInput + strlen(szInput) - 3, "[0]") == 0)
+        szInput[strlen(szInput) - 3] = '\0';
+    for (argi = 2; argi < argc; argi++)
+    {
+        if (strcmp(argv[argi], "-thumbnail") == 0 && argi + 1 < argc)
+            size = strtol(argv[++argi], NULL, 10);
+        else if (strncmp(argv[argi], "jpg:", 4) == 0)
+            pszOutput = argv[argi] + 4;
+    }
+    if (size <= 0 || !pszOutput)
+        return 1;
+
+    f = fopen(szInput, "rb");
+    if (!f || (c = fgetc(f)) == EOF)
+    {
+        if (f)
+            fclose(f);
+        return 1;
+    }
+    seed = (unsigned char)c;
+    fclose(f);
+
+    f = fopen(pszOutput, "wb");
+    if (!f)
+        return 1;
+    cb = size * size / 8;
+    fputc(0xFF, f);
+    fputc(0xD8, f);
+    for (i = 4; i < cb; i++)
+        fputc((int)(unsigned char)(seed + i), f);
+    fputc(0xFF, f);
+    fputc(0xD9, f);
+    return fclose(f) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pszPassword = getenv("SSHFS_PERF_PASSWORD");
+    long msDelay = GetEnvNumber("SSHFS_PERF_DELAY_MS");
+    long kbOutput = GetEnvNumber("SSHFS_PERF_OUTPUT_KB");
+    char szLine[512];
+    struct termios tio, tioSaved;
+    int bTty = tcgetattr(STDIN_FILENO, &tioSaved) == 0;
+    char szRow[128];
+    long cbLeft;
+    int nRow = 0;
+    const char *pszProgram = strrchr(argv[0], '/');
+
+    if (strcmp(pszProgram ? pszProgram + 1 : argv[0], "magick") == 0)
+        return RunMagick(argc, argv);
+
+    if (!pszPassword)
+        pszPassword = "perf";
+
+    Delay(msDelay);
+    fputs("perf@bench's password: ", stdout);
+    fflush(stdout);
+
+    if (bTty)
+    {
+        tio = tioSaved;
+        tio.c_lflag &= ~(tcflag_t)ECHO;
+        tcsetattr(STDIN_FILENO, TCSANOW, &tio);
+    }
+    if (!fgets(szLine, sizeof(szLine), stdin))
+        szLine[0] = '\0';
+    if (bTty)
+        tcsetattr(STDIN_FILENO, TCSANOW, &tioSaved);
+    szLine[strcspn(szLine, "\r\n")] = '\0';
+
+    fputs("\r\n", stdout);
+    if (strcmp(szLine, pszPassword) != 0)
+    {
+        fputs("Permission denied, please try again.\r\n", stdout);
+        return 255;
+    }
+
+    Delay(msDelay);
+    fputs("#sshfs-perf ready\r\n", stdout);
+
+    /* Roughly what "ls -l" of a big folder looks like, in full rows */
+    for (cbLeft = kbOutput * 1024; cbLeft > 0; cbLeft -= (long)strlen(szRow))
+    {
+        snprintf(szRow, sizeof(szRow),
+            "-rw-r--r-- 1 perf perf %8d Jan  1 00:00 \x1b[01;32mfile-%06d.dat\x1b[0m\r\n",
+            nRow * 37 % 99991, nRow);
+        fputs(szRow, stdout);
+        nRow++;
+    }
+
+    fputs("#sshfs-perf done\r\n", stdout);
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/**
+ * sshfs-perf-stats.c
+ *
+ * Test of sshfs-stats.c: the session counters the relay bumps on every
+ * read and write, and the title and JSON reports made from them once a
+ * second. Checked on a known RTT and rate, then timed.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-stats sshfs-perf-stats.c sshfs-perf.c sshfs-stats.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-stats.h"
+
+#include <string.h>
+
+static void BenchStatsHooks(size_t nOps)
+{
+    static SessionStats st;
+    size_t i;
+
+    /* The byte path: a keystroke out, a read of output back */
+    StatsInit(&st, 0);
+    for (i = 0; i < nOps; i++)
+    {
+        StatsOnSent(&st, 1, i);
+        StatsOnReceived(&st, 4096, i + 1);
+    }
+    g_sink += (size_t)st.cbReceived + (size_t)st.nRttSamples;
+}
+
+static void BenchStatsReport(size_t nOps)
+{
+    static SessionStats st;
+    StatsSampler sm;
+    StatsSnapshot snap;
+    char szTitle[64], szJson[512];
+    size_t i, n = 0;
+
+    StatsInit(&st, 0);
+    StatsSamplerInit(&sm, &st, 0);
+    for (i = 0; i < nOps; i++)
+    {
+        StatsOnReceived(&st, 65536, i * 1000);
+        StatsSample(&st, &sm, i * 1000 + 1000, &snap);
+        StatsFormatSummary(&snap, szTitle, sizeof(szTitle));
+        n += StatsFormatJson(&snap, "alice@files.example.com", szJson, sizeof(szJson)) + (unsigned char)szTitle[0];
+    }
+    g_sink += n;
+}
+
+static int CheckStats(void)
+{
+    SessionStats st;
+    StatsSampler sm;
+    StatsSnapshot snap;
+    char szTitle[64], szJson[512];
+    int bOk;
+
+    /* A keystroke echoed after 42 ms, and 1 KB in two seconds */
+    StatsInit(&st, 0);
+    StatsSamplerInit(&sm, &st, 0);
+    StatsOnSent(&st, 1, 1000);
+    StatsOnReceived(&st, 1023, 1042);
+    StatsSample(&st, &sm, 2000, &snap);
+    StatsFormatSummary(&snap, szTitle, sizeof(szTitle));
+    bOk = Expect(snap.msRtt == 42 && snap.msIdle == 958 && strcmp(szTitle, "42 ms | 512 B/s") == 0, "echo RTT and rate");
+
+    /* A paste is no keystroke, and an echo after the timeout is no sample */
+    StatsOnSent(&st, 4096, 2100);
+    StatsOnReceived(&st, 10, 2200);
+    StatsOnSent(&st, 1, 3000);
+    StatsOnReceived(&st, 1, 3000 + STATS_PROBE_TIMEOUT_MS + 1);
+    StatsSample(&st, &sm, 300000 + 3000 + STATS_PROBE_TIMEOUT_MS + 1, &snap);
+    StatsFormatSummary(&snap, szTitle, sizeof(szTitle));
+    bOk &= Expect(snap.nRttSamples == 1 && snap.cbSent == 4098, "only keystrokes probe");
+    bOk &= Expect(strcmp(szTitle, "42 ms | 14 B/s | idle 5m") == 0, "idle shown");
+
+    bOk &= Expect(StatsFormatJson(&snap, "al\"ice@h", szJson, sizeof(szJson)) > 0 &&
+        strstr(szJson, "\"target\":\"al\\\"ice@h\"") && strstr(szJson, "\"rtt_ms\":42,"), "JSON snapshot");
+    bOk &= Expect(StatsFormatJson(&snap, "alice@h", szJson, 32) == 0, "JSON that does not fit");
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"stats-byte-hooks",     BenchStatsHooks,    CheckStats,         4000000, 200},
+    {"stats-report",         BenchStatsReport,   CheckStats,         100000, 20000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, NULL, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,180 @@
+/**
+ * sshfs-perf-thumb.c
+ *
+ * Test of sshfs-thumb.c: the parser of the framed thumbnail stream from
+ * the server and the thumbnail cache entries. Checked on a stream cut into
+ * reads of any size and on entries of other files and versions, then
+ * timed parsing a thousand frames and looking up a cached thumbnail.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-thumb sshfs-perf-thumb.c sshfs-perf.c sshfs-thumb.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-thumb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PERF_THUMB_FRAMES   1000
+
+static char *g_pThumbStream;
+static size_t g_cbThumbStream;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    /* A folder of photos as the server sends it: mostly 4-12 KB thumbnails */
+    g_pThumbStream = malloc((size_t)PERF_THUMB_FRAMES * (12 * 1024 + 128) + 64);
+    if (!g_pThumbStream)
+        return 0;
+    pos = (size_t)sprintf(g_pThumbStream, "#sshfs-thumbs magick\n");
+    for (i = 0; i < PERF_THUMB_FRAMES; i++)
+    {
+        char szName[32];
+        size_t cbName = (size_t)sprintf(szName, "IMG_%04zu.JPG", i);
+        size_t cbData = i % 50 == 49 ? 0 : 4096 + (i * 7919) % (8 * 1024);
+
+        pos += (size_t)sprintf(g_pThumbStream + pos, "%c 1700000000 %zu %zu\n%s",
+            cbData ? 'T' : 'E', cbName, cbData, szName);
+        memset(g_pThumbStream + pos, (int)(i & 0xff), cbData);
+        pos += cbData;
+    }
+    pos += (size_t)sprintf(g_pThumbStream + pos, "#sshfs-thumbs end\n");
+    g_cbThumbStream = pos;
+    return 1;
+}
+
+static void CountThumbFrame(const ThumbFrame *pFrame, void *pContext)
+{
+    *(size_t *)pContext += pFrame->cbData + 1;
+}
+
+static void BenchThumbParse(size_t nOps)
+{
+    ThumbParser parser;
+    size_t i, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        size_t pos;
+
+        /* In reads of a pipe's size, so some frames are cut */
+        ThumbParserInit(&parser);
+        for (pos = 0; pos < g_cbThumbStream; pos += 16384)
+            ThumbParserFeed(&parser, g_pThumbStream + pos,
+                g_cbThumbStream - pos < 16384 ? g_cbThumbStream - pos : 16384, CountThumbFrame, &n);
+        n += parser.nFrames;
+        ThumbParserFree(&parser);
+    }
+    g_sink += n;
+}
+
+static void BenchThumbCache(size_t nOps)
+{
+    char szKey[512];
+    char szName[THUMB_CACHE_NAME_MAX];
+    char entry[1024];
+    ThumbKind kind;
+    size_t i, n = 0, cbOffset, cbData;
+
+    /* Looking one up: key, file name, and the check of what was read */
+    for (i = 0; i < nOps; i++)
+    {
+        size_t cb;
+
+        ThumbCacheKey("alice", "files.example.com", "", "/srv/photos/2024/summer/IMG_1234.JPG",
+            szKey, sizeof(szKey));
+        ThumbCacheName(szKey, 1700000000 + (long long)(i & 15), THUMB_DEFAULT_SIZE, '/', szName);
+        cb = ThumbCacheFormatHeader(szKey, 1700000000 + (long long)(i & 15), THUMB_DEFAULT_SIZE,
+            THUMB_IMAGE, 16, entry, sizeof(entry) - 16);
+        n += (unsigned char)szName[1] +
+            (size_t)ThumbCacheCheck(entry, cb + 16, szKey, 1700000000 + (long long)(i & 15),
+                THUMB_DEFAULT_SIZE, &kind, &cbOffset, &cbData);
+    }
+    g_sink += n;
+}
+
+typedef struct ThumbCheck {
+    unsigned long nImages, nFailed;
+    size_t cbData;
+    int bNamesOk;
+} ThumbCheck;
+
+static void CheckThumbFrame(const ThumbFrame *pFrame, void *pContext)
+{
+    ThumbCheck *c = (ThumbCheck *)pContext;
+    char szName[32];
+    unsigned long i = c->nImages + c->nFailed;
+
+    snprintf(szName, sizeof(szName), "IMG_%04lu.JPG", i);
+    if (pFrame->cbName != strlen(szName) || memcmp(pFrame->pName, szName, pFrame->cbName) != 0 ||
+        (pFrame->cbData && pFrame->pData[pFrame->cbData - 1] != (unsigned char)(i & 0xff)))
+        c->bNamesOk = 0;
+    if (pFrame->kind == THUMB_IMAGE)
+        c->nImages++;
+    else
+        c->nFailed++;
+    c->cbData += pFrame->cbData;
+}
+
+static int CheckThumbParse(void)
+{
+    static const size_t cbReads[] = {1, 7, 4096, 16384, 1 << 30};
+    ThumbParser parser;
+    ThumbCheck c;
+    size_t r, pos, cbFirst = 0;
+    int bOk = 1;
+
+    /* The same frames whatever the reads are cut into */
+    for (r = 0; r < sizeof(cbReads) / sizeof(cbReads[0]); r++)
+    {
+        memset(&c, 0, sizeof(c));
+        c.bNamesOk = 1;
+        ThumbParserInit(&parser);
+        for (pos = 0; pos < g_cbThumbStream && bOk; pos += cbReads[r])
+            bOk = ThumbParserFeed(&parser, g_pThumbStream + pos,
+                g_cbThumbStream - pos < cbReads[r] ? g_cbThumbStream - pos : cbReads[r], CheckThumbFrame, &c);
+        bOk = Expect(bOk && parser.bEnd && c.bNamesOk && c.nImages == PERF_THUMB_FRAMES - PERF_THUMB_FRAMES / 50 &&
+            c.nFailed == PERF_THUMB_FRAMES / 50 && strcmp(parser.szTool, "magick") == 0 &&
+            (r == 0 || c.cbData == cbFirst), "frames of the stream");
+        cbFirst = c.cbData;
+        ThumbParserFree(&parser);
+    }
+
+    ThumbParserInit(&parser);
+    bOk &= Expect(!ThumbParserFeed(&parser, "T 1 3 0\nabc", 11, CheckThumbFrame, &c), "image frame without data");
+    ThumbParserFree(&parser);
+    return bOk;
+}
+
+static int CheckThumbCache(void)
+{
+    char entry[1024];
+    ThumbKind kind;
+    size_t cb, cbOffset, cbData;
+    int bOk;
+
+    cb = ThumbCacheFormatHeader("alice@h:22:/a.jpg", 1700000000, 256, THUMB_IMAGE, 4, entry, sizeof(entry) - 4);
+    memcpy(entry + cb, "\xff\xd8\xff\xd9", 4);
+    bOk = Expect(ThumbCacheCheck(entry, cb + 4, "alice@h:22:/a.jpg", 1700000000, 256, &kind, &cbOffset, &cbData) &&
+        kind == THUMB_IMAGE && cbOffset == cb && cbData == 4, "entry read back");
+    bOk &= Expect(!ThumbCacheCheck(entry, cb + 4, "alice@h:22:/a.jpg", 1700000001, 256, &kind, &cbOffset, &cbData),
+        "entry of an older version of the file");
+    bOk &= Expect(!ThumbCacheCheck(entry, cb + 4, "alice@h:22:/b.jpg", 1700000000, 256, &kind, &cbOffset, &cbData),
+        "entry of another file");
+    bOk &= Expect(!ThumbCacheCheck(entry, cb + 3, "alice@h:22:/a.jpg", 1700000000, 256, &kind, &cbOffset, &cbData),
+        "truncated entry");
+    return bOk;
+}
+
+static const MicroBench g_benches[] = {
+    {"thumb-parse-1000",     BenchThumbParse,    CheckThumbParse,    200,    5000000},
+    {"thumb-cache-lookup",   BenchThumbCache,    CheckThumbCache,    400000, 10000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
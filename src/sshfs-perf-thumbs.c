@@ -0,0 +1,352 @@
+/**
+ * sshfs-perf-thumbs.c
+ *
+ * Thumbnail batch benchmark: the server script of "sshfs-ssh.exe --thumbs"
+ * run locally with /bin/sh over a folder of stand-in images, with a
+ * stand-in magick (sshfs-perf-ssh.c) first in PATH. Its frames are parsed
+ * and written to a cache, and every entry is read back and checked.
+ * Reports the time to the first thumbnail, per image, and for a cache hit.
+ *
+ * Usage: sshfs-perf-thumbs [--check] [--images <n>] <tool_dir>
+ *
+ * tool_dir holds the stand-in as "magick". With --check the exit status
+ * is 1 if the batch went wrong or a result is over its limit.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-thumbs sshfs-perf-thumbs.c sshfs-perf.c sshfs-thumb.c sshfs-remote.c
+ */
+
+#define _GNU_SOURCE
+
+#include "sshfs-perf.h"
+#include "sshfs-thumb.h"
+#include "sshfs-remote.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define PERF_THUMB_MAX_IMAGES 2000          /* Names that fit in a pipe's buffer */
+
+#define THUMBS_FIRST_LIMIT_MS   1000.0
+#define THUMBS_IMAGE_LIMIT_MS   50.0
+#define THUMBS_HIT_LIMIT_US     500.0
+
+typedef struct ThumbsRun {
+    char szCache[256];
+    char szDir[256];
+    int nImages;
+    int *pSeen;                     /* Frames per image */
+    int nImageFrames, nFailedFrames, nUnknown, nWriteErrors;
+    unsigned long long start;
+    double msFirst;
+} ThumbsRun;
+
+/**
+ * Image i of the folder: every tenth is empty, which the stand-in (like a
+ * real decoder for a broken file) cannot make a thumbnail of
+ */
+static void ThumbsImageName(int i, char *psz, size_t cch)
+{
+    snprintf(psz, cch, i % 3 ? "IMG_%04d.jpg" : "photo %04d (copy).JPEG", i);
+}
+
+static int ThumbsImageIndex(const char *pName, size_t cbName)
+{
+    char szName[64];
+    int i;
+
+    if (cbName >= sizeof(szName))
+        return -1;
+    memcpy(szName, pName, cbName);
+    szName[cbName] = '\0';
+    if (sscanf(szName, "IMG_%d.jpg", &i) != 1 && sscanf(szName, "photo %d", &i) != 1)
+        return -1;
+    return i;
+}
+
+static void ThumbsEntryPath(const ThumbsRun *r, int i, char *pszPath, size_t cch, char *pszKey, size_t cchKey,
+    long long *pMtime)
+{
+    char szRemote[512];
+    char szFile[64];
+    char szName[THUMB_CACHE_NAME_MAX];
+    struct stat st;
+
+    ThumbsImageName(i, szFile, sizeof(szFile));
+    snprintf(szRemote, sizeof(szRemote), "%s/%s", r->szDir, szFile);
+    *pMtime = stat(szRemote, &st) == 0 ? (long long)st.st_mtime : 0;
+    ThumbCacheKey("perf", "bench", "", szRemote, pszKey, cchKey);
+    ThumbCacheName(pszKey, *pMtime, THUMB_DEFAULT_SIZE, '/', szName);
+    snprintf(pszPath, cch, "%s/%s", r->szCache, szName);
+}
+
+/**
+ * What "--thumbs" does with a frame: write it to the cache
+ */
+static void TakeThumbFrame(const ThumbFrame *pFrame, void *pContext)
+{
+    ThumbsRun *r = (ThumbsRun *)pContext;
+    char szPath[512], szKey[512], szHeader[1024];
+    char *pszSep;
+    long long mtime;
+    size_t cbHeader;
+    FILE *f;
+    int i = ThumbsImageIndex(pFrame->pName, pFrame->cbName);
+
+    if (r->msFirst == 0)
+        r->msFirst = (double)(NowNs() - r->start) / 1e6;
+    if (i < 0 || i >= r->nImages)
+    {
+        r->nUnknown++;
+        return;
+    }
+    r->pSeen[i]++;
+    if (pFrame->kind == THUMB_IMAGE)
+        r->nImageFrames++;
+    else
+        r->nFailedFrames++;
+
+    ThumbsEntryPath(r, i, szPath, sizeof(szPath), szKey, sizeof(szKey), &mtime);
+    if (mtime != pFrame->mtime)
+    {
+        r->nWriteErrors++;
+        return;
+    }
+    cbHeader = ThumbCacheFormatHeader(szKey, pFrame->mtime, THUMB_DEFAULT_SIZE, pFrame->kind,
+        pFrame->cbData, szHeader, sizeof(szHeader));
+    pszSep = strrchr(szPath, '/');
+    *pszSep = '\0';
+    mkdir(szPath, 0700);        /* The entry's subfolder */
+    *pszSep = '/';
+    f = fopen(szPath, "wb");
+    if (!f || cbHeader >= sizeof(szHeader) || fwrite(szHeader, 1, cbHeader, f) != cbHeader ||
+        fwrite(pFrame->pData, 1, pFrame->cbData, f) != pFrame->cbData)
+        r->nWriteErrors++;
+    if (f && fclose(f) != 0)
+        r->nWriteErrors++;
+}
+
+/**
+ * One batch over nImages stand-in images; 0 with a message if it went wrong
+ */
+static int RunThumbsBatch(const char *pszToolDir, ThumbsRun *r, double *pmsTotal, double *pusHit)
+{
+    ThumbParser parser;
+    char *pszCmd = NULL;
+    char *pList = NULL;
+    char buffer[16384];
+    size_t cbCmd, cbList = 0;
+    int inFds[2] = {-1, -1}, outFds[2] = {-1, -1};
+    int i, status, bOk = 0;
+    unsigned long long startHits;
+    pid_t pid;
+
+    ThumbParserInit(&parser);
+    for (i = 0; i < r->nImages; i++)
+    {
+        char szName[64], szPath[512];
+        FILE *f;
+
+        ThumbsImageName(i, szName, sizeof(szName));
+        snprintf(szPath, sizeof(szPath), "%s/%s", r->szDir, szName);
+        f = fopen(szPath, "wb");
+        if (!f)
+            goto cleanup;
+        if (i % 10 != 9)
+            fputs("stand-in image data", f);
+        fclose(f);
+    }
+
+    cbCmd = RemoteBuildThumbCommand(r->szDir, THUMB_DEFAULT_SIZE, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pList = malloc((size_t)r->nImages * 64);
+    if (!pszCmd || !pList)
+        goto cleanup;
+    RemoteBuildThumbCommand(r->szDir, THUMB_DEFAULT_SIZE, pszCmd, cbCmd);
+    for (i = 0; i < r->nImages; i++)
+    {
+        ThumbsImageName(i, pList + cbList, 64);
+        cbList += strlen(pList + cbList);
+        pList[cbList++] = '\n';
+    }
+
+    if (pipe(inFds) != 0 || pipe(outFds) != 0)
+        goto cleanup;
+    r->start = NowNs();
+    pid = fork();
+    if (pid < 0)
+        goto cleanup;
+    if (pid == 0)
+    {
+        char szPath[8192];
+        const char *pszPath = getenv("PATH");
+
+        snprintf(szPath, sizeof(szPath), "%s:%s", pszToolDir, pszPath ? pszPath : "/usr/bin:/bin");
+        setenv("PATH", szPath, 1);
+        dup2(inFds[0], 0);
+        dup2(outFds[1], 1);
+        close(inFds[0]);
+        close(inFds[1]);
+        close(outFds[0]);
+        close(outFds[1]);
+        execl("/bin/sh", "sh", "-c", pszCmd, (char *)NULL);
+        _exit(127);
+    }
+    close(inFds[0]);
+    close(outFds[1]);
+    inFds[0] = outFds[1] = -1;
+
+    /* The whole list fits in the pipe, so it goes in before the output is read */
+    signal(SIGPIPE, SIG_IGN);
+    if (write(inFds[1], pList, cbList) != (ssize_t)cbList)
+        fprintf(stderr, "thumbs: could not write the whole list\n");
+    close(inFds[1]);
+    inFds[1] = -1;
+
+    for (;;)
+    {
+        ssize_t n = read(outFds[0], buffer, sizeof(buffer));
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (!ThumbParserFeed(&parser, buffer, (size_t)n, TakeThumbFrame, r))
+        {
+            fprintf(stderr, "thumbs: the server's output is not in the framed format\n");
+            kill(pid, SIGKILL);
+            break;
+        }
+    }
+    waitpid(pid, &status, 0);
+    *pmsTotal = (double)(NowNs() - r->start) / 1e6;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !parser.bEnd || parser.bNoTool ||
+        strcmp(parser.szTool, "magick") != 0)
+    {
+        fprintf(stderr, "thumbs: batch failed (exit %d, tool \"%s\", %s)\n",
+            WIFEXITED(status) ? WEXITSTATUS(status) : -1, parser.szTool, parser.bEnd ? "complete" : "cut short");
+        goto cleanup;
+    }
+    for (i = 0; i < r->nImages; i++)
+    {
+        if (r->pSeen[i] != 1)
+        {
+            fprintf(stderr, "thumbs: %d frames for image %d\n", r->pSeen[i], i);
+            goto cleanup;
+        }
+    }
+    if (r->nUnknown || r->nWriteErrors || r->nFailedFrames != r->nImages / 10)
+    {
+        fprintf(stderr, "thumbs: %d unknown names, %d cache errors, %d failed of %d\n",
+            r->nUnknown, r->nWriteErrors, r->nFailedFrames, r->nImages);
+        goto cleanup;
+    }
+
+    /* Every entry read back the way the provider does: key, mtime and size must match */
+    startHits = NowNs();
+    for (i = 0; i < r->nImages; i++)
+    {
+        static char entry[THUMB_MAX_DATA + 4096];
+        char szPath[512], szKey[512];
+        long long mtime;
+        ThumbKind kind;
+        size_t cb, cbOffset, cbData;
+        FILE *f;
+
+        ThumbsEntryPath(r, i, szPath, sizeof(szPath), szKey, sizeof(szKey), &mtime);
+        f = fopen(szPath, "rb");
+        cb = f ? fread(entry, 1, sizeof(entry), f) : 0;
+        if (f)
+            fclose(f);
+        if (!ThumbCacheCheck(entry, cb, szKey, mtime, THUMB_DEFAULT_SIZE, &kind, &cbOffset, &cbData) ||
+            (kind == THUMB_IMAGE) != (i % 10 != 9) ||
+            (kind == THUMB_IMAGE && (cbData != THUMB_DEFAULT_SIZE * THUMB_DEFAULT_SIZE / 8 ||
+                (unsigned char)entry[cbOffset] != 0xFF || (unsigned char)entry[cbOffset + 1] != 0xD8)))
+        {
+            fprintf(stderr, "thumbs: bad cache entry for image %d\n", i);
+            goto cleanup;
+        }
+    }
+    *pusHit = (double)(NowNs() - startHits) / 1e3 / r->nImages;
+    bOk = 1;
+
+cleanup:
+    if (inFds[0] >= 0)
+        close(inFds[0]);
+    if (inFds[1] >= 0)
+        close(inFds[1]);
+    if (outFds[0] >= 0)
+        close(outFds[0]);
+    if (outFds[1] >= 0)
+        close(outFds[1]);
+    ThumbParserFree(&parser);
+    free(pszCmd);
+    free(pList);
+    return bOk;
+}
+
+static void RunThumbs(const char *pszToolDir, int nImages)
+{
+    ThumbsRun r;
+    const char *pszTmp = getenv("TMPDIR");
+    double msTotal = 0, usHit = 0;
+    char szToolDir[4096];
+    int bOk = 0;
+
+    memset(&r, 0, sizeof(r));
+    r.nImages = nImages;
+    r.pSeen = calloc((size_t)nImages, sizeof(int));
+    snprintf(r.szDir, sizeof(r.szDir), "%s/sshfs-perf-images.XXXXXX", pszTmp ? pszTmp : "/tmp");
+    snprintf(r.szCache, sizeof(r.szCache), "%s/sshfs-perf-cache.XXXXXX", pszTmp ? pszTmp : "/tmp");
+    /* The script cds into the folder, so a relative PATH entry would not do */
+    if (r.pSeen && realpath(pszToolDir, szToolDir) && mkdtemp(r.szDir) && mkdtemp(r.szCache))
+        bOk = RunThumbsBatch(szToolDir, &r, &msTotal, &usHit);
+
+    if (!bOk)
+    {
+        PrintFailed("thumbs-first", "ms", THUMBS_FIRST_LIMIT_MS);
+    }
+    else
+    {
+        PrintResult("thumbs-first", r.msFirst, "ms", THUMBS_FIRST_LIMIT_MS);
+        PrintResult("thumbs-per-image", msTotal / nImages, "ms", THUMBS_IMAGE_LIMIT_MS);
+        PrintResult("thumbs-cache-hit", usHit, "us", THUMBS_HIT_LIMIT_US);
+    }
+
+    if (r.szDir[0] && strstr(r.szDir, "XXXXXX") == NULL)
+        RemoveScratch(r.szDir);
+    if (r.szCache[0] && strstr(r.szCache, "XXXXXX") == NULL)
+        RemoveScratch(r.szCache);
+    free(r.pSeen);
+}
+
+int main(int argc, char *argv[])
+{
+    int bCheck = 0, nImages = 200;
+    int argi;
+
+    for (argi = 1; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "--check") == 0)
+            bCheck = 1;
+        else if (strcmp(argv[argi], "--images") == 0 && argi + 1 < argc)
+            nImages = atoi(argv[++argi]);
+        else
+            break;
+    }
+    if (argc - argi != 1 || nImages < 10 || nImages > PERF_THUMB_MAX_IMAGES)
+    {
+        fprintf(stderr, "Usage: %s [--check] [--images <n>] <tool_dir>\n", argv[0]);
+        return 2;
+    }
+
+    PrintHeader();
+    RunThumbs(argv[argi], nImages);
+    return bCheck && PerfFailed() ? 1 : 0;
+}
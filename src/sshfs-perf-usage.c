@@ -0,0 +1,173 @@
+/**
+ * sshfs-perf-usage.c
+ *
+ * Test of sshfs-usage.c: the folder size tree built from du output as it
+ * arrives. Checked on known output in uneven reads and against the usage
+ * command run with /bin/sh on a scratch folder, then timed on 64 KB of
+ * du -0 output.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-usage sshfs-perf-usage.c sshfs-perf.c sshfs-usage.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-usage.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static char *g_pPaste;
+static char *g_pDuOut;
+static size_t g_cbDuOut;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    g_pPaste = MakePaste(PERF_PASTE_SIZE);
+    if (!g_pPaste)
+        return 0;
+
+    /* du -0 over a source tree: each folder after its children */
+    g_pDuOut = malloc(PERF_OUTPUT_SIZE + 256);
+    if (!g_pDuOut)
+        return 0;
+    pos = (size_t)sprintf(g_pDuOut, "#time 1700000000") + 1;
+    for (i = 0; pos + 256 < PERF_OUTPUT_SIZE; i++)
+    {
+        pos += (size_t)sprintf(g_pDuOut + pos, "%zu\t./src/module-%zu/dir-%zu", i * 37 % 5000, i / 8, i % 8) + 1;
+        if (i % 8 == 7)
+            pos += (size_t)sprintf(g_pDuOut + pos, "%zu\t./src/module-%zu", i * 300, i / 8) + 1;
+    }
+    pos += (size_t)sprintf(g_pDuOut + pos, "%zu\t./src/module-%zu", i * 300, i / 8) + 1;
+    pos += (size_t)sprintf(g_pDuOut + pos, "%zu\t./src", i * 5000) + 1;
+    pos += (size_t)sprintf(g_pDuOut + pos, "%zu\t.", i * 5000) + 1;
+    g_cbDuOut = pos;
+    return 1;
+}
+
+static void BenchUsageTree(size_t nOps)
+{
+    static UsageTree tree;
+    size_t i, pos, n = 0;
+
+    for (i = 0; i < nOps; i++)
+    {
+        if (!UsageTreeInit(&tree))
+            return;
+        for (pos = 0; pos < g_cbDuOut; pos += 4096)
+            UsageTreeFeed(&tree, g_pDuOut + pos, g_cbDuOut - pos < 4096 ? g_cbDuOut - pos : 4096);
+        n += (size_t)UsageTreeFinish(&tree) + tree.nNodes;
+        UsageTreeFree(&tree);
+    }
+    g_sink += n;
+}
+
+/* Feed du output in small uneven reads, so records span them */
+static int FeedUsage(UsageTree *t, const char *data, size_t len)
+{
+    size_t pos, cb;
+
+    for (pos = 0; pos < len; pos += cb)
+    {
+        cb = 1 + pos % 11;
+        if (cb > len - pos)
+            cb = len - pos;
+        if (!UsageTreeFeed(t, data + pos, cb))
+            return 0;
+    }
+    return UsageTreeFinish(t);
+}
+
+static int CheckUsageParse(void)
+{
+    static const char szLines[] = "#time 1700000000\0#lines\0" "8\t./a/b\n12\t./a\n4\t./c d\n40\t.\n";
+    char szPath[64], szHeader[256];
+    UsageTree t;
+    const UsageNode *root;
+    size_t cbHeader;
+    int bOk;
+
+    /* du without -0: newline records after "#lines" */
+    if (!UsageTreeInit(&t))
+        return Expect(0, "out of memory");
+    bOk = Expect(FeedUsage(&t, szLines, sizeof(szLines) - 1) && t.serverTime == 1700000000, "line records");
+    root = &t.pNodes[t.iRoot];
+    bOk &= Expect(root->cbSize == 40 * 1024 && root->nKids == 2 &&
+        strcmp(UsageNodeName(&t, t.pKids[root->iKids]), "a") == 0 &&
+        strcmp(UsageNodeName(&t, t.pKids[root->iKids + 1]), "c d") == 0 && UsageOwnFiles(&t, t.iRoot) == 24 * 1024,
+        "children largest first, own files");
+    bOk &= Expect(UsageNodePath(&t, t.pKids[t.pNodes[t.pKids[root->iKids]].iKids], '/', szPath, sizeof(szPath)) &&
+        strcmp(szPath, "a/b") == 0, "path of a folder");
+    UsageTreeFree(&t);
+
+    cbHeader = UsageCacheFormatHeader("~/projects", szHeader, sizeof(szHeader));
+    bOk &= Expect(cbHeader > 0 && cbHeader < sizeof(szHeader) &&
+        UsageCacheCheckHeader(szHeader, cbHeader, "~/projects") == cbHeader &&
+        UsageCacheCheckHeader(szHeader, cbHeader, "~/project") == 0, "cache header");
+    return bOk;
+}
+
+/**
+ * du runs for real on a scratch folder; a second run with the time of
+ * the first finds nothing newer and answers "#fresh"
+ */
+static int CheckUsageScript(void)
+{
+    static char szOut[16384];
+    char szDir[256], szPath[PATH_MAX], szCmd[PATH_MAX + 1024];
+    const UsageNode *root, *a;
+    size_t cbOut;
+    UsageTree t;
+    int bOk, status;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szPath, sizeof(szPath), "%s/a", szDir);
+    mkdir(szPath, 0755);
+    snprintf(szPath, sizeof(szPath), "%s/a/b", szDir);
+    mkdir(szPath, 0755);
+    snprintf(szPath, sizeof(szPath), "%s/c", szDir);
+    mkdir(szPath, 0755);
+    bOk = Expect(WriteScratchFile(szDir, "a/b/big", g_pPaste, 200000) && WriteScratchFile(szDir, "c/small", g_pPaste, 100),
+        "scratch files");
+
+    RemoteBuildUsageCommand(szDir, -1, szCmd, sizeof(szCmd));
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    if (!UsageTreeInit(&t))
+        return Expect(0, "out of memory");
+    bOk &= Expect(status == 0 && FeedUsage(&t, szOut, cbOut) && t.serverTime > 0 && t.nNodes == 4, "du listing");
+    root = &t.pNodes[t.iRoot];
+    a = &t.pNodes[t.pKids[root->iKids]];
+    bOk &= Expect(root->nKids == 2 && strcmp(UsageNodeName(&t, t.pKids[root->iKids]), "a") == 0 &&
+        a->cbSize >= 200000 && root->cbSize >= a->cbSize + t.pNodes[t.pKids[root->iKids + 1]].cbSize, "du tree");
+
+    RemoteBuildUsageCommand(szDir, t.serverTime + 2, szCmd, sizeof(szCmd));
+    UsageTreeFree(&t);
+    status = RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+    if (!UsageTreeInit(&t))
+        return Expect(0, "out of memory");
+    FeedUsage(&t, szOut, cbOut);
+    bOk &= Expect(status == 0 && t.bFresh, "cache still fresh");
+    UsageTreeFree(&t);
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static int CheckUsage(void)
+{
+    return CheckUsageParse() & CheckUsageScript();
+}
+
+static const MicroBench g_benches[] = {
+    {"usage-tree-64k",       BenchUsageTree,     CheckUsage,         2000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
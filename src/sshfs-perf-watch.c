@@ -0,0 +1,217 @@
+/**
+ * sshfs-perf-watch.c
+ *
+ * Test of sshfs-watch.c: the parser of the server's change stream and the
+ * coalescer that turns it into Explorer notifications. Checked on known
+ * event sequences and against the watch command run with /bin/sh on a
+ * scratch folder, then timed on a 64 KB storm of events from a build.
+ *
+ * Compile with: gcc -O2 -o sshfs-perf-watch sshfs-perf-watch.c sshfs-perf.c sshfs-watch.c sshfs-remote.c
+ */
+
+#include "sshfs-perf.h"
+#include "sshfs-watch.h"
+#include "sshfs-remote.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static char *g_pWatchOut;
+static size_t g_cbWatchOut;
+
+static int SetUp(void)
+{
+    size_t i, pos;
+
+    /* An event storm from a build: files written, rewritten and removed */
+    g_pWatchOut = malloc(PERF_OUTPUT_SIZE);
+    if (!g_pWatchOut)
+        return 0;
+    for (pos = 0, i = 0; pos + 256 < PERF_OUTPUT_SIZE; i++)
+    {
+        static const char *const apszEvents[] = {"CREATE", "MODIFY", "CLOSE_WRITE,CLOSE", "ATTRIB", "DELETE"};
+        pos += (size_t)sprintf(g_pWatchOut + pos, "%s\t./build/module-%zu/obj-%zu.o\n",
+            apszEvents[i % 5], i % 400 / 20, i % 400);
+    }
+    g_cbWatchOut = pos;
+    return 1;
+}
+
+static void CountNotify(WatchNotify kind, const char *pszPath, void *pContext)
+{
+    (void)pszPath;
+    *(size_t *)pContext += (size_t)kind + 1;
+}
+
+static void AddWatchEvent(const WatchEvent *pEvent, void *pContext)
+{
+    WatchCoalescerAdd((WatchCoalescer *)pContext, pEvent, 0);
+}
+
+static void BenchWatchStorm(size_t nOps)
+{
+    static WatchParser parser;
+    static WatchCoalescer c;
+    size_t i, pos, n = 0;
+
+    if (!WatchParserInit(&parser))
+        return;
+    WatchCoalescerInit(&c);
+    for (i = 0; i < nOps; i++)
+    {
+        for (pos = 0; pos < g_cbWatchOut; pos += 4096)
+            WatchParserFeed(&parser, g_pWatchOut + pos, g_cbWatchOut - pos < 4096 ? g_cbWatchOut - pos : 4096,
+                AddWatchEvent, &c);
+        WatchCoalescerFlush(&c, CountNotify, &n);
+    }
+    WatchCoalescerFree(&c);
+    WatchParserFree(&parser);
+    g_sink += n;
+}
+
+typedef struct WatchLog {
+    WatchCoalescer c;
+    unsigned long long msNow;
+    char sz[1024];
+    size_t cch;
+} WatchLog;
+
+static void LogWatchEvent(const WatchEvent *pEvent, void *pContext)
+{
+    WatchLog *log = (WatchLog *)pContext;
+    WatchCoalescerAdd(&log->c, pEvent, log->msNow);
+}
+
+/* "c:" create, "d:" delete, "m:"/"r:" mkdir/rmdir, "u:"/"U:" update item/folder */
+static void LogWatchNotify(WatchNotify kind, const char *pszPath, void *pContext)
+{
+    WatchLog *log = (WatchLog *)pContext;
+
+    if (log->cch + strlen(pszPath) + 4 < sizeof(log->sz))
+        log->cch += (size_t)sprintf(log->sz + log->cch, "%c:%s|", "cdmruU"[kind], pszPath);
+}
+
+/* Feed a stream in small uneven reads, so records span them */
+static void FeedWatch(WatchParser *p, WatchLog *log, const char *data, size_t len)
+{
+    size_t pos, cb;
+
+    for (pos = 0; pos < len; pos += cb)
+    {
+        cb = 1 + pos % 7;
+        if (cb > len - pos)
+            cb = len - pos;
+        WatchParserFeed(p, data + pos, cb, LogWatchEvent, log);
+    }
+}
+
+static int CheckWatchCoalesce(void)
+{
+    static const char szEvents[] =
+        "CREATE\t./a.txt\n" "CLOSE_WRITE,CLOSE\t./a.txt\n" "DELETE\t./a.txt\n"
+        "CREATE,ISDIR\t./d/\n" "MODIFY\t./b.txt\n" "CLOSE_WRITE,CLOSE\t./b.txt\n"
+        "DELETE\t./c.txt\n" "MOVED_FROM\t./e.txt\n" "MOVED_TO\t./e.txt\n"
+        "OPEN\t./f\n" "BOGUS\t./g\n" "DELETE,ISDIR\t./sub/old\n";
+    static WatchLog log;
+    WatchParser p;
+    char szRecord[64];
+    int bOk, i;
+
+    if (!WatchParserInit(&p))
+        return Expect(0, "out of memory");
+    WatchCoalescerInit(&log.c);
+    log.msNow = 1000;
+    FeedWatch(&p, &log, szEvents, sizeof(szEvents) - 1);
+    bOk = Expect(p.nEvents == 10 && p.nSkipped == 1, "event records");
+    bOk &= Expect(WatchCoalescerDue(&log.c, 1000) == WATCH_QUIET_MS && WatchCoalescerDue(&log.c, 1200) == 0,
+        "quiet period");
+    log.cch = 0;
+    WatchCoalescerFlush(&log.c, LogWatchNotify, &log);
+    bOk &= Expect(strcmp(log.sz, "m:d|u:b.txt|d:c.txt|u:e.txt|r:sub/old|") == 0, "net change per path");
+    bOk &= Expect(WatchCoalescerDue(&log.c, 5000) == (unsigned long)-1, "nothing pending after a flush");
+
+    /* A steady trickle is still flushed after WATCH_MAX_DELAY_MS */
+    for (log.msNow = 0; log.msNow <= 1500; log.msNow += 100)
+        FeedWatch(&p, &log, "MODIFY\t./log.txt\n", 17);
+    bOk &= Expect(WatchCoalescerDue(&log.c, 1500) == 0, "maximum delay");
+    log.cch = 0;
+    WatchCoalescerFlush(&log.c, LogWatchNotify, &log);
+    bOk &= Expect(strcmp(log.sz, "u:log.txt|") == 0, "one notification for a trickle");
+
+    /* A busy folder is refreshed as a whole, an overflow refreshes the tree */
+    for (i = 0; i <= WATCH_DIR_LIMIT; i++)
+    {
+        snprintf(szRecord, sizeof(szRecord), "CREATE\t./big/file-%d\n", i);
+        FeedWatch(&p, &log, szRecord, strlen(szRecord));
+    }
+    FeedWatch(&p, &log, "CREATE\t./small\n", 15);
+    log.cch = 0;
+    WatchCoalescerFlush(&log.c, LogWatchNotify, &log);
+    bOk &= Expect(strcmp(log.sz, "U:big|c:small|") == 0, "busy folder");
+    FeedWatch(&p, &log, "CREATE\t./x\nQ_OVERFLOW\t.\n", 24);
+    log.cch = 0;
+    WatchCoalescerFlush(&log.c, LogWatchNotify, &log);
+    bOk &= Expect(strcmp(log.sz, "U:|") == 0, "overflow");
+
+    WatchCoalescerFree(&log.c);
+    WatchParserFree(&p);
+    return bOk;
+}
+
+/**
+ * The watch command run for real on a scratch folder: inotifywait, or
+ * without it the find loop, has to report a file and a folder made
+ * between two polls
+ */
+static int CheckWatchScript(void)
+{
+    static char szOut[16384];
+    static WatchLog log;
+    char szDir[256], szPath[PATH_MAX], szCmd[PATH_MAX * 2 + 256];
+    size_t cbOut, cbCmd;
+    WatchParser p;
+    int bOk;
+
+    if (!MakeScratch(szDir, sizeof(szDir)))
+        return Expect(0, "scratch folder");
+    snprintf(szPath, sizeof(szPath), "%s/tree", szDir);
+    mkdir(szPath, 0755);
+    cbCmd = RemoteBuildWatchCommand(szPath, 1, szCmd, sizeof(szCmd));
+    bOk = Expect(cbCmd < sizeof(szCmd) && WriteScratchFile(szDir, "watch.sh", szCmd, cbCmd), "watch script");
+
+    /* Poll twice; the changes land between the polls */
+    snprintf(szCmd, sizeof(szCmd), "(cd '%s' && sleep 1.3 && : > new.txt && mkdir sub) & "
+        "timeout 2.6 sh '%s/watch.sh'; wait", szPath, szDir);
+    RunScript(szCmd, NULL, 0, szOut, sizeof(szOut), &cbOut);
+
+    if (!WatchParserInit(&p))
+        return Expect(0, "out of memory");
+    WatchCoalescerInit(&log.c);
+    FeedWatch(&p, &log, szOut, cbOut);
+    log.cch = 0;
+    WatchCoalescerFlush(&log.c, LogWatchNotify, &log);
+    bOk &= Expect((strstr(log.sz, "u:new.txt|") || strstr(log.sz, "c:new.txt|")) &&
+        (strstr(log.sz, "U:sub|") || strstr(log.sz, "m:sub|")), "changes seen");
+    WatchCoalescerFree(&log.c);
+    WatchParserFree(&p);
+
+    RemoveScratch(szDir);
+    return bOk;
+}
+
+static int CheckWatch(void)
+{
+    return CheckWatchCoalesce() & CheckWatchScript();
+}
+
+static const MicroBench g_benches[] = {
+    {"watch-storm-64k",      BenchWatchStorm,    CheckWatch,         2000,   2000000}
+};
+
+int main(int argc, char *argv[])
+{
+    return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+}
@@ -0,0 +1,313 @@
+/**
+ * sshfs-perf.c
+ *
+ * Harness of the module tests (sshfs-perf.h): option parsing, the timing
+ * loop and result report, and the inputs and scratch folders the checks
+ * share.
+ */
+
+#define _GNU_SOURCE
+
+#include "sshfs-perf.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+volatile size_t g_sink;
+
+static int g_bFailed = 0;
+
+unsigned long long NowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+int Expect(int bOk, const char *pszWhat)
+{
+    if (!bOk)
+        printf("  check failed: %s\n", pszWhat);
+    return bOk;
+}
+
+void PrintHeader(void)
+{
+    printf("%-24s %14s %-6s %14s  %s\n", "benchmark", "result", "unit", "limit", "status");
+}
+
+void PrintResult(const char *pszName, double value, const char *pszUnit, double limit)
+{
+    int bOver = value > limit;
+
+    printf("%-24s %14.1f %-6s %14.1f  %s\n", pszName, value, pszUnit, limit, bOver ? "REGRESSED" : "ok");
+    fflush(stdout);
+    if (bOver)
+        g_bFailed = 1;
+}
+
+void PrintFailed(const char *pszName, const char *pszUnit, double limit)
+{
+    printf("%-24s %14s %-6s %14.1f  %s\n", pszName, "-", pszUnit, limit, "FAILED");
+    fflush(stdout);
+    g_bFailed = 1;
+}
+
+int PerfFailed(void)
+{
+    return g_bFailed;
+}
+
+static void RunMicro(const MicroBench *mb, int bQuick)
+{
+    size_t nOps = bQuick ? mb->nOps / 10 : mb->nOps;
+    double best = 0;
+    int r;
+
+    if (nOps == 0)
+        nOps = 1;
+
+    if (mb->pfnCheck && !mb->pfnCheck())
+    {
+        printf("%-24s %14s %-6s %14s  %s\n", mb->pszName, "-", "check", "-", "FAILED");
+        fflush(stdout);
+        g_bFailed = 1;
+        return;
+    }
+
+    /* Warm caches and the branch predictor first */
+    mb->pfnRun(nOps / 10 + 1);
+
+    for (r = 0; r < (bQuick ? 3 : PERF_REPEATS); r++)
+    {
+        unsigned long long start = NowNs();
+        double ns;
+
+        mb->pfnRun(nOps);
+        ns = (double)(NowNs() - start) / (double)nOps;
+        if (r == 0 || ns < best)
+            best = ns;
+    }
+    PrintResult(mb->pszName, best, "ns/op", mb->limitNs);
+}
+
+int PerfMain(int argc, char *argv[], int (*pfnSetUp)(void), const MicroBench *pBenches, size_t nBenches)
+{
+    const char *pszOnly = NULL;
+    int bQuick = 0, bCheck = 0;
+    size_t i, nRun = 0;
+    int argi;
+
+    for (argi = 1; argi < argc; argi++)
+    {
+        if (strcmp(argv[argi], "--quick") == 0)
+            bQuick = 1;
+        else if (strcmp(argv[argi], "--check") == 0)
+            bCheck = 1;
+        else if (strcmp(argv[argi], "--only") == 0 && argi + 1 < argc)
+            pszOnly = argv[++argi];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--quick] [--check] [--only <name>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (pfnSetUp && !pfnSetUp())
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+
+    PrintHeader();
+    for (i = 0; i < nBenches; i++)
+    {
+        if (pszOnly && strcmp(pszOnly, pBenches[i].pszName) != 0)
+            continue;
+        RunMicro(&pBenches[i], bQuick);
+        nRun++;
+    }
+    if (nRun == 0)
+    {
+        fprintf(stderr, "No benchmark named %s\n", pszOnly);
+        return 2;
+    }
+    return bCheck && g_bFailed ? 1 : 0;
+}
+
+/*
+ * Inputs
+ */
+char *MakeTerminalOutput(size_t cb)
+{
+    char *p = malloc(cb);
+    size_t pos;
+    int nRow = 0;
+
+    for (pos = 0; p && pos < cb; nRow++)
+    {
+        char szRow[160];
+        int cch = nRow % 64 == 63
+            ? snprintf(szRow, sizeof(szRow), "\x1b]7;file://host/home/alice/project/dir-%d\x07$ ", nRow)
+            : snprintf(szRow, sizeof(szRow),
+                "drwxr-xr-x 2 alice alice 4096 Jan  1 00:00 \x1b[01;34mdir-%06d\x1b[0m\r\n", nRow);
+        size_t cbRow = (size_t)cch < cb - pos ? (size_t)cch : cb - pos;
+
+        memcpy(p + pos, szRow, cbRow);
+        pos += cbRow;
+    }
+    return p;
+}
+
+char *MakePaste(size_t cb)
+{
+    char *p = malloc(cb);
+    size_t pos;
+
+    if (!p)
+        return NULL;
+    memcpy(p, "\x1b[200~", 6);
+    for (pos = 6; pos < cb - 6; pos++)
+        p[pos] = "    if (x) return y;\n"[pos % 21];
+    memcpy(p + cb - 6, "\x1b[201~", 6);
+    return p;
+}
+
+int AppendMem(const void *p, size_t cb, void *pContext)
+{
+    MemBuffer *mb = pContext;
+
+    if (mb->cb + cb > mb->cbAlloc)
+    {
+        size_t cbAlloc = (mb->cb + cb) * 2;
+        char *pNew = realloc(mb->p, cbAlloc);
+        if (!pNew)
+            return 0;
+        mb->p = pNew;
+        mb->cbAlloc = cbAlloc;
+    }
+    memcpy(mb->p + mb->cb, p, cb);
+    mb->cb += cb;
+    return 1;
+}
+
+/*
+ * Scratch folders
+ */
+static int RemoveEntry(const char *pszPath, const struct stat *pst, int flag, struct FTW *pftw)
+{
+    (void)pst;
+    (void)flag;
+    (void)pftw;
+    remove(pszPath);
+    return 0;
+}
+
+int MakeScratch(char *pszDir, size_t cch)
+{
+    const char *pszTmp = getenv("TMPDIR");
+
+    snprintf(pszDir, cch, "%s/sshfs-perf-XXXXXX", pszTmp && pszTmp[0] ? pszTmp : "/tmp");
+    return mkdtemp(pszDir) != NULL;
+}
+
+void RemoveScratch(const char *pszDir)
+{
+    nftw(pszDir, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int WriteScratchFile(const char *pszDir, const char *pszName, const char *pData, size_t cb)
+{
+    char szPath[PATH_MAX];
+    FILE *f;
+    int bOk;
+
+    snprintf(szPath, sizeof(szPath), "%s/%s", pszDir, pszName);
+    f = fopen(szPath, "wb");
+    if (!f)
+        return 0;
+    bOk = fwrite(pData, 1, cb, f) == cb;
+    return fclose(f) == 0 && bOk;
+}
+
+int ScratchExists(const char *pszDir, const char *pszName)
+{
+    char szPath[PATH_MAX];
+    struct stat st;
+
+    snprintf(szPath, sizeof(szPath), "%s/%s", pszDir, pszName);
+    return lstat(szPath, &st) == 0;
+}
+
+int RunScript(const char *pszCmd, const char *pIn, size_t cbIn, char *out, size_t cbOut, size_t *pcbOut)
+{
+    int inFds[2], outFds[2], status = 0;
+    size_t cb = 0;
+    pid_t pid;
+
+    if (pipe(inFds) != 0)
+        return -1;
+    if (pipe(outFds) != 0)
+    {
+        close(inFds[0]);
+        close(inFds[1]);
+        return -1;
+    }
+    pid = fork();
+    if (pid == 0)
+    {
+        dup2(inFds[0], 0);
+        dup2(outFds[1], 1);
+        close(inFds[0]);
+        close(inFds[1]);
+        close(outFds[0]);
+        close(outFds[1]);
+        /* Errors the checks provoke on purpose would only clutter the report */
+        freopen("/dev/null", "w", stderr);
+        execl("/bin/sh", "sh", "-c", pszCmd, (char *)NULL);
+        _exit(127);
+    }
+    close(inFds[0]);
+    close(outFds[1]);
+    signal(SIGPIPE, SIG_IGN);
+    if (pid > 0 && cbIn && write(inFds[1], pIn, cbIn) != (ssize_t)cbIn)
+        fprintf(stderr, "  script input cut short\n");
+    close(inFds[1]);
+    while (pid > 0)
+    {
+        char discard[4096];
+        int bFull = cb + 1 >= cbOut;
+        ssize_t n = bFull ? read(outFds[0], discard, sizeof(discard)) : read(outFds[0], out + cb, cbOut - cb - 1);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (!bFull)
+            cb += (size_t)n;
+    }
+    close(outFds[0]);
+    out[cb] = '\0';
+    if (pcbOut)
+        *pcbOut = cb;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int Gunzip(const char *pszDir, const char *pszName, char *out, size_t cbOut, size_t *pcbOut)
+{
+    char szCmd[PATH_MAX + 64];
+
+    snprintf(szCmd, sizeof(szCmd), "gzip -dc '%s/%s'", pszDir, pszName);
+    return RunScript(szCmd, NULL, 0, out, cbOut, pcbOut);
+}
@@ -0,0 +1,118 @@
+/**
+ * sshfs-perf.h
+ *
+ * Harness shared by the tests of the portable modules. Each module has its
+ * own program, sshfs-perf-<module>.c, that checks the module's code on input
+ * with a known answer and then times its hot paths:
+ *
+ *   static const MicroBench g_benches[] = {...};
+ *
+ *   int main(int argc, char *argv[])
+ *   {
+ *       return PerfMain(argc, argv, SetUp, g_benches, PERF_COUNT(g_benches));
+ *   }
+ *
+ * Usage of every such program: sshfs-perf-<module> [--quick] [--check] [--only <name>]
+ *
+ * Each result is printed with its limit. Each microbenchmark first runs its
+ * check. With --check the exit status is 1 if a check failed or any result
+ * is over its limit. The limits are far above what a loaded build machine
+ * measures, so they only trip on a real regression (a quadratic loop, a
+ * lost fast path), not on noise. --quick runs a tenth of the iterations.
+ * Results are the best of several repetitions in nanoseconds per operation.
+ */
+
+#ifndef SSHFS_PERF_H
+#define SSHFS_PERF_H
+
+#include <stddef.h>
+
+#define PERF_REPEATS        5
+#define PERF_OUTPUT_SIZE    (64 * 1024)     /* Terminal output per scan */
+#define PERF_PASTE_SIZE     (1024 * 1024)
+
+#define PERF_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct MicroBench {
+    const char *pszName;
+    void (*pfnRun)(size_t nOps);
+    int (*pfnCheck)(void);      /* Correctness of the same code on known input, NULL for none */
+    size_t nOps;                /* Per repetition; --quick runs a tenth */
+    double limitNs;             /* Per operation */
+} MicroBench;
+
+/* Results go here so the compiler cannot drop the work */
+extern volatile size_t g_sink;
+
+unsigned long long NowNs(void);
+
+/**
+ * Print a check's failure; returns bOk
+ */
+int Expect(int bOk, const char *pszWhat);
+
+/**
+ * Print a result against its limit, and fail the run if it is over
+ */
+void PrintResult(const char *pszName, double value, const char *pszUnit, double limit);
+
+void PrintHeader(void);
+
+/**
+ * Print a benchmark that could not run, and fail the run
+ */
+void PrintFailed(const char *pszName, const char *pszUnit, double limit);
+
+/**
+ * 1 if a check failed or a result was over its limit
+ */
+int PerfFailed(void);
+
+/**
+ * Parse the options, set up and run the benchmarks. Returns the exit status.
+ */
+int PerfMain(int argc, char *argv[], int (*pfnSetUp)(void), const MicroBench *pBenches, size_t nBenches);
+
+/**
+ * cb bytes of terminal output: a coloured listing with a shell's directory
+ * report (OSC 7) every 64 rows and no password prompt. NULL if out of memory.
+ */
+char *MakeTerminalOutput(size_t cb);
+
+/**
+ * A bracketed paste of cb bytes of source code. NULL if out of memory.
+ */
+char *MakePaste(size_t cb);
+
+/*
+ * Scratch folders for the server scripts to run in
+ */
+int MakeScratch(char *pszDir, size_t cch);
+void RemoveScratch(const char *pszDir);
+int WriteScratchFile(const char *pszDir, const char *pszName, const char *pData, size_t cb);
+int ScratchExists(const char *pszDir, const char *pszName);
+
+/**
+ * Run a server script locally with /bin/sh, as ssh would on the server:
+ * pIn on its stdin (it has to fit in a pipe), its stdout into out
+ * (NUL-terminated). Returns the exit status, -1 if it did not run.
+ */
+int RunScript(const char *pszCmd, const char *pIn, size_t cbIn, char *out, size_t cbOut, size_t *pcbOut);
+
+/**
+ * Inflate what was written to pszName in a scratch folder with gzip -dc
+ */
+int Gunzip(const char *pszDir, const char *pszName, char *out, size_t cbOut, size_t *pcbOut);
+
+/**
+ * Growing buffer for writers that stream (IndexWriteFn and the like)
+ */
+typedef struct MemBuffer {
+    char *p;
+    size_t cb;
+    size_t cbAlloc;
+} MemBuffer;
+
+int AppendMem(const void *p, size_t cb, void *pContext);
+
+#endif /* SSHFS_PERF_H */
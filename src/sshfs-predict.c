@@ -0,0 +1,664 @@
+/**
+ * sshfs-predict.c
+ *
+ * Predictive local echo engine (see sshfs-predict.h)
+ */
+
+#include "sshfs-predict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ESC 0x1b
+
+enum {
+    ESC_NONE,
+    ESC_SEEN,
+    ESC_CSI,
+    ESC_STRING,                 /* OSC, DCS and the like, until BEL or ST */
+    ESC_STRING_ESC,
+    ESC_CHARSET                 /* ESC ( and friends take one more byte */
+};
+
+/* Keystrokes the line model follows */
+enum {
+    KEY_INSERT,
+    KEY_BACKSPACE,
+    KEY_LEFT,
+    KEY_RIGHT
+};
+
+void PredictInit(PredictEngine *pe, int bEnabled)
+{
+    memset(pe, 0, sizeof(*pe));
+    pe->bEnabled = bEnabled;
+    pe->nColumns = 80;
+    PromptMatcherInit(&pe->passwordPrompt, "password");
+    PromptMatcherInit(&pe->passphrasePrompt, "passphrase");
+}
+
+static int IsActive(const PredictEngine *pe)
+{
+    return pe->bEnabled && !pe->bFullScreen && !pe->bSecretPrompt;
+}
+
+/* ---- Cursor line model ---- */
+
+static char CellAt(const PredictLine *line, size_t i)
+{
+    return i < line->cLen ? line->cells[i] : ' ';
+}
+
+static int LinesEqual(const PredictLine *a, const PredictLine *b)
+{
+    size_t i, n = a->cLen > b->cLen ? a->cLen : b->cLen;
+
+    if (a->col != b->col)
+        return 0;
+    for (i = 0; i < n; i++)
+        if (CellAt(a, i) != CellAt(b, i))
+            return 0;
+    return 1;
+}
+
+/**
+ * Forget the cursor line: every cell unknown, column unknown until a CR
+ */
+static void LoseLine(PredictEngine *pe)
+{
+    memset(pe->server.cells, 0, sizeof(pe->server.cells));
+    pe->server.cLen = PREDICT_LINE_MAX;
+    pe->server.col = 0;
+    pe->bLineKnown = 0;
+    pe->bInputStart = 0;
+}
+
+/**
+ * Make line cells [0, n) exist, padding with blanks
+ */
+static void ExtendLine(PredictLine *line, size_t n)
+{
+    if (n > PREDICT_LINE_MAX)
+        n = PREDICT_LINE_MAX;
+    if (line->cLen < n)
+    {
+        memset(line->cells + line->cLen, ' ', n - line->cLen);
+        line->cLen = n;
+    }
+}
+
+static void PutCell(PredictEngine *pe, char c)
+{
+    PredictLine *line = &pe->server;
+
+    if (line->col < PREDICT_LINE_MAX)
+    {
+        ExtendLine(line, line->col + 1);
+        line->cells[line->col] = c;
+    }
+    /* At the last column the next character wraps to a line the model does not have */
+    if (++line->col >= pe->nColumns)
+        LoseLine(pe);
+}
+
+/**
+ * Apply a completed CSI to the line; anything that may leave it is a loss
+ */
+static void LineCsi(PredictEngine *pe, char final)
+{
+    PredictLine *line = &pe->server;
+    size_t n, col = line->col;
+    long param;
+
+    pe->lineParams[pe->cbLineParams] = '\0';
+    if (pe->cbLineParams && (pe->lineParams[0] < '0' || pe->lineParams[0] > '9'))
+    {
+        /* Private modes (?2004h, ?25l, ...); the alternate screen is ScanOutput's */
+        if (final != 'h' && final != 'l' && final != 'm')
+            LoseLine(pe);
+        return;
+    }
+    param = strtol(pe->lineParams, NULL, 10);
+    n = param > 0 ? (size_t)param : 1;
+
+    switch (final)
+    {
+    case 'm':
+    case 'h':
+    case 'l':
+        break;
+    case 'C':
+        line->col = col + n < pe->nColumns ? col + n : pe->nColumns - 1;
+        break;
+    case 'D':
+        line->col = col > n ? col - n : 0;
+        break;
+    case 'G':
+        line->col = n - 1 < pe->nColumns ? n - 1 : pe->nColumns - 1;
+        pe->bLineKnown = 1;
+        break;
+    case 'K':
+        if (param == 0 && col < line->cLen)
+            line->cLen = col;
+        else if (param == 1)
+        {
+            ExtendLine(line, col + 1);
+            memset(line->cells, ' ', col + 1 < line->cLen ? col + 1 : line->cLen);
+        }
+        else if (param == 2)
+            line->cLen = 0;
+        break;
+    case 'X':
+        if (col < line->cLen)
+            memset(line->cells + col, ' ', n < line->cLen - col ? n : line->cLen - col);
+        break;
+    case 'P':
+        if (col < line->cLen)
+        {
+            if (n > line->cLen - col)
+                n = line->cLen - col;
+            memmove(line->cells + col, line->cells + col + n, line->cLen - col - n);
+            line->cLen -= n;
+        }
+        break;
+    case '@':
+        if (col < line->cLen)
+        {
+            size_t cLen = line->cLen + n < PREDICT_LINE_MAX ? line->cLen + n : PREDICT_LINE_MAX;
+            if (n > cLen - col)
+                n = cLen - col;
+            memmove(line->cells + col + n, line->cells + col, cLen - col - n);
+            memset(line->cells + col, ' ', n);
+            line->cLen = cLen;
+        }
+        break;
+    default:
+        LoseLine(pe);
+        break;
+    }
+}
+
+/**
+ * Run server output through the line model, byte by byte
+ */
+static void LineFeed(PredictEngine *pe, const unsigned char *p, const unsigned char *end)
+{
+    PredictLine *line = &pe->server;
+
+    for (; p < end; p++)
+    {
+        unsigned char c = *p;
+
+        switch (pe->lineEscState)
+        {
+        case ESC_SEEN:
+            if (c == '[')
+            {
+                pe->lineEscState = ESC_CSI;
+                pe->cbLineParams = 0;
+                continue;
+            }
+            if (c == ']' || c == 'P' || c == '_' || c == '^' || c == 'X')
+                pe->lineEscState = ESC_STRING;
+            else if (c == '(' || c == ')' || c == '*' || c == '+')
+                pe->lineEscState = ESC_CHARSET;
+            else
+            {
+                /* ESC = and ESC > only switch the keypad; the rest move or reset */
+                if (c != '=' && c != '>')
+                    LoseLine(pe);
+                pe->lineEscState = ESC_NONE;
+            }
+            continue;
+        case ESC_CSI:
+            if (c >= 0x40 && c <= 0x7e)
+            {
+                pe->lineEscState = ESC_NONE;
+                LineCsi(pe, (char)c);
+            }
+            else if (c >= 0x30 && c <= 0x3f && pe->cbLineParams < sizeof(pe->lineParams) - 1)
+                pe->lineParams[pe->cbLineParams++] = (char)c;
+            else if (c < 0x30 || c > 0x3f)
+            {
+                /* Intermediate byte: never a sequence the model follows */
+                pe->lineParams[0] = '!';
+                if (pe->cbLineParams == 0)
+                    pe->cbLineParams = 1;
+            }
+            continue;
+        case ESC_STRING:
+            if (c == 0x07)
+                pe->lineEscState = ESC_NONE;
+            else if (c == ESC)
+                pe->lineEscState = ESC_STRING_ESC;
+            continue;
+        case ESC_STRING_ESC:
+            pe->lineEscState = (c == '\\') ? ESC_NONE : ESC_STRING;
+            continue;
+        case ESC_CHARSET:
+            pe->lineEscState = ESC_NONE;
+            continue;
+        default:
+            break;
+        }
+
+        if (c >= 0x20 && c < 0x7f)
+            PutCell(pe, (char)c);
+        else if (c >= 0xc0)
+            PutCell(pe, '\0');     /* UTF-8 lead byte: one cell the model cannot redraw */
+        else if (c == ESC)
+            pe->lineEscState = ESC_SEEN;
+        else if (c == '\r')
+        {
+            line->col = 0;
+            pe->bLineKnown = 1;
+            pe->bInputStart = 0;
+        }
+        else if (c == '\n')
+        {
+            line->cLen = 0;
+            pe->bInputStart = 0;
+        }
+        else if (c == '\b')
+        {
+            if (line->col > 0)
+                line->col--;
+        }
+        else if (c == '\t')
+        {
+            line->col = (line->col / 8 + 1) * 8;
+            if (line->col >= pe->nColumns)
+                line->col = pe->nColumns - 1;
+        }
+    }
+}
+
+/**
+ * Apply server output to the cursor line. Only what follows the last
+ * newline can still be on it, so a screenful of output costs a scan for
+ * that newline.
+ */
+static void TrackLine(PredictEngine *pe, const char *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data, *end = p + len, *nl = end;
+
+    while (nl > p + 1 && nl[-1] != '\n')
+        nl--;
+    if (nl > p + 1 && nl[-1] == '\n')
+    {
+        /* Escape sequences do not span lines; the column is known after CR LF */
+        pe->lineEscState = ESC_NONE;
+        pe->server.cLen = 0;
+        pe->bInputStart = 0;
+        if (nl[-2] == '\r')
+        {
+            pe->server.col = 0;
+            pe->bLineKnown = 1;
+        }
+        else
+            pe->bLineKnown = 0;
+        p = nl;
+    }
+    LineFeed(pe, p, end);
+}
+
+/**
+ * Apply one keystroke to a predicted line; 0 if its effect is not predictable
+ */
+static int ApplyKey(const PredictEngine *pe, PredictLine *line, int key, char c)
+{
+    size_t col = line->col;
+
+    switch (key)
+    {
+    case KEY_INSERT:
+        /* Line editors insert at the cursor, pushing the rest of the line right */
+        if ((col > line->cLen ? col : line->cLen) + 2 >= pe->nColumns || line->cLen >= PREDICT_LINE_MAX - 1)
+            return 0;
+        ExtendLine(line, col);
+        memmove(line->cells + col + 1, line->cells + col, line->cLen - col);
+        line->cells[col] = c;
+        line->cLen++;
+        line->col++;
+        return 1;
+    case KEY_BACKSPACE:
+        if (col <= pe->inputStart || col > line->cLen)
+            return 0;
+        memmove(line->cells + col - 1, line->cells + col, line->cLen - col);
+        line->cLen--;
+        line->col--;
+        return 1;
+    case KEY_LEFT:
+        if (col <= pe->inputStart)
+            return 0;
+        line->col--;
+        return 1;
+    case KEY_RIGHT:
+        if (col >= line->cLen)
+            return 0;
+        line->col++;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Write the changes that turn the drawn line into target, underlining the
+ * cells that differ from the server's. Returns the length written, or 0
+ * (leaving pe->screen alone) if nothing changes or the target cannot be
+ * drawn safely: cells the model does not know, or a cursor at the margin.
+ */
+static size_t DrawLine(PredictEngine *pe, const PredictLine *target, char *out, size_t cbOut)
+{
+    const PredictLine *from = &pe->screen;
+    size_t i, first, last, n, cb = 0;
+    int bUnderline = 0;
+
+    n = from->cLen > target->cLen ? from->cLen : target->cLen;
+    for (first = 0; first < n && CellAt(from, first) == CellAt(target, first); first++)
+        ;
+    if (first == n && from->col == target->col)
+        return 0;
+    if (target->col >= pe->nColumns || n >= pe->nColumns)
+        return 0;
+
+    last = first;
+    for (i = first; i < n; i++)
+    {
+        if (CellAt(from, i) != CellAt(target, i))
+        {
+            if (CellAt(target, i) == '\0' || CellAt(&pe->server, i) == '\0')
+                return 0;
+            last = i + 1;
+        }
+    }
+    if (first < last)
+    {
+        if (from->col > first)
+            cb += (size_t)snprintf(out + cb, cbOut - cb, "\x1b[%uD", (unsigned)(from->col - first));
+        else if (from->col < first)
+            cb += (size_t)snprintf(out + cb, cbOut - cb, "\x1b[%uC", (unsigned)(first - from->col));
+
+        for (i = first; i < last; i++)
+        {
+            char c = CellAt(target, i);
+            int bPredicted = (c != CellAt(&pe->server, i));
+
+            /* Room for this cell, an underline switch, and the closing switch and move */
+            if (cb + 40 > cbOut)
+                return 0;
+            if (bPredicted != bUnderline)
+            {
+                cb += (size_t)snprintf(out + cb, cbOut - cb, bPredicted ? "\x1b[4m" : "\x1b[24m");
+                bUnderline = bPredicted;
+            }
+            out[cb++] = c;
+        }
+        if (bUnderline)
+            cb += (size_t)snprintf(out + cb, cbOut - cb, "\x1b[24m");
+    }
+    else
+        last = from->col;
+
+    if (last > target->col)
+        cb += (size_t)snprintf(out + cb, cbOut - cb, "\x1b[%uD", (unsigned)(last - target->col));
+    else if (last < target->col)
+        cb += (size_t)snprintf(out + cb, cbOut - cb, "\x1b[%uC", (unsigned)(target->col - last));
+
+    pe->screen = *target;
+    return cb;
+}
+
+/**
+ * Read one keystroke the line model follows from data; returns its length
+ * (0 for anything else) and the key
+ */
+static size_t ReadKey(const char *data, size_t len, int *pKey)
+{
+    unsigned char c = (unsigned char)data[0];
+
+    if (c >= 0x20 && c < 0x7f)
+    {
+        *pKey = KEY_INSERT;
+        return 1;
+    }
+    if (c == 0x7f || c == '\b')
+    {
+        *pKey = KEY_BACKSPACE;
+        return 1;
+    }
+    /* Cursor keys in normal (ESC [) and application (ESC O) mode */
+    if (c == ESC && len >= 3 && (data[1] == '[' || data[1] == 'O') && (data[2] == 'C' || data[2] == 'D'))
+    {
+        *pKey = data[2] == 'C' ? KEY_RIGHT : KEY_LEFT;
+        return 3;
+    }
+    return 0;
+}
+
+void PredictResize(PredictEngine *pe, size_t nColumns)
+{
+    if (nColumns < 2)
+        nColumns = 2;
+    if (nColumns != pe->nColumns)
+    {
+        /* Anything drawn stays until the shell redraws the reflowed line */
+        pe->nColumns = nColumns;
+        LoseLine(pe);
+        pe->screen = pe->server;
+    }
+}
+
+size_t PredictInput(PredictEngine *pe, const char *data, size_t len, char *echo, size_t cbEcho)
+{
+    size_t i = 0, cbKey;
+    int key;
+
+    if (!pe->bEnabled)
+        return 0;
+
+    while (i < len)
+    {
+        unsigned char c = (unsigned char)data[i];
+        PredictLine *line;
+
+        /* Enter ends a password prompt */
+        if (c == '\r' || c == '\n')
+            pe->bSecretPrompt = 0;
+
+        if (!IsActive(pe) || pe->bBlocked)
+        {
+            i++;
+            continue;
+        }
+
+        cbKey = ReadKey(data + i, len - i, &key);
+        if (cbKey && pe->bLineKnown && pe->nPending < PREDICT_MAX_PENDING)
+        {
+            line = &pe->expect[pe->nPending];
+            *line = pe->nPending ? pe->expect[pe->nPending - 1] : pe->server;
+            if (!pe->bInputStart)
+            {
+                /* Typing starts here: the prompt to the left is not the line editor's */
+                pe->inputStart = line->col;
+                pe->bInputStart = 1;
+            }
+            if (ApplyKey(pe, line, key, (char)c))
+            {
+                pe->nPending++;
+                i += cbKey;
+                continue;
+            }
+        }
+
+        /* Enter, control keys, other escape sequences: the server decides */
+        pe->bBlocked = 1;
+        i++;
+    }
+
+    /* Draw only once the server has shown it echoes */
+    if (pe->bConfident && pe->nPending)
+        return DrawLine(pe, &pe->expect[pe->nPending - 1], echo, cbEcho);
+    return 0;
+}
+
+/**
+ * Check a completed private-mode CSI (ESC [ ? Pm h/l) for alternate screen switches
+ */
+static void CheckScreenMode(PredictEngine *pe, char final)
+{
+    const char *p = pe->csiParams + 1;
+
+    if (pe->cbCsiParams == 0 || pe->csiParams[0] != '?' || (final != 'h' && final != 'l'))
+        return;
+
+    while (*p)
+    {
+        long mode = strtol(p, (char **)&p, 10);
+        if (mode == 1049 || mode == 1047 || mode == 47)
+            pe->bFullScreen = (final == 'h');
+        if (*p == ';')
+            p++;
+        else if (*p)
+            break;
+    }
+}
+
+/**
+ * Track alternate screen and password prompts in server output
+ */
+static void ScanOutput(PredictEngine *pe, const char *data, size_t len)
+{
+    const char *p = data, *end = data + len;
+
+    if (PromptMatcherFeed(&pe->passwordPrompt, data, len) ||
+        PromptMatcherFeed(&pe->passphrasePrompt, data, len))
+        pe->bSecretPrompt = 1;
+
+    while (p < end)
+    {
+        if (pe->escState == ESC_NONE)
+        {
+            /* Plain text fast path: jump straight to the next ESC */
+            p = memchr(p, ESC, (size_t)(end - p));
+            if (!p)
+                break;
+            pe->escState = ESC_SEEN;
+            p++;
+            continue;
+        }
+
+        if (pe->escState == ESC_SEEN)
+        {
+            if (*p == '[')
+            {
+                pe->escState = ESC_CSI;
+                pe->cbCsiParams = 0;
+            }
+            else
+            {
+                pe->escState = ESC_NONE;
+            }
+            p++;
+            continue;
+        }
+
+        /* ESC_CSI: parameter bytes until a final byte */
+        if (*p >= 0x40 && *p <= 0x7e)
+        {
+            pe->csiParams[pe->cbCsiParams] = '\0';
+            CheckScreenMode(pe, *p);
+            pe->escState = ESC_NONE;
+        }
+        else if (*p >= 0x30 && *p <= 0x3f && pe->cbCsiParams < sizeof(pe->csiParams) - 1)
+        {
+            pe->csiParams[pe->cbCsiParams++] = *p;
+        }
+        else if (*p == ESC)
+        {
+            pe->escState = ESC_SEEN;
+        }
+        p++;
+    }
+}
+
+void PredictOutput(PredictEngine *pe, const char *data, size_t len, PredictFrame *frame)
+{
+    PredictLine before;
+    size_t k;
+
+    frame->cbPrefix = 0;
+    frame->cbSuffix = 0;
+
+    if (!pe->bEnabled)
+        return;
+
+    /* The chunk has to land on the line as the server left it */
+    if (pe->bLineKnown)
+        frame->cbPrefix = DrawLine(pe, &pe->server, frame->prefix, sizeof(frame->prefix));
+
+    ScanOutput(pe, data, len);
+    before = pe->server;
+    TrackLine(pe, data, len);
+    if (pe->bFullScreen)
+        LoseLine(pe);
+    pe->screen = pe->server;
+
+    if (pe->nPending == 0)
+    {
+        pe->bBlocked = 0;
+        return;
+    }
+
+    if (!IsActive(pe) || !pe->bLineKnown)
+    {
+        /* Suspended, or the line went somewhere the model cannot follow */
+        pe->nMispredicted++;
+        pe->bConfident = 0;
+        pe->bBlocked = 0;
+        pe->bUnsettled = 0;
+        pe->nPending = 0;
+        return;
+    }
+
+    /*
+     * A prediction the server's line has reached confirms those before it.
+     * Take the earliest: keys that cancel out (Y, Backspace) lead back to
+     * an earlier state before their echoes have come.
+     */
+    for (k = 0; k < pe->nPending && !LinesEqual(&pe->server, &pe->expect[k]); k++)
+        ;
+
+    if (k < pe->nPending)
+    {
+        k++;
+        memmove(pe->expect, pe->expect + k, (pe->nPending - k) * sizeof(pe->expect[0]));
+        pe->nPending -= k;
+        pe->nConfirmed += (unsigned long)k;
+        pe->bConfident = 1;
+        pe->bUnsettled = 0;
+        if (pe->nPending == 0)
+            pe->bBlocked = 0;
+    }
+    else if (!LinesEqual(&pe->server, &before))
+    {
+        /* A redraw may span two chunks; after that, or behind a key we did not model, give up */
+        if (pe->bUnsettled || pe->bBlocked)
+        {
+            if (!pe->bBlocked)
+            {
+                pe->nMispredicted++;
+                pe->bConfident = 0;
+            }
+            pe->bBlocked = 0;
+            pe->bUnsettled = 0;
+            pe->nPending = 0;
+            return;
+        }
+        pe->bUnsettled = 1;
+    }
+
+    if (pe->bConfident && pe->nPending)
+        frame->cbSuffix = DrawLine(pe, &pe->expect[pe->nPending - 1], frame->suffix, sizeof(frame->suffix));
+}
@@ -0,0 +1,111 @@
+/**
+ * sshfs-predict.h
+ *
+ * Predictive local echo for high-latency links, in the spirit of mosh.
+ *
+ * The engine keeps a model of the cursor line: the cells and cursor column
+ * the server's output has left there. Each keystroke that line editors
+ * handle predictably (printable characters inserted at the cursor,
+ * backspace, left and right arrows) is applied to a copy of it, and once
+ * the server has proven it echoes, the predicted line is drawn immediately
+ * with new cells underlined. When output arrives the drawing is first
+ * undone, the output applied to the model, and a prediction is confirmed
+ * when the server's line reaches the state it predicted, however the shell
+ * redrew it. Output that leads nowhere predicted erases the predictions.
+ * Prediction suspends itself while a full-screen application owns the
+ * alternate screen, at password or passphrase prompts, and on lines it
+ * cannot follow (cursor addressing, wrapping).
+ *
+ * The engine is not thread-safe; the ConPTY launcher serializes its input
+ * and output threads around it.
+ */
+
+#ifndef SSHFS_PREDICT_H
+#define SSHFS_PREDICT_H
+
+#include <stddef.h>
+
+#include "sshfs-relay.h"
+
+#define PREDICT_MAX_PENDING 64
+#define PREDICT_LINE_MAX    256
+
+/* Longest redraw of the cursor line, and the echo buffer PredictInput needs */
+#define PREDICT_DRAW_MAX    (PREDICT_LINE_MAX * 2 + 64)
+#define PREDICT_ECHO_SIZE   PREDICT_DRAW_MAX
+
+/**
+ * The cursor line: cells beyond cLen are blank, '\0' marks a cell the
+ * model cannot redraw (non-ASCII, or not seen since the line was lost)
+ */
+typedef struct PredictLine {
+    char cells[PREDICT_LINE_MAX];
+    size_t cLen;
+    size_t col;
+} PredictLine;
+
+/**
+ * Bytes to write around one chunk of server output
+ */
+typedef struct PredictFrame {
+    char prefix[PREDICT_DRAW_MAX];  /* Before the chunk: restore the server's line */
+    size_t cbPrefix;
+    char suffix[PREDICT_DRAW_MAX];  /* After the chunk: draw unconfirmed predictions */
+    size_t cbSuffix;
+} PredictFrame;
+
+typedef struct PredictEngine {
+    int bEnabled;               /* Opt-in switch */
+    int bFullScreen;            /* Alternate screen active */
+    int bSecretPrompt;          /* Password prompt seen, until the user presses Enter */
+    int bConfident;             /* Server echoed a prediction */
+    int bBlocked;               /* Unmodelled key sent: no predictions until reconciled */
+    int bUnsettled;             /* Last output changed the line but matched no prediction */
+
+    size_t nColumns;            /* Terminal width: the cursor wraps at this column */
+    PredictLine server;         /* Cursor line as the server's output left it */
+    PredictLine screen;         /* Cursor line as drawn, predictions included */
+    int bLineKnown;             /* Cursor column of server is known */
+    int bInputStart;            /* inputStart is set */
+    size_t inputStart;          /* Column of the first keystroke on this line */
+
+    PredictLine expect[PREDICT_MAX_PENDING];    /* Line after each keystroke awaiting its echo */
+    size_t nPending;
+
+    PromptMatcher passwordPrompt;
+    PromptMatcher passphrasePrompt;
+
+    int escState;               /* Output CSI scanner for alternate screen switches */
+    char csiParams[16];
+    size_t cbCsiParams;
+
+    int lineEscState;           /* Control sequence parser of the line model */
+    char lineParams[16];
+    size_t cbLineParams;
+
+    unsigned long nConfirmed;   /* Statistics */
+    unsigned long nMispredicted;
+} PredictEngine;
+
+void PredictInit(PredictEngine *pe, int bEnabled);
+
+/**
+ * Set the terminal width (at start and whenever it changes). The cursor
+ * line is lost until the next newline, since the terminal may reflow it.
+ */
+void PredictResize(PredictEngine *pe, size_t nColumns);
+
+/**
+ * Record keystrokes about to be sent to the server.
+ * Writes the local echo to draw now into echo (PREDICT_ECHO_SIZE bytes)
+ * and returns its length.
+ */
+size_t PredictInput(PredictEngine *pe, const char *data, size_t len, char *echo, size_t cbEcho);
+
+/**
+ * Reconcile a chunk of server output with outstanding predictions.
+ * The caller writes frame->prefix, the unchanged chunk, then frame->suffix.
+ */
+void PredictOutput(PredictEngine *pe, const char *data, size_t len, PredictFrame *frame);
+
+#endif /* SSHFS_PREDICT_H */
@@ -0,0 +1,223 @@
+/**
+ * sshfs-reconnect.c
+ *
+ * Reconnect state machine and messages for the terminal relay's resilient
+ * sessions. See sshfs-reconnect.h.
+ */
+
+#include "sshfs-reconnect.h"
+#include "sshfs-remote.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void ReconnectInit(Reconnect *r, unsigned long long seed)
+{
+    memset(r, 0, sizeof(*r));
+    r->phase = RECONNECT_CONNECTING;
+    r->rng = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+void ReconnectAttempt(Reconnect *r, unsigned long long now)
+{
+    r->phase = RECONNECT_CONNECTING;
+    r->msAttempt = now;
+    r->nAttempts++;
+}
+
+int ReconnectUp(Reconnect *r, unsigned long long now)
+{
+    int bRecovered;
+
+    if (r->phase != RECONNECT_CONNECTING)
+        return 0;
+
+    bRecovered = r->msLost != 0;
+    r->phase = RECONNECT_LIVE;
+    r->bEverLive = 1;
+    r->msLive = now;
+    if (!bRecovered)
+        r->nAttempts = 0;
+    return bRecovered;
+}
+
+int ReconnectTick(Reconnect *r, unsigned long long now)
+{
+    if (r->phase == RECONNECT_CONNECTING && now - r->msAttempt >= RECONNECT_STABLE_MS)
+        return ReconnectUp(r, now);
+
+    /* A session that stays up ends the outage's backoff */
+    if (r->phase == RECONNECT_LIVE && r->nFailed && now - r->msLive >= RECONNECT_STABLE_MS)
+        r->nFailed = 0;
+    return 0;
+}
+
+ReconnectPhase ReconnectExit(Reconnect *r, int exitCode, unsigned long long now)
+{
+    unsigned long long msUp;
+
+    r->exitCode = exitCode;
+
+    if (exitCode != RECONNECT_EXIT_TRANSPORT || !r->bEverLive)
+    {
+        r->phase = RECONNECT_DONE;
+        return r->phase;
+    }
+
+    msUp = now - r->msLive;
+    if (r->phase == RECONNECT_LIVE && (r->msLost == 0 || msUp >= RECONNECT_STABLE_MS))
+    {
+        /* A new outage */
+        r->nFailed = 0;
+        r->nAttempts = 0;
+        r->msLost = now;
+    }
+    else
+    {
+        /* Failed attempt, or a session that dropped again right away: back off further */
+        r->nFailed++;
+    }
+
+    if (r->msLost && now - r->msLost >= RECONNECT_GIVE_UP_MS)
+    {
+        r->phase = RECONNECT_DONE;
+        return r->phase;
+    }
+
+    r->msRetry = now + ReconnectBackoff(r->nFailed, &r->rng);
+    r->phase = RECONNECT_WAITING;
+    return r->phase;
+}
+
+unsigned ReconnectDelay(const Reconnect *r, unsigned long long now)
+{
+    if (r->phase != RECONNECT_WAITING || now >= r->msRetry)
+        return 0;
+    return (unsigned)(r->msRetry - now);
+}
+
+ReconnectKey ReconnectOnKey(Reconnect *r, char c, unsigned long long now)
+{
+    if (r->phase != RECONNECT_WAITING)
+        return RECONNECT_KEY_NONE;
+
+    if (c == '\r' || c == '\n')
+    {
+        r->msRetry = now;
+        return RECONNECT_KEY_RETRY;
+    }
+    if (c == 'q' || c == 'Q' || c == 0x03 || c == 0x04)
+    {
+        r->phase = RECONNECT_DONE;
+        return RECONNECT_KEY_GIVE_UP;
+    }
+    return RECONNECT_KEY_NONE;
+}
+
+unsigned ReconnectBackoff(unsigned nFailed, unsigned long long *pRng)
+{
+    unsigned long long x = *pRng;
+    unsigned ceiling = RECONNECT_BASE_MS;
+    unsigned half;
+
+    while (nFailed-- && ceiling < RECONNECT_CAP_MS)
+        ceiling *= 2;
+    if (ceiling > RECONNECT_CAP_MS)
+        ceiling = RECONNECT_CAP_MS;
+
+    /* xorshift64: plenty to keep a fleet of terminals from retrying in step */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *pRng = x;
+
+    half = ceiling / 2;
+    return half + (unsigned)(x % (half + 1));
+}
+
+/**
+ * "4.2s", "3m 07s", "1h 02m"
+ */
+static void FormatDuration(unsigned long long ms, char *out, size_t cbOut)
+{
+    unsigned long long s = ms / 1000;
+
+    if (s < 60)
+        snprintf(out, cbOut, "%u.%us", (unsigned)s, (unsigned)(ms % 1000 / 100));
+    else if (s < 3600)
+        snprintf(out, cbOut, "%um %02us", (unsigned)(s / 60), (unsigned)(s % 60));
+    else
+        snprintf(out, cbOut, "%uh %02um", (unsigned)(s / 3600), (unsigned)(s / 60 % 60));
+}
+
+/**
+ * snprintf's return as a length
+ */
+static size_t Length(int n)
+{
+    return n < 0 ? 0 : (size_t)n;
+}
+
+size_t ReconnectFormatLost(const Reconnect *r, unsigned long long now, char *out, size_t cbOut)
+{
+    char szWait[32];
+    char szDown[32];
+
+    FormatDuration(ReconnectDelay(r, now), szWait, sizeof(szWait));
+    if (r->nFailed == 0)
+        return Length(snprintf(out, cbOut,
+            "\r\n\x1b[33m[sshfs-ssh] Connection lost. Reconnecting in %s"
+            " (Enter: now, q: give up)\x1b[0m\r\n", szWait));
+
+    FormatDuration(now - r->msLost, szDown, sizeof(szDown));
+    return Length(snprintf(out, cbOut,
+        "\x1b[33m[sshfs-ssh] Attempt %u failed, down %s. Next in %s\x1b[0m\r\n",
+        r->nAttempts, szDown, szWait));
+}
+
+size_t ReconnectFormatUp(const Reconnect *r, unsigned long long now, char *out, size_t cbOut)
+{
+    char szDown[32];
+
+    FormatDuration(now - r->msLost, szDown, sizeof(szDown));
+    return Length(snprintf(out, cbOut,
+        "\x1b[32m[sshfs-ssh] Reconnected after %s (%u attempt%s)\x1b[0m\r\n",
+        szDown, r->nAttempts, r->nAttempts == 1 ? "" : "s"));
+}
+
+size_t ReconnectFormatGiveUp(const Reconnect *r, unsigned long long now, char *out, size_t cbOut)
+{
+    char szDown[32];
+
+    FormatDuration(r->msLost ? now - r->msLost : 0, szDown, sizeof(szDown));
+    return Length(snprintf(out, cbOut,
+        "\r\n\x1b[31m[sshfs-ssh] Gave up reconnecting after %s\x1b[0m\r\n", szDown));
+}
+
+size_t ReconnectBuildCommand(const char *pszDir, const char *pszShell, char *out, size_t cbOut)
+{
+    char szQuoted[4 * 4096];
+    size_t cch;
+
+    if (!pszDir || !*pszDir)
+        pszDir = "~";
+    if (!pszShell)
+        pszShell = "exec $SHELL";
+
+    cch = RemoteQuotePath(pszDir, szQuoted, sizeof(szQuoted));
+    if (cch >= sizeof(szQuoted))
+    {
+        /* Too long to resume in; home is the best we can do */
+        strcpy(szQuoted, "~");
+    }
+
+    /*
+     * The report doubles as the "logged in" signal: it only appears once
+     * authentication is done and the command runs. Host-less file:// URI;
+     * $PWD goes out as is (not percent-encoded), which CwdScan takes for
+     * any path without a '%'.
+     */
+    return Length(snprintf(out, cbOut,
+        "cd %s; printf '\\033]7;file://%%s\\033\\\\' \"$PWD\"; %s",
+        szQuoted, pszShell));
+}
@@ -0,0 +1,122 @@
+/**
+ * sshfs-reconnect.h
+ *
+ * Resilient sessions for the terminal relay (--reconnect): when ssh dies
+ * with 255 (its own exit code for a lost connection, including keepalive
+ * timeouts), the relay starts it again after a jittered exponential
+ * backoff, in the last directory the shell reported, and tells the user
+ * inline how long the outage lasted. Any other exit code is the remote
+ * shell's own and ends the session as before.
+ *
+ * Each attempt runs a command (ReconnectBuildCommand) that reports its
+ * directory with OSC 7 right after the cd; the report is how the relay
+ * knows the new session is up, password or not, and later reports from
+ * the shell keep the directory current. A connection is only reconnected
+ * after it was up once, so a wrong host or password still fails at once.
+ *
+ * The state machine is platform neutral: the launchers feed it ssh starts,
+ * directory reports, exits and keys, and it says what to do next.
+ */
+
+#ifndef SSHFS_RECONNECT_H
+#define SSHFS_RECONNECT_H
+
+#include <stddef.h>
+
+#define RECONNECT_EXIT_TRANSPORT    255     /* ssh: connection failed or lost */
+#define RECONNECT_BASE_MS           500     /* First delay */
+#define RECONNECT_CAP_MS            30000   /* Longest delay */
+#define RECONNECT_STABLE_MS         10000   /* Up this long, a session resets the backoff */
+#define RECONNECT_GIVE_UP_MS        (60 * 60 * 1000)
+#define RECONNECT_ALIVE_INTERVAL    10      /* ssh ServerAliveInterval, seconds */
+#define RECONNECT_ALIVE_COUNT       3       /* ServerAliveCountMax: lost after ~30 s of silence */
+#define RECONNECT_CONNECT_TIMEOUT   10      /* ssh ConnectTimeout for each attempt, seconds */
+
+typedef enum ReconnectPhase {
+    RECONNECT_CONNECTING,   /* ssh started, session not up yet */
+    RECONNECT_LIVE,
+    RECONNECT_WAITING,      /* Lost; next attempt at msRetry */
+    RECONNECT_DONE          /* Ended for good: exitCode */
+} ReconnectPhase;
+
+typedef enum ReconnectKey {
+    RECONNECT_KEY_NONE,
+    RECONNECT_KEY_RETRY,    /* Enter: try now */
+    RECONNECT_KEY_GIVE_UP   /* q, Ctrl+C, Ctrl+D */
+} ReconnectKey;
+
+typedef struct Reconnect {
+    ReconnectPhase phase;
+    int bEverLive;
+    unsigned nFailed;               /* Attempts that failed since the connection was lost */
+    unsigned nAttempts;             /* Attempts since then, the running one included */
+    unsigned long long msAttempt;   /* Start of the current attempt */
+    unsigned long long msLive;      /* When the current session came up */
+    unsigned long long msLost;      /* When the connection was lost; 0 while it is not */
+    unsigned long long msRetry;     /* WAITING: when to try again */
+    unsigned long long rng;
+    int exitCode;
+} Reconnect;
+
+void ReconnectInit(Reconnect *r, unsigned long long seed);
+
+/**
+ * ssh was started (again) at now
+ */
+void ReconnectAttempt(Reconnect *r, unsigned long long now);
+
+/**
+ * The session is up (a directory report, or RECONNECT_STABLE_MS without
+ * exiting: see ReconnectTick). Returns 1 if this ended an outage, i.e.
+ * "reconnected" should be shown.
+ */
+int ReconnectUp(Reconnect *r, unsigned long long now);
+
+/**
+ * Counts a connecting ssh that has run for RECONNECT_STABLE_MS as up, for
+ * shells that never got to print the report. Same return as ReconnectUp.
+ */
+int ReconnectTick(Reconnect *r, unsigned long long now);
+
+/**
+ * ssh exited with exitCode: WAITING (msRetry set) or DONE
+ */
+ReconnectPhase ReconnectExit(Reconnect *r, int exitCode, unsigned long long now);
+
+/**
+ * Milliseconds until the next attempt while WAITING, else 0
+ */
+unsigned ReconnectDelay(const Reconnect *r, unsigned long long now);
+
+/**
+ * A key pressed while WAITING (keys go to ssh otherwise, which may be
+ * asking for a password): RECONNECT_KEY_RETRY moves msRetry to now,
+ * RECONNECT_KEY_GIVE_UP ends the session (DONE with the last exit code).
+ */
+ReconnectKey ReconnectOnKey(Reconnect *r, char c, unsigned long long now);
+
+/**
+ * Backoff before attempt nFailed + 1 after a loss: "equal jitter", half of
+ * min(cap, base * 2^nFailed) plus a random part up to the other half.
+ * *pRng is a xorshift64 state.
+ */
+unsigned ReconnectBackoff(unsigned nFailed, unsigned long long *pRng);
+
+/**
+ * "\r\n[sshfs-ssh] ..." lines for the terminal: the loss with the next
+ * attempt, the reconnect with how long it took, giving up. Work like
+ * snprintf.
+ */
+size_t ReconnectFormatLost(const Reconnect *r, unsigned long long now, char *out, size_t cbOut);
+size_t ReconnectFormatUp(const Reconnect *r, unsigned long long now, char *out, size_t cbOut);
+size_t ReconnectFormatGiveUp(const Reconnect *r, unsigned long long now, char *out, size_t cbOut);
+
+/**
+ * Remote command of an attempt: cd to pszDir (FormatRemotePath() form,
+ * "~" or "" for home), report the directory with OSC 7, then run pszShell:
+ * NULL execs the user's shell, RemoteBuildAttachCommand() reattaches to
+ * the persistent session. snprintf-style return.
+ */
+size_t ReconnectBuildCommand(const char *pszDir, const char *pszShell, char *out, size_t cbOut);
+
+#endif /* SSHFS_RECONNECT_H */
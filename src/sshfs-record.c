@@ -0,0 +1,401 @@
+/**
+ * sshfs-record.c
+ *
+ * Recording queue and asciicast writer (see sshfs-record.h)
+ */
+
+#include "sshfs-record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AtomicLoadAcquire(p)        _InterlockedCompareExchange64((volatile long long *)(p), 0, 0)
+#define AtomicStoreRelease(p, v)    _InterlockedExchange64((p), (v))
+#else
+#define AtomicLoadAcquire(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define AtomicStoreRelease(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+/* Worst case of one event line: every byte escaped as \uXXXX */
+#define EVENT_MAX(cb)       ((cb) * 6 + 64)
+#define INCOMPLETE          ((size_t)-1)
+
+/**
+ * Chunk header in the ring
+ */
+typedef struct RecordHeader {
+    unsigned long long ms;
+    unsigned long long cbDropped;
+    unsigned int cb;
+    unsigned int reserved;
+} RecordHeader;
+
+int RecordQueueInit(RecordQueue *q, RecordPolicy policy)
+{
+    memset((void *)q, 0, sizeof(*q));
+    q->pRing = (unsigned char *)malloc(RECORD_RING_SIZE);
+    if (!q->pRing)
+        return 0;
+    q->cbRing = RECORD_RING_SIZE;
+    q->policy = policy;
+    return 1;
+}
+
+void RecordQueueFree(RecordQueue *q)
+{
+    free(q->pRing);
+    q->pRing = NULL;
+}
+
+static void RingWrite(RecordQueue *q, long long pos, const void *data, size_t cb)
+{
+    size_t off = (size_t)pos & (q->cbRing - 1);
+    size_t run = q->cbRing - off < cb ? q->cbRing - off : cb;
+
+    memcpy(q->pRing + off, data, run);
+    memcpy(q->pRing, (const unsigned char *)data + run, cb - run);
+}
+
+static void RingRead(RecordQueue *q, long long pos, void *data, size_t cb)
+{
+    size_t off = (size_t)pos & (q->cbRing - 1);
+    size_t run = q->cbRing - off < cb ? q->cbRing - off : cb;
+
+    memcpy(data, q->pRing + off, run);
+    memcpy((unsigned char *)data + run, q->pRing, cb - run);
+}
+
+RecordResult RecordOffer(RecordQueue *q, const void *data, size_t cb, unsigned long long ms, int *pbWake)
+{
+    RecordHeader h;
+    long long tail = q->tail;
+    size_t used = (size_t)(tail - AtomicLoadAcquire(&q->head));
+    size_t need = sizeof(h) + cb;
+
+    *pbWake = 0;
+    if (cb > RECORD_CHUNK_MAX)
+    {
+        RecordDrop(q, cb);
+        return RECORD_DROPPED;
+    }
+
+    /* Sampling keeps some of the output while the writer catches up */
+    if (q->policy == RECORD_SAMPLE)
+    {
+        if (!q->bSampling && used > q->cbRing / 2)
+        {
+            q->bSampling = 1;
+            q->nOffered = 0;
+        }
+        else if (q->bSampling && used < q->cbRing / 4)
+        {
+            q->bSampling = 0;
+        }
+        if (q->bSampling && q->nOffered++ % RECORD_SAMPLE_EVERY != 0)
+        {
+            RecordDrop(q, cb);
+            *pbWake = 1;
+            return RECORD_DROPPED;
+        }
+    }
+
+    if (need > q->cbRing - used)
+    {
+        *pbWake = 1;
+        if (q->policy == RECORD_BLOCK)
+            return RECORD_FULL;
+        RecordDrop(q, cb);
+        return RECORD_DROPPED;
+    }
+
+    h.ms = ms;
+    h.cbDropped = q->cbDropped;
+    h.cb = (unsigned int)cb;
+    h.reserved = 0;
+    RingWrite(q, tail, &h, sizeof(h));
+    RingWrite(q, tail + (long long)sizeof(h), data, cb);
+    AtomicStoreRelease(&q->tail, tail + (long long)need);
+
+    q->cbDropped = 0;
+    q->cbRecordedTotal += (long long)cb;
+
+    /* The writer's timer is enough until a quarter of the ring is in use */
+    *pbWake = used + need > q->cbRing / 4;
+    return RECORD_QUEUED;
+}
+
+void RecordDrop(RecordQueue *q, size_t cb)
+{
+    q->cbDropped += cb;
+    q->cbDroppedTotal += (long long)cb;
+}
+
+int RecordTake(RecordQueue *q, RecordChunk *pChunk, unsigned char *pData)
+{
+    RecordHeader h;
+    long long head = q->head;
+
+    if (AtomicLoadAcquire(&q->tail) == head)
+        return 0;
+
+    RingRead(q, head, &h, sizeof(h));
+    RingRead(q, head + (long long)sizeof(h), pData, h.cb);
+    AtomicStoreRelease(&q->head, head + (long long)(sizeof(h) + h.cb));
+
+    pChunk->ms = h.ms;
+    pChunk->cbDropped = h.cbDropped;
+    pChunk->cb = h.cb;
+    return 1;
+}
+
+/**
+ * Length of the valid UTF-8 sequence at p, INCOMPLETE if it is valid so far
+ * but runs past the end, or 0 if invalid with *pcbInvalid set to the bytes
+ * to replace (the lead byte and the continuation bytes it did allow)
+ */
+static size_t SequenceLength(const unsigned char *p, size_t avail, size_t *pcbInvalid)
+{
+    unsigned char lo = 0x80, hi = 0xBF;
+    size_t n, k;
+
+    *pcbInvalid = 1;
+    if (p[0] >= 0xC2 && p[0] <= 0xDF)
+        n = 2;
+    else if (p[0] >= 0xE0 && p[0] <= 0xEF)
+    {
+        n = 3;
+        if (p[0] == 0xE0)
+            lo = 0xA0;
+        else if (p[0] == 0xED)
+            hi = 0x9F;          /* No surrogates */
+    }
+    else if (p[0] >= 0xF0 && p[0] <= 0xF4)
+    {
+        n = 4;
+        if (p[0] == 0xF0)
+            lo = 0x90;
+        else if (p[0] == 0xF4)
+            hi = 0x8F;
+    }
+    else
+        return 0;
+
+    for (k = 1; k < n; k++)
+    {
+        if (k >= avail)
+            return INCOMPLETE;
+        if (p[k] < lo || p[k] > hi)
+        {
+            *pcbInvalid = k;
+            return 0;
+        }
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return n;
+}
+
+/**
+ * JSON string body for terminal output: control characters escaped and
+ * invalid UTF-8 replaced by U+FFFD. With bMore, a sequence cut off at the
+ * end is left for the next chunk. Returns the bytes of p consumed; out
+ * needs 6 bytes per byte of p.
+ */
+static size_t EscapeJson(const unsigned char *p, size_t cb, int bMore, char *out, size_t *pcbOut)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i = 0, o = 0, n, cbInvalid;
+
+    while (i < cb)
+    {
+        unsigned char c = p[i];
+
+        if (c < 0x80)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out[o++] = '\\';
+                out[o++] = (char)c;
+            }
+            else if (c == '\n' || c == '\r' || c == '\t')
+            {
+                out[o++] = '\\';
+                out[o++] = c == '\n' ? 'n' : c == '\r' ? 'r' : 't';
+            }
+            else if (c < 0x20 || c == 0x7f)
+            {
+                memcpy(out + o, "\\u00", 4);
+                out[o + 4] = hex[c >> 4];
+                out[o + 5] = hex[c & 15];
+                o += 6;
+            }
+            else
+            {
+                out[o++] = (char)c;
+            }
+            i++;
+            continue;
+        }
+
+        n = SequenceLength(p + i, cb - i, &cbInvalid);
+        if (n == INCOMPLETE)
+        {
+            if (bMore)
+                break;
+            n = 0;
+            cbInvalid = cb - i;
+        }
+        if (n == 0)
+        {
+            memcpy(out + o, "\\ufffd", 6);
+            o += 6;
+            i += cbInvalid;
+            continue;
+        }
+        memcpy(out + o, p + i, n);
+        o += n;
+        i += n;
+    }
+
+    *pcbOut = o;
+    return i;
+}
+
+static void FlushBatch(RecordWriter *w, unsigned long long nowMs)
+{
+    size_t cbOut = GzipMember(&w->gzip, w->pBatch, w->cbBatch, w->pOut, GZIP_BOUND(w->cbBatchMax));
+
+    if (!w->bError && (cbOut == 0 || !w->pfnWrite(w->pOut, cbOut, w->pContext)))
+        w->bError = 1;
+    if (!w->bError)
+        w->cbWritten += cbOut;
+    w->cbBatch = 0;
+    w->msFlushed = nowMs;
+}
+
+/**
+ * "[<seconds>, "<code>", "" - the start of an event line
+ */
+static void AppendEventStart(RecordWriter *w, unsigned long long ms, char code, size_t cbBody)
+{
+    unsigned long long t = ms > w->msStart ? ms - w->msStart : 0;
+
+    if (w->cbBatch + EVENT_MAX(cbBody) > w->cbBatchMax)
+        FlushBatch(w, ms);
+    w->cbBatch += (size_t)snprintf(w->pBatch + w->cbBatch, 64, "[%llu.%03u, \"%c\", \"",
+        t / 1000, (unsigned int)(t % 1000), code);
+}
+
+static void AppendEventEnd(RecordWriter *w)
+{
+    memcpy(w->pBatch + w->cbBatch, "\"]\n", 3);
+    w->cbBatch += 3;
+}
+
+static void AppendMarker(RecordWriter *w, unsigned long long ms, unsigned long long cbDropped)
+{
+    AppendEventStart(w, ms, 'm', 0);
+    w->cbBatch += (size_t)snprintf(w->pBatch + w->cbBatch, 48, "dropped %llu bytes", cbDropped);
+    AppendEventEnd(w);
+}
+
+/**
+ * Output event for w->pChunk (cb bytes, after the carried sequence)
+ */
+static void AppendOutput(RecordWriter *w, unsigned long long ms, size_t cb, int bMore)
+{
+    size_t cbUsed, cbEscaped, cbMark;
+
+    if (w->cbBatch + EVENT_MAX(cb) > w->cbBatchMax)
+        FlushBatch(w, ms);
+    cbMark = w->cbBatch;
+    AppendEventStart(w, ms, 'o', cb);
+    cbUsed = EscapeJson(w->pChunk, cb, bMore, w->pBatch + w->cbBatch, &cbEscaped);
+    w->cbBatch += cbEscaped;
+    AppendEventEnd(w);
+
+    /* Nothing but the start of a sequence: no event yet */
+    if (cbUsed == 0)
+        w->cbBatch = cbMark;
+    w->cbCarry = cb - cbUsed;
+    memmove(w->pChunk, w->pChunk + cbUsed, w->cbCarry);
+}
+
+int RecordWriterInit(RecordWriter *w, RecordWriteFunc pfnWrite, void *pContext,
+    int cols, int rows, long long unixTime, const char *pszTitle, unsigned long long msStart)
+{
+    size_t cbTitle = strlen(pszTitle), cbEscaped;
+
+    memset(w, 0, sizeof(*w));
+    w->pfnWrite = pfnWrite;
+    w->pContext = pContext;
+    w->msStart = msStart;
+    w->msFlushed = msStart;
+    w->cbBatchMax = RECORD_BATCH_BYTES + EVENT_MAX(RECORD_CHUNK_MAX + 4) + EVENT_MAX(cbTitle) + 256;
+    w->pBatch = (char *)malloc(w->cbBatchMax);
+    w->pChunk = (unsigned char *)malloc(RECORD_CHUNK_MAX + 4);
+    w->pOut = (unsigned char *)malloc(GZIP_BOUND(w->cbBatchMax));
+    if (!w->pBatch || !w->pChunk || !w->pOut || !GzipInit(&w->gzip))
+    {
+        RecordWriterFree(w);
+        return 0;
+    }
+
+    w->cbBatch = (size_t)snprintf(w->pBatch, 128,
+        "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, \"title\": \"",
+        cols, rows, unixTime);
+    EscapeJson((const unsigned char *)pszTitle, cbTitle, 0, w->pBatch + w->cbBatch, &cbEscaped);
+    w->cbBatch += cbEscaped;
+    w->cbBatch += (size_t)snprintf(w->pBatch + w->cbBatch, 64,
+        "\", \"env\": {\"TERM\": \"xterm-256color\"}}\n");
+    return 1;
+}
+
+void RecordWriterFree(RecordWriter *w)
+{
+    free(w->pBatch);
+    free(w->pChunk);
+    free(w->pOut);
+    GzipFree(&w->gzip);
+    w->pBatch = NULL;
+    w->pChunk = NULL;
+    w->pOut = NULL;
+}
+
+int RecordWriterPump(RecordWriter *w, RecordQueue *q, unsigned long long nowMs, int bFinal)
+{
+    RecordChunk c;
+
+    while (RecordTake(q, &c, w->pChunk + w->cbCarry))
+    {
+        /* A sequence cut off before lost output cannot be completed */
+        if (c.cbDropped)
+        {
+            memmove(w->pChunk, w->pChunk + w->cbCarry, c.cb);
+            w->cbCarry = 0;
+            AppendMarker(w, c.ms, c.cbDropped);
+        }
+        AppendOutput(w, c.ms, w->cbCarry + c.cb, 1);
+        if (w->cbBatch >= RECORD_BATCH_BYTES)
+            FlushBatch(w, nowMs);
+    }
+
+    /* The relay has stopped, so what it last dropped can be read here */
+    if (bFinal)
+    {
+        if (w->cbCarry)
+            AppendOutput(w, nowMs, w->cbCarry, 0);
+        if (q->cbDropped)
+        {
+            AppendMarker(w, nowMs, q->cbDropped);
+            q->cbDropped = 0;
+        }
+    }
+
+    if (w->cbBatch && (bFinal || nowMs - w->msFlushed >= RECORD_BATCH_MS))
+        FlushBatch(w, nowMs);
+    return !w->bError;
+}
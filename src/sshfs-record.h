@@ -0,0 +1,130 @@
+/**
+ * sshfs-record.h
+ *
+ * Session recording for the terminal relay (--record): the server's output
+ * is saved as an asciicast v2 stream (asciinema's format), gzip compressed.
+ *
+ * The relay's output thread only copies each chunk, with the time it was
+ * read, into a single-producer single-consumer ring (RecordOffer()), after
+ * the chunk has gone to the console. A writer thread takes the chunks out,
+ * turns them into asciicast events and compresses them in batches, each
+ * batch one gzip member (sshfs-gzip.c), so the file is readable up to the
+ * last batch written even if the relay is killed.
+ *
+ * When the writer falls behind the ring fills. Under RECORD_SAMPLE (the
+ * default) every RECORD_SAMPLE_EVERY-th chunk is still recorded while the
+ * ring is over half full, until it has drained to a quarter, and chunks
+ * that do not fit are dropped: the live terminal never waits. Under
+ * RECORD_BLOCK nothing is sampled out and the caller waits for room, up to
+ * a limit of its choosing, before dropping. Lost output shows up in the
+ * recording as a marker event ("m") with the number of bytes.
+ */
+
+#ifndef SSHFS_RECORD_H
+#define SSHFS_RECORD_H
+
+#include <stddef.h>
+
+#include "sshfs-gzip.h"
+
+#define RECORD_RING_SIZE    (4 * 1024 * 1024)   /* Power of two */
+#define RECORD_CHUNK_MAX    65536               /* Larger chunks are dropped */
+#define RECORD_SAMPLE_EVERY 8
+#define RECORD_BATCH_BYTES  (256 * 1024)        /* Of asciicast text per gzip member */
+#define RECORD_BATCH_MS     1000                /* Longest a recorded chunk waits for its batch */
+
+typedef enum {
+    RECORD_SAMPLE,
+    RECORD_BLOCK
+} RecordPolicy;
+
+typedef enum {
+    RECORD_QUEUED,
+    RECORD_DROPPED,                 /* Sampled out or no room; counted for the marker */
+    RECORD_FULL                     /* RECORD_BLOCK: offer it again, or RecordDrop() */
+} RecordResult;
+
+typedef struct RecordQueue {
+    unsigned char *pRing;
+    size_t cbRing;
+    volatile long long head;        /* Consumed so far, written by the writer only */
+    volatile long long tail;        /* Queued so far, written by the relay only */
+    RecordPolicy policy;
+
+    /* Relay side */
+    int bSampling;
+    unsigned long nOffered;
+    unsigned long long cbDropped;   /* Since the last queued chunk */
+
+    volatile long long cbRecordedTotal;
+    volatile long long cbDroppedTotal;
+} RecordQueue;
+
+/**
+ * One chunk as the writer takes it
+ */
+typedef struct RecordChunk {
+    unsigned long long ms;          /* When the relay read it */
+    unsigned long long cbDropped;   /* Output lost just before it */
+    size_t cb;
+} RecordChunk;
+
+/**
+ * Returns 0 if out of memory
+ */
+int RecordQueueInit(RecordQueue *q, RecordPolicy policy);
+void RecordQueueFree(RecordQueue *q);
+
+/**
+ * Queue a chunk of output (relay thread, lock-free). *pbWake is set when
+ * the writer should not wait for its next round: the ring is filling up.
+ */
+RecordResult RecordOffer(RecordQueue *q, const void *data, size_t cb, unsigned long long ms, int *pbWake);
+
+/**
+ * Give up on a chunk RecordOffer() had no room for
+ */
+void RecordDrop(RecordQueue *q, size_t cb);
+
+/**
+ * Take the next chunk into pData (RECORD_CHUNK_MAX bytes; writer thread).
+ * Returns 0 if the ring is empty.
+ */
+int RecordTake(RecordQueue *q, RecordChunk *pChunk, unsigned char *pData);
+
+/**
+ * Sink for compressed batches; returns 0 on a write error
+ */
+typedef int (*RecordWriteFunc)(const void *data, size_t cb, void *pContext);
+
+typedef struct RecordWriter {
+    RecordWriteFunc pfnWrite;
+    void *pContext;
+    unsigned long long msStart;     /* Time 0 of the events */
+    unsigned long long msFlushed;
+    char *pBatch;                   /* Asciicast lines not compressed yet */
+    size_t cbBatch, cbBatchMax;
+    unsigned char *pChunk;          /* Taken chunk, after a cut-off UTF-8 sequence */
+    size_t cbCarry;                 /* Bytes of that sequence */
+    unsigned char *pOut;            /* GZIP_BOUND(cbBatchMax) */
+    GzipCompressor gzip;
+    unsigned long long cbWritten;   /* Compressed bytes so far */
+    int bError;
+} RecordWriter;
+
+/**
+ * Start a recording: the asciicast header (terminal size, start time in
+ * Unix seconds, title) goes into the first batch. Returns 0 if out of memory.
+ */
+int RecordWriterInit(RecordWriter *w, RecordWriteFunc pfnWrite, void *pContext,
+    int cols, int rows, long long unixTime, const char *pszTitle, unsigned long long msStart);
+void RecordWriterFree(RecordWriter *w);
+
+/**
+ * Turn what is queued into events, and compress and write the batch once
+ * it is full, RECORD_BATCH_MS have passed since the last write, or bFinal
+ * (the relay has stopped offering). Returns 0 once a write has failed.
+ */
+int RecordWriterPump(RecordWriter *w, RecordQueue *q, unsigned long long nowMs, int bFinal);
+
+#endif /* SSHFS_RECORD_H */
@@ -0,0 +1,87 @@
+/**
+ * sshfs-relay.c
+ *
+ * Portable relay helpers shared by sshfs-ssh-launcher.c (ConPTY) and
+ * sshfs-ssh-launcher-posix.c (forkpty).
+ */
+
+#include "sshfs-relay.h"
+
+#include <string.h>
+
+static char LowerAscii(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+void PromptMatcherInit(PromptMatcher *pm, const char *pattern)
+{
+    size_t i, k;
+
+    memset(pm, 0, sizeof(*pm));
+
+    for (i = 0; pattern[i] && i < PROMPT_MAX_PATTERN - 1; i++)
+        pm->pattern[i] = LowerAscii(pattern[i]);
+    pm->patternLen = i;
+
+    /* Build KMP failure table so a mismatch never rescans old bytes */
+    k = 0;
+    for (i = 1; i < pm->patternLen; i++)
+    {
+        while (k > 0 && pm->pattern[i] != pm->pattern[k])
+            k = pm->failure[k - 1];
+        if (pm->pattern[i] == pm->pattern[k])
+            k++;
+        pm->failure[i] = k;
+    }
+}
+
+size_t PromptMatcherFeed(PromptMatcher *pm, const char *data, size_t len)
+{
+    size_t i;
+
+    if (pm->patternLen == 0)
+        return 0;
+
+    for (i = 0; i < len; i++)
+    {
+        char c = LowerAscii(data[i]);
+
+        while (pm->matched > 0 && c != pm->pattern[pm->matched])
+            pm->matched = pm->failure[pm->matched - 1];
+        if (c == pm->pattern[pm->matched])
+            pm->matched++;
+
+        if (pm->matched == pm->patternLen)
+        {
+            pm->matched = 0;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void PromptMatcherReset(PromptMatcher *pm)
+{
+    pm->matched = 0;
+}
+
+size_t RelayFormatPasswordLine(const char *password, char *out, size_t cbOut)
+{
+    size_t len = strlen(password);
+
+    if (len + 2 > cbOut)
+        return 0;
+
+    memcpy(out, password, len);
+    out[len] = '\n';
+    out[len + 1] = '\0';
+    return len + 1;
+}
+
+void RelaySecureZero(void *p, size_t len)
+{
+    volatile unsigned char *v = (volatile unsigned char *)p;
+    while (len--)
+        *v++ = 0;
+}
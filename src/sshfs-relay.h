@@ -0,0 +1,63 @@
+/**
+ * sshfs-relay.h
+ *
+ * Portable pieces of the terminal relay shared by the Windows (ConPTY) and
+ * POSIX (forkpty) launchers: password prompt detection and helpers for
+ * handing the stored password to ssh.
+ *
+ * Plain C with no platform headers so it builds with MSVC and GCC alike.
+ */
+
+#ifndef SSHFS_RELAY_H
+#define SSHFS_RELAY_H
+
+#include <stddef.h>
+
+#define PROMPT_MAX_PATTERN 32
+
+/* Bytes of UTF-8 in the launcher's password pipe: sshfs-ssh.exe keeps a
+ * stored password in 256 UTF-16 units, and the launcher reads up to the
+ * end of the pipe */
+#define RELAY_MAX_PASSWORD (256 * 3)
+
+/**
+ * Streaming, case-insensitive matcher for a prompt string.
+ * Keeps partial-match state between calls, so a prompt split across two
+ * reads from the pty is still detected.
+ */
+typedef struct PromptMatcher {
+    char pattern[PROMPT_MAX_PATTERN];       /* lowercase pattern */
+    size_t patternLen;
+    size_t failure[PROMPT_MAX_PATTERN];     /* KMP failure table */
+    size_t matched;                         /* pattern bytes matched so far */
+} PromptMatcher;
+
+/**
+ * Initialize a matcher for pattern (truncated to PROMPT_MAX_PATTERN - 1)
+ */
+void PromptMatcherInit(PromptMatcher *pm, const char *pattern);
+
+/**
+ * Feed output bytes. Returns the offset just past the end of the first
+ * complete match within data, or 0 if the pattern has not completed yet.
+ */
+size_t PromptMatcherFeed(PromptMatcher *pm, const char *data, size_t len);
+
+/**
+ * Forget any partial match
+ */
+void PromptMatcherReset(PromptMatcher *pm);
+
+/**
+ * Format the password line sent to ssh once the prompt is seen.
+ * Returns the number of bytes written (excluding the terminator), or 0 if
+ * the password does not fit.
+ */
+size_t RelayFormatPasswordLine(const char *password, char *out, size_t cbOut);
+
+/**
+ * Zero memory holding secrets in a way the compiler will not optimize out
+ */
+void RelaySecureZero(void *p, size_t len);
+
+#endif /* SSHFS_RELAY_H */
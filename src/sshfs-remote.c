@@ -0,0 +1,705 @@
+/**
+ * sshfs-remote.c
+ *
+ * Remote command construction and progress parsing (see sshfs-remote.h)
+ */
+
+#include "sshfs-remote.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREFIX "#sshfs-"
+#define PREFIX_LEN 7
+
+/**
+ * Output cursor that keeps counting once the buffer is full
+ */
+typedef struct Writer {
+    char *out;
+    size_t cbOut;
+    size_t len;
+} Writer;
+
+static void Put(Writer *w, const char *s, size_t n)
+{
+    if (w->len < w->cbOut)
+    {
+        size_t room = w->cbOut - w->len - 1;
+        memcpy(w->out + w->len, s, n < room ? n : room);
+    }
+    w->len += n;
+}
+
+static void PutStr(Writer *w, const char *s)
+{
+    Put(w, s, strlen(s));
+}
+
+/**
+ * Bytes for inside single quotes: each ' becomes '\''
+ */
+static void PutEscaped(Writer *w, const char *s, size_t n)
+{
+    const char *end = s + n;
+
+    while (s < end)
+    {
+        const char *q = memchr(s, '\'', (size_t)(end - s));
+        if (!q)
+        {
+            Put(w, s, (size_t)(end - s));
+            break;
+        }
+        Put(w, s, (size_t)(q - s));
+        Put(w, "'\\''", 4);
+        s = q + 1;
+    }
+}
+
+static void PutQuoted(Writer *w, const char *s, size_t n)
+{
+    Put(w, "'", 1);
+    PutEscaped(w, s, n);
+    Put(w, "'", 1);
+}
+
+static void PutPath(Writer *w, const char *pszPath)
+{
+    size_t n = strlen(pszPath);
+
+    /* A trailing slash would leave the basename empty in the script */
+    while (n > 1 && pszPath[n - 1] == '/')
+        n--;
+
+    if (n == 1 && pszPath[0] == '~')
+    {
+        Put(w, "~", 1);
+    }
+    else if (n >= 2 && pszPath[0] == '~' && pszPath[1] == '/')
+    {
+        Put(w, "~/", 2);
+        if (n > 2)
+            PutQuoted(w, pszPath + 2, n - 2);
+    }
+    else
+    {
+        PutQuoted(w, pszPath, n);
+    }
+}
+
+static size_t Finish(Writer *w)
+{
+    if (w->cbOut > 0)
+        w->out[w->len < w->cbOut ? w->len : w->cbOut - 1] = '\0';
+    return w->len;
+}
+
+size_t RemoteQuotePath(const char *pszPath, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    PutPath(&w, pszPath);
+    return Finish(&w);
+}
+
+size_t RemoteBuildTransferCommand(RemoteOperation op, const char *pszDest,
+    const char *const *ppszSources, size_t nSources, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    PutStr(&w, "d=");
+    PutPath(&w, pszDest);
+    PutStr(&w, "; set --");
+    for (size_t i = 0; i < nSources; i++)
+    {
+        Put(&w, " ", 1);
+        PutPath(&w, ppszSources[i]);
+    }
+    PutStr(&w, "; ");
+
+    /* Refuse up front rather than merge into or overwrite existing items */
+    PutStr(&w,
+        "for s; do if [ -e \"$d/${s##*/}\" ]; then "
+        "printf '" PREFIX "exists %s\\n' \"${s##*/}\"; exit 17; fi; done; ");
+
+    if (op == REMOTE_COPY)
+    {
+        /* Reflink makes same-filesystem copies near instant where supported (GNU cp) */
+        PutStr(&w,
+            "r=--reflink=auto; cp $r --help >/dev/null 2>&1 || r=; "
+            "printf '" PREFIX "total %s\\n' \"$(du -skc -- \"$@\" | tail -n 1 | cut -f1)\"; "
+            "i=0; b=0; for s; do i=$((i+1)); t=\"$d/${s##*/}\"; "
+            "printf '" PREFIX "item %d %d %s\\n' $i $# \"${s##*/}\"; "
+            "cp -a $r -- \"$s\" \"$d/\" & p=$!; "
+            "while kill -0 $p 2>/dev/null; do sleep 1; "
+            "k=$(du -sk -- \"$t\" 2>/dev/null | cut -f1); "
+            "printf '" PREFIX "kb %d\\n' $((b + ${k:-0})); done; "
+            "wait $p || exit $?; "
+            "k=$(du -sk -- \"$t\" 2>/dev/null | cut -f1); b=$((b + ${k:-0})); "
+            "printf '" PREFIX "kb %d\\n' $b; done; ");
+    }
+    else
+    {
+        /* Renames within one filesystem are instant: report items only */
+        PutStr(&w,
+            "i=0; for s; do i=$((i+1)); "
+            "printf '" PREFIX "item %d %d %s\\n' $i $# \"${s##*/}\"; "
+            "mv -- \"$s\" \"$d/\" || exit $?; done; ");
+    }
+
+    PutStr(&w, "printf '" PREFIX "done\\n'");
+    return Finish(&w);
+}
+
+size_t RemoteBuildArchiveCommand(const char *pszDir, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    /* exec: tar's exit status (1 = a file changed while read) becomes ssh's */
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " && exec tar cf - .");
+    return Finish(&w);
+}
+
+size_t RemoteBuildExtractCommand(const char *pszDest,
+    const char *const *ppszNames, size_t nNames, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDest[0] ? pszDest : "~");
+    PutStr(&w, " || exit 1; set --");
+    for (size_t i = 0; i < nNames; i++)
+    {
+        Put(&w, " ", 1);
+        PutQuoted(&w, ppszNames[i], strlen(ppszNames[i]));
+    }
+
+    /* Same rule as copy/move: nothing is merged into or overwritten */
+    PutStr(&w,
+        "; for s; do if [ -e \"$s\" ] || [ -L \"$s\" ]; then "
+        "printf '" PREFIX "exists %s\\n' \"$s\"; exit 17; fi; done; "
+        "exec tar xf -");
+    return Finish(&w);
+}
+
+size_t RemoteBuildHashCommand(const char *pszDir, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    /* One sha256sum per batch of names; they are "./" prefixed, so none looks like an option */
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " && exec xargs -0 sha256sum");
+    return Finish(&w);
+}
+
+/**
+ * Quoted find -iname pattern: the query itself if it has wildcards,
+ * otherwise *query* with glob characters taken literally
+ */
+static void PutNameGlob(Writer *w, const char *pszQuery)
+{
+    if (strpbrk(pszQuery, "*?"))
+    {
+        PutQuoted(w, pszQuery, strlen(pszQuery));
+        return;
+    }
+
+    Put(w, "'*", 2);
+    for (const char *p = pszQuery; *p; p++)
+    {
+        if (*p == '\'')
+            Put(w, "'\\''", 4);
+        else if (strchr("[]\\", *p))
+        {
+            Put(w, "\\", 1);
+            Put(w, p, 1);
+        }
+        else
+            Put(w, p, 1);
+    }
+    Put(w, "*'", 2);
+}
+
+size_t RemoteBuildSearchCommand(const char *pszDir, RemoteSearchMode mode,
+    const char *pszQuery, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " || exit 1; ");
+
+    if (mode == REMOTE_SEARCH_NAMES)
+    {
+        PutStr(&w, "exec find . -mindepth 1 -iname ");
+        PutNameGlob(&w, pszQuery);
+        PutStr(&w, " -print0");
+        return Finish(&w);
+    }
+
+    /* ripgrep when installed (parallel, skips binaries fast), else grep.
+     * Both print "path\0line:text"; nothing is skipped for .gitignore. */
+    PutStr(&w,
+        "if command -v rg >/dev/null 2>&1; then exec rg --null --no-heading --with-filename "
+        "--line-number --color never --hidden --no-ignore --max-columns 500 "
+        "--max-columns-preview -i -F -e ");
+    PutQuoted(&w, pszQuery, strlen(pszQuery));
+    PutStr(&w, " .; fi; exec grep -rnIiZ -F -e ");
+    PutQuoted(&w, pszQuery, strlen(pszQuery));
+    PutStr(&w, " .");
+    return Finish(&w);
+}
+
+size_t RemoteBuildSnapshotCommand(const char *pszDir, long long since, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    char szSince[32];
+
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " || exit 1; printf '#time %s\\0' \"$(date +%s)\"; ");
+
+    if (since < 0)
+    {
+        PutStr(&w, "exec find . -mindepth 1 -printf '%y\\t%s\\t%T@\\t%P\\0'");
+        return Finish(&w);
+    }
+
+    /* A second early so nothing changed while the last listing ran is missed */
+    snprintf(szSince, sizeof(szSince), "@%lld", since - 1);
+
+    /* Every folder and whatever changed, then the full contents of the
+     * folders that changed: only those can have lost entries */
+    PutStr(&w, "find . -mindepth 1 \\( -type d -o -newermt ");
+    PutStr(&w, szSince);
+    PutStr(&w, " \\) -printf '%y\\t%s\\t%T@\\t%P\\0'; find . -type d -newermt ");
+    PutStr(&w, szSince);
+    PutStr(&w, " -print0 | xargs -0 -r sh -c 'for d; do printf \"#list %s\\0\" \"$d\"; done; "
+        "exec find \"$@\" -mindepth 1 -maxdepth 1 -printf \"%y\\t%s\\t%T@\\t%p\\0\"' sh");
+    return Finish(&w);
+}
+
+size_t RemoteBuildUsageCommand(const char *pszDir, long long since, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    char szSince[32];
+
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " || exit 1; ");
+
+    /* Sizes only change with an mtime: one newer entry is enough to stop at.
+     * Without -newermt nothing can be checked, so du runs again. */
+    if (since >= 0)
+    {
+        snprintf(szSince, sizeof(szSince), "@%lld", since - 1);
+        PutStr(&w, "if find /dev/null -newermt @0 >/dev/null 2>&1 && "
+            "[ -z \"$(find . -xdev -newermt ");
+        PutStr(&w, szSince);
+        PutStr(&w, " -print -quit 2>/dev/null)\" ]; then printf '#fresh\\0'; exit 0; fi; ");
+    }
+
+    PutStr(&w, "printf '#time %s\\0' \"$(date +%s)\"; "
+        "if du -0 -s /dev/null >/dev/null 2>&1; then exec du -0 -k -x .; fi; "
+        "printf '#lines\\0'; exec du -k -x .");
+    return Finish(&w);
+}
+
+size_t RemoteBuildWatchCommand(const char *pszDir, int pollSeconds, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    char szSleep[32];
+
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " || exit 1; ");
+
+    /* An overflow record when inotifywait stops, so everything is refreshed
+     * before polling takes over */
+    PutStr(&w, "if command -v inotifywait >/dev/null 2>&1; then "
+        "inotifywait -m -r -q -e close_write,attrib,create,delete,moved_from,moved_to,delete_self,move_self "
+        "--format \"$(printf '%%e\\t%%w%%f')\" .; printf 'Q_OVERFLOW\\t.\\n'; fi; ");
+
+    snprintf(szSleep, sizeof(szSleep), "%d", pollSeconds > 0 ? pollSeconds : 5);
+    PutStr(&w, "t=$(date +%s); while sleep ");
+    PutStr(&w, szSleep);
+    PutStr(&w, "; do n=$(date +%s); find . -newermt \"@$t\" "
+        "\\( -type d -printf 'POLL,ISDIR\\t%p\\n' -o -printf 'POLL\\t%p\\n' \\) 2>/dev/null; t=$n; done");
+    return Finish(&w);
+}
+
+size_t RemoteBuildDeltaCommand(const char *pszFile, size_t cbBlock, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    char szBlock[32];
+
+    snprintf(szBlock, sizeof(szBlock), "%lu", (unsigned long)cbBlock);
+    PutStr(&w, "f=");
+    PutPath(&w, pszFile);
+    PutStr(&w, "; b=");
+    PutStr(&w, szBlock);
+    PutStr(&w, "; [ -f \"$f\" ] || { echo '#notfile'; exit 1; }; t=\"$f.sshfs-sync.$$\"; "
+        "trap 'rm -f \"$t.b\" \"$t.ops\" \"$t.lit\" \"$t.new\"' 0; "
+        "echo \"#size $(($(wc -c < \"$f\")))\"; ");
+
+    /* One pass with GNU split; elsewhere a dd per block */
+    PutStr(&w, "if split --filter=: /dev/null 2>/dev/null; then "
+        "T=\"$t.b\" SHELL=/bin/sh split -b $b --filter='cat > \"$T\"; cksum < \"$T\"; sha256sum < \"$T\"' -- \"$f\"; "
+        "else n=0; while dd if=\"$f\" of=\"$t.b\" bs=$b skip=$n count=1 2>/dev/null && [ -s \"$t.b\" ]; do "
+        "cksum < \"$t.b\"; sha256sum < \"$t.b\"; n=$((n+1)); done; fi; "
+        "rm -f \"$t.b\"; echo '#end'; ");
+
+    /* sh's read takes a byte at a time from a pipe, so the literal bytes
+     * behind the operations stay for cat */
+    PutStr(&w, "read -r c h s || exit 0; [ \"$c\" = '#apply' ] || exit 0; "
+        "while read -r o x y && [ \"$o\" != . ]; do echo \"$o $x $y\"; done > \"$t.ops\"; "
+        "cat > \"$t.lit\"; "
+        "p=0; while read -r o x y; do case $o in "
+        "c) dd if=\"$f\" bs=$b skip=$x count=$y 2>/dev/null;; "
+        "l) tail -c +$((p+1)) \"$t.lit\" | head -c $x; p=$((p+x));; "
+        "esac; done < \"$t.ops\" > \"$t.new\" && r=$(sha256sum < \"$t.new\") && "
+        "[ \"${r%% *}\" = \"$h\" ] && [ $(($(wc -c < \"$t.new\"))) = \"$s\" ] || { echo '#mismatch'; exit 1; }; "
+        "m=$(stat -c %a \"$f\" 2>/dev/null) && chmod \"$m\" \"$t.new\"; "
+        "mv -f \"$t.new\" \"$f\" && echo '#ok'");
+    return Finish(&w);
+}
+
+size_t RemoteBuildExecCommand(const char *pszDir, const char *const *ppszArgs, size_t nArgs,
+    char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    size_t i;
+
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " || exit 1; ");
+
+    /* sshd made this shell the leader of its own process group. Signals
+     * that an async list would inherit as ignored are trapped here instead,
+     * so the command starts with the default handlers while the wrapper
+     * lives on to report its status. */
+    PutStr(&w, "trap : INT TERM; exec 3<&0 </dev/null; "
+        "{ trap '' INT TERM HUP; while read -r k; do case $k in "
+        "i) kill -INT 0;; t) kill -TERM 0;; k) kill -KILL 0;; esac; done; kill -HUP 0; } "
+        "<&3 >/dev/null 2>&1 & w=$!; exec 3<&-; \"${SHELL:-/bin/sh}\" -c ");
+    Put(&w, "'", 1);
+    for (i = 0; i < nArgs; i++)
+    {
+        if (i > 0)
+            Put(&w, " ", 1);
+        PutEscaped(&w, ppszArgs[i], strlen(ppszArgs[i]));
+    }
+    PutStr(&w, "'; s=$?; kill $w 2>/dev/null; exit $s");
+    return Finish(&w);
+}
+
+char RemoteExecSignal(int nPresses)
+{
+    if (nPresses <= 1)
+        return REMOTE_EXEC_INTERRUPT;
+    return nPresses == 2 ? REMOTE_EXEC_TERMINATE : REMOTE_EXEC_KILL;
+}
+
+size_t RemoteBuildBenchCommand(const char *pszDir, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+
+    PutStr(&w, "echo '" PREFIX "bench session'; cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+    PutStr(&w, " || exit 1; echo '" PREFIX "bench cd'; "
+        "exec \"${SHELL:-/bin/sh}\" -i -c 'echo \"" PREFIX "bench shell\"' </dev/null 2>/dev/null");
+    return Finish(&w);
+}
+
+size_t RemoteBuildThumbCommand(const char *pszDir, int size, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    char szSize[32];
+
+    snprintf(szSize, sizeof(szSize), "%d", size > 0 ? size : 256);
+    PutStr(&w, "cd ");
+    PutPath(&w, pszDir[0] ? pszDir : "~");
+
+    /* C locale: ${#f} counts bytes, which is what the frames carry */
+    PutStr(&w, " || exit 1; LC_ALL=C; export LC_ALL; s=");
+    PutStr(&w, szSize);
+    PutStr(&w, "; if command -v magick >/dev/null 2>&1; then g=magick; "
+        "elif command -v convert >/dev/null 2>&1; then g=convert; "
+        "elif command -v vipsthumbnail >/dev/null 2>&1; then g=vips; "
+        "else echo '" PREFIX "thumbs none'; exit 0; fi; "
+        "t=$(mktemp) || exit 1; trap 'rm -f \"$t\" \"$t.jpg\"' 0; "
+        "if command -v timeout >/dev/null 2>&1; then k='timeout 60'; else k=; fi; "
+        "echo \"" PREFIX "thumbs $g\"; ");
+
+    /* One broken file must not cost the rest: a failed frame, then on */
+    PutStr(&w, "while IFS= read -r f; do "
+        "m=$(stat -c %Y -- \"$f\" 2>/dev/null || stat -f %m -- \"$f\" 2>/dev/null) || m=0; "
+        ": >\"$t\"; "
+        "case $g in "
+        "vips) $k vipsthumbnail \"./$f\" -s $s -o \"$t.jpg[Q=80,strip]\" && mv -f \"$t.jpg\" \"$t\";; "
+        "*) $k $g \"./$f[0]\" -auto-orient -thumbnail \"${s}x$s>\" -strip -quality 80 \"jpg:$t\";; "
+        "esac </dev/null >/dev/null 2>&1; "
+        "n=$(($(wc -c <\"$t\"))); "
+        "if [ -f \"$f\" ] && [ $n -gt 0 ]; then printf 'T %s %s %s\\n%s' \"$m\" ${#f} $n \"$f\"; cat \"$t\"; "
+        "else printf 'E %s %s 0\\n%s' \"$m\" ${#f} \"$f\"; fi; "
+        "done; echo '" PREFIX "thumbs end'");
+    return Finish(&w);
+}
+
+/**
+ * 64-bit FNV-1a over n bytes, continuing from h
+ */
+static unsigned long long Fnv1a(unsigned long long h, const char *s, size_t n)
+{
+    while (n--)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+size_t RemoteSessionName(const char *pszUser, const char *pszHost, const char *pszPort,
+    const char *pszDir, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    unsigned long long h = 0xCBF29CE484222325ULL;
+    char szHash[32];
+    char szLabel[REMOTE_SESSION_LABEL_MAX + 1];
+    const char *pszLabel;
+    size_t cchDir = strlen(pszDir);
+    size_t cchLabel;
+    size_t i;
+
+    /* "~", "~/" and "" are all home; "/srv/" is "/srv" */
+    while (cchDir > 1 && pszDir[cchDir - 1] == '/')
+        cchDir--;
+    if (cchDir == 0 || (cchDir == 1 && pszDir[0] == '~'))
+    {
+        pszDir = "~";
+        cchDir = 1;
+    }
+    if (!pszPort || !pszPort[0])
+        pszPort = "22";
+
+    h = Fnv1a(h, pszUser, strlen(pszUser) + 1);
+    for (i = 0; pszHost[i]; i++)
+    {
+        char c = pszHost[i] >= 'A' && pszHost[i] <= 'Z' ? (char)(pszHost[i] + 32) : pszHost[i];
+        h = Fnv1a(h, &c, 1);
+    }
+    h = Fnv1a(h, "", 1);
+    h = Fnv1a(h, pszPort, strlen(pszPort) + 1);
+    h = Fnv1a(h, pszDir, cchDir);
+
+    /* The folder's own name, so "tmux ls" says which is which */
+    if (cchDir == 1 && pszDir[0] == '~')
+    {
+        pszLabel = "home";
+        cchLabel = 4;
+    }
+    else if (cchDir == 1 && pszDir[0] == '/')
+    {
+        pszLabel = "root";
+        cchLabel = 4;
+    }
+    else
+    {
+        pszLabel = pszDir + cchDir;
+        while (pszLabel > pszDir && pszLabel[-1] != '/')
+            pszLabel--;
+        cchLabel = (size_t)(pszDir + cchDir - pszLabel);
+    }
+    if (cchLabel > REMOTE_SESSION_LABEL_MAX)
+        cchLabel = REMOTE_SESSION_LABEL_MAX;
+
+    /* tmux takes neither '.' nor ':' in a name; keep it safe unquoted as well */
+    for (i = 0; i < cchLabel; i++)
+    {
+        char c = pszLabel[i];
+        szLabel[i] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '_' ? c : '_';
+    }
+    szLabel[cchLabel] = '\0';
+
+    snprintf(szHash, sizeof(szHash), "%012llx", h >> 16);
+    PutStr(&w, "sshfs-");
+    PutStr(&w, szLabel);
+    PutStr(&w, "-");
+    PutStr(&w, szHash);
+    return Finish(&w);
+}
+
+size_t RemoteBuildAttachCommand(const char *pszSession, int idleHours, char *out, size_t cbOut)
+{
+    Writer w = {out, cbOut, 0};
+    char szNum[32];
+
+    PutStr(&w, "s=");
+    PutQuoted(&w, pszSession, strlen(pszSession));
+
+    /*
+     * No double quotes anywhere: the command travels inside them on a
+     * Windows command line. $s needs none (RemoteSessionName's characters).
+     */
+    PutStr(&w, "; if command -v tmux >/dev/null 2>&1; then ");
+    if (idleHours > 0)
+    {
+        /* Detached sshfs sessions nobody typed in for idleHours */
+        snprintf(szNum, sizeof(szNum), "%lld", (long long)idleHours * 3600);
+        PutStr(&w, "t=$(date +%s); "
+            "tmux ls -F '#{session_name} #{session_attached} #{session_activity}' 2>/dev/null | "
+            "while read n a l; do case $n in sshfs-*) "
+            "[ $n != $s ] && [ $a = 0 ] && [ $((t - ${l:-t})) -ge ");
+        PutStr(&w, szNum);
+        PutStr(&w, " ] && tmux kill-session -t =$n;; esac; done; ");
+    }
+    PutStr(&w, "tmux new-session -A -s $s && exit; "
+        "elif command -v screen >/dev/null 2>&1; then ");
+    if (idleHours > 0)
+    {
+        /*
+         * screen keeps no activity time; its socket loses the owner's x bit
+         * on detach, which changes the socket's ctime
+         */
+        snprintf(szNum, sizeof(szNum), "%lld", (long long)idleHours * 60);
+        PutStr(&w, "d=$(screen -ls 2>/dev/null | awk '/Socket/ {print $NF}'); "
+            "for f in $(find ${d%.}/ -maxdepth 1 -name '*.sshfs-*' ! -name '*.'$s "
+            "! -perm -u+x -cmin +");
+        PutStr(&w, szNum);
+        PutStr(&w, " 2>/dev/null); do screen -S ${f##*/} -X quit; done; ");
+    }
+    PutStr(&w, "case $(screen -ls 2>/dev/null) in "
+        "*.$s[[:space:]]*) screen -x $s && exit;; "
+        "*) screen -S $s && exit;; esac; "
+        "fi; exec $SHELL");
+    return Finish(&w);
+}
+
+void RemoteProgressInit(RemoteProgress *rp)
+{
+    memset(rp, 0, sizeof(*rp));
+}
+
+static void CopyName(RemoteProgress *rp, const char *psz)
+{
+    size_t n = strlen(psz);
+    if (n >= sizeof(rp->szItem))
+        n = sizeof(rp->szItem) - 1;
+    memcpy(rp->szItem, psz, n);
+    rp->szItem[n] = '\0';
+}
+
+/**
+ * Keep the last lines of anything that is not a progress report
+ */
+static void KeepError(RemoteProgress *rp, const char *psz, size_t n)
+{
+    size_t cap = sizeof(rp->szErrors) - 1;
+
+    if (n + 1 > cap)
+    {
+        psz += n + 1 - cap;
+        n = cap - 1;
+    }
+    if (rp->cbErrors + n + 1 > cap)
+    {
+        size_t drop = rp->cbErrors + n + 1 - cap;
+        memmove(rp->szErrors, rp->szErrors + drop, rp->cbErrors - drop);
+        rp->cbErrors -= drop;
+    }
+    memcpy(rp->szErrors + rp->cbErrors, psz, n);
+    rp->cbErrors += n;
+    rp->szErrors[rp->cbErrors++] = '\n';
+    rp->szErrors[rp->cbErrors] = '\0';
+}
+
+static int ParseLine(RemoteProgress *rp, char *psz, size_t n)
+{
+    char *p, *end;
+
+    if (n == 0)
+        return 0;
+
+    if (n < PREFIX_LEN || memcmp(psz, PREFIX, PREFIX_LEN) != 0)
+    {
+        KeepError(rp, psz, n);
+        return 0;
+    }
+    p = psz + PREFIX_LEN;
+
+    if (strncmp(p, "total ", 6) == 0)
+    {
+        rp->kbTotal = strtoull(p + 6, NULL, 10);
+    }
+    else if (strncmp(p, "kb ", 3) == 0)
+    {
+        rp->kbDone = strtoull(p + 3, NULL, 10);
+    }
+    else if (strncmp(p, "item ", 5) == 0)
+    {
+        rp->nItem = strtoul(p + 5, &end, 10);
+        rp->nItems = strtoul(end, &end, 10);
+        CopyName(rp, *end == ' ' ? end + 1 : end);
+    }
+    else if (strncmp(p, "exists ", 7) == 0)
+    {
+        rp->bExists = 1;
+        CopyName(rp, p + 7);
+    }
+    else if (strcmp(p, "done") == 0)
+    {
+        rp->bDone = 1;
+        if (rp->kbTotal)
+            rp->kbDone = rp->kbTotal;
+    }
+    else
+    {
+        KeepError(rp, psz, n);
+        return 0;
+    }
+    return 1;
+}
+
+int RemoteProgressFeed(RemoteProgress *rp, const char *data, size_t len)
+{
+    int bChanged = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+
+        /* Remote ptys turn \n into \r\n */
+        if (c == '\r' || c == '\n')
+        {
+            rp->line[rp->cbLine] = '\0';
+            bChanged |= ParseLine(rp, rp->line, rp->cbLine);
+            rp->cbLine = 0;
+        }
+        else if (rp->cbLine < sizeof(rp->line) - 1)
+        {
+            rp->line[rp->cbLine++] = c;
+        }
+    }
+    return bChanged;
+}
+
+void RemoteProgressPosition(const RemoteProgress *rp,
+    unsigned long long *pCompleted, unsigned long long *pTotal)
+{
+    if (rp->kbTotal)
+    {
+        *pCompleted = rp->kbDone < rp->kbTotal ? rp->kbDone : rp->kbTotal;
+        *pTotal = rp->kbTotal;
+    }
+    else
+    {
+        *pCompleted = rp->bDone ? rp->nItems : (rp->nItem ? rp->nItem - 1 : 0);
+        *pTotal = rp->nItems ? rp->nItems : 1;
+    }
+}
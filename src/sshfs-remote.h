@@ -0,0 +1,219 @@
+/**
+ * sshfs-remote.h
+ *
+ * Server-side operations on files behind an sshfs mount: the shell command
+ * sent over one ssh exec, and the parser for the progress lines it prints.
+ * Shared by sshfs-ssh.exe (Explorer "Copy/Move here on server",
+ * "Download via stream", "Upload here via stream", "Hash on server",
+ * "Search on server", "Snapshot tree", "Disk usage on server", "Watch
+ * server changes" and "Sync changes to server", "exec", "--bench" and the
+ * terminal's attach mode) and the Linux sshfs-ssh.
+ *
+ * All strings are UTF-8 remote paths as produced by FormatRemotePath().
+ */
+
+#ifndef SSHFS_REMOTE_H
+#define SSHFS_REMOTE_H
+
+#include <stddef.h>
+
+/* Exit status of the transfer script when a name already exists at the destination */
+#define REMOTE_EXIT_EXISTS 17
+
+typedef enum {
+    REMOTE_COPY,
+    REMOTE_MOVE
+} RemoteOperation;
+
+/**
+ * Quote a remote path for a POSIX shell. "~" and a leading "~/" stay
+ * unquoted so the server still expands them. Works like snprintf: returns
+ * the length needed, the output is complete only if that is below cbOut.
+ */
+size_t RemoteQuotePath(const char *pszPath, char *out, size_t cbOut);
+
+/**
+ * Build the sh script that copies (cp -a, reflink when available) or moves
+ * the sources into pszDest on the server. Nothing is touched if any name
+ * already exists in pszDest. Progress is reported on stdout as
+ * "#sshfs-..." lines for RemoteProgressFeed(). snprintf-style return.
+ */
+size_t RemoteBuildTransferCommand(RemoteOperation op, const char *pszDest,
+    const char *const *ppszSources, size_t nSources, char *out, size_t cbOut);
+
+/**
+ * Build the command that streams everything below pszDir to stdout as one
+ * tar archive (entries relative to pszDir, "./..."). snprintf-style return.
+ */
+size_t RemoteBuildArchiveCommand(const char *pszDir, char *out, size_t cbOut);
+
+/**
+ * Build the command that unpacks a tar archive from stdin into pszDest.
+ * ppszNames are the top-level names the archive will create; if any of them
+ * already exists the script prints "#sshfs-exists <name>" and exits with
+ * REMOTE_EXIT_EXISTS before reading anything. snprintf-style return.
+ */
+size_t RemoteBuildExtractCommand(const char *pszDest,
+    const char *const *ppszNames, size_t nNames, char *out, size_t cbOut);
+
+/**
+ * Build the command that prints sha256sum lines for the NUL separated file
+ * names it reads on stdin (relative to pszDir, each starting with "./").
+ * Parse the output with HashParseLine(). snprintf-style return.
+ */
+size_t RemoteBuildHashCommand(const char *pszDir, char *out, size_t cbOut);
+
+typedef enum {
+    REMOTE_SEARCH_NAMES,            /* find -iname: "path\0" per match */
+    REMOTE_SEARCH_CONTENTS          /* rg or grep -F, ignoring case: "path\0line:text\n" */
+} RemoteSearchMode;
+
+/**
+ * Build the command that searches below pszDir, printing paths relative to
+ * it ("./..."). A name query without * or ? matches anywhere in the name.
+ * Parse the output with SearchParserFeed(). snprintf-style return.
+ */
+size_t RemoteBuildSearchCommand(const char *pszDir, RemoteSearchMode mode,
+    const char *pszQuery, char *out, size_t cbOut);
+
+/**
+ * Build the listing for "Snapshot tree": a "#time <server clock>" record,
+ * then one "%y\t%s\t%T@\t%P" record per entry below pszDir, each NUL
+ * terminated (IndexParseRecord()). With since >= 0 (the time of the last
+ * snapshot) only folders and entries modified since are listed, plus a
+ * "#list <folder>" record and the full contents of each modified folder
+ * (IndexBuildDelta()). snprintf-style return.
+ */
+size_t RemoteBuildSnapshotCommand(const char *pszDir, long long since, char *out, size_t cbOut);
+
+/**
+ * Build the du run for "Disk usage on server": a "#time <server clock>"
+ * record, then du's folder records for pszDir (one file system), NUL
+ * terminated, or newline terminated after a "#lines" record where du has
+ * no -0. With since >= 0 (the time of a cached run) it first looks for
+ * anything modified since and prints just "#fresh" if there is nothing.
+ * Parse the output with UsageTreeFeed(). snprintf-style return.
+ */
+size_t RemoteBuildUsageCommand(const char *pszDir, long long since, char *out, size_t cbOut);
+
+/**
+ * Build the watcher for "Watch server changes": inotifywait -m -r on pszDir
+ * printing "EVENTS\t./path" lines until the connection ends. Where
+ * inotifywait is missing or cannot watch the tree, a find loop prints
+ * "POLL\t./path" for whatever was modified every pollSeconds instead.
+ * Parse the output with WatchParserFeed(). snprintf-style return.
+ */
+size_t RemoteBuildWatchCommand(const char *pszDir, int pollSeconds, char *out, size_t cbOut);
+
+/**
+ * Build the two halves of "Sync changes to server" on the file pszFile, run
+ * over one channel: first the block list of the server copy in cbBlock
+ * blocks ("#size", then cksum and sha256sum per block, then "#end"; see
+ * DeltaSignatureFeed()). Then it reads "#apply <sha256> <size>", the
+ * operations (DeltaFormatOp()) up to a "." line and the literal bytes up to
+ * the end of stdin, rebuilds the file next to the old one and replaces it
+ * if the result has that digest and size, printing "#ok" or "#mismatch".
+ * Anything else in place of "#apply" leaves the file alone.
+ * snprintf-style return.
+ */
+size_t RemoteBuildDeltaCommand(const char *pszFile, size_t cbBlock, char *out, size_t cbOut);
+
+/* Control lines "exec" reads on stdin: signal the command's process group */
+#define REMOTE_EXEC_INTERRUPT   'i'     /* SIGINT */
+#define REMOTE_EXEC_TERMINATE   't'     /* SIGTERM */
+#define REMOTE_EXEC_KILL        'k'     /* SIGKILL */
+
+/**
+ * Build the wrapper for "exec": cd to pszDir and run the arguments, joined
+ * with spaces like ssh joins its own, with the login shell and stdin from
+ * /dev/null, so stdout and stderr stay apart without a PTY. Meanwhile the
+ * wrapper reads control lines (REMOTE_EXEC_*) from stdin and signals the
+ * session's process group; the end of stdin (the client went away) sends
+ * SIGHUP. Exits with the command's status. snprintf-style return.
+ */
+size_t RemoteBuildExecCommand(const char *pszDir, const char *const *ppszArgs, size_t nArgs,
+    char *out, size_t cbOut);
+
+/**
+ * Control line for the nth Ctrl+C: interrupt first, then terminate, then kill
+ */
+char RemoteExecSignal(int nPresses);
+
+/**
+ * Build the command for one "--bench" run: it prints "#sshfs-bench session"
+ * as soon as it runs, "#sshfs-bench cd" once in pszDir, and has an
+ * interactive shell (its rc files run, as in the terminal)
+ * print "#sshfs-bench shell" (BenchFeed()). snprintf-style return.
+ */
+size_t RemoteBuildBenchCommand(const char *pszDir, char *out, size_t cbOut);
+
+/**
+ * Build the batch for thumbnails ("--thumbs"): in pszDir, read names (one
+ * per line, no '/') from stdin and answer each with a frame holding a JPEG
+ * of at most size pixels a side, or one saying there is none
+ * (ThumbParserFeed()). It uses ImageMagick (magick or convert) or
+ * vipsthumbnail, whichever is installed, one file at a time so the first
+ * name comes back first; with none it prints just "#sshfs-thumbs none".
+ * snprintf-style return.
+ */
+size_t RemoteBuildThumbCommand(const char *pszDir, int size, char *out, size_t cbOut);
+
+#define REMOTE_SESSION_LABEL_MAX    24      /* Bytes of the folder name kept in a session name */
+#define REMOTE_SESSION_NAME_MAX     48      /* Room for any RemoteSessionName() */
+
+/**
+ * Name of the persistent terminal session for pszDir on user@host:port
+ * ("Attach session"): "sshfs-<folder>-<hash>", the folder's name reduced
+ * to [A-Za-z0-9_-] and a 48-bit FNV-1a of the whole key, so it is safe
+ * unquoted for tmux and screen. The key is normalized first: "", "~" and
+ * "~/" are all home, trailing slashes go, the host is lowercased and an
+ * empty port is 22. snprintf-style return.
+ */
+size_t RemoteSessionName(const char *pszUser, const char *pszHost, const char *pszPort,
+    const char *pszDir, char *out, size_t cbOut);
+
+/**
+ * Build what runs after the cd in place of "exec $SHELL" to attach to the
+ * session pszSession (RemoteSessionName()): tmux new-session -A, or screen
+ * when there is no tmux, and the login shell when neither is installed or
+ * the multiplexer fails to start. With idleHours > 0 other detached sshfs
+ * sessions idle that long are killed first. Contains no double quotes.
+ * snprintf-style return.
+ */
+size_t RemoteBuildAttachCommand(const char *pszSession, int idleHours, char *out, size_t cbOut);
+
+/**
+ * State parsed from the transfer script's output
+ */
+typedef struct RemoteProgress {
+    unsigned long long kbTotal;     /* Size of all sources, 0 if unknown (moves) */
+    unsigned long long kbDone;      /* Copied so far */
+    unsigned long nItem;            /* Item in progress, 1-based */
+    unsigned long nItems;
+    char szItem[256];               /* Its name (or the conflicting name) */
+    int bDone;
+    int bExists;                    /* Stopped before starting: szItem already exists */
+
+    char szErrors[1024];            /* Tail of any other output (ssh and cp errors) */
+    size_t cbErrors;
+
+    char line[1024];                /* Partial line carried between reads */
+    size_t cbLine;
+} RemoteProgress;
+
+void RemoteProgressInit(RemoteProgress *rp);
+
+/**
+ * Feed raw output (CR/LF tolerant, lines may span reads).
+ * Returns 1 if the progress state changed.
+ */
+int RemoteProgressFeed(RemoteProgress *rp, const char *data, size_t len);
+
+/**
+ * Completed and total units for a progress bar: kilobytes when the size is
+ * known, otherwise items.
+ */
+void RemoteProgressPosition(const RemoteProgress *rp,
+    unsigned long long *pCompleted, unsigned long long *pTotal);
+
+#endif /* SSHFS_REMOTE_H */
@@ -0,0 +1,182 @@
+/**
+ * sshfs-search.c
+ *
+ * Streaming parser for find/grep/rg output (see sshfs-search.h)
+ */
+
+#include "sshfs-search.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest record worth keeping: path, NUL, line number and colon, text */
+#define PENDING_MAX (SEARCH_MAX_PATH + 1 + 24 + SEARCH_MAX_TEXT)
+
+int SearchParserInit(SearchParser *p, int bContents)
+{
+    memset(p, 0, sizeof(*p));
+    p->bContents = bContents;
+    p->pPending = malloc(PENDING_MAX);
+    return p->pPending != NULL;
+}
+
+void SearchParserFree(SearchParser *p)
+{
+    free(p->pPending);
+    p->pPending = NULL;
+}
+
+/**
+ * Hand out one complete record: rec up to nul is the path, after it (for
+ * content searches) "line:text" up to end. nul is NULL when the record
+ * was cut before its path ended.
+ */
+static void EmitRecord(SearchParser *p, const char *rec, const char *nul, const char *end,
+    SearchResultFn fn, void *pContext)
+{
+    SearchResult r;
+    size_t cchPath, cchText;
+    const char *q;
+
+    if (!nul)
+    {
+        p->nSkipped++;
+        return;
+    }
+
+    if (nul - rec >= 2 && rec[0] == '.' && rec[1] == '/')
+        rec += 2;
+    cchPath = (size_t)(nul - rec);
+    if (cchPath == 0 || cchPath > SEARCH_MAX_PATH)
+    {
+        p->nSkipped++;
+        return;
+    }
+    memcpy(p->szPath, rec, cchPath);
+    p->szPath[cchPath] = '\0';
+
+    r.pszPath = p->szPath;
+    r.nLine = 0;
+    r.pszText = "";
+
+    if (p->bContents)
+    {
+        q = nul + 1;
+        if (q == end || *q < '0' || *q > '9')
+        {
+            p->nSkipped++;
+            return;
+        }
+        while (q < end && *q >= '0' && *q <= '9')
+            r.nLine = r.nLine * 10 + (unsigned long)(*q++ - '0');
+        if (q == end || *q != ':')
+        {
+            p->nSkipped++;
+            return;
+        }
+        q++;
+
+        cchText = (size_t)(end - q);
+        if (cchText > 0 && q[cchText - 1] == '\r')
+            cchText--;
+        if (cchText > SEARCH_MAX_TEXT)
+        {
+            /* Do not split a UTF-8 sequence */
+            cchText = SEARCH_MAX_TEXT;
+            while (cchText > 0 && ((unsigned char)q[cchText] & 0xC0) == 0x80)
+                cchText--;
+        }
+        memcpy(p->szText, q, cchText);
+        p->szText[cchText] = '\0';
+        r.pszText = p->szText;
+    }
+
+    p->nResults++;
+    fn(&r, pContext);
+}
+
+/**
+ * Add bytes to the pending record, keeping at most PENDING_MAX
+ */
+static void AppendPending(SearchParser *p, const char *data, size_t cb)
+{
+    if (cb > PENDING_MAX - p->cbPending)
+        cb = PENDING_MAX - p->cbPending;
+    memcpy(p->pPending + p->cbPending, data, cb);
+    p->cbPending += cb;
+}
+
+void SearchParserFeed(SearchParser *p, const char *data, size_t cb,
+    SearchResultFn fn, void *pContext)
+{
+    const char *pos = data, *end = data + cb;
+
+    /* Finish the record the previous read cut off */
+    if (p->cbPending > 0)
+    {
+        const char *rec, *nul;
+
+        if (!p->bPendingNul)
+        {
+            nul = memchr(pos, '\0', cb);
+            if (!nul)
+            {
+                AppendPending(p, pos, cb);
+                return;
+            }
+            AppendPending(p, pos, (size_t)(nul + 1 - pos));
+            p->bPendingNul = 1;
+            pos = nul + 1;
+        }
+
+        if (p->bContents)
+        {
+            const char *stop = memchr(pos, '\n', (size_t)(end - pos));
+            if (!stop)
+            {
+                AppendPending(p, pos, (size_t)(end - pos));
+                return;
+            }
+            AppendPending(p, pos, (size_t)(stop - pos));
+            pos = stop + 1;
+        }
+
+        /* A path longer than we keep lost its NUL to the cut */
+        rec = p->pPending;
+        nul = memchr(rec, '\0', p->cbPending);
+        EmitRecord(p, rec, nul, p->bContents ? rec + p->cbPending : nul, fn, pContext);
+        p->cbPending = 0;
+        p->bPendingNul = 0;
+    }
+
+    /* Whole records straight from the read buffer */
+    while (pos < end)
+    {
+        const char *nul = memchr(pos, '\0', (size_t)(end - pos));
+        const char *stop;
+
+        if (!nul)
+            break;
+        if (!p->bContents)
+        {
+            EmitRecord(p, pos, nul, nul, fn, pContext);
+            pos = nul + 1;
+            continue;
+        }
+
+        stop = memchr(nul + 1, '\n', (size_t)(end - nul - 1));
+        if (!stop)
+        {
+            AppendPending(p, pos, (size_t)(nul + 1 - pos));
+            p->bPendingNul = 1;
+            pos = nul + 1;
+            AppendPending(p, pos, (size_t)(end - pos));
+            return;
+        }
+        EmitRecord(p, pos, nul, stop, fn, pContext);
+        pos = stop + 1;
+    }
+
+    if (pos < end)
+        AppendPending(p, pos, (size_t)(end - pos));
+}
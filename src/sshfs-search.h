@@ -0,0 +1,58 @@
+/**
+ * sshfs-search.h
+ *
+ * Output parser for "Search on server" in sshfs-ssh.exe, kept free of
+ * Windows so it can be run against real find/grep/rg output elsewhere.
+ *
+ * Results arrive as the server finds them, split across reads at arbitrary
+ * points. Records are handed out as soon as they are complete; only a
+ * record cut by a read boundary is copied, everything else is parsed in
+ * place.
+ */
+
+#ifndef SSHFS_SEARCH_H
+#define SSHFS_SEARCH_H
+
+#include <stddef.h>
+
+#define SEARCH_MAX_PATH     4096        /* Longer paths are counted as skipped */
+#define SEARCH_MAX_TEXT     512         /* Matched lines are cut to this (bytes, UTF-8) */
+
+typedef struct SearchResult {
+    const char *pszPath;            /* Relative to the searched folder, "./" removed */
+    unsigned long nLine;            /* 0 for name searches */
+    const char *pszText;            /* Matched line, "" for name searches */
+} SearchResult;
+
+/**
+ * Called for each result. The strings are only valid during the call.
+ */
+typedef void (*SearchResultFn)(const SearchResult *pResult, void *pContext);
+
+typedef struct SearchParser {
+    int bContents;                  /* "path\0line:text\n" records, else "path\0" */
+    char *pPending;                 /* Start of a record cut by the last read */
+    size_t cbPending;
+    int bPendingNul;                /* Pending record already has its path's NUL */
+    unsigned long nResults;
+    unsigned long nSkipped;         /* Records that did not parse (messages, long paths) */
+    char szPath[SEARCH_MAX_PATH + 1];
+    char szText[SEARCH_MAX_TEXT + 1];
+} SearchParser;
+
+/**
+ * bContents selects the content search format (RemoteSearchMode). Returns
+ * 0 if out of memory.
+ */
+int SearchParserInit(SearchParser *p, int bContents);
+
+/**
+ * Parse the next cb bytes of output, calling fn for every record they
+ * complete
+ */
+void SearchParserFeed(SearchParser *p, const char *data, size_t cb,
+    SearchResultFn fn, void *pContext);
+
+void SearchParserFree(SearchParser *p);
+
+#endif /* SSHFS_SEARCH_H */
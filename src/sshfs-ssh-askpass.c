@@ -2,11 +2,14 @@
  * sshfs-ssh-askpass.c
  *
  * Minimal SSH_ASKPASS helper for SSHFS-Win.
- * Reads the password from SSHFS_PASSWORD environment variable and prints
- * it to stdout. Used by ssh.exe when SSH_ASKPASS_REQUIRE=force is set.
+ * Prints the password for ssh.exe, which runs it when
+ * SSH_ASKPASS_REQUIRE=force is set.
  *
- * The password is passed via env var by sshfs-ssh.exe, which reads it
- * from Windows Credential Manager.
+ * sshfs-ssh.exe hands the password from Windows Credential Manager to its
+ * credential broker and passes only a token in SSHFS_ASKPASS_TOKEN; the
+ * password is fetched from the broker's pipe (sshfs-broker.h), which
+ * answers only the askpass of the ssh that token was made for. If the
+ * broker could not be reached, the password is in SSHFS_PASSWORD instead.
  */
 
 #ifndef UNICODE
@@ -18,22 +21,68 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "sshfs-broker.h"
+
+/**
+ * Fetch the password for the token from the broker (UTF-8)
+ */
+static BOOL GetBrokerPassword(LPCWSTR pszToken, char *pszPassword, size_t cbPassword)
+{
+    char szRequest[BROKER_TOKEN_LEN + 8];
+    char szResponse[BROKER_MAX_LINE];
+    char szToken[BROKER_TOKEN_LEN + 1];
+    size_t cb;
+    BOOL bOk = FALSE;
+
+    if (wcslen(pszToken) != BROKER_TOKEN_LEN ||
+        !WideCharToMultiByte(CP_UTF8, 0, pszToken, -1, szToken, (int)sizeof(szToken), NULL, NULL))
+        return FALSE;
+
+    _snprintf_s(szRequest, sizeof(szRequest), _TRUNCATE, "GET %s", szToken);
+    if (BrokerCall(szRequest, szResponse, BROKER_MAX_LINE) && strncmp(szResponse, "OK ", 3) == 0)
+    {
+        cb = BrokerHexDecode(szResponse + 3, strlen(szResponse + 3), pszPassword, cbPassword - 1);
+        if (cb != (size_t)-1)
+        {
+            pszPassword[cb] = '\0';
+            bOk = TRUE;
+        }
+    }
+    SecureZeroMemory(szResponse, sizeof(szResponse));
+    return bOk;
+}
 
 int wmain(int argc, wchar_t *argv[])
 {
+    WCHAR szToken[BROKER_TOKEN_LEN + 2] = {0};
+    DWORD cchToken;
     WCHAR szPassword[256];
-    char szPasswordA[256];
+    char szPasswordA[BROKER_MAX_SECRET + 1];
 
     (void)argc;
     (void)argv;
 
-    if (!GetEnvironmentVariableW(L"SSHFS_PASSWORD", szPassword, 256) || !szPassword[0])
-        return 1;
+    cchToken = GetEnvironmentVariableW(L"SSHFS_ASKPASS_TOKEN", szToken, BROKER_TOKEN_LEN + 2);
+    if (cchToken)
+    {
+        if (cchToken != BROKER_TOKEN_LEN)
+            return 1;
+        if (!GetBrokerPassword(szToken, szPasswordA, sizeof(szPasswordA)))
+            return 1;
+    }
+    else
+    {
+        if (!GetEnvironmentVariableW(L"SSHFS_PASSWORD", szPassword, 256) || !szPassword[0])
+            return 1;
+        WideCharToMultiByte(CP_UTF8, 0, szPassword, -1, szPasswordA, (int)sizeof(szPasswordA), NULL, NULL);
+        SecureZeroMemory(szPassword, sizeof(szPassword));
+    }
 
-    WideCharToMultiByte(CP_UTF8, 0, szPassword, -1, szPasswordA, 256, NULL, NULL);
     printf("%s\n", szPasswordA);
+    fflush(stdout);
 
-    SecureZeroMemory(szPassword, sizeof(szPassword));
     SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
 
     return 0;
@@ -0,0 +1,244 @@
+/**
+ * sshfs-ssh-bench.c
+ *
+ * Connection phase timings: sshfs-ssh.exe --bench <path> [<runs>] ["<ssh options>"...]
+ *
+ * sshfs-ssh.exe --bench X:\proj 10 "-c aes128-gcm@openssh.com" connects
+ * 10 times as the terminal would and then 10 times with each set of extra
+ * ssh options, and reports min/median/p95 of every phase for each: name
+ * lookup (with ssh's own startup and config), TCP connect, key exchange,
+ * authentication, the session starting the command, the cd into the
+ * folder and the interactive shell's startup files (sshfs-bench.h).
+ *
+ * The runs are the terminal's ssh command line with -v and -T, without a
+ * PTY or relay; they can't prompt (BatchMode, or the stored password).
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-bench.h"
+#include "sshfs-ssh.h"
+
+/**
+ * Text for the console from "--bench" (UTF-8)
+ */
+static void WriteBenchText(HANDLE hOut, const char *pszText)
+{
+    WCHAR szText[2048];
+
+    if (MultiByteToWideChar(CP_UTF8, 0, pszText, -1, szText, 2048))
+        WriteExecError(hOut, szText);
+}
+
+/**
+ * One timed connection: ssh -v with RemoteBuildBenchCommand(), both of its
+ * output streams on one pipe, each read stamped against the start
+ */
+static void RunBenchOnce(LPWSTR pszCmdLine, BOOL bHasPassword, LPCWSTR pszAskpassPath,
+    LPCWSTR pszPassword, BenchRun *r)
+{
+    PROCESS_INFORMATION pi = {0};
+    HANDLE hRead = NULL, hWrite = NULL;
+    LARGE_INTEGER freq, start, now;
+    char buffer[4096];
+    double msNow = 0;
+    DWORD cbRead;
+    BOOL bStarted;
+
+    BenchRunInit(r);
+    if (!CreateSSHPipe(&hRead, &hWrite, FALSE, 64 * 1024))
+    {
+        StringCchCopyA(r->szError, sizeof(r->szError), "Failed to create a pipe for ssh.exe");
+        goto cleanup;
+    }
+
+    /* The askpass grant is set up outside the timed part */
+    QueryPerformanceFrequency(&freq);
+    if (bHasPassword)
+        SetAskpassEnvironment(pszAskpassPath, pszPassword);
+    QueryPerformanceCounter(&start);
+    bStarted = SpawnSSH(pszCmdLine, NULL, hWrite, hWrite, CREATE_NO_WINDOW, NULL, NULL, &pi);
+    if (bHasPassword)
+        SetAskpassEnvironment(NULL, NULL);
+    if (!bStarted)
+    {
+        StringCchPrintfA(r->szError, sizeof(r->szError), "Failed to start ssh.exe (error %lu)", GetLastError());
+        goto cleanup;
+    }
+    CloseHandle(hWrite);
+    hWrite = NULL;
+
+    /* Until ssh exits and the pipe breaks */
+    while (ReadFile(hRead, buffer, sizeof(buffer), &cbRead, NULL) && cbRead > 0)
+    {
+        QueryPerformanceCounter(&now);
+        msNow = (double)(now.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart;
+        BenchFeed(r, buffer, cbRead, msNow);
+    }
+    BenchFeed(r, "\n", 1, msNow);   /* A last line without a newline */
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+cleanup:
+    if (hRead)
+        CloseHandle(hRead);
+    if (hWrite)
+        CloseHandle(hWrite);
+}
+
+int RunBench(LPCWSTR pszPath, LPWSTR *ppszArgs, int nArgs)
+{
+    SSHFSLocation *pLoc = NULL;
+    BenchSeries *pSeries = NULL;
+    BenchRun *pRun = NULL;
+    char *pszRemote = NULL;
+    char *pszReport = NULL;
+    char szCmd[MAX_PATH * 8];
+    char szLine[512];
+    char szLabel[512];
+    WCHAR szCmdW[MAX_PATH * 8];
+    WCHAR szCmdLine[MAX_PATH * 12];
+    WCHAR szFull[MAX_PATH];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH] = {0};
+    WCHAR szPassword[256] = {0};
+    WCHAR szError[MAX_PATH * 2];
+    HANDLE hOut = INVALID_HANDLE_VALUE;
+    HANDLE hErr = INVALID_HANDLE_VALUE;
+    ResolveResult res;
+    BOOL bConsole;
+    BOOL bHasPassword = FALSE;
+    int nRuns = BENCH_DEFAULT_RUNS;
+    int iVariant, iRun;
+    int result = 1;
+
+    bConsole = AttachConsole(ATTACH_PARENT_PROCESS);
+    hOut = GetExecStdHandle(STD_OUTPUT_HANDLE, L"CONOUT$", bConsole);
+    hErr = GetExecStdHandle(STD_ERROR_HANDLE, L"CONOUT$", bConsole);
+
+    if (nArgs > 0 && ppszArgs[0][0] && wcsspn(ppszArgs[0], L"0123456789") == wcslen(ppszArgs[0]))
+    {
+        nRuns = _wtoi(ppszArgs[0]);
+        ppszArgs++;
+        nArgs--;
+    }
+    if (nRuns < 1 || nRuns > BENCH_MAX_RUNS)
+    {
+        WriteExecError(hErr, L"Usage: sshfs-ssh.exe --bench <path> [<runs, 1-1000>] [\"<ssh options>\"...]\r\n");
+        goto cleanup;
+    }
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    pSeries = malloc(sizeof(BenchSeries));
+    pRun = malloc(sizeof(BenchRun));
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    pszReport = malloc(4096);
+    if (!pLoc || !pSeries || !pRun || !pszRemote || !pszReport)
+        goto cleanup;
+
+    /* The folder is resolved as for the terminal */
+    if (!GetFullPathNameW(pszPath, MAX_PATH, szFull, NULL))
+        StringCchCopyW(szFull, MAX_PATH, pszPath);
+    res = ResolveSSHFSPath(szFull, pLoc);
+    if (res != RESOLVE_OK)
+    {
+        StringCchPrintfW(szError, MAX_PATH * 2,
+            res == RESOLVE_PARSE_FAILED ?
+                L"Could not parse SSHFS connection information from the path: %s\r\n" :
+                L"This path is not on an SSHFS mounted drive: %s\r\n",
+            szFull);
+        WriteExecError(hErr, szError);
+        goto cleanup;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+    if (RemoteBuildBenchCommand(pszRemote, szCmd, sizeof(szCmd)) >= sizeof(szCmd))
+        goto cleanup;
+    MultiByteToWideChar(CP_UTF8, 0, szCmd, -1, szCmdW, MAX_PATH * 8);
+
+    if (!FindSSH(szSSHPath, MAX_PATH))
+    {
+        WriteExecError(hErr, L"OpenSSH client (ssh.exe) not found.\r\n");
+        goto cleanup;
+    }
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    StringCchPrintfA(szLine, sizeof(szLine), "Connecting %d times to %ls@%ls for %s\r\n\r\n",
+        nRuns, pLoc->szUser, pLoc->szHost, pszRemote);
+    WriteBenchText(hOut, szLine);
+
+    /* The plain connection first, then one variant per options argument */
+    result = 0;
+    for (iVariant = 0; iVariant <= nArgs; iVariant++)
+    {
+        LPCWSTR pszOptions = iVariant > 0 ? ppszArgs[iVariant - 1] : L"";
+
+        StringCchPrintfW(szCmdLine, MAX_PATH * 12, L"\"%s\" -v -T%s%s%s %s %s@%s ",
+            szSSHPath,
+            bHasPassword ? L"" : L" -o BatchMode=yes",
+            pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+            pszOptions, pLoc->szUser, pLoc->szHost);
+        AppendQuotedArg(szCmdLine, MAX_PATH * 12, szCmdW);
+
+        if (iVariant > 0)
+            WideCharToMultiByte(CP_UTF8, 0, pszOptions, -1, szLabel, (int)sizeof(szLabel), NULL, NULL);
+        else
+            StringCchCopyA(szLabel, sizeof(szLabel), "default");
+
+        BenchSeriesInit(pSeries);
+        for (iRun = 0; iRun < nRuns; iRun++)
+        {
+            BenchPhase reached;
+
+            RunBenchOnce(szCmdLine, bHasPassword, szAskpassPath, szPassword, pRun);
+            BenchSeriesAdd(pSeries, pRun);
+            reached = BenchRunReached(pRun);
+            if (reached == BENCH_PHASES)
+                StringCchPrintfA(szLine, sizeof(szLine), "%s: run %d of %d: %.1f ms\r\n",
+                    szLabel, iRun + 1, nRuns, pRun->msEnd[BENCH_SHELL]);
+            else
+                StringCchPrintfA(szLine, sizeof(szLine), "%s: run %d of %d failed in %s: %s\r\n",
+                    szLabel, iRun + 1, nRuns, BenchPhaseName(reached),
+                    pRun->szError[0] ? pRun->szError : "no output");
+            WriteBenchText(reached == BENCH_PHASES ? hOut : hErr, szLine);
+        }
+
+        BenchFormatSeries(pSeries, szLabel, pszReport, 4096);
+        WriteBenchText(hOut, "\r\n");
+        WriteBenchText(hOut, pszReport);
+        WriteBenchText(hOut, "\r\n");
+        if (pSeries->nOk < pSeries->nRuns)
+            result = 1;
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hOut != INVALID_HANDLE_VALUE)
+        CloseHandle(hOut);
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    free(pLoc);
+    free(pSeries);
+    free(pRun);
+    free(pszRemote);
+    free(pszReport);
+    return result;
+}
@@ -0,0 +1,197 @@
+/**
+ * sshfs-ssh-broker.c
+ *
+ * The per-user credential broker: sshfs-ssh.exe --broker (started on demand),
+ *                                 sshfs-ssh.exe --forget-passwords
+ *
+ * The broker (sshfs-broker.h) is started by the first launch with a
+ * password to hand over. It holds the passwords in locked memory,
+ * shielded, for CredentialCacheSeconds (default 900, 0 for no caching:
+ * askpass handoffs only), and exits when it has held nothing for a
+ * minute. --forget-passwords empties its cache, e.g. after changing a
+ * password in Credential Manager.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <time.h>
+
+#include "sshfs-broker.h"
+#include "sshfs-ssh.h"
+
+/**
+ * State of "sshfs-ssh.exe --broker"
+ */
+typedef struct BrokerServer {
+    Broker *pBroker;                /* VirtualLock'ed */
+    CRITICAL_SECTION cs;
+    volatile LONG nClients;
+    volatile LONGLONG lastUse;      /* GetTickCount64() */
+} BrokerServer;
+
+static BrokerServer g_broker;
+
+#define BROKER_IDLE_MS (60 * 1000)
+
+/**
+ * Thread: one request on one pipe instance. The client is identified by
+ * its process: the sshfs-ssh.exe and askpass from our own folder may ask,
+ * nothing else gets more than "NO".
+ */
+static DWORD WINAPI BrokerClientThread(LPVOID pParam)
+{
+    HANDLE hPipe = (HANDLE)pParam;
+    char szRequest[BROKER_MAX_LINE + 2];
+    char szResponse[BROKER_MAX_LINE + 2];
+    DWORD cbRead = 0, cbWritten, dwClient = 0;
+    BrokerPeer peer = {BROKER_PEER_UNTRUSTED, 0, 0, 0};
+
+    if (GetNamedPipeClientProcessId(hPipe, &dwClient))
+    {
+        peer.pid = dwClient;
+        if (BrokerProcessIs(dwClient, L"sshfs-ssh.exe"))
+            peer.role = BROKER_PEER_LAUNCHER;
+        else if (BrokerProcessIs(dwClient, L"sshfs-ssh-askpass.exe"))
+        {
+            peer.role = BROKER_PEER_ASKPASS;
+            peer.parentPid = BrokerParentPid(dwClient);
+            peer.grandparentPid = peer.parentPid ? BrokerParentPid(peer.parentPid) : 0;
+        }
+    }
+
+    if (ReadFile(hPipe, szRequest, BROKER_MAX_LINE, &cbRead, NULL) && cbRead > 0)
+    {
+        size_t cchResponse;
+
+        szRequest[cbRead] = '\0';
+        while (cbRead > 0 && (szRequest[cbRead - 1] == '\n' || szRequest[cbRead - 1] == '\r'))
+            szRequest[--cbRead] = '\0';
+
+        EnterCriticalSection(&g_broker.cs);
+        cchResponse = BrokerHandle(g_broker.pBroker, szRequest, &peer, (long long)time(NULL),
+            szResponse, sizeof(szResponse));
+        LeaveCriticalSection(&g_broker.cs);
+
+        WriteFile(hPipe, szResponse, (DWORD)cchResponse, &cbWritten, NULL);
+        FlushFileBuffers(hPipe);
+    }
+    SecureZeroMemory(szRequest, sizeof(szRequest));
+    SecureZeroMemory(szResponse, sizeof(szResponse));
+
+    DisconnectNamedPipe(hPipe);
+    CloseHandle(hPipe);
+    InterlockedExchange64(&g_broker.lastUse, (LONGLONG)GetTickCount64());
+    InterlockedDecrement(&g_broker.nClients);
+    return 0;
+}
+
+/**
+ * Thread: drop what expired, and end the broker once it has held nothing
+ * for BROKER_IDLE_MS
+ */
+static DWORD WINAPI BrokerSweepThread(LPVOID pParam)
+{
+    BOOL bIdle;
+
+    (void)pParam;
+
+    do
+    {
+        Sleep(BROKER_IDLE_MS / 4);
+        EnterCriticalSection(&g_broker.cs);
+        BrokerSweep(g_broker.pBroker, (long long)time(NULL));
+        bIdle = BrokerIdle(g_broker.pBroker) && g_broker.nClients == 0 &&
+            (LONGLONG)GetTickCount64() - g_broker.lastUse >= BROKER_IDLE_MS;
+        if (!bIdle)
+            LeaveCriticalSection(&g_broker.cs);
+    } while (!bIdle);
+
+    /* The lock stays held, so no request is answered from here on */
+    BrokerWipe(g_broker.pBroker);
+    ExitProcess(0);
+    return 0;
+}
+
+int RunBroker(void)
+{
+    BYTE prekey[BROKER_PREKEY_SIZE];
+    SIZE_T cbMin, cbMax;
+    HANDLE hPipe, hThread;
+    BOOL bFirst = TRUE;
+    int ttl = (int)GetTerminalSetting(L"CredentialCacheSeconds", BROKER_DEFAULT_TTL);
+
+    g_broker.pBroker = (Broker *)VirtualAlloc(NULL, sizeof(Broker), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!g_broker.pBroker)
+        return 1;
+
+    /* Kept out of the page file; the working set has to make room first */
+    if (GetProcessWorkingSetSize(GetCurrentProcess(), &cbMin, &cbMax))
+        SetProcessWorkingSetSize(GetCurrentProcess(), cbMin + sizeof(Broker) + 65536, cbMax + sizeof(Broker) + 65536);
+    VirtualLock(g_broker.pBroker, sizeof(Broker));
+
+    if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, prekey, sizeof(prekey), BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+        return 1;
+    BrokerInit(g_broker.pBroker, prekey, sizeof(prekey), ttl);
+    SecureZeroMemory(prekey, sizeof(prekey));
+
+    InitializeCriticalSection(&g_broker.cs);
+    g_broker.lastUse = (LONGLONG)GetTickCount64();
+
+    for (;;)
+    {
+        hPipe = BrokerCreatePipe(bFirst);
+        if (hPipe == INVALID_HANDLE_VALUE)
+        {
+            if (bFirst)
+                break;
+            Sleep(100);
+            continue;
+        }
+        if (bFirst)
+        {
+            bFirst = FALSE;
+            hThread = CreateThread(NULL, 0, BrokerSweepThread, NULL, 0, NULL);
+            if (hThread)
+                CloseHandle(hThread);
+        }
+
+        if (!ConnectNamedPipe(hPipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        {
+            CloseHandle(hPipe);
+            continue;
+        }
+
+        InterlockedIncrement(&g_broker.nClients);
+        hThread = CreateThread(NULL, 0, BrokerClientThread, hPipe, 0, NULL);
+        if (hThread)
+            CloseHandle(hThread);
+        else
+        {
+            CloseHandle(hPipe);
+            InterlockedDecrement(&g_broker.nClients);
+        }
+    }
+
+    BrokerWipe(g_broker.pBroker);
+    return 0;
+}
+
+int RunForgetPasswords(void)
+{
+    char szResponse[BROKER_MAX_LINE];
+
+    if (!BrokerCall("CLEAR", szResponse, BROKER_MAX_LINE) && GetLastError() != ERROR_FILE_NOT_FOUND)
+    {
+        MessageBoxW(NULL, L"Could not reach the SSHFS-Win credential broker.",
+            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONERROR);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+/**
+ * sshfs-ssh-connect-posix.c
+ *
+ * Linux counterpart of sshfs-ssh-connect.c: connects to all of a host's
+ * addresses at once and relays the winning connection on stdin/stdout
+ * (sshfs-connect.h). For hosts where that helps, in ~/.ssh/config:
+ *
+ *     Host web1
+ *         ProxyCommand sshfs-ssh-connect %h %p
+ *
+ * The winner per host is kept in $XDG_CACHE_HOME/sshfs-ssh/connect-cache
+ * (or ~/.cache/sshfs-ssh/connect-cache).
+ *
+ * Compile with: gcc -O2 -o sshfs-ssh-connect sshfs-ssh-connect-posix.c sshfs-connect.c
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "sshfs-connect.h"
+
+/**
+ * Path of the address cache, creating its directory
+ */
+static int GetCachePath(char *pszPath, size_t cchPath)
+{
+    const char *pszCache = getenv("XDG_CACHE_HOME");
+    const char *pszHome = getenv("HOME");
+    char szDir[512];
+
+    if (pszCache && pszCache[0])
+        snprintf(szDir, sizeof(szDir), "%s", pszCache);
+    else if (pszHome && pszHome[0])
+        snprintf(szDir, sizeof(szDir), "%s/.cache", pszHome);
+    else
+        return 0;
+    mkdir(szDir, 0700);
+    strncat(szDir, "/sshfs-ssh", sizeof(szDir) - strlen(szDir) - 1);
+    mkdir(szDir, 0700);
+    return (size_t)snprintf(pszPath, cchPath, "%s/connect-cache", szDir) < cchPath;
+}
+
+static void ReadCache(const char *pszPath, char *pszText, size_t cbText)
+{
+    int fd = open(pszPath, O_RDONLY | O_CLOEXEC);
+    ssize_t cb = 0;
+
+    if (fd >= 0)
+    {
+        cb = read(fd, pszText, cbText - 1);
+        close(fd);
+    }
+    pszText[cb > 0 ? cb : 0] = '\0';
+}
+
+/**
+ * Replace the cache file; another launch writing at the same time wins or
+ * loses as a whole
+ */
+static void WriteCache(const char *pszPath, const char *pszText)
+{
+    char szTemp[600];
+    size_t cb = strlen(pszText);
+    int fd;
+
+    snprintf(szTemp, sizeof(szTemp), "%s.%d", pszPath, (int)getpid());
+    fd = open(szTemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return;
+    if (write(fd, pszText, cb) != (ssize_t)cb || close(fd) != 0 || rename(szTemp, pszPath) != 0)
+        unlink(szTemp);
+}
+
+/**
+ * Write all of a buffer, 0 if the other side is gone
+ */
+static int WriteAll(int fd, const char *p, size_t cb)
+{
+    while (cb > 0)
+    {
+        ssize_t n = write(fd, p, cb);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        cb -= (size_t)n;
+    }
+    return 1;
+}
+
+/**
+ * Copy stdin to the socket and the socket to stdout until the server
+ * closes the connection
+ */
+static int Relay(int s)
+{
+    struct pollfd fds[2];
+    char buffer[65536];
+    int bInput = 1;
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = s;
+    fds[1].events = POLLIN;
+
+    for (;;)
+    {
+        ssize_t n;
+
+        fds[0].fd = bInput ? STDIN_FILENO : -1;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            n = read(s, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return n < 0;
+            if (!WriteAll(STDOUT_FILENO, buffer, (size_t)n))
+                return 1;
+        }
+
+        if (bInput && (fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            n = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                /* ssh is done sending; the server ends the connection */
+                shutdown(s, SHUT_WR);
+                bInput = 0;
+            }
+            else if (!WriteAll(s, buffer, (size_t)n))
+                return 1;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ConnectTarget target;
+    ConnectSocket s;
+    char szCachePath[600];
+    char szCache[CONNECT_CACHE_MAX + 1];
+    char szNewCache[CONNECT_CACHE_MAX + 600];
+    char szCached[64];
+    char szError[256];
+    size_t iWinner = 0;
+    int bCache, bCached = 0;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <host> <port>\n\n"
+            "Connects to all addresses of the host at once and relays the first\n"
+            "connection made on stdin/stdout, for use as an ssh ProxyCommand.\n", argv[0]);
+        return 255;
+    }
+
+    if (!ConnectResolve(argv[1], argv[2], &target, szError, sizeof(szError)))
+    {
+        fprintf(stderr, "sshfs-ssh-connect: %s\n", szError);
+        return 255;
+    }
+
+    bCache = GetCachePath(szCachePath, sizeof(szCachePath));
+    szCache[0] = '\0';
+    if (bCache)
+    {
+        ReadCache(szCachePath, szCache, sizeof(szCache));
+        bCached = ConnectCacheFind(szCache, argv[1], argv[2], (long long)time(NULL), szCached, sizeof(szCached)) &&
+            ConnectPrefer(&target, szCached);
+    }
+
+    s = ConnectRace(&target, CONNECT_ATTEMPT_DELAY_MS, 0, &iWinner, szError, sizeof(szError));
+    if (s == CONNECT_INVALID)
+    {
+        if (bCached)
+        {
+            ConnectCacheUpdate(szCache, argv[1], argv[2], NULL, (long long)time(NULL), szNewCache, sizeof(szNewCache));
+            WriteCache(szCachePath, szNewCache);
+        }
+        fprintf(stderr, "sshfs-ssh-connect: %s: %s\n", argv[1], szError);
+        return 255;
+    }
+
+    /* Only a new winner is written: the entry expires a day after it first won */
+    if (bCache && target.nAddrs > 1 && !(bCached && iWinner == 0))
+    {
+        ConnectCacheUpdate(szCache, argv[1], argv[2], target.szAddr[iWinner], (long long)time(NULL),
+            szNewCache, sizeof(szNewCache));
+        WriteCache(szCachePath, szNewCache);
+    }
+
+    return Relay(s);
+}
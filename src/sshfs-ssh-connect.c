@@ -0,0 +1,203 @@
+/**
+ * sshfs-ssh-connect.c
+ *
+ * ProxyCommand helper for the ParallelConnect terminal option:
+ *   sshfs-ssh-connect.exe <host> <port>
+ *
+ * ssh.exe runs it with -o ProxyCommand="... %h %p" and speaks the SSH
+ * protocol over its stdin/stdout. It connects to all of the host's
+ * addresses at once (sshfs-connect.h), relays the first connection made,
+ * and remembers which address won in
+ * %LOCALAPPDATA%\SSHFS-Win\connect-cache.txt, so the next launch tries
+ * that one first.
+ *
+ * Errors go to stderr, which ssh shows in the terminal; the exit code is
+ * 255 like ssh's own connection failures.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <strsafe.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "sshfs-connect.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+
+/**
+ * Path of the address cache, creating its folder
+ */
+static BOOL GetCachePath(LPWSTR pszPath, DWORD cchPath)
+{
+    WCHAR szDir[MAX_PATH];
+
+    if (!GetEnvironmentVariableW(L"LOCALAPPDATA", szDir, MAX_PATH))
+        return FALSE;
+    StringCchCatW(szDir, MAX_PATH, L"\\SSHFS-Win");
+    CreateDirectoryW(szDir, NULL);
+    return SUCCEEDED(StringCchPrintfW(pszPath, cchPath, L"%s\\connect-cache.txt", szDir));
+}
+
+static void ReadCache(LPCWSTR pszPath, char *pszText, DWORD cbText)
+{
+    HANDLE hFile = CreateFileW(pszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, 0, NULL);
+    DWORD cbRead = 0;
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        if (!ReadFile(hFile, pszText, cbText - 1, &cbRead, NULL))
+            cbRead = 0;
+        CloseHandle(hFile);
+    }
+    pszText[cbRead] = '\0';
+}
+
+/**
+ * Replace the cache file; another launch writing at the same time wins or
+ * loses as a whole
+ */
+static void WriteCache(LPCWSTR pszPath, const char *pszText)
+{
+    WCHAR szTemp[MAX_PATH + 16];
+    HANDLE hFile;
+    DWORD cb = (DWORD)strlen(pszText), cbWritten = 0;
+    BOOL bOk;
+
+    StringCchPrintfW(szTemp, MAX_PATH + 16, L"%s.%lu", pszPath, GetCurrentProcessId());
+    hFile = CreateFileW(szTemp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+    bOk = WriteFile(hFile, pszText, cb, &cbWritten, NULL) && cbWritten == cb;
+    CloseHandle(hFile);
+    if (!bOk || !MoveFileExW(szTemp, pszPath, MOVEFILE_REPLACE_EXISTING))
+        DeleteFileW(szTemp);
+}
+
+/**
+ * Thread: ssh's output (our stdin) to the server. At its end the sending
+ * side is shut down and the server closes the connection.
+ */
+static DWORD WINAPI InputThread(LPVOID pParam)
+{
+    SOCKET s = (SOCKET)(ULONG_PTR)pParam;
+    HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+    char buffer[65536];
+    DWORD cbRead;
+
+    while (ReadFile(hIn, buffer, sizeof(buffer), &cbRead, NULL) && cbRead > 0)
+    {
+        DWORD cbSent = 0;
+
+        while (cbSent < cbRead)
+        {
+            int n = send(s, buffer + cbSent, (int)(cbRead - cbSent), 0);
+            if (n <= 0)
+                return 1;
+            cbSent += (DWORD)n;
+        }
+    }
+    shutdown(s, SD_SEND);
+    return 0;
+}
+
+/**
+ * Server to ssh (our stdout) until the server closes the connection
+ */
+static int Relay(SOCKET s)
+{
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    HANDLE hThread;
+    char buffer[65536];
+    int n;
+
+    hThread = CreateThread(NULL, 0, InputThread, (LPVOID)(ULONG_PTR)s, 0, NULL);
+    if (!hThread)
+        return 255;
+    CloseHandle(hThread);
+
+    while ((n = recv(s, buffer, sizeof(buffer), 0)) > 0)
+    {
+        DWORD cbWritten;
+
+        if (!WriteFile(hOut, buffer, (DWORD)n, &cbWritten, NULL))
+            return 255;
+    }
+    return n == 0 ? 0 : 255;
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+    WSADATA wsa;
+    ConnectTarget target;
+    ConnectSocket s;
+    WCHAR szCachePath[MAX_PATH];
+    char szHost[256 * 3];
+    char szPort[16];
+    char szCache[CONNECT_CACHE_MAX + 1];
+    char szNewCache[CONNECT_CACHE_MAX + 600];
+    char szCached[64];
+    char szError[256];
+    size_t iWinner = 0;
+    BOOL bCache;
+    BOOL bCached = FALSE;
+
+    if (argc != 3)
+    {
+        fwprintf(stderr, L"Usage: %s <host> <port>\n", argv[0]);
+        return 255;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, argv[1], -1, szHost, (int)sizeof(szHost), NULL, NULL);
+    WideCharToMultiByte(CP_UTF8, 0, argv[2], -1, szPort, (int)sizeof(szPort), NULL, NULL);
+
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return 255;
+
+    if (!ConnectResolve(szHost, szPort, &target, szError, sizeof(szError)))
+    {
+        fprintf(stderr, "sshfs-ssh-connect: %s\n", szError);
+        return 255;
+    }
+
+    bCache = GetCachePath(szCachePath, MAX_PATH);
+    szCache[0] = '\0';
+    if (bCache)
+    {
+        ReadCache(szCachePath, szCache, sizeof(szCache));
+        bCached = ConnectCacheFind(szCache, szHost, szPort, (long long)time(NULL), szCached, sizeof(szCached)) &&
+            ConnectPrefer(&target, szCached);
+    }
+
+    s = ConnectRace(&target, CONNECT_ATTEMPT_DELAY_MS, 0, &iWinner, szError, sizeof(szError));
+    if (s == CONNECT_INVALID)
+    {
+        if (bCached)
+        {
+            ConnectCacheUpdate(szCache, szHost, szPort, NULL, (long long)time(NULL), szNewCache, sizeof(szNewCache));
+            WriteCache(szCachePath, szNewCache);
+        }
+        fprintf(stderr, "sshfs-ssh-connect: %s: %s\n", szHost, szError);
+        return 255;
+    }
+
+    /* Only a new winner is written: the entry expires a day after it first won */
+    if (bCache && target.nAddrs > 1 && !(bCached && iWinner == 0))
+    {
+        ConnectCacheUpdate(szCache, szHost, szPort, target.szAddr[iWinner], (long long)time(NULL),
+            szNewCache, sizeof(szNewCache));
+        WriteCache(szCachePath, szNewCache);
+    }
+
+    return Relay((SOCKET)s);
+}
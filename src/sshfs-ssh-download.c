@@ -0,0 +1,302 @@
+/**
+ * sshfs-ssh-download.c
+ *
+ * Streamed folder downloads: sshfs-ssh.exe --download <path> [<folder>]
+ *
+ * Dragging a large tree off the drive costs SFTP round trips per file. Here
+ * the server runs tar on the whole folder and the archive is extracted
+ * locally while it arrives (sshfs-extract.c). ssh compresses the channel
+ * (-C), so decompression runs in the ssh process, in parallel with the
+ * extraction. The folder lands in <folder>\<folder name>; without a
+ * destination the user is asked for one.
+ */
+
+#define COBJMACROS
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-extract.h"
+#include "sshfs-ssh.h"
+
+int RunStreamDownload(LPCWSTR pszPath, LPCWSTR pszDestFolder)
+{
+    SSHFSLocation *pLoc = NULL;
+    ResolveResult res;
+    char *pszRemote = NULL;
+    char *pszCmd = NULL;
+    char *pBuffer = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    WCHAR szName[MAX_PATH];
+    WCHAR szFolder[MAX_PATH];
+    WCHAR szTarget[MAX_PATH];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szLine[MAX_PATH * 2];
+    WCHAR szErrors[1024];
+    HANDLE hOutRead = NULL, hOutWrite = NULL, hErr = INVALID_HANDLE_VALUE;
+    PROCESS_INFORMATION pi = {0};
+    IProgressDialog *pDlg = NULL;
+    Extractor *pExtractor = NULL;
+    ExtractStats stats;
+    ULONGLONG msStart, msLastUpdate = 0;
+    BOOL bHasPassword = FALSE;
+    BOOL bCancelled = FALSE;
+    BOOL bCorrupt = FALSE;
+    BOOL bCoInit = FALSE;
+    BOOL bStarted;
+    DWORD dwExitCode = 1;
+    int result = 1;
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    pBuffer = malloc(DOWNLOAD_READ_SIZE);
+    if (!pLoc || !pszRemote || !pszCmdLine || !pBuffer)
+        goto cleanup;
+
+    res = ResolveSSHFSPath(pszPath, pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(pszPath, res, L"SSHFS-Win - Download");
+        goto cleanup;
+    }
+
+    /* Local folder name: the remote folder's, or the host for a drive root */
+    StringCchCopyW(szName, MAX_PATH, pszPath);
+    PathRemoveBackslashW(szName);
+    if (PathIsRootW(szName) || PathIsUNCServerShareW(szName) || szName[wcslen(szName) - 1] == L':')
+        StringCchCopyW(szName, MAX_PATH, pLoc->szHost);
+    else
+        StringCchCopyW(szName, MAX_PATH, PathFindFileNameW(szName));
+
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
+
+    if (pszDestFolder && pszDestFolder[0])
+        StringCchCopyW(szFolder, MAX_PATH, pszDestFolder);
+    else
+    {
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"Download \"%s\" to", szName);
+        if (!PickLocalPath(szLine, FOS_PICKFOLDERS, szFolder, MAX_PATH))
+            goto cleanup;
+    }
+
+    if (FAILED(StringCchCopyW(szTarget, MAX_PATH, szFolder)) || !PathAppendW(szTarget, szName))
+        goto cleanup;
+    if (!CreateDirectoryW(szTarget, NULL))
+    {
+        if (GetLastError() != ERROR_ALREADY_EXISTS)
+        {
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"Could not create the folder:\n\n%s", szTarget);
+            MessageBoxW(NULL, szLine, L"SSHFS-Win - Download", MB_OK | MB_ICONERROR);
+            goto cleanup;
+        }
+        StringCchPrintfW(szLine, MAX_PATH * 2,
+            L"%s already exists.\n\nFiles in it with the same names will be replaced. Continue?", szTarget);
+        if (MessageBoxW(NULL, szLine, L"SSHFS-Win - Download", MB_YESNO | MB_ICONQUESTION) != IDYES)
+            goto cleanup;
+    }
+
+    /* Remote command, then the ssh command line around it */
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+    cbCmd = RemoteBuildArchiveCommand(pszRemote, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW)
+        goto cleanup;
+    RemoteBuildArchiveCommand(pszRemote, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* -T: the archive is binary and must not pass through a remote pty */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T -C%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    /* Archive on a large pipe; errors to a temp file so they cannot stall it */
+    if (!CreateSSHPipe(&hOutRead, &hOutWrite, FALSE, DOWNLOAD_PIPE_SIZE))
+        goto cleanup;
+    hErr = CreateScratchFile();
+
+    pExtractor = ExtractorCreate(szTarget, 0);
+    if (!pExtractor)
+        goto cleanup;
+
+    bStarted = SpawnSSH(pszCmdLine, NULL, hOutWrite, hErr != INVALID_HANDLE_VALUE ? hErr : NULL,
+        CREATE_NO_WINDOW, szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+
+    /* Our copy of the write end must go, or the pipe never reports EOF */
+    CloseHandle(hOutWrite);
+    hOutWrite = NULL;
+
+    if (!bStarted)
+    {
+        WCHAR szError[512];
+        StringCchPrintfW(szError, 512, L"Failed to start ssh.exe.\nError code: %lu", GetLastError());
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Download", MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    /* The size is not known up front (no extra pass over the tree): marquee */
+    if (SUCCEEDED(CoCreateInstance(&CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IProgressDialog, (void **)&pDlg)))
+    {
+        IProgressDialog_SetTitle(pDlg, L"Downloading");
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"Downloading %s from %s@%s", szName, pLoc->szUser, pLoc->szHost);
+        IProgressDialog_SetLine(pDlg, 1, szLine, FALSE, NULL);
+        IProgressDialog_StartProgressDialog(pDlg, NULL, NULL, PROGDLG_NORMAL | PROGDLG_MARQUEEPROGRESS, NULL);
+    }
+
+    msStart = GetTickCount64();
+    for (;;)
+    {
+        DWORD dwAvail = 0, bytesRead;
+        ULONGLONG msNow;
+
+        /* Poll so the Cancel button is honoured while the server is busy */
+        if (!PeekNamedPipe(hOutRead, NULL, 0, NULL, &dwAvail, NULL))
+            break;
+
+        if (dwAvail == 0)
+        {
+            if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+            {
+                bCancelled = TRUE;
+                TerminateProcess(pi.hProcess, 1);
+                break;
+            }
+            Sleep(10);
+            continue;
+        }
+
+        if (!ReadFile(hOutRead, pBuffer, DOWNLOAD_READ_SIZE, &bytesRead, NULL) || bytesRead == 0)
+            break;
+
+        if (!ExtractorFeed(pExtractor, pBuffer, bytesRead))
+        {
+            bCorrupt = TRUE;
+            TerminateProcess(pi.hProcess, 1);
+            break;
+        }
+
+        msNow = GetTickCount64();
+        if (pDlg && msNow - msLastUpdate >= 250)
+        {
+            double mb;
+
+            msLastUpdate = msNow;
+            if (IProgressDialog_HasUserCancelled(pDlg))
+            {
+                bCancelled = TRUE;
+                TerminateProcess(pi.hProcess, 1);
+                break;
+            }
+            ExtractorGetStats(pExtractor, &stats);
+            mb = (double)stats.cbWritten / (1024.0 * 1024.0);
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"%lu files, %.1f MB (%.1f MB/s)",
+                stats.nFiles, mb, mb * 1000.0 / (double)(msNow - msStart + 1));
+            IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+        }
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    /* Let the writers finish before reporting */
+    bCorrupt = bCorrupt || (!bCancelled && !ExtractorAtEnd(pExtractor));
+    ExtractorFinish(pExtractor, &stats);
+    pExtractor = NULL;
+
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+    }
+
+    SHChangeNotify(SHCNE_UPDATEDIR, SHCNF_PATHW, szFolder, NULL);
+
+    szErrors[0] = L'\0';
+    if (hErr != INVALID_HANDLE_VALUE)
+        ReadErrorTail(hErr, szErrors, 1024);
+
+    if (bCancelled)
+    {
+        result = 1;
+    }
+    else if (bCorrupt)
+    {
+        WCHAR szError[2048];
+        StringCchPrintfW(szError, 2048,
+            L"The download stopped before it was complete (exit code %lu).\n\n%s%s%s",
+            dwExitCode, stats.szFirstError, stats.szFirstError[0] ? L"\n" : L"", szErrors);
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Download", MB_OK | MB_ICONERROR);
+    }
+    else if (stats.nErrors > 0 || stats.nSkipped > 0 || dwExitCode != 0)
+    {
+        /* Complete archive, but not everything made it (or tar had warnings) */
+        WCHAR szError[2048];
+        StringCchPrintfW(szError, 2048,
+            L"Downloaded %lu files to %s.\n\n"
+            L"%lu could not be written%s%s\n"
+            L"%lu symbolic links or special files were skipped.\n\n%s",
+            stats.nFiles, szTarget, stats.nErrors,
+            stats.szFirstError[0] ? L", first: " : L".", stats.szFirstError,
+            stats.nSkipped, szErrors);
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Download", MB_OK | MB_ICONWARNING);
+        result = stats.nErrors > 0 ? 1 : 0;
+    }
+    else
+    {
+        result = 0;
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (pExtractor)
+        ExtractorFinish(pExtractor, NULL);
+    if (hOutRead)
+        CloseHandle(hOutRead);
+    if (hOutWrite)
+        CloseHandle(hOutWrite);
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    if (bCoInit)
+        CoUninitialize();
+    free(pLoc);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    free(pBuffer);
+    return result;
+}
@@ -0,0 +1,220 @@
+/**
+ * sshfs-ssh-exec.c
+ *
+ * Commands run on the server from scripts:
+ * sshfs-ssh.exe exec <path> -- <command>...
+ *
+ * sshfs-ssh.exe exec X:\proj -- make -j32 runs make on the server in the
+ * folder X:\proj is mounted from, which for builds and tests is far faster
+ * than running them on the drive. There is no PTY (ssh -T): the command's
+ * stdout and stderr arrive on this program's own, unmixed and as they are
+ * written, and its exit status is this program's. The arguments are joined
+ * and run by the login shell, as ssh does, with stdin from /dev/null.
+ *
+ * ssh's stdin carries control lines to the wrapper on the server instead
+ * (RemoteBuildExecCommand()), and ssh runs in its own process group, so
+ * Ctrl+C in the console signals the command rather than ending ssh.
+ *
+ * sshfs-ssh.exe is a GUI program: it writes to the console of whoever
+ * started it, but cmd only waits for it in scripts and PowerShell not at
+ * all. sshfs-exec.exe (sshfs-exec.c) is this verb as a console program,
+ * for shells to run like any other command.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-ssh.h"
+
+/* Write end of ssh's stdin while "exec" runs, for the Ctrl+C handler */
+static HANDLE g_hExecControl = NULL;
+static volatile LONG g_nExecPresses = 0;
+
+/**
+ * Ctrl+C during "exec" goes to the command on the server (SIGINT, then
+ * SIGTERM and SIGKILL on repeats) instead of ending ssh. Anything else
+ * (Ctrl+Break, closing the console) ends ssh, which hangs up the command.
+ */
+static BOOL WINAPI ExecCtrlHandler(DWORD dwCtrlType)
+{
+    char line[2];
+    DWORD cbWritten;
+
+    if (dwCtrlType != CTRL_C_EVENT)
+        return FALSE;
+
+    line[0] = RemoteExecSignal((int)InterlockedIncrement(&g_nExecPresses));
+    line[1] = '\n';
+    WriteFile(g_hExecControl, line, 2, &cbWritten, NULL);
+    return TRUE;
+}
+
+int RunRemoteExec(LPCWSTR pszPath, LPWSTR *ppszArgs, int nArgs)
+{
+    SSHFSLocation *pLoc = NULL;
+    char **ppszArgsA = NULL;
+    char *pszRemote = NULL;
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine;
+    size_t cbCmd;
+    WCHAR szFull[MAX_PATH];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szError[MAX_PATH * 2];
+    PROCESS_INFORMATION pi = {0};
+    HANDLE hInRead = NULL;
+    HANDLE hOut = INVALID_HANDLE_VALUE;
+    HANDLE hErr = INVALID_HANDLE_VALUE;
+    ResolveResult res;
+    DWORD dwExit = 255;
+    BOOL bConsole;
+    BOOL bHasPassword = FALSE;
+    BOOL bStarted;
+    int i;
+    int result = 255;               /* What ssh returns when it fails itself */
+
+    /* sshfs-exec.exe has its console already */
+    bConsole = AttachConsole(ATTACH_PARENT_PROCESS) || GetLastError() == ERROR_ACCESS_DENIED;
+    hOut = GetExecStdHandle(STD_OUTPUT_HANDLE, L"CONOUT$", bConsole);
+    hErr = GetExecStdHandle(STD_ERROR_HANDLE, L"CONOUT$", bConsole);
+
+    if (nArgs > 0 && wcscmp(ppszArgs[0], L"--") == 0)
+    {
+        ppszArgs++;
+        nArgs--;
+    }
+    if (nArgs < 1)
+    {
+        WriteExecError(hErr, L"Usage: sshfs-ssh.exe exec <path> -- <command> [<argument>...]\r\n");
+        goto cleanup;
+    }
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    ppszArgsA = calloc((size_t)nArgs, sizeof(char *));
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    if (!pLoc || !ppszArgsA || !pszRemote)
+        goto cleanup;
+
+    if (!GetFullPathNameW(pszPath, MAX_PATH, szFull, NULL))
+        StringCchCopyW(szFull, MAX_PATH, pszPath);
+    res = ResolveSSHFSPath(szFull, pLoc);
+    if (res != RESOLVE_OK)
+    {
+        StringCchPrintfW(szError, MAX_PATH * 2,
+            res == RESOLVE_PARSE_FAILED ?
+                L"Could not parse SSHFS connection information from the path: %s\r\n" :
+                L"This path is not on an SSHFS mounted drive: %s\r\n",
+            szFull);
+        WriteExecError(hErr, szError);
+        goto cleanup;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+
+    for (i = 0; i < nArgs; i++)
+    {
+        int cb = WideCharToMultiByte(CP_UTF8, 0, ppszArgs[i], -1, NULL, 0, NULL, NULL);
+        ppszArgsA[i] = malloc(cb > 0 ? (size_t)cb : 1);
+        if (!ppszArgsA[i])
+            goto cleanup;
+        ppszArgsA[i][0] = '\0';
+        WideCharToMultiByte(CP_UTF8, 0, ppszArgs[i], -1, ppszArgsA[i], cb, NULL, NULL);
+    }
+
+    cbCmd = RemoteBuildExecCommand(pszRemote, (const char *const *)ppszArgsA, (size_t)nArgs, NULL, 0) + 1;
+    cchCmdLine = cbCmd + 2 * MAX_PATH + 512;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW || !pszCmdLine)
+        goto cleanup;
+    RemoteBuildExecCommand(pszRemote, (const char *const *)ppszArgsA, (size_t)nArgs, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    if (!FindSSH(szSSHPath, MAX_PATH))
+    {
+        WriteExecError(hErr, L"OpenSSH client (ssh.exe) not found.\r\n");
+        goto cleanup;
+    }
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* Without a console nobody could answer a prompt */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword || bConsole ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+    {
+        WriteExecError(hErr, L"The command is too long.\r\n");
+        goto cleanup;
+    }
+
+    if (!CreateSSHPipe(&g_hExecControl, &hInRead, TRUE, 0))
+        goto cleanup;
+
+    SetConsoleCtrlHandler(ExecCtrlHandler, TRUE);
+    bStarted = SpawnSSH(pszCmdLine, hInRead, hOut, hErr,
+        CREATE_NEW_PROCESS_GROUP | (bConsole ? 0 : CREATE_NO_WINDOW),
+        szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (!bStarted)
+    {
+        StringCchPrintfW(szError, MAX_PATH * 2, L"Failed to start ssh.exe (error %lu).\r\n", GetLastError());
+        WriteExecError(hErr, szError);
+        goto cleanup;
+    }
+    CloseHandle(hInRead);
+    hInRead = NULL;
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    if (GetExitCodeProcess(pi.hProcess, &dwExit))
+        result = (int)dwExit;
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+cleanup:
+    SetConsoleCtrlHandler(ExecCtrlHandler, FALSE);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hInRead)
+        CloseHandle(hInRead);
+    if (g_hExecControl)
+    {
+        CloseHandle(g_hExecControl);
+        g_hExecControl = NULL;
+    }
+    if (hOut != INVALID_HANDLE_VALUE)
+        CloseHandle(hOut);
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    if (ppszArgsA)
+    {
+        for (i = 0; i < nArgs; i++)
+            free(ppszArgsA[i]);
+    }
+    free(ppszArgsA);
+    free(pLoc);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    return result;
+}
@@ -0,0 +1,522 @@
+/**
+ * sshfs-ssh-fanout.c
+ *
+ * Terminals on every mount of the same folder: sshfs-ssh.exe --fanout <folder>
+ *
+ * For trees mounted from many servers (X:\srv\app on web1, Y:\srv\app on
+ * web2, ...), a terminal opens in the same folder on every SSHFS drive that
+ * has it, with one console whose input goes to all of them. The folder is
+ * looked up below the root of every SSHFS drive at once, so an unreachable
+ * server only costs its own check. The terminals are the relay's
+ * (sshfs-ssh-launcher.exe --broadcast), opened a few at a time
+ * (FanoutSchedule): each counts as starting until it has logged in, so
+ * dozens of handshakes and password prompts do not land together.
+ *
+ * Input typed into the broadcast console is kept once (sshfs-fanout.c) and
+ * written to each session by its own thread, so a slow or hung server only
+ * falls behind by itself. Each terminal keeps its own keyboard too; closing
+ * the broadcast console ends the broadcast, not the sessions.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-fanout.h"
+#include "sshfs-ssh.h"
+
+/**
+ * One terminal of "Open SSH Terminal Here on all servers"
+ */
+typedef struct FanoutSession {
+    WCHAR szPath[MAX_PATH];         /* The folder on this session's drive */
+    SSHFSLocation loc;
+    volatile LONG bExists;          /* Set by FanoutCheckThread */
+    HANDLE hWrite;                  /* Our end of the relay's input pipe */
+    HANDLE hThread;
+    BroadcastLink link;
+    BOOL bEnded, bReported;
+    size_t i;
+    struct FanoutJob *job;
+} FanoutSession;
+
+typedef struct FanoutJob {
+    FanoutSession *pSessions;
+    size_t nSessions;
+    Fanout ring;                    /* Guarded by cs */
+    FanoutSchedule sched;           /* Main thread only */
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cvInput;     /* New input, room in the ring, or a session dropped */
+    HANDLE hIn, hOut;               /* The broadcast console */
+} FanoutJob;
+
+/**
+ * Thread: Does the folder exist on this drive (a hung mount only holds up its own check)
+ */
+static DWORD WINAPI FanoutCheckThread(LPVOID pParam)
+{
+    FanoutSession *s = (FanoutSession *)pParam;
+    DWORD dwAttrs = GetFileAttributesW(s->szPath);
+
+    InterlockedExchange(&s->bExists,
+        dwAttrs != INVALID_FILE_ATTRIBUTES && (dwAttrs & FILE_ATTRIBUTE_DIRECTORY));
+    return 0;
+}
+
+/**
+ * The drive a path is on and the path below the drive's root: from a drive
+ * letter path, or a UNC path below some drive's connection
+ */
+static BOOL GetFanoutSubPath(LPCWSTR pszPath, WCHAR *pcDrive, LPWSTR pszSub, DWORD cchSub)
+{
+    WCHAR szUNC[MAX_PATH * 2];
+    LPCWSTR pszRest = NULL;
+    DWORD dwDrives = GetLogicalDrives();
+    size_t len;
+    int d;
+
+    if (pszPath[0] && pszPath[1] == L':')
+    {
+        *pcDrive = towupper(pszPath[0]);
+        pszRest = pszPath + 2;
+    }
+    else
+    {
+        for (d = 0; d < 26 && !pszRest; d++)
+        {
+            if (!(dwDrives & (1u << d)) || !GetDriveUNCPath((WCHAR)(L'A' + d), szUNC, MAX_PATH * 2))
+                continue;
+            len = wcslen(szUNC);
+            if (_wcsnicmp(pszPath, szUNC, len) == 0 &&
+                (pszPath[len] == L'\0' || pszPath[len] == L'\\' || pszPath[len] == L'/'))
+            {
+                *pcDrive = (WCHAR)(L'A' + d);
+                pszRest = pszPath + len;
+            }
+        }
+        if (!pszRest)
+            return FALSE;
+    }
+
+    while (*pszRest == L'\\' || *pszRest == L'/')
+        pszRest++;
+    StringCchCopyW(pszSub, cchSub, pszRest);
+    len = wcslen(pszSub);
+    while (len > 0 && (pszSub[len - 1] == L'\\' || pszSub[len - 1] == L'/'))
+        pszSub[--len] = L'\0';
+    return TRUE;
+}
+
+/**
+ * "X: user@host[:port]" for status lines and the confirmation
+ */
+static void FormatFanoutSession(const FanoutSession *s, LPWSTR pszOut, DWORD cchOut)
+{
+    if (s->loc.szPort[0])
+        StringCchPrintfW(pszOut, cchOut, L"%c: %s@%s:%s", s->szPath[0], s->loc.szUser, s->loc.szHost, s->loc.szPort);
+    else
+        StringCchPrintfW(pszOut, cchOut, L"%c: %s@%s", s->szPath[0], s->loc.szUser, s->loc.szHost);
+}
+
+/**
+ * Status line in the broadcast console
+ */
+static void PrintFanoutStatus(FanoutJob *job, const FanoutSession *s, LPCWSTR pszWhat)
+{
+    WCHAR szLine[512];
+    WCHAR szName[400];
+    DWORD cchWritten;
+
+    FormatFanoutSession(s, szName, 400);
+    StringCchPrintfW(szLine, 512, L"%s: %s\r\n", szName, pszWhat);
+    WriteConsoleW(job->hOut, szLine, (DWORD)wcslen(szLine), &cchWritten, NULL);
+}
+
+/**
+ * Say once for each session that no longer gets input why (cs held)
+ */
+static void ReportFanoutDrops(FanoutJob *job)
+{
+    size_t i;
+
+    for (i = 0; i < job->nSessions; i++)
+    {
+        FanoutSession *s = &job->pSessions[i];
+        if (s->bReported || !job->ring.pSinks[i].bDropped)
+            continue;
+        s->bReported = TRUE;
+        PrintFanoutStatus(job, s, s->bEnded ? L"session ended" :
+            L"stopped taking input, no longer typed into");
+    }
+}
+
+/**
+ * Thread: Write the broadcast stream into one session's relay
+ */
+static DWORD WINAPI FanoutWriterThread(LPVOID pParam)
+{
+    FanoutSession *s = (FanoutSession *)pParam;
+    FanoutJob *job = s->job;
+    unsigned char chunk[16384];
+    const unsigned char *p;
+    size_t cb = 0;
+    DWORD cbWritten;
+    BOOL bOk;
+
+    EnterCriticalSection(&job->cs);
+    for (;;)
+    {
+        while (!job->ring.pSinks[s->i].bDropped && (cb = FanoutPeek(&job->ring, s->i, &p)) == 0)
+            SleepConditionVariableCS(&job->cvInput, &job->cs, INFINITE);
+        if (job->ring.pSinks[s->i].bDropped)
+            break;
+        if (cb > sizeof(chunk))
+            cb = sizeof(chunk);
+        memcpy(chunk, p, cb);
+        LeaveCriticalSection(&job->cs);
+
+        /* Blocks while the session is busy; fails once it has ended */
+        bOk = WriteFile(s->hWrite, chunk, (DWORD)cb, &cbWritten, NULL);
+
+        EnterCriticalSection(&job->cs);
+        if (bOk)
+            FanoutConsume(&job->ring, s->i, cbWritten, GetTickCount64());
+        else
+            FanoutDrop(&job->ring, s->i);
+        WakeAllConditionVariable(&job->cvInput);
+    }
+    LeaveCriticalSection(&job->cs);
+
+    CloseHandle(s->hWrite);
+    return 0;
+}
+
+/**
+ * Thread: Read the broadcast console and queue its input for every session
+ */
+static DWORD WINAPI FanoutInputThread(LPVOID pParam)
+{
+    FanoutJob *job = (FanoutJob *)pParam;
+    char buffer[4096];
+    DWORD cbRead;
+
+    while (ReadFile(job->hIn, buffer, sizeof(buffer), &cbRead, NULL) && cbRead > 0)
+    {
+        EnterCriticalSection(&job->cs);
+
+        /* A paste larger than the ring waits for the sessions; stalled ones are dropped */
+        while (FanoutRoom(&job->ring, GetTickCount64()) < cbRead)
+        {
+            ReportFanoutDrops(job);
+            SleepConditionVariableCS(&job->cvInput, &job->cs, 250);
+        }
+        FanoutPush(&job->ring, buffer, cbRead, GetTickCount64());
+        ReportFanoutDrops(job);
+        WakeAllConditionVariable(&job->cvInput);
+        LeaveCriticalSection(&job->cs);
+    }
+    return 0;
+}
+
+/**
+ * Open one session's terminal through the relay, with an input pipe and a
+ * ready event only it inherits (they are created just before its launch)
+ */
+static BOOL StartFanoutSession(FanoutSession *s)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    BOOL bOk;
+
+    if (!CreateSSHPipe(&s->hWrite, &s->link.hRead, TRUE, 65536))
+        return FALSE;
+
+    s->link.hReady = CreateEventW(&sa, TRUE, FALSE, NULL);
+    bOk = s->link.hReady && LaunchSSHTerminal(s->loc.szUser, s->loc.szHost, s->loc.szPort,
+        s->loc.szRemotePath, s->szPath, s->loc.mountType, &s->link);
+
+    CloseHandle(s->link.hRead);
+    s->link.hRead = NULL;
+    if (s->link.hReady)
+        SetHandleInformation(s->link.hReady, HANDLE_FLAG_INHERIT, 0);
+
+    if (bOk)
+        s->hThread = CreateThread(NULL, 0, FanoutWriterThread, s, 0, NULL);
+    if (!s->hThread)
+    {
+        CloseHandle(s->hWrite);
+        s->hWrite = NULL;
+        if (s->link.hReady)
+            CloseHandle(s->link.hReady);
+        s->link.hReady = NULL;
+        if (s->link.hProcess)
+            TerminateProcess(s->link.hProcess, 1);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+int RunFanout(LPCWSTR pszPath)
+{
+    FanoutJob job;
+    FanoutSession *pCandidates = NULL;
+    HANDLE ahChecks[26];
+    WCHAR szSub[MAX_PATH];
+    WCHAR szUNC[MAX_PATH * 2];
+    WCHAR szText[4096];
+    WCHAR szLine[512];
+    WCHAR cDrive;
+    DWORD dwDrives, cchWritten;
+    HANDLE hInputThread = NULL;
+    size_t nCandidates = 0, nChecks = 0, i, j;
+    BOOL bChecksDone = TRUE;
+    int d;
+    int result = 1;
+
+    ZeroMemory(&job, sizeof(job));
+
+    if (!GetFanoutSubPath(pszPath, &cDrive, szSub, MAX_PATH))
+    {
+        MessageBoxW(NULL,
+            L"The folder is not on a drive letter.\n\n"
+            L"Map the SSHFS drives to open a terminal on all of them.",
+            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONWARNING);
+        return 1;
+    }
+
+    /* Every SSHFS drive, the folder's own first */
+    pCandidates = (FanoutSession *)calloc(26, sizeof(FanoutSession));
+    if (!pCandidates)
+        return 1;
+    dwDrives = GetLogicalDrives();
+    for (d = 0; d < 26; d++)
+    {
+        WCHAR cLetter = (WCHAR)(L'A' + d);
+        FanoutSession *s;
+
+        if (!(dwDrives & (1u << d)) || !GetDriveUNCPath(cLetter, szUNC, MAX_PATH * 2) ||
+            _wcsnicmp(szUNC, L"\\\\sshfs", 7) != 0)
+            continue;
+        s = &pCandidates[nCandidates++];
+        StringCchPrintfW(s->szPath, MAX_PATH, L"%c:\\%s", cLetter, szSub);
+        if (cLetter == cDrive && s != pCandidates)
+        {
+            FanoutSession t = pCandidates[0];
+            pCandidates[0] = *s;
+            *s = t;
+        }
+    }
+
+    /* The others are checked side by side */
+    if (nCandidates > 0 && pCandidates[0].szPath[0] == cDrive)
+        pCandidates[0].bExists = TRUE;
+    for (i = 0; i < nCandidates; i++)
+    {
+        if (pCandidates[i].bExists)
+            continue;
+        ahChecks[nChecks] = CreateThread(NULL, 0, FanoutCheckThread, &pCandidates[i], 0, NULL);
+        if (ahChecks[nChecks])
+            nChecks++;
+    }
+    if (nChecks > 0)
+    {
+        bChecksDone = WaitForMultipleObjects((DWORD)nChecks, ahChecks, TRUE, 10000) != WAIT_TIMEOUT;
+        for (i = 0; i < nChecks; i++)
+            CloseHandle(ahChecks[i]);
+    }
+
+    /* The same server folder reached through two drives is opened once */
+    job.pSessions = (FanoutSession *)calloc(nCandidates ? nCandidates : 1, sizeof(FanoutSession));
+    if (!job.pSessions)
+        goto cleanup;
+    for (i = 0; i < nCandidates; i++)
+    {
+        FanoutSession *s = &job.pSessions[job.nSessions];
+
+        if (!InterlockedCompareExchange(&pCandidates[i].bExists, 0, 0))
+            continue;
+        StringCchCopyW(s->szPath, MAX_PATH, pCandidates[i].szPath);
+        if (ResolveSSHFSPath(s->szPath, &s->loc) != RESOLVE_OK)
+            continue;
+        for (j = 0; j < job.nSessions; j++)
+        {
+            if (SameSSHFSServer(&job.pSessions[j].loc, &s->loc) &&
+                wcscmp(job.pSessions[j].loc.szRemotePath, s->loc.szRemotePath) == 0)
+                break;
+        }
+        if (j < job.nSessions)
+            continue;
+        s->i = job.nSessions++;
+        s->job = &job;
+    }
+
+    if (job.nSessions < 2)
+    {
+        StringCchPrintfW(szText, 4096,
+            L"No other SSHFS drive has the folder \\%s.\n\n"
+            L"A terminal is opened on every drive whose root has the same folder.",
+            szSub);
+        MessageBoxW(NULL, szText, L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONINFORMATION);
+        goto cleanup;
+    }
+
+    StringCchPrintfW(szText, 4096,
+        L"Open a terminal in \\%s on these %u servers?\n\n"
+        L"Input typed into the broadcast window goes to all of them.\n\n",
+        szSub, (unsigned)job.nSessions);
+    for (i = 0; i < job.nSessions; i++)
+    {
+        FormatFanoutSession(&job.pSessions[i], szLine, 512);
+        StringCchCatW(szText, 4096, szLine);
+        StringCchCatW(szText, 4096, L"\n");
+    }
+    if (MessageBoxW(NULL, szText, L"SSHFS-Win - SSH Terminal", MB_OKCANCEL | MB_ICONQUESTION) != IDOK)
+    {
+        result = 0;
+        goto cleanup;
+    }
+
+    if (!FanoutInit(&job.ring, job.nSessions, FANOUT_RING_SIZE) ||
+        !FanoutScheduleInit(&job.sched, job.nSessions, FANOUT_MAX_STARTING, FANOUT_START_TIMEOUT_MS))
+        goto cleanup;
+    InitializeCriticalSection(&job.cs);
+    InitializeConditionVariable(&job.cvInput);
+
+    /* The broadcast console: raw input, passed on as the terminals would read it */
+    AllocConsole();
+    StringCchPrintfW(szLine, 512, L"SSH broadcast: %u servers", (unsigned)job.nSessions);
+    SetConsoleTitleW(szLine);
+    job.hIn = CreateFileW(L"CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, 0, NULL);
+    job.hOut = CreateFileW(L"CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, 0, NULL);
+    SetConsoleCP(CP_UTF8);
+    SetConsoleMode(job.hIn, ENABLE_VIRTUAL_TERMINAL_INPUT);
+    StringCchPrintfW(szText, 4096,
+        L"Typing here goes to all %u terminals in \\%s.\r\n"
+        L"Close this window to stop broadcasting; the terminals stay open.\r\n\r\n",
+        (unsigned)job.nSessions, szSub);
+    WriteConsoleW(job.hOut, szText, (DWORD)wcslen(szText), &cchWritten, NULL);
+
+    hInputThread = CreateThread(NULL, 0, FanoutInputThread, &job, 0, NULL);
+
+    /* Start sessions as the schedule allows until all have ended */
+    for (;;)
+    {
+        HANDLE ahWait[MAXIMUM_WAIT_OBJECTS];
+        size_t aiWait[MAXIMUM_WAIT_OBJECTS];
+        DWORD nWait = 0, dwTimeout, dwWait;
+        long iNext;
+
+        while ((iNext = FanoutScheduleNext(&job.sched, GetTickCount64())) >= 0)
+        {
+            FanoutSession *s = &job.pSessions[iNext];
+
+            PrintFanoutStatus(&job, s, L"connecting");
+            if (StartFanoutSession(s))
+                continue;
+            FanoutScheduleDone(&job.sched, (size_t)iNext, FALSE);
+            EnterCriticalSection(&job.cs);
+            s->bEnded = TRUE;
+            FanoutDrop(&job.ring, (size_t)iNext);
+            ReportFanoutDrops(&job);
+            LeaveCriticalSection(&job.cs);
+        }
+
+        /* Logins and ended relays; each session needs at most two slots */
+        for (i = 0; i < job.nSessions && nWait + 2 <= MAXIMUM_WAIT_OBJECTS; i++)
+        {
+            FanoutSession *s = &job.pSessions[i];
+            if (s->bEnded || !s->link.hProcess)
+                continue;
+            if (s->link.hReady)
+            {
+                aiWait[nWait] = i;
+                ahWait[nWait++] = s->link.hReady;
+            }
+            aiWait[nWait] = i;
+            ahWait[nWait++] = s->link.hProcess;
+        }
+        if (nWait == 0)
+        {
+            if (FanoutScheduleStarted(&job.sched))
+                break;
+            continue;
+        }
+
+        dwTimeout = FanoutScheduleWait(&job.sched, GetTickCount64());
+        dwWait = WaitForMultipleObjects(nWait, ahWait, FALSE, dwTimeout == ~0UL ? INFINITE : dwTimeout);
+        if (dwWait >= WAIT_OBJECT_0 + nWait)
+            continue;
+
+        {
+            FanoutSession *s = &job.pSessions[aiWait[dwWait - WAIT_OBJECT_0]];
+
+            if (ahWait[dwWait - WAIT_OBJECT_0] == s->link.hReady)
+            {
+                FanoutScheduleDone(&job.sched, s->i, TRUE);
+                CloseHandle(s->link.hReady);
+                s->link.hReady = NULL;
+                PrintFanoutStatus(&job, s, L"logged in");
+                continue;
+            }
+
+            /* The relay ended: its writer stops, and the next session may start */
+            FanoutScheduleDone(&job.sched, s->i, FALSE);
+            EnterCriticalSection(&job.cs);
+            s->bEnded = TRUE;
+            FanoutDrop(&job.ring, s->i);
+            if (s->bReported)
+                PrintFanoutStatus(&job, s, L"session ended");
+            ReportFanoutDrops(&job);
+            WakeAllConditionVariable(&job.cvInput);
+            LeaveCriticalSection(&job.cs);
+        }
+    }
+    result = 0;
+
+    /* Writers stop with their sessions; the console reader is blocked reading */
+    if (job.hIn && job.hIn != INVALID_HANDLE_VALUE)
+        CancelIoEx(job.hIn, NULL);
+    if (hInputThread)
+    {
+        WaitForSingleObject(hInputThread, 1000);
+        CloseHandle(hInputThread);
+    }
+    for (i = 0; i < job.nSessions; i++)
+    {
+        FanoutSession *s = &job.pSessions[i];
+        if (s->hThread)
+        {
+            WaitForSingleObject(s->hThread, 1000);
+            CloseHandle(s->hThread);
+        }
+        if (s->link.hReady)
+            CloseHandle(s->link.hReady);
+        if (s->link.hProcess)
+            CloseHandle(s->link.hProcess);
+    }
+    if (job.hIn && job.hIn != INVALID_HANDLE_VALUE)
+        CloseHandle(job.hIn);
+    if (job.hOut && job.hOut != INVALID_HANDLE_VALUE)
+        CloseHandle(job.hOut);
+    DeleteCriticalSection(&job.cs);
+
+cleanup:
+    FanoutScheduleFree(&job.sched);
+    FanoutFree(&job.ring);
+    free(job.pSessions);
+    /* A check stuck on a hung mount still uses its candidate */
+    if (bChecksDone)
+        free(pCandidates);
+    return result;
+}
@@ -0,0 +1,644 @@
+/**
+ * sshfs-ssh-hash.c
+ *
+ * Remote hashing: sshfs-ssh.exe --hash <item>...
+ *                 sshfs-ssh.exe --compare <folder> [<local folder>]
+ *
+ * Reading every remote byte through the mount to verify a tree is slow;
+ * here sha256sum runs on the server and only the digests come back. The
+ * files are listed through the mount (directory reads only), split over up
+ * to HASH_MAX_CHANNELS ssh connections by size (sshfs-hash.c), and each
+ * channel gets its share as a NUL separated list on stdin.
+ *
+ * --hash (the selected items, all in one folder) writes a sha256sum
+ * compatible list and opens it. --compare (the mounted folder, and the
+ * local folder, asked for if missing) hashes the local copy at the same
+ * time on several threads, only for files whose sizes match, and reports
+ * just the files that differ.
+ */
+
+#define COBJMACROS
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shellapi.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-hash.h"
+#include "sshfs-verify.h"
+#include "sshfs-ssh.h"
+
+/* Hash channels print one short line per file; the pipe only covers polling gaps */
+#define HASH_PIPE_SIZE (64 * 1024)
+#define HASH_LINE_MAX (HASH_HEX_LEN + 8 + 2 * 4096)
+
+/**
+ * One ssh running sha256sum over its share of the files
+ */
+typedef struct HashChannel {
+    PROCESS_INFORMATION pi;
+    HANDLE hList;                   /* Temp file with the channel's names, ssh's stdin */
+    HANDLE hOutRead;
+    BOOL bDone;
+    BOOL bSkipLine;                 /* The current line did not fit: drop it */
+    char line[HASH_LINE_MAX];
+    size_t cbLine;
+} HashChannel;
+
+static void ReportPutSection(ReportWriter *w, const char *pszTitle, VerifyFile **ppFiles, size_t nFiles)
+{
+    char szCount[32];
+
+    if (nFiles == 0)
+        return;
+    ReportPutStr(w, pszTitle);
+    StringCchPrintfA(szCount, 32, " (%lu):\r\n", (unsigned long)nFiles);
+    ReportPutStr(w, szCount);
+    for (size_t i = 0; i < nFiles; i++)
+    {
+        ReportPutStr(w, "    ");
+        ReportPutStr(w, ppFiles[i]->pszName);
+        ReportPutStr(w, "\r\n");
+    }
+    ReportPutStr(w, "\r\n");
+}
+
+/**
+ * Take one sha256sum line: record the digest of the listed file
+ */
+static void TakeHashLine(const char *pszLine, size_t cchLine, VerifyList *pRemote, unsigned long long *pcbDone)
+{
+    unsigned char digest[HASH_SIZE];
+    char szName[HASH_LINE_MAX];
+    VerifyFile *pFile;
+
+    if (!HashParseLine(pszLine, cchLine, digest, szName, HASH_LINE_MAX) ||
+        strncmp(szName, "./", 2) != 0)
+        return;
+
+    pFile = VerifyListFind(pRemote, szName + 2);
+    if (pFile && !pFile->bHashed)
+    {
+        memcpy(pFile->digest, digest, HASH_SIZE);
+        pFile->bHashed = TRUE;
+        *pcbDone += pFile->size;
+    }
+}
+
+/**
+ * Read whatever a channel has printed. FALSE if there was nothing.
+ */
+static BOOL PollHashChannel(HashChannel *c, char *pBuffer, VerifyList *pRemote, unsigned long long *pcbDone)
+{
+    DWORD dwAvail = 0, bytesRead, i;
+
+    if (c->bDone)
+        return FALSE;
+    if (!PeekNamedPipe(c->hOutRead, NULL, 0, NULL, &dwAvail, NULL))
+    {
+        /* ssh exited and everything it wrote has been read */
+        c->bDone = TRUE;
+        return FALSE;
+    }
+    if (dwAvail == 0)
+        return FALSE;
+    if (!ReadFile(c->hOutRead, pBuffer, DOWNLOAD_READ_SIZE, &bytesRead, NULL) || bytesRead == 0)
+    {
+        c->bDone = TRUE;
+        return FALSE;
+    }
+
+    for (i = 0; i < bytesRead; i++)
+    {
+        if (pBuffer[i] == '\n')
+        {
+            if (!c->bSkipLine)
+                TakeHashLine(c->line, c->cbLine, pRemote, pcbDone);
+            c->cbLine = 0;
+            c->bSkipLine = FALSE;
+        }
+        else if (c->cbLine < HASH_LINE_MAX)
+        {
+            c->line[c->cbLine++] = pBuffer[i];
+        }
+        else
+        {
+            c->bSkipLine = TRUE;
+        }
+    }
+    return TRUE;
+}
+
+int RunRemoteHash(LPWSTR *ppszPaths, int nPaths, BOOL bCompare)
+{
+    SSHFSLocation *pLoc = NULL;
+    ResolveResult res;
+    VerifyList remote = {0}, local = {0};
+    VerifyFile **ppHash = NULL;     /* Remote files to hash */
+    VerifyFile **ppLocal = NULL;    /* Their local counterparts (compare) */
+    VerifyFile **ppReport = NULL;
+    unsigned long long *pSizes = NULL;
+    int *pChannelOf = NULL;
+    HashChannel *pChannels = NULL;
+    LocalHasher *pHasher = NULL;
+    LPCWSTR *ppszItems = NULL;
+    LPCWSTR pszTitle = bCompare ? L"SSHFS-Win - Compare" : L"SSHFS-Win - Hash";
+    size_t nHash = 0, nItems = 0, i, j;
+    int nChannels = 0, nStarted = 0, c;
+    char *pszRemote = NULL;
+    char *pszCmd = NULL;
+    char *pBuffer = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    WCHAR szRoot[MAX_PATH];
+    WCHAR szLocal[MAX_PATH];
+    WCHAR szName[MAX_PATH];
+    WCHAR szReport[MAX_PATH];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szLine[MAX_PATH * 2];
+    WCHAR szErrors[1024];
+    HANDLE hErr = INVALID_HANDLE_VALUE;
+    IProgressDialog *pDlg = NULL;
+    unsigned long long cbRemoteTotal = 0, cbRemoteDone = 0;
+    unsigned long long cbLocalTotal = 0;
+    ULONGLONG msStart, msLastUpdate = 0;
+    BOOL bHasPassword = FALSE;
+    BOOL bCancelled = FALSE;
+    BOOL bCoInit = FALSE;
+    int result = 1;
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    pBuffer = malloc(DOWNLOAD_READ_SIZE);
+    ppszItems = calloc(nPaths, sizeof(LPCWSTR));
+    if (!pLoc || !pszRemote || !pszCmdLine || !pBuffer || !ppszItems)
+        goto cleanup;
+
+    /* Root folder on the mount, and the items in it (NULL: all of it) */
+    StringCchCopyW(szRoot, MAX_PATH, ppszPaths[0]);
+    PathRemoveBackslashW(szRoot);
+    if (bCompare || PathIsRootW(szRoot) || PathIsUNCServerShareW(szRoot) || szRoot[wcslen(szRoot) - 1] == L':')
+    {
+        PathAddBackslashW(szRoot);
+        StringCchCopyW(szName, MAX_PATH, PathFindFileNameW(szRoot));
+        PathRemoveBackslashW(szName);
+    }
+    else
+    {
+        for (c = 0; c < nPaths; c++)
+        {
+            PathRemoveBackslashW(ppszPaths[c]);
+            ppszItems[nItems++] = PathFindFileNameW(ppszPaths[c]);
+        }
+        StringCchCopyW(szName, MAX_PATH, ppszItems[0]);
+        PathRemoveFileSpecW(szRoot);
+    }
+
+    res = ResolveSSHFSPath(szRoot, pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(szRoot, res, pszTitle);
+        goto cleanup;
+    }
+    if (!szName[0] || szName[wcslen(szName) - 1] == L':')
+        StringCchCopyW(szName, MAX_PATH, pLoc->szHost);
+    if (bCompare && !PathIsDirectoryW(szRoot))
+    {
+        MessageBoxW(NULL, L"Select a folder to compare with a local folder.", pszTitle, MB_OK | MB_ICONINFORMATION);
+        goto cleanup;
+    }
+
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
+
+    if (bCompare)
+    {
+        if (nPaths >= 2 && ppszPaths[1][0])
+        {
+            StringCchCopyW(szLocal, MAX_PATH, ppszPaths[1]);
+        }
+        else
+        {
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"Compare \"%s\" with", szName);
+            if (!PickLocalPath(szLine, FOS_PICKFOLDERS, szLocal, MAX_PATH))
+                goto cleanup;
+        }
+    }
+
+    if (SUCCEEDED(CoCreateInstance(&CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IProgressDialog, (void **)&pDlg)))
+    {
+        IProgressDialog_SetTitle(pDlg, bCompare ? L"Comparing" : L"Hashing");
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"Hashing %s on %s@%s", szName, pLoc->szUser, pLoc->szHost);
+        IProgressDialog_SetLine(pDlg, 1, szLine, FALSE, NULL);
+        IProgressDialog_SetLine(pDlg, 2, L"Listing files...", FALSE, NULL);
+        IProgressDialog_StartProgressDialog(pDlg, NULL, NULL, PROGDLG_NORMAL | PROGDLG_AUTOTIME, NULL);
+    }
+
+    /* The remote tree is listed through the mount: directory reads, no content */
+    if (!VerifyListScan(&remote, szRoot, nItems ? ppszItems : NULL, (int)nItems) ||
+        (bCompare && !VerifyListScan(&local, szLocal, NULL, 0)))
+        goto cleanup;
+    if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+    {
+        bCancelled = TRUE;
+        goto report;
+    }
+
+    /* Hash everything, or only pairs a hash can tell apart (same size) */
+    ppHash = malloc((remote.nFiles ? remote.nFiles : 1) * sizeof(VerifyFile *));
+    ppLocal = malloc((remote.nFiles ? remote.nFiles : 1) * sizeof(VerifyFile *));
+    if (!ppHash || !ppLocal)
+        goto cleanup;
+    for (i = 0, j = 0; i < remote.nFiles; i++)
+    {
+        if (bCompare)
+        {
+            int cmp = 1;
+            while (j < local.nFiles && (cmp = strcmp(local.pFiles[j].pszName, remote.pFiles[i].pszName)) < 0)
+                j++;
+            if (cmp != 0 || local.pFiles[j].size != remote.pFiles[i].size)
+                continue;
+            ppLocal[nHash] = &local.pFiles[j];
+            cbLocalTotal += local.pFiles[j].size;
+        }
+        ppHash[nHash++] = &remote.pFiles[i];
+        cbRemoteTotal += remote.pFiles[i].size;
+    }
+
+    if (nHash == 0)
+        goto report;
+
+    /* Split over the channels, largest files first */
+    nChannels = HashChannelCount(nHash, cbRemoteTotal);
+    pSizes = malloc(nHash * sizeof(unsigned long long));
+    pChannelOf = malloc(nHash * sizeof(int));
+    pChannels = calloc(nChannels, sizeof(HashChannel));
+    if (!pSizes || !pChannelOf || !pChannels)
+        goto cleanup;
+    for (i = 0; i < nHash; i++)
+        pSizes[i] = ppHash[i]->size;
+    if (!HashSchedule(pSizes, nHash, nChannels, pChannelOf, NULL))
+        goto cleanup;
+
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+    cbCmd = RemoteBuildHashCommand(pszRemote, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW)
+        goto cleanup;
+    RemoteBuildHashCommand(pszRemote, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    hErr = CreateScratchFile();
+    if (hErr == INVALID_HANDLE_VALUE)
+        goto cleanup;
+
+    for (c = 0; c < nChannels; c++)
+    {
+        HashChannel *pc = &pChannels[c];
+        ReportWriter list = {INVALID_HANDLE_VALUE, pBuffer, 0, FALSE};
+        LARGE_INTEGER liZero = {0};
+        HANDLE hOutWrite = NULL;
+        BOOL bStarted;
+
+        pc->bDone = TRUE;
+        pc->hList = CreateScratchFile();
+        if (pc->hList == INVALID_HANDLE_VALUE)
+            continue;
+
+        /* "./name\0" for each file of this channel */
+        list.hFile = pc->hList;
+        for (i = 0; i < nHash; i++)
+        {
+            if (pChannelOf[i] != c)
+                continue;
+            ReportPut(&list, "./", 2);
+            ReportPut(&list, ppHash[i]->pszName, strlen(ppHash[i]->pszName) + 1);
+        }
+        ReportFlush(&list);
+        if (list.bFailed || !SetFilePointerEx(pc->hList, liZero, NULL, FILE_BEGIN) ||
+            !CreateSSHPipe(&pc->hOutRead, &hOutWrite, FALSE, HASH_PIPE_SIZE))
+            continue;
+
+        /* A broker token is good for one ssh, so each channel gets its own */
+        bStarted = SpawnSSH(pszCmdLine, pc->hList, hOutWrite, hErr, CREATE_NO_WINDOW,
+            szAskpassPath, bHasPassword ? szPassword : NULL, &pc->pi);
+        CloseHandle(hOutWrite);
+        if (bStarted)
+        {
+            pc->bDone = FALSE;
+            nStarted++;
+        }
+    }
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+
+    if (nStarted == 0)
+    {
+        WCHAR szError[512];
+        StringCchPrintfW(szError, 512, L"Failed to start ssh.exe.\nError code: %lu", GetLastError());
+        MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    /* The local copy is read while the server works */
+    if (bCompare)
+        pHasher = LocalHasherStart(szLocal, ppLocal, nHash);
+
+    msStart = GetTickCount64();
+    for (;;)
+    {
+        BOOL bActive = FALSE, bAllDone = TRUE;
+        ULONGLONG msNow;
+
+        for (c = 0; c < nChannels; c++)
+        {
+            bActive |= PollHashChannel(&pChannels[c], pBuffer, &remote, &cbRemoteDone);
+            bAllDone &= pChannels[c].bDone;
+        }
+        if (bAllDone && (!pHasher || LocalHasherWait(pHasher, 0)))
+            break;
+
+        msNow = GetTickCount64();
+        if (pDlg && msNow - msLastUpdate >= 250)
+        {
+            unsigned long long cbLocalDone = pHasher ? LocalHasherGetProgress(pHasher) : 0;
+            double seconds = (double)(msNow - msStart + 1) / 1000.0;
+
+            msLastUpdate = msNow;
+            if (IProgressDialog_HasUserCancelled(pDlg))
+            {
+                bCancelled = TRUE;
+                break;
+            }
+            IProgressDialog_SetProgress64(pDlg, cbRemoteDone + cbLocalDone, cbRemoteTotal + cbLocalTotal);
+            if (bCompare)
+                StringCchPrintfW(szLine, MAX_PATH * 2,
+                    L"Server: %.1f of %.1f MB (%.1f MB/s), local: %.1f MB (%.1f MB/s)",
+                    cbRemoteDone / 1048576.0, cbRemoteTotal / 1048576.0, cbRemoteDone / 1048576.0 / seconds,
+                    cbLocalDone / 1048576.0, cbLocalDone / 1048576.0 / seconds);
+            else
+                StringCchPrintfW(szLine, MAX_PATH * 2,
+                    L"%.1f of %.1f MB on %d connection%s (%.1f MB/s)",
+                    cbRemoteDone / 1048576.0, cbRemoteTotal / 1048576.0, nStarted,
+                    nStarted == 1 ? L"" : L"s", cbRemoteDone / 1048576.0 / seconds);
+            IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+        }
+
+        if (!bActive)
+        {
+            if (pHasher)
+                LocalHasherWait(pHasher, 10);
+            else
+                Sleep(10);
+        }
+    }
+
+    for (c = 0; c < nChannels; c++)
+    {
+        if (!pChannels[c].pi.hProcess)
+            continue;
+        if (bCancelled)
+            TerminateProcess(pChannels[c].pi.hProcess, 1);
+        WaitForSingleObject(pChannels[c].pi.hProcess, INFINITE);
+        CloseHandle(pChannels[c].pi.hProcess);
+        CloseHandle(pChannels[c].pi.hThread);
+        pChannels[c].pi.hProcess = NULL;
+    }
+    if (pHasher)
+    {
+        if (bCancelled)
+            LocalHasherCancel(pHasher);
+        LocalHasherFinish(pHasher);
+        pHasher = NULL;
+    }
+
+report:
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+        pDlg = NULL;
+    }
+    if (bCancelled)
+        goto cleanup;
+
+    szErrors[0] = L'\0';
+    if (hErr != INVALID_HANDLE_VALUE)
+        ReadErrorTail(hErr, szErrors, 1024);
+
+    if (!bCompare)
+    {
+        ReportWriter w = {INVALID_HANDLE_VALUE, pBuffer, 0, FALSE};
+        unsigned long nHashed = 0;
+        char szHex[HASH_HEX_LEN + 1];
+
+        for (i = 0; i < remote.nFiles; i++)
+            nHashed += remote.pFiles[i].bHashed ? 1 : 0;
+        if (nHashed == 0)
+        {
+            WCHAR szError[2048];
+            StringCchPrintfW(szError, 2048, L"No files could be hashed on the server.\n\n%s%s%s",
+                remote.szFirstError, remote.szFirstError[0] ? L"\n" : L"", szErrors);
+            MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONERROR);
+            goto cleanup;
+        }
+
+        /* sha256sum format, so "sha256sum -c" can check it on the server later */
+        GetTempPathW(MAX_PATH, szReport);
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"SHA256SUMS-%s.txt", szName);
+        if (!PathAppendW(szReport, szLine))
+            goto cleanup;
+        w.hFile = CreateFileW(szReport, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL);
+        if (w.hFile == INVALID_HANDLE_VALUE)
+            goto cleanup;
+        for (i = 0; i < remote.nFiles; i++)
+        {
+            if (!remote.pFiles[i].bHashed)
+                continue;
+            HashToHex(remote.pFiles[i].digest, szHex);
+            ReportPutStr(&w, szHex);
+            ReportPutStr(&w, "  ");
+            ReportPutStr(&w, remote.pFiles[i].pszName);
+            ReportPutStr(&w, "\n");
+        }
+        ReportFlush(&w);
+        CloseHandle(w.hFile);
+
+        if (nHashed < remote.nFiles || remote.nErrors > 0)
+        {
+            WCHAR szError[2048];
+            StringCchPrintfW(szError, 2048,
+                L"Hashed %lu of %lu files. The others could not be read on the server.\n\n%s%s%s",
+                nHashed, (unsigned long)remote.nFiles, remote.szFirstError, remote.szFirstError[0] ? L"\n" : L"", szErrors);
+            MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONWARNING);
+        }
+        ShellExecuteW(NULL, L"open", szReport, NULL, NULL, SW_SHOWNORMAL);
+        result = nHashed < remote.nFiles ? 1 : 0;
+    }
+    else
+    {
+        ReportWriter w = {INVALID_HANDLE_VALUE, pBuffer, 0, FALSE};
+        unsigned long nDiffer = 0, nOnlyRemote = 0, nOnlyLocal = 0, nFailed = 0, nSame = 0;
+        size_t nReport = remote.nFiles + local.nFiles;
+        VerifyFile **ppDiffer, **ppOnlyRemote, **ppOnlyLocal, **ppFailed;
+        char szHeader[MAX_PATH * 3 * 2 + 64];
+
+        /* One merge over both sorted lists sorts every file into its section */
+        ppReport = malloc((nReport ? nReport : 1) * 4 * sizeof(VerifyFile *));
+        if (!ppReport)
+            goto cleanup;
+        ppDiffer = ppReport;
+        ppOnlyRemote = ppDiffer + nReport;
+        ppOnlyLocal = ppOnlyRemote + nReport;
+        ppFailed = ppOnlyLocal + nReport;
+        for (i = 0, j = 0; i < remote.nFiles || j < local.nFiles; )
+        {
+            int cmp = i == remote.nFiles ? 1 : j == local.nFiles ? -1 :
+                strcmp(remote.pFiles[i].pszName, local.pFiles[j].pszName);
+
+            if (cmp < 0)
+            {
+                ppOnlyRemote[nOnlyRemote++] = &remote.pFiles[i++];
+            }
+            else if (cmp > 0)
+            {
+                ppOnlyLocal[nOnlyLocal++] = &local.pFiles[j++];
+            }
+            else
+            {
+                VerifyFile *r = &remote.pFiles[i++], *l = &local.pFiles[j++];
+
+                if (r->size != l->size)
+                    ppDiffer[nDiffer++] = r;
+                else if (!r->bHashed || !l->bHashed)
+                    ppFailed[nFailed++] = r;
+                else if (memcmp(r->digest, l->digest, HASH_SIZE) != 0)
+                    ppDiffer[nDiffer++] = r;
+                else
+                    nSame++;
+            }
+        }
+
+        if (nDiffer + nOnlyRemote + nOnlyLocal + nFailed == 0 && remote.nErrors + local.nErrors == 0)
+        {
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"All %lu files are identical in\n\n%s\n%s",
+                nSame, ppszPaths[0], szLocal);
+            MessageBoxW(NULL, szLine, pszTitle, MB_OK | MB_ICONINFORMATION);
+            result = 0;
+            goto cleanup;
+        }
+
+        GetTempPathW(MAX_PATH, szReport);
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"sshfs-compare-%s.txt", szName);
+        if (!PathAppendW(szReport, szLine))
+            goto cleanup;
+        w.hFile = CreateFileW(szReport, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL);
+        if (w.hFile == INVALID_HANDLE_VALUE)
+            goto cleanup;
+
+        WideCharToMultiByte(CP_UTF8, 0, ppszPaths[0], -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+        StringCchPrintfA(szHeader, sizeof(szHeader), "Compared %s\r\n    with ", pszRemote);
+        ReportPutStr(&w, szHeader);
+        WideCharToMultiByte(CP_UTF8, 0, szLocal, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+        StringCchPrintfA(szHeader, sizeof(szHeader), "%s\r\n\r\n%lu identical, %lu different, %lu only on the server, "
+            "%lu only in the local folder\r\n\r\n", pszRemote, nSame, nDiffer, nOnlyRemote, nOnlyLocal);
+        ReportPutStr(&w, szHeader);
+        ReportPutSection(&w, "Different", ppDiffer, nDiffer);
+        ReportPutSection(&w, "Only on the server", ppOnlyRemote, nOnlyRemote);
+        ReportPutSection(&w, "Only in the local folder", ppOnlyLocal, nOnlyLocal);
+        ReportPutSection(&w, "Could not be hashed", ppFailed, nFailed);
+        if (remote.nErrors + local.nErrors > 0 || szErrors[0])
+        {
+            WideCharToMultiByte(CP_UTF8, 0, remote.szFirstError[0] ? remote.szFirstError : local.szFirstError,
+                -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+            StringCchPrintfA(szHeader, sizeof(szHeader), "%lu folders could not be listed. %s\r\n",
+                remote.nErrors + local.nErrors, pszRemote);
+            ReportPutStr(&w, szHeader);
+            WideCharToMultiByte(CP_UTF8, 0, szErrors, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+            ReportPutStr(&w, pszRemote);
+        }
+        ReportFlush(&w);
+        CloseHandle(w.hFile);
+
+        ShellExecuteW(NULL, L"open", szReport, NULL, NULL, SW_SHOWNORMAL);
+        result = 1;
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+    }
+    if (pHasher)
+    {
+        LocalHasherCancel(pHasher);
+        LocalHasherFinish(pHasher);
+    }
+    for (c = 0; pChannels && c < nChannels; c++)
+    {
+        if (pChannels[c].pi.hProcess)
+        {
+            TerminateProcess(pChannels[c].pi.hProcess, 1);
+            CloseHandle(pChannels[c].pi.hProcess);
+            CloseHandle(pChannels[c].pi.hThread);
+        }
+        if (pChannels[c].hList && pChannels[c].hList != INVALID_HANDLE_VALUE)
+            CloseHandle(pChannels[c].hList);
+        if (pChannels[c].hOutRead)
+            CloseHandle(pChannels[c].hOutRead);
+    }
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    if (bCoInit)
+        CoUninitialize();
+    VerifyListFree(&remote);
+    VerifyListFree(&local);
+    free(ppHash);
+    free(ppLocal);
+    free(ppReport);
+    free(pSizes);
+    free(pChannelOf);
+    free(pChannels);
+    free(ppszItems);
+    free(pLoc);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    free(pBuffer);
+    return result;
+}
@@ -0,0 +1,1141 @@
+/**
+ * sshfs-ssh-launcher-posix.c
+ *
+ * POSIX (Linux) counterpart of sshfs-ssh-launcher.c for desktops that mount
+ * the same servers with sshfs. Runs ssh on a pty from forkpty() and relays
+ * it to the calling terminal with an epoll loop. SIGWINCH is delivered
+ * through a signalfd and propagated to the pty. Keystrokes go through the
+ * sshfs-input.c pipeline and are written to the non-blocking master as it
+ * drains, so large pastes never stall the relay.
+ *
+ * Usage: sshfs-ssh-launcher [options] user@host[:port] pipe_fd ["remote_command"]
+ *
+ * Options are the same as the Windows launcher:
+ *   --predict     Predictive local echo for high-latency links (sshfs-predict.c)
+ *   --stats       Live RTT and throughput in the terminal title (sshfs-stats.c),
+ *                 with a JSON snapshot in $XDG_RUNTIME_DIR (or /tmp)
+ *                 as sshfs-ssh-stats-<pid>.json
+ *   --stats-file <path>
+ *                 Write the snapshot to path instead (implies --stats)
+ *   --record      Save the session's output as a gzipped asciicast in
+ *                 $XDG_STATE_HOME/sshfs-ssh (or ~/.local/state/sshfs-ssh)
+ *   --record-file <path>
+ *                 Record to path instead (implies --record)
+ *   --record-block <ms>
+ *                 Wait up to ms for the recorder instead of sampling when it
+ *                 falls behind (implies --record)
+ *   --cwd-map <local_root> <remote_root> <remote_start>
+ *                 Follow the shell's directory reports (OSC 7, OSC 9;9) and
+ *                 map them onto the mount at local_root (sshfs-cwd.c): the
+ *                 local path is kept in $XDG_RUNTIME_DIR (or /tmp) as
+ *                 sshfs-ssh-cwd-<pid> and passed on to the terminal as OSC 7
+ *   --reconnect <remote_dir>
+ *                 Resilient session (sshfs-reconnect.c): start the shell in
+ *                 remote_dir instead of running remote_command, and when the
+ *                 connection is lost start ssh again, with backoff, in the
+ *                 last directory the shell reported
+ *   --attach <session> <idle_hours>
+ *                 With --reconnect: each attempt reattaches to the tmux or
+ *                 screen session instead of starting a shell
+ *                 (RemoteBuildAttachCommand(), sshfs-remote.c)
+ *
+ * Password is read from the inherited pipe_fd (not command line) for
+ * security. Pass 0 for no password. Prompt detection is shared with the
+ * Windows launcher via sshfs-relay.c. Under --reconnect the password is
+ * kept until the session ends, to answer the prompt of each new attempt.
+ *
+ * Compile with: gcc -O2 -o sshfs-ssh-launcher sshfs-ssh-launcher-posix.c sshfs-relay.c sshfs-predict.c \
+ *     sshfs-input.c sshfs-stats.c sshfs-record.c sshfs-gzip.c sshfs-cwd.c sshfs-path.c \
+ *     sshfs-reconnect.c sshfs-remote.c -lutil -lpthread
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include "sshfs-relay.h"
+#include "sshfs-predict.h"
+#include "sshfs-input.h"
+#include "sshfs-stats.h"
+#include "sshfs-record.h"
+#include "sshfs-cwd.h"
+#include "sshfs-reconnect.h"
+#include "sshfs-remote.h"
+
+#define BUFFER_SIZE 4096
+#define SPLICE_CHUNK 65536
+
+/* Relay state */
+static int g_masterFd = -1;
+static int g_bSplice = 0;           /* stdout is a pipe: try zero-copy splice */
+static struct termios g_origTermios;
+static int g_bRawMode = 0;
+static int g_bPredict = 0;
+static PredictEngine g_predict;
+
+/* Input stage: queued keystrokes and the chunk currently being written */
+static InputPipeline g_input;
+static char g_inflight[INPUT_CHUNK_SIZE];
+static size_t g_cbInflight = 0;
+static size_t g_offInflight = 0;
+static int g_bInputPaused = 0;
+static const char *g_pszTarget = "";
+
+/* Live stats: NULL unless --stats, so the byte path only tests the pointer */
+static SessionStats g_stats;
+static SessionStats *g_pStats = NULL;
+static char g_szStatsFile[512];
+
+/* Recording: NULL unless --record; RecordThread does the writing */
+static RecordQueue g_record;
+static RecordQueue *g_pRecord = NULL;
+static RecordWriter g_recordWriter;
+static RecordPolicy g_recordPolicy = RECORD_SAMPLE;
+static unsigned long g_recordBlockMs = 0;
+static char g_szRecordFile[4096];
+static int g_recordFd = -1;
+static int g_recordWakeFd = -1;
+static volatile int g_bRecordStop = 0;
+
+/* Directory reports: scanned for --cwd-map and --reconnect, NULL otherwise */
+static CwdScanner g_cwdScanner;
+static CwdScanner *g_pCwd = NULL;
+static int g_bCwdMap = 0;
+static CwdMap g_cwdMap;
+static char g_szCwdFile[512];
+static char g_szLocalCwd[CWD_MAX];
+static char g_szHostname[256];
+
+/* Resilient session: unless --reconnect, ssh runs once */
+static int g_bReconnect = 0;
+static Reconnect g_reconnect;
+static const char *g_pszReconnectDir = "~";
+
+#define ATTACH_MAX 2048     /* RemoteBuildAttachCommand() */
+static char g_szAttach[ATTACH_MAX];
+
+/**
+ * Write the whole buffer, retrying on short writes and EINTR
+ */
+static int WriteAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static unsigned long long NowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+static void WakeRecorder(void)
+{
+    unsigned long long one = 1;
+
+    if (write(g_recordWakeFd, &one, sizeof(one)) < 0)
+        return;     /* Counter saturated: the writer is awake anyway */
+}
+
+/**
+ * Queue output for the recorder once it is on the terminal. Under
+ * --record-block wait for room up to the limit, otherwise never wait.
+ */
+static void RecordOutput(const char *buffer, size_t cb, unsigned long long msRead)
+{
+    unsigned long long msDeadline = NowMs() + g_recordBlockMs;
+    struct timespec pause = {0, 1000000};
+    int bWake;
+
+    while (RecordOffer(g_pRecord, buffer, cb, msRead, &bWake) == RECORD_FULL)
+    {
+        WakeRecorder();
+        if (NowMs() >= msDeadline)
+        {
+            RecordDrop(g_pRecord, cb);
+            return;
+        }
+        nanosleep(&pause, NULL);
+    }
+    if (bWake)
+        WakeRecorder();
+}
+
+static int WriteRecording(const void *data, size_t cb, void *pContext)
+{
+    (void)pContext;
+    return WriteAll(g_recordFd, (const char *)data, cb);
+}
+
+/**
+ * Thread: Compress queued output into the recording, each second or sooner
+ * when the queue fills up, until told to stop
+ */
+static void *RecordThread(void *param)
+{
+    struct pollfd pfd;
+    unsigned long long count;
+    int bStop;
+
+    (void)param;
+    pfd.fd = g_recordWakeFd;
+    pfd.events = POLLIN;
+
+    do
+    {
+        if (poll(&pfd, 1, RECORD_BATCH_MS) > 0 && read(g_recordWakeFd, &count, sizeof(count)) < 0)
+            count = 0;
+        bStop = __atomic_load_n(&g_bRecordStop, __ATOMIC_ACQUIRE);
+        RecordWriterPump(&g_recordWriter, g_pRecord, NowMs(), bStop);
+    } while (!bStop);
+    return NULL;
+}
+
+/**
+ * Open the recording and start its writer. The default file is per session:
+ * $XDG_STATE_HOME/sshfs-ssh/<target>-<date>-<time>-<pid>.cast.gz
+ */
+static int StartRecording(const char *pszTarget, pthread_t *pThread)
+{
+    char szDir[512];
+    char szTitle[600];
+    char szStamp[32];
+    const char *pszState = getenv("XDG_STATE_HOME");
+    const char *pszHome = getenv("HOME");
+    struct winsize ws;
+    time_t now = time(NULL);
+    int cols = 80, rows = 24;
+
+    if (!g_szRecordFile[0])
+    {
+        if (pszState && pszState[0])
+            snprintf(szDir, sizeof(szDir), "%s", pszState);
+        else if (pszHome && pszHome[0])
+        {
+            snprintf(szDir, sizeof(szDir), "%s/.local", pszHome);
+            mkdir(szDir, 0700);
+            snprintf(szDir, sizeof(szDir), "%s/.local/state", pszHome);
+        }
+        else
+            return 0;
+        mkdir(szDir, 0700);
+        strncat(szDir, "/sshfs-ssh", sizeof(szDir) - strlen(szDir) - 1);
+        mkdir(szDir, 0700);
+
+        strftime(szStamp, sizeof(szStamp), "%Y%m%d-%H%M%S", localtime(&now));
+        snprintf(g_szRecordFile, sizeof(g_szRecordFile), "%s/%s-%s-%d.cast.gz",
+            szDir, pszTarget, szStamp, (int)getpid());
+    }
+
+    /* Recordings hold whatever was on screen: owner only */
+    g_recordFd = open(g_szRecordFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (g_recordFd < 0)
+        return 0;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col && ws.ws_row)
+    {
+        cols = ws.ws_col;
+        rows = ws.ws_row;
+    }
+    snprintf(szTitle, sizeof(szTitle), "SSH: %s", pszTarget);
+
+    if (!RecordQueueInit(&g_record, g_recordPolicy))
+        goto cleanup;
+    if (!RecordWriterInit(&g_recordWriter, WriteRecording, NULL, cols, rows,
+            (long long)now, szTitle, NowMs()))
+    {
+        RecordQueueFree(&g_record);
+        goto cleanup;
+    }
+
+    g_recordWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (g_recordWakeFd < 0 || pthread_create(pThread, NULL, RecordThread, NULL) != 0)
+    {
+        if (g_recordWakeFd >= 0)
+            close(g_recordWakeFd);
+        RecordWriterFree(&g_recordWriter);
+        RecordQueueFree(&g_record);
+        goto cleanup;
+    }
+    return 1;
+
+cleanup:
+    close(g_recordFd);
+    unlink(g_szRecordFile);
+    return 0;
+}
+
+/**
+ * Write what is still queued and close the recording (the relay loop has
+ * stopped offering)
+ */
+static void StopRecording(pthread_t thread)
+{
+    __atomic_store_n(&g_bRecordStop, 1, __ATOMIC_RELEASE);
+    WakeRecorder();
+    pthread_join(thread, NULL);
+    close(g_recordWakeFd);
+    close(g_recordFd);
+
+    if (g_recordWriter.bError)
+        fprintf(stderr, "\r\nRecording incomplete (write failed): %s\r\n", g_szRecordFile);
+    RecordWriterFree(&g_recordWriter);
+    RecordQueueFree(&g_record);
+}
+
+/**
+ * Put the controlling terminal into raw mode (ssh's pty does line editing)
+ */
+static void EnterRawMode(void)
+{
+    struct termios raw;
+
+    if (g_bRawMode || !isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &g_origTermios) != 0)
+        return;
+
+    raw = g_origTermios;
+    cfmakeraw(&raw);
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0)
+        g_bRawMode = 1;
+}
+
+static void RestoreMode(void)
+{
+    if (g_bRawMode)
+    {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_origTermios);
+        g_bRawMode = 0;
+    }
+}
+
+/**
+ * Copy the terminal size onto the pty (initial size and on SIGWINCH)
+ */
+static void PropagateWindowSize(void)
+{
+    struct winsize ws;
+
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0)
+    {
+        ioctl(g_masterFd, TIOCSWINSZ, &ws);
+        if (g_bPredict && ws.ws_col)
+            PredictResize(&g_predict, ws.ws_col);
+    }
+}
+
+/**
+ * The shell reported a directory (g_cwdScanner.szCwd): keep its local path
+ * in the cwd file, replaced atomically like the stats file, and return
+ * OSC 7 with it for the terminal (0 if it is not on the mount)
+ */
+static size_t UpdateCwd(char *pszOsc, size_t cchOsc)
+{
+    char szLocal[CWD_MAX];
+    char szTempFile[600];
+    int bMapped = CwdMapToLocal(&g_cwdMap, g_cwdScanner.szCwd, szLocal, sizeof(szLocal));
+    int fd;
+
+    if (!bMapped)
+        szLocal[0] = '\0';
+
+    if (strcmp(szLocal, g_szLocalCwd) != 0)
+    {
+        snprintf(g_szLocalCwd, sizeof(g_szLocalCwd), "%s", szLocal);
+        snprintf(szTempFile, sizeof(szTempFile), "%s.tmp", g_szCwdFile);
+        fd = open(szTempFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd >= 0)
+        {
+            int bOk = WriteAll(fd, szLocal, strlen(szLocal));
+            close(fd);
+            if (bOk)
+                rename(szTempFile, g_szCwdFile);
+        }
+    }
+
+    return bMapped ? CwdFormatOsc7(g_szHostname, szLocal, pszOsc, cchOsc) : 0;
+}
+
+/**
+ * The shell reported a directory: what goes to the terminal right after
+ * the report. That is the local directory as OSC 7 under --cwd-map and,
+ * if this report ends an outage, the reconnect notice.
+ */
+static size_t OnDirectoryReport(char *pszOut, size_t cchOut)
+{
+    size_t cb = g_bCwdMap ? UpdateCwd(pszOut, cchOut) : 0;
+    unsigned long long now = NowMs();
+
+    if (g_bReconnect && ReconnectUp(&g_reconnect, now))
+        cb += ReconnectFormatUp(&g_reconnect, now, pszOut + cb, cchOut - cb);
+    return cb < cchOut ? cb : 0;
+}
+
+/**
+ * Write server output to stdout. cbReport is where a directory report ends
+ * in it (0 if none): the local directory goes in right there, between two
+ * sequences, so it is the last one the terminal sees.
+ */
+static int WriteServerOutput(const char *buffer, size_t cb, size_t cbReport)
+{
+    char szInsert[CWD_MAX * 3 + 300];
+    size_t cbInsert;
+
+    if (cbReport && (cbInsert = OnDirectoryReport(szInsert, sizeof(szInsert))) != 0)
+    {
+        if (!WriteAll(STDOUT_FILENO, buffer, cbReport) || !WriteAll(STDOUT_FILENO, szInsert, cbInsert))
+            return 0;
+        buffer += cbReport;
+        cb -= cbReport;
+    }
+    return WriteAll(STDOUT_FILENO, buffer, cb);
+}
+
+/**
+ * Relay one batch of pty output to stdout.
+ * Returns 0 once the pty has closed (child exited).
+ */
+static int RelayOutput(void)
+{
+    char buffer[BUFFER_SIZE];
+    unsigned long long msRead;
+    ssize_t n;
+
+    /* Zero-copy path: pty -> pipe without bouncing through user space */
+    if (g_bSplice)
+    {
+        n = splice(g_masterFd, NULL, STDOUT_FILENO, NULL, SPLICE_CHUNK, SPLICE_F_MOVE);
+        if (n > 0)
+        {
+            if (g_pStats)
+                StatsOnReceived(g_pStats, (size_t)n, NowMs());
+            return 1;
+        }
+        if (n == 0)
+            return 0;
+        if (errno == EINTR || errno == EAGAIN)
+            return 1;
+        if (errno == EIO)
+            return 0;
+        /* Kernel cannot splice from a tty: fall back to read/write for good */
+        g_bSplice = 0;
+    }
+
+    n = read(g_masterFd, buffer, sizeof(buffer));
+    if (n > 0)
+    {
+        size_t cbReport = g_pCwd ? CwdScan(g_pCwd, buffer, (size_t)n) : 0;
+        int bOk;
+
+        msRead = NowMs();
+        if (g_pStats)
+            StatsOnReceived(g_pStats, (size_t)n, msRead);
+        if (g_bPredict)
+        {
+            PredictFrame frame;
+            PredictOutput(&g_predict, buffer, (size_t)n, &frame);
+            bOk = WriteAll(STDOUT_FILENO, frame.prefix, frame.cbPrefix) &&
+                WriteServerOutput(buffer, (size_t)n, cbReport) &&
+                WriteAll(STDOUT_FILENO, frame.suffix, frame.cbSuffix);
+        }
+        else
+            bOk = WriteServerOutput(buffer, (size_t)n, cbReport);
+
+        if (g_pRecord)
+            RecordOutput(buffer, (size_t)n, msRead);
+        return bOk;
+    }
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return 1;
+
+    /* EIO on the master means the slave side has been closed */
+    return 0;
+}
+
+/**
+ * Write queued input to the master until it would block.
+ * Chunks are finished before the next one (or an interrupt) starts, so an
+ * escape sequence is never split by a partial write.
+ */
+static void FlushInput(void)
+{
+    InputPasteStats stats;
+
+    for (;;)
+    {
+        ssize_t n;
+
+        if (g_offInflight == g_cbInflight)
+        {
+            g_offInflight = 0;
+            g_cbInflight = InputPipelineTake(&g_input, g_inflight, sizeof(g_inflight), NowMs());
+            if (g_cbInflight == 0)
+                break;
+        }
+
+        n = write(g_masterFd, g_inflight + g_offInflight, g_cbInflight - g_offInflight);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+            {
+                /* pty is going away: nothing more will be read */
+                g_offInflight = g_cbInflight = 0;
+                InputPipelineFree(&g_input);
+                InputPipelineInit(&g_input);
+            }
+            break;
+        }
+        g_offInflight += (size_t)n;
+        if (g_pStats)
+            StatsOnSent(g_pStats, (size_t)n, NowMs());
+    }
+
+    /* Show how fast the last paste went through in the title */
+    if (InputPipelineTakePasteReport(&g_input, &stats) && isatty(STDOUT_FILENO))
+    {
+        char szReport[64];
+        char szTitle[640];
+        int cch;
+
+        InputFormatPasteReport(&stats, szReport, sizeof(szReport));
+        cch = snprintf(szTitle, sizeof(szTitle), "\033]0;SSH: %s | %s\007", g_pszTarget, szReport);
+        if (cch > 0 && (size_t)cch < sizeof(szTitle))
+            WriteAll(STDOUT_FILENO, szTitle, (size_t)cch);
+    }
+}
+
+/**
+ * Watch the master for writability while input is pending, and stop reading
+ * stdin above the high water mark so the terminal holds the rest of a paste
+ */
+static void UpdateInputEvents(int epfd)
+{
+    struct epoll_event ev;
+    size_t cbQueued = InputPipelineQueued(&g_input);
+
+    ev.events = EPOLLIN;
+    if (cbQueued > 0 || g_offInflight < g_cbInflight)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = g_masterFd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, g_masterFd, &ev);
+
+    if (!g_bInputPaused && cbQueued > INPUT_HIGH_WATER)
+        g_bInputPaused = 1;
+    else if (g_bInputPaused && cbQueued < INPUT_LOW_WATER)
+        g_bInputPaused = 0;
+    else
+        return;
+
+    ev.events = g_bInputPaused ? 0 : EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+}
+
+/**
+ * Publish a stats snapshot: summary in the title, JSON in the stats file.
+ * The file is replaced atomically so readers never see a partial write.
+ */
+static void ReportStats(StatsSampler *pSampler)
+{
+    StatsSnapshot snap;
+    char szSummary[96];
+    char szJson[1024];
+    char szTemp[520];
+    size_t cbJson;
+    int fd;
+
+    StatsSample(g_pStats, pSampler, NowMs(), &snap);
+
+    if (isatty(STDOUT_FILENO))
+    {
+        char szTitle[640];
+        int cch;
+
+        StatsFormatSummary(&snap, szSummary, sizeof(szSummary));
+        cch = snprintf(szTitle, sizeof(szTitle), "\033]0;SSH: %s | %s\007", g_pszTarget, szSummary);
+        if (cch > 0 && (size_t)cch < sizeof(szTitle))
+            WriteAll(STDOUT_FILENO, szTitle, (size_t)cch);
+    }
+
+    cbJson = StatsFormatJson(&snap, g_pszTarget, szJson, sizeof(szJson));
+    if (cbJson == 0 || (size_t)snprintf(szTemp, sizeof(szTemp), "%s.tmp", g_szStatsFile) >= sizeof(szTemp))
+        return;
+
+    fd = open(szTemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return;
+    if (WriteAll(fd, szJson, cbJson))
+        rename(szTemp, g_szStatsFile);
+    close(fd);
+}
+
+/**
+ * Relay pending ssh output until the password prompt appears, then send it.
+ * Mirrors the pre-thread prompt loop in the Windows launcher. A directory
+ * report means the login is done without a prompt (keys, agent).
+ */
+static void InjectPassword(const char *pszPassword, pid_t child)
+{
+    char buffer[BUFFER_SIZE];
+    char passLine[RELAY_MAX_PASSWORD + 2];
+    PromptMatcher promptMatcher;
+    ssize_t n;
+    size_t cbLine;
+    size_t cbReport;
+
+    PromptMatcherInit(&promptMatcher, "password:");
+
+    while ((n = read(g_masterFd, buffer, sizeof(buffer))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        cbReport = g_pCwd ? CwdScan(g_pCwd, buffer, (size_t)n) : 0;
+        WriteServerOutput(buffer, (size_t)n, cbReport);
+        if (cbReport)
+            break;
+
+        /* Check for password prompt (case-insensitive, may span reads) */
+        if (PromptMatcherFeed(&promptMatcher, buffer, (size_t)n))
+        {
+            cbLine = RelayFormatPasswordLine(pszPassword, passLine, sizeof(passLine));
+            WriteAll(g_masterFd, passLine, cbLine);
+            RelaySecureZero(passLine, sizeof(passLine));
+            break;
+        }
+
+        /* Check if SSH exited */
+        if (waitpid(child, NULL, WNOHANG) == child)
+            break;
+    }
+}
+
+/**
+ * Start ssh on a new pty (g_masterFd) the size of the terminal
+ */
+static pid_t StartSsh(char *const *sshArgv, const sigset_t *pSigs)
+{
+    struct winsize ws;
+    pid_t child;
+
+    child = forkpty(&g_masterFd, NULL, NULL,
+        ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0 ? &ws : NULL);
+    if (child == 0)
+    {
+        sigprocmask(SIG_UNBLOCK, pSigs, NULL);
+        execvp(sshArgv[0], sshArgv);
+        fprintf(stderr, "Could not run ssh: %s\n", strerror(errno));
+        _exit(127);
+    }
+    return child;
+}
+
+/**
+ * Drop input still queued for a session that has ended, so nothing typed
+ * into the dead one lands in the next one's password prompt
+ */
+static void ResetInput(int epfd)
+{
+    struct epoll_event ev;
+
+    InputPipelineFree(&g_input);
+    InputPipelineInit(&g_input);
+    g_cbInflight = g_offInflight = 0;
+    if (g_bInputPaused)
+    {
+        g_bInputPaused = 0;
+        ev.events = EPOLLIN;
+        ev.data.fd = STDIN_FILENO;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+    }
+}
+
+/**
+ * The connection was lost (g_reconnect is WAITING): say so and wait out
+ * the backoff. Enter retries at once, q / Ctrl+C / Ctrl+D give up, as does
+ * closing the terminal. Returns 1 to start the next attempt.
+ */
+static int WaitToReconnect(int epfd, int sigfd, int timerFd, StatsSampler *pSampler)
+{
+    struct epoll_event events[8];
+    char szMessage[256];
+    size_t cbMessage;
+    unsigned msWait;
+
+    cbMessage = ReconnectFormatLost(&g_reconnect, NowMs(), szMessage, sizeof(szMessage));
+    WriteAll(STDOUT_FILENO, szMessage, cbMessage);
+
+    while ((msWait = ReconnectDelay(&g_reconnect, NowMs())) != 0)
+    {
+        int nEvents = epoll_wait(epfd, events, 8, (int)msWait);
+
+        for (int i = 0; i < nEvents && g_reconnect.phase == RECONNECT_WAITING; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == STDIN_FILENO)
+            {
+                char buffer[BUFFER_SIZE];
+                ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+
+                for (ssize_t j = 0; j < n && g_reconnect.phase == RECONNECT_WAITING; j++)
+                    ReconnectOnKey(&g_reconnect, buffer[j], NowMs());
+                if (n == 0)
+                    g_reconnect.phase = RECONNECT_DONE;
+            }
+            else if (fd == sigfd)
+            {
+                struct signalfd_siginfo si;
+                if (read(sigfd, &si, sizeof(si)) == sizeof(si) &&
+                    (si.ssi_signo == SIGHUP || si.ssi_signo == SIGTERM))
+                    g_reconnect.phase = RECONNECT_DONE;
+            }
+            else if (fd == timerFd)
+            {
+                unsigned long long nExpirations;
+                if (read(timerFd, &nExpirations, sizeof(nExpirations)) == sizeof(nExpirations))
+                    ReportStats(pSampler);
+            }
+        }
+
+        if (g_reconnect.phase != RECONNECT_WAITING)
+        {
+            cbMessage = ReconnectFormatGiveUp(&g_reconnect, NowMs(), szMessage, sizeof(szMessage));
+            WriteAll(STDOUT_FILENO, szMessage, cbMessage);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char szTarget[512];
+    char szPassword[RELAY_MAX_PASSWORD + 1] = {0};
+    char szPort[16] = {0};
+    char szCommand[CWD_MAX * 4 + ATTACH_MAX];
+    char szResumeDir[CWD_MAX];
+    char szAliveOptions[3][32];
+    char *sshArgv[16];
+    int sshArgc = 0;
+    int iCommand = -1;
+    struct epoll_event ev, events[8];
+    StatsSampler sampler;
+    struct stat st;
+    sigset_t sigs;
+    int epfd, sigfd, timerFd = -1;
+    int status = 0, exitCode = 0;
+    int bRunning;
+    int bFirst = 1;
+    int argi = 1;
+    pid_t child;
+    pthread_t recordThread;
+
+    /* Parse options */
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0)
+    {
+        if (strcmp(argv[argi], "--predict") == 0)
+            g_bPredict = 1;
+        else if (strcmp(argv[argi], "--stats") == 0)
+            g_pStats = &g_stats;
+        else if (strcmp(argv[argi], "--stats-file") == 0 && argi + 1 < argc)
+        {
+            g_pStats = &g_stats;
+            snprintf(g_szStatsFile, sizeof(g_szStatsFile), "%s", argv[++argi]);
+        }
+        else if (strcmp(argv[argi], "--record") == 0)
+            g_pRecord = &g_record;
+        else if (strcmp(argv[argi], "--record-file") == 0 && argi + 1 < argc)
+        {
+            g_pRecord = &g_record;
+            snprintf(g_szRecordFile, sizeof(g_szRecordFile), "%s", argv[++argi]);
+        }
+        else if (strcmp(argv[argi], "--record-block") == 0 && argi + 1 < argc)
+        {
+            g_pRecord = &g_record;
+            g_recordPolicy = RECORD_BLOCK;
+            g_recordBlockMs = strtoul(argv[++argi], NULL, 10);
+        }
+        else if (strcmp(argv[argi], "--cwd-map") == 0 && argi + 3 < argc)
+        {
+            CwdMapInit(&g_cwdMap, argv[argi + 1], argv[argi + 2], argv[argi + 3], '/');
+            g_bCwdMap = 1;
+            g_pCwd = &g_cwdScanner;
+            argi += 3;
+        }
+        else if (strcmp(argv[argi], "--reconnect") == 0 && argi + 1 < argc)
+        {
+            g_bReconnect = 1;
+            g_pszReconnectDir = argv[++argi];
+            g_pCwd = &g_cwdScanner;
+        }
+        else if (strcmp(argv[argi], "--attach") == 0 && argi + 2 < argc)
+        {
+            if (RemoteBuildAttachCommand(argv[argi + 1], atoi(argv[argi + 2]),
+                g_szAttach, sizeof(g_szAttach)) >= sizeof(g_szAttach))
+                g_szAttach[0] = '\0';
+            argi += 2;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[argi]);
+            return 1;
+        }
+        argi++;
+    }
+
+    if (argc - argi < 2)
+    {
+        fprintf(stderr, "Usage: %s [--predict] [--stats] [--stats-file path] [--record] [--record-file path] [--record-block ms] [--cwd-map local_root remote_root remote_start] [--reconnect remote_dir] [--attach session idle_hours] user@host[:port] pipe_fd [\"remote_command\"]\n", argv[0]);
+        return 1;
+    }
+
+    snprintf(szTarget, sizeof(szTarget), "%s", argv[argi]);
+    g_pszTarget = szTarget;
+    if (g_pCwd)
+        CwdScanInit(g_pCwd);
+    snprintf(szResumeDir, sizeof(szResumeDir), "%s", g_pszReconnectDir);
+    ReconnectInit(&g_reconnect, (unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 32));
+
+    /* Read password from inherited pipe (secure - not visible in process list) */
+    {
+        int passFd = atoi(argv[argi + 1]);
+        if (passFd > 0)
+        {
+            size_t cbPassword = 0;
+            ssize_t n;
+
+            /* All of it, up to the writer closing its end */
+            while (cbPassword < sizeof(szPassword))
+            {
+                n = read(passFd, szPassword + cbPassword, sizeof(szPassword) - cbPassword);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    break;
+                cbPassword += (size_t)n;
+            }
+            close(passFd);
+            if (cbPassword > RELAY_MAX_PASSWORD)
+            {
+                RelaySecureZero(szPassword, sizeof(szPassword));
+                fprintf(stderr, "The password is longer than %d bytes\n", RELAY_MAX_PASSWORD);
+                return 1;
+            }
+            szPassword[cbPassword] = '\0';
+        }
+    }
+
+    /* Check for port in target (user@host:port format) */
+    {
+        char *pColon = strrchr(szTarget, ':');
+        char *pAt = strchr(szTarget, '@');
+        if (pColon && pColon > pAt)
+        {
+            *pColon = '\0';
+            snprintf(szPort, sizeof(szPort), "%s", pColon + 1);
+        }
+    }
+
+    /* Set terminal title */
+    if (isatty(STDOUT_FILENO))
+    {
+        printf("\033]0;SSH: %s\007", szTarget);
+        fflush(stdout);
+    }
+
+    /* Default stats file is per process so several sessions can be queried */
+    if (g_pStats && !g_szStatsFile[0])
+    {
+        const char *pszDir = getenv("XDG_RUNTIME_DIR");
+        snprintf(g_szStatsFile, sizeof(g_szStatsFile), "%s/sshfs-ssh-stats-%d.json",
+            pszDir && pszDir[0] ? pszDir : "/tmp", (int)getpid());
+    }
+
+    if (g_bCwdMap)
+    {
+        const char *pszDir = getenv("XDG_RUNTIME_DIR");
+        snprintf(g_szCwdFile, sizeof(g_szCwdFile), "%s/sshfs-ssh-cwd-%d",
+            pszDir && pszDir[0] ? pszDir : "/tmp", (int)getpid());
+        if (gethostname(g_szHostname, sizeof(g_szHostname)) != 0)
+            g_szHostname[0] = '\0';
+    }
+
+    /* Build SSH argument vector */
+    sshArgv[sshArgc++] = "ssh";
+    if (szPort[0])
+    {
+        sshArgv[sshArgc++] = "-p";
+        sshArgv[sshArgc++] = szPort;
+    }
+    if (g_bReconnect)
+    {
+        /* Notice a dead link within ~30 s instead of waiting on TCP */
+        snprintf(szAliveOptions[0], sizeof(szAliveOptions[0]), "ServerAliveInterval=%d", RECONNECT_ALIVE_INTERVAL);
+        snprintf(szAliveOptions[1], sizeof(szAliveOptions[1]), "ServerAliveCountMax=%d", RECONNECT_ALIVE_COUNT);
+        snprintf(szAliveOptions[2], sizeof(szAliveOptions[2]), "ConnectTimeout=%d", RECONNECT_CONNECT_TIMEOUT);
+        for (int i = 0; i < 3; i++)
+        {
+            sshArgv[sshArgc++] = "-o";
+            sshArgv[sshArgc++] = szAliveOptions[i];
+        }
+    }
+    if (g_bReconnect || argc - argi >= 3)
+        sshArgv[sshArgc++] = "-t";
+    sshArgv[sshArgc++] = szTarget;
+    if (g_bReconnect)
+        iCommand = sshArgc++;
+    else if (argc - argi >= 3)
+        sshArgv[sshArgc++] = argv[argi + 2];
+    sshArgv[sshArgc] = NULL;
+
+    /* Block the signals we consume through the signalfd (unblocked again in the child) */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGWINCH);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+
+    sigfd = signalfd(-1, &sigs, SFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sigfd < 0 || epfd < 0)
+    {
+        fprintf(stderr, "epoll setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+    ev.data.fd = sigfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+    InputPipelineInit(&g_input);
+
+    /* One pass per ssh; more than one only under --reconnect */
+    for (;;)
+    {
+        if (g_bReconnect)
+        {
+            ReconnectBuildCommand(szResumeDir, g_szAttach[0] ? g_szAttach : NULL,
+                szCommand, sizeof(szCommand));
+            sshArgv[iCommand] = szCommand;
+            ReconnectAttempt(&g_reconnect, NowMs());
+        }
+
+        child = StartSsh(sshArgv, &sigs);
+        if (child < 0)
+        {
+            fprintf(stderr, "forkpty failed: %s\n", strerror(errno));
+            exitCode = 1;
+            break;
+        }
+
+        /* If password provided, wait for password prompt and send it */
+        if (szPassword[0])
+            InjectPassword(szPassword, child);
+        if (!g_bReconnect)
+            RelaySecureZero(szPassword, sizeof(szPassword));
+
+        if (bFirst)
+        {
+            /* Recording starts after login, so the password prompt is not in it */
+            if (g_pRecord && !StartRecording(szTarget, &recordThread))
+            {
+                fprintf(stderr, "Could not start recording (%s); continuing without it\r\n", g_szRecordFile);
+                g_pRecord = NULL;
+            }
+
+            /* splice() needs one side to be a pipe; only the stdout side can be.
+               Prediction, recording and directory tracking have to see the
+               output, so they rule out the zero-copy path. */
+            g_bSplice = !g_bPredict && !g_pRecord && !g_pCwd && fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+
+            /* Stats reporter ticks once a second */
+            if (g_pStats)
+            {
+                struct itimerspec its = {{1, 0}, {1, 0}};
+
+                StatsInit(g_pStats, NowMs());
+                StatsSamplerInit(&sampler, g_pStats, NowMs());
+                timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+                if (timerFd >= 0 && timerfd_settime(timerFd, 0, &its, NULL) == 0)
+                {
+                    ev.data.fd = timerFd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev);
+                }
+            }
+            bFirst = 0;
+        }
+        PredictInit(&g_predict, g_bPredict);
+
+        /* Input is written as the pty drains; output reads already tolerate EAGAIN */
+        fcntl(g_masterFd, F_SETFL, fcntl(g_masterFd, F_GETFL) | O_NONBLOCK);
+        ev.events = EPOLLIN;
+        ev.data.fd = g_masterFd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, g_masterFd, &ev);
+
+        EnterRawMode();
+        PropagateWindowSize();
+
+        bRunning = 1;
+        while (bRunning)
+        {
+            /* Resilient sessions wake each second to count a quiet login as up */
+            int nEvents = epoll_wait(epfd, events, 8, g_bReconnect ? 1000 : -1);
+            if (nEvents < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            for (int i = 0; i < nEvents && bRunning; i++)
+            {
+                int fd = events[i].data.fd;
+
+                if (fd == g_masterFd)
+                {
+                    if (events[i].events & EPOLLOUT)
+                        FlushInput();
+                    if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !RelayOutput())
+                        bRunning = 0;
+                }
+                else if (fd == STDIN_FILENO)
+                {
+                    char buffer[BUFFER_SIZE];
+                    ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+                    if (n > 0 && g_bReconnect && g_reconnect.bEverLive && g_reconnect.phase != RECONNECT_LIVE)
+                        continue;   /* Reconnecting: typed for the lost session, not this attempt's prompts */
+                    if (n > 0 && g_bPredict)
+                    {
+                        /* Draw predicted echo before the keystrokes start their round trip */
+                        char echo[PREDICT_ECHO_SIZE];
+                        size_t cbEcho = PredictInput(&g_predict, buffer, (size_t)n, echo, sizeof(echo));
+                        WriteAll(STDOUT_FILENO, echo, cbEcho);
+                    }
+                    if (n > 0)
+                    {
+                        InputPipelineFeed(&g_input, buffer, (size_t)n, NowMs());
+                        FlushInput();
+                    }
+                    else if (n == 0 || errno != EINTR)
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+                }
+                else if (fd == sigfd)
+                {
+                    struct signalfd_siginfo si;
+                    if (read(sigfd, &si, sizeof(si)) != sizeof(si))
+                        continue;
+                    if (si.ssi_signo == SIGWINCH)
+                        PropagateWindowSize();
+                    else if (si.ssi_signo == SIGHUP || si.ssi_signo == SIGTERM)
+                        kill(child, (int)si.ssi_signo);  /* Terminal closed: end ssh, then clean up normally */
+                    /* SIGCHLD: keep draining until the master reports EIO */
+                }
+                else if (fd == timerFd)
+                {
+                    unsigned long long nExpirations;
+                    if (read(timerFd, &nExpirations, sizeof(nExpirations)) == sizeof(nExpirations))
+                        ReportStats(&sampler);
+                }
+            }
+
+            if (g_bReconnect && ReconnectTick(&g_reconnect, NowMs()))
+            {
+                char szMessage[256];
+                size_t cbMessage = ReconnectFormatUp(&g_reconnect, NowMs(), szMessage, sizeof(szMessage));
+                WriteAll(STDOUT_FILENO, szMessage, cbMessage);
+            }
+
+            if (bRunning)
+                UpdateInputEvents(epfd);
+        }
+
+        epoll_ctl(epfd, EPOLL_CTL_DEL, g_masterFd, NULL);
+        close(g_masterFd);
+        g_masterFd = -1;
+
+        waitpid(child, &status, 0);
+        if (WIFEXITED(status))
+            exitCode = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            exitCode = 128 + WTERMSIG(status);
+
+        if (!g_bReconnect || ReconnectExit(&g_reconnect, exitCode, NowMs()) == RECONNECT_DONE)
+            break;
+
+        /* Resume where the shell last was; a fresh scanner for the new stream */
+        if (g_cwdScanner.szCwd[0])
+            snprintf(szResumeDir, sizeof(szResumeDir), "%s", g_cwdScanner.szCwd);
+        CwdScanInit(&g_cwdScanner);
+        ResetInput(epfd);
+
+        if (!WaitToReconnect(epfd, sigfd, timerFd, &sampler))
+            break;
+    }
+    RelaySecureZero(szPassword, sizeof(szPassword));
+
+    if (g_pRecord && !bFirst)
+        StopRecording(recordThread);
+
+    /* Pause on error so user can see what happened (still raw: any key works) */
+    if (exitCode != 0 && isatty(STDIN_FILENO))
+    {
+        char c;
+        fprintf(stderr, "\r\nSSH exited with code %d. Press any key to close...", exitCode);
+        if (read(STDIN_FILENO, &c, 1) < 0)
+            c = 0;
+    }
+
+    RestoreMode();
+    close(epfd);
+    close(sigfd);
+    if (timerFd >= 0)
+        close(timerFd);
+
+    /* The snapshot and the cwd file describe a live session only */
+    if (g_pStats)
+        unlink(g_szStatsFile);
+    if (g_bCwdMap)
+        unlink(g_szCwdFile);
+    InputPipelineFree(&g_input);
+
+    return exitCode;
+}
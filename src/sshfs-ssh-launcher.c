@@ -4,10 +4,56 @@
  * SSH launcher using Windows ConPTY (Pseudo Console) and built-in OpenSSH.
  * ConPTY properly handles Ctrl+C, terminal resize, and all terminal signals.
  *
- * Usage: sshfs-ssh-launcher.exe user@host[:port] pipe_handle ["remote_command"]
+ * Usage: sshfs-ssh-launcher.exe [options] user@host[:port] pipe_handle ["remote_command"]
+ *
+ * Options:
+ *   --predict     Predictive local echo for high-latency links (sshfs-predict.c)
+ *   --stats       Live RTT and throughput in the console title (sshfs-stats.c),
+ *                 with a JSON snapshot in %TEMP%\sshfs-ssh-stats-<pid>.json
+ *   --stats-file <path>
+ *                 Write the snapshot to path instead (implies --stats)
+ *   --broadcast <pipe_handle> <event_handle>
+ *                 Also type what arrives on the inherited pipe, and set the
+ *                 event once logged in (sshfs-ssh.exe --fanout sends one
+ *                 console's input to many sessions)
+ *   --record      Save the session's output as a gzipped asciicast in
+ *                 %LOCALAPPDATA%\SSHFS-Win\recordings (sshfs-record.c)
+ *   --record-file <path>
+ *                 Record to path instead (implies --record)
+ *   --record-block <ms>
+ *                 Wait up to ms for the recorder instead of sampling when it
+ *                 falls behind (implies --record)
+ *   --cwd-map <local_root> <remote_root> <remote_start>
+ *                 Follow the shell's directory reports (OSC 7, OSC 9;9) and
+ *                 map them onto the mount whose root is local_root
+ *                 (sshfs-cwd.c): the local path is kept in
+ *                 %TEMP%\sshfs-ssh-cwd-<pid>.txt and passed on to the
+ *                 console as OSC 9;9
+ *   --connect <helper_path>
+ *                 Connect through sshfs-ssh-connect.exe as ssh's
+ *                 ProxyCommand (parallel connect to all of the host's
+ *                 addresses, sshfs-connect.c)
+ *   --reconnect <remote_dir>
+ *                 Resilient session (sshfs-reconnect.c): start the shell in
+ *                 remote_dir instead of running remote_command, and when the
+ *                 connection is lost start ssh again, with backoff, on a new
+ *                 ConPTY in the last directory the shell reported
+ *   --attach <session> <idle_hours>
+ *                 With --reconnect: each attempt reattaches to the tmux or
+ *                 screen session instead of starting a shell
+ *                 (RemoteBuildAttachCommand(), sshfs-remote.c)
  *
  * Password is read from inherited pipe handle (not command line) for security.
- * The pipe_handle is a numeric handle value. Pass 0 for no password.
+ * The pipe_handle is a numeric handle value. Pass 0 for no password. Under
+ * --reconnect it is kept until the session ends, for each new attempt.
+ *
+ * Keystrokes are queued through sshfs-input.c and written to the ConPTY by a
+ * separate writer thread, so a large paste cannot stall console input.
+ *
+ * Prompt detection is shared with the POSIX launcher via sshfs-relay.c.
+ * Compile with: cl /O2 sshfs-ssh-launcher.c sshfs-relay.c sshfs-predict.c sshfs-input.c
+ *     sshfs-stats.c sshfs-record.c sshfs-gzip.c sshfs-cwd.c sshfs-path.c
+ *     sshfs-reconnect.c sshfs-remote.c
  */
 
 #ifndef UNICODE
@@ -23,6 +69,17 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <conio.h>
+#include <time.h>
+
+#include "sshfs-cmdline.h"
+#include "sshfs-relay.h"
+#include "sshfs-predict.h"
+#include "sshfs-input.h"
+#include "sshfs-stats.h"
+#include "sshfs-record.h"
+#include "sshfs-cwd.h"
+#include "sshfs-reconnect.h"
+#include "sshfs-remote.h"
 
 #define BUFFER_SIZE 4096
 
@@ -31,13 +88,192 @@ typedef HRESULT (WINAPI *CreatePseudoConsoleFunc)(COORD, HANDLE, HANDLE, DWORD,
 typedef HRESULT (WINAPI *ResizePseudoConsoleFunc)(HPCON, COORD);
 typedef void (WINAPI *ClosePseudoConsoleFunc)(HPCON);
 
-/* Global state for threads */
+/* Global state for threads; the ssh side is replaced on each reconnect */
 static HANDLE g_hPipeOutRead = NULL;
 static HANDLE g_hPipeInWrite = NULL;
 static HANDLE g_hProcess = NULL;
 static HPCON g_hPC = NULL;
+static CreatePseudoConsoleFunc g_pCreatePseudoConsole = NULL;
 static ResizePseudoConsoleFunc g_pResizePseudoConsole = NULL;
+static ClosePseudoConsoleFunc g_pClosePseudoConsole = NULL;
+static CRITICAL_SECTION g_csPC;             /* g_hPC against ResizeThread */
 static volatile BOOL g_bRunning = TRUE;
+static volatile BOOL g_bSession = FALSE;    /* OutputThread and WriterThread: this ssh */
+
+/* Predictive echo: engine is shared by the input and output threads */
+static BOOL g_bPredict = FALSE;
+static PredictEngine g_predict;
+static CRITICAL_SECTION g_csConsole;
+
+/* Input stage: InputThread queues, WriterThread drains into the ConPTY */
+static InputPipeline g_input;
+static CRITICAL_SECTION g_csInput;
+static CONDITION_VARIABLE g_cvQueued;
+static CONDITION_VARIABLE g_cvDrained;
+static WCHAR g_szTitle[512];
+
+/* Live stats: NULL unless --stats, so the byte path only tests the pointer */
+static SessionStats g_stats;
+static SessionStats *g_pStats = NULL;
+static WCHAR g_szStatsFile[MAX_PATH];
+static char g_szTargetA[512];
+
+/* Broadcast input from --broadcast, read once logged in */
+static HANDLE g_hBroadcast = NULL;
+static HANDLE g_hBroadcastReady = NULL;
+
+/* Recording: NULL unless --record; RecordThread does the writing */
+static RecordQueue g_record;
+static RecordQueue *g_pRecord = NULL;
+static RecordWriter g_recordWriter;
+static RecordPolicy g_recordPolicy = RECORD_SAMPLE;
+static DWORD g_dwRecordBlockMs = 0;
+static WCHAR g_szRecordFile[MAX_PATH];
+static HANDLE g_hRecordFile = INVALID_HANDLE_VALUE;
+static HANDLE g_hRecordWake = NULL;
+static volatile BOOL g_bRecordStop = FALSE;
+
+/* Directory reports: scanned for --cwd-map and --reconnect, NULL otherwise;
+   used by OutputThread only */
+static CwdScanner g_cwdScanner;
+static CwdScanner *g_pCwd = NULL;
+static BOOL g_bCwdMap = FALSE;
+static CwdMap g_cwdMap;
+static WCHAR g_szCwdFile[MAX_PATH];
+static char g_szLocalCwd[CWD_MAX];
+
+/* Resilient session: unless --reconnect, ssh runs once. InputThread takes
+   the keys of an outage and wakes the main thread with g_hReconnectWake. */
+static BOOL g_bReconnect = FALSE;
+static Reconnect g_reconnect;
+
+#define ATTACH_MAX 2048     /* RemoteBuildAttachCommand() */
+static CRITICAL_SECTION g_csReconnect;
+static HANDLE g_hReconnectWake = NULL;
+
+/**
+ * Queue output for the recorder once it is on the console. Under
+ * --record-block wait for room up to the limit, otherwise never wait.
+ */
+static void RecordOutput(const char *buffer, DWORD cb, ULONGLONG msRead)
+{
+    ULONGLONG msDeadline = GetTickCount64() + g_dwRecordBlockMs;
+    int bWake;
+
+    while (RecordOffer(g_pRecord, buffer, cb, msRead, &bWake) == RECORD_FULL)
+    {
+        SetEvent(g_hRecordWake);
+        if (GetTickCount64() >= msDeadline)
+        {
+            RecordDrop(g_pRecord, cb);
+            return;
+        }
+        Sleep(1);
+    }
+    if (bWake)
+        SetEvent(g_hRecordWake);
+}
+
+/**
+ * The shell reported a directory (g_cwdScanner.szCwd): keep its local path
+ * in the cwd file, replaced atomically like the stats file, and return
+ * OSC 9;9 with it for the console (0 if it is not on the mount)
+ */
+static size_t UpdateCwd(char *pszOsc, size_t cchOsc)
+{
+    char szLocal[CWD_MAX];
+    WCHAR szTempFile[MAX_PATH];
+    HANDLE hFile;
+    DWORD bytesWritten;
+    BOOL bMapped = CwdMapToLocal(&g_cwdMap, g_cwdScanner.szCwd, szLocal, sizeof(szLocal));
+
+    if (!bMapped)
+        szLocal[0] = '\0';
+
+    if (strcmp(szLocal, g_szLocalCwd) != 0 &&
+        SUCCEEDED(StringCchPrintfW(szTempFile, MAX_PATH, L"%s.tmp", g_szCwdFile)))
+    {
+        StringCchCopyA(g_szLocalCwd, CWD_MAX, szLocal);
+        hFile = CreateFileW(szTempFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile != INVALID_HANDLE_VALUE)
+        {
+            WriteFile(hFile, szLocal, (DWORD)strlen(szLocal), &bytesWritten, NULL);
+            CloseHandle(hFile);
+            MoveFileExW(szTempFile, g_szCwdFile, MOVEFILE_REPLACE_EXISTING);
+        }
+    }
+
+    return bMapped ? CwdFormatOsc99(szLocal, pszOsc, cchOsc) : 0;
+}
+
+/**
+ * The shell reported a directory: what goes to the console right after the
+ * report. That is the local directory as OSC 9;9 under --cwd-map and, if
+ * this report ends an outage, the reconnect notice.
+ */
+static size_t OnDirectoryReport(char *pszOut, size_t cchOut)
+{
+    size_t cb = g_bCwdMap ? UpdateCwd(pszOut, cchOut) : 0;
+    ULONGLONG now = GetTickCount64();
+
+    if (g_bReconnect)
+    {
+        EnterCriticalSection(&g_csReconnect);
+        if (ReconnectUp(&g_reconnect, now))
+            cb += ReconnectFormatUp(&g_reconnect, now, pszOut + cb, cchOut - cb);
+        LeaveCriticalSection(&g_csReconnect);
+    }
+    return cb < cchOut ? cb : 0;
+}
+
+/**
+ * Write server output to the console. cbReport is where a directory report
+ * ends in it (0 if none): the local directory goes in right there, between
+ * two sequences, so it is the last one the console sees.
+ */
+static void WriteServerOutput(HANDLE hStdout, const char *buffer, DWORD cb, DWORD cbReport)
+{
+    char szInsert[CWD_MAX + 256];
+    DWORD cbInsert, bytesWritten;
+
+    if (cbReport && (cbInsert = (DWORD)OnDirectoryReport(szInsert, sizeof(szInsert))) != 0)
+    {
+        WriteFile(hStdout, buffer, cbReport, &bytesWritten, NULL);
+        WriteFile(hStdout, szInsert, cbInsert, &bytesWritten, NULL);
+        buffer += cbReport;
+        cb -= cbReport;
+    }
+    WriteFile(hStdout, buffer, cb, &bytesWritten, NULL);
+}
+
+/**
+ * Keys typed while the session is not connected stay out of the input
+ * queue: while waiting to reconnect they go to the reconnect state (Enter,
+ * q), while an attempt connects or after it ended they are dropped. Before
+ * the first login they go to ssh, which may be asking about the host key.
+ * Returns TRUE if they were taken.
+ */
+static BOOL TakeReconnectKeys(const char *buffer, DWORD cb)
+{
+    BOOL bTaken = FALSE, bWaiting = FALSE;
+
+    if (!g_bReconnect)
+        return FALSE;
+
+    EnterCriticalSection(&g_csReconnect);
+    if (g_reconnect.phase == RECONNECT_WAITING)
+    {
+        for (DWORD i = 0; i < cb && g_reconnect.phase == RECONNECT_WAITING; i++)
+            ReconnectOnKey(&g_reconnect, buffer[i], GetTickCount64());
+        bWaiting = TRUE;
+    }
+    bTaken = bWaiting || (g_reconnect.phase != RECONNECT_LIVE && g_reconnect.bEverLive);
+    LeaveCriticalSection(&g_csReconnect);
+
+    if (bWaiting)
+        SetEvent(g_hReconnectWake);
+    return bTaken;
+}
 
 /**
  * Thread: Read from SSH output and write to console
@@ -46,48 +282,222 @@ static DWORD WINAPI OutputThread(LPVOID param)
 {
     HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
     char buffer[BUFFER_SIZE];
-    DWORD bytesRead, bytesWritten;
+    DWORD bytesRead, bytesWritten, cbReport;
+    ULONGLONG msRead;
 
     (void)param;
 
-    while (g_bRunning && ReadFile(g_hPipeOutRead, buffer, BUFFER_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    while (g_bSession && ReadFile(g_hPipeOutRead, buffer, BUFFER_SIZE, &bytesRead, NULL) && bytesRead > 0)
     {
-        WriteFile(hStdout, buffer, bytesRead, &bytesWritten, NULL);
+        msRead = GetTickCount64();
+        if (g_pStats)
+            StatsOnReceived(g_pStats, bytesRead, msRead);
+        cbReport = g_pCwd ? (DWORD)CwdScan(g_pCwd, buffer, bytesRead) : 0;
+
+        if (g_bPredict)
+        {
+            PredictFrame frame;
+
+            EnterCriticalSection(&g_csConsole);
+            PredictOutput(&g_predict, buffer, bytesRead, &frame);
+            if (frame.cbPrefix)
+                WriteFile(hStdout, frame.prefix, (DWORD)frame.cbPrefix, &bytesWritten, NULL);
+            WriteServerOutput(hStdout, buffer, bytesRead, cbReport);
+            if (frame.cbSuffix)
+                WriteFile(hStdout, frame.suffix, (DWORD)frame.cbSuffix, &bytesWritten, NULL);
+            LeaveCriticalSection(&g_csConsole);
+        }
+        else
+        {
+            WriteServerOutput(hStdout, buffer, bytesRead, cbReport);
+        }
+
+        if (g_pRecord)
+            RecordOutput(buffer, bytesRead, msRead);
     }
     return 0;
 }
 
 /**
- * Thread: Read from console input and write to SSH
+ * Thread: Read from console input and queue it for the writer
  */
 static DWORD WINAPI InputThread(LPVOID param)
 {
     HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
     char buffer[BUFFER_SIZE];
+    char echo[PREDICT_ECHO_SIZE];
     DWORD bytesRead, bytesWritten;
 
     (void)param;
 
-    while (g_bRunning && ReadFile(hStdin, buffer, BUFFER_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    while (g_bRunning)
+    {
+        /* Backpressure: leave the rest of a huge paste in the console buffer */
+        EnterCriticalSection(&g_csInput);
+        if (InputPipelineQueued(&g_input) > INPUT_HIGH_WATER)
+        {
+            while (g_bRunning && InputPipelineQueued(&g_input) > INPUT_LOW_WATER)
+                SleepConditionVariableCS(&g_cvDrained, &g_csInput, INFINITE);
+        }
+        LeaveCriticalSection(&g_csInput);
+
+        if (!g_bRunning || !ReadFile(hStdin, buffer, BUFFER_SIZE, &bytesRead, NULL) || bytesRead == 0)
+            break;
+        if (TakeReconnectKeys(buffer, bytesRead))
+            continue;
+
+        /* Draw predicted echo before the keystrokes start their round trip */
+        if (g_bPredict)
+        {
+            EnterCriticalSection(&g_csConsole);
+            DWORD cbEcho = (DWORD)PredictInput(&g_predict, buffer, bytesRead, echo, sizeof(echo));
+            if (cbEcho)
+                WriteFile(hStdout, echo, cbEcho, &bytesWritten, NULL);
+            LeaveCriticalSection(&g_csConsole);
+        }
+
+        EnterCriticalSection(&g_csInput);
+        InputPipelineFeed(&g_input, buffer, bytesRead, GetTickCount64());
+        LeaveCriticalSection(&g_csInput);
+        WakeConditionVariable(&g_cvQueued);
+    }
+    return 0;
+}
+
+/**
+ * Thread: Queue input broadcast to this session alongside the console's own
+ */
+static DWORD WINAPI BroadcastThread(LPVOID param)
+{
+    char buffer[BUFFER_SIZE];
+    DWORD bytesRead;
+
+    (void)param;
+
+    while (g_bRunning)
+    {
+        /* Same backpressure as console input; the broadcaster holds the rest */
+        EnterCriticalSection(&g_csInput);
+        if (InputPipelineQueued(&g_input) > INPUT_HIGH_WATER)
+        {
+            while (g_bRunning && InputPipelineQueued(&g_input) > INPUT_LOW_WATER)
+                SleepConditionVariableCS(&g_cvDrained, &g_csInput, INFINITE);
+        }
+        LeaveCriticalSection(&g_csInput);
+
+        /* The broadcaster closing its end just ends the broadcast, not the session */
+        if (!g_bRunning || !ReadFile(g_hBroadcast, buffer, BUFFER_SIZE, &bytesRead, NULL) || bytesRead == 0)
+            break;
+
+        EnterCriticalSection(&g_csInput);
+        InputPipelineFeed(&g_input, buffer, bytesRead, GetTickCount64());
+        LeaveCriticalSection(&g_csInput);
+        WakeConditionVariable(&g_cvQueued);
+    }
+    return 0;
+}
+
+/**
+ * Thread: Write queued input to SSH in bounded chunks
+ */
+static DWORD WINAPI WriterThread(LPVOID param)
+{
+    char chunk[INPUT_CHUNK_SIZE];
+    DWORD cbChunk = 0, bytesWritten;
+    InputPasteStats stats;
+    BOOL bReport;
+
+    (void)param;
+
+    while (g_bSession)
     {
-        WriteFile(g_hPipeInWrite, buffer, bytesRead, &bytesWritten, NULL);
+        EnterCriticalSection(&g_csInput);
+        while (g_bSession && (cbChunk = (DWORD)InputPipelineTake(&g_input, chunk, sizeof(chunk), GetTickCount64())) == 0)
+            SleepConditionVariableCS(&g_cvQueued, &g_csInput, INFINITE);
+        bReport = InputPipelineTakePasteReport(&g_input, &stats);
+        /* Both the console and the broadcast pipe may be waiting for room */
+        if (InputPipelineQueued(&g_input) < INPUT_LOW_WATER)
+            WakeAllConditionVariable(&g_cvDrained);
+        LeaveCriticalSection(&g_csInput);
+
+        if (!g_bSession)
+            break;
+
+        /* Show how fast the last paste went through in the title */
+        if (bReport)
+        {
+            char szReport[64];
+            WCHAR szTitle[600];
+
+            InputFormatPasteReport(&stats, szReport, sizeof(szReport));
+            StringCchPrintfW(szTitle, 600, L"%s | %S", g_szTitle, szReport);
+            SetConsoleTitleW(szTitle);
+        }
+
+        if (!WriteFile(g_hPipeInWrite, chunk, cbChunk, &bytesWritten, NULL))
+            break;
+
+        if (g_pStats)
+            StatsOnSent(g_pStats, bytesWritten, GetTickCount64());
     }
     return 0;
 }
 
+/**
+ * Publish a stats snapshot: summary in the title, JSON in the stats file.
+ * The file is replaced atomically so readers never see a partial write.
+ */
+static void ReportStats(StatsSampler *pSampler)
+{
+    StatsSnapshot snap;
+    char szSummary[96];
+    char szJson[1024];
+    WCHAR szTitle[640];
+    WCHAR szTempFile[MAX_PATH];
+    HANDLE hFile;
+    DWORD cbJson, bytesWritten;
+
+    StatsSample(g_pStats, pSampler, GetTickCount64(), &snap);
+
+    StatsFormatSummary(&snap, szSummary, sizeof(szSummary));
+    StringCchPrintfW(szTitle, 640, L"%s | %S", g_szTitle, szSummary);
+    SetConsoleTitleW(szTitle);
+
+    cbJson = (DWORD)StatsFormatJson(&snap, g_szTargetA, szJson, sizeof(szJson));
+    if (cbJson == 0 || FAILED(StringCchPrintfW(szTempFile, MAX_PATH, L"%s.tmp", g_szStatsFile)))
+        return;
+
+    hFile = CreateFileW(szTempFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+    WriteFile(hFile, szJson, cbJson, &bytesWritten, NULL);
+    CloseHandle(hFile);
+    MoveFileExW(szTempFile, g_szStatsFile, MOVEFILE_REPLACE_EXISTING);
+}
+
 static COORD GetConsoleSize(void);
 
 /**
- * Thread: Monitor console size changes and resize the ConPTY
+ * Thread: Monitor console size changes and resize the ConPTY.
+ * With --stats it also publishes a stats snapshot about once a second.
  */
 static DWORD WINAPI ResizeThread(LPVOID param)
 {
     COORD lastSize = GetConsoleSize();
     COORD curSize;
     DWORD settleCount = 0;
+    StatsSampler sampler;
+    ULONGLONG msNextReport = 0;
 
     (void)param;
 
+    if (g_pStats)
+    {
+        StatsSamplerInit(&sampler, g_pStats, GetTickCount64());
+        msNextReport = GetTickCount64() + 1000;
+    }
+
     while (g_bRunning)
     {
         Sleep(2);
@@ -95,13 +505,146 @@ static DWORD WINAPI ResizeThread(LPVOID param)
         if (curSize.X != lastSize.X || curSize.Y != lastSize.Y)
         {
             lastSize = curSize;
+            EnterCriticalSection(&g_csPC);
             if (g_hPC && g_pResizePseudoConsole)
                 g_pResizePseudoConsole(g_hPC, curSize);
+            LeaveCriticalSection(&g_csPC);
+            if (g_bPredict)
+            {
+                EnterCriticalSection(&g_csConsole);
+                PredictResize(&g_predict, (size_t)curSize.X);
+                LeaveCriticalSection(&g_csConsole);
+            }
+        }
+
+        if (g_pStats && GetTickCount64() >= msNextReport)
+        {
+            ReportStats(&sampler);
+            msNextReport += 1000;
         }
     }
     return 0;
 }
 
+static int WriteRecording(const void *data, size_t cb, void *pContext)
+{
+    DWORD bytesWritten;
+
+    (void)pContext;
+    return WriteFile(g_hRecordFile, data, (DWORD)cb, &bytesWritten, NULL) && bytesWritten == cb;
+}
+
+/**
+ * Thread: Compress queued output into the recording, each second or sooner
+ * when the queue fills up, until told to stop
+ */
+static DWORD WINAPI RecordThread(LPVOID param)
+{
+    BOOL bStop;
+
+    (void)param;
+
+    do
+    {
+        WaitForSingleObject(g_hRecordWake, RECORD_BATCH_MS);
+        bStop = g_bRecordStop;
+        RecordWriterPump(&g_recordWriter, g_pRecord, GetTickCount64(), bStop);
+    } while (!bStop);
+    return 0;
+}
+
+/**
+ * Open the recording and start its writer. The default file is per session:
+ * %LOCALAPPDATA%\SSHFS-Win\recordings\<target>-<date>-<time>-<pid>.cast.gz
+ */
+static HANDLE StartRecording(LPCWSTR pszTarget)
+{
+    WCHAR szDir[MAX_PATH];
+    WCHAR szSafeTarget[512];
+    char szTitleA[1024];
+    COORD size = GetConsoleSize();
+    SYSTEMTIME st;
+    HANDLE hThread = NULL;
+    WCHAR *p;
+
+    if (!g_szRecordFile[0])
+    {
+        if (!GetEnvironmentVariableW(L"LOCALAPPDATA", szDir, MAX_PATH))
+            return NULL;
+        StringCchCatW(szDir, MAX_PATH, L"\\SSHFS-Win");
+        CreateDirectoryW(szDir, NULL);
+        StringCchCatW(szDir, MAX_PATH, L"\\recordings");
+        CreateDirectoryW(szDir, NULL);
+
+        /* IPv6 literals and odd user names must still make a file name */
+        StringCchCopyW(szSafeTarget, 512, pszTarget);
+        for (p = szSafeTarget; *p; p++)
+        {
+            if (wcschr(L"\\/:*?\"<>|", *p))
+                *p = L'_';
+        }
+
+        GetLocalTime(&st);
+        StringCchPrintfW(g_szRecordFile, MAX_PATH, L"%s\\%s-%04u%02u%02u-%02u%02u%02u-%lu.cast.gz",
+            szDir, szSafeTarget, st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond,
+            GetCurrentProcessId());
+    }
+
+    /* Readable while recording, so a player can follow along */
+    g_hRecordFile = CreateFileW(g_szRecordFile, GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (g_hRecordFile == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    WideCharToMultiByte(CP_UTF8, 0, g_szTitle, -1, szTitleA, sizeof(szTitleA), NULL, NULL);
+    if (!RecordQueueInit(&g_record, g_recordPolicy))
+        goto cleanup;
+    if (!RecordWriterInit(&g_recordWriter, WriteRecording, NULL, size.X, size.Y,
+            (long long)time(NULL), szTitleA, GetTickCount64()))
+    {
+        RecordQueueFree(&g_record);
+        goto cleanup;
+    }
+
+    g_hRecordWake = CreateEventW(NULL, FALSE, FALSE, NULL);
+    if (g_hRecordWake)
+        hThread = CreateThread(NULL, 0, RecordThread, NULL, 0, NULL);
+    if (!hThread)
+    {
+        if (g_hRecordWake)
+            CloseHandle(g_hRecordWake);
+        RecordWriterFree(&g_recordWriter);
+        RecordQueueFree(&g_record);
+        goto cleanup;
+    }
+    return hThread;
+
+cleanup:
+    CloseHandle(g_hRecordFile);
+    g_hRecordFile = INVALID_HANDLE_VALUE;
+    DeleteFileW(g_szRecordFile);
+    return NULL;
+}
+
+/**
+ * Write what is still queued and close the recording (the output thread has
+ * stopped offering)
+ */
+static void StopRecording(HANDLE hThread)
+{
+    g_bRecordStop = TRUE;
+    SetEvent(g_hRecordWake);
+    WaitForSingleObject(hThread, INFINITE);
+    CloseHandle(hThread);
+    CloseHandle(g_hRecordWake);
+    CloseHandle(g_hRecordFile);
+
+    if (g_recordWriter.bError)
+        fwprintf(stderr, L"\nRecording incomplete (write failed): %s\n", g_szRecordFile);
+    RecordWriterFree(&g_recordWriter);
+    RecordQueueFree(&g_record);
+}
+
 /**
  * Get current console size
  */
@@ -146,62 +689,400 @@ static BOOL FindSSH(LPWSTR pszPath, DWORD cchPath)
     return TRUE;
 }
 
-int wmain(int argc, wchar_t *argv[])
+/**
+ * Command line of one reconnecting attempt: pszPrefix (ssh and its options)
+ * with the command that resumes in pszDir (UTF-8) and runs pszShell there
+ * (NULL: the login shell). A directory too long for the command line
+ * resumes in pszFallbackDir instead.
+ */
+static BOOL BuildReconnectCmdLine(LPCWSTR pszPrefix, const char *pszDir, const char *pszFallbackDir,
+    const char *pszShell, LPWSTR pszCmdLine, size_t cchCmdLine)
+{
+    char szCommandA[CWD_MAX * 4 + ATTACH_MAX];
+    WCHAR szCommand[CWD_MAX * 4 + ATTACH_MAX];
+
+    for (int i = 0; i < 2; i++)
+    {
+        size_t cch = ReconnectBuildCommand(i == 0 ? pszDir : pszFallbackDir, pszShell,
+            szCommandA, sizeof(szCommandA));
+
+        if (cch < sizeof(szCommandA) &&
+            MultiByteToWideChar(CP_UTF8, 0, szCommandA, -1, szCommand, CWD_MAX * 4 + ATTACH_MAX) &&
+            SUCCEEDED(StringCchCopyW(pszCmdLine, cchCmdLine, pszPrefix)) &&
+            AppendQuotedArg(pszCmdLine, cchCmdLine, szCommand))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Start ssh on a new ConPTY: g_hProcess, g_hPC and the pipes the output and
+ * writer threads use. Prints why and returns FALSE if it could not.
+ */
+static BOOL StartSession(LPWSTR pszCmdLine)
 {
-    HMODULE hKernel;
-    CreatePseudoConsoleFunc pCreatePseudoConsole;
-    ClosePseudoConsoleFunc pClosePseudoConsole;
     HANDLE hPipeInRead = NULL, hPipeInWrite = NULL;
     HANDLE hPipeOutRead = NULL, hPipeOutWrite = NULL;
-    HANDLE hOutputThread = NULL, hInputThread = NULL, hResizeThread = NULL;
     SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
     STARTUPINFOEXW si = {0};
     PROCESS_INFORMATION pi = {0};
     SIZE_T attrListSize = 0;
     LPPROC_THREAD_ATTRIBUTE_LIST attrList = NULL;
-    COORD consoleSize;
+    HPCON hPC = NULL;
     HRESULT hr;
+    BOOL bResult = FALSE;
+
+    /* Create pipes for I/O */
+    if (!CreatePipe(&hPipeInRead, &hPipeInWrite, &sa, 0) ||
+        !CreatePipe(&hPipeOutRead, &hPipeOutWrite, &sa, 0))
+    {
+        fwprintf(stderr, L"CreatePipe failed: %lu\n", GetLastError());
+        goto cleanup;
+    }
+
+    SetHandleInformation(hPipeInWrite, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(hPipeOutRead, HANDLE_FLAG_INHERIT, 0);
+
+    /* Create pseudo console */
+    hr = g_pCreatePseudoConsole(GetConsoleSize(), hPipeInRead, hPipeOutWrite, 0, &hPC);
+    if (FAILED(hr))
+    {
+        fwprintf(stderr, L"CreatePseudoConsole failed: 0x%08lx\n", hr);
+        hPC = NULL;
+        goto cleanup;
+    }
+
+    /* Set up process to use pseudo console */
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attrListSize);
+    attrList = (LPPROC_THREAD_ATTRIBUTE_LIST)malloc(attrListSize);
+    if (!attrList)
+    {
+        fwprintf(stderr, L"Memory allocation failed\n");
+        goto cleanup;
+    }
+
+    InitializeProcThreadAttributeList(attrList, 1, 0, &attrListSize);
+    UpdateProcThreadAttribute(attrList, 0, PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE,
+                              hPC, sizeof(HPCON), NULL, NULL);
+
+    si.StartupInfo.cb = sizeof(STARTUPINFOEXW);
+    si.lpAttributeList = attrList;
+
+    /* Create SSH process */
+    if (!CreateProcessW(NULL, pszCmdLine, NULL, NULL, FALSE,
+                        EXTENDED_STARTUPINFO_PRESENT, NULL, NULL,
+                        (LPSTARTUPINFOW)&si, &pi))
+    {
+        fwprintf(stderr, L"CreateProcess failed: %lu\nCommand: %s\n", GetLastError(), pszCmdLine);
+        DeleteProcThreadAttributeList(attrList);
+        goto cleanup;
+    }
+    DeleteProcThreadAttributeList(attrList);
+    CloseHandle(pi.hThread);
+
+    /* Set global handles for threads; SSH has its own pipe ends now */
+    g_hProcess = pi.hProcess;
+    g_hPipeOutRead = hPipeOutRead;
+    g_hPipeInWrite = hPipeInWrite;
+    EnterCriticalSection(&g_csPC);
+    g_hPC = hPC;
+    LeaveCriticalSection(&g_csPC);
+    hPC = NULL;
+    hPipeOutRead = hPipeInWrite = NULL;
+    bResult = TRUE;
+
+cleanup:
+    if (hPC)
+        g_pClosePseudoConsole(hPC);
+    free(attrList);
+    if (hPipeInRead)
+        CloseHandle(hPipeInRead);
+    if (hPipeOutWrite)
+        CloseHandle(hPipeOutWrite);
+    if (hPipeInWrite)
+        CloseHandle(hPipeInWrite);
+    if (hPipeOutRead)
+        CloseHandle(hPipeOutRead);
+    return bResult;
+}
+
+/**
+ * Relay ssh output until the password prompt appears, then send it. A
+ * directory report means the login is done without a prompt (keys, agent).
+ */
+static void AnswerPasswordPrompt(const char *pszPasswordA)
+{
+    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+    char buffer[BUFFER_SIZE];
+    char passLine[RELAY_MAX_PASSWORD + 2];
+    PromptMatcher promptMatcher;
+    DWORD bytesRead, bytesWritten, cbLine, cbReport;
+
+    PromptMatcherInit(&promptMatcher, "password:");
+
+    while (ReadFile(g_hPipeOutRead, buffer, BUFFER_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    {
+        cbReport = g_pCwd ? (DWORD)CwdScan(g_pCwd, buffer, bytesRead) : 0;
+        WriteServerOutput(hStdout, buffer, bytesRead, cbReport);
+        if (cbReport)
+            break;
+
+        /* Check for password prompt (case-insensitive, may span reads) */
+        if (PromptMatcherFeed(&promptMatcher, buffer, bytesRead))
+        {
+            cbLine = (DWORD)RelayFormatPasswordLine(pszPasswordA, passLine, sizeof(passLine));
+            WriteFile(g_hPipeInWrite, passLine, cbLine, &bytesWritten, NULL);
+            SecureZeroMemory(passLine, sizeof(passLine));
+            break;
+        }
+
+        /* Check if SSH exited */
+        if (WaitForSingleObject(g_hProcess, 0) == WAIT_OBJECT_0)
+            break;
+    }
+}
+
+/**
+ * Relay the session until ssh exits, then stop the output and writer
+ * threads and close its ConPTY. Returns ssh's exit code.
+ */
+static DWORD RelaySession(void)
+{
+    HANDLE hThreads[2];
+    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+    HPCON hPC;
+    DWORD dwExitCode = 0;
+    DWORD nThreads = 0;
+
+    g_bSession = TRUE;
+    if ((hThreads[nThreads] = CreateThread(NULL, 0, OutputThread, NULL, 0, NULL)) != NULL)
+        nThreads++;
+    if ((hThreads[nThreads] = CreateThread(NULL, 0, WriterThread, NULL, 0, NULL)) != NULL)
+        nThreads++;
+
+    /* Resilient sessions wake each second to count a quiet login as up */
+    while (WaitForSingleObject(g_hProcess, g_bReconnect ? 1000 : INFINITE) == WAIT_TIMEOUT)
+    {
+        char szMessage[256];
+        DWORD cbMessage = 0, bytesWritten;
+        ULONGLONG now = GetTickCount64();
+
+        EnterCriticalSection(&g_csReconnect);
+        if (ReconnectTick(&g_reconnect, now))
+            cbMessage = (DWORD)ReconnectFormatUp(&g_reconnect, now, szMessage, sizeof(szMessage));
+        LeaveCriticalSection(&g_csReconnect);
+        if (cbMessage)
+            WriteFile(hStdout, szMessage, cbMessage, &bytesWritten, NULL);
+    }
+    GetExitCodeProcess(g_hProcess, &dwExitCode);
+
+    /* Cancel blocking reads and writes and wake the writer waiting on the
+     * queue until both threads are gone: one still running would use the
+     * pipes of the next session, which get the same globals. CancelIoEx
+     * only reaches I/O already started, hence again on each round. */
+    g_bSession = FALSE;
+    do
+    {
+        CancelIoEx(g_hPipeOutRead, NULL);
+        CancelIoEx(g_hPipeInWrite, NULL);
+        EnterCriticalSection(&g_csInput);
+        WakeAllConditionVariable(&g_cvQueued);
+        LeaveCriticalSection(&g_csInput);
+    } while (nThreads > 0 && WaitForMultipleObjects(nThreads, hThreads, TRUE, 100) == WAIT_TIMEOUT);
+    while (nThreads > 0)
+        CloseHandle(hThreads[--nThreads]);
+
+    CloseHandle(g_hProcess);
+    CloseHandle(g_hPipeInWrite);
+    CloseHandle(g_hPipeOutRead);
+    g_hProcess = g_hPipeInWrite = g_hPipeOutRead = NULL;
+
+    EnterCriticalSection(&g_csPC);
+    hPC = g_hPC;
+    g_hPC = NULL;
+    LeaveCriticalSection(&g_csPC);
+    g_pClosePseudoConsole(hPC);
+
+    return dwExitCode;
+}
+
+/**
+ * Drop input still queued for a session that has ended, so nothing typed
+ * into the dead one lands in the next one's password prompt
+ */
+static void ResetInput(void)
+{
+    EnterCriticalSection(&g_csInput);
+    InputPipelineFree(&g_input);
+    InputPipelineInit(&g_input);
+    WakeAllConditionVariable(&g_cvDrained);
+    LeaveCriticalSection(&g_csInput);
+}
+
+/**
+ * The connection was lost (g_reconnect is WAITING): say so and wait out
+ * the backoff. Enter retries at once, q / Ctrl+C / Ctrl+D give up
+ * (InputThread passes them on). Returns TRUE to start the next attempt.
+ */
+static BOOL WaitToReconnect(void)
+{
+    HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+    char szMessage[256];
+    DWORD cbMessage, bytesWritten, dwWait;
+    BOOL bGiveUp;
+
+    EnterCriticalSection(&g_csReconnect);
+    cbMessage = (DWORD)ReconnectFormatLost(&g_reconnect, GetTickCount64(), szMessage, sizeof(szMessage));
+    LeaveCriticalSection(&g_csReconnect);
+    WriteFile(hStdout, szMessage, cbMessage, &bytesWritten, NULL);
+
+    for (;;)
+    {
+        EnterCriticalSection(&g_csReconnect);
+        bGiveUp = g_reconnect.phase != RECONNECT_WAITING;
+        dwWait = bGiveUp ? 0 : ReconnectDelay(&g_reconnect, GetTickCount64());
+        if (bGiveUp)
+            cbMessage = (DWORD)ReconnectFormatGiveUp(&g_reconnect, GetTickCount64(), szMessage, sizeof(szMessage));
+        LeaveCriticalSection(&g_csReconnect);
+
+        if (bGiveUp)
+        {
+            WriteFile(hStdout, szMessage, cbMessage, &bytesWritten, NULL);
+            return FALSE;
+        }
+        if (dwWait == 0)
+            return TRUE;
+        WaitForSingleObject(g_hReconnectWake, dwWait);
+    }
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+    HMODULE hKernel;
+    HANDLE hInputThread = NULL, hResizeThread = NULL;
+    HANDLE hBroadcastThread = NULL, hRecordThread = NULL;
     DWORD dwExitCode = 0;
     DWORD dwOrigConsoleMode = 0;
     HANDLE hStdin = GetStdHandle(STD_INPUT_HANDLE);
     
     WCHAR szSSHPath[MAX_PATH];
-    WCHAR szCmdLine[4096];
+    WCHAR szPrefix[1024];
+    WCHAR szCmdLine[32768];
     WCHAR szTarget[512] = {0};
-    WCHAR szPassword[256] = {0};
-    WCHAR szRemoteCmd[1024] = {0};
+    WCHAR szRemoteCmd[ATTACH_MAX + MAX_PATH * 2] = {0};
     WCHAR szPort[16] = {0};
-    WCHAR szTitle[512];
+    WCHAR szConnect[MAX_PATH + 64] = {0};
+    char szReconnectDir[CWD_MAX] = "~";
+    char szResumeDir[CWD_MAX];
+    char szAttach[ATTACH_MAX] = "";
     
-    char szPasswordA[256] = {0};
-    char buffer[BUFFER_SIZE];
-    DWORD bytesRead, bytesWritten;
-    BOOL foundPrompt = FALSE;
+    char szPasswordA[RELAY_MAX_PASSWORD + 1] = {0};
+    BOOL bFirst = TRUE;
+    int argi = 1;
 
-    if (argc < 3)
+    /* Parse options */
+    while (argi < argc && wcsncmp(argv[argi], L"--", 2) == 0)
     {
-        fwprintf(stderr, L"Usage: %s user@host[:port] pipe_handle [\"remote_command\"]\n", argv[0]);
+        if (wcscmp(argv[argi], L"--predict") == 0)
+            g_bPredict = TRUE;
+        else if (wcscmp(argv[argi], L"--stats") == 0)
+            g_pStats = &g_stats;
+        else if (wcscmp(argv[argi], L"--stats-file") == 0 && argi + 1 < argc)
+        {
+            g_pStats = &g_stats;
+            StringCchCopyW(g_szStatsFile, MAX_PATH, argv[++argi]);
+        }
+        else if (wcscmp(argv[argi], L"--broadcast") == 0 && argi + 2 < argc)
+        {
+            g_hBroadcast = (HANDLE)(ULONG_PTR)_wcstoui64(argv[++argi], NULL, 10);
+            g_hBroadcastReady = (HANDLE)(ULONG_PTR)_wcstoui64(argv[++argi], NULL, 10);
+        }
+        else if (wcscmp(argv[argi], L"--record") == 0)
+            g_pRecord = &g_record;
+        else if (wcscmp(argv[argi], L"--record-file") == 0 && argi + 1 < argc)
+        {
+            g_pRecord = &g_record;
+            StringCchCopyW(g_szRecordFile, MAX_PATH, argv[++argi]);
+        }
+        else if (wcscmp(argv[argi], L"--record-block") == 0 && argi + 1 < argc)
+        {
+            g_pRecord = &g_record;
+            g_recordPolicy = RECORD_BLOCK;
+            g_dwRecordBlockMs = wcstoul(argv[++argi], NULL, 10);
+        }
+        else if (wcscmp(argv[argi], L"--cwd-map") == 0 && argi + 3 < argc)
+        {
+            char szLocalRoot[MAX_PATH * 3], szRemoteRoot[MAX_PATH * 6], szRemoteStart[MAX_PATH * 6];
+
+            WideCharToMultiByte(CP_UTF8, 0, argv[++argi], -1, szLocalRoot, (int)sizeof(szLocalRoot), NULL, NULL);
+            WideCharToMultiByte(CP_UTF8, 0, argv[++argi], -1, szRemoteRoot, (int)sizeof(szRemoteRoot), NULL, NULL);
+            WideCharToMultiByte(CP_UTF8, 0, argv[++argi], -1, szRemoteStart, (int)sizeof(szRemoteStart), NULL, NULL);
+            CwdMapInit(&g_cwdMap, szLocalRoot, szRemoteRoot, szRemoteStart, '\\');
+            g_bCwdMap = TRUE;
+            g_pCwd = &g_cwdScanner;
+        }
+        else if (wcscmp(argv[argi], L"--connect") == 0 && argi + 1 < argc)
+        {
+            StringCchPrintfW(szConnect, MAX_PATH + 64, L" -o \"ProxyCommand=\\\"%s\\\" %%h %%p\"", argv[++argi]);
+        }
+        else if (wcscmp(argv[argi], L"--reconnect") == 0 && argi + 1 < argc)
+        {
+            WideCharToMultiByte(CP_UTF8, 0, argv[++argi], -1, szReconnectDir, CWD_MAX, NULL, NULL);
+            g_bReconnect = TRUE;
+            g_pCwd = &g_cwdScanner;
+        }
+        else if (wcscmp(argv[argi], L"--attach") == 0 && argi + 2 < argc)
+        {
+            char szSession[REMOTE_SESSION_NAME_MAX];
+
+            WideCharToMultiByte(CP_UTF8, 0, argv[++argi], -1, szSession, REMOTE_SESSION_NAME_MAX, NULL, NULL);
+            if (RemoteBuildAttachCommand(szSession, _wtoi(argv[++argi]), szAttach, ATTACH_MAX) >= ATTACH_MAX)
+                szAttach[0] = '\0';
+        }
+        else
+        {
+            fwprintf(stderr, L"Unknown option: %s\n", argv[argi]);
+            return 1;
+        }
+        argi++;
+    }
+
+    if (argc - argi < 2)
+    {
+        fwprintf(stderr, L"Usage: %s [--predict] [--stats] [--stats-file path] [--broadcast pipe_handle event_handle] [--record] [--record-file path] [--record-block ms] [--cwd-map local_root remote_root remote_start] [--connect helper_path] [--reconnect remote_dir] [--attach session idle_hours] user@host[:port] pipe_handle [\"remote_command\"]\n", argv[0]);
         return 1;
     }
 
     /* Parse arguments */
-    StringCchCopyW(szTarget, 512, argv[1]);
+    StringCchCopyW(szTarget, 512, argv[argi]);
+    if (g_pCwd)
+        CwdScanInit(g_pCwd);
+    StringCchCopyA(szResumeDir, CWD_MAX, szReconnectDir);
+    ReconnectInit(&g_reconnect, GetTickCount64() ^ ((ULONGLONG)GetCurrentProcessId() << 32));
 
     /* Read password from inherited pipe handle (secure - not visible in process list) */
-    HANDLE hPipeRead = (HANDLE)(ULONG_PTR)_wcstoui64(argv[2], NULL, 10);
+    HANDLE hPipeRead = (HANDLE)(ULONG_PTR)_wcstoui64(argv[argi + 1], NULL, 10);
     if (hPipeRead != NULL && hPipeRead != INVALID_HANDLE_VALUE)
     {
-        DWORD pipeBytes;
-        if (ReadFile(hPipeRead, szPasswordA, 255, &pipeBytes, NULL) && pipeBytes > 0)
+        DWORD cbPassword = 0, pipeBytes;
+
+        /* All of it, up to sshfs-ssh.exe closing its end */
+        while (cbPassword < sizeof(szPasswordA) &&
+            ReadFile(hPipeRead, szPasswordA + cbPassword, (DWORD)sizeof(szPasswordA) - cbPassword, &pipeBytes, NULL) &&
+            pipeBytes > 0)
+            cbPassword += pipeBytes;
+        CloseHandle(hPipeRead);
+        if (cbPassword > RELAY_MAX_PASSWORD)
         {
-            szPasswordA[pipeBytes] = '\0';
-            MultiByteToWideChar(CP_UTF8, 0, szPasswordA, -1, szPassword, 256);
+            SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
+            fwprintf(stderr, L"The password is longer than %d bytes\n", RELAY_MAX_PASSWORD);
+            return 1;
         }
-        CloseHandle(hPipeRead);
+        szPasswordA[cbPassword] = '\0';
     }
 
-    if (argc >= 4)
-        StringCchCopyW(szRemoteCmd, 1024, argv[3]);
+    if (argc - argi >= 3)
+        StringCchCopyW(szRemoteCmd, ATTACH_MAX + MAX_PATH * 2, argv[argi + 2]);
 
     /* Check for port in target (user@host:port format) */
     WCHAR *pColon = wcsrchr(szTarget, L':');
@@ -213,8 +1094,29 @@ int wmain(int argc, wchar_t *argv[])
     }
 
     /* Set console title */
-    StringCchPrintfW(szTitle, 512, L"SSH: %s", szTarget);
-    SetConsoleTitleW(szTitle);
+    StringCchPrintfW(g_szTitle, 512, g_hBroadcast ? L"SSH: %s (broadcast)" : L"SSH: %s", szTarget);
+    SetConsoleTitleW(g_szTitle);
+
+    /* Default stats file is per process so several sessions can be queried */
+    if (g_pStats)
+    {
+        WideCharToMultiByte(CP_UTF8, 0, szTarget, -1, g_szTargetA, 512, NULL, NULL);
+        if (!g_szStatsFile[0])
+        {
+            WCHAR szTempPath[MAX_PATH];
+            GetTempPathW(MAX_PATH, szTempPath);
+            StringCchPrintfW(g_szStatsFile, MAX_PATH, L"%ssshfs-ssh-stats-%lu.json",
+                szTempPath, GetCurrentProcessId());
+        }
+    }
+
+    if (g_bCwdMap)
+    {
+        WCHAR szTempPath[MAX_PATH];
+        GetTempPathW(MAX_PATH, szTempPath);
+        StringCchPrintfW(g_szCwdFile, MAX_PATH, L"%ssshfs-ssh-cwd-%lu.txt",
+            szTempPath, GetCurrentProcessId());
+    }
 
     /* Find SSH executable */
     if (!FindSSH(szSSHPath, MAX_PATH))
@@ -223,189 +1125,187 @@ int wmain(int argc, wchar_t *argv[])
         return 1;
     }
 
-    /* Build SSH command line */
+    /* Build SSH command line: everything up to the target is the same for each attempt */
+    StringCchPrintfW(szPrefix, 1024, L"\"%s\"%s", szSSHPath, szConnect);
     if (szPort[0])
     {
-        if (szRemoteCmd[0])
-            StringCchPrintfW(szCmdLine, 4096, L"\"%s\" -p %s -t %s \"%s\"", 
-                szSSHPath, szPort, szTarget, szRemoteCmd);
-        else
-            StringCchPrintfW(szCmdLine, 4096, L"\"%s\" -p %s %s", 
-                szSSHPath, szPort, szTarget);
+        StringCchCatW(szPrefix, 1024, L" -p ");
+        StringCchCatW(szPrefix, 1024, szPort);
     }
-    else
+    if (g_bReconnect)
     {
-        if (szRemoteCmd[0])
-            StringCchPrintfW(szCmdLine, 4096, L"\"%s\" -t %s \"%s\"", 
-                szSSHPath, szTarget, szRemoteCmd);
-        else
-            StringCchPrintfW(szCmdLine, 4096, L"\"%s\" %s", 
-                szSSHPath, szTarget);
+        /* Notice a dead link within ~30 s instead of waiting on TCP */
+        WCHAR szAlive[128];
+        StringCchPrintfW(szAlive, 128, L" -o ServerAliveInterval=%d -o ServerAliveCountMax=%d -o ConnectTimeout=%d",
+            RECONNECT_ALIVE_INTERVAL, RECONNECT_ALIVE_COUNT, RECONNECT_CONNECT_TIMEOUT);
+        StringCchCatW(szPrefix, 1024, szAlive);
     }
+    if (g_bReconnect || szRemoteCmd[0])
+        StringCchCatW(szPrefix, 1024, L" -t");
+    StringCchCatW(szPrefix, 1024, L" ");
+    StringCchCatW(szPrefix, 1024, szTarget);
+
+    if (szRemoteCmd[0])
+        StringCchPrintfW(szCmdLine, 32768, L"%s \"%s\"", szPrefix, szRemoteCmd);
+    else
+        StringCchCopyW(szCmdLine, 32768, szPrefix);
 
     /* Load ConPTY functions */
     hKernel = GetModuleHandleW(L"kernel32.dll");
-    pCreatePseudoConsole = (CreatePseudoConsoleFunc)GetProcAddress(hKernel, "CreatePseudoConsole");
-    pClosePseudoConsole = (ClosePseudoConsoleFunc)GetProcAddress(hKernel, "ClosePseudoConsole");
+    g_pCreatePseudoConsole = (CreatePseudoConsoleFunc)GetProcAddress(hKernel, "CreatePseudoConsole");
+    g_pClosePseudoConsole = (ClosePseudoConsoleFunc)GetProcAddress(hKernel, "ClosePseudoConsole");
     g_pResizePseudoConsole = (ResizePseudoConsoleFunc)GetProcAddress(hKernel, "ResizePseudoConsole");
 
-    if (!pCreatePseudoConsole || !pClosePseudoConsole)
+    if (!g_pCreatePseudoConsole || !g_pClosePseudoConsole)
     {
         fwprintf(stderr, L"ConPTY not available. Requires Windows 10 1809+\n");
         return 1;
     }
 
-    /* Create pipes for I/O */
-    if (!CreatePipe(&hPipeInRead, &hPipeInWrite, &sa, 0) ||
-        !CreatePipe(&hPipeOutRead, &hPipeOutWrite, &sa, 0))
-    {
-        fwprintf(stderr, L"CreatePipe failed: %lu\n", GetLastError());
-        return 1;
-    }
-
-    SetHandleInformation(hPipeInWrite, HANDLE_FLAG_INHERIT, 0);
-    SetHandleInformation(hPipeOutRead, HANDLE_FLAG_INHERIT, 0);
-
-    /* Get console size */
-    consoleSize = GetConsoleSize();
-
-    /* Create pseudo console */
-    hr = pCreatePseudoConsole(consoleSize, hPipeInRead, hPipeOutWrite, 0, &g_hPC);
-    if (FAILED(hr))
-    {
-        fwprintf(stderr, L"CreatePseudoConsole failed: 0x%08lx\n", hr);
-        return 1;
-    }
-
-    /* Set up process to use pseudo console */
-    InitializeProcThreadAttributeList(NULL, 1, 0, &attrListSize);
-    attrList = (LPPROC_THREAD_ATTRIBUTE_LIST)malloc(attrListSize);
-    if (!attrList)
-    {
-        fwprintf(stderr, L"Memory allocation failed\n");
-        pClosePseudoConsole(g_hPC);
-        return 1;
-    }
-    
-    InitializeProcThreadAttributeList(attrList, 1, 0, &attrListSize);
-    UpdateProcThreadAttribute(attrList, 0, PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE,
-                              g_hPC, sizeof(HPCON), NULL, NULL);
-
-    si.StartupInfo.cb = sizeof(STARTUPINFOEXW);
-    si.lpAttributeList = attrList;
+    InitializeCriticalSection(&g_csPC);
+    InitializeCriticalSection(&g_csReconnect);
+    InitializeCriticalSection(&g_csConsole);
+    InitializeCriticalSection(&g_csInput);
+    InitializeConditionVariable(&g_cvQueued);
+    InitializeConditionVariable(&g_cvDrained);
+    InputPipelineInit(&g_input);
+    g_hReconnectWake = CreateEventW(NULL, FALSE, FALSE, NULL);
 
-    /* Create SSH process */
-    if (!CreateProcessW(NULL, szCmdLine, NULL, NULL, FALSE,
-                        EXTENDED_STARTUPINFO_PRESENT, NULL, NULL, 
-                        (LPSTARTUPINFOW)&si, &pi))
+    /* One pass per ssh; more than one only under --reconnect */
+    for (;;)
     {
-        fwprintf(stderr, L"CreateProcess failed: %lu\nCommand: %s\n", GetLastError(), szCmdLine);
-        pClosePseudoConsole(g_hPC);
-        free(attrList);
-        return 1;
-    }
+        if (g_bReconnect)
+        {
+            if (!BuildReconnectCmdLine(szPrefix, szResumeDir, szReconnectDir,
+                szAttach[0] ? szAttach : NULL, szCmdLine, 32768))
+            {
+                fwprintf(stderr, L"Command line too long\n");
+                dwExitCode = 1;
+                break;
+            }
+            EnterCriticalSection(&g_csReconnect);
+            ReconnectAttempt(&g_reconnect, GetTickCount64());
+            LeaveCriticalSection(&g_csReconnect);
+        }
 
-    g_hProcess = pi.hProcess;
+        if (!StartSession(szCmdLine))
+        {
+            dwExitCode = 1;
+            break;
+        }
 
-    /* Close pipe ends that SSH process uses */
-    CloseHandle(hPipeInRead);
-    hPipeInRead = NULL;
-    CloseHandle(hPipeOutWrite);
-    hPipeOutWrite = NULL;
+        /* If password provided, wait for password prompt and send it */
+        if (szPasswordA[0])
+            AnswerPasswordPrompt(szPasswordA);
+        if (!g_bReconnect)
+            SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
 
-    /* Set global handles for threads */
-    g_hPipeOutRead = hPipeOutRead;
-    g_hPipeInWrite = hPipeInWrite;
+        if (bFirst)
+        {
+            /* Set console to raw mode for proper terminal handling */
+            GetConsoleMode(hStdin, &dwOrigConsoleMode);
+            SetConsoleMode(hStdin, ENABLE_VIRTUAL_TERMINAL_INPUT);
 
-    /* Convert password to ANSI for sending */
-    if (szPassword[0])
-    {
-        WideCharToMultiByte(CP_UTF8, 0, szPassword, -1, szPasswordA, 256, NULL, NULL);
-    }
+            if (g_pStats)
+                StatsInit(g_pStats, GetTickCount64());
 
-    /* If password provided, wait for password prompt and send it */
-    if (szPasswordA[0])
-    {
-        HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+            /* Recording starts after login, so the password prompt is not in it */
+            if (g_pRecord)
+            {
+                hRecordThread = StartRecording(szTarget);
+                if (!hRecordThread)
+                {
+                    fwprintf(stderr, L"Could not start recording (%s); continuing without it\r\n", g_szRecordFile);
+                    g_pRecord = NULL;
+                }
+            }
 
-        while (ReadFile(hPipeOutRead, buffer, BUFFER_SIZE - 1, &bytesRead, NULL) && bytesRead > 0)
-        {
-            buffer[bytesRead] = '\0';
-            WriteFile(hStdout, buffer, bytesRead, &bytesWritten, NULL);
+            /* Console input and resizing outlive each ssh */
+            hInputThread = CreateThread(NULL, 0, InputThread, NULL, 0, NULL);
+            hResizeThread = CreateThread(NULL, 0, ResizeThread, NULL, 0, NULL);
 
-            /* Check for password prompt (case-insensitive) */
-            if (!foundPrompt)
+            /* Tell the broadcaster this session is logged in, so it starts the next one */
+            if (g_hBroadcast)
             {
-                char lowerBuf[BUFFER_SIZE];
-                for (DWORD i = 0; i <= bytesRead; i++)
-                    lowerBuf[i] = (char)tolower((unsigned char)buffer[i]);
-
-                if (strstr(lowerBuf, "password:"))
+                hBroadcastThread = CreateThread(NULL, 0, BroadcastThread, NULL, 0, NULL);
+                if (g_hBroadcastReady)
                 {
-                    foundPrompt = TRUE;
+                    SetEvent(g_hBroadcastReady);
+                    CloseHandle(g_hBroadcastReady);
+                }
+            }
+            bFirst = FALSE;
+        }
+        PredictInit(&g_predict, g_bPredict);
+        PredictResize(&g_predict, (size_t)GetConsoleSize().X);
 
-                    /* Send password */
-                    char passLine[512];
-                    StringCchPrintfA(passLine, 512, "%s\n", szPasswordA);
-                    WriteFile(hPipeInWrite, passLine, (DWORD)strlen(passLine), &bytesWritten, NULL);
+        /* Wait for SSH process to exit */
+        dwExitCode = RelaySession();
 
-                    /* Clear password from memory */
-                    SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
-                    SecureZeroMemory(szPassword, sizeof(szPassword));
+        if (!g_bReconnect)
+            break;
+        EnterCriticalSection(&g_csReconnect);
+        ReconnectExit(&g_reconnect, (int)dwExitCode, GetTickCount64());
+        LeaveCriticalSection(&g_csReconnect);
+        if (g_reconnect.phase == RECONNECT_DONE)
+            break;
 
-                    break;
-                }
-            }
+        /* Resume where the shell last was; a fresh scanner for the new stream */
+        if (g_cwdScanner.szCwd[0])
+            StringCchCopyA(szResumeDir, CWD_MAX, g_cwdScanner.szCwd);
+        CwdScanInit(&g_cwdScanner);
+        ResetInput();
 
-            /* Check if SSH exited */
-            if (WaitForSingleObject(pi.hProcess, 0) == WAIT_OBJECT_0)
-                break;
-        }
+        if (!WaitToReconnect())
+            break;
     }
 
-    /* Set console to raw mode for proper terminal handling */
-    GetConsoleMode(hStdin, &dwOrigConsoleMode);
-    SetConsoleMode(hStdin, ENABLE_VIRTUAL_TERMINAL_INPUT);
-
-    /* Start I/O and resize threads */
-    hOutputThread = CreateThread(NULL, 0, OutputThread, NULL, 0, NULL);
-    hInputThread = CreateThread(NULL, 0, InputThread, NULL, 0, NULL);
-    hResizeThread = CreateThread(NULL, 0, ResizeThread, NULL, 0, NULL);
+    /* Final cleanup - ensure password is cleared even if prompt was never detected */
+    SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
 
-    /* Wait for SSH process to exit */
-    WaitForSingleObject(pi.hProcess, INFINITE);
-    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    /* Nothing ran if the first ssh could not be started */
+    if (bFirst)
+        return 1;
 
     /* Signal threads to stop */
     g_bRunning = FALSE;
     
-    /* Cancel blocking reads */
-    CancelIoEx(hPipeOutRead, NULL);
+    /* Cancel blocking reads, wake threads waiting on the queue */
     CancelIoEx(hStdin, NULL);
+    if (g_hBroadcast)
+        CancelIoEx(g_hBroadcast, NULL);
+    EnterCriticalSection(&g_csInput);
+    WakeAllConditionVariable(&g_cvDrained);
+    LeaveCriticalSection(&g_csInput);
 
     /* Wait for threads */
-    WaitForSingleObject(hOutputThread, 1000);
     WaitForSingleObject(hInputThread, 1000);
     WaitForSingleObject(hResizeThread, 1000);
+    if (hBroadcastThread)
+        WaitForSingleObject(hBroadcastThread, 1000);
+    if (hRecordThread)
+        StopRecording(hRecordThread);
 
     /* Restore console mode */
     SetConsoleMode(hStdin, dwOrigConsoleMode);
+    DeleteCriticalSection(&g_csConsole);
+    DeleteCriticalSection(&g_csInput);
+    InputPipelineFree(&g_input);
+
+    /* The snapshot and the cwd file describe a live session only */
+    if (g_pStats)
+        DeleteFileW(g_szStatsFile);
+    if (g_bCwdMap)
+        DeleteFileW(g_szCwdFile);
 
     /* Cleanup */
-    CloseHandle(hOutputThread);
     CloseHandle(hInputThread);
     CloseHandle(hResizeThread);
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
-    CloseHandle(hPipeInWrite);
-    CloseHandle(hPipeOutRead);
-    DeleteProcThreadAttributeList(attrList);
-    free(attrList);
-    pClosePseudoConsole(g_hPC);
-
-    /* Final cleanup - ensure password is cleared even if prompt was never detected */
-    SecureZeroMemory(szPassword, sizeof(szPassword));
-    SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
+    if (hBroadcastThread)
+        CloseHandle(hBroadcastThread);
+    if (g_hBroadcast)
+        CloseHandle(g_hBroadcast);
+    CloseHandle(g_hReconnectWake);
 
     /* Pause on error so user can see what happened */
     if (dwExitCode != 0)
@@ -416,4 +1316,3 @@ int wmain(int argc, wchar_t *argv[])
 
     return (int)dwExitCode;
 }
-
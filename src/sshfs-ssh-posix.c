@@ -0,0 +1,431 @@
+/**
+ * sshfs-ssh-posix.c
+ *
+ * Linux counterpart of sshfs-ssh.c: opens an ssh session at the remote
+ * directory behind a local path on a fuse.sshfs mount.
+ *
+ * Usage: sshfs-ssh <path>
+ *        sshfs-ssh attach <path> [<idle hours>]
+ *        sshfs-ssh exec <path> -- <command> [<argument>...]
+ *        sshfs-ssh bench <path> [<runs>] ["<ssh options>"...]
+ *
+ * The mount is found through the indexed mountinfo table in sshfs-mounts.c
+ * and the remote path is built by the same code as the Windows UNC path.
+ * Linux sshfs mounts authenticate with keys/agent, so ssh is exec'd
+ * directly in the current terminal.
+ *
+ * "attach" opens the persistent tmux or screen session of that directory,
+ * as the AttachSession setting does on Windows (RemoteSessionName()),
+ * reaping others detached for idle hours (default 24, 0: never).
+ *
+ * "exec" runs a command on the server in that directory without a PTY, the
+ * same way as sshfs-ssh.exe exec (see RunRemoteExec()). "bench" times the
+ * phases of connecting, as sshfs-ssh.exe --bench does (see RunBench()).
+ *
+ * Compile with: gcc -O2 -o sshfs-ssh sshfs-ssh-posix.c sshfs-mounts.c sshfs-path.c sshfs-remote.c sshfs-bench.c
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "sshfs-mounts.h"
+#include "sshfs-remote.h"
+#include "sshfs-bench.h"
+
+#define ATTACH_MAX          2048    /* RemoteBuildAttachCommand() */
+#define ATTACH_IDLE_HOURS   24
+
+/**
+ * Build remote command: cd to path and run pszShell there, "exec $SHELL"
+ * for the login shell (same quoting rules as LaunchSSHTerminal)
+ */
+static void BuildRemoteCommand(const char *pszRemotePath, const char *pszShell, char *pszCmd, size_t cchCmd)
+{
+    char szCleanPath[PATH_MAX * 2];
+    const char *src = pszRemotePath;
+    char *dst = szCleanPath;
+
+    while (*src && dst < szCleanPath + sizeof(szCleanPath) - 1)
+    {
+        if (*src != '"' && *src != '\'')
+            *dst++ = *src;
+        src++;
+    }
+    *dst = '\0';
+
+    if (szCleanPath[0] == '\0' || strcmp(szCleanPath, "~") == 0)
+        snprintf(pszCmd, cchCmd, "cd ~; %s", pszShell);
+    else if (szCleanPath[0] == '~')
+        snprintf(pszCmd, cchCmd, "cd %s; %s", szCleanPath, pszShell);
+    else
+        snprintf(pszCmd, cchCmd, "cd '%s'; %s", szCleanPath, pszShell);
+}
+
+/**
+ * Resolve a local path on an sshfs mount to the ssh target and remote path,
+ * reporting failures on stderr
+ */
+static int ResolvePath(const char *pszArg, char *pszTarget, size_t cchTarget,
+    char *pszRemotePath, size_t cchRemotePath)
+{
+    char szPath[PATH_MAX];
+    MountTable *mt;
+    int bOk;
+
+    if (!realpath(pszArg, szPath))
+    {
+        fprintf(stderr, "%s: %s\n", pszArg, strerror(errno));
+        return 0;
+    }
+
+    mt = MountTableOpen();
+    if (!mt)
+    {
+        fprintf(stderr, "Could not read /proc/self/mountinfo\n");
+        return 0;
+    }
+
+    bOk = MountTableResolve(mt, szPath, pszTarget, cchTarget, pszRemotePath, cchRemotePath);
+    if (!bOk)
+        fprintf(stderr, "%s is not on an sshfs mount.\n", szPath);
+    MountTableClose(mt);
+    return bOk;
+}
+
+/* Write end of ssh's stdin while "exec" runs, for the SIGINT handler */
+static int g_fdControl = -1;
+static volatile sig_atomic_t g_nPresses = 0;
+
+static void OnExecInterrupt(int sig)
+{
+    char line[2];
+
+    (void)sig;
+    g_nPresses++;
+    line[0] = RemoteExecSignal(g_nPresses);
+    line[1] = '\n';
+    if (write(g_fdControl, line, 2) < 0)
+    {
+        /* ssh is gone; waitpid() reports it */
+    }
+}
+
+/**
+ * Run a command on the server in pszRemotePath with ssh -T: its stdout and
+ * stderr are ssh's (this terminal's), its exit status is returned. ssh
+ * ignores SIGINT, and Ctrl+C becomes a control line on ssh's stdin for the
+ * wrapper on the server (RemoteBuildExecCommand()). 255 if ssh could not run.
+ */
+static int RunRemoteExec(const char *pszTarget, const char *pszRemotePath, char **ppszArgs, int nArgs)
+{
+    struct sigaction sa;
+    char *pszCmd;
+    size_t cbCmd;
+    int fds[2];
+    int status;
+    pid_t pid;
+
+    cbCmd = RemoteBuildExecCommand(pszRemotePath, (const char *const *)ppszArgs, (size_t)nArgs, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    if (!pszCmd)
+        return 255;
+    RemoteBuildExecCommand(pszRemotePath, (const char *const *)ppszArgs, (size_t)nArgs, pszCmd, cbCmd);
+
+    if (pipe(fds) < 0)
+    {
+        free(pszCmd);
+        return 255;
+    }
+
+    pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        signal(SIGINT, SIG_IGN);
+        execlp("ssh", "ssh", "-T", pszTarget, pszCmd, (char *)NULL);
+        fprintf(stderr, "Could not run ssh: %s\n", strerror(errno));
+        _exit(255);
+    }
+    close(fds[0]);
+    free(pszCmd);
+    if (pid < 0)
+    {
+        close(fds[1]);
+        return 255;
+    }
+
+    g_fdControl = fds[1];
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnExecInterrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            status = 255 << 8;
+            break;
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    close(fds[1]);
+    g_fdControl = -1;
+
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+static double ElapsedMs(const struct timespec *pStart)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - pStart->tv_sec) * 1000.0 + (double)(now.tv_nsec - pStart->tv_nsec) / 1e6;
+}
+
+/**
+ * One timed connection: ssh -v with RemoteBuildBenchCommand(), stdout and
+ * stderr on one pipe, each read stamped against the start. pszOptions are
+ * extra ssh arguments, split at spaces.
+ */
+static void RunBenchOnce(const char *pszTarget, const char *pszCmd, const char *pszOptions, BenchRun *r)
+{
+    char szOptions[1024];
+    char *argv[64];
+    char buffer[4096];
+    struct timespec start;
+    double msNow = 0;
+    ssize_t cb;
+    int argc = 0;
+    int fds[2];
+    pid_t pid;
+    char *tok;
+
+    BenchRunInit(r);
+    argv[argc++] = "ssh";
+    argv[argc++] = "-v";
+    argv[argc++] = "-T";
+    argv[argc++] = "-o";
+    argv[argc++] = "BatchMode=yes";
+    argv[argc++] = "-o";            /* A shared connection would skip the phases */
+    argv[argc++] = "ControlPath=none";
+    snprintf(szOptions, sizeof(szOptions), "%s", pszOptions);
+    for (tok = strtok(szOptions, " \t"); tok && argc < 60; tok = strtok(NULL, " \t"))
+        argv[argc++] = tok;
+    argv[argc++] = (char *)pszTarget;
+    argv[argc++] = (char *)pszCmd;
+    argv[argc] = NULL;
+
+    if (pipe(fds) < 0)
+    {
+        snprintf(r->szError, sizeof(r->szError), "pipe: %s", strerror(errno));
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid = fork();
+    if (pid == 0)
+    {
+        int fdNull = open("/dev/null", O_RDONLY);
+
+        dup2(fdNull, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execvp("ssh", argv);
+        fprintf(stderr, "Could not run ssh: %s\n", strerror(errno));
+        _exit(255);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+        snprintf(r->szError, sizeof(r->szError), "fork: %s", strerror(errno));
+        close(fds[0]);
+        return;
+    }
+
+    /* Until ssh exits and the pipe closes */
+    while ((cb = read(fds[0], buffer, sizeof(buffer))) != 0)
+    {
+        if (cb < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        msNow = ElapsedMs(&start);
+        BenchFeed(r, buffer, (size_t)cb, msNow);
+    }
+    BenchFeed(r, "\n", 1, msNow);   /* A last line without a newline */
+    close(fds[0]);
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+}
+
+/**
+ * Connect nRuns times as the terminal would, then nRuns times with each set
+ * of extra ssh options, and report each phase's min/median/p95 per variant.
+ * Returns 0 if every run completed.
+ */
+static int RunBench(const char *pszTarget, const char *pszRemotePath, int nRuns,
+    char **ppszVariants, int nVariants)
+{
+    static BenchSeries series;
+    BenchRun run;
+    char szCmd[PATH_MAX * 3];
+    char szReport[4096];
+    int result = 0;
+    int iVariant, iRun;
+
+    if (RemoteBuildBenchCommand(pszRemotePath, szCmd, sizeof(szCmd)) >= sizeof(szCmd))
+        return 1;
+
+    printf("Connecting %d times to %s for %s\n\n", nRuns, pszTarget, pszRemotePath[0] ? pszRemotePath : "~");
+    for (iVariant = 0; iVariant <= nVariants; iVariant++)
+    {
+        const char *pszOptions = iVariant > 0 ? ppszVariants[iVariant - 1] : "";
+        const char *pszLabel = iVariant > 0 ? pszOptions : "default";
+
+        BenchSeriesInit(&series);
+        for (iRun = 0; iRun < nRuns; iRun++)
+        {
+            BenchPhase reached;
+
+            RunBenchOnce(pszTarget, szCmd, pszOptions, &run);
+            BenchSeriesAdd(&series, &run);
+            reached = BenchRunReached(&run);
+            if (reached == BENCH_PHASES)
+                printf("%s: run %d of %d: %.1f ms\n", pszLabel, iRun + 1, nRuns, run.msEnd[BENCH_SHELL]);
+            else
+                fprintf(stderr, "%s: run %d of %d failed in %s: %s\n", pszLabel, iRun + 1, nRuns,
+                    BenchPhaseName(reached), run.szError[0] ? run.szError : "no output");
+            fflush(stdout);
+        }
+
+        BenchFormatSeries(&series, pszLabel, szReport, sizeof(szReport));
+        printf("\n%s\n", szReport);
+        if (series.nOk < series.nRuns)
+            result = 1;
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    char szTarget[512];
+    char szRemotePath[PATH_MAX * 2];
+    char szRemoteCmd[PATH_MAX * 2 + ATTACH_MAX];
+    char szShell[ATTACH_MAX] = "exec $SHELL";
+    const char *pszPath = argv[1];
+    int bAttach = 0;
+    int idleHours = ATTACH_IDLE_HOURS;
+
+    if (argc >= 3 && strcmp(argv[1], "exec") == 0)
+    {
+        char **ppszArgs = argv + 3;
+        int nArgs = argc - 3;
+
+        if (nArgs > 0 && strcmp(ppszArgs[0], "--") == 0)
+        {
+            ppszArgs++;
+            nArgs--;
+        }
+        if (nArgs < 1)
+        {
+            fprintf(stderr, "Usage: %s exec <path> -- <command> [<argument>...]\n", argv[0]);
+            return 255;
+        }
+        if (!ResolvePath(argv[2], szTarget, sizeof(szTarget), szRemotePath, sizeof(szRemotePath)))
+            return 255;
+        return RunRemoteExec(szTarget, szRemotePath, ppszArgs, nArgs);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "bench") == 0)
+    {
+        char **ppszVariants = argv + 3;
+        int nVariants = argc - 3;
+        int nRuns = BENCH_DEFAULT_RUNS;
+
+        if (nVariants > 0 && ppszVariants[0][0] &&
+            strspn(ppszVariants[0], "0123456789") == strlen(ppszVariants[0]))
+        {
+            nRuns = atoi(ppszVariants[0]);
+            ppszVariants++;
+            nVariants--;
+        }
+        if (nRuns < 1 || nRuns > BENCH_MAX_RUNS)
+        {
+            fprintf(stderr, "Usage: %s bench <path> [<runs, 1-1000>] [\"<ssh options>\"...]\n", argv[0]);
+            return 1;
+        }
+        if (!ResolvePath(argv[2], szTarget, sizeof(szTarget), szRemotePath, sizeof(szRemotePath)))
+            return 1;
+        return RunBench(szTarget, szRemotePath, nRuns, ppszVariants, nVariants);
+    }
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <path>\n"
+            "       %s attach <path> [<idle hours>]\n"
+            "       %s exec <path> -- <command> [<argument>...]\n"
+            "       %s bench <path> [<runs>] [\"<ssh options>\"...]\n\n"
+            "Opens an SSH terminal to the location on an sshfs mounted directory,\n"
+            "runs a command there on the server, or times each phase of connecting.\n",
+            argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "attach") == 0)
+    {
+        bAttach = 1;
+        pszPath = argv[2];
+        if (argc >= 4)
+            idleHours = atoi(argv[3]);
+    }
+
+    if (!ResolvePath(pszPath, szTarget, sizeof(szTarget), szRemotePath, sizeof(szRemotePath)))
+        return 1;
+
+    if (bAttach)
+    {
+        char szSession[REMOTE_SESSION_NAME_MAX];
+        char szUser[256] = "";
+        const char *pszHost = strrchr(szTarget, '@');
+
+        /* The target is the mount's "[user@]host" */
+        if (pszHost)
+        {
+            snprintf(szUser, sizeof(szUser), "%.*s", (int)(pszHost - szTarget), szTarget);
+            pszHost++;
+        }
+        else
+            pszHost = szTarget;
+
+        RemoteSessionName(szUser, pszHost, "", szRemotePath, szSession, sizeof(szSession));
+        if (RemoteBuildAttachCommand(szSession, idleHours, szShell, sizeof(szShell)) >= sizeof(szShell))
+            snprintf(szShell, sizeof(szShell), "exec $SHELL");
+    }
+
+    BuildRemoteCommand(szRemotePath, szShell, szRemoteCmd, sizeof(szRemoteCmd));
+
+    execlp("ssh", "ssh", "-t", szTarget, szRemoteCmd, (char *)NULL);
+    fprintf(stderr, "Could not run ssh: %s\n", strerror(errno));
+    return 1;
+}
@@ -0,0 +1,775 @@
+/**
+ * sshfs-ssh-search.c
+ *
+ * Searching on the server: sshfs-ssh.exe --search <folder>
+ *
+ * Walking a tree through the drive costs SFTP round trips per folder, and
+ * reading it for a content search pulls every file across. Here the server
+ * runs find, or rg (grep where rg is not installed), in the folder and the
+ * results stream back over one ssh channel while they are found. Each
+ * remote path is mapped back to its place under the folder on the drive
+ * (RemotePathToLocal, the inverse of how the mount builds remote paths),
+ * so a double-click opens the file through the mount.
+ *
+ * Once the mount has a snapshot ("Snapshot tree"), name searches can use
+ * its index instead and need no connection at all.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <commctrl.h>
+#include <shellapi.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-path.h"
+#include "sshfs-remote.h"
+#include "sshfs-search.h"
+#include "sshfs-index.h"
+#include "sshfs-ssh.h"
+
+#define SEARCH_MAX_RESULTS  1000000
+#define SEARCH_BATCH_SIZE   4096
+#define SEARCH_POST_MS      100         /* Results reach the list at least this often */
+#define SEARCH_PIPE_SIZE    (256 * 1024)
+
+#define WM_SEARCH_RESULTS   (WM_APP + 1)
+#define WM_SEARCH_DONE      (WM_APP + 2)
+
+#define IDC_QUERY           101
+#define IDC_CONTENTS        102
+#define IDC_SEARCH          103
+#define IDC_RESULTS         104
+#define IDC_STATUS          105
+#define IDC_SNAPSHOT        106
+
+/**
+ * One result: local path and, for content searches, "line: text", in a
+ * single allocation (free pszPath)
+ */
+typedef struct SearchHit {
+    LPWSTR pszPath;
+    LPWSTR pszMatch;
+} SearchHit;
+
+typedef struct SearchBatch {
+    size_t nHits;
+    SearchHit hits[SEARCH_BATCH_SIZE];
+} SearchBatch;
+
+/**
+ * A running search: ssh's output (or the snapshot index) is read on a
+ * thread of its own, which posts the results to the window in batches
+ */
+typedef struct SearchJob {
+    HWND hWnd;
+    WPARAM nGeneration;             /* Tags its messages, see SearchWindow */
+    PROCESS_INFORMATION pi;
+    HANDLE hOutRead;
+    HANDLE hErr;
+    HANDLE hThread;
+    SearchParser parser;
+    SearchBatch *pBatch;
+    ULONGLONG msLastPost;
+    LPCWSTR pszFolder;              /* Local folder searched, results are below it */
+    const char *pszRemote;          /* Its remote path */
+    unsigned long nResults;
+    volatile LONG bStop;
+    BOOL bCapped;
+    DWORD dwExitCode;
+    WCHAR szError[512];
+    BOOL bSnapshot;                 /* Names from the index, no ssh */
+    WCHAR szIndex[MAX_PATH];
+    char szQuery[512 * 3];
+    char szSubPath[MAX_PATH * 2 * 3];   /* Folder searched, relative to the index root */
+} SearchJob;
+
+typedef struct SearchWindow {
+    HWND hQuery, hContents, hSnapshot, hButton, hList, hStatus;
+    SSHFSLocation *pLoc;
+    WCHAR szFolder[MAX_PATH];
+    char szRemote[MAX_PATH * 2 * 3];
+    WCHAR szIndex[MAX_PATH];        /* Snapshot of the mount, "" if there is none */
+    char szSubPath[MAX_PATH * 2 * 3];
+    SearchHit *pHits;
+    size_t nHits, nAlloc;
+    SearchJob *pJob;
+    WPARAM nGeneration;             /* Messages of stopped searches are dropped */
+    size_t cchPrefix;               /* szFolder and its backslash, left out of the Path column */
+    ULONGLONG msStart;
+} SearchWindow;
+
+/**
+ * Hand the current batch to the window (freed here if it is gone)
+ */
+static void PostSearchBatch(SearchJob *job)
+{
+    SearchBatch *b = job->pBatch;
+
+    job->pBatch = NULL;
+    job->msLastPost = GetTickCount64();
+    if (!b)
+        return;
+    if (b->nHits > 0 && PostMessageW(job->hWnd, WM_SEARCH_RESULTS, job->nGeneration, (LPARAM)b))
+        return;
+    while (b->nHits > 0)
+        free(b->hits[--b->nHits].pszPath);
+    free(b);
+}
+
+/**
+ * Parser callback (reader thread): map the remote path to the drive
+ */
+static void TakeSearchResult(const SearchResult *r, void *pContext)
+{
+    SearchJob *job = (SearchJob *)pContext;
+    char szSub[SEARCH_MAX_PATH + 1];
+    WCHAR szSubW[SEARCH_MAX_PATH + 1];
+    WCHAR szMatch[SEARCH_MAX_TEXT + 32];
+    WCHAR szText[SEARCH_MAX_TEXT + 1];
+    size_t cchFolder, cchSub, cchMatch;
+    LPWSTR p;
+
+    if (job->nResults >= SEARCH_MAX_RESULTS)
+    {
+        if (!job->bCapped)
+        {
+            job->bCapped = TRUE;
+            if (job->pi.hProcess)
+                TerminateProcess(job->pi.hProcess, 1);
+        }
+        return;
+    }
+
+    /* Relative to the searched folder, whose remote path is pszRemote */
+    if (!RemotePathToLocal(r->pszPath, job->pszRemote, '\\', szSub, sizeof(szSub)) || !szSub[0] ||
+        !MultiByteToWideChar(CP_UTF8, 0, szSub, -1, szSubW, SEARCH_MAX_PATH + 1))
+        return;
+
+    szMatch[0] = L'\0';
+    if (job->parser.bContents)
+    {
+        MultiByteToWideChar(CP_UTF8, 0, r->pszText, -1, szText, SEARCH_MAX_TEXT + 1);
+        /* Tabs and runs of indentation are noise in a one-line column */
+        for (p = szText; *p == L' ' || *p == L'\t'; p++)
+            ;
+        StringCchPrintfW(szMatch, SEARCH_MAX_TEXT + 32, L"%lu: %s", r->nLine, p);
+    }
+
+    cchFolder = wcslen(job->pszFolder);
+    cchSub = wcslen(szSubW);
+    cchMatch = wcslen(szMatch);
+    p = malloc((cchFolder + 1 + cchSub + 1 + cchMatch + 1) * sizeof(WCHAR));
+    if (!p)
+        return;
+
+    if (!job->pBatch)
+    {
+        job->pBatch = malloc(sizeof(SearchBatch));
+        if (!job->pBatch)
+        {
+            free(p);
+            return;
+        }
+        job->pBatch->nHits = 0;
+    }
+
+    memcpy(p, job->pszFolder, cchFolder * sizeof(WCHAR));
+    if (cchFolder > 0 && p[cchFolder - 1] != L'\\')
+        p[cchFolder++] = L'\\';
+    memcpy(p + cchFolder, szSubW, (cchSub + 1) * sizeof(WCHAR));
+    job->pBatch->hits[job->pBatch->nHits].pszPath = p;
+    p += cchFolder + cchSub + 1;
+    memcpy(p, szMatch, (cchMatch + 1) * sizeof(WCHAR));
+    job->pBatch->hits[job->pBatch->nHits].pszMatch = p;
+    job->nResults++;
+
+    if (++job->pBatch->nHits == SEARCH_BATCH_SIZE)
+        PostSearchBatch(job);
+}
+
+/**
+ * Reader thread: parse ssh's output until it ends or the search is stopped
+ */
+static DWORD WINAPI SearchReaderThread(LPVOID pParam)
+{
+    SearchJob *job = (SearchJob *)pParam;
+    char *pBuffer = malloc(SEARCH_PIPE_SIZE);
+    DWORD bytesRead;
+
+    while (pBuffer && !job->bStop &&
+        ReadFile(job->hOutRead, pBuffer, SEARCH_PIPE_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    {
+        SearchParserFeed(&job->parser, pBuffer, bytesRead, TakeSearchResult, job);
+        if (GetTickCount64() - job->msLastPost >= SEARCH_POST_MS)
+            PostSearchBatch(job);
+    }
+    PostSearchBatch(job);
+    free(pBuffer);
+
+    WaitForSingleObject(job->pi.hProcess, INFINITE);
+    GetExitCodeProcess(job->pi.hProcess, &job->dwExitCode);
+    ReadErrorTail(job->hErr, job->szError, 512);
+    PostMessageW(job->hWnd, WM_SEARCH_DONE, job->nGeneration, 0);
+    return 0;
+}
+
+/**
+ * Snapshot thread: match the names in the index below the searched folder
+ */
+static DWORD WINAPI SearchSnapshotThread(LPVOID pParam)
+{
+    SearchJob *job = (SearchJob *)pParam;
+    IndexCursor *c = malloc(sizeof(IndexCursor));
+    SnapshotView v;
+    SearchResult r;
+    size_t first = 0, end = 0, cchSub = strlen(job->szSubPath);
+
+    job->dwExitCode = 2;
+    if (!c || !OpenSnapshot(job->szIndex, &v))
+    {
+        StringCchCopyW(job->szError, 512, L"the snapshot could not be read. Take a new one.");
+        free(c);
+        PostMessageW(job->hWnd, WM_SEARCH_DONE, job->nGeneration, 0);
+        return 0;
+    }
+
+    /* A folder's subtree is the range of entries after it */
+    end = v.ix.nEntries;
+    if (cchSub > 0)
+    {
+        size_t j = IndexFind(&v.ix, job->szSubPath);
+
+        if (j == (size_t)-1 || v.ix.pEntries[j].type != 'd')
+            end = 0;
+        else
+        {
+            first = j + 1;
+            end = first + v.ix.pEntries[j].nBelow;
+        }
+    }
+
+    r.nLine = 0;
+    r.pszText = "";
+    IndexCursorSeek(c, &v.ix, first);
+    while (c->iNext < end && !job->bStop && !job->bCapped && IndexCursorNext(c))
+    {
+        if (!IndexNameMatches(c->szPath, job->szQuery))
+            continue;
+        r.pszPath = c->szPath + (cchSub > 0 ? cchSub + 1 : 0);
+        TakeSearchResult(&r, job);
+        if (GetTickCount64() - job->msLastPost >= SEARCH_POST_MS)
+            PostSearchBatch(job);
+    }
+    PostSearchBatch(job);
+
+    job->dwExitCode = 0;
+    CloseSnapshot(&v);
+    free(c);
+    PostMessageW(job->hWnd, WM_SEARCH_DONE, job->nGeneration, 0);
+    return 0;
+}
+
+/**
+ * Stop a search (if bStop) and free it once its reader thread has ended
+ */
+static void EndSearch(SearchWindow *sw, BOOL bStop)
+{
+    SearchJob *job = sw->pJob;
+
+    if (!job)
+        return;
+    if (bStop)
+    {
+        job->bStop = TRUE;
+        if (job->pi.hProcess)
+            TerminateProcess(job->pi.hProcess, 1);
+        sw->nGeneration++;
+    }
+    WaitForSingleObject(job->hThread, INFINITE);
+    CloseHandle(job->hThread);
+    if (job->pi.hProcess)
+    {
+        CloseHandle(job->pi.hProcess);
+        CloseHandle(job->pi.hThread);
+    }
+    if (job->hOutRead)
+        CloseHandle(job->hOutRead);
+    if (job->hErr)
+        CloseHandle(job->hErr);
+    SearchParserFree(&job->parser);
+    free(job);
+    sw->pJob = NULL;
+    SetWindowTextW(sw->hButton, L"Search");
+}
+
+static void ClearSearchHits(SearchWindow *sw)
+{
+    while (sw->nHits > 0)
+        free(sw->pHits[--sw->nHits].pszPath);
+    ListView_SetItemCountEx(sw->hList, 0, 0);
+}
+
+/**
+ * Run ssh for the query in the window and start reading its output, or
+ * search the snapshot when that box is checked
+ */
+static void StartSearch(HWND hWnd, SearchWindow *sw)
+{
+    SearchJob *job = NULL;
+    WCHAR szQuery[512];
+    char szQueryA[512 * 3];
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    HANDLE hOutWrite = NULL;
+    BOOL bContents = SendMessageW(sw->hContents, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    BOOL bSnapshot = SendMessageW(sw->hSnapshot, BM_GETCHECK, 0, 0) == BST_CHECKED;
+    BOOL bHasPassword = FALSE;
+    BOOL bStarted;
+
+    GetWindowTextW(sw->hQuery, szQuery, 512);
+    if (!szQuery[0])
+        return;
+    WideCharToMultiByte(CP_UTF8, 0, szQuery, -1, szQueryA, sizeof(szQueryA), NULL, NULL);
+
+    if (bSnapshot && bContents)
+    {
+        SetWindowTextW(sw->hStatus, L"A snapshot holds names only: uncheck one of the boxes.");
+        return;
+    }
+
+    ClearSearchHits(sw);
+
+    if (bSnapshot)
+    {
+        job = calloc(1, sizeof(SearchJob));
+        if (!job)
+            return;
+        job->bSnapshot = TRUE;
+        StringCchCopyW(job->szIndex, MAX_PATH, sw->szIndex);
+        StringCchCopyA(job->szQuery, sizeof(job->szQuery), szQueryA);
+        StringCchCopyA(job->szSubPath, sizeof(job->szSubPath), sw->szSubPath);
+        goto start;
+    }
+
+    cbCmd = RemoteBuildSearchCommand(sw->szRemote,
+        bContents ? REMOTE_SEARCH_CONTENTS : REMOTE_SEARCH_NAMES, szQueryA, NULL, 0) + 1;
+    job = calloc(1, sizeof(SearchJob));
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!job || !pszCmd || !pszCmdW || !pszCmdLine || !SearchParserInit(&job->parser, bContents))
+        goto cleanup;
+    RemoteBuildSearchCommand(sw->szRemote,
+        bContents ? REMOTE_SEARCH_CONTENTS : REMOTE_SEARCH_NAMES, szQueryA, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (sw->pLoc->mountType == MOUNT_TYPE_PASSWORD || sw->pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(sw->pLoc->szUser, sw->pLoc->szHost, sw->pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        sw->pLoc->szPort[0] ? L" -p " : L"", sw->pLoc->szPort,
+        sw->pLoc->szUser, sw->pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    job->hErr = CreateScratchFile();
+    if (job->hErr == INVALID_HANDLE_VALUE)
+    {
+        job->hErr = NULL;
+        goto cleanup;
+    }
+    if (!CreateSSHPipe(&job->hOutRead, &hOutWrite, FALSE, SEARCH_PIPE_SIZE))
+        goto cleanup;
+    bStarted = SpawnSSH(pszCmdLine, NULL, hOutWrite, job->hErr, CREATE_NO_WINDOW,
+        szAskpassPath, bHasPassword ? szPassword : NULL, &job->pi);
+    CloseHandle(hOutWrite);
+    if (!bStarted)
+    {
+        WCHAR szError[128];
+        StringCchPrintfW(szError, 128, L"Failed to start ssh.exe (error %lu).", GetLastError());
+        SetWindowTextW(sw->hStatus, szError);
+        goto cleanup;
+    }
+
+start:
+    job->hWnd = hWnd;
+    job->nGeneration = ++sw->nGeneration;
+    job->pszFolder = sw->szFolder;
+    job->pszRemote = sw->szRemote;
+    job->msLastPost = GetTickCount64();
+    job->hThread = CreateThread(NULL, 0, bSnapshot ? SearchSnapshotThread : SearchReaderThread, job, 0, NULL);
+    if (!job->hThread)
+    {
+        if (job->pi.hProcess)
+        {
+            TerminateProcess(job->pi.hProcess, 1);
+            CloseHandle(job->pi.hProcess);
+            CloseHandle(job->pi.hThread);
+        }
+        goto cleanup;
+    }
+
+    sw->pJob = job;
+    job = NULL;
+    sw->msStart = GetTickCount64();
+    SetWindowTextW(sw->hButton, L"Stop");
+    SetWindowTextW(sw->hStatus, L"Searching...");
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (job)
+    {
+        if (job->hOutRead)
+            CloseHandle(job->hOutRead);
+        if (job->hErr)
+            CloseHandle(job->hErr);
+        SearchParserFree(&job->parser);
+        free(job);
+    }
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+}
+
+static void ShowSearchStatus(SearchWindow *sw, BOOL bDone)
+{
+    WCHAR szStatus[640];
+    double seconds = (double)(GetTickCount64() - sw->msStart) / 1000.0;
+    SearchJob *job = sw->pJob;
+
+    if (!bDone)
+        StringCchPrintfW(szStatus, 640, L"Searching... %lu results", (unsigned long)sw->nHits);
+    else if (job->bCapped)
+        StringCchPrintfW(szStatus, 640, L"Stopped at the first %lu results (%.1f s)", (unsigned long)sw->nHits, seconds);
+    /* ssh itself failed, or grep/find found nothing because of an error */
+    else if (job->dwExitCode == 255 || (job->dwExitCode > 1 && sw->nHits == 0))
+        StringCchPrintfW(szStatus, 640, L"Search failed: %s", job->szError[0] ? job->szError : L"(no message)");
+    else
+        StringCchPrintfW(szStatus, 640, L"%lu results (%.1f s)%s", (unsigned long)sw->nHits, seconds,
+            job->bSnapshot ? L" - from the last snapshot" :
+            job->dwExitCode > 1 ? L" - some folders could not be read" : L"");
+    SetWindowTextW(sw->hStatus, szStatus);
+}
+
+static void LayoutSearchWindow(HWND hWnd, SearchWindow *sw)
+{
+    RECT rc;
+    int cx, cy;
+
+    GetClientRect(hWnd, &rc);
+    cx = rc.right;
+    cy = rc.bottom;
+    MoveWindow(sw->hQuery, 8, 8, cx > 470 ? cx - 470 : 10, 24, TRUE);
+    MoveWindow(sw->hContents, cx > 454 ? cx - 454 : 26, 8, 170, 24, TRUE);
+    MoveWindow(sw->hSnapshot, cx > 278 ? cx - 278 : 26, 8, 170, 24, TRUE);
+    MoveWindow(sw->hButton, cx - 100, 7, 92, 26, TRUE);
+    MoveWindow(sw->hList, 8, 40, cx - 16, cy > 76 ? cy - 76 : 10, TRUE);
+    MoveWindow(sw->hStatus, 8, cy - 28, cx - 16, 22, TRUE);
+}
+
+static LRESULT CALLBACK SearchWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    SearchWindow *sw = (SearchWindow *)GetWindowLongPtrW(hWnd, GWLP_USERDATA);
+
+    switch (uMsg)
+    {
+    case WM_CREATE:
+    {
+        HFONT hFont = (HFONT)GetStockObject(DEFAULT_GUI_FONT);
+        HINSTANCE hInst = ((CREATESTRUCTW *)lParam)->hInstance;
+        LVCOLUMNW col = {0};
+
+        sw = (SearchWindow *)((CREATESTRUCTW *)lParam)->lpCreateParams;
+        SetWindowLongPtrW(hWnd, GWLP_USERDATA, (LONG_PTR)sw);
+
+        sw->hQuery = CreateWindowExW(WS_EX_CLIENTEDGE, L"EDIT", L"",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP | ES_AUTOHSCROLL,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_QUERY, hInst, NULL);
+        sw->hContents = CreateWindowExW(0, L"BUTTON", L"Search file contents",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP | BS_AUTOCHECKBOX,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_CONTENTS, hInst, NULL);
+        sw->hSnapshot = CreateWindowExW(0, L"BUTTON", L"Use last snapshot",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP | BS_AUTOCHECKBOX | (sw->szIndex[0] ? 0 : WS_DISABLED),
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_SNAPSHOT, hInst, NULL);
+        sw->hButton = CreateWindowExW(0, L"BUTTON", L"Search",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP | BS_DEFPUSHBUTTON,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_SEARCH, hInst, NULL);
+        sw->hList = CreateWindowExW(WS_EX_CLIENTEDGE, WC_LISTVIEWW, L"",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP | LVS_REPORT | LVS_OWNERDATA | LVS_SHOWSELALWAYS | LVS_SINGLESEL,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_RESULTS, hInst, NULL);
+        sw->hStatus = CreateWindowExW(0, L"STATIC", L"Names match anywhere; * and ? work as in Explorer.",
+            WS_CHILD | WS_VISIBLE | SS_LEFTNOWORDWRAP,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_STATUS, hInst, NULL);
+        if (!sw->hQuery || !sw->hContents || !sw->hSnapshot || !sw->hButton || !sw->hList || !sw->hStatus)
+            return -1;
+
+        SendMessageW(sw->hQuery, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hContents, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hSnapshot, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hButton, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hList, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hStatus, WM_SETFONT, (WPARAM)hFont, FALSE);
+        ListView_SetExtendedListViewStyle(sw->hList, LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER);
+
+        col.mask = LVCF_TEXT | LVCF_WIDTH;
+        col.cx = 420;
+        col.pszText = L"Path";
+        ListView_InsertColumn(sw->hList, 0, &col);
+        col.cx = 480;
+        col.pszText = L"Match";
+        ListView_InsertColumn(sw->hList, 1, &col);
+
+        LayoutSearchWindow(hWnd, sw);
+        SetFocus(sw->hQuery);
+        return 0;
+    }
+
+    case WM_SIZE:
+        if (sw && sw->hList)
+            LayoutSearchWindow(hWnd, sw);
+        return 0;
+
+    case WM_SETFOCUS:
+        if (sw && sw->hQuery)
+            SetFocus(sw->hQuery);
+        return 0;
+
+    case WM_COMMAND:
+        /* Enter comes as IDOK from IsDialogMessage, wherever the focus is */
+        if (LOWORD(wParam) == IDOK && GetFocus() == sw->hList)
+        {
+            int iItem = ListView_GetNextItem(sw->hList, -1, LVNI_SELECTED);
+
+            if (iItem >= 0 && (size_t)iItem < sw->nHits)
+                ShellExecuteW(hWnd, NULL, sw->pHits[iItem].pszPath, NULL, NULL, SW_SHOWNORMAL);
+            return 0;
+        }
+        if (LOWORD(wParam) == IDC_SEARCH || LOWORD(wParam) == IDOK)
+        {
+            if (sw->pJob)
+            {
+                WCHAR szStatus[128];
+
+                EndSearch(sw, TRUE);
+                StringCchPrintfW(szStatus, 128, L"Stopped, %lu results", (unsigned long)sw->nHits);
+                SetWindowTextW(sw->hStatus, szStatus);
+            }
+            else
+            {
+                StartSearch(hWnd, sw);
+            }
+            return 0;
+        }
+        break;
+
+    case WM_NOTIFY:
+    {
+        NMHDR *pnm = (NMHDR *)lParam;
+
+        if (pnm->idFrom != IDC_RESULTS)
+            break;
+        if (pnm->code == LVN_GETDISPINFOW)
+        {
+            LVITEMW *pItem = &((NMLVDISPINFOW *)lParam)->item;
+
+            if ((pItem->mask & LVIF_TEXT) && (size_t)pItem->iItem < sw->nHits)
+            {
+                SearchHit *h = &sw->pHits[pItem->iItem];
+
+                /* The folder part is the same on every row */
+                if (pItem->iSubItem == 0)
+                    StringCchCopyW(pItem->pszText, pItem->cchTextMax, h->pszPath + sw->cchPrefix);
+                else
+                    StringCchCopyW(pItem->pszText, pItem->cchTextMax, h->pszMatch);
+            }
+            return 0;
+        }
+        if (pnm->code == LVN_ITEMACTIVATE)
+        {
+            int iItem = ((NMITEMACTIVATE *)lParam)->iItem;
+
+            if (iItem >= 0 && (size_t)iItem < sw->nHits)
+                ShellExecuteW(hWnd, NULL, sw->pHits[iItem].pszPath, NULL, NULL, SW_SHOWNORMAL);
+            return 0;
+        }
+        break;
+    }
+
+    case WM_SEARCH_RESULTS:
+    {
+        SearchBatch *b = (SearchBatch *)lParam;
+        size_t i;
+
+        if (wParam != sw->nGeneration)
+        {
+            for (i = 0; i < b->nHits; i++)
+                free(b->hits[i].pszPath);
+            free(b);
+            return 0;
+        }
+        if (sw->nHits + b->nHits > sw->nAlloc)
+        {
+            size_t nAlloc = sw->nAlloc ? sw->nAlloc * 2 : SEARCH_BATCH_SIZE * 4;
+            SearchHit *pHits;
+
+            while (nAlloc < sw->nHits + b->nHits)
+                nAlloc *= 2;
+            pHits = realloc(sw->pHits, nAlloc * sizeof(SearchHit));
+            if (!pHits)
+            {
+                for (i = 0; i < b->nHits; i++)
+                    free(b->hits[i].pszPath);
+                free(b);
+                return 0;
+            }
+            sw->pHits = pHits;
+            sw->nAlloc = nAlloc;
+        }
+        memcpy(sw->pHits + sw->nHits, b->hits, b->nHits * sizeof(SearchHit));
+        sw->nHits += b->nHits;
+        free(b);
+
+        /* Virtual list: only the visible rows are drawn */
+        ListView_SetItemCountEx(sw->hList, (int)sw->nHits, LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+        if (sw->pJob)
+            ShowSearchStatus(sw, FALSE);
+        return 0;
+    }
+
+    case WM_SEARCH_DONE:
+        if (sw->pJob && wParam == sw->nGeneration)
+        {
+            ShowSearchStatus(sw, TRUE);
+            EndSearch(sw, FALSE);
+        }
+        return 0;
+
+    case WM_DESTROY:
+        EndSearch(sw, TRUE);
+        PostQuitMessage(0);
+        return 0;
+    }
+
+    return DefWindowProcW(hWnd, uMsg, wParam, lParam);
+}
+
+int RunRemoteSearch(LPCWSTR pszFolder)
+{
+    SearchWindow *sw = NULL;
+    ResolveResult res;
+    INITCOMMONCONTROLSEX icc = {sizeof(INITCOMMONCONTROLSEX), ICC_LISTVIEW_CLASSES};
+    WNDCLASSEXW wc = {0};
+    WCHAR szTitle[MAX_PATH * 2];
+    HINSTANCE hInst = GetModuleHandleW(NULL);
+    HWND hWnd;
+    MSG msg;
+    BOOL bCoInit = FALSE;
+    int result = 1;
+
+    sw = calloc(1, sizeof(SearchWindow));
+    if (!sw)
+        return 1;
+    sw->pLoc = malloc(sizeof(SSHFSLocation));
+    if (!sw->pLoc)
+        goto cleanup;
+
+    StringCchCopyW(sw->szFolder, MAX_PATH, pszFolder);
+    if (!PathIsRootW(sw->szFolder))
+        PathRemoveBackslashW(sw->szFolder);
+    res = ResolveSSHFSPath(sw->szFolder, sw->pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(sw->szFolder, res, L"SSHFS-Win - Search");
+        goto cleanup;
+    }
+    if (!PathIsDirectoryW(sw->szFolder))
+    {
+        MessageBoxW(NULL, L"Select a folder to search in.", L"SSHFS-Win - Search", MB_OK | MB_ICONINFORMATION);
+        goto cleanup;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, sw->pLoc->szRemotePath, -1, sw->szRemote, sizeof(sw->szRemote), NULL, NULL);
+    sw->cchPrefix = wcslen(sw->szFolder);
+    if (sw->szFolder[sw->cchPrefix - 1] != L'\\')
+        sw->cchPrefix++;
+
+    /* The snapshot covers the whole mount; find the folder in it */
+    {
+        SSHFSLocation *pRoot = malloc(sizeof(SSHFSLocation));
+        char szRootRemote[MAX_PATH * 2 * 3];
+
+        if (pRoot && GetSnapshotPath(sw->szFolder, pRoot, sw->szIndex, MAX_PATH) &&
+            GetFileAttributesW(sw->szIndex) != INVALID_FILE_ATTRIBUTES)
+        {
+            WideCharToMultiByte(CP_UTF8, 0, pRoot->szRemotePath, -1, szRootRemote, sizeof(szRootRemote), NULL, NULL);
+            if (!RemotePathToLocal(sw->szRemote, szRootRemote, '/', sw->szSubPath, sizeof(sw->szSubPath)))
+                sw->szIndex[0] = L'\0';
+        }
+        else
+        {
+            sw->szIndex[0] = L'\0';
+        }
+        free(pRoot);
+    }
+
+    /* ShellExecute on the results may need COM */
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE));
+    InitCommonControlsEx(&icc);
+
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = SearchWndProc;
+    wc.hInstance = hInst;
+    wc.hCursor = LoadCursorW(NULL, IDC_ARROW);
+    wc.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+    wc.lpszClassName = L"SSHFSWinSearch";
+    RegisterClassExW(&wc);
+
+    StringCchPrintfW(szTitle, MAX_PATH * 2, L"Search %s on %s@%s", sw->szFolder, sw->pLoc->szUser, sw->pLoc->szHost);
+    hWnd = CreateWindowExW(0, wc.lpszClassName, szTitle, WS_OVERLAPPEDWINDOW,
+        CW_USEDEFAULT, CW_USEDEFAULT, 960, 600, NULL, NULL, hInst, sw);
+    if (hWnd)
+    {
+        ShowWindow(hWnd, SW_SHOWNORMAL);
+        while (GetMessageW(&msg, NULL, 0, 0) > 0)
+        {
+            /* Tab between the controls, Enter in the query searches */
+            if (IsDialogMessageW(hWnd, &msg))
+                continue;
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+        result = 0;
+    }
+
+cleanup:
+    if (bCoInit)
+        CoUninitialize();
+    while (sw->nHits > 0)
+        free(sw->pHits[--sw->nHits].pszPath);
+    free(sw->pHits);
+    free(sw->pLoc);
+    free(sw);
+    return result;
+}
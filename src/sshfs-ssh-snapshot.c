@@ -0,0 +1,512 @@
+/**
+ * sshfs-ssh-snapshot.c
+ *
+ * Snapshots of a mount's tree: sshfs-ssh.exe --snapshot <path>
+ *
+ * One find on the server lists the whole mount (the tree behind the drive
+ * root, wherever the verb was used) as NUL separated records, which are
+ * sorted into the index file (sshfs-index.c). Once an index exists, the
+ * next snapshot asks only for folders and what changed since, and merges
+ * that into the previous index, so the server still walks the tree but
+ * only the differences cross the network. The summary (changes, largest
+ * folders, newest files) opens as a text file; the index itself serves
+ * "Use last snapshot" in the search window.
+ */
+
+#define COBJMACROS
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shellapi.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-search.h"
+#include "sshfs-index.h"
+#include "sshfs-ssh.h"
+
+#define SNAPSHOT_MAX_CHANGES    500     /* Change lines in the report, the rest are counted */
+#define SNAPSHOT_MAX_LARGEST    30
+#define SNAPSHOT_MAX_NEWEST     50
+
+BOOL GetSnapshotPath(LPCWSTR pszPath, SSHFSLocation *pRootLoc, LPWSTR pszIndex, DWORD cchIndex)
+{
+    WCHAR szRoot[MAX_PATH];
+
+    StringCchCopyW(szRoot, MAX_PATH, pszPath);
+    if (!PathStripToRootW(szRoot) || ResolveSSHFSPath(szRoot, pRootLoc) != RESOLVE_OK)
+        return FALSE;
+    return GetCacheFilePath(pRootLoc, L"snapshots", L".idx", pszIndex, cchIndex);
+}
+
+void CloseSnapshot(SnapshotView *v)
+{
+    if (v->pView)
+        UnmapViewOfFile(v->pView);
+    if (v->hMapping)
+        CloseHandle(v->hMapping);
+    if (v->hFile && v->hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(v->hFile);
+    ZeroMemory(v, sizeof(*v));
+}
+
+BOOL OpenSnapshot(LPCWSTR pszIndex, SnapshotView *v)
+{
+    LARGE_INTEGER liSize;
+
+    ZeroMemory(v, sizeof(*v));
+    v->hFile = CreateFileW(pszIndex, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (v->hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(v->hFile, &liSize) ||
+        liSize.QuadPart < (LONGLONG)sizeof(IndexHeader) || (ULONGLONG)liSize.QuadPart > (SIZE_T)-1)
+        goto fail;
+    v->hMapping = CreateFileMappingW(v->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!v->hMapping)
+        goto fail;
+    v->pView = MapViewOfFile(v->hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (v->pView && IndexOpen(&v->ix, v->pView, (size_t)liSize.QuadPart))
+        return TRUE;
+
+fail:
+    CloseSnapshot(v);
+    return FALSE;
+}
+
+/**
+ * State while the listing arrives, and the changes found when merging
+ */
+typedef struct SnapshotListing {
+    IndexBuilder *pEntries;         /* Everything, or the changes (delta) */
+    IndexBuilder *pListed;          /* Delta: folders listed in full */
+    long long snapshotTime;         /* From "#time", -1 until seen */
+    BOOL bFailed;                   /* Out of memory */
+    unsigned long nChanges[3];      /* By IndexChange */
+    char *ppszChanges[SNAPSHOT_MAX_CHANGES];
+    size_t nShown;
+} SnapshotListing;
+
+static void TakeSnapshotRecord(const SearchResult *r, void *pContext)
+{
+    SnapshotListing *sl = (SnapshotListing *)pContext;
+    const char *pszPath;
+    unsigned long long size;
+    long long mtime;
+    char type;
+
+    if (strncmp(r->pszPath, "#time ", 6) == 0)
+    {
+        sl->snapshotTime = _atoi64(r->pszPath + 6);
+        return;
+    }
+    if (strncmp(r->pszPath, "#list ", 6) == 0)
+    {
+        pszPath = r->pszPath + 6;
+        if (pszPath[0] == '.' && pszPath[1] == '/')
+            pszPath += 2;
+        if (!IndexBuilderAdd(sl->pListed, pszPath, 'd', 0, 0))
+            sl->bFailed = TRUE;
+        return;
+    }
+    if (IndexParseRecord(r->pszPath, &type, &size, &mtime, &pszPath) &&
+        !IndexBuilderAdd(sl->pEntries, pszPath, type, size, mtime))
+        sl->bFailed = TRUE;
+}
+
+static void TakeSnapshotChange(IndexChange change, const char *pszPath, void *pContext)
+{
+    SnapshotListing *sl = (SnapshotListing *)pContext;
+    static const char prefix[] = "+*-";
+    size_t cch;
+
+    sl->nChanges[change]++;
+    if (sl->nShown == SNAPSHOT_MAX_CHANGES)
+        return;
+    cch = strlen(pszPath);
+    sl->ppszChanges[sl->nShown] = malloc(cch + 3);
+    if (!sl->ppszChanges[sl->nShown])
+        return;
+    sl->ppszChanges[sl->nShown][0] = prefix[change];
+    sl->ppszChanges[sl->nShown][1] = ' ';
+    memcpy(sl->ppszChanges[sl->nShown] + 2, pszPath, cch + 1);
+    sl->nShown++;
+}
+
+static int WriteSnapshotData(const void *p, size_t cb, void *pContext)
+{
+    DWORD cbWritten;
+
+    while (cb > 0)
+    {
+        DWORD n = cb > 0x40000000 ? 0x40000000 : (DWORD)cb;
+        if (!WriteFile((HANDLE)pContext, p, n, &cbWritten, NULL) || cbWritten != n)
+            return 0;
+        p = (const char *)p + n;
+        cb -= n;
+    }
+    return 1;
+}
+
+/**
+ * Report line: size or date, then the path on the drive
+ */
+static void ReportPutEntry(ReportWriter *w, const char *pszLead, const char *pszRoot, const char *pszPath)
+{
+    ReportPutStr(w, "    ");
+    ReportPutStr(w, pszLead);
+    ReportPutStr(w, "  ");
+    ReportPutStr(w, pszRoot);
+    for (const char *p = pszPath; *p; p++)
+        ReportPut(w, *p == '/' ? "\\" : p, 1);
+    ReportPutStr(w, "\r\n");
+}
+
+int RunSnapshot(LPCWSTR pszPath)
+{
+    SSHFSLocation *pLoc = NULL;
+    SnapshotListing *sl = NULL;
+    SnapshotView old = {0}, cur = {0};
+    IndexBuilder *pMerged = NULL;
+    IndexCursor *pCursor = NULL;
+    SearchParser parser = {0};
+    LPCWSTR pszTitle = L"SSHFS-Win - Snapshot";
+    char *pszRemote = NULL;
+    char *pszCmd = NULL;
+    char *pBuffer = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd, i, n;
+    size_t top[SNAPSHOT_MAX_NEWEST];
+    WCHAR szIndex[MAX_PATH];
+    WCHAR szIndexNew[MAX_PATH];
+    WCHAR szRoot[MAX_PATH];
+    WCHAR szReport[MAX_PATH];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szLine[MAX_PATH * 2];
+    WCHAR szError[1024];
+    char szRootA[MAX_PATH * 3];
+    char szText[256], szLead[64];
+    HANDLE hOutRead = NULL, hOutWrite = NULL, hErr = INVALID_HANDLE_VALUE;
+    HANDLE hIndex = INVALID_HANDLE_VALUE;
+    PROCESS_INFORMATION pi = {0};
+    IProgressDialog *pDlg = NULL;
+    ReportWriter w = {INVALID_HANDLE_VALUE, NULL, 0, FALSE};
+    ULONGLONG msStart, msLastUpdate = 0;
+    long long since;
+    BOOL bDelta;
+    BOOL bHasPassword = FALSE;
+    BOOL bCancelled = FALSE;
+    BOOL bCoInit = FALSE;
+    BOOL bStarted;
+    DWORD dwExitCode = 1;
+    int result = 1;
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    sl = calloc(1, sizeof(SnapshotListing));
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    pBuffer = malloc(DOWNLOAD_READ_SIZE);
+    pCursor = malloc(sizeof(IndexCursor));
+    if (!pLoc || !sl || !pszRemote || !pszCmdLine || !pBuffer || !pCursor)
+        goto cleanup;
+    sl->snapshotTime = -1;
+
+    if (!GetSnapshotPath(pszPath, pLoc, szIndex, MAX_PATH))
+    {
+        ShowResolveError(pszPath, ResolveSSHFSPath(pszPath, pLoc), pszTitle);
+        goto cleanup;
+    }
+    StringCchCopyW(szRoot, MAX_PATH, pszPath);
+    PathStripToRootW(szRoot);
+    PathAddBackslashW(szRoot);
+    WideCharToMultiByte(CP_UTF8, 0, szRoot, -1, szRootA, (int)sizeof(szRootA), NULL, NULL);
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+
+    /* A previous snapshot turns this one into a delta */
+    bDelta = OpenSnapshot(szIndex, &old);
+    since = bDelta ? old.ix.pHeader->snapshotTime : -1;
+
+    sl->pEntries = IndexBuilderCreate();
+    sl->pListed = IndexBuilderCreate();
+    if (!sl->pEntries || !sl->pListed || !SearchParserInit(&parser, 0))
+        goto cleanup;
+
+    cbCmd = RemoteBuildSnapshotCommand(pszRemote, since, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW)
+        goto cleanup;
+    RemoteBuildSnapshotCommand(pszRemote, since, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* -C: a listing compresses several times over */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T -C%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    if (!CreateSSHPipe(&hOutRead, &hOutWrite, FALSE, DOWNLOAD_PIPE_SIZE))
+        goto cleanup;
+    hErr = CreateScratchFile();
+
+    bStarted = SpawnSSH(pszCmdLine, NULL, hOutWrite, hErr != INVALID_HANDLE_VALUE ? hErr : NULL,
+        CREATE_NO_WINDOW, szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    CloseHandle(hOutWrite);
+    hOutWrite = NULL;
+
+    if (!bStarted)
+    {
+        StringCchPrintfW(szError, 1024, L"Failed to start ssh.exe.\nError code: %lu", GetLastError());
+        MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
+    if (SUCCEEDED(CoCreateInstance(&CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IProgressDialog, (void **)&pDlg)))
+    {
+        IProgressDialog_SetTitle(pDlg, L"Snapshot");
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"Listing %s on %s@%s%s", pLoc->szRemotePath,
+            pLoc->szUser, pLoc->szHost, bDelta ? L" (changes only)" : L"");
+        IProgressDialog_SetLine(pDlg, 1, szLine, FALSE, NULL);
+        IProgressDialog_StartProgressDialog(pDlg, NULL, NULL, PROGDLG_NORMAL | PROGDLG_MARQUEEPROGRESS, NULL);
+    }
+
+    msStart = GetTickCount64();
+    for (;;)
+    {
+        DWORD dwAvail = 0, bytesRead;
+        ULONGLONG msNow;
+
+        /* Poll so the Cancel button is honoured while the server is busy */
+        if (!PeekNamedPipe(hOutRead, NULL, 0, NULL, &dwAvail, NULL))
+            break;
+
+        if (dwAvail == 0)
+        {
+            if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+            {
+                bCancelled = TRUE;
+                TerminateProcess(pi.hProcess, 1);
+                break;
+            }
+            Sleep(10);
+            continue;
+        }
+
+        if (!ReadFile(hOutRead, pBuffer, DOWNLOAD_READ_SIZE, &bytesRead, NULL) || bytesRead == 0)
+            break;
+        SearchParserFeed(&parser, pBuffer, bytesRead, TakeSnapshotRecord, sl);
+        if (sl->bFailed)
+        {
+            TerminateProcess(pi.hProcess, 1);
+            break;
+        }
+
+        msNow = GetTickCount64();
+        if (pDlg && msNow - msLastUpdate >= 250)
+        {
+            msLastUpdate = msNow;
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"%lu entries (%.0f/s)",
+                (unsigned long)IndexBuilderCount(sl->pEntries),
+                (double)IndexBuilderCount(sl->pEntries) * 1000.0 / (double)(msNow - msStart + 1));
+            IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+        }
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    if (bCancelled)
+        goto cleanup;
+
+    /* find exits 1 for unreadable folders; without "#time" nothing ran */
+    if (sl->bFailed || dwExitCode == 255 || sl->snapshotTime < 0)
+    {
+        szError[0] = L'\0';
+        if (hErr != INVALID_HANDLE_VALUE)
+            ReadErrorTail(hErr, szError, 1024);
+        StringCchPrintfW(szLine, MAX_PATH * 2, sl->bFailed ? L"Out of memory while listing %s." :
+            L"Listing %s on the server failed.", pLoc->szRemotePath);
+        StringCchPrintfW(szError + wcslen(szError), 1024 - wcslen(szError), L"%s%s",
+            szError[0] ? L"\n\n" : L"", szLine);
+        MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    if (pDlg)
+        IProgressDialog_SetLine(pDlg, 2, L"Building the index...", FALSE, NULL);
+    if (bDelta)
+    {
+        pMerged = IndexBuilderCreate();
+        if (!pMerged || !IndexBuildDelta(&old.ix, sl->pEntries, sl->pListed, pMerged, TakeSnapshotChange, sl))
+            goto cleanup;
+    }
+
+    /* Written next to the old one and swapped in, so a failure keeps it */
+    StringCchPrintfW(szIndexNew, MAX_PATH, L"%s.new", szIndex);
+    StringCchCopyW(szLine, MAX_PATH * 2, szIndex);
+    PathRemoveFileSpecW(szLine);
+    SHCreateDirectoryExW(NULL, szLine, NULL);
+    hIndex = CreateFileW(szIndexNew, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hIndex == INVALID_HANDLE_VALUE ||
+        !IndexBuilderWrite(pMerged ? pMerged : sl->pEntries, sl->snapshotTime, WriteSnapshotData, hIndex))
+    {
+        StringCchPrintfW(szError, 1024, L"Could not write the index\n\n%s", szIndexNew);
+        MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONERROR);
+        if (hIndex != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(hIndex);
+            hIndex = INVALID_HANDLE_VALUE;
+            DeleteFileW(szIndexNew);
+        }
+        goto cleanup;
+    }
+    CloseHandle(hIndex);
+    hIndex = INVALID_HANDLE_VALUE;
+    CloseSnapshot(&old);
+    if (!MoveFileExW(szIndexNew, szIndex, MOVEFILE_REPLACE_EXISTING) || !OpenSnapshot(szIndex, &cur))
+        goto cleanup;
+
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+        pDlg = NULL;
+    }
+
+    /* Summary */
+    GetTempPathW(MAX_PATH, szReport);
+    StringCchPrintfW(szLine, MAX_PATH * 2, L"sshfs-snapshot-%s.txt", pLoc->szHost);
+    if (!PathAppendW(szReport, szLine))
+        goto cleanup;
+    w.pBuffer = pBuffer;
+    w.hFile = CreateFileW(szReport, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL);
+    if (w.hFile == INVALID_HANDLE_VALUE)
+        goto cleanup;
+
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szHost, -1, szText, (int)sizeof(szText), NULL, NULL);
+    ReportPutStr(&w, "Snapshot of ");
+    ReportPutStr(&w, szText);
+    ReportPutStr(&w, ":");
+    ReportPutStr(&w, pszRemote);
+    ReportPutStr(&w, " (");
+    ReportPutStr(&w, szRootA);
+    FormatUnixTime(sl->snapshotTime, szLead, sizeof(szLead));
+    FormatSize(cur.ix.pHeader->cbTotal, szText, sizeof(szText));
+    ReportPutStr(&w, ") taken ");
+    ReportPutStr(&w, szLead);
+    StringCchPrintfA(szLead, sizeof(szLead), "\r\n%lu entries, ", (unsigned long)cur.ix.nEntries);
+    ReportPutStr(&w, szLead);
+    ReportPutStr(&w, szText);
+    StringCchPrintfA(szText, sizeof(szText), " in files, listed in %.1f s%s\r\n\r\n",
+        (double)(GetTickCount64() - msStart) / 1000.0, bDelta ? " (changes only)" : "");
+    ReportPutStr(&w, szText);
+
+    if (bDelta)
+    {
+        FormatUnixTime(since, szLead, sizeof(szLead));
+        StringCchPrintfA(szText, sizeof(szText), "Since the previous snapshot (%s): %lu added, %lu changed, %lu removed\r\n",
+            szLead, sl->nChanges[INDEX_ADDED], sl->nChanges[INDEX_CHANGED], sl->nChanges[INDEX_REMOVED]);
+        ReportPutStr(&w, szText);
+        for (i = 0; i < sl->nShown; i++)
+        {
+            szLead[0] = sl->ppszChanges[i][0];
+            szLead[1] = '\0';
+            ReportPutEntry(&w, szLead, szRootA, sl->ppszChanges[i] + 2);
+        }
+        if (sl->nShown < sl->nChanges[0] + sl->nChanges[1] + sl->nChanges[2])
+            ReportPutStr(&w, "    ...\r\n");
+        ReportPutStr(&w, "\r\n");
+    }
+
+    ReportPutStr(&w, "Largest folders:\r\n");
+    n = IndexLargest(&cur.ix, 'd', top, SNAPSHOT_MAX_LARGEST);
+    for (i = 0; i < n; i++)
+    {
+        IndexCursorSeek(pCursor, &cur.ix, top[i]);
+        if (!IndexCursorNext(pCursor))
+            break;
+        FormatSize(cur.ix.pEntries[top[i]].size, szLead, sizeof(szLead));
+        ReportPutEntry(&w, szLead, szRootA, pCursor->szPath);
+    }
+
+    ReportPutStr(&w, "\r\nMost recently modified files:\r\n");
+    n = IndexNewest(&cur.ix, 'f', top, SNAPSHOT_MAX_NEWEST);
+    for (i = 0; i < n; i++)
+    {
+        IndexCursorSeek(pCursor, &cur.ix, top[i]);
+        if (!IndexCursorNext(pCursor))
+            break;
+        FormatUnixTime(cur.ix.pEntries[top[i]].mtime, szLead, sizeof(szLead));
+        ReportPutEntry(&w, szLead, szRootA, pCursor->szPath);
+    }
+    ReportFlush(&w);
+    CloseHandle(w.hFile);
+
+    ShellExecuteW(NULL, L"open", szReport, NULL, NULL, SW_SHOWNORMAL);
+    result = 0;
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+    }
+    if (pi.hProcess)
+    {
+        TerminateProcess(pi.hProcess, 1);
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+    }
+    if (hOutRead)
+        CloseHandle(hOutRead);
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    if (bCoInit)
+        CoUninitialize();
+    CloseSnapshot(&old);
+    CloseSnapshot(&cur);
+    SearchParserFree(&parser);
+    if (sl)
+    {
+        IndexBuilderFree(sl->pEntries);
+        IndexBuilderFree(sl->pListed);
+        while (sl->nShown > 0)
+            free(sl->ppszChanges[--sl->nShown]);
+    }
+    IndexBuilderFree(pMerged);
+    free(pCursor);
+    free(sl);
+    free(pLoc);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    free(pBuffer);
+    return result;
+}
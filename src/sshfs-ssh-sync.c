@@ -0,0 +1,579 @@
+/**
+ * sshfs-ssh-sync.c
+ *
+ * Delta sync of an edited file: sshfs-ssh.exe --sync <folder> [<local file>]
+ *
+ * Saving a big file onto the drive rewrites all of it over SFTP. Here the
+ * server lists its copy's blocks (cksum and sha256sum per block), the
+ * local file is scanned for those blocks at any offset on several threads
+ * (sshfs-delta.c), and only the bytes the server does not have go back
+ * over the same channel, with the operations that rebuild the file from
+ * its old blocks. The server checks the rebuilt file against the local
+ * digest before replacing the old one.
+ *
+ * <folder> is the mounted folder holding the server copy, <local file> the
+ * edited local file (asked for if missing); the server copy is the file of
+ * the same name in <folder>.
+ */
+
+#define COBJMACROS
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-hash.h"
+#include "sshfs-delta.h"
+#include "sshfs-ssh.h"
+
+#define SYNC_MAX_THREADS    16
+#define SYNC_PIPE_SIZE      (1024 * 1024)
+#define SYNC_WRITE_SIZE     (1024 * 1024)
+
+/**
+ * One range of the local file scanned for the server's blocks
+ */
+typedef struct SyncRange {
+    const DeltaSignature *s;
+    const unsigned char *pData;
+    unsigned long long cbData;
+    unsigned long long offStart, offEnd;
+    DeltaMatches matches;
+    volatile unsigned long long cbDone;
+    volatile int *pbCancel;
+    BOOL bFailed;
+} SyncRange;
+
+/**
+ * Whole-file digest of the local file, checked by the server after the rebuild
+ */
+typedef struct SyncDigest {
+    const unsigned char *pData;
+    unsigned long long cbData;
+    unsigned char digest[HASH_SIZE];
+    volatile unsigned long long cbDone;
+    volatile int *pbCancel;
+} SyncDigest;
+
+static DWORD WINAPI SyncScanThread(LPVOID pParam)
+{
+    SyncRange *r = (SyncRange *)pParam;
+
+    if (!DeltaScanRange(r->s, r->pData, r->cbData, r->offStart, r->offEnd, &r->matches,
+        &r->cbDone, r->pbCancel))
+        r->bFailed = TRUE;
+    return 0;
+}
+
+static DWORD WINAPI SyncDigestThread(LPVOID pParam)
+{
+    SyncDigest *d = (SyncDigest *)pParam;
+    unsigned long long o;
+    Sha256 h;
+
+    Sha256Init(&h);
+    for (o = 0; o < d->cbData && !*d->pbCancel; o += SYNC_WRITE_SIZE)
+    {
+        Sha256Update(&h, d->pData + o, (size_t)(d->cbData - o < SYNC_WRITE_SIZE ? d->cbData - o : SYNC_WRITE_SIZE));
+        d->cbDone = o;
+    }
+    Sha256Final(&h, d->digest);
+    d->cbDone = d->cbData;
+    return 0;
+}
+
+/**
+ * Read whatever ssh has printed into the signature parser. FALSE once
+ * ssh has exited and everything was read.
+ */
+static BOOL PollSyncOutput(HANDLE hOutRead, char *pBuffer, DeltaSignature *s)
+{
+    DWORD dwAvail = 0, bytesRead;
+
+    if (!PeekNamedPipe(hOutRead, NULL, 0, NULL, &dwAvail, NULL))
+        return FALSE;
+    if (dwAvail == 0)
+        return TRUE;
+    if (!ReadFile(hOutRead, pBuffer, SYNC_PIPE_SIZE, &bytesRead, NULL) || bytesRead == 0)
+        return FALSE;
+    DeltaSignatureFeed(s, pBuffer, bytesRead);
+    return TRUE;
+}
+
+/**
+ * Write all of cb bytes to ssh's stdin. FALSE if ssh went away.
+ */
+static BOOL WriteSyncInput(HANDLE hInWrite, const void *p, size_t cb)
+{
+    DWORD dwWritten;
+
+    while (cb > 0)
+    {
+        if (!WriteFile(hInWrite, p, (DWORD)(cb < SYNC_WRITE_SIZE ? cb : SYNC_WRITE_SIZE), &dwWritten, NULL) ||
+            dwWritten == 0)
+            return FALSE;
+        p = (const char *)p + dwWritten;
+        cb -= dwWritten;
+    }
+    return TRUE;
+}
+
+int RunDeltaSync(LPCWSTR pszFolder, LPCWSTR pszLocal)
+{
+    SSHFSLocation *pLoc = NULL;
+    ResolveResult res;
+    DeltaSignature *s = NULL;
+    DeltaPlan plan = {0};
+    SyncRange *pRanges = NULL;
+    SyncDigest digest = {0};
+    DeltaMatches *pMatches = NULL;
+    HANDLE hThreads[SYNC_MAX_THREADS + 1];
+    int nThreads = 0, nRanges = 0, i;
+    char *pBuffer = NULL;
+    char *pszRemote = NULL;
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd, cbBlock;
+    WCHAR szLocal[MAX_PATH];
+    WCHAR szTarget[MAX_PATH];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szLine[MAX_PATH * 2];
+    WCHAR szError[1024];
+    char szHex[HASH_HEX_LEN + 1];
+    char szHeader[128];
+    SYSTEM_INFO si2;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+    const unsigned char *pData = NULL;
+    LARGE_INTEGER liSize;
+    unsigned long long cbData;
+    HANDLE hInRead = NULL, hInWrite = NULL;
+    HANDLE hOutRead = NULL, hOutWrite = NULL;
+    HANDLE hErr = INVALID_HANDLE_VALUE;
+    PROCESS_INFORMATION pi = {0};
+    IProgressDialog *pDlg = NULL;
+    ULONGLONG msStart;
+    volatile int bStop = 0;
+    BOOL bHasPassword = FALSE;
+    BOOL bCancelled = FALSE;
+    BOOL bSent = FALSE;
+    BOOL bCoInit = FALSE;
+    BOOL bStarted;
+    DWORD dwExitCode = 1;
+    int result = 1;
+
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
+
+    if (pszLocal)
+        StringCchCopyW(szLocal, MAX_PATH, pszLocal);
+    else if (!PickLocalPath(L"Choose the local file to sync to the server", FOS_FILEMUSTEXIST, szLocal, MAX_PATH))
+        goto cleanup;
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    s = malloc(sizeof(DeltaSignature));
+    pBuffer = malloc(SYNC_PIPE_SIZE);
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!pLoc || !s || !pBuffer || !pszRemote || !pszCmdLine)
+        goto cleanup;
+    DeltaSignatureInit(s, 0);
+
+    /* The server copy has the local file's name */
+    if (!PathCombineW(szTarget, pszFolder, PathFindFileNameW(szLocal)))
+        goto cleanup;
+    res = ResolveSSHFSPath(szTarget, pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(szTarget, res, L"SSHFS-Win - Sync");
+        goto cleanup;
+    }
+
+    hFile = CreateFileW(szLocal, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &liSize))
+    {
+        StringCchPrintfW(szError, 1024, L"Cannot read %s (error %lu).", szLocal, GetLastError());
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Sync", MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+    cbData = (unsigned long long)liSize.QuadPart;
+
+    /* Scanned in place: the threads and the sender share one view */
+    if (cbData > 0)
+    {
+        if (cbData <= (SIZE_T)-1)
+            hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping)
+            pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!pData)
+        {
+            MessageBoxW(NULL, L"The local file is too large to map into memory.",
+                L"SSHFS-Win - Sync", MB_OK | MB_ICONERROR);
+            goto cleanup;
+        }
+    }
+
+    cbBlock = DeltaBlockSize(cbData);
+    DeltaSignatureInit(s, cbBlock);
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+    cbCmd = RemoteBuildDeltaCommand(pszRemote, cbBlock, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW)
+        goto cleanup;
+    RemoteBuildDeltaCommand(pszRemote, cbBlock, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    /* Block list on stdout, the changes back on stdin, errors to a temp file */
+    if (!CreateSSHPipe(&hInWrite, &hInRead, TRUE, SYNC_PIPE_SIZE) ||
+        !CreateSSHPipe(&hOutRead, &hOutWrite, FALSE, SYNC_PIPE_SIZE))
+        goto cleanup;
+    hErr = CreateScratchFile();
+    if (hErr == INVALID_HANDLE_VALUE)
+        goto cleanup;
+
+    bStarted = SpawnSSH(pszCmdLine, hInRead, hOutWrite, hErr, CREATE_NO_WINDOW,
+        szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+
+    CloseHandle(hInRead);
+    hInRead = NULL;
+    CloseHandle(hOutWrite);
+    hOutWrite = NULL;
+
+    if (!bStarted)
+    {
+        StringCchPrintfW(szError, 1024, L"Failed to start ssh.exe.\nError code: %lu", GetLastError());
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Sync", MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    if (SUCCEEDED(CoCreateInstance(&CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IProgressDialog, (void **)&pDlg)))
+    {
+        IProgressDialog_SetTitle(pDlg, L"Syncing changes");
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"Syncing %s to %s@%s:%s",
+            PathFindFileNameW(szLocal), pLoc->szUser, pLoc->szHost, pLoc->szRemotePath);
+        IProgressDialog_SetLine(pDlg, 1, szLine, FALSE, NULL);
+        IProgressDialog_StartProgressDialog(pDlg, NULL, NULL, PROGDLG_NORMAL | PROGDLG_AUTOTIME, NULL);
+    }
+    msStart = GetTickCount64();
+
+    /* 1. The server copy's blocks */
+    while (!s->bEnd && !s->bNotFile && PollSyncOutput(hOutRead, pBuffer, s))
+    {
+        if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+        {
+            bCancelled = TRUE;
+            goto finish;
+        }
+        if (pDlg && s->bSize)
+        {
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"Reading block checksums on the server: %lu of %llu blocks",
+                (unsigned long)s->nBlocks, (s->cbFile + cbBlock - 1) / cbBlock);
+            IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+            IProgressDialog_SetProgress64(pDlg, s->nBlocks, (s->cbFile + cbBlock - 1) / cbBlock + 1);
+        }
+        WaitForSingleObject(pi.hProcess, 50);
+    }
+    if (!s->bEnd)
+        goto finish;
+    if (!DeltaSignatureIndex(s))
+        goto finish;
+
+    /* 2. Scan the local file for them on all processors, and hash it whole meanwhile */
+    GetSystemInfo(&si2);
+    nRanges = (int)si2.dwNumberOfProcessors;
+    if (nRanges > SYNC_MAX_THREADS)
+        nRanges = SYNC_MAX_THREADS;
+    if (nRanges < 1)
+        nRanges = 1;
+    pRanges = calloc(nRanges, sizeof(SyncRange));
+    pMatches = calloc(nRanges, sizeof(DeltaMatches));
+    if (!pRanges || !pMatches)
+        goto finish;
+
+    digest.pData = pData;
+    digest.cbData = cbData;
+    digest.pbCancel = &bStop;
+    hThreads[nThreads] = CreateThread(NULL, 0, SyncDigestThread, &digest, 0, NULL);
+    if (!hThreads[nThreads])
+        goto finish;
+    nThreads++;
+    for (i = 0; i < nRanges; i++)
+    {
+        pRanges[i].s = s;
+        pRanges[i].pData = pData;
+        pRanges[i].cbData = cbData;
+        pRanges[i].offStart = DeltaRangeStart(s, cbData, i, nRanges);
+        pRanges[i].offEnd = DeltaRangeStart(s, cbData, i + 1, nRanges);
+        pRanges[i].pbCancel = &bStop;
+        hThreads[nThreads] = CreateThread(NULL, 0, SyncScanThread, &pRanges[i], 0, NULL);
+        if (!hThreads[nThreads])
+        {
+            bStop = 1;
+            break;
+        }
+        nThreads++;
+    }
+
+    while (WaitForMultipleObjects((DWORD)nThreads, hThreads, TRUE, 250) == WAIT_TIMEOUT)
+    {
+        unsigned long long cbScanned = 0;
+
+        if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+        {
+            bCancelled = TRUE;
+            bStop = 1;
+            continue;
+        }
+        for (i = 0; i < nRanges; i++)
+            cbScanned += pRanges[i].cbDone;
+        if (pDlg)
+        {
+            StringCchPrintfW(szLine, MAX_PATH * 2, L"Matching blocks: %.1f of %.1f MB",
+                (double)cbScanned / (1024.0 * 1024.0), (double)cbData / (1024.0 * 1024.0));
+            IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+            IProgressDialog_SetProgress64(pDlg, cbScanned + digest.cbDone, cbData * 2 + 1);
+        }
+    }
+    for (i = 0; i < nThreads; i++)
+        CloseHandle(hThreads[i]);
+    nThreads = 0;
+    if (bCancelled)
+        goto finish;
+    for (i = 0; i < nRanges; i++)
+    {
+        if (pRanges[i].bFailed)
+            goto finish;
+        pMatches[i] = pRanges[i].matches;
+    }
+    if (bStop || !DeltaBuildPlan(s, pData, cbData, pMatches, nRanges, &plan))
+        goto finish;
+
+    /* Nothing to send: leaving out "#apply" ends the server side */
+    if (plan.bSame)
+    {
+        bSent = TRUE;
+        goto finish;
+    }
+
+    /* 3. The operations, then the literal bytes in their order */
+    HashToHex(digest.digest, szHex);
+    StringCchPrintfA(szHeader, sizeof(szHeader), "#apply %s %llu\n", szHex, cbData);
+    {
+        size_t cbOps = 0;
+        size_t k;
+
+        bSent = WriteSyncInput(hInWrite, szHeader, strlen(szHeader));
+        for (k = 0; bSent && k < plan.nOps; k++)
+        {
+            cbOps += DeltaFormatOp(&plan.pOps[k], pBuffer + cbOps);
+            if (cbOps > SYNC_PIPE_SIZE - 64 || k + 1 == plan.nOps)
+            {
+                bSent = WriteSyncInput(hInWrite, pBuffer, cbOps);
+                cbOps = 0;
+            }
+        }
+        if (bSent)
+            bSent = WriteSyncInput(hInWrite, ".\n", 2);
+    }
+    {
+        unsigned long long cbDone = 0, o;
+        size_t k;
+
+        for (k = 0; bSent && k < plan.nOps; k++)
+        {
+            const DeltaOp *op = &plan.pOps[k];
+
+            if (op->nBlocks > 0)
+                continue;
+            for (o = 0; bSent && o < op->cb; o += SYNC_WRITE_SIZE)
+            {
+                size_t cb = (size_t)(op->cb - o < SYNC_WRITE_SIZE ? op->cb - o : SYNC_WRITE_SIZE);
+
+                if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+                {
+                    bCancelled = TRUE;
+                    goto finish;
+                }
+                bSent = WriteSyncInput(hInWrite, pData + op->offset + o, cb);
+                cbDone += cb;
+                if (pDlg)
+                {
+                    double seconds = (double)(GetTickCount64() - msStart + 1) / 1000.0;
+                    StringCchPrintfW(szLine, MAX_PATH * 2, L"Sending changes: %.1f of %.1f MB (%.1f MB/s)",
+                        (double)cbDone / (1024.0 * 1024.0), (double)plan.cbLiteral / (1024.0 * 1024.0),
+                        (double)cbDone / (1024.0 * 1024.0) / seconds);
+                    IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+                    IProgressDialog_SetProgress64(pDlg, cbDone, plan.cbLiteral);
+                }
+            }
+        }
+    }
+
+    /* 4. The server rebuilds and checks the file once stdin ends */
+    CloseHandle(hInWrite);
+    hInWrite = NULL;
+    if (pDlg && bSent)
+        IProgressDialog_SetLine(pDlg, 2, L"Rebuilding the file on the server...", FALSE, NULL);
+    while (bSent && PollSyncOutput(hOutRead, pBuffer, s))
+    {
+        if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+        {
+            bCancelled = TRUE;
+            break;
+        }
+        WaitForSingleObject(pi.hProcess, 50);
+    }
+
+finish:
+    bStop = 1;
+    if (nThreads > 0)
+    {
+        WaitForMultipleObjects((DWORD)nThreads, hThreads, TRUE, INFINITE);
+        for (i = 0; i < nThreads; i++)
+            CloseHandle(hThreads[i]);
+    }
+    if (hInWrite)
+    {
+        CloseHandle(hInWrite);
+        hInWrite = NULL;
+    }
+    if (bCancelled)
+        TerminateProcess(pi.hProcess, 1);
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    while (PollSyncOutput(hOutRead, pBuffer, s) && !s->bOk && !s->bMismatch)
+        ;
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+        pDlg = NULL;
+    }
+
+    if (bCancelled)
+    {
+        result = 1;
+    }
+    else if (s->bEnd && plan.bSame)
+    {
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"%s is already the same on the server.", PathFindFileNameW(szLocal));
+        MessageBoxW(NULL, szLine, L"SSHFS-Win - Sync", MB_OK | MB_ICONINFORMATION);
+        result = 0;
+    }
+    else if (s->bOk)
+    {
+        double seconds = (double)(GetTickCount64() - msStart) / 1000.0;
+
+        SHChangeNotify(SHCNE_UPDATEITEM, SHCNF_PATHW, szTarget, NULL);
+        StringCchPrintfW(szError, 1024,
+            L"%s was synced in %.1f s.\n\n"
+            L"Sent: %.1f MB of changes (%.1f%% of the file)\n"
+            L"Reused on the server: %.1f MB in %lu blocks of %lu KB",
+            PathFindFileNameW(szLocal), seconds,
+            (double)plan.cbLiteral / (1024.0 * 1024.0),
+            cbData ? 100.0 * (double)plan.cbLiteral / (double)cbData : 0.0,
+            (double)plan.cbCopied / (1024.0 * 1024.0),
+            (unsigned long)((plan.cbCopied + cbBlock - 1) / cbBlock), (unsigned long)(cbBlock / 1024));
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Sync", MB_OK | MB_ICONINFORMATION);
+        result = 0;
+    }
+    else if (s->bNotFile)
+    {
+        StringCchPrintfW(szError, 1024,
+            L"There is no file named %s in this folder on the server.\n\n"
+            L"Only changes to an existing file can be synced; copy or upload new files.",
+            PathFindFileNameW(szLocal));
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Sync", MB_OK | MB_ICONWARNING);
+    }
+    else if (s->bMismatch)
+    {
+        MessageBoxW(NULL,
+            L"The file rebuilt on the server did not match the local one, so the server copy was left as it was.\n\n"
+            L"It may have changed during the sync. Try again.",
+            L"SSHFS-Win - Sync", MB_OK | MB_ICONERROR);
+    }
+    else
+    {
+        WCHAR szTail[512];
+
+        ReadErrorTail(hErr, szTail, 512);
+        StringCchPrintfW(szError, 1024, L"The sync failed (exit code %lu).\n\n%s", dwExitCode, szTail);
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Sync", MB_OK | MB_ICONERROR);
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hInRead)
+        CloseHandle(hInRead);
+    if (hInWrite)
+        CloseHandle(hInWrite);
+    if (hOutRead)
+        CloseHandle(hOutRead);
+    if (hOutWrite)
+        CloseHandle(hOutWrite);
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    if (pData)
+        UnmapViewOfFile(pData);
+    if (hMapping)
+        CloseHandle(hMapping);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+    if (pRanges)
+    {
+        for (i = 0; i < nRanges; i++)
+            DeltaMatchesFree(&pRanges[i].matches);
+    }
+    if (s)
+        DeltaSignatureFree(s);
+    DeltaPlanFree(&plan);
+    if (bCoInit)
+        CoUninitialize();
+    free(pRanges);
+    free(pMatches);
+    free(s);
+    free(pLoc);
+    free(pBuffer);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    return result;
+}
@@ -0,0 +1,484 @@
+/**
+ * sshfs-ssh-thumbs.c
+ *
+ * Thumbnails made on the server: sshfs-ssh.exe --thumbs <folder> [<first file>]
+ *
+ * Started by the thumbnail provider in the shell extension the first
+ * time Explorer asks it for an image of the folder that is not in the
+ * cache; <first file> (the image asked for) is made first. One ssh run
+ * makes the thumbnails of all of the folder's uncached images on the
+ * server and streams them back (RemoteBuildThumbCommand()), so Explorer
+ * no longer reads every image whole over SFTP to draw its thumbnail. Each
+ * one is written to %LOCALAPPDATA%\SSHFS-Win\thumbs as it arrives, which
+ * is where the provider picks it up, and the shell is told the file
+ * changed so that a view still showing its icon asks again.
+ *
+ * A named mutex (GetThumbBatchName()) keeps it to one run per folder. It
+ * runs without any window: there is nobody to tell about failures, and
+ * the provider falls back to reading the image itself.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-thumb.h"
+#include "sshfs-ssh.h"
+
+#define THUMB_PIPE_SIZE         (256 * 1024)
+#define THUMB_MAX_BATCH         2000        /* Images per run; the next run takes the rest */
+#define THUMB_DEFAULT_CACHE_MB  256
+
+/**
+ * State of one "--thumbs" run
+ */
+typedef struct ThumbBatch {
+    LPCWSTR pszFolder;
+    char **ppszNames;               /* UTF-8, in the order they were sent */
+    char **ppszKeys;                /* Cache key of each */
+    size_t nItems;
+    size_t iNext;                   /* The server answers in order */
+    int size;
+    char *pList;                    /* The names, one per line, for ssh's stdin */
+    size_t cbList;
+    HANDLE hInWrite;
+    unsigned long nWritten, nFailed;
+    BOOL bOutOfOrder;
+} ThumbBatch;
+
+/**
+ * Write a cache entry so that readers see all of it or nothing
+ */
+static BOOL WriteThumbEntry(const char *pszKey, long long mtime, int size, ThumbKind kind,
+    const void *pData, size_t cbData)
+{
+    WCHAR szFile[MAX_PATH];
+    WCHAR szNew[MAX_PATH];
+    WCHAR szDir[MAX_PATH];
+    char szHeader[MAX_PATH * 9 + 128];
+    size_t cbHeader;
+    HANDLE hFile;
+    DWORD cbWritten;
+    BOOL bOk;
+
+    cbHeader = ThumbCacheFormatHeader(pszKey, mtime, size, kind, cbData, szHeader, sizeof(szHeader));
+    if (cbHeader >= sizeof(szHeader) || !GetThumbEntryPath(pszKey, mtime, size, szFile, MAX_PATH) ||
+        FAILED(StringCchPrintfW(szNew, MAX_PATH, L"%s.new", szFile)))
+        return FALSE;
+
+    hFile = CreateFileW(szNew, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PATH_NOT_FOUND)
+    {
+        StringCchCopyW(szDir, MAX_PATH, szFile);
+        PathRemoveFileSpecW(szDir);
+        SHCreateDirectoryExW(NULL, szDir, NULL);
+        hFile = CreateFileW(szNew, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    }
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    bOk = WriteFile(hFile, szHeader, (DWORD)cbHeader, &cbWritten, NULL) && cbWritten == cbHeader &&
+        (cbData == 0 || (WriteFile(hFile, pData, (DWORD)cbData, &cbWritten, NULL) && cbWritten == cbData));
+    CloseHandle(hFile);
+    if (bOk)
+        bOk = MoveFileExW(szNew, szFile, MOVEFILE_REPLACE_EXISTING);
+    if (!bOk)
+        DeleteFileW(szNew);
+    return bOk;
+}
+
+/**
+ * Tell the views showing the image's icon that its thumbnail is in
+ */
+static void NotifyThumbEntry(const ThumbBatch *b, const char *pszName)
+{
+    WCHAR szName[MAX_PATH];
+    WCHAR szFile[MAX_PATH];
+
+    if (MultiByteToWideChar(CP_UTF8, 0, pszName, -1, szName, MAX_PATH) &&
+        PathCombineW(szFile, b->pszFolder, szName))
+        SHChangeNotify(SHCNE_UPDATEITEM, SHCNF_PATHW, szFile, NULL);
+}
+
+/**
+ * A frame from the server: its entry goes to the cache at once, so the
+ * provider can show it while the rest are made
+ */
+static void TakeThumbFrame(const ThumbFrame *pFrame, void *pContext)
+{
+    ThumbBatch *b = (ThumbBatch *)pContext;
+    const char *pszName;
+
+    if (b->bOutOfOrder || b->iNext >= b->nItems)
+    {
+        b->bOutOfOrder = TRUE;
+        return;
+    }
+    pszName = b->ppszNames[b->iNext];
+    if (strlen(pszName) != pFrame->cbName || memcmp(pszName, pFrame->pName, pFrame->cbName) != 0)
+    {
+        b->bOutOfOrder = TRUE;
+        return;
+    }
+
+    /* Keyed by the server's mtime: that is the file the thumbnail was made from */
+    if (WriteThumbEntry(b->ppszKeys[b->iNext], pFrame->mtime, b->size, pFrame->kind,
+        pFrame->pData, pFrame->cbData))
+    {
+        b->nWritten++;
+        NotifyThumbEntry(b, pszName);
+    }
+    if (pFrame->kind != THUMB_IMAGE)
+        b->nFailed++;
+    b->iNext++;
+}
+
+/**
+ * Thread: hand the list of names to ssh, then end its stdin
+ */
+static DWORD WINAPI ThumbListWriterThread(LPVOID pParam)
+{
+    ThumbBatch *b = (ThumbBatch *)pParam;
+    size_t pos = 0;
+    DWORD cbWritten;
+
+    while (pos < b->cbList && WriteFile(b->hInWrite, b->pList + pos,
+        (DWORD)(b->cbList - pos < 65536 ? b->cbList - pos : 65536), &cbWritten, NULL))
+        pos += cbWritten;
+    CloseHandle(b->hInWrite);
+    b->hInWrite = NULL;
+    return 0;
+}
+
+typedef struct ThumbCacheFile {
+    ULONGLONG time;
+    ULONGLONG cbSize;
+    WCHAR szPath[MAX_PATH];
+} ThumbCacheFile;
+
+static int CompareThumbCacheFiles(const void *a, const void *b)
+{
+    ULONGLONG x = ((const ThumbCacheFile *)a)->time, y = ((const ThumbCacheFile *)b)->time;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Keep the cache under cbLimit: the oldest entries go first, down to 3/4
+ * of the limit so that not every run has to prune
+ */
+static void PruneThumbCache(ULONGLONG cbLimit)
+{
+    WCHAR szCache[MAX_PATH];
+    WCHAR szPattern[MAX_PATH];
+    ThumbCacheFile *pFiles = NULL;
+    size_t nFiles = 0, nAlloc = 0, i;
+    ULONGLONG cbTotal = 0;
+    WIN32_FIND_DATAW fdDir, fd;
+    HANDLE hDirs, hFind;
+
+    if (!GetThumbCacheFolder(szCache, MAX_PATH) ||
+        FAILED(StringCchPrintfW(szPattern, MAX_PATH, L"%s\\*", szCache)))
+        return;
+    hDirs = FindFirstFileExW(szPattern, FindExInfoBasic, &fdDir, FindExSearchLimitToDirectories, NULL, 0);
+    if (hDirs == INVALID_HANDLE_VALUE)
+        return;
+    do
+    {
+        if (!(fdDir.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || fdDir.cFileName[0] == L'.')
+            continue;
+        if (FAILED(StringCchPrintfW(szPattern, MAX_PATH, L"%s\\%s\\*.thm", szCache, fdDir.cFileName)))
+            continue;
+        hFind = FindFirstFileExW(szPattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL,
+            FIND_FIRST_EX_LARGE_FETCH);
+        if (hFind == INVALID_HANDLE_VALUE)
+            continue;
+        do
+        {
+            if (nFiles == nAlloc)
+            {
+                ThumbCacheFile *pNew = realloc(pFiles, (nAlloc ? nAlloc * 2 : 1024) * sizeof(ThumbCacheFile));
+                if (!pNew)
+                    break;
+                pFiles = pNew;
+                nAlloc = nAlloc ? nAlloc * 2 : 1024;
+            }
+            pFiles[nFiles].time = ((ULONGLONG)fd.ftLastWriteTime.dwHighDateTime << 32) |
+                fd.ftLastWriteTime.dwLowDateTime;
+            pFiles[nFiles].cbSize = ((ULONGLONG)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+            if (SUCCEEDED(StringCchPrintfW(pFiles[nFiles].szPath, MAX_PATH, L"%s\\%s\\%s",
+                szCache, fdDir.cFileName, fd.cFileName)))
+            {
+                cbTotal += pFiles[nFiles].cbSize;
+                nFiles++;
+            }
+        } while (FindNextFileW(hFind, &fd));
+        FindClose(hFind);
+    } while (FindNextFileW(hDirs, &fdDir));
+    FindClose(hDirs);
+
+    if (cbTotal > cbLimit && pFiles)
+    {
+        qsort(pFiles, nFiles, sizeof(ThumbCacheFile), CompareThumbCacheFiles);
+        for (i = 0; i < nFiles && cbTotal > cbLimit / 4 * 3; i++)
+        {
+            if (DeleteFileW(pFiles[i].szPath))
+                cbTotal -= pFiles[i].cbSize;
+        }
+    }
+    free(pFiles);
+}
+
+int RunThumbnails(LPCWSTR pszFolder, LPCWSTR pszFirst)
+{
+    ThumbBatch b = {0};
+    ThumbParser parser;
+    SSHFSLocation *pLoc = NULL;
+    char *pszRemote = NULL;
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    char *pBuffer = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    char szServerKey[MAX_PATH * 3];
+    char szName[MAX_PATH * 3];
+    char szFirst[MAX_PATH * 3] = "";
+    WCHAR szFull[MAX_PATH];
+    WCHAR szPattern[MAX_PATH];
+    WCHAR szFile[MAX_PATH];
+    WCHAR szRemote[MAX_PATH * 2];
+    WCHAR szMutex[64];
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WIN32_FIND_DATAW fd;
+    PROCESS_INFORMATION pi = {0};
+    HANDLE hMutex = NULL;
+    HANDLE hFind = INVALID_HANDLE_VALUE;
+    HANDLE hInRead = NULL;
+    HANDLE hOutRead = NULL;
+    HANDLE hOutWrite = NULL;
+    HANDLE hWriter = NULL;
+    DWORD bytesRead;
+    BOOL bHasPassword = FALSE;
+    BOOL bStarted;
+    size_t cbList = 0;
+    size_t i;
+    int result = 1;
+
+    ThumbParserInit(&parser);
+    b.size = GetThumbnailSize();
+
+    if (!GetFullPathNameW(pszFolder, MAX_PATH, szFull, NULL))
+        StringCchCopyW(szFull, MAX_PATH, pszFolder);
+    b.pszFolder = szFull;
+    pLoc = malloc(sizeof(SSHFSLocation));
+    if (!pLoc || ResolveSSHFSPath(szFull, pLoc) != RESOLVE_OK || !GetThumbBatchName(pLoc, szMutex, 64))
+        goto cleanup;
+
+    /* Another run is on this folder already */
+    hMutex = CreateMutexW(NULL, TRUE, szMutex);
+    if (!hMutex || GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        result = 0;
+        goto cleanup;
+    }
+
+    /* A server without a thumbnailer is asked again only after a while */
+    if (!GetThumbKey(pLoc, L"", szServerKey, sizeof(szServerKey)) || IsThumbToolMissing(pLoc))
+    {
+        result = 0;
+        goto cleanup;
+    }
+
+    if (pszFirst)
+        WideCharToMultiByte(CP_UTF8, 0, PathFindFileNameW(pszFirst), -1, szFirst, (int)sizeof(szFirst), NULL, NULL);
+
+    /* The images whose entry for their current mtime is missing; the
+     * listing is metadata only, no file is read */
+    b.ppszNames = calloc(THUMB_MAX_BATCH, sizeof(char *));
+    b.ppszKeys = calloc(THUMB_MAX_BATCH, sizeof(char *));
+    if (!b.ppszNames || !b.ppszKeys || !PathCombineW(szPattern, szFull, L"*"))
+        goto cleanup;
+    hFind = FindFirstFileExW(szPattern, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL,
+        FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE)
+        goto cleanup;
+    do
+    {
+        char szKey[MAX_PATH * 9];
+        long long mtime = FileTimeToUnixTime(&fd.ftLastWriteTime);
+
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+            !WideCharToMultiByte(CP_UTF8, 0, fd.cFileName, -1, szName, (int)sizeof(szName), NULL, NULL) ||
+            !ThumbIsImageName(szName) || !PathCombineW(szFile, szFull, fd.cFileName))
+            continue;
+        BuildFullRemotePath(szFile, pLoc->szUNCPath, pLoc->szBasePath, pLoc->mountType, szRemote, MAX_PATH * 2);
+        if (!GetThumbKey(pLoc, szRemote, szKey, sizeof(szKey)) ||
+            !GetThumbEntryPath(szKey, mtime, b.size, szFile, MAX_PATH) ||
+            GetFileAttributesW(szFile) != INVALID_FILE_ATTRIBUTES)
+            continue;
+
+        b.ppszNames[b.nItems] = _strdup(szName);
+        b.ppszKeys[b.nItems] = _strdup(szKey);
+        if (!b.ppszNames[b.nItems] || !b.ppszKeys[b.nItems])
+            break;
+        cbList += strlen(szName) + 1;
+
+        /* The one Explorer is waiting for goes first */
+        if (b.nItems > 0 && strcmp(szName, szFirst) == 0)
+        {
+            char *pszSwap = b.ppszNames[0];
+            b.ppszNames[0] = b.ppszNames[b.nItems];
+            b.ppszNames[b.nItems] = pszSwap;
+            pszSwap = b.ppszKeys[0];
+            b.ppszKeys[0] = b.ppszKeys[b.nItems];
+            b.ppszKeys[b.nItems] = pszSwap;
+        }
+        b.nItems++;
+    } while (b.nItems < THUMB_MAX_BATCH && FindNextFileW(hFind, &fd));
+    FindClose(hFind);
+    hFind = INVALID_HANDLE_VALUE;
+
+    if (b.nItems == 0)
+    {
+        result = 0;
+        goto cleanup;
+    }
+
+    b.pList = malloc(cbList);
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    pBuffer = malloc(THUMB_PIPE_SIZE);
+    if (!b.pList || !pszRemote || !pBuffer)
+        goto cleanup;
+    for (i = 0; i < b.nItems; i++)
+    {
+        size_t cb = strlen(b.ppszNames[i]);
+        memcpy(b.pList + b.cbList, b.ppszNames[i], cb);
+        b.cbList += cb;
+        b.pList[b.cbList++] = '\n';
+    }
+
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+    cbCmd = RemoteBuildThumbCommand(pszRemote, b.size, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW || !pszCmdLine)
+        goto cleanup;
+    RemoteBuildThumbCommand(pszRemote, b.size, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    if (!FindSSH(szSSHPath, MAX_PATH))
+        goto cleanup;
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* JPEG data does not compress: no -C */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    if (!CreateSSHPipe(&b.hInWrite, &hInRead, TRUE, 0) ||
+        !CreateSSHPipe(&hOutRead, &hOutWrite, FALSE, THUMB_PIPE_SIZE))
+        goto cleanup;
+
+    bStarted = SpawnSSH(pszCmdLine, hInRead, hOutWrite, NULL,
+        CREATE_NO_WINDOW | BELOW_NORMAL_PRIORITY_CLASS,
+        szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    CloseHandle(hInRead);
+    hInRead = NULL;
+    CloseHandle(hOutWrite);
+    hOutWrite = NULL;
+    if (!bStarted)
+        goto cleanup;
+
+    hWriter = CreateThread(NULL, 0, ThumbListWriterThread, &b, 0, NULL);
+    if (!hWriter)
+    {
+        TerminateProcess(pi.hProcess, 1);
+        goto cleanup;
+    }
+
+    while (ReadFile(hOutRead, pBuffer, THUMB_PIPE_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    {
+        if (!ThumbParserFeed(&parser, pBuffer, bytesRead, TakeThumbFrame, &b) || b.bOutOfOrder)
+        {
+            TerminateProcess(pi.hProcess, 1);
+            break;
+        }
+    }
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    WaitForSingleObject(hWriter, INFINITE);
+
+    /* The images still showing their icon get Windows' own thumbnail now */
+    if (parser.bNoTool && WriteThumbEntry(szServerKey, 0, 0, THUMB_NO_TOOL, NULL, 0))
+    {
+        for (i = b.iNext; i < b.nItems; i++)
+            NotifyThumbEntry(&b, b.ppszNames[i]);
+    }
+    PruneThumbCache((ULONGLONG)GetThumbnailSetting(L"CacheMB", THUMB_DEFAULT_CACHE_MB) * 1024 * 1024);
+    result = parser.bEnd || parser.bNoTool ? 0 : 1;
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hWriter)
+        CloseHandle(hWriter);
+    if (pi.hProcess)
+    {
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+    }
+    if (b.hInWrite)
+        CloseHandle(b.hInWrite);
+    if (hInRead)
+        CloseHandle(hInRead);
+    if (hOutRead)
+        CloseHandle(hOutRead);
+    if (hOutWrite)
+        CloseHandle(hOutWrite);
+    if (hFind != INVALID_HANDLE_VALUE)
+        FindClose(hFind);
+    if (hMutex)
+    {
+        ReleaseMutex(hMutex);
+        CloseHandle(hMutex);
+    }
+    for (i = 0; i < b.nItems; i++)
+    {
+        free(b.ppszNames[i]);
+        free(b.ppszKeys[i]);
+    }
+    free(b.ppszNames);
+    free(b.ppszKeys);
+    free(b.pList);
+    ThumbParserFree(&parser);
+    free(pLoc);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    free(pBuffer);
+    return result;
+}
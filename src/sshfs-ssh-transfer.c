@@ -0,0 +1,271 @@
+/**
+ * sshfs-ssh-transfer.c
+ *
+ * Server-side copy/move for the shell extension's drag and drop menu:
+ * sshfs-ssh.exe --copy|--move <destination> <item>...
+ *
+ * The items are copied or moved into the destination folder with one ssh
+ * exec. The work runs as cp/mv on the server (sshfs-remote.c), so only
+ * progress lines cross the network. ssh gets a remote pty (-tt) so that
+ * cancelling, which terminates ssh, hangs up the remote shell and stops cp
+ * with it.
+ */
+
+#define COBJMACROS
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-ssh.h"
+
+int RunServerTransfer(RemoteOperation op, LPWSTR *ppszPaths, int nPaths)
+{
+    SSHFSLocation *pLocs = NULL;
+    char **ppszRemote = NULL;
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 32768;
+    size_t cbCmd;
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szLine[MAX_PATH * 2];
+    LPCWSTR pszVerb = (op == REMOTE_MOVE) ? L"Moving" : L"Copying";
+    HANDLE hOutRead = NULL, hOutWrite = NULL;
+    PROCESS_INFORMATION pi = {0};
+    IProgressDialog *pDlg = NULL;
+    RemoteProgress *pProgress = NULL;
+    BOOL bHasPassword = FALSE;
+    BOOL bCancelled = FALSE;
+    BOOL bStarted;
+    DWORD dwExitCode = 1;
+    int result = 1;
+    int i;
+
+    if (nPaths < 2)
+    {
+        MessageBoxW(NULL,
+            L"Usage: sshfs-ssh.exe --copy|--move <destination> <item>...",
+            L"SSHFS-Win - Server Copy", MB_OK | MB_ICONINFORMATION);
+        return 1;
+    }
+
+    pLocs = calloc((size_t)nPaths, sizeof(SSHFSLocation));
+    ppszRemote = calloc((size_t)nPaths, sizeof(char *));
+    pProgress = malloc(sizeof(RemoteProgress));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!pLocs || !ppszRemote || !pProgress || !pszCmdLine)
+        goto cleanup;
+
+    /* Every item has to live on the destination's server */
+    for (i = 0; i < nPaths; i++)
+    {
+        ResolveResult res = ResolveSSHFSPath(ppszPaths[i], &pLocs[i]);
+        if (res != RESOLVE_OK)
+        {
+            ShowResolveError(ppszPaths[i], res, L"SSHFS-Win - Server Copy");
+            goto cleanup;
+        }
+        if (!SameSSHFSServer(&pLocs[0], &pLocs[i]))
+        {
+            MessageBoxW(NULL,
+                L"The items and the destination folder are on different servers.\n\n"
+                L"Use the normal Copy or Move instead.",
+                L"SSHFS-Win - Server Copy", MB_OK | MB_ICONWARNING);
+            goto cleanup;
+        }
+
+        ppszRemote[i] = malloc(MAX_PATH * 2 * 3);
+        if (!ppszRemote[i])
+            goto cleanup;
+        WideCharToMultiByte(CP_UTF8, 0, pLocs[i].szRemotePath, -1, ppszRemote[i], MAX_PATH * 2 * 3, NULL, NULL);
+    }
+
+    /* Remote script, then the ssh command line around it */
+    cbCmd = RemoteBuildTransferCommand(op, ppszRemote[0],
+        (const char *const *)ppszRemote + 1, (size_t)nPaths - 1, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW)
+        goto cleanup;
+    RemoteBuildTransferCommand(op, ppszRemote[0],
+        (const char *const *)ppszRemote + 1, (size_t)nPaths - 1, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLocs[0].mountType == MOUNT_TYPE_PASSWORD || pLocs[0].mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLocs[0].szUser, pLocs[0].szHost, pLocs[0].szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* No console to prompt on: without a stored password, fail instead of hanging */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -tt%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLocs[0].szPort[0] ? L" -p " : L"", pLocs[0].szPort,
+        pLocs[0].szUser, pLocs[0].szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+    {
+        MessageBoxW(NULL, L"Too many items selected for one server-side operation.",
+            L"SSHFS-Win - Server Copy", MB_OK | MB_ICONWARNING);
+        goto cleanup;
+    }
+
+    /* Output (stdout and stderr, merged by the remote pty) comes back over a pipe */
+    if (!CreateSSHPipe(&hOutRead, &hOutWrite, FALSE, 0))
+        goto cleanup;
+    bStarted = SpawnSSH(pszCmdLine, NULL, hOutWrite, hOutWrite, CREATE_NO_WINDOW,
+        szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+
+    /* Our copy of the write end must go, or the pipe never reports EOF */
+    CloseHandle(hOutWrite);
+    hOutWrite = NULL;
+
+    if (!bStarted)
+    {
+        WCHAR szError[512];
+        StringCchPrintfW(szError, 512, L"Failed to start ssh.exe.\nError code: %lu", GetLastError());
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Server Copy", MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    /* Progress dialog (optional: the transfer runs without it) */
+    CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+    if (SUCCEEDED(CoCreateInstance(&CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IProgressDialog, (void **)&pDlg)))
+    {
+        IProgressDialog_SetTitle(pDlg, op == REMOTE_MOVE ? L"Moving on server" : L"Copying on server");
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"%s %d item%s on %s@%s", pszVerb, nPaths - 1,
+            nPaths == 2 ? L"" : L"s", pLocs[0].szUser, pLocs[0].szHost);
+        IProgressDialog_SetLine(pDlg, 1, szLine, FALSE, NULL);
+        IProgressDialog_StartProgressDialog(pDlg, NULL, NULL, PROGDLG_NORMAL | PROGDLG_AUTOTIME, NULL);
+    }
+
+    RemoteProgressInit(pProgress);
+    for (;;)
+    {
+        char buffer[4096];
+        DWORD dwAvail = 0, bytesRead;
+
+        /* Poll so the Cancel button is honoured while the server is busy */
+        if (!PeekNamedPipe(hOutRead, NULL, 0, NULL, &dwAvail, NULL))
+            break;
+
+        if (dwAvail == 0)
+        {
+            if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+            {
+                bCancelled = TRUE;
+                TerminateProcess(pi.hProcess, 1);
+                break;
+            }
+            Sleep(100);
+            continue;
+        }
+
+        if (!ReadFile(hOutRead, buffer, sizeof(buffer), &bytesRead, NULL) || bytesRead == 0)
+            break;
+
+        if (RemoteProgressFeed(pProgress, buffer, bytesRead) && pDlg)
+        {
+            unsigned long long completed, total;
+
+            RemoteProgressPosition(pProgress, &completed, &total);
+            IProgressDialog_SetProgress64(pDlg, completed, total);
+            if (pProgress->szItem[0])
+            {
+                MultiByteToWideChar(CP_UTF8, 0, pProgress->szItem, -1, szLine, MAX_PATH * 2);
+                IProgressDialog_SetLine(pDlg, 2, szLine, TRUE, NULL);
+            }
+        }
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+    }
+    CoUninitialize();
+
+    /* Refresh Explorer views of everything that changed, even after a cancel */
+    SHChangeNotify(SHCNE_UPDATEDIR, SHCNF_PATHW, ppszPaths[0], NULL);
+    if (op == REMOTE_MOVE)
+    {
+        for (i = 1; i < nPaths; i++)
+        {
+            WCHAR szParent[MAX_PATH];
+            StringCchCopyW(szParent, MAX_PATH, ppszPaths[i]);
+            if (PathRemoveFileSpecW(szParent))
+                SHChangeNotify(SHCNE_UPDATEDIR, SHCNF_PATHW, szParent, NULL);
+        }
+    }
+
+    if (bCancelled)
+    {
+        result = 1;
+    }
+    else if (dwExitCode == 0 && pProgress->bDone)
+    {
+        result = 0;
+    }
+    else if (dwExitCode == REMOTE_EXIT_EXISTS && pProgress->bExists)
+    {
+        WCHAR szName[256];
+        WCHAR szError[512];
+        MultiByteToWideChar(CP_UTF8, 0, pProgress->szItem, -1, szName, 256);
+        StringCchPrintfW(szError, 512,
+            L"\"%s\" already exists in the destination folder.\n\nNothing was %s.",
+            szName, op == REMOTE_MOVE ? L"moved" : L"copied");
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Server Copy", MB_OK | MB_ICONWARNING);
+    }
+    else
+    {
+        WCHAR szOutput[1024];
+        WCHAR szError[1536];
+        MultiByteToWideChar(CP_UTF8, 0, pProgress->szErrors, -1, szOutput, 1024);
+        StringCchPrintfW(szError, 1536,
+            L"The operation on the server failed (exit code %lu).\n\n%s",
+            dwExitCode, szOutput);
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Server Copy", MB_OK | MB_ICONERROR);
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hOutRead)
+        CloseHandle(hOutRead);
+    if (hOutWrite)
+        CloseHandle(hOutWrite);
+    if (ppszRemote)
+    {
+        for (i = 0; i < nPaths; i++)
+            free(ppszRemote[i]);
+    }
+    free(ppszRemote);
+    free(pLocs);
+    free(pProgress);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    return result;
+}
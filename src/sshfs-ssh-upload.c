@@ -0,0 +1,306 @@
+/**
+ * sshfs-ssh-upload.c
+ *
+ * Streamed uploads: sshfs-ssh.exe --upload <destination> <local item>...
+ *
+ * The local files and folders go into a folder on the mount as one tar
+ * stream over a single ssh channel, the mirror image of the streamed
+ * download: a packer thread (sshfs-pack.c) writes the archive into ssh's
+ * stdin while the server runs "tar xf -" in the destination, so there are
+ * no per-file SFTP round trips. Compression is chosen per upload: ssh -C
+ * only pays off when the data is not already compressed (archives, media),
+ * and costs CPU on both ends when it is.
+ */
+
+#define COBJMACROS
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-pack.h"
+#include "sshfs-ssh.h"
+
+int RunStreamUpload(LPWSTR *ppszPaths, int nPaths)
+{
+    SSHFSLocation *pLoc = NULL;
+    ResolveResult res;
+    LPWSTR const *ppszItems = ppszPaths + 1;
+    int nItems = nPaths - 1;
+    char *pszRemote = NULL;
+    char **ppszNames = NULL;
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    int i;
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szLine[MAX_PATH * 2];
+    HANDLE hInRead = NULL, hInWrite = NULL;
+    HANDLE hOut = INVALID_HANDLE_VALUE;
+    PROCESS_INFORMATION pi = {0};
+    IProgressDialog *pDlg = NULL;
+    Packer *pPacker = NULL;
+    PackTotals totals;
+    PackResult pr;
+    RemoteProgress *rp = NULL;
+    ULONGLONG msStart;
+    BOOL bCompress;
+    BOOL bHasPassword = FALSE;
+    BOOL bCancelled = FALSE;
+    BOOL bCoInit = FALSE;
+    BOOL bStarted;
+    DWORD dwExitCode = 1;
+    int result = 1;
+
+    pLoc = malloc(sizeof(SSHFSLocation));
+    pszRemote = malloc(MAX_PATH * 2 * 3);
+    ppszNames = calloc(nItems, sizeof(char *));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    rp = malloc(sizeof(RemoteProgress));
+    if (!pLoc || !pszRemote || !ppszNames || !pszCmdLine || !rp)
+        goto cleanup;
+
+    res = ResolveSSHFSPath(ppszPaths[0], pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(ppszPaths[0], res, L"SSHFS-Win - Upload");
+        goto cleanup;
+    }
+
+    /* Top-level names the archive will create, checked on the server first */
+    for (i = 0; i < nItems; i++)
+    {
+        WCHAR szItem[MAX_PATH];
+
+        StringCchCopyW(szItem, MAX_PATH, ppszItems[i]);
+        PathRemoveBackslashW(szItem);
+        ppszNames[i] = malloc(MAX_PATH * 3);
+        if (!ppszNames[i])
+            goto cleanup;
+        WideCharToMultiByte(CP_UTF8, 0, PathFindFileNameW(szItem), -1, ppszNames[i], MAX_PATH * 3, NULL, NULL);
+    }
+
+    /* One metadata pass: totals for the progress bar and the compression choice */
+    PackScan(ppszItems, nItems, &totals);
+    bCompress = PackWorthCompressing(&totals);
+
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, pszRemote, MAX_PATH * 2 * 3, NULL, NULL);
+    cbCmd = RemoteBuildExtractCommand(pszRemote, (const char *const *)ppszNames, nItems, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW)
+        goto cleanup;
+    RemoteBuildExtractCommand(pszRemote, (const char *const *)ppszNames, nItems, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T%s%s%s%s %s@%s ",
+        szSSHPath,
+        bCompress ? L" -C" : L"",
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+    {
+        MessageBoxW(NULL, L"Too many items selected for one upload.",
+            L"SSHFS-Win - Upload", MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    /* Archive into ssh's stdin; everything ssh and tar print goes to a temp file */
+    if (!CreateSSHPipe(&hInWrite, &hInRead, TRUE, DOWNLOAD_PIPE_SIZE))
+        goto cleanup;
+    hOut = CreateScratchFile();
+    if (hOut == INVALID_HANDLE_VALUE)
+        goto cleanup;
+
+    bStarted = SpawnSSH(pszCmdLine, hInRead, hOut, hOut, CREATE_NO_WINDOW,
+        szAskpassPath, bHasPassword ? szPassword : NULL, &pi);
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+
+    /* ssh holds the read end now; ours would keep the pipe open if ssh exits */
+    CloseHandle(hInRead);
+    hInRead = NULL;
+
+    if (!bStarted)
+    {
+        WCHAR szError[512];
+        StringCchPrintfW(szError, 512, L"Failed to start ssh.exe.\nError code: %lu", GetLastError());
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Upload", MB_OK | MB_ICONERROR);
+        goto cleanup;
+    }
+
+    /* The packer owns the write end from here and closes it at the end of the archive */
+    pPacker = PackerStart(ppszItems, nItems, hInWrite);
+    hInWrite = NULL;
+    if (!pPacker)
+        TerminateProcess(pi.hProcess, 1);
+
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED));
+    if (pPacker && SUCCEEDED(CoCreateInstance(&CLSID_ProgressDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IProgressDialog, (void **)&pDlg)))
+    {
+        IProgressDialog_SetTitle(pDlg, L"Uploading");
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"Uploading to %s@%s:%s%s",
+            pLoc->szUser, pLoc->szHost, pLoc->szRemotePath[0] ? pLoc->szRemotePath : L"~",
+            bCompress ? L" (compressed)" : L"");
+        IProgressDialog_SetLine(pDlg, 1, szLine, FALSE, NULL);
+        IProgressDialog_StartProgressDialog(pDlg, NULL, NULL, PROGDLG_NORMAL | PROGDLG_AUTOTIME, NULL);
+    }
+
+    msStart = GetTickCount64();
+    while (pPacker && !PackerWait(pPacker, 250))
+    {
+        unsigned long nFiles;
+        unsigned long long cbSent;
+        double seconds, mb;
+
+        if (!pDlg)
+            continue;
+        if (IProgressDialog_HasUserCancelled(pDlg))
+        {
+            bCancelled = TRUE;
+            PackerCancel(pPacker);
+            TerminateProcess(pi.hProcess, 1);
+            break;
+        }
+
+        PackerGetProgress(pPacker, &nFiles, &cbSent);
+        seconds = (double)(GetTickCount64() - msStart + 1) / 1000.0;
+        mb = (double)cbSent / (1024.0 * 1024.0);
+        IProgressDialog_SetProgress64(pDlg, cbSent, totals.cbTotal ? totals.cbTotal : 1);
+        StringCchPrintfW(szLine, MAX_PATH * 2, L"%lu of %lu files, %.1f of %.1f MB (%.0f files/s, %.1f MB/s)",
+            nFiles, totals.nFiles, mb, (double)totals.cbTotal / (1024.0 * 1024.0),
+            (double)nFiles / seconds, mb / seconds);
+        IProgressDialog_SetLine(pDlg, 2, szLine, FALSE, NULL);
+    }
+
+    /* The archive is sent; the server may still be writing the last files */
+    if (pDlg && !bCancelled)
+        IProgressDialog_SetLine(pDlg, 2, L"Finishing on the server...", FALSE, NULL);
+    while (pPacker && !bCancelled && WaitForSingleObject(pi.hProcess, 250) == WAIT_TIMEOUT)
+    {
+        if (pDlg && IProgressDialog_HasUserCancelled(pDlg))
+        {
+            bCancelled = TRUE;
+            TerminateProcess(pi.hProcess, 1);
+        }
+    }
+
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    GetExitCodeProcess(pi.hProcess, &dwExitCode);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+
+    ZeroMemory(&pr, sizeof(pr));
+    if (pPacker)
+    {
+        PackerFinish(pPacker, &pr);
+        pPacker = NULL;
+    }
+
+    if (pDlg)
+    {
+        IProgressDialog_StopProgressDialog(pDlg);
+        IProgressDialog_Release(pDlg);
+    }
+
+    /* The "exists" report and error text, as for server-side copies */
+    RemoteProgressInit(rp);
+    {
+        char buffer[4096];
+        DWORD bytesRead;
+        LARGE_INTEGER liZero = {0};
+
+        SetFilePointerEx(hOut, liZero, NULL, FILE_BEGIN);
+        while (ReadFile(hOut, buffer, sizeof(buffer), &bytesRead, NULL) && bytesRead > 0)
+            RemoteProgressFeed(rp, buffer, bytesRead);
+        RemoteProgressFeed(rp, "\n", 1);
+    }
+
+    SHChangeNotify(SHCNE_UPDATEDIR, SHCNF_PATHW, ppszPaths[0], NULL);
+
+    if (bCancelled)
+    {
+        result = 1;
+    }
+    else if (dwExitCode == REMOTE_EXIT_EXISTS && rp->bExists)
+    {
+        WCHAR szName[256];
+        MultiByteToWideChar(CP_UTF8, 0, rp->szItem, -1, szName, 256);
+        StringCchPrintfW(szLine, MAX_PATH * 2,
+            L"\"%s\" already exists in the destination folder.\n\nNothing was uploaded.", szName);
+        MessageBoxW(NULL, szLine, L"SSHFS-Win - Upload", MB_OK | MB_ICONWARNING);
+    }
+    else if (dwExitCode != 0 || pr.nErrors > 0 || pr.nSkipped > 0)
+    {
+        WCHAR szErrors[1024];
+        WCHAR szError[2048];
+
+        MultiByteToWideChar(CP_UTF8, 0, rp->szErrors, -1, szErrors, 1024);
+        if (dwExitCode != 0)
+            StringCchPrintfW(szError, 2048,
+                L"The upload failed (exit code %lu).\n\n%s%s%s",
+                dwExitCode, pr.szFirstError, pr.szFirstError[0] ? L"\n" : L"", szErrors);
+        else
+            StringCchPrintfW(szError, 2048,
+                L"Uploaded %lu files.\n\n"
+                L"%lu could not be read%s%s\n"
+                L"%lu symbolic links or junctions were skipped.",
+                pr.nFiles, pr.nErrors,
+                pr.szFirstError[0] ? L", first: " : L".", pr.szFirstError, pr.nSkipped);
+        MessageBoxW(NULL, szError, L"SSHFS-Win - Upload",
+            MB_OK | (dwExitCode != 0 || pr.nErrors > 0 ? MB_ICONERROR : MB_ICONWARNING));
+        result = dwExitCode != 0 || pr.nErrors > 0 ? 1 : 0;
+    }
+    else
+    {
+        result = 0;
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hInRead)
+        CloseHandle(hInRead);
+    if (hInWrite)
+        CloseHandle(hInWrite);
+    if (hOut != INVALID_HANDLE_VALUE)
+        CloseHandle(hOut);
+    if (bCoInit)
+        CoUninitialize();
+    if (ppszNames)
+    {
+        for (i = 0; i < nItems; i++)
+            free(ppszNames[i]);
+        free(ppszNames);
+    }
+    free(pLoc);
+    free(pszRemote);
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    free(rp);
+    return result;
+}
@@ -0,0 +1,698 @@
+/**
+ * sshfs-ssh-usage.c
+ *
+ * Disk usage measured on the server: sshfs-ssh.exe --usage <folder>
+ *
+ * Explorer's Properties on a folder of the drive walks the whole tree over
+ * SFTP, a round trip per folder. Here du runs on the server and only its
+ * per-folder totals come back, built into a tree that shows the largest
+ * subfolders first.
+ *
+ * The output is kept as a cache per remote folder. The next look shows the
+ * cached tree at once while the server checks for anything modified since
+ * it was taken (find stops at the first hit); du only runs again if there
+ * is something.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <commctrl.h>
+#include <shellapi.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-usage.h"
+#include "sshfs-ssh.h"
+
+#define USAGE_MAX_SHOWN     1000        /* Subfolders listed per folder, the rest are summed */
+#define USAGE_POST_MS       250
+#define USAGE_PIPE_SIZE     (256 * 1024)
+
+#define WM_USAGE_PROGRESS   (WM_APP + 3)
+#define WM_USAGE_DONE       (WM_APP + 4)
+
+#define IDC_USAGE_TREE      201
+#define IDC_USAGE_STATUS    202
+#define IDC_USAGE_REFRESH   203
+
+/**
+ * A running du: its output is parsed on a reader thread and copied to a new
+ * cache file, which replaces the old one if the run completes
+ */
+typedef struct UsageJob {
+    HWND hWnd;
+    unsigned int nGeneration;
+    PROCESS_INFORMATION pi;
+    HANDLE hOutRead;
+    HANDLE hErr;
+    HANDLE hThread;
+    HANDLE hCache;                  /* <cache>.new, closed by the reader thread */
+    WCHAR szCacheNew[MAX_PATH];
+    UsageTree tree;
+    ULONGLONG msLastPost;
+    volatile LONG bStop;
+    BOOL bOutOfMemory;
+    BOOL bCacheFailed;
+    DWORD dwExitCode;
+    WCHAR szError[512];
+} UsageJob;
+
+typedef struct UsageWindow {
+    HWND hTree, hStatus, hRefresh;
+    SSHFSLocation *pLoc;
+    WCHAR szFolder[MAX_PATH];
+    char szRemote[MAX_PATH * 2 * 3];
+    WCHAR szCache[MAX_PATH];
+    UsageTree tree;                 /* Shown; iRoot is USAGE_NONE until there is one */
+    UsageJob *pJob;
+    unsigned int nGeneration;
+    ULONGLONG msStart;
+} UsageWindow;
+
+/**
+ * Reader thread: build the tree and the cache file from du's output
+ */
+static DWORD WINAPI UsageReaderThread(LPVOID pParam)
+{
+    UsageJob *job = (UsageJob *)pParam;
+    char *pBuffer = malloc(USAGE_PIPE_SIZE);
+    DWORD bytesRead, cbWritten;
+
+    while (pBuffer && !job->bStop &&
+        ReadFile(job->hOutRead, pBuffer, USAGE_PIPE_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    {
+        if (!UsageTreeFeed(&job->tree, pBuffer, bytesRead))
+        {
+            job->bOutOfMemory = TRUE;
+            TerminateProcess(job->pi.hProcess, 1);
+            break;
+        }
+        if (!job->bCacheFailed && (!WriteFile(job->hCache, pBuffer, bytesRead, &cbWritten, NULL) ||
+            cbWritten != bytesRead))
+            job->bCacheFailed = TRUE;
+        if (GetTickCount64() - job->msLastPost >= USAGE_POST_MS)
+        {
+            job->msLastPost = GetTickCount64();
+            PostMessageW(job->hWnd, WM_USAGE_PROGRESS, job->nGeneration, (LPARAM)job->tree.nNodes);
+        }
+    }
+    free(pBuffer);
+    if (job->hCache != INVALID_HANDLE_VALUE)
+        CloseHandle(job->hCache);
+    job->hCache = NULL;
+
+    WaitForSingleObject(job->pi.hProcess, INFINITE);
+    GetExitCodeProcess(job->pi.hProcess, &job->dwExitCode);
+    ReadErrorTail(job->hErr, job->szError, 512);
+    PostMessageW(job->hWnd, WM_USAGE_DONE, job->nGeneration, 0);
+    return 0;
+}
+
+/**
+ * Stop a run (if bStop) and free it once its reader thread has ended; an
+ * unfinished cache file is deleted
+ */
+static void EndUsage(UsageWindow *sw, BOOL bStop)
+{
+    UsageJob *job = sw->pJob;
+
+    if (!job)
+        return;
+    if (bStop)
+    {
+        job->bStop = TRUE;
+        TerminateProcess(job->pi.hProcess, 1);
+        sw->nGeneration++;
+    }
+    WaitForSingleObject(job->hThread, INFINITE);
+    CloseHandle(job->hThread);
+    CloseHandle(job->pi.hProcess);
+    CloseHandle(job->pi.hThread);
+    CloseHandle(job->hOutRead);
+    CloseHandle(job->hErr);
+    if (job->szCacheNew[0])
+        DeleteFileW(job->szCacheNew);
+    UsageTreeFree(&job->tree);
+    free(job);
+    sw->pJob = NULL;
+    SetWindowTextW(sw->hRefresh, L"Refresh");
+}
+
+/**
+ * Run du on the server; since >= 0 lets it answer "#fresh" for a cache
+ * taken then
+ */
+static void StartUsage(HWND hWnd, UsageWindow *sw, long long since)
+{
+    UsageJob *job = NULL;
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    char szHeader[MAX_PATH * 2 * 3 + 16];
+    size_t cbHeader;
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    WCHAR szDir[MAX_PATH];
+    HANDLE hOutWrite = NULL;
+    DWORD cbWritten;
+    BOOL bHasPassword = FALSE;
+    BOOL bStarted;
+
+    cbCmd = RemoteBuildUsageCommand(sw->szRemote, since, NULL, 0) + 1;
+    job = calloc(1, sizeof(UsageJob));
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!job || !pszCmd || !pszCmdW || !pszCmdLine || !UsageTreeInit(&job->tree))
+        goto cleanup;
+    RemoteBuildUsageCommand(sw->szRemote, since, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    /* The output goes to the cache as it comes, behind the header */
+    job->hCache = INVALID_HANDLE_VALUE;
+    if (sw->szCache[0])
+    {
+        StringCchPrintfW(job->szCacheNew, MAX_PATH, L"%s.new", sw->szCache);
+        StringCchCopyW(szDir, MAX_PATH, sw->szCache);
+        PathRemoveFileSpecW(szDir);
+        SHCreateDirectoryExW(NULL, szDir, NULL);
+        job->hCache = CreateFileW(job->szCacheNew, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    cbHeader = UsageCacheFormatHeader(sw->szRemote, szHeader, sizeof(szHeader));
+    if (job->hCache == INVALID_HANDLE_VALUE || cbHeader > sizeof(szHeader) ||
+        !WriteFile(job->hCache, szHeader, (DWORD)cbHeader, &cbWritten, NULL))
+        job->bCacheFailed = TRUE;
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (sw->pLoc->mountType == MOUNT_TYPE_PASSWORD || sw->pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(sw->pLoc->szUser, sw->pLoc->szHost, sw->pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* du's listing compresses well */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T -C%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        sw->pLoc->szPort[0] ? L" -p " : L"", sw->pLoc->szPort,
+        sw->pLoc->szUser, sw->pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    job->hErr = CreateScratchFile();
+    if (job->hErr == INVALID_HANDLE_VALUE)
+    {
+        job->hErr = NULL;
+        goto cleanup;
+    }
+    if (!CreateSSHPipe(&job->hOutRead, &hOutWrite, FALSE, USAGE_PIPE_SIZE))
+        goto cleanup;
+    bStarted = SpawnSSH(pszCmdLine, NULL, hOutWrite, job->hErr, CREATE_NO_WINDOW,
+        szAskpassPath, bHasPassword ? szPassword : NULL, &job->pi);
+    CloseHandle(hOutWrite);
+    if (!bStarted)
+    {
+        WCHAR szError[128];
+        StringCchPrintfW(szError, 128, L"Failed to start ssh.exe (error %lu).", GetLastError());
+        SetWindowTextW(sw->hStatus, szError);
+        goto cleanup;
+    }
+
+    job->hWnd = hWnd;
+    job->nGeneration = ++sw->nGeneration;
+    job->msLastPost = GetTickCount64();
+    job->hThread = CreateThread(NULL, 0, UsageReaderThread, job, 0, NULL);
+    if (!job->hThread)
+    {
+        TerminateProcess(job->pi.hProcess, 1);
+        CloseHandle(job->pi.hProcess);
+        CloseHandle(job->pi.hThread);
+        goto cleanup;
+    }
+
+    sw->pJob = job;
+    job = NULL;
+    sw->msStart = GetTickCount64();
+    SetWindowTextW(sw->hRefresh, L"Stop");
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (job)
+    {
+        if (job->hOutRead)
+            CloseHandle(job->hOutRead);
+        if (job->hErr)
+            CloseHandle(job->hErr);
+        if (job->hCache != INVALID_HANDLE_VALUE && job->hCache)
+            CloseHandle(job->hCache);
+        if (job->szCacheNew[0])
+            DeleteFileW(job->szCacheNew);
+        UsageTreeFree(&job->tree);
+        free(job);
+    }
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+}
+
+/**
+ * Build the tree from the cache file, if there is one for this folder
+ */
+static BOOL LoadUsageCache(UsageWindow *sw)
+{
+    HANDLE hFile;
+    LARGE_INTEGER liSize;
+    char *pData = NULL;
+    DWORD cbRead;
+    size_t cbData = 0, cbHeader;
+    BOOL bLoaded = FALSE;
+
+    hFile = CreateFileW(sw->szCache, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    if (GetFileSizeEx(hFile, &liSize) && (ULONGLONG)liSize.QuadPart < (SIZE_T)-1 / 2)
+        pData = malloc((size_t)liSize.QuadPart + 1);
+    while (pData && cbData < (size_t)liSize.QuadPart)
+    {
+        size_t cbChunk = (size_t)liSize.QuadPart - cbData;
+
+        if (cbChunk > DOWNLOAD_READ_SIZE)
+            cbChunk = DOWNLOAD_READ_SIZE;
+        if (!ReadFile(hFile, pData + cbData, (DWORD)cbChunk, &cbRead, NULL) || cbRead == 0)
+            break;
+        cbData += cbRead;
+    }
+    CloseHandle(hFile);
+
+    cbHeader = pData ? UsageCacheCheckHeader(pData, cbData, sw->szRemote) : 0;
+    if (cbHeader > 0 && UsageTreeInit(&sw->tree))
+    {
+        if (UsageTreeFeed(&sw->tree, pData + cbHeader, cbData - cbHeader) &&
+            UsageTreeFinish(&sw->tree) && sw->tree.serverTime >= 0)
+            bLoaded = TRUE;
+        else
+            UsageTreeFree(&sw->tree);
+    }
+    free(pData);
+    return bLoaded;
+}
+
+/**
+ * "name   12.3 GB  (45%)"
+ */
+static void FormatUsageLabel(LPCWSTR pszName, unsigned long long cbSize, unsigned long long cbParent,
+    LPWSTR pszLabel, size_t cchLabel)
+{
+    char szSize[32];
+    WCHAR szSizeW[32];
+    LPCWSTR pSize = szSizeW;
+
+    FormatSize(cbSize, szSize, 32);
+    MultiByteToWideChar(CP_UTF8, 0, szSize, -1, szSizeW, 32);
+    while (*pSize == L' ')
+        pSize++;
+    if (cbParent > 0)
+        StringCchPrintfW(pszLabel, cchLabel, L"%s   %s  (%.0f%%)", pszName, pSize,
+            100.0 * (double)cbSize / (double)cbParent);
+    else
+        StringCchPrintfW(pszLabel, cchLabel, L"%s   %s", pszName, pSize);
+}
+
+static HTREEITEM InsertUsageItem(HWND hTree, HTREEITEM hParent, LPCWSTR pszLabel, LPARAM lParam, BOOL bChildren)
+{
+    TVINSERTSTRUCTW tvis = {0};
+
+    tvis.hParent = hParent;
+    tvis.hInsertAfter = TVI_LAST;
+    tvis.item.mask = TVIF_TEXT | TVIF_PARAM | TVIF_CHILDREN;
+    tvis.item.pszText = (LPWSTR)pszLabel;
+    tvis.item.lParam = lParam;
+    tvis.item.cChildren = bChildren ? 1 : 0;
+    return TreeView_InsertItem(hTree, &tvis);
+}
+
+/**
+ * Fill in the subfolders of a folder item, largest first; called when it
+ * is first expanded
+ */
+static void InsertUsageChildren(UsageWindow *sw, HTREEITEM hItem, unsigned int iNode)
+{
+    const UsageTree *t = &sw->tree;
+    const UsageNode *n = &t->pNodes[iNode];
+    unsigned long long cbFiles = UsageOwnFiles(t, iNode);
+    unsigned long long cbRest = 0;
+    WCHAR szName[MAX_PATH];
+    WCHAR szLabel[MAX_PATH + 64];
+    unsigned int k;
+    BOOL bFilesShown = FALSE;
+
+    for (k = 0; k < n->nKids; k++)
+    {
+        unsigned int iKid = t->pKids[n->iKids + k];
+        const UsageNode *kid = &t->pNodes[iKid];
+
+        if (k >= USAGE_MAX_SHOWN)
+        {
+            cbRest += kid->cbSize;
+            continue;
+        }
+        /* The folder's own files take their place by size among the subfolders */
+        if (!bFilesShown && cbFiles >= kid->cbSize)
+        {
+            FormatUsageLabel(L"[files]", cbFiles, n->cbSize, szLabel, MAX_PATH + 64);
+            InsertUsageItem(sw->hTree, hItem, szLabel, (LPARAM)USAGE_NONE, FALSE);
+            bFilesShown = TRUE;
+        }
+        if (!MultiByteToWideChar(CP_UTF8, 0, UsageNodeName(t, iKid), -1, szName, MAX_PATH))
+            StringCchCopyW(szName, MAX_PATH, L"?");
+        FormatUsageLabel(szName, kid->cbSize, n->cbSize, szLabel, MAX_PATH + 64);
+        InsertUsageItem(sw->hTree, hItem, szLabel, (LPARAM)iKid, kid->nKids > 0);
+    }
+    if (!bFilesShown && cbFiles > 0)
+    {
+        FormatUsageLabel(L"[files]", cbFiles, n->cbSize, szLabel, MAX_PATH + 64);
+        InsertUsageItem(sw->hTree, hItem, szLabel, (LPARAM)USAGE_NONE, FALSE);
+    }
+    if (n->nKids > USAGE_MAX_SHOWN)
+    {
+        StringCchPrintfW(szName, MAX_PATH, L"[%lu more folders]", (unsigned long)(n->nKids - USAGE_MAX_SHOWN));
+        FormatUsageLabel(szName, cbRest, n->cbSize, szLabel, MAX_PATH + 64);
+        InsertUsageItem(sw->hTree, hItem, szLabel, (LPARAM)USAGE_NONE, FALSE);
+    }
+}
+
+/**
+ * Replace the tree view's contents with sw->tree, root expanded
+ */
+static void ShowUsageTree(UsageWindow *sw)
+{
+    WCHAR szLabel[MAX_PATH + 64];
+    HTREEITEM hRoot;
+
+    SendMessageW(sw->hTree, WM_SETREDRAW, FALSE, 0);
+    TreeView_DeleteAllItems(sw->hTree);
+    if (sw->tree.iRoot != USAGE_NONE)
+    {
+        FormatUsageLabel(sw->szFolder, sw->tree.pNodes[sw->tree.iRoot].cbSize, 0, szLabel, MAX_PATH + 64);
+        hRoot = InsertUsageItem(sw->hTree, TVI_ROOT, szLabel, (LPARAM)sw->tree.iRoot, TRUE);
+        InsertUsageChildren(sw, hRoot, sw->tree.iRoot);
+        TreeView_Expand(sw->hTree, hRoot, TVE_EXPAND);
+        TreeView_SelectItem(sw->hTree, hRoot);
+    }
+    SendMessageW(sw->hTree, WM_SETREDRAW, TRUE, 0);
+    InvalidateRect(sw->hTree, NULL, TRUE);
+}
+
+static void ShowUsageCacheStatus(UsageWindow *sw, LPCWSTR pszWhat)
+{
+    WCHAR szStatus[256];
+    char szTime[32];
+    WCHAR szTimeW[32];
+
+    FormatUnixTime(sw->tree.serverTime, szTime, 32);
+    MultiByteToWideChar(CP_UTF8, 0, szTime, -1, szTimeW, 32);
+    StringCchPrintfW(szStatus, 256, L"%lu folders as of %s - %s",
+        (unsigned long)sw->tree.nNodes, szTimeW, pszWhat);
+    SetWindowTextW(sw->hStatus, szStatus);
+}
+
+/**
+ * The run ended: keep its tree and cache, or say why not
+ */
+static void FinishUsage(UsageWindow *sw)
+{
+    UsageJob *job = sw->pJob;
+    WCHAR szStatus[640];
+    double seconds = (double)(GetTickCount64() - sw->msStart) / 1000.0;
+
+    if (job->tree.bFresh && sw->tree.iRoot != USAGE_NONE)
+    {
+        ShowUsageCacheStatus(sw, L"nothing has changed on the server since.");
+    }
+    else if (job->bOutOfMemory)
+    {
+        SetWindowTextW(sw->hStatus, L"Out of memory while reading the sizes.");
+    }
+    else if (job->dwExitCode == 255 || !UsageTreeFinish(&job->tree))
+    {
+        StringCchPrintfW(szStatus, 640, L"Failed: %s", job->szError[0] ? job->szError : L"(no message)");
+        SetWindowTextW(sw->hStatus, szStatus);
+    }
+    else
+    {
+        UsageTreeFree(&sw->tree);
+        sw->tree = job->tree;
+        ZeroMemory(&job->tree, sizeof(job->tree));
+        ShowUsageTree(sw);
+
+        /* A complete run replaces the cache */
+        if (!job->bCacheFailed && MoveFileExW(job->szCacheNew, sw->szCache, MOVEFILE_REPLACE_EXISTING))
+            job->szCacheNew[0] = L'\0';
+
+        StringCchPrintfW(szStatus, 640, L"%lu folders (%.1f s)%s", (unsigned long)sw->tree.nNodes, seconds,
+            job->dwExitCode != 0 ? L" - some folders could not be read" : L"");
+        SetWindowTextW(sw->hStatus, szStatus);
+    }
+}
+
+static void LayoutUsageWindow(HWND hWnd, UsageWindow *sw)
+{
+    RECT rc;
+    int cx, cy;
+
+    GetClientRect(hWnd, &rc);
+    cx = rc.right;
+    cy = rc.bottom;
+    MoveWindow(sw->hTree, 8, 8, cx - 16, cy > 52 ? cy - 52 : 10, TRUE);
+    MoveWindow(sw->hStatus, 8, cy - 34, cx > 124 ? cx - 124 : 10, 22, TRUE);
+    MoveWindow(sw->hRefresh, cx - 100, cy - 38, 92, 26, TRUE);
+}
+
+static LRESULT CALLBACK UsageWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    UsageWindow *sw = (UsageWindow *)GetWindowLongPtrW(hWnd, GWLP_USERDATA);
+
+    switch (uMsg)
+    {
+    case WM_CREATE:
+    {
+        HFONT hFont = (HFONT)GetStockObject(DEFAULT_GUI_FONT);
+        HINSTANCE hInst = ((CREATESTRUCTW *)lParam)->hInstance;
+
+        sw = (UsageWindow *)((CREATESTRUCTW *)lParam)->lpCreateParams;
+        SetWindowLongPtrW(hWnd, GWLP_USERDATA, (LONG_PTR)sw);
+
+        sw->hTree = CreateWindowExW(WS_EX_CLIENTEDGE, WC_TREEVIEWW, L"",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP | TVS_HASBUTTONS | TVS_HASLINES | TVS_LINESATROOT | TVS_SHOWSELALWAYS,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_USAGE_TREE, hInst, NULL);
+        sw->hStatus = CreateWindowExW(0, L"STATIC", L"",
+            WS_CHILD | WS_VISIBLE | SS_LEFTNOWORDWRAP,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_USAGE_STATUS, hInst, NULL);
+        sw->hRefresh = CreateWindowExW(0, L"BUTTON", L"Refresh",
+            WS_CHILD | WS_VISIBLE | WS_TABSTOP,
+            0, 0, 0, 0, hWnd, (HMENU)(INT_PTR)IDC_USAGE_REFRESH, hInst, NULL);
+        if (!sw->hTree || !sw->hStatus || !sw->hRefresh)
+            return -1;
+
+        SendMessageW(sw->hTree, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hStatus, WM_SETFONT, (WPARAM)hFont, FALSE);
+        SendMessageW(sw->hRefresh, WM_SETFONT, (WPARAM)hFont, FALSE);
+        LayoutUsageWindow(hWnd, sw);
+
+        /* A cached tree shows at once; the server only checks it is current */
+        if (sw->tree.iRoot != USAGE_NONE)
+        {
+            ShowUsageTree(sw);
+            ShowUsageCacheStatus(sw, L"checking the server for changes...");
+            StartUsage(hWnd, sw, sw->tree.serverTime);
+        }
+        else
+        {
+            SetWindowTextW(sw->hStatus, L"Measuring on the server...");
+            StartUsage(hWnd, sw, -1);
+        }
+        SetFocus(sw->hTree);
+        return 0;
+    }
+
+    case WM_SIZE:
+        if (sw && sw->hTree)
+            LayoutUsageWindow(hWnd, sw);
+        return 0;
+
+    case WM_SETFOCUS:
+        if (sw && sw->hTree)
+            SetFocus(sw->hTree);
+        return 0;
+
+    case WM_COMMAND:
+        /* Enter on a folder opens it on the drive */
+        if (LOWORD(wParam) == IDOK && GetFocus() == sw->hTree)
+        {
+            TVITEMW item = {0};
+            char szSub[MAX_PATH * 3];
+            WCHAR szPath[MAX_PATH * 2];
+            size_t cch;
+
+            item.mask = TVIF_PARAM;
+            item.hItem = TreeView_GetSelection(sw->hTree);
+            if (!item.hItem || !TreeView_GetItem(sw->hTree, &item) || (unsigned int)item.lParam == USAGE_NONE ||
+                !UsageNodePath(&sw->tree, (unsigned int)item.lParam, '\\', szSub, sizeof(szSub)))
+                return 0;
+            StringCchCopyW(szPath, MAX_PATH * 2, sw->szFolder);
+            cch = wcslen(szPath);
+            if (szSub[0] && szPath[cch - 1] != L'\\')
+                StringCchCatW(szPath, MAX_PATH * 2, L"\\");
+            cch = wcslen(szPath);
+            MultiByteToWideChar(CP_UTF8, 0, szSub, -1, szPath + cch, (int)(MAX_PATH * 2 - cch));
+            ShellExecuteW(hWnd, NULL, szPath, NULL, NULL, SW_SHOWNORMAL);
+            return 0;
+        }
+        if (LOWORD(wParam) == IDC_USAGE_REFRESH)
+        {
+            if (sw->pJob)
+            {
+                EndUsage(sw, TRUE);
+                SetWindowTextW(sw->hStatus, L"Stopped.");
+            }
+            else
+            {
+                SetWindowTextW(sw->hStatus, L"Measuring on the server...");
+                StartUsage(hWnd, sw, -1);
+            }
+            return 0;
+        }
+        break;
+
+    case WM_NOTIFY:
+    {
+        NMTREEVIEWW *pnm = (NMTREEVIEWW *)lParam;
+
+        if (pnm->hdr.idFrom == IDC_USAGE_TREE && pnm->hdr.code == TVN_ITEMEXPANDINGW &&
+            pnm->action == TVE_EXPAND && (unsigned int)pnm->itemNew.lParam != USAGE_NONE &&
+            !TreeView_GetChild(sw->hTree, pnm->itemNew.hItem))
+            InsertUsageChildren(sw, pnm->itemNew.hItem, (unsigned int)pnm->itemNew.lParam);
+        break;
+    }
+
+    case WM_USAGE_PROGRESS:
+        if (sw->pJob && wParam == sw->nGeneration)
+        {
+            WCHAR szStatus[128];
+
+            StringCchPrintfW(szStatus, 128, L"Measuring on the server... %lu folders", (unsigned long)lParam);
+            SetWindowTextW(sw->hStatus, szStatus);
+        }
+        return 0;
+
+    case WM_USAGE_DONE:
+        if (sw->pJob && wParam == sw->nGeneration)
+        {
+            FinishUsage(sw);
+            EndUsage(sw, FALSE);
+        }
+        return 0;
+
+    case WM_DESTROY:
+        EndUsage(sw, TRUE);
+        PostQuitMessage(0);
+        return 0;
+    }
+
+    return DefWindowProcW(hWnd, uMsg, wParam, lParam);
+}
+
+int RunRemoteUsage(LPCWSTR pszFolder)
+{
+    UsageWindow *sw = NULL;
+    ResolveResult res;
+    INITCOMMONCONTROLSEX icc = {sizeof(INITCOMMONCONTROLSEX), ICC_TREEVIEW_CLASSES};
+    WNDCLASSEXW wc = {0};
+    WCHAR szTitle[MAX_PATH * 2];
+    HINSTANCE hInst = GetModuleHandleW(NULL);
+    HWND hWnd;
+    MSG msg;
+    BOOL bCoInit = FALSE;
+    int result = 1;
+
+    sw = calloc(1, sizeof(UsageWindow));
+    if (!sw)
+        return 1;
+    sw->tree.iRoot = USAGE_NONE;
+    sw->pLoc = malloc(sizeof(SSHFSLocation));
+    if (!sw->pLoc)
+        goto cleanup;
+
+    StringCchCopyW(sw->szFolder, MAX_PATH, pszFolder);
+    if (!PathIsRootW(sw->szFolder))
+        PathRemoveBackslashW(sw->szFolder);
+    res = ResolveSSHFSPath(sw->szFolder, sw->pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(sw->szFolder, res, L"SSHFS-Win - Disk Usage");
+        goto cleanup;
+    }
+    if (!PathIsDirectoryW(sw->szFolder))
+    {
+        MessageBoxW(NULL, L"Select a folder to measure.", L"SSHFS-Win - Disk Usage", MB_OK | MB_ICONINFORMATION);
+        goto cleanup;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, sw->pLoc->szRemotePath, -1, sw->szRemote, sizeof(sw->szRemote), NULL, NULL);
+    if (!GetCacheFilePath(sw->pLoc, L"usage", L".du", sw->szCache, MAX_PATH))
+        sw->szCache[0] = L'\0';
+    else
+        LoadUsageCache(sw);
+
+    /* ShellExecute on a folder may need COM */
+    bCoInit = SUCCEEDED(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE));
+    InitCommonControlsEx(&icc);
+
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = UsageWndProc;
+    wc.hInstance = hInst;
+    wc.hCursor = LoadCursorW(NULL, IDC_ARROW);
+    wc.hbrBackground = (HBRUSH)(COLOR_BTNFACE + 1);
+    wc.lpszClassName = L"SSHFSWinUsage";
+    RegisterClassExW(&wc);
+
+    StringCchPrintfW(szTitle, MAX_PATH * 2, L"Disk usage of %s on %s@%s", sw->szFolder, sw->pLoc->szUser, sw->pLoc->szHost);
+    hWnd = CreateWindowExW(0, wc.lpszClassName, szTitle, WS_OVERLAPPEDWINDOW,
+        CW_USEDEFAULT, CW_USEDEFAULT, 720, 640, NULL, NULL, hInst, sw);
+    if (hWnd)
+    {
+        ShowWindow(hWnd, SW_SHOWNORMAL);
+        while (GetMessageW(&msg, NULL, 0, 0) > 0)
+        {
+            if (IsDialogMessageW(hWnd, &msg))
+                continue;
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+        result = 0;
+    }
+
+cleanup:
+    if (bCoInit)
+        CoUninitialize();
+    UsageTreeFree(&sw->tree);
+    free(sw->pLoc);
+    free(sw);
+    return result;
+}
@@ -0,0 +1,347 @@
+/**
+ * sshfs-ssh-watch.c
+ *
+ * Shell notifications for changes made on the server:
+ * sshfs-ssh.exe --watch <path>
+ *
+ * Folders on the drive never get change notifications of their own, so
+ * Explorer (and editors watching a folder) only see changes made on the
+ * server by listing again over SFTP. Here one ssh channel runs inotifywait
+ * on the mount's remote root (or a find loop every WATCH_POLL_SECONDS where
+ * there is none) and the events become SHChangeNotify calls for the paths
+ * on the drive, coalesced so a storm of events ends up as a few folder
+ * refreshes (sshfs-watch.c).
+ *
+ * The watcher runs in the background, one per mount, marked by a named
+ * event (GetWatchEventName()); starting it again signals that event and
+ * stops the running one. A dropped connection is made again with growing
+ * delays, and the watcher ends when the drive goes away.
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-path.h"
+#include "sshfs-remote.h"
+#include "sshfs-watch.h"
+#include "sshfs-ssh.h"
+
+#define WATCH_POLL_SECONDS  5           /* Where the server has no inotifywait */
+#define WATCH_PIPE_SIZE     (64 * 1024)
+#define WATCH_CHECK_MS      30000       /* How often the watcher checks the drive is still there */
+#define WATCH_RETRY_MIN_MS  5000
+#define WATCH_RETRY_MAX_MS  300000
+#define WATCH_STABLE_MS     60000       /* A connection up this long resets the retry delay */
+
+/**
+ * State shared by the watcher's main loop and its reader thread
+ */
+typedef struct Watcher {
+    CRITICAL_SECTION cs;            /* Guards parser and coalescer */
+    WatchParser parser;
+    WatchCoalescer co;
+    HANDLE hOutRead;
+    HANDLE hData;                   /* Set by the reader when events came in */
+    WCHAR szRoot[MAX_PATH];         /* The mount's root on this machine */
+    char szRemote[MAX_PATH * 2 * 3];
+} Watcher;
+
+static void TakeWatchEvent(const WatchEvent *pEvent, void *pContext)
+{
+    Watcher *w = (Watcher *)pContext;
+    WatchCoalescerAdd(&w->co, pEvent, GetTickCount64());
+}
+
+static DWORD WINAPI WatchReaderThread(LPVOID pParam)
+{
+    Watcher *w = (Watcher *)pParam;
+    char *pBuffer = malloc(WATCH_PIPE_SIZE);
+    DWORD bytesRead;
+
+    while (pBuffer && ReadFile(w->hOutRead, pBuffer, WATCH_PIPE_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    {
+        EnterCriticalSection(&w->cs);
+        WatchParserFeed(&w->parser, pBuffer, bytesRead, TakeWatchEvent, w);
+        LeaveCriticalSection(&w->cs);
+        SetEvent(w->hData);
+    }
+    free(pBuffer);
+    return 0;
+}
+
+/**
+ * Coalescer callback: tell the shell about one change under the root
+ */
+static void SendWatchNotify(WatchNotify kind, const char *pszPath, void *pContext)
+{
+    static const LONG events[] = {
+        SHCNE_CREATE, SHCNE_DELETE, SHCNE_MKDIR, SHCNE_RMDIR, SHCNE_UPDATEITEM, SHCNE_UPDATEDIR
+    };
+    Watcher *w = (Watcher *)pContext;
+    char szSub[MAX_PATH * 3];
+    WCHAR szPath[MAX_PATH * 2];
+    size_t cch;
+
+    /* Relative to the watched folder, which is the root's remote path */
+    if (!RemotePathToLocal(pszPath, w->szRemote, '\\', szSub, sizeof(szSub)))
+        return;
+    StringCchCopyW(szPath, MAX_PATH * 2, w->szRoot);
+    cch = wcslen(szPath);
+    if (szSub[0] && !MultiByteToWideChar(CP_UTF8, 0, szSub, -1, szPath + cch, (int)(MAX_PATH * 2 - cch)))
+        return;
+    SHChangeNotify(events[kind], SHCNF_PATHW, szPath, NULL);
+}
+
+/**
+ * Start ssh with the watch script. FALSE (with a message in szError) if
+ * it could not be started.
+ */
+static BOOL StartWatchProcess(Watcher *w, const SSHFSLocation *pLoc, HANDLE hErr,
+    PROCESS_INFORMATION *pi, LPWSTR pszError, DWORD cchError)
+{
+    char *pszCmd = NULL;
+    LPWSTR pszCmdW = NULL;
+    LPWSTR pszCmdLine = NULL;
+    size_t cchCmdLine = 8192;
+    size_t cbCmd;
+    WCHAR szSSHPath[MAX_PATH];
+    WCHAR szAskpassPath[MAX_PATH];
+    WCHAR szPassword[256] = {0};
+    HANDLE hOutWrite = NULL;
+    BOOL bHasPassword = FALSE;
+    BOOL bStarted = FALSE;
+
+    pszError[0] = L'\0';
+    cbCmd = RemoteBuildWatchCommand(w->szRemote, WATCH_POLL_SECONDS, NULL, 0) + 1;
+    pszCmd = malloc(cbCmd);
+    pszCmdW = malloc(cbCmd * sizeof(WCHAR));
+    pszCmdLine = malloc(cchCmdLine * sizeof(WCHAR));
+    if (!pszCmd || !pszCmdW || !pszCmdLine)
+        goto cleanup;
+    RemoteBuildWatchCommand(w->szRemote, WATCH_POLL_SECONDS, pszCmd, cbCmd);
+    MultiByteToWideChar(CP_UTF8, 0, pszCmd, -1, pszCmdW, (int)cbCmd);
+
+    FindSSH(szSSHPath, MAX_PATH);
+    if (pLoc->mountType == MOUNT_TYPE_PASSWORD || pLoc->mountType == MOUNT_TYPE_PASSWORD_ROOT)
+    {
+        bHasPassword = GetStoredPassword(pLoc->szUser, pLoc->szHost, pLoc->szPort, szPassword, 256);
+        if (bHasPassword && !GetAskpassPath(szAskpassPath, MAX_PATH))
+            bHasPassword = FALSE;
+    }
+
+    /* Keepalives, so a connection that died quietly ends and is made again */
+    StringCchPrintfW(pszCmdLine, cchCmdLine, L"\"%s\" -T -o ServerAliveInterval=30%s%s%s %s@%s ",
+        szSSHPath,
+        bHasPassword ? L"" : L" -o BatchMode=yes",
+        pLoc->szPort[0] ? L" -p " : L"", pLoc->szPort,
+        pLoc->szUser, pLoc->szHost);
+    if (!AppendQuotedArg(pszCmdLine, cchCmdLine, pszCmdW))
+        goto cleanup;
+
+    if (!CreateSSHPipe(&w->hOutRead, &hOutWrite, FALSE, WATCH_PIPE_SIZE))
+        goto cleanup;
+    bStarted = SpawnSSH(pszCmdLine, NULL, hOutWrite, hErr, CREATE_NO_WINDOW,
+        szAskpassPath, bHasPassword ? szPassword : NULL, pi);
+    if (!bStarted)
+    {
+        StringCchPrintfW(pszError, cchError, L"Failed to start ssh.exe (error %lu).", GetLastError());
+        CloseHandle(w->hOutRead);
+        w->hOutRead = NULL;
+    }
+
+cleanup:
+    SecureZeroMemory(szPassword, sizeof(szPassword));
+    if (hOutWrite)
+        CloseHandle(hOutWrite);
+    if (!bStarted && !pszError[0])
+        StringCchCopyW(pszError, cchError, L"Could not set up the connection.");
+    free(pszCmd);
+    free(pszCmdW);
+    free(pszCmdLine);
+    return bStarted;
+}
+
+int RunWatcher(LPCWSTR pszPath)
+{
+    Watcher *w = NULL;
+    SSHFSLocation *pLoc = NULL;
+    WCHAR szEventName[MAX_PATH];
+    WCHAR szError[512];
+    HANDLE hStop = NULL;
+    HANDLE hErr = INVALID_HANDLE_VALUE;
+    ResolveResult res;
+    DWORD retryMs = WATCH_RETRY_MIN_MS;
+    BOOL bEverConnected = FALSE;
+    BOOL bStopped = FALSE;
+    BOOL bCsInit = FALSE;
+    int result = 1;
+
+    if (!GetWatchEventName(pszPath, szEventName, MAX_PATH))
+    {
+        ShowResolveError(pszPath, RESOLVE_NOT_SSHFS, L"SSHFS-Win - Watch");
+        return 1;
+    }
+
+    /* A watcher is already running for this mount: ask it to stop */
+    hStop = CreateEventW(NULL, TRUE, FALSE, szEventName);
+    if (!hStop)
+        return 1;
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        SetEvent(hStop);
+        CloseHandle(hStop);
+        return 0;
+    }
+
+    w = calloc(1, sizeof(Watcher));
+    pLoc = malloc(sizeof(SSHFSLocation));
+    if (!w || !pLoc || !WatchParserInit(&w->parser))
+        goto cleanup;
+    InitializeCriticalSection(&w->cs);
+    bCsInit = TRUE;
+    WatchCoalescerInit(&w->co);
+    w->hData = CreateEventW(NULL, FALSE, FALSE, NULL);
+    hErr = CreateScratchFile();
+    if (!w->hData || hErr == INVALID_HANDLE_VALUE)
+        goto cleanup;
+
+    StringCchCopyW(w->szRoot, MAX_PATH, pszPath);
+    if (!PathStripToRootW(w->szRoot))
+        goto cleanup;
+    PathAddBackslashW(w->szRoot);
+    res = ResolveSSHFSPath(w->szRoot, pLoc);
+    if (res != RESOLVE_OK)
+    {
+        ShowResolveError(w->szRoot, res, L"SSHFS-Win - Watch");
+        goto cleanup;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, pLoc->szRemotePath, -1, w->szRemote, sizeof(w->szRemote), NULL, NULL);
+
+    while (!bStopped)
+    {
+        PROCESS_INFORMATION pi = {0};
+        HANDLE hThread;
+        ULONGLONG msStart = GetTickCount64();
+        ULONGLONG msChecked = msStart;
+        DWORD dwExitCode = 0;
+
+        if (!StartWatchProcess(w, pLoc, hErr, &pi, szError, 512))
+        {
+            MessageBoxW(NULL, szError, L"SSHFS-Win - Watch", MB_OK | MB_ICONERROR);
+            goto cleanup;
+        }
+        hThread = CreateThread(NULL, 0, WatchReaderThread, w, 0, NULL);
+        if (!hThread)
+        {
+            TerminateProcess(pi.hProcess, 1);
+            CloseHandle(pi.hProcess);
+            CloseHandle(pi.hThread);
+            CloseHandle(w->hOutRead);
+            w->hOutRead = NULL;
+            goto cleanup;
+        }
+
+        for (;;)
+        {
+            HANDLE handles[3] = {hStop, pi.hProcess, w->hData};
+            unsigned long due;
+            DWORD dwWait;
+
+            EnterCriticalSection(&w->cs);
+            due = WatchCoalescerDue(&w->co, GetTickCount64());
+            if (due == 0)
+                WatchCoalescerFlush(&w->co, SendWatchNotify, w);
+            LeaveCriticalSection(&w->cs);
+
+            dwWait = WaitForMultipleObjects(3, handles, FALSE,
+                due == 0 || due > WATCH_CHECK_MS ? WATCH_CHECK_MS : due);
+            if (dwWait == WAIT_OBJECT_0)
+            {
+                bStopped = TRUE;
+                TerminateProcess(pi.hProcess, 0);
+                break;
+            }
+            if (dwWait == WAIT_OBJECT_0 + 1)
+                break;
+
+            /* Disconnecting the drive ends the watcher */
+            if (GetTickCount64() - msChecked >= WATCH_CHECK_MS)
+            {
+                msChecked = GetTickCount64();
+                if (ResolveSSHFSPath(w->szRoot, pLoc) != RESOLVE_OK)
+                {
+                    bStopped = TRUE;
+                    TerminateProcess(pi.hProcess, 0);
+                    break;
+                }
+            }
+        }
+
+        WaitForSingleObject(hThread, INFINITE);
+        CloseHandle(hThread);
+        GetExitCodeProcess(pi.hProcess, &dwExitCode);
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+        CloseHandle(w->hOutRead);
+        w->hOutRead = NULL;
+
+        /* What came in before the end, and whatever was missed until the
+         * next connection: the flush after it refreshes the root */
+        EnterCriticalSection(&w->cs);
+        WatchCoalescerFlush(&w->co, SendWatchNotify, w);
+        if (!bStopped)
+        {
+            WatchEvent ev = {WATCH_EV_OVERFLOW, ""};
+            WatchCoalescerAdd(&w->co, &ev, GetTickCount64());
+        }
+        LeaveCriticalSection(&w->cs);
+        if (bStopped)
+            break;
+
+        /* A first connection that fails is a setup problem worth showing */
+        if (!bEverConnected && GetTickCount64() - msStart < WATCH_STABLE_MS && dwExitCode == 255)
+        {
+            ReadErrorTail(hErr, szError, 512);
+            MessageBoxW(NULL, szError[0] ? szError : L"The connection to the server failed.",
+                L"SSHFS-Win - Watch", MB_OK | MB_ICONERROR);
+            goto cleanup;
+        }
+        bEverConnected = TRUE;
+
+        if (GetTickCount64() - msStart >= WATCH_STABLE_MS)
+            retryMs = WATCH_RETRY_MIN_MS;
+        if (WaitForSingleObject(hStop, retryMs) == WAIT_OBJECT_0)
+            break;
+        retryMs = retryMs * 2 > WATCH_RETRY_MAX_MS ? WATCH_RETRY_MAX_MS : retryMs * 2;
+    }
+    result = 0;
+
+cleanup:
+    if (hErr != INVALID_HANDLE_VALUE)
+        CloseHandle(hErr);
+    if (w)
+    {
+        if (w->hData)
+            CloseHandle(w->hData);
+        if (bCsInit)
+            DeleteCriticalSection(&w->cs);
+        WatchParserFree(&w->parser);
+        WatchCoalescerFree(&w->co);
+    }
+    free(w);
+    free(pLoc);
+    CloseHandle(hStop);
+    return result;
+}
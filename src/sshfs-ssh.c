@@ -5,9 +5,30 @@
  * Uses Windows built-in OpenSSH via ConPTY for proper terminal emulation
  * Supports both password and key-based authentication
  *
+ * Also runs server-side copy/move for the shell extension's drag and drop
+ * menu: sshfs-ssh.exe --copy|--move <destination> <item>...
+ * and streamed folder downloads: sshfs-ssh.exe --download <path> [<folder>]
+ * and uploads: sshfs-ssh.exe --upload <destination> <local item>...
+ * and remote hashing: sshfs-ssh.exe --hash <item>...
+ *                     sshfs-ssh.exe --compare <folder> [<local folder>]
+ * and searching on the server: sshfs-ssh.exe --search <folder>
+ * and snapshots of a mount's tree: sshfs-ssh.exe --snapshot <path>
+ * and disk usage measured on the server: sshfs-ssh.exe --usage <folder>
+ * and shell notifications for changes made on the server: sshfs-ssh.exe --watch <path>
+ * and delta sync of an edited file: sshfs-ssh.exe --sync <folder> [<local file>]
+ * and commands run on the server from scripts: sshfs-ssh.exe exec <path> -- <command>...
+ * and terminals on every mount of the same folder: sshfs-ssh.exe --fanout <folder>
+ * and connection phase timings: sshfs-ssh.exe --bench <path> [<runs>] ["<ssh options>"...]
+ * and thumbnails made on the server: sshfs-ssh.exe --thumbs <folder> [<first file>]
+ * and the per-user credential broker: sshfs-ssh.exe --broker (started on demand),
+ *                                     sshfs-ssh.exe --forget-passwords
+ * Each verb is in its own sshfs-ssh-<verb>.c; what they share is here
+ * (sshfs-ssh.h).
+ *
  * This is a native Windows program - no Cygwin dependencies
  */
 
+#define COBJMACROS
 #ifndef UNICODE
 #define UNICODE
 #endif
@@ -18,16 +39,32 @@
 #include <windows.h>
 #include <wincred.h>
 #include <shellapi.h>
+#include <shlobj.h>
 #include <shlwapi.h>
 #include <strsafe.h>
-#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-path.h"
+#include "sshfs-remote.h"
+#include "sshfs-relay.h"
+#include "sshfs-hash.h"
+#include "sshfs-broker.h"
+#include "sshfs-cred.h"
+#include "sshfs-ssh.h"
 
 #ifdef _MSC_VER
 #pragma comment(lib, "advapi32.lib")
+#pragma comment(lib, "bcrypt.lib")
+#pragma comment(lib, "comctl32.lib")
 #pragma comment(lib, "credui.lib")
+#pragma comment(lib, "gdi32.lib")
 #pragma comment(lib, "mpr.lib")
+#pragma comment(lib, "ole32.lib")
 #pragma comment(lib, "shell32.lib")
 #pragma comment(lib, "shlwapi.lib")
+#pragma comment(lib, "uuid.lib")
 #endif
 
 /* Debug flags - set to 1 to enable debug message boxes */
@@ -36,16 +73,6 @@
 #define DEBUG_CRED 0       /* Show credential lookup debug info */
 #define DEBUG_PASSWORD 0   /* Show the actual password retrieved (SECURITY RISK - disable after debugging) */
 
-/**
- * Mount type enumeration
- */
-typedef enum {
-    MOUNT_TYPE_PASSWORD,        /* \\sshfs\... - password auth */
-    MOUNT_TYPE_PASSWORD_ROOT,   /* \\sshfs.r\... - password auth, root path */
-    MOUNT_TYPE_KEY,             /* \\sshfs.k\... - key auth */
-    MOUNT_TYPE_KEY_ROOT         /* \\sshfs.kr\... - key auth, root path */
-} MountType;
-
 /**
  * Extract password from credential blob, handling Unicode vs ANSI encoding
  */
@@ -58,12 +85,7 @@ static BOOL ExtractPasswordFromCredential(PCREDENTIALW pCred, LPWSTR pszPassword
     BYTE *blob = pCred->CredentialBlob;
 
     /* Detect if password is stored as Unicode or ANSI */
-    BOOL isUnicode = FALSE;
-    if (blobSize >= 4 && (blobSize % 2) == 0)
-    {
-        if (blob[1] == 0 && blob[3] == 0)
-            isUnicode = TRUE;
-    }
+    BOOL isUnicode = CredBlobIsUtf16(blob, blobSize);
 
     if (isUnicode)
     {
@@ -93,7 +115,7 @@ static BOOL ExtractPasswordFromCredential(PCREDENTIALW pCred, LPWSTR pszPassword
  * Try to read password from Windows Credential Manager
  * First tries exact target names, then enumerates all credentials to find a match
  */
-static BOOL GetStoredPassword(
+static BOOL FindStoredPassword(
     LPCWSTR pszUser,
     LPCWSTR pszHost,
     LPCWSTR pszPort,
@@ -104,8 +126,11 @@ static BOOL GetStoredPassword(
     PCREDENTIALW *pCredentials = NULL;
     DWORD dwCount = 0;
     BOOL bFound = FALSE;
+    CredPattern pattern;
 
     pszPassword[0] = L'\0';
+    if (!CredPatternInit(&pattern, (const CredChar *)pszUser, (const CredChar *)pszHost))
+        return FALSE;
 
     /* Build search pattern for user@host */
     WCHAR szSearchPattern[512];
@@ -139,14 +164,7 @@ static BOOL GetStoredPassword(
             if (pc->TargetName)
             {
                 /* Check if target contains our user@host pattern (case-insensitive) */
-                WCHAR szTargetLower[MAX_PATH];
-                WCHAR szPatternLower[512];
-                StringCchCopyW(szTargetLower, MAX_PATH, pc->TargetName);
-                StringCchCopyW(szPatternLower, 512, szSearchPattern);
-                _wcslwr_s(szTargetLower, MAX_PATH);
-                _wcslwr_s(szPatternLower, 512);
-
-                if (wcsstr(szTargetLower, szPatternLower))
+                if (CredTargetMatches(&pattern, (const CredChar *)pc->TargetName))
                 {
 #if DEBUG_CRED
                     {
@@ -206,220 +224,298 @@ static BOOL GetStoredPassword(
 }
 
 /**
- * Parse SSHFS UNC path to extract connection info
+ * Get path to a helper executable bundled next to sshfs-ssh.exe
  */
-static BOOL ParseSSHFSUNCPath(
-    LPCWSTR pszUNC,
-    LPWSTR pszUser, DWORD cchUser,
-    LPWSTR pszHost, DWORD cchHost,
-    LPWSTR pszPort, DWORD cchPort,
-    LPWSTR pszBasePath, DWORD cchBasePath,
-    MountType *pMountType)
+static BOOL GetHelperPath(LPCWSTR pszName, LPWSTR pszPath, DWORD cchPath)
 {
-    WCHAR szWork[MAX_PATH * 2];
-    WCHAR *p, *pInstance, *pPath;
-    WCHAR *pAt, *pBang, *pEquals;
+    WCHAR szModulePath[MAX_PATH];
 
-    if (!pszUNC || wcslen(pszUNC) < 10)
-        return FALSE;
+    if (GetModuleFileNameW(NULL, szModulePath, MAX_PATH))
+    {
+        WCHAR *pLastSlash = wcsrchr(szModulePath, L'\\');
+        if (pLastSlash)
+        {
+            *pLastSlash = L'\0';
+            StringCchPrintfW(pszPath, cchPath, L"%s\\%s", szModulePath, pszName);
+            if (GetFileAttributesW(pszPath) != INVALID_FILE_ATTRIBUTES)
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
 
-    StringCchCopyW(szWork, MAX_PATH * 2, pszUNC);
+BOOL GetAskpassPath(LPWSTR pszPath, DWORD cchPath)
+{
+    return GetHelperPath(L"sshfs-ssh-askpass.exe", pszPath, cchPath);
+}
 
-    p = szWork;
-    while (*p == L'\\') p++;
+DWORD GetTerminalSetting(LPCWSTR pszName, DWORD dwDefault)
+{
+    HKEY hKey;
+    DWORD dwValue, dwType, dwSize = sizeof(DWORD);
 
-    if (_wcsnicmp(p, L"sshfs.kr\\", 9) == 0 || _wcsnicmp(p, L"sshfs.kr/", 9) == 0)
-    {
-        *pMountType = MOUNT_TYPE_KEY_ROOT;
-        p += 9;
-    }
-    else if (_wcsnicmp(p, L"sshfs.k\\", 8) == 0 || _wcsnicmp(p, L"sshfs.k/", 8) == 0)
-    {
-        *pMountType = MOUNT_TYPE_KEY;
-        p += 8;
-    }
-    else if (_wcsnicmp(p, L"sshfs.r\\", 8) == 0 || _wcsnicmp(p, L"sshfs.r/", 8) == 0)
-    {
-        *pMountType = MOUNT_TYPE_PASSWORD_ROOT;
-        p += 8;
-    }
-    else if (_wcsnicmp(p, L"sshfs\\", 6) == 0 || _wcsnicmp(p, L"sshfs/", 6) == 0)
-    {
-        *pMountType = MOUNT_TYPE_PASSWORD;
-        p += 6;
-    }
-    else
-    {
-        return FALSE;
-    }
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, L"SOFTWARE\\SSHFS-Win\\Terminal",
+        0, KEY_READ, &hKey) != ERROR_SUCCESS)
+        return dwDefault;
+
+    if (RegQueryValueExW(hKey, pszName, NULL, &dwType, (LPBYTE)&dwValue, &dwSize) != ERROR_SUCCESS ||
+        dwType != REG_DWORD)
+        dwValue = dwDefault;
+
+    RegCloseKey(hKey);
+    return dwValue;
+}
+
+/**
+ * Send a request to the credential broker (sshfs-broker.h). With bStart a
+ * broker is started if none runs yet; lookups leave that to the first
+ * launch that has something to hand over.
+ */
+static BOOL CallBroker(const char *pszRequest, char *pszResponse, DWORD cchResponse, BOOL bStart)
+{
+    WCHAR szExePath[MAX_PATH], szDir[MAX_PATH], szCmdLine[MAX_PATH + 16];
+    WCHAR *pSlash;
+    STARTUPINFOW si = {0};
+    PROCESS_INFORMATION pi = {0};
+    int i;
 
-    pInstance = p;
-    pPath = NULL;
+    if (BrokerCall(pszRequest, pszResponse, cchResponse))
+        return TRUE;
+    if (!bStart || GetLastError() != ERROR_FILE_NOT_FOUND)
+        return FALSE;
 
-    while (*p && *p != L'\\' && *p != L'/') p++;
+    /* Started from our own folder, so it holds no directory of a mount open */
+    if (!GetModuleFileNameW(NULL, szExePath, MAX_PATH))
+        return FALSE;
+    StringCchCopyW(szDir, MAX_PATH, szExePath);
+    pSlash = wcsrchr(szDir, L'\\');
+    if (pSlash)
+        *pSlash = L'\0';
+    StringCchPrintfW(szCmdLine, MAX_PATH + 16, L"\"%s\" --broker", szExePath);
+    si.cb = sizeof(si);
+    if (!CreateProcessW(NULL, szCmdLine, NULL, NULL, FALSE,
+        DETACHED_PROCESS | CREATE_NO_WINDOW, NULL, szDir, &si, &pi))
+        return FALSE;
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
 
-    if (*p)
+    for (i = 0; i < 40; i++)
     {
-        *p = L'\0';
-        pPath = p + 1;
+        if (BrokerCall(pszRequest, pszResponse, cchResponse))
+            return TRUE;
+        if (GetLastError() != ERROR_FILE_NOT_FOUND && GetLastError() != ERROR_PIPE_BUSY)
+            return FALSE;
+        Sleep(25);
     }
+    return FALSE;
+}
 
-    pEquals = wcschr(pInstance, L'=');
-    if (pEquals)
-        pInstance = pEquals + 1;
+/**
+ * "<request> <hex of the password as UTF-8>" for the broker
+ */
+static BOOL FormatBrokerSecret(LPCSTR pszPrefix, LPCWSTR pszPassword, char *pszRequest, size_t cchRequest)
+{
+    char szSecret[BROKER_MAX_SECRET];
+    size_t cchPrefix = strlen(pszPrefix);
+    int cb;
 
-    pAt = wcschr(pInstance, L'@');
-    if (!pAt)
+    cb = WideCharToMultiByte(CP_UTF8, 0, pszPassword, -1, szSecret, (int)sizeof(szSecret), NULL, NULL);
+    if (cb <= 1 || cchPrefix + (size_t)(cb - 1) * 2 + 1 > cchRequest)
+    {
+        SecureZeroMemory(szSecret, sizeof(szSecret));
         return FALSE;
+    }
+    memcpy(pszRequest, pszPrefix, cchPrefix);
+    BrokerHexEncode(szSecret, (size_t)(cb - 1), pszRequest + cchPrefix, cchRequest - cchPrefix);
+    SecureZeroMemory(szSecret, sizeof(szSecret));
+    return TRUE;
+}
+
+BOOL GetStoredPassword(
+    LPCWSTR pszUser,
+    LPCWSTR pszHost,
+    LPCWSTR pszPort,
+    LPWSTR pszPassword,
+    DWORD cchPassword)
+{
+    WCHAR szKeyW[BROKER_MAX_KEY];
+    char szKey[BROKER_MAX_KEY * 3];
+    char szRequest[BROKER_MAX_LINE];
+    char szResponse[BROKER_MAX_LINE];
+    char szSecret[BROKER_MAX_SECRET + 1];
+    size_t cbSecret;
+    BOOL bCache = GetTerminalSetting(L"CredentialCacheSeconds", BROKER_DEFAULT_TTL) > 0;
+    BOOL bFound = FALSE;
 
-    *pAt = L'\0';
-    StringCchCopyW(pszUser, cchUser, pInstance);
+    StringCchPrintfW(szKeyW, BROKER_MAX_KEY, L"%s@%s:%s", pszUser, pszHost,
+        pszPort && pszPort[0] ? pszPort : L"22");
+    WideCharToMultiByte(CP_UTF8, 0, szKeyW, -1, szKey, (int)sizeof(szKey), NULL, NULL);
 
-    pBang = wcschr(pAt + 1, L'!');
-    if (pBang)
+    StringCchPrintfA(szRequest, BROKER_MAX_LINE, "CRED %s", szKey);
+    if (bCache && CallBroker(szRequest, szResponse, BROKER_MAX_LINE, FALSE) && strncmp(szResponse, "OK ", 3) == 0)
     {
-        *pBang = L'\0';
-        StringCchCopyW(pszHost, cchHost, pAt + 1);
-        StringCchCopyW(pszPort, cchPort, pBang + 1);
+        cbSecret = BrokerHexDecode(szResponse + 3, strlen(szResponse + 3), szSecret, BROKER_MAX_SECRET);
+        if (cbSecret != (size_t)-1)
+        {
+            szSecret[cbSecret] = '\0';
+            bFound = MultiByteToWideChar(CP_UTF8, 0, szSecret, -1, pszPassword, (int)cchPassword) > 1;
+        }
+        SecureZeroMemory(szResponse, sizeof(szResponse));
+        SecureZeroMemory(szSecret, sizeof(szSecret));
+        if (bFound)
+            return TRUE;
     }
-    else
+
+    bFound = FindStoredPassword(pszUser, pszHost, pszPort, pszPassword, cchPassword);
+    if (bFound && bCache)
     {
-        StringCchCopyW(pszHost, cchHost, pAt + 1);
-        pszPort[0] = L'\0';
+        char szPrefix[BROKER_MAX_KEY * 3 + 8];
+
+        StringCchPrintfA(szPrefix, sizeof(szPrefix), "PUT %s ", szKey);
+        if (FormatBrokerSecret(szPrefix, pszPassword, szRequest, BROKER_MAX_LINE))
+            CallBroker(szRequest, szResponse, BROKER_MAX_LINE, TRUE);
+        SecureZeroMemory(szRequest, sizeof(szRequest));
     }
+    return bFound;
+}
+
+void SetAskpassEnvironment(LPCWSTR pszAskpassPath, LPCWSTR pszPassword)
+{
+    char szRequest[BROKER_MAX_LINE];
+    char szResponse[BROKER_MAX_LINE];
+    WCHAR szToken[BROKER_TOKEN_LEN + 1];
+    BOOL bToken = FALSE;
 
-    if (pPath && *pPath)
+    SetEnvironmentVariableW(L"SSH_ASKPASS", pszAskpassPath);
+    SetEnvironmentVariableW(L"SSH_ASKPASS_REQUIRE", pszAskpassPath ? L"force" : NULL);
+
+    if (pszPassword && FormatBrokerSecret("GRANT ", pszPassword, szRequest, BROKER_MAX_LINE))
     {
-        StringCchCopyW(pszBasePath, cchBasePath, pPath);
-        for (WCHAR *q = pszBasePath; *q; q++)
-            if (*q == L'\\') *q = L'/';
+        bToken = CallBroker(szRequest, szResponse, BROKER_MAX_LINE, TRUE) &&
+            strncmp(szResponse, "OK ", 3) == 0 && strlen(szResponse + 3) == BROKER_TOKEN_LEN;
+        if (bToken)
+            MultiByteToWideChar(CP_UTF8, 0, szResponse + 3, -1, szToken, BROKER_TOKEN_LEN + 1);
+        SecureZeroMemory(szRequest, sizeof(szRequest));
     }
-    else
+
+    SetEnvironmentVariableW(L"SSHFS_ASKPASS_TOKEN", bToken ? szToken : NULL);
+    SetEnvironmentVariableW(L"SSHFS_PASSWORD", bToken ? NULL : pszPassword);
+}
+
+/**
+ * Collect sshfs-ssh-launcher.exe switches for the optional terminal features.
+ * Returns TRUE if any is enabled, i.e. the session has to go through the relay.
+ */
+static BOOL BuildRelayOptions(LPWSTR pszOptions, DWORD cchOptions)
+{
+    WCHAR szBlock[32];
+    DWORD dwBlockMs;
+
+    pszOptions[0] = L'\0';
+
+    if (GetTerminalSetting(L"PredictiveEcho", 0))
+        StringCchCatW(pszOptions, cchOptions, L" --predict");
+    if (GetTerminalSetting(L"LiveStats", 0))
+        StringCchCatW(pszOptions, cchOptions, L" --stats");
+    if ((dwBlockMs = GetTerminalSetting(L"RecordBlockMs", 0)) != 0)
     {
-        pszBasePath[0] = L'\0';
+        StringCchPrintfW(szBlock, 32, L" --record-block %lu", dwBlockMs);
+        StringCchCatW(pszOptions, cchOptions, szBlock);
     }
+    else if (GetTerminalSetting(L"RecordSessions", 0))
+        StringCchCatW(pszOptions, cchOptions, L" --record");
 
-    return TRUE;
+    return pszOptions[0] != L'\0';
 }
 
 /**
- * Get the UNC path for a drive letter
+ * sshfs-ssh-connect.exe, if ParallelConnect is set: ssh's ProxyCommand
+ * then connects to all of the host's addresses at once. It takes the place
+ * of a ProxyCommand or ProxyJump the host has in the ssh config.
  */
-static BOOL GetDriveUNCPath(WCHAR driveLetter, LPWSTR pszUNC, DWORD cchUNC)
+static BOOL GetConnectHelper(LPWSTR pszPath, DWORD cchPath)
 {
-    WCHAR szDrive[4] = {driveLetter, L':', L'\0'};
-    DWORD dwLen = cchUNC;
-    return WNetGetConnectionW(szDrive, pszUNC, &dwLen) == NO_ERROR;
+    return GetTerminalSetting(L"ParallelConnect", 0) &&
+        GetHelperPath(L"sshfs-ssh-connect.exe", pszPath, cchPath);
 }
 
 /**
- * Build the full remote path
+ * Relay switch for directory tracking (TrackDirectory): the root of the
+ * mount pszLocalPath is on, locally (the drive, or \\sshfs...\user@host)
+ * and on the server, and the folder the session starts in
  */
-static void BuildFullRemotePath(
-    LPCWSTR pszLocalPath,
-    LPCWSTR pszUNCPath,
-    LPCWSTR pszUNCBasePath,
-    MountType mountType,
-    LPWSTR pszFullRemotePath,
-    DWORD cchFullRemotePath)
+static BOOL BuildCwdMapOption(LPCWSTR pszLocalPath, LPCWSTR pszRemotePath, LPWSTR pszOption, DWORD cchOption)
 {
-    WCHAR szRemotePath[MAX_PATH * 2] = {0};
-    WCHAR szLocalSubPath[MAX_PATH] = {0};
-    BOOL bRootMount = (mountType == MOUNT_TYPE_PASSWORD_ROOT || mountType == MOUNT_TYPE_KEY_ROOT);
+    WCHAR szRoot[MAX_PATH];
+    SSHFSLocation rootLoc;
+    WCHAR *p;
+    int nSeparators = 0;
 
-    if (pszUNCPath && pszUNCPath[0])
+    StringCchCopyW(szRoot, MAX_PATH, pszLocalPath);
+    if (szRoot[0] && szRoot[1] == L':')
     {
-        WCHAR *p = (WCHAR *)pszUNCPath;
-        while (*p == L'\\') p++;
-        while (*p && *p != L'\\' && *p != L'/') p++;
-        if (*p) p++;
-        while (*p && *p != L'\\' && *p != L'/') p++;
-        if (*p) StringCchCopyW(szRemotePath, MAX_PATH * 2, p);
+        szRoot[2] = L'\0';
     }
-
-    if (pszLocalPath[1] == L':' && pszLocalPath[2])
-        StringCchCopyW(szLocalSubPath, MAX_PATH, pszLocalPath + 2);
-
-    for (WCHAR *q = szRemotePath; *q; q++)
-        if (*q == L'\\') *q = L'/';
-    for (WCHAR *q = szLocalSubPath; *q; q++)
-        if (*q == L'\\') *q = L'/';
-
-    WCHAR szCombined[MAX_PATH * 2];
-    StringCchPrintfW(szCombined, MAX_PATH * 2, L"%s%s", szRemotePath, szLocalSubPath);
-
-    /* Check if path contains .. components */
-    BOOL hasParentDir = (wcsstr(szCombined, L"../") != NULL || wcsstr(szCombined, L"..\\") != NULL);
-
-    if (bRootMount)
+    else if (szRoot[0] == L'\\' && szRoot[1] == L'\\')
     {
-        /* Root mount: path is absolute from / */
-        if (szCombined[0] == L'/')
-            StringCchCopyW(pszFullRemotePath, cchFullRemotePath, szCombined);
-        else
-            StringCchPrintfW(pszFullRemotePath, cchFullRemotePath, L"/%s", szCombined);
+        for (p = szRoot + 2; *p; p++)
+        {
+            if ((*p == L'\\' || *p == L'/') && ++nSeparators == 2)
+            {
+                *p = L'\0';
+                break;
+            }
+        }
     }
     else
     {
-        /* Home mount: path is relative to home directory (~) */
-        if (szCombined[0] == L'/')
-            StringCchPrintfW(pszFullRemotePath, cchFullRemotePath, L"~%s", szCombined);
-        else if (szCombined[0])
-            StringCchPrintfW(pszFullRemotePath, cchFullRemotePath, L"~/%s", szCombined);
-        else
-            StringCchCopyW(pszFullRemotePath, cchFullRemotePath, L"~");
+        return FALSE;
     }
 
-    /* Clean up double slashes */
-    WCHAR szClean[MAX_PATH * 2];
-    WCHAR *src = pszFullRemotePath;
-    WCHAR *dst = szClean;
-    BOOL lastWasSlash = FALSE;
-    
-    while (*src)
-    {
-        if (*src == L'/')
-        {
-            if (!lastWasSlash) { *dst++ = *src; lastWasSlash = TRUE; }
-        }
-        else
-        {
-            *dst++ = *src;
-            lastWasSlash = FALSE;
-        }
-        src++;
-    }
-    *dst = L'\0';
+    /* The root's remote path is built the same way as the folder's */
+    if (ResolveSSHFSPath(szRoot, &rootLoc) != RESOLVE_OK)
+        return FALSE;
 
-    StringCchCopyW(pszFullRemotePath, cchFullRemotePath, szClean);
+    return SUCCEEDED(StringCchPrintfW(pszOption, cchOption, L" --cwd-map \"%s\" \"%s\" \"%s\"",
+        szRoot, rootLoc.szRemotePath, pszRemotePath));
 }
 
+#define ATTACH_MAX 2048     /* RemoteBuildAttachCommand() */
+
 /**
- * Get path to sshfs-ssh-askpass.exe (bundled with sshfs-ctx)
+ * Persistent session for the terminal (AttachSession): the session name
+ * for user@host:port and pszRemotePath (RemoteSessionName()) and the part
+ * of the remote command that attaches to it, in place of "exec $SHELL".
+ * Other detached sessions are reaped after AttachIdleHours (default 24,
+ * 0 never). FALSE if the setting is off.
  */
-static BOOL GetAskpassPath(LPWSTR pszPath, DWORD cchPath)
+static BOOL BuildAttachCommand(LPCWSTR pszUser, LPCWSTR pszHost, LPCWSTR pszPort, LPCWSTR pszRemotePath,
+    LPWSTR pszSession, DWORD cchSession, LPWSTR pszShell, DWORD cchShell)
 {
-    WCHAR szModulePath[MAX_PATH];
+    char szUser[256 * 3], szHost[256 * 3], szPort[16 * 3], szPath[MAX_PATH * 6];
+    char szSessionA[REMOTE_SESSION_NAME_MAX];
+    char szShellA[ATTACH_MAX];
 
-    if (GetModuleFileNameW(NULL, szModulePath, MAX_PATH))
-    {
-        WCHAR *pLastSlash = wcsrchr(szModulePath, L'\\');
-        if (pLastSlash)
-        {
-            *pLastSlash = L'\0';
-            StringCchPrintfW(pszPath, cchPath, L"%s\\sshfs-ssh-askpass.exe", szModulePath);
-            if (GetFileAttributesW(pszPath) != INVALID_FILE_ATTRIBUTES)
-                return TRUE;
-        }
-    }
+    if (!GetTerminalSetting(L"AttachSession", 0))
+        return FALSE;
 
-    return FALSE;
+    if (!WideCharToMultiByte(CP_UTF8, 0, pszUser, -1, szUser, (int)sizeof(szUser), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, pszHost, -1, szHost, (int)sizeof(szHost), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, pszPort ? pszPort : L"", -1, szPort, (int)sizeof(szPort), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, pszRemotePath, -1, szPath, (int)sizeof(szPath), NULL, NULL))
+        return FALSE;
+
+    RemoteSessionName(szUser, szHost, szPort, szPath, szSessionA, sizeof(szSessionA));
+    if (RemoteBuildAttachCommand(szSessionA, (int)GetTerminalSetting(L"AttachIdleHours", 24),
+        szShellA, sizeof(szShellA)) >= sizeof(szShellA))
+        return FALSE;
+
+    return MultiByteToWideChar(CP_UTF8, 0, szSessionA, -1, pszSession, (int)cchSession) &&
+        MultiByteToWideChar(CP_UTF8, 0, szShellA, -1, pszShell, (int)cchShell);
 }
 
-/**
- * Find ssh.exe - try Windows OpenSSH first
- */
-static BOOL FindSSH(LPWSTR pszPath, DWORD cchPath)
+BOOL FindSSH(LPWSTR pszPath, DWORD cchPath)
 {
     WCHAR szSystemPath[MAX_PATH];
 
@@ -442,30 +538,199 @@ static BOOL FindSSH(LPWSTR pszPath, DWORD cchPath)
 }
 
 /**
- * Launch SSH terminal directly using Windows OpenSSH
+ * Launch SSH terminal through sshfs-ssh-launcher.exe (ConPTY relay)
  *
- * Launches ssh.exe directly in its own console window (no ConPTY middleman).
- * For password auth, uses SSH_ASKPASS mechanism with sshfs-ssh-askpass.exe.
- * This gives native terminal behavior: resize, Ctrl+C, VT sequences all
- * handled by the console itself.
+ * Used when one of the relay features is enabled. The launcher answers the
+ * password prompt itself, so the password goes to it over an inherited pipe
+ * instead of the askpass environment.
  */
-static BOOL LaunchSSHTerminal(
+static BOOL LaunchRelay(
+    LPCWSTR pszUser,
+    LPCWSTR pszHost,
+    LPCWSTR pszPort,
+    LPCWSTR pszRemoteCmd,
+    LPCWSTR pszPassword,
+    LPCWSTR pszOptions,
+    BroadcastLink *pLink)
+{
+    WCHAR szLauncherPath[MAX_PATH];
+    WCHAR szTarget[512];
+    WCHAR szCmdLine[MAX_PATH * 16];
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    HANDLE hPassRead = NULL, hPassWrite = NULL;
+    STARTUPINFOW si = {0};
+    PROCESS_INFORMATION pi = {0};
+    BOOL bResult;
+
+    if (!GetHelperPath(L"sshfs-ssh-launcher.exe", szLauncherPath, MAX_PATH))
+    {
+        MessageBoxW(NULL,
+            L"Could not find sshfs-ssh-launcher.exe.\n\n"
+            L"Please ensure sshfs-ssh-launcher.exe is in the same directory as sshfs-ssh.exe.",
+            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONERROR);
+        return FALSE;
+    }
+
+    if (pszPort && pszPort[0])
+        StringCchPrintfW(szTarget, 512, L"%s@%s:%s", pszUser, pszHost, pszPort);
+    else
+        StringCchPrintfW(szTarget, 512, L"%s@%s", pszUser, pszHost);
+
+    /* Hand the password over in a pipe the launcher inherits */
+    if (pszPassword && pszPassword[0])
+    {
+        char szPasswordA[RELAY_MAX_PASSWORD];
+        DWORD cbPassword, dwWritten;
+        BOOL bWritten;
+
+        cbPassword = (DWORD)WideCharToMultiByte(CP_UTF8, 0, pszPassword, -1, szPasswordA,
+            (int)sizeof(szPasswordA), NULL, NULL);
+        if (cbPassword <= 1)
+        {
+            SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
+            MessageBoxW(NULL, L"The stored password is too long to hand to the terminal.",
+                L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONERROR);
+            return FALSE;
+        }
+        if (!CreatePipe(&hPassRead, &hPassWrite, &sa, 0))
+        {
+            SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
+            return FALSE;
+        }
+        SetHandleInformation(hPassWrite, HANDLE_FLAG_INHERIT, 0);
+
+        /* Far less than a pipe's buffer: written whole before the launcher runs */
+        bWritten = WriteFile(hPassWrite, szPasswordA, cbPassword - 1, &dwWritten, NULL) &&
+            dwWritten == cbPassword - 1;
+        CloseHandle(hPassWrite);
+        SecureZeroMemory(szPasswordA, sizeof(szPasswordA));
+        if (!bWritten)
+        {
+            CloseHandle(hPassRead);
+            return FALSE;
+        }
+    }
+
+    StringCchPrintfW(szCmdLine, MAX_PATH * 16, L"\"%s\"%s %s %llu \"%s\"",
+        szLauncherPath, pszOptions, szTarget,
+        (unsigned long long)(ULONG_PTR)hPassRead, pszRemoteCmd);
+
+    si.cb = sizeof(si);
+    bResult = CreateProcessW(NULL, szCmdLine, NULL, NULL, TRUE,
+        CREATE_NEW_CONSOLE, NULL, NULL, &si, &pi);
+
+    if (hPassRead)
+        CloseHandle(hPassRead);
+
+    if (!bResult)
+    {
+        WCHAR szError[512];
+        StringCchPrintfW(szError, 512,
+            L"Failed to launch SSH terminal.\nError code: %lu\n\nCommand: %s",
+            GetLastError(), szCmdLine);
+        MessageBoxW(NULL, szError, L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONERROR);
+        return FALSE;
+    }
+
+    if (pLink)
+        pLink->hProcess = pi.hProcess;
+    else
+        CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    return TRUE;
+}
+
+BOOL LaunchSSHTerminal(
     LPCWSTR pszUser,
     LPCWSTR pszHost,
     LPCWSTR pszPort,
     LPCWSTR pszRemotePath,
-    MountType mountType)
+    LPCWSTR pszLocalPath,
+    MountType mountType,
+    BroadcastLink *pLink)
 {
     WCHAR szSSHPath[MAX_PATH];
     WCHAR szAskpassPath[MAX_PATH];
     WCHAR szPassword[256] = {0};
-    WCHAR szCmdLine[MAX_PATH * 8];
+    WCHAR szCmdLine[MAX_PATH * 12];
     WCHAR szTitle[512];
-    WCHAR szRemoteCmd[MAX_PATH * 2];
+    WCHAR szRemoteCmd[MAX_PATH * 2 + ATTACH_MAX];
+    WCHAR szCleanPath[MAX_PATH * 2];
+    WCHAR szSession[REMOTE_SESSION_NAME_MAX];
+    WCHAR szShell[ATTACH_MAX] = L"exec $SHELL";
+    WCHAR szRelayOptions[MAX_PATH * 8];
+    WCHAR szCwdMap[MAX_PATH * 3];
+    WCHAR szConnectHelper[MAX_PATH];
+    WCHAR szProxy[MAX_PATH + 64] = L"";
     STARTUPINFOW si = {0};
     PROCESS_INFORMATION pi = {0};
     BOOL bResult;
     BOOL bHasPassword = FALSE;
+    BOOL bConnect = GetConnectHelper(szConnectHelper, MAX_PATH);
+    BOOL bRelay = BuildRelayOptions(szRelayOptions, MAX_PATH * 8);
+    BOOL bAttach;
+
+    /* Quotes would end the remote command early */
+    {
+        WCHAR *src = (WCHAR*)pszRemotePath;
+        WCHAR *dst = szCleanPath;
+        while (*src && dst < szCleanPath + MAX_PATH * 2 - 1)
+        {
+            if (*src != L'"' && *src != L'\'')
+                *dst++ = *src;
+            src++;
+        }
+        *dst = L'\0';
+    }
+
+    bAttach = BuildAttachCommand(pszUser, pszHost, pszPort, szCleanPath[0] ? szCleanPath : L"~",
+        szSession, REMOTE_SESSION_NAME_MAX, szShell, ATTACH_MAX);
+
+    /* Directory tracking goes through the relay too, and needs the mount's root */
+    if (pszLocalPath && GetTerminalSetting(L"TrackDirectory", 0) &&
+        BuildCwdMapOption(pszLocalPath, pszRemotePath, szCwdMap, MAX_PATH * 3))
+    {
+        StringCchCatW(szRelayOptions, MAX_PATH * 8, szCwdMap);
+        bRelay = TRUE;
+    }
+
+    /* So does reconnecting: the relay builds the remote command for each attempt */
+    if (GetTerminalSetting(L"Reconnect", 0))
+    {
+        WCHAR szReconnect[MAX_PATH * 2 + 32];
+        StringCchPrintfW(szReconnect, MAX_PATH * 2 + 32, L" --reconnect \"%s\"",
+            szCleanPath[0] ? szCleanPath : L"~");
+        StringCchCatW(szRelayOptions, MAX_PATH * 8, szReconnect);
+        bRelay = TRUE;
+
+        /* Each attempt reattaches, so the relay needs the session as well */
+        if (bAttach)
+        {
+            WCHAR szAttach[REMOTE_SESSION_NAME_MAX + 32];
+            StringCchPrintfW(szAttach, REMOTE_SESSION_NAME_MAX + 32, L" --attach %s %lu",
+                szSession, GetTerminalSetting(L"AttachIdleHours", 24));
+            StringCchCatW(szRelayOptions, MAX_PATH * 8, szAttach);
+        }
+    }
+
+    /* Only the relay can take a second input */
+    if (pLink)
+    {
+        WCHAR szBroadcast[64];
+        StringCchPrintfW(szBroadcast, 64, L" --broadcast %llu %llu",
+            (unsigned long long)(ULONG_PTR)pLink->hRead, (unsigned long long)(ULONG_PTR)pLink->hReady);
+        StringCchCatW(szRelayOptions, MAX_PATH * 8, szBroadcast);
+        bRelay = TRUE;
+    }
+
+    /* Parallel connect works either way: the relay passes it on to ssh */
+    if (bConnect && bRelay)
+    {
+        StringCchPrintfW(szProxy, MAX_PATH + 64, L" --connect \"%s\"", szConnectHelper);
+        StringCchCatW(szRelayOptions, MAX_PATH * 8, szProxy);
+    }
+    else if (bConnect)
+        StringCchPrintfW(szProxy, MAX_PATH + 64, L" -o \"ProxyCommand=\\\"%s\\\" %%h %%p\"", szConnectHelper);
 
     /* Find ssh.exe */
     if (!FindSSH(szSSHPath, MAX_PATH))
@@ -481,8 +746,8 @@ static BOOL LaunchSSHTerminal(
         bHasPassword = GetStoredPassword(pszUser, pszHost, pszPort, szPassword, 256);
     }
 
-    /* If we have a password, find the askpass helper */
-    if (bHasPassword)
+    /* If we have a password, find the askpass helper (the relay answers the prompt itself) */
+    if (bHasPassword && !bRelay)
     {
         if (!GetAskpassPath(szAskpassPath, MAX_PATH))
         {
@@ -495,38 +760,33 @@ static BOOL LaunchSSHTerminal(
         }
     }
 
-    /* Build remote command: cd to path and start login shell */
-    {
-        WCHAR szCleanPath[MAX_PATH * 2];
-        WCHAR *src = (WCHAR*)pszRemotePath;
-        WCHAR *dst = szCleanPath;
-        while (*src && dst < szCleanPath + MAX_PATH * 2 - 1)
-        {
-            if (*src != L'"' && *src != L'\'')
-                *dst++ = *src;
-            src++;
-        }
-        *dst = L'\0';
+    /* Build remote command: cd to path and start login shell (or attach) */
+    if (szCleanPath[0] == L'\0' || wcscmp(szCleanPath, L"~") == 0)
+        StringCchPrintfW(szRemoteCmd, MAX_PATH * 2 + ATTACH_MAX, L"cd ~; %s", szShell);
+    else if (szCleanPath[0] == L'/')
+        StringCchPrintfW(szRemoteCmd, MAX_PATH * 2 + ATTACH_MAX, L"cd '%s'; %s", szCleanPath, szShell);
+    else if (szCleanPath[0] == L'~')
+        StringCchPrintfW(szRemoteCmd, MAX_PATH * 2 + ATTACH_MAX, L"cd %s; %s", szCleanPath, szShell);
+    else
+        StringCchPrintfW(szRemoteCmd, MAX_PATH * 2 + ATTACH_MAX, L"cd '%s'; %s", szCleanPath, szShell);
 
-        if (szCleanPath[0] == L'\0' || wcscmp(szCleanPath, L"~") == 0)
-            StringCchCopyW(szRemoteCmd, MAX_PATH * 2, L"cd ~; exec $SHELL");
-        else if (szCleanPath[0] == L'/')
-            StringCchPrintfW(szRemoteCmd, MAX_PATH * 2, L"cd '%s'; exec $SHELL", szCleanPath);
-        else if (szCleanPath[0] == L'~')
-            StringCchPrintfW(szRemoteCmd, MAX_PATH * 2, L"cd %s; exec $SHELL", szCleanPath);
-        else
-            StringCchPrintfW(szRemoteCmd, MAX_PATH * 2, L"cd '%s'; exec $SHELL", szCleanPath);
+    if (bRelay)
+    {
+        bResult = LaunchRelay(pszUser, pszHost, pszPort, szRemoteCmd,
+            bHasPassword ? szPassword : NULL, szRelayOptions, pLink);
+        SecureZeroMemory(szPassword, sizeof(szPassword));
+        return bResult;
     }
 
     /* Build SSH command line */
     if (pszPort && pszPort[0])
-        StringCchPrintfW(szCmdLine, MAX_PATH * 8,
-            L"\"%s\" -t -p %s %s@%s \"%s\"",
-            szSSHPath, pszPort, pszUser, pszHost, szRemoteCmd);
+        StringCchPrintfW(szCmdLine, MAX_PATH * 12,
+            L"\"%s\"%s -t -p %s %s@%s \"%s\"",
+            szSSHPath, szProxy, pszPort, pszUser, pszHost, szRemoteCmd);
     else
-        StringCchPrintfW(szCmdLine, MAX_PATH * 8,
-            L"\"%s\" -t %s@%s \"%s\"",
-            szSSHPath, pszUser, pszHost, szRemoteCmd);
+        StringCchPrintfW(szCmdLine, MAX_PATH * 12,
+            L"\"%s\"%s -t %s@%s \"%s\"",
+            szSSHPath, szProxy, pszUser, pszHost, szRemoteCmd);
 
     /* Console title */
     if (pszPort && pszPort[0])
@@ -555,11 +815,7 @@ static BOOL LaunchSSHTerminal(
 
     /* Set SSH_ASKPASS environment for password auth */
     if (bHasPassword)
-    {
-        SetEnvironmentVariableW(L"SSH_ASKPASS", szAskpassPath);
-        SetEnvironmentVariableW(L"SSH_ASKPASS_REQUIRE", L"force");
-        SetEnvironmentVariableW(L"SSHFS_PASSWORD", szPassword);
-    }
+        SetAskpassEnvironment(szAskpassPath, szPassword);
 
     /* Launch ssh.exe directly in a new console */
     si.cb = sizeof(si);
@@ -569,11 +825,7 @@ static BOOL LaunchSSHTerminal(
 
     /* Clear environment immediately */
     if (bHasPassword)
-    {
-        SetEnvironmentVariableW(L"SSH_ASKPASS", NULL);
-        SetEnvironmentVariableW(L"SSH_ASKPASS_REQUIRE", NULL);
-        SetEnvironmentVariableW(L"SSHFS_PASSWORD", NULL);
-    }
+        SetAskpassEnvironment(NULL, NULL);
     SecureZeroMemory(szPassword, sizeof(szPassword));
 
     if (bResult)
@@ -593,6 +845,241 @@ static BOOL LaunchSSHTerminal(
     return FALSE;
 }
 
+void ShowResolveError(LPCWSTR pszPath, ResolveResult result, LPCWSTR pszTitle)
+{
+    WCHAR szError[MAX_PATH * 2];
+
+    StringCchPrintfW(szError, MAX_PATH * 2,
+        result == RESOLVE_PARSE_FAILED ?
+            L"Could not parse SSHFS connection information from the path:\n\n%s" :
+            L"This path is not on an SSHFS mounted drive:\n\n%s",
+        pszPath);
+    MessageBoxW(NULL, szError, pszTitle, MB_OK | MB_ICONWARNING);
+}
+
+BOOL CreateSSHPipe(HANDLE *phOurs, HANDLE *phSsh, BOOL bToSsh, DWORD cbSize)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    HANDLE hRead, hWrite;
+
+    if (!CreatePipe(&hRead, &hWrite, &sa, cbSize))
+        return FALSE;
+    *phOurs = bToSsh ? hWrite : hRead;
+    *phSsh = bToSsh ? hRead : hWrite;
+    SetHandleInformation(*phOurs, HANDLE_FLAG_INHERIT, 0);
+    return TRUE;
+}
+
+HANDLE CreateScratchFile(void)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    WCHAR szTempDir[MAX_PATH], szTempFile[MAX_PATH];
+
+    GetTempPathW(MAX_PATH, szTempDir);
+    if (!GetTempFileNameW(szTempDir, L"ssh", 0, szTempFile))
+        return INVALID_HANDLE_VALUE;
+    return CreateFileW(szTempFile, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, &sa, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+}
+
+BOOL SpawnSSH(LPWSTR pszCmdLine, HANDLE hIn, HANDLE hOut, HANDLE hErr, DWORD dwFlags,
+    LPCWSTR pszAskpassPath, LPCWSTR pszPassword, PROCESS_INFORMATION *ppi)
+{
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    STARTUPINFOW si = {0};
+    HANDLE hNul = INVALID_HANDLE_VALUE;
+    DWORD dwError;
+    BOOL bStarted;
+
+    if (!hIn || !hOut || !hErr)
+        hNul = CreateFileW(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa,
+            OPEN_EXISTING, 0, NULL);
+
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = hIn ? hIn : hNul;
+    si.hStdOutput = hOut ? hOut : hNul;
+    si.hStdError = hErr ? hErr : hNul;
+
+    if (pszPassword)
+        SetAskpassEnvironment(pszAskpassPath, pszPassword);
+    bStarted = CreateProcessW(NULL, pszCmdLine, NULL, NULL, TRUE, dwFlags, NULL, NULL, &si, ppi);
+    dwError = GetLastError();
+    if (pszPassword)
+        SetAskpassEnvironment(NULL, NULL);
+    if (hNul != INVALID_HANDLE_VALUE)
+        CloseHandle(hNul);
+    SetLastError(dwError);
+    return bStarted;
+}
+
+BOOL PickLocalPath(LPCWSTR pszTitle, DWORD dwPick, LPWSTR pszPath, DWORD cchPath)
+{
+    IFileOpenDialog *pDlg = NULL;
+    IShellItem *pItem = NULL;
+    LPWSTR pszPicked = NULL;
+    DWORD dwOptions;
+    BOOL bResult = FALSE;
+
+    if (FAILED(CoCreateInstance(&CLSID_FileOpenDialog, NULL, CLSCTX_INPROC_SERVER,
+        &IID_IFileOpenDialog, (void **)&pDlg)))
+        return FALSE;
+
+    IFileOpenDialog_SetTitle(pDlg, pszTitle);
+    if (SUCCEEDED(IFileOpenDialog_GetOptions(pDlg, &dwOptions)))
+        IFileOpenDialog_SetOptions(pDlg, dwOptions | dwPick | FOS_FORCEFILESYSTEM);
+
+    if (SUCCEEDED(IFileOpenDialog_Show(pDlg, NULL)) &&
+        SUCCEEDED(IFileOpenDialog_GetResult(pDlg, &pItem)) &&
+        SUCCEEDED(IShellItem_GetDisplayName(pItem, SIGDN_FILESYSPATH, &pszPicked)))
+    {
+        bResult = SUCCEEDED(StringCchCopyW(pszPath, cchPath, pszPicked));
+        CoTaskMemFree(pszPicked);
+    }
+
+    if (pItem)
+        IShellItem_Release(pItem);
+    IFileOpenDialog_Release(pDlg);
+    return bResult;
+}
+
+void ReadErrorTail(HANDLE hFile, LPWSTR pszOut, DWORD cchOut)
+{
+    char buffer[1024];
+    LARGE_INTEGER liSize, liPos;
+    DWORD bytesRead = 0;
+
+    pszOut[0] = L'\0';
+    if (!GetFileSizeEx(hFile, &liSize))
+        return;
+    liPos.QuadPart = liSize.QuadPart > (LONGLONG)sizeof(buffer) - 1 ?
+        liSize.QuadPart - (LONGLONG)sizeof(buffer) + 1 : 0;
+    if (!SetFilePointerEx(hFile, liPos, NULL, FILE_BEGIN) ||
+        !ReadFile(hFile, buffer, sizeof(buffer) - 1, &bytesRead, NULL))
+        return;
+    buffer[bytesRead] = '\0';
+    MultiByteToWideChar(CP_UTF8, 0, buffer, -1, pszOut, (int)cchOut);
+}
+
+void ReportFlush(ReportWriter *w)
+{
+    DWORD cbWritten;
+
+    if (w->cbBuffer > 0 && !WriteFile(w->hFile, w->pBuffer, (DWORD)w->cbBuffer, &cbWritten, NULL))
+        w->bFailed = TRUE;
+    w->cbBuffer = 0;
+}
+
+void ReportPut(ReportWriter *w, const char *psz, size_t cb)
+{
+    while (cb > 0)
+    {
+        size_t n = DOWNLOAD_READ_SIZE - w->cbBuffer;
+        if (n > cb)
+            n = cb;
+        memcpy(w->pBuffer + w->cbBuffer, psz, n);
+        w->cbBuffer += n;
+        psz += n;
+        cb -= n;
+        if (w->cbBuffer == DOWNLOAD_READ_SIZE)
+            ReportFlush(w);
+    }
+}
+
+void ReportPutStr(ReportWriter *w, const char *psz)
+{
+    ReportPut(w, psz, strlen(psz));
+}
+
+BOOL GetCacheFilePath(const SSHFSLocation *pLoc, LPCWSTR pszKind, LPCWSTR pszExt,
+    LPWSTR pszFile, DWORD cchFile)
+{
+    WCHAR szKey[MAX_PATH * 3];
+    char szKeyA[MAX_PATH * 9];
+    char szHex[HASH_HEX_LEN + 1];
+    WCHAR szName[32];
+    unsigned char digest[HASH_SIZE];
+    Sha256 h;
+    DWORD cch;
+
+    StringCchPrintfW(szKey, MAX_PATH * 3, L"%s@%s:%s:%s", pLoc->szUser, pLoc->szHost,
+        pLoc->szPort, pLoc->szRemotePath);
+    WideCharToMultiByte(CP_UTF8, 0, szKey, -1, szKeyA, (int)sizeof(szKeyA), NULL, NULL);
+    Sha256Init(&h);
+    Sha256Update(&h, szKeyA, strlen(szKeyA));
+    Sha256Final(&h, digest);
+    HashToHex(digest, szHex);
+    szHex[16] = '\0';
+    MultiByteToWideChar(CP_UTF8, 0, szHex, -1, szName, 32);
+
+    cch = GetEnvironmentVariableW(L"LOCALAPPDATA", pszFile, cchFile);
+    if (cch == 0 || cch >= cchFile)
+        return FALSE;
+    StringCchPrintfW(szKey, MAX_PATH * 3, L"SSHFS-Win\\%s\\%s%s", pszKind, szName, pszExt);
+    return PathAppendW(pszFile, szKey);
+}
+
+void FormatUnixTime(long long t, char *psz, size_t cch)
+{
+    ULARGE_INTEGER li;
+    FILETIME ft;
+    SYSTEMTIME stUtc, st;
+
+    li.QuadPart = (ULONGLONG)(t + 11644473600LL) * 10000000ULL;
+    ft.dwLowDateTime = li.LowPart;
+    ft.dwHighDateTime = li.HighPart;
+    if (t < -11644473600LL || !FileTimeToSystemTime(&ft, &stUtc) ||
+        !SystemTimeToTzSpecificLocalTime(NULL, &stUtc, &st))
+    {
+        StringCchCopyA(psz, cch, "(unknown)       ");
+        return;
+    }
+    StringCchPrintfA(psz, cch, "%04u-%02u-%02u %02u:%02u", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute);
+}
+
+void FormatSize(unsigned long long cb, char *psz, size_t cch)
+{
+    if (cb >= 1024ULL * 1024 * 1024)
+        StringCchPrintfA(psz, cch, "%7.1f GB", (double)cb / (1024.0 * 1024.0 * 1024.0));
+    else if (cb >= 1024 * 1024)
+        StringCchPrintfA(psz, cch, "%7.1f MB", (double)cb / (1024.0 * 1024.0));
+    else
+        StringCchPrintfA(psz, cch, "%7.1f KB", (double)cb / 1024.0);
+}
+
+HANDLE GetExecStdHandle(DWORD nStdHandle, LPCWSTR pszDevice, BOOL bConsole)
+{
+    HANDLE h = GetStdHandle(nStdHandle);
+    HANDLE hDup = INVALID_HANDLE_VALUE;
+    SECURITY_ATTRIBUTES sa = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+
+    if (h && h != INVALID_HANDLE_VALUE &&
+        DuplicateHandle(GetCurrentProcess(), h, GetCurrentProcess(), &hDup, 0, TRUE, DUPLICATE_SAME_ACCESS))
+        return hDup;
+
+    return CreateFileW(bConsole ? pszDevice : L"NUL", GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, NULL);
+}
+
+void WriteExecError(HANDLE hErr, LPCWSTR pszMessage)
+{
+    char szUtf8[1024];
+    DWORD dwMode, cbWritten;
+    int cb;
+
+    if (hErr == INVALID_HANDLE_VALUE)
+        return;
+    if (GetConsoleMode(hErr, &dwMode))
+    {
+        WriteConsoleW(hErr, pszMessage, (DWORD)wcslen(pszMessage), &cbWritten, NULL);
+        return;
+    }
+    cb = WideCharToMultiByte(CP_UTF8, 0, pszMessage, -1, szUtf8, (int)sizeof(szUtf8), NULL, NULL);
+    if (cb > 1)
+        WriteFile(hErr, szUtf8, (DWORD)(cb - 1), &cbWritten, NULL);
+}
+
 /**
  * Main entry point
  */
@@ -602,10 +1089,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     int argc;
     LPWSTR *argv;
     WCHAR szPath[MAX_PATH];
-    WCHAR szUNCPath[MAX_PATH * 2];
-    WCHAR szUser[128], szHost[256], szPort[16], szBasePath[MAX_PATH];
-    WCHAR szFullRemotePath[MAX_PATH * 2];
-    MountType mountType = MOUNT_TYPE_PASSWORD;
+    SSHFSLocation loc;
 
     (void)hInstance;
     (void)hPrevInstance;
@@ -615,68 +1099,184 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     if (!argv || argc < 2)
     {
         MessageBoxW(NULL,
-            L"Usage: sshfs-ssh.exe <path>\n\n"
-            L"Opens an SSH terminal to the location on an SSHFS mounted drive.",
+            L"Usage: sshfs-ssh.exe <path>\n"
+            L"       sshfs-ssh.exe --copy|--move <destination> <item>...\n"
+            L"       sshfs-ssh.exe --download <path> [<local folder>]\n"
+            L"       sshfs-ssh.exe --upload <destination> <local item>...\n"
+            L"       sshfs-ssh.exe --hash <item>...\n"
+            L"       sshfs-ssh.exe --compare <folder> [<local folder>]\n"
+            L"       sshfs-ssh.exe --search <folder>\n"
+            L"       sshfs-ssh.exe --snapshot <path>\n"
+            L"       sshfs-ssh.exe --usage <folder>\n"
+            L"       sshfs-ssh.exe --watch <path>\n"
+            L"       sshfs-ssh.exe --sync <folder> [<local file>]\n"
+            L"       sshfs-ssh.exe exec <path> -- <command> [<argument>...]\n"
+            L"       sshfs-ssh.exe --fanout <folder>\n"
+            L"       sshfs-ssh.exe --bench <path> [<runs>] [\"<ssh options>\"...]\n"
+            L"       sshfs-ssh.exe --thumbs <folder> [<first file>]\n"
+            L"       sshfs-ssh.exe --forget-passwords\n\n"
+            L"Opens an SSH terminal to the location on an SSHFS mounted drive,\n"
+            L"copies/moves items on the server itself, downloads a folder or\n"
+            L"uploads local items as one stream, hashes files on the server\n"
+            L"(optionally comparing them with a local folder), searches a\n"
+            L"folder's file names or contents on the server, indexes the\n"
+            L"mount's whole tree locally, shows a folder's disk usage,\n"
+            L"passes changes made on the server on to Explorer, sends just\n"
+            L"the changed blocks of a local file to its server copy, runs\n"
+            L"a command on the server in a mounted folder for scripts,\n"
+            L"opens the folder on every server with one input for all, or\n"
+            L"times each phase of connecting to find what slows a launch,\n"
+            L"makes a folder's image thumbnails on the server for Explorer,\n"
+            L"or forgets the passwords the credential broker holds.",
             L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONINFORMATION);
         if (argv) LocalFree(argv);
         return 1;
     }
 
-    StringCchCopyW(szPath, MAX_PATH, argv[1]);
-    LocalFree(argv);
+    /* Server-side copy/move from the shell extension's drag and drop menu */
+    if (wcscmp(argv[1], L"--copy") == 0 || wcscmp(argv[1], L"--move") == 0)
+    {
+        int result = RunServerTransfer(wcscmp(argv[1], L"--move") == 0 ? REMOTE_MOVE : REMOTE_COPY,
+            argv + 2, argc - 2);
+        LocalFree(argv);
+        return result;
+    }
 
-    /* Remove trailing backslash if present */
-    size_t len = wcslen(szPath);
-    if (len > 3 && (szPath[len - 1] == L'\\' || szPath[len - 1] == L'/'))
-        szPath[len - 1] = L'\0';
+    /* Streamed folder download from the shell extension's context menu */
+    if (wcscmp(argv[1], L"--download") == 0 && argc >= 3)
+    {
+        int result = RunStreamDownload(argv[2], argc >= 4 ? argv[3] : NULL);
+        LocalFree(argv);
+        return result;
+    }
 
-    /* Get UNC path */
-    if (szPath[0] == L'\\' && szPath[1] == L'\\')
+    /* Streamed upload of the files on the clipboard into a mounted folder */
+    if (wcscmp(argv[1], L"--upload") == 0 && argc >= 4)
     {
-        StringCchCopyW(szUNCPath, MAX_PATH * 2, szPath);
+        int result = RunStreamUpload(argv + 2, argc - 2);
+        LocalFree(argv);
+        return result;
     }
-    else if (szPath[1] == L':')
+
+    /* SHA-256 on the server, or compared with a local copy */
+    if ((wcscmp(argv[1], L"--hash") == 0 || wcscmp(argv[1], L"--compare") == 0) && argc >= 3)
     {
-        if (!GetDriveUNCPath(szPath[0], szUNCPath, MAX_PATH * 2))
-        {
-            MessageBoxW(NULL,
-                L"This drive is not a network drive.\n\n"
-                L"The \"Open SSH Terminal Here\" feature only works on SSHFS mounted drives.",
-                L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONWARNING);
-            return 1;
-        }
+        int result = RunRemoteHash(argv + 2, argc - 2, wcscmp(argv[1], L"--compare") == 0);
+        LocalFree(argv);
+        return result;
     }
-    else
+
+    /* File name or content search run by the server */
+    if (wcscmp(argv[1], L"--search") == 0 && argc >= 3)
     {
-        MessageBoxW(NULL,
-            L"Invalid path format.\n\n"
-            L"Please use a drive letter path (X:\\folder) or UNC path.",
-            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONERROR);
-        return 1;
+        int result = RunRemoteSearch(argv[2]);
+        LocalFree(argv);
+        return result;
     }
 
-#if DEBUG_PATHS
+    /* Local index of the mount's tree */
+    if (wcscmp(argv[1], L"--snapshot") == 0 && argc >= 3)
     {
-        WCHAR szDebug[MAX_PATH * 2];
-        StringCchPrintfW(szDebug, MAX_PATH * 2, L"Local path: %s\nUNC path: %s", szPath, szUNCPath);
-        MessageBoxW(NULL, szDebug, L"Debug - Paths", MB_OK);
+        int result = RunSnapshot(argv[2]);
+        LocalFree(argv);
+        return result;
     }
-#endif
 
-    /* Check if it's an SSHFS path */
-    if (_wcsnicmp(szUNCPath, L"\\\\sshfs", 7) != 0)
+    /* Folder sizes from du on the server */
+    if (wcscmp(argv[1], L"--usage") == 0 && argc >= 3)
     {
+        int result = RunRemoteUsage(argv[2]);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* Shell notifications for changes made on the server */
+    if (wcscmp(argv[1], L"--watch") == 0 && argc >= 3)
+    {
+        int result = RunWatcher(argv[2]);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* Changed blocks of a local file onto the server copy */
+    if (wcscmp(argv[1], L"--sync") == 0 && argc >= 3)
+    {
+        int result = RunDeltaSync(argv[2], argc >= 4 ? argv[3] : NULL);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* Command on the server for scripts, streaming its output and status */
+    if ((wcscmp(argv[1], L"exec") == 0 || wcscmp(argv[1], L"--exec") == 0) && argc >= 3)
+    {
+        int result = RunRemoteExec(argv[2], argv + 3, argc - 3);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* The same folder on every SSHFS drive, with broadcast input */
+    if (wcscmp(argv[1], L"--fanout") == 0 && argc >= 3)
+    {
+        int result = RunFanout(argv[2]);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* Per-phase connection timings, to see what makes a launch slow */
+    if (wcscmp(argv[1], L"--bench") == 0 && argc >= 3)
+    {
+        int result = RunBench(argv[2], argv + 3, argc - 3);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* Image thumbnails for a folder, started by the shell extension's provider */
+    if (wcscmp(argv[1], L"--thumbs") == 0 && argc >= 3)
+    {
+        int result = RunThumbnails(argv[2], argc >= 4 ? argv[3] : NULL);
+        LocalFree(argv);
+        return result;
+    }
+
+    /* Credential broker, started on demand by launches with a password */
+    if (wcscmp(argv[1], L"--broker") == 0)
+    {
+        LocalFree(argv);
+        return RunBroker();
+    }
+
+    if (wcscmp(argv[1], L"--forget-passwords") == 0)
+    {
+        LocalFree(argv);
+        return RunForgetPasswords();
+    }
+
+    StringCchCopyW(szPath, MAX_PATH, argv[1]);
+    LocalFree(argv);
+
+    switch (ResolveSSHFSPath(szPath, &loc))
+    {
+    case RESOLVE_OK:
+        break;
+    case RESOLVE_NOT_NETWORK_DRIVE:
+        MessageBoxW(NULL,
+            L"This drive is not a network drive.\n\n"
+            L"The \"Open SSH Terminal Here\" feature only works on SSHFS mounted drives.",
+            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONWARNING);
+        return 1;
+    case RESOLVE_BAD_FORMAT:
+        MessageBoxW(NULL,
+            L"Invalid path format.\n\n"
+            L"Please use a drive letter path (X:\\folder) or UNC path.",
+            L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONERROR);
+        return 1;
+    case RESOLVE_NOT_SSHFS:
         MessageBoxW(NULL,
             L"This is not an SSHFS mounted drive.\n\n"
             L"The \"Open SSH Terminal Here\" feature only works on SSHFS mounted drives.",
             L"SSHFS-Win - SSH Terminal", MB_OK | MB_ICONWARNING);
         return 1;
-    }
-
-    /* Parse the UNC path */
-    if (!ParseSSHFSUNCPath(szUNCPath, 
-        szUser, 128, szHost, 256, szPort, 16, szBasePath, MAX_PATH, &mountType))
-    {
+    default:
         MessageBoxW(NULL,
             L"Could not parse SSHFS connection information from the path.\n\n"
             L"The path format may be unsupported.",
@@ -684,21 +1284,19 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
         return 1;
     }
 
-    /* Build full remote path */
-    BuildFullRemotePath(szPath, szUNCPath, szBasePath, mountType, szFullRemotePath, MAX_PATH * 2);
-
 #if DEBUG_PATHS
     {
         WCHAR szDebug[MAX_PATH * 2];
         StringCchPrintfW(szDebug, MAX_PATH * 2, 
-            L"User: %s\nHost: %s\nPort: %s\nBase: %s\nFull remote: %s\nType: %d",
-            szUser, szHost, szPort, szBasePath, szFullRemotePath, mountType);
+            L"Local path: %s\nUNC path: %s\nUser: %s\nHost: %s\nPort: %s\nBase: %s\nFull remote: %s\nType: %d",
+            szPath, loc.szUNCPath, loc.szUser, loc.szHost, loc.szPort, loc.szBasePath,
+            loc.szRemotePath, loc.mountType);
         MessageBoxW(NULL, szDebug, L"Debug - Parsed", MB_OK);
     }
 #endif
 
     /* Launch SSH terminal */
-    if (!LaunchSSHTerminal(szUser, szHost, szPort, szFullRemotePath, mountType))
+    if (!LaunchSSHTerminal(loc.szUser, loc.szHost, loc.szPort, loc.szRemotePath, szPath, loc.mountType, NULL))
         return 1;
 
     return 0;
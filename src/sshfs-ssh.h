@@ -0,0 +1,246 @@
+/**
+ * sshfs-ssh.h
+ *
+ * Shared by sshfs-ssh.c and the files with sshfs-ssh.exe's verbs
+ * (sshfs-ssh-<verb>.c): finding ssh.exe and the drive's stored password,
+ * starting ssh with piped standard handles, and each verb's entry point
+ * for wWinMain().
+ */
+
+#ifndef SSHFS_SSH_H
+#define SSHFS_SSH_H
+
+#include <windows.h>
+
+#include "sshfs-cmdline.h"
+#include "sshfs-unc.h"
+#include "sshfs-remote.h"
+#include "sshfs-index.h"
+
+/* Pipe and read sizes for bulk ssh output: the pipe absorbs ssh output
+ * while we are not reading, the read buffer bounds each feed */
+#define DOWNLOAD_PIPE_SIZE (4 * 1024 * 1024)
+#define DOWNLOAD_READ_SIZE (1024 * 1024)
+
+/**
+ * Get path to sshfs-ssh-askpass.exe (bundled with sshfs-ctx)
+ */
+BOOL GetAskpassPath(LPWSTR pszPath, DWORD cchPath);
+
+/**
+ * Read a DWORD option from HKCU\SOFTWARE\SSHFS-Win\Terminal
+ */
+DWORD GetTerminalSetting(LPCWSTR pszName, DWORD dwDefault);
+
+/**
+ * Stored password for user@host: from the credential broker if an earlier
+ * launch left it there, otherwise from Credential Manager, and then handed
+ * to the broker for the launches that follow (CredentialCacheSeconds)
+ */
+BOOL GetStoredPassword(
+    LPCWSTR pszUser,
+    LPCWSTR pszHost,
+    LPCWSTR pszPort,
+    LPWSTR pszPassword,
+    DWORD cchPassword);
+
+/**
+ * Point ssh at sshfs-ssh-askpass.exe for the next child process. The
+ * password goes to the credential broker, ssh gets only a token for it
+ * that works for one ssh started by this process; the environment
+ * carries the password itself only if the broker cannot be reached.
+ * Pass NULLs to clear the variables again right after CreateProcess.
+ * SpawnSSH() does both for the ssh it starts.
+ */
+void SetAskpassEnvironment(LPCWSTR pszAskpassPath, LPCWSTR pszPassword);
+
+/**
+ * Find ssh.exe - try Windows OpenSSH first
+ */
+BOOL FindSSH(LPWSTR pszPath, DWORD cchPath);
+
+/**
+ * Input a --fanout session takes from the broadcast console, handed to the
+ * relay by inheritance like its password
+ */
+typedef struct BroadcastLink {
+    HANDLE hRead;                   /* Read end of the input pipe, inheritable */
+    HANDLE hReady;                  /* Event the relay sets once logged in, inheritable */
+    HANDLE hProcess;                /* The relay, set by LaunchRelay() */
+} BroadcastLink;
+
+/**
+ * Launch SSH terminal directly using Windows OpenSSH
+ *
+ * Launches ssh.exe directly in its own console window (no ConPTY middleman).
+ * For password auth, uses SSH_ASKPASS mechanism with sshfs-ssh-askpass.exe.
+ * This gives native terminal behavior: resize, Ctrl+C, VT sequences all
+ * handled by the console itself. Optional relay features (see
+ * BuildRelayOptions), directory tracking for pszLocalPath (the folder
+ * opened, may be NULL), reconnecting (Reconnect) and broadcast input
+ * (pLink, may be NULL) go through sshfs-ssh-launcher.exe instead.
+ * Parallel connect (GetConnectHelper()) and persistent sessions
+ * (BuildAttachCommand()) work with or without it.
+ */
+BOOL LaunchSSHTerminal(
+    LPCWSTR pszUser,
+    LPCWSTR pszHost,
+    LPCWSTR pszPort,
+    LPCWSTR pszRemotePath,
+    LPCWSTR pszLocalPath,
+    MountType mountType,
+    BroadcastLink *pLink);
+
+/**
+ * Report a path that cannot take part in a server-side transfer or download
+ */
+void ShowResolveError(LPCWSTR pszPath, ResolveResult result, LPCWSTR pszTitle);
+
+/**
+ * A pipe between us and ssh of cbSize bytes (0: the default), to ssh's
+ * stdin if bToSsh, else from its stdout or stderr. ssh's end is
+ * inheritable, for SpawnSSH() and to be closed right after it; ours is
+ * not, or ssh would hold its own pipe open.
+ */
+BOOL CreateSSHPipe(HANDLE *phOurs, HANDLE *phSsh, BOOL bToSsh, DWORD cbSize);
+
+/**
+ * Temp file that disappears when closed, inheritable to be one of ssh's
+ * standard handles
+ */
+HANDLE CreateScratchFile(void);
+
+/**
+ * Start ssh (pszCmdLine) with hIn, hOut and hErr as its standard handles,
+ * NULL for NUL, and pszPassword answered through askpass unless it is
+ * NULL. Returns FALSE with GetLastError() set if ssh did not start.
+ */
+BOOL SpawnSSH(LPWSTR pszCmdLine, HANDLE hIn, HANDLE hOut, HANDLE hErr, DWORD dwFlags,
+    LPCWSTR pszAskpassPath, LPCWSTR pszPassword, PROCESS_INFORMATION *ppi);
+
+/**
+ * Ask for a local path: a folder with FOS_PICKFOLDERS (to download into,
+ * to compare with), an existing file with FOS_FILEMUSTEXIST (to sync to
+ * the server)
+ */
+BOOL PickLocalPath(LPCWSTR pszTitle, DWORD dwPick, LPWSTR pszPath, DWORD cchPath);
+
+/**
+ * Last part of what the remote command printed on stderr
+ */
+void ReadErrorTail(HANDLE hFile, LPWSTR pszOut, DWORD cchOut);
+
+/**
+ * Buffered UTF-8 output for the hash list and the comparison report, and
+ * the snapshot report; pBuffer holds DOWNLOAD_READ_SIZE bytes
+ */
+typedef struct ReportWriter {
+    HANDLE hFile;
+    char *pBuffer;
+    size_t cbBuffer;
+    BOOL bFailed;
+} ReportWriter;
+
+/**
+ * Write out what is buffered; bFailed is set if the write fails
+ */
+void ReportFlush(ReportWriter *w);
+
+void ReportPut(ReportWriter *w, const char *psz, size_t cb);
+void ReportPutStr(ReportWriter *w, const char *psz);
+
+/**
+ * Per-location file in %LOCALAPPDATA%\SSHFS-Win\<pszKind>, named by a hash
+ * of the server and the remote path
+ */
+BOOL GetCacheFilePath(const SSHFSLocation *pLoc, LPCWSTR pszKind, LPCWSTR pszExt,
+    LPWSTR pszFile, DWORD cchFile);
+
+/**
+ * Server time to "YYYY-MM-DD hh:mm" local time, and a size to KB, MB or GB
+ */
+void FormatUnixTime(long long t, char *psz, size_t cch);
+void FormatSize(unsigned long long cb, char *psz, size_t cch);
+
+/**
+ * A mapped snapshot index file (sshfs-ssh-snapshot.c)
+ */
+typedef struct SnapshotView {
+    HANDLE hFile;
+    HANDLE hMapping;
+    const void *pView;
+    Index ix;
+} SnapshotView;
+
+/**
+ * Index file of the mount that pszPath is on, in
+ * %LOCALAPPDATA%\SSHFS-Win\snapshots. pRootLoc receives the mount root's
+ * location.
+ */
+BOOL GetSnapshotPath(LPCWSTR pszPath, SSHFSLocation *pRootLoc, LPWSTR pszIndex, DWORD cchIndex);
+
+/**
+ * Map an index file read-only. FALSE if it is missing or not a valid index.
+ */
+BOOL OpenSnapshot(LPCWSTR pszIndex, SnapshotView *v);
+void CloseSnapshot(SnapshotView *v);
+
+/**
+ * Inheritable copy of a standard handle for ssh: the redirected one if the
+ * caller gave one, else the console (pszDevice) or NUL without one
+ */
+HANDLE GetExecStdHandle(DWORD nStdHandle, LPCWSTR pszDevice, BOOL bConsole);
+
+/**
+ * Message from "exec" itself on its standard error
+ */
+void WriteExecError(HANDLE hErr, LPCWSTR pszMessage);
+
+/* The verbs, each in its own sshfs-ssh-<verb>.c */
+
+/* --copy|--move <destination> <item>... (sshfs-ssh-transfer.c) */
+int RunServerTransfer(RemoteOperation op, LPWSTR *ppszPaths, int nPaths);
+
+/* --download <path> [<folder>] (sshfs-ssh-download.c) */
+int RunStreamDownload(LPCWSTR pszPath, LPCWSTR pszDestFolder);
+
+/* --upload <destination> <local item>... (sshfs-ssh-upload.c) */
+int RunStreamUpload(LPWSTR *ppszPaths, int nPaths);
+
+/* --hash <item>..., --compare <folder> [<local folder>] (sshfs-ssh-hash.c) */
+int RunRemoteHash(LPWSTR *ppszPaths, int nPaths, BOOL bCompare);
+
+/* --search <folder> (sshfs-ssh-search.c) */
+int RunRemoteSearch(LPCWSTR pszFolder);
+
+/* --snapshot <path> (sshfs-ssh-snapshot.c) */
+int RunSnapshot(LPCWSTR pszPath);
+
+/* --usage <folder> (sshfs-ssh-usage.c) */
+int RunRemoteUsage(LPCWSTR pszFolder);
+
+/* --watch <path> (sshfs-ssh-watch.c) */
+int RunWatcher(LPCWSTR pszPath);
+
+/* --sync <folder> [<local file>] (sshfs-ssh-sync.c) */
+int RunDeltaSync(LPCWSTR pszFolder, LPCWSTR pszLocal);
+
+/* exec <path> -- <command>... (sshfs-ssh-exec.c) */
+int RunRemoteExec(LPCWSTR pszPath, LPWSTR *ppszArgs, int nArgs);
+
+/* --fanout <folder> (sshfs-ssh-fanout.c) */
+int RunFanout(LPCWSTR pszPath);
+
+/* --bench <path> [<runs>] ["<ssh options>"...] (sshfs-ssh-bench.c) */
+int RunBench(LPCWSTR pszPath, LPWSTR *ppszArgs, int nArgs);
+
+/* --broker: returns at once if a broker runs (sshfs-ssh-broker.c) */
+int RunBroker(void);
+
+/* --forget-passwords (sshfs-ssh-broker.c) */
+int RunForgetPasswords(void);
+
+/* --thumbs <folder> [<first file>] (sshfs-ssh-thumbs.c) */
+int RunThumbnails(LPCWSTR pszFolder, LPCWSTR pszFirst);
+
+#endif /* SSHFS_SSH_H */
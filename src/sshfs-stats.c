@@ -0,0 +1,166 @@
+/**
+ * sshfs-stats.c
+ *
+ * Lock-free session counters (see sshfs-stats.h)
+ */
+
+#include "sshfs-stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AtomicAdd(p, v)         _InterlockedExchangeAdd64((p), (v))
+#define AtomicLoad(p)           _InterlockedCompareExchange64((volatile long long *)(p), 0, 0)
+#define AtomicStore(p, v)       _InterlockedExchange64((p), (v))
+#define AtomicCas(p, cmp, v)    (_InterlockedCompareExchange64((p), (v), (cmp)) == (cmp))
+#else
+#define AtomicAdd(p, v)         __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define AtomicLoad(p)           __atomic_load_n((p), __ATOMIC_RELAXED)
+#define AtomicStore(p, v)       __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define AtomicCas(p, cmp, v)    __extension__ ({ long long _c = (cmp); \
+    __atomic_compare_exchange_n((p), &_c, (v), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED); })
+#endif
+
+void StatsInit(SessionStats *st, unsigned long long nowMs)
+{
+    memset((void *)st, 0, sizeof(*st));
+    st->msStart = (long long)nowMs;
+    st->msLastOutput = (long long)nowMs;
+}
+
+void StatsOnSent(SessionStats *st, size_t len, unsigned long long nowMs)
+{
+    long long msProbe;
+
+    AtomicAdd(&st->cbSent, (long long)len);
+
+    /* Typed keys start an echo probe unless one is still in flight */
+    if (len <= STATS_PROBE_MAX_BYTES)
+    {
+        msProbe = AtomicLoad(&st->msProbe);
+        if (msProbe == 0 || (long long)nowMs - msProbe > STATS_PROBE_TIMEOUT_MS)
+            AtomicCas(&st->msProbe, msProbe, (long long)nowMs);
+    }
+}
+
+void StatsOnReceived(SessionStats *st, size_t len, unsigned long long nowMs)
+{
+    long long msProbe;
+
+    AtomicAdd(&st->cbReceived, (long long)len);
+    AtomicStore(&st->msLastOutput, (long long)nowMs);
+
+    msProbe = AtomicLoad(&st->msProbe);
+    if (msProbe != 0 && AtomicCas(&st->msProbe, msProbe, 0))
+    {
+        long long sample = (long long)nowMs - msProbe;
+
+        /* Output is only read on one thread, so the estimator has a single writer */
+        if (sample >= 0 && sample <= STATS_PROBE_TIMEOUT_MS)
+        {
+            long long srtt8 = AtomicLoad(&st->srtt8);
+
+            /* Same gains as TCP: srtt = 7/8 srtt + 1/8 sample */
+            srtt8 = AtomicLoad(&st->nRttSamples) ? srtt8 - (srtt8 >> 3) + sample : sample << 3;
+            AtomicStore(&st->srtt8, srtt8);
+            AtomicAdd(&st->nRttSamples, 1);
+        }
+    }
+}
+
+void StatsSamplerInit(StatsSampler *sm, const SessionStats *st, unsigned long long nowMs)
+{
+    sm->cbReceived = AtomicLoad(&st->cbReceived);
+    sm->cbSent = AtomicLoad(&st->cbSent);
+    sm->msLast = nowMs;
+}
+
+void StatsSample(const SessionStats *st, StatsSampler *sm, unsigned long long nowMs, StatsSnapshot *snap)
+{
+    long long cbReceived = AtomicLoad(&st->cbReceived);
+    long long cbSent = AtomicLoad(&st->cbSent);
+    long long msLastOutput = AtomicLoad(&st->msLastOutput);
+    long long srtt8 = AtomicLoad(&st->srtt8);
+    double secs = (double)(nowMs - sm->msLast) / 1000.0;
+
+    if (secs <= 0.0)
+        secs = 0.001;
+
+    snap->cbReceived = (unsigned long long)cbReceived;
+    snap->cbSent = (unsigned long long)cbSent;
+    snap->receiveRate = (double)(cbReceived - sm->cbReceived) / secs;
+    snap->sendRate = (double)(cbSent - sm->cbSent) / secs;
+    snap->nRttSamples = (unsigned long long)AtomicLoad(&st->nRttSamples);
+    snap->msRtt = snap->nRttSamples ? (long)((srtt8 + 4) >> 3) : -1;
+    snap->msIdle = (long long)nowMs > msLastOutput ? nowMs - (unsigned long long)msLastOutput : 0;
+    snap->msUptime = nowMs - (unsigned long long)AtomicLoad(&st->msStart);
+
+    sm->cbReceived = cbReceived;
+    sm->cbSent = cbSent;
+    sm->msLast = nowMs;
+}
+
+/**
+ * Human readable rate: "512 B/s", "12.3 KB/s", "1.2 MB/s"
+ */
+static void FormatRate(double rate, char *out, size_t cbOut)
+{
+    if (rate < 1024.0)
+        snprintf(out, cbOut, "%.0f B/s", rate);
+    else if (rate < 1024.0 * 1024.0)
+        snprintf(out, cbOut, "%.1f KB/s", rate / 1024.0);
+    else
+        snprintf(out, cbOut, "%.1f MB/s", rate / (1024.0 * 1024.0));
+}
+
+void StatsFormatSummary(const StatsSnapshot *snap, char *out, size_t cbOut)
+{
+    char szRate[32];
+    char szRtt[32];
+    unsigned long long secsIdle = snap->msIdle / 1000;
+
+    /* One number for both directions keeps the title short */
+    FormatRate(snap->receiveRate + snap->sendRate, szRate, sizeof(szRate));
+
+    if (snap->msRtt >= 0)
+        snprintf(szRtt, sizeof(szRtt), "%ld ms", snap->msRtt);
+    else
+        snprintf(szRtt, sizeof(szRtt), "-- ms");
+
+    if (secsIdle >= 3600)
+        snprintf(out, cbOut, "%s | %s | idle %lluh", szRtt, szRate, secsIdle / 3600);
+    else if (secsIdle >= 60)
+        snprintf(out, cbOut, "%s | %s | idle %llum", szRtt, szRate, secsIdle / 60);
+    else
+        snprintf(out, cbOut, "%s | %s", szRtt, szRate);
+}
+
+size_t StatsFormatJson(const StatsSnapshot *snap, const char *pszTarget, char *out, size_t cbOut)
+{
+    char szTarget[512];
+    size_t n = 0;
+    int cch;
+
+    /* user@host should never need escaping, but keep the file valid JSON regardless */
+    for (const char *p = pszTarget; *p && n + 2 < sizeof(szTarget); p++)
+    {
+        if ((unsigned char)*p < 0x20)
+            continue;
+        if (*p == '"' || *p == '\\')
+            szTarget[n++] = '\\';
+        szTarget[n++] = *p;
+    }
+    szTarget[n] = '\0';
+
+    cch = snprintf(out, cbOut,
+        "{\"target\":\"%s\",\"uptime_ms\":%llu,\"bytes_received\":%llu,\"bytes_sent\":%llu,"
+        "\"receive_rate\":%.0f,\"send_rate\":%.0f,\"rtt_ms\":%ld,\"rtt_samples\":%llu,\"idle_ms\":%llu}\n",
+        szTarget, snap->msUptime, snap->cbReceived, snap->cbSent,
+        snap->receiveRate, snap->sendRate, snap->msRtt, snap->nRttSamples, snap->msIdle);
+
+    if (cch < 0 || (size_t)cch >= cbOut)
+        return 0;
+    return (size_t)cch;
+}
@@ -0,0 +1,86 @@
+/**
+ * sshfs-stats.h
+ *
+ * Live session counters for the terminal relay.
+ *
+ * The relay threads bump the counters on the byte path with lock-free
+ * atomic adds; a reporter samples them about once a second to produce the
+ * title summary ("42 ms | 1.2 MB/s") and the JSON snapshot written to the
+ * stats file. When the mode is off the relay holds a NULL SessionStats
+ * pointer and the byte path only pays for that check.
+ *
+ * Echo RTT is estimated from keystrokes: a short write to the server starts
+ * a probe and the next chunk of server output completes it.
+ */
+
+#ifndef SSHFS_STATS_H
+#define SSHFS_STATS_H
+
+#include <stddef.h>
+
+/* Probes older than this are treated as unanswered (no echo, e.g. passwords) */
+#define STATS_PROBE_TIMEOUT_MS 3000
+
+/* Writes up to this size count as keystrokes for RTT probing */
+#define STATS_PROBE_MAX_BYTES 8
+
+/**
+ * Counters shared between relay threads. Only touch through the functions below.
+ */
+typedef struct SessionStats {
+    volatile long long cbReceived;      /* Server -> console */
+    volatile long long cbSent;          /* Console -> server */
+    volatile long long msStart;
+    volatile long long msLastOutput;
+    volatile long long msProbe;         /* Keystroke awaiting its echo, 0 if none */
+    volatile long long srtt8;           /* Smoothed RTT in 1/8 ms */
+    volatile long long nRttSamples;
+} SessionStats;
+
+/**
+ * Reporter-side state for turning totals into per-interval rates
+ */
+typedef struct StatsSampler {
+    long long cbReceived;
+    long long cbSent;
+    unsigned long long msLast;
+} StatsSampler;
+
+typedef struct StatsSnapshot {
+    unsigned long long cbReceived;
+    unsigned long long cbSent;
+    double receiveRate;                 /* Bytes per second since the previous sample */
+    double sendRate;
+    long msRtt;                         /* -1 until the first sample */
+    unsigned long long nRttSamples;
+    unsigned long long msIdle;          /* Since the last server output */
+    unsigned long long msUptime;
+} StatsSnapshot;
+
+void StatsInit(SessionStats *st, unsigned long long nowMs);
+
+/**
+ * Byte path hooks, safe to call concurrently from the relay threads
+ */
+void StatsOnSent(SessionStats *st, size_t len, unsigned long long nowMs);
+void StatsOnReceived(SessionStats *st, size_t len, unsigned long long nowMs);
+
+void StatsSamplerInit(StatsSampler *sm, const SessionStats *st, unsigned long long nowMs);
+
+/**
+ * Read the counters and compute rates since the previous call
+ */
+void StatsSample(const SessionStats *st, StatsSampler *sm, unsigned long long nowMs, StatsSnapshot *snap);
+
+/**
+ * Compact title summary, e.g. "42 ms | 1.2 MB/s" (appends "| idle 5m" when quiet)
+ */
+void StatsFormatSummary(const StatsSnapshot *snap, char *out, size_t cbOut);
+
+/**
+ * JSON object for the stats file. pszTarget is user@host (UTF-8).
+ * Returns the length written, 0 if it did not fit.
+ */
+size_t StatsFormatJson(const StatsSnapshot *snap, const char *pszTarget, char *out, size_t cbOut);
+
+#endif /* SSHFS_STATS_H */
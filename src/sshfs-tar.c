@@ -0,0 +1,523 @@
+/**
+ * sshfs-tar.c
+ *
+ * Streaming tar reader (see sshfs-tar.h)
+ */
+
+#include "sshfs-tar.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest pax / long name record accepted */
+#define TAR_MAX_EXT (64 * 1024)
+
+enum {
+    ST_HEADER,
+    ST_DATA,
+    ST_PADDING,
+    ST_EXT,
+    ST_DONE,
+    ST_FAILED
+};
+
+void TarReaderInit(TarReader *tr)
+{
+    memset(tr, 0, sizeof(*tr));
+    tr->state = ST_HEADER;
+}
+
+void TarReaderFree(TarReader *tr)
+{
+    free(tr->ext);
+    tr->ext = NULL;
+}
+
+void TarReaderSetInput(TarReader *tr, const char *data, size_t len)
+{
+    tr->in = data;
+    tr->cbIn = len;
+}
+
+static TarEvent Fail(TarReader *tr, const char *pszError)
+{
+    snprintf(tr->szError, sizeof(tr->szError), "%s", pszError);
+    tr->state = ST_FAILED;
+    return TAR_ERROR;
+}
+
+static size_t Padding(unsigned long long size)
+{
+    return TAR_PADDING(size);
+}
+
+/**
+ * Octal field (space/NUL terminated), or GNU base-256 when the high bit is set
+ */
+static unsigned long long ParseNumber(const char *p, size_t n)
+{
+    unsigned long long v = 0;
+    size_t i = 0;
+
+    if ((unsigned char)p[0] & 0x80)
+    {
+        v = (unsigned char)p[0] & 0x3f;
+        for (i = 1; i < n; i++)
+            v = (v << 8) | (unsigned char)p[i];
+        return v;
+    }
+
+    while (i < n && p[i] == ' ')
+        i++;
+    for (; i < n && p[i] >= '0' && p[i] <= '7'; i++)
+        v = (v << 3) | (unsigned long long)(p[i] - '0');
+    return v;
+}
+
+static int ChecksumOk(const char *block)
+{
+    unsigned long long stored = ParseNumber(block + 148, 8);
+    unsigned long long sum = 0;
+    long long sumSigned = 0;
+
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        char c = (i >= 148 && i < 156) ? ' ' : block[i];
+        sum += (unsigned char)c;
+        sumSigned += (signed char)c;
+    }
+
+    /* Some old tars summed signed chars */
+    return stored == sum || (long long)stored == sumSigned;
+}
+
+static void CopyField(char *dst, size_t cbDst, const char *src, size_t n)
+{
+    size_t len = 0;
+
+    while (len < n && src[len])
+        len++;
+    if (len >= cbDst)
+        len = cbDst - 1;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static void StripTrailingSlashes(char *psz)
+{
+    size_t n = strlen(psz);
+
+    while (n > 1 && psz[n - 1] == '/')
+        psz[--n] = '\0';
+}
+
+/**
+ * "<len> <key>=<value>\n" records of a pax extended header
+ */
+static int ApplyPax(TarReader *tr, const char *p, size_t n)
+{
+    const char *end = p + n;
+
+    while (p < end)
+    {
+        const char *rec = p, *key, *eq, *val, *recEnd;
+        unsigned long len = 0;
+
+        while (p < end && *p >= '0' && *p <= '9')
+            len = len * 10 + (unsigned long)(*p++ - '0');
+        if (p >= end || *p != ' ' || len == 0 || len > (unsigned long)(end - rec))
+            return 0;
+
+        recEnd = rec + len;
+        key = p + 1;
+        eq = memchr(key, '=', (size_t)(recEnd - key));
+        if (!eq || recEnd[-1] != '\n')
+            return 0;
+        val = eq + 1;
+
+#define KEY_IS(k) ((size_t)(eq - key) == sizeof(k) - 1 && memcmp(key, k, sizeof(k) - 1) == 0)
+        if (KEY_IS("path"))
+        {
+            if ((size_t)(recEnd - 1 - val) >= TAR_MAX_PATH)
+                return 0;
+            CopyField(tr->szNextPath, TAR_MAX_PATH, val, (size_t)(recEnd - 1 - val));
+        }
+        else if (KEY_IS("linkpath"))
+        {
+            if ((size_t)(recEnd - 1 - val) >= TAR_MAX_PATH)
+                return 0;
+            CopyField(tr->szNextLink, TAR_MAX_PATH, val, (size_t)(recEnd - 1 - val));
+        }
+        else if (KEY_IS("size"))
+        {
+            tr->nextSize = strtoull(val, NULL, 10);
+            tr->bNextSize = 1;
+        }
+        else if (KEY_IS("mtime"))
+        {
+            /* Fractional seconds are dropped */
+            tr->nextMtime = strtoll(val, NULL, 10);
+            tr->bNextMtime = 1;
+        }
+#undef KEY_IS
+
+        p = recEnd;
+    }
+    return 1;
+}
+
+static TarEvent FinishExt(TarReader *tr)
+{
+    tr->ext[tr->cbExt] = '\0';
+
+    switch (tr->extKind)
+    {
+    case 'L':
+        if (strlen(tr->ext) >= TAR_MAX_PATH)
+            return Fail(tr, "path name too long");
+        CopyField(tr->szNextPath, TAR_MAX_PATH, tr->ext, tr->cbExt);
+        break;
+    case 'K':
+        if (strlen(tr->ext) >= TAR_MAX_PATH)
+            return Fail(tr, "link name too long");
+        CopyField(tr->szNextLink, TAR_MAX_PATH, tr->ext, tr->cbExt);
+        break;
+    case 'x':
+        if (!ApplyPax(tr, tr->ext, tr->cbExt))
+            return Fail(tr, "malformed pax header");
+        break;
+    default:
+        /* Global pax headers carry nothing we extract */
+        break;
+    }
+
+    free(tr->ext);
+    tr->ext = NULL;
+    tr->state = ST_PADDING;
+    return TAR_NEED_INPUT;
+}
+
+/**
+ * A complete header block: either an extension record to collect, or the
+ * next entry
+ */
+static TarEvent ParseHeader(TarReader *tr)
+{
+    const char *b = tr->block;
+    TarEntry *e = &tr->entry;
+    unsigned long long size;
+    char type;
+    int i;
+
+    for (i = 0; i < TAR_BLOCK_SIZE && b[i] == 0; i++)
+        ;
+    if (i == TAR_BLOCK_SIZE)
+    {
+        /* Two zero blocks end the archive */
+        if (++tr->nZeroBlocks >= 2)
+        {
+            tr->state = ST_DONE;
+            return TAR_END;
+        }
+        return TAR_NEED_INPUT;
+    }
+    tr->nZeroBlocks = 0;
+
+    if (!ChecksumOk(b))
+        return Fail(tr, "header checksum mismatch");
+
+    type = b[156];
+    size = ParseNumber(b + 124, 12);
+
+    if (type == 'L' || type == 'K' || type == 'x' || type == 'g')
+    {
+        if (size > TAR_MAX_EXT)
+            return Fail(tr, "extended header too large");
+        tr->ext = malloc((size_t)size + 1);
+        if (!tr->ext)
+            return Fail(tr, "out of memory");
+        tr->extKind = type;
+        tr->cbExt = 0;
+        tr->cbExtWanted = (size_t)size;
+        tr->cbPadding = Padding(size);
+        tr->state = ST_EXT;
+        return TAR_NEED_INPUT;
+    }
+
+    /* Name: long name record, else ustar prefix + name */
+    if (tr->szNextPath[0])
+    {
+        memcpy(e->szPath, tr->szNextPath, TAR_MAX_PATH);
+    }
+    else if (memcmp(b + 257, "ustar", 5) == 0 && b[345])
+    {
+        char szPrefix[156], szName[101];
+        CopyField(szPrefix, sizeof(szPrefix), b + 345, 155);
+        CopyField(szName, sizeof(szName), b + 0, 100);
+        snprintf(e->szPath, TAR_MAX_PATH, "%s/%s", szPrefix, szName);
+    }
+    else
+    {
+        CopyField(e->szPath, TAR_MAX_PATH, b + 0, 100);
+    }
+
+    if (tr->szNextLink[0])
+        memcpy(e->szLink, tr->szNextLink, TAR_MAX_PATH);
+    else
+        CopyField(e->szLink, TAR_MAX_PATH, b + 157, 100);
+
+    if (tr->bNextSize)
+        size = tr->nextSize;
+    e->mtime = tr->bNextMtime ? tr->nextMtime : (long long)ParseNumber(b + 136, 12);
+    e->mode = (unsigned int)ParseNumber(b + 100, 8);
+
+    switch (type)
+    {
+    case '0':
+    case '\0':
+    case '7':
+        /* Pre-POSIX archives mark directories with a trailing slash only */
+        e->type = (e->szPath[0] && e->szPath[strlen(e->szPath) - 1] == '/') ? TAR_DIRECTORY : TAR_FILE;
+        break;
+    case '1':
+        e->type = TAR_HARDLINK;
+        break;
+    case '2':
+        e->type = TAR_SYMLINK;
+        break;
+    case '5':
+        e->type = TAR_DIRECTORY;
+        break;
+    default:
+        e->type = TAR_OTHER;
+        break;
+    }
+    StripTrailingSlashes(e->szPath);
+
+    /* Content of anything but a file (e.g. GNU dumpdirs) is skipped silently */
+    e->size = (e->type == TAR_FILE) ? size : 0;
+    tr->cbRemaining = size;
+    tr->cbPadding = Padding(size);
+
+    tr->szNextPath[0] = '\0';
+    tr->szNextLink[0] = '\0';
+    tr->bNextSize = 0;
+    tr->bNextMtime = 0;
+
+    tr->state = ST_DATA;
+    return TAR_ENTRY;
+}
+
+TarEvent TarReaderNext(TarReader *tr, const char **pData, size_t *pLen)
+{
+    size_t n;
+
+    for (;;)
+    {
+        switch (tr->state)
+        {
+        case ST_HEADER:
+        {
+            TarEvent ev;
+
+            if (tr->cbIn == 0)
+                return TAR_NEED_INPUT;
+            n = TAR_BLOCK_SIZE - tr->cbBlock;
+            if (n > tr->cbIn)
+                n = tr->cbIn;
+            memcpy(tr->block + tr->cbBlock, tr->in, n);
+            tr->cbBlock += n;
+            tr->in += n;
+            tr->cbIn -= n;
+            if (tr->cbBlock < TAR_BLOCK_SIZE)
+                return TAR_NEED_INPUT;
+            tr->cbBlock = 0;
+
+            ev = ParseHeader(tr);
+            if (ev != TAR_NEED_INPUT)
+                return ev;
+            break;
+        }
+
+        case ST_DATA:
+            if (tr->cbRemaining == 0)
+            {
+                tr->state = ST_PADDING;
+                return TAR_ENTRY_END;
+            }
+            if (tr->cbIn == 0)
+                return TAR_NEED_INPUT;
+            n = tr->cbIn;
+            if (n > tr->cbRemaining)
+                n = (size_t)tr->cbRemaining;
+            *pData = tr->in;
+            *pLen = n;
+            tr->in += n;
+            tr->cbIn -= n;
+            tr->cbRemaining -= n;
+            if (tr->entry.type == TAR_FILE)
+                return TAR_DATA;
+            break;
+
+        case ST_PADDING:
+            n = tr->cbPadding < tr->cbIn ? tr->cbPadding : tr->cbIn;
+            tr->in += n;
+            tr->cbIn -= n;
+            tr->cbPadding -= n;
+            if (tr->cbPadding > 0)
+                return TAR_NEED_INPUT;
+            tr->state = ST_HEADER;
+            break;
+
+        case ST_EXT:
+            n = tr->cbExtWanted - tr->cbExt;
+            if (n > tr->cbIn)
+                n = tr->cbIn;
+            memcpy(tr->ext + tr->cbExt, tr->in, n);
+            tr->cbExt += n;
+            tr->in += n;
+            tr->cbIn -= n;
+            if (tr->cbExt < tr->cbExtWanted)
+                return TAR_NEED_INPUT;
+            if (FinishExt(tr) == TAR_ERROR)
+                return TAR_ERROR;
+            break;
+
+        case ST_DONE:
+            /* Trailing record padding */
+            tr->cbIn = 0;
+            return TAR_NEED_INPUT;
+
+        default:
+            return TAR_ERROR;
+        }
+    }
+}
+
+int TarPathIsSafe(const char *pszPath)
+{
+    const char *p = pszPath;
+    int bAny = 0;
+
+    if (p[0] == '/' || p[0] == '\\')
+        return 0;
+
+    while (*p)
+    {
+        const char *end = p;
+        size_t n;
+
+        while (*end && *end != '/' && *end != '\\')
+            end++;
+        n = (size_t)(end - p);
+
+        if (n == 2 && p[0] == '.' && p[1] == '.')
+            return 0;
+        if (n > 0 && !(n == 1 && p[0] == '.'))
+            bAny = 1;
+
+        p = *end ? end + 1 : end;
+    }
+    return bAny;
+}
+
+/**
+ * Octal when it fits the field, GNU base-256 otherwise (files over 8 GiB)
+ */
+static void FormatNumber(char *p, size_t n, unsigned long long v)
+{
+    if (v < (1ULL << (3 * (n - 1))))
+    {
+        for (size_t i = n - 1; i-- > 0; v >>= 3)
+            p[i] = (char)('0' + (v & 7));
+        p[n - 1] = '\0';
+        return;
+    }
+
+    for (size_t i = n; i-- > 1; v >>= 8)
+        p[i] = (char)(v & 0xff);
+    p[0] = (char)0x80;
+}
+
+static void FinishBlock(char *b)
+{
+    unsigned int sum = 0;
+
+    memset(b + 148, ' ', 8);
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+        sum += (unsigned char)b[i];
+    snprintf(b + 148, 8, "%06o", sum);
+    b[155] = ' ';
+}
+
+/**
+ * One header block. GNU magic, since long names use GNU records.
+ */
+static void FormatBlock(char *b, const char *pszName, const char *pszLink,
+    char type, unsigned int mode, unsigned long long size, long long mtime)
+{
+    memset(b, 0, TAR_BLOCK_SIZE);
+    memcpy(b, pszName, strnlen(pszName, 100));
+    FormatNumber(b + 100, 8, mode & 07777);
+    FormatNumber(b + 108, 8, 0);
+    FormatNumber(b + 116, 8, 0);
+    FormatNumber(b + 124, 12, size);
+    FormatNumber(b + 136, 12, mtime > 0 ? (unsigned long long)mtime : 0);
+    b[156] = type;
+    if (pszLink)
+        memcpy(b + 157, pszLink, strnlen(pszLink, 100));
+    memcpy(b + 257, "ustar  ", 8);
+    FinishBlock(b);
+}
+
+/**
+ * GNU 'L' / 'K' record carrying a name too long for its header field
+ */
+static size_t FormatLongName(char *out, char type, const char *pszName, size_t len)
+{
+    size_t cb = TAR_BLOCK_SIZE + len + 1 + TAR_PADDING(len + 1);
+
+    FormatBlock(out, "././@LongLink", NULL, type, 0644, len + 1, 0);
+    memset(out + TAR_BLOCK_SIZE, 0, cb - TAR_BLOCK_SIZE);
+    memcpy(out + TAR_BLOCK_SIZE, pszName, len);
+    return cb;
+}
+
+size_t TarFormatHeader(const TarEntry *e, char *out, size_t cbOut)
+{
+    char szName[TAR_MAX_PATH + 1];
+    size_t lenName, lenLink = 0, cb = 0;
+    char type;
+
+    lenName = strnlen(e->szPath, TAR_MAX_PATH);
+    if (lenName == 0 || lenName >= TAR_MAX_PATH)
+        return 0;
+    memcpy(szName, e->szPath, lenName);
+    if (e->type == TAR_DIRECTORY && szName[lenName - 1] != '/')
+        szName[lenName++] = '/';
+    szName[lenName] = '\0';
+
+    switch (e->type)
+    {
+    case TAR_DIRECTORY: type = '5'; break;
+    case TAR_SYMLINK:   type = '2'; break;
+    case TAR_HARDLINK:  type = '1'; break;
+    default:            type = '0'; break;
+    }
+    if (type == '1' || type == '2')
+        lenLink = strnlen(e->szLink, TAR_MAX_PATH);
+
+    if (cbOut < TAR_HEADER_MAX)
+        return 0;
+
+    if (lenName >= 100)
+        cb += FormatLongName(out + cb, 'L', szName, lenName);
+    if (lenLink >= 100)
+        cb += FormatLongName(out + cb, 'K', e->szLink, lenLink);
+
+    FormatBlock(out + cb, szName, lenLink ? e->szLink : NULL, type,
+        e->mode ? e->mode : (type == '5' ? 0755 : 0644),
+        type == '0' ? e->size : 0, e->mtime);
+    return cb + TAR_BLOCK_SIZE;
+}
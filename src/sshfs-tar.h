@@ -0,0 +1,114 @@
+/**
+ * sshfs-tar.h
+ *
+ * Streaming reader for the tar archives produced by "tar cf -" on the
+ * server (ustar with GNU long names or pax headers), and the header writer
+ * for archives sent the other way to "tar xf -".
+ *
+ * The reader is fed whatever the pipe delivers and hands back events one at
+ * a time: an entry header, then its content as slices that point straight
+ * into the caller's buffer (no copy), then the end of the entry. Only
+ * headers and long-name records are buffered, so memory use does not
+ * depend on file sizes.
+ *
+ *     TarReaderSetInput(&tr, buf, n);
+ *     while ((ev = TarReaderNext(&tr, &data, &len)) > TAR_NEED_INPUT)
+ *         ... handle tr.entry / data ...
+ */
+
+#ifndef SSHFS_TAR_H
+#define SSHFS_TAR_H
+
+#include <stddef.h>
+
+#define TAR_BLOCK_SIZE   512
+#define TAR_MAX_PATH     4096       /* Longer names are reported as TAR_ERROR */
+
+/* Room TarFormatHeader() may need: long name and link records plus the header */
+#define TAR_HEADER_MAX   (TAR_BLOCK_SIZE * 5 + 2 * TAR_MAX_PATH)
+
+/* Zero bytes after content of the given size up to the next block */
+#define TAR_PADDING(size) ((size_t)((TAR_BLOCK_SIZE - (size) % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE))
+
+typedef enum {
+    TAR_ERROR = -1,                 /* Corrupt archive, see szError */
+    TAR_NEED_INPUT = 0,             /* Input consumed, feed more */
+    TAR_ENTRY,                      /* tr.entry describes the next entry */
+    TAR_DATA,                       /* A slice of the current file's content */
+    TAR_ENTRY_END,                  /* All content of the current entry delivered */
+    TAR_END                         /* End of archive marker */
+} TarEvent;
+
+typedef enum {
+    TAR_FILE,
+    TAR_DIRECTORY,
+    TAR_SYMLINK,
+    TAR_HARDLINK,                   /* szLink names an earlier entry of the archive */
+    TAR_OTHER                       /* Devices, fifos: nothing to extract */
+} TarEntryType;
+
+typedef struct TarEntry {
+    TarEntryType type;
+    char szPath[TAR_MAX_PATH];      /* As stored, '/' separated, UTF-8 on sane servers */
+    char szLink[TAR_MAX_PATH];
+    unsigned long long size;        /* Content bytes (0 for everything but files) */
+    long long mtime;                /* Seconds since 1970 */
+    unsigned int mode;
+} TarEntry;
+
+typedef struct TarReader {
+    const char *in;                 /* Caller input not yet consumed */
+    size_t cbIn;
+
+    int state;
+    char block[TAR_BLOCK_SIZE];     /* Header being assembled */
+    size_t cbBlock;
+
+    char *ext;                      /* GNU long name / pax record being assembled */
+    size_t cbExt, cbExtWanted;
+    int extKind;
+
+    char szNextPath[TAR_MAX_PATH];  /* Overrides for the next header */
+    char szNextLink[TAR_MAX_PATH];
+    unsigned long long nextSize;
+    long long nextMtime;
+    int bNextSize, bNextMtime;
+
+    unsigned long long cbRemaining; /* Content left in the current entry */
+    size_t cbPadding;               /* Then zero padding up to the block */
+    int nZeroBlocks;
+
+    TarEntry entry;
+    char szError[128];
+} TarReader;
+
+void TarReaderInit(TarReader *tr);
+void TarReaderFree(TarReader *tr);
+
+/**
+ * Hand the reader the next piece of the stream. The buffer must stay valid
+ * until TarReaderNext() returns TAR_NEED_INPUT.
+ */
+void TarReaderSetInput(TarReader *tr, const char *data, size_t len);
+
+/**
+ * Next event. TAR_DATA points *pData (length *pLen) at the slice.
+ */
+TarEvent TarReaderNext(TarReader *tr, const char **pData, size_t *pLen);
+
+/**
+ * 1 if the archive path stays below the extraction folder: relative, and
+ * no ".." component. Empty paths and "." are not safe (nothing to create).
+ */
+int TarPathIsSafe(const char *pszPath);
+
+/**
+ * Header block(s) for an entry: GNU long name / long link records when the
+ * names do not fit the 100 byte fields, then the header itself. Directories
+ * get their trailing slash added. Content (e->size bytes, files only) and
+ * TAR_PADDING() zeros follow; two zero blocks end the archive.
+ * Returns the bytes written, 0 if cbOut is too small (see TAR_HEADER_MAX).
+ */
+size_t TarFormatHeader(const TarEntry *e, char *out, size_t cbOut);
+
+#endif /* SSHFS_TAR_H */
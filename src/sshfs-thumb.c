@@ -0,0 +1,290 @@
+/**
+ * sshfs-thumb.c
+ *
+ * Thumbnail names, stream parsing and cache entries (see sshfs-thumb.h)
+ */
+
+#include "sshfs-thumb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THUMBS_PREFIX       "#sshfs-thumbs "
+#define THUMBS_PREFIX_LEN   14
+#define CACHE_MAGIC         "#sshfs-thumb 1 "
+
+enum { STATE_LINE, STATE_BODY };
+
+static const char *const g_ppszExtensions[] = {
+    ".jpg", ".jpeg", ".jpe", ".png", ".gif", ".bmp", ".tif", ".tiff", ".webp", ".heic", NULL
+};
+
+const char *ThumbExtension(size_t i)
+{
+    return i < sizeof(g_ppszExtensions) / sizeof(g_ppszExtensions[0]) ? g_ppszExtensions[i] : NULL;
+}
+
+static char Lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+int ThumbIsImageName(const char *pszName)
+{
+    const char *pszDot = NULL;
+    const char *p;
+    size_t i;
+
+    for (p = pszName; *p; p++)
+    {
+        if (*p == '/' || *p == '\n')
+            return 0;
+        if (*p == '.')
+            pszDot = p;
+    }
+    if (!pszDot || pszDot == pszName || (size_t)(p - pszName) > THUMB_MAX_NAME)
+        return 0;
+
+    for (i = 0; g_ppszExtensions[i]; i++)
+    {
+        const char *e = g_ppszExtensions[i];
+        const char *s = pszDot;
+
+        while (*e && Lower(*s) == *e)
+        {
+            e++;
+            s++;
+        }
+        if (!*e && !*s)
+            return 1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void ThumbParserInit(ThumbParser *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->state = STATE_LINE;
+}
+
+void ThumbParserFree(ThumbParser *p)
+{
+    free(p->pBody);
+    p->pBody = NULL;
+    p->cbBody = p->cbBodyAlloc = 0;
+}
+
+/**
+ * Unsigned decimal at *pp up to a space or the end; advances past the space
+ */
+static int ParseNumber(const char **pp, unsigned long long *pValue)
+{
+    const char *s = *pp;
+    unsigned long long v = 0;
+
+    if (*s < '0' || *s > '9')
+        return 0;
+    for (; *s >= '0' && *s <= '9'; s++)
+    {
+        if (v > (~0ULL - 9) / 10)
+            return 0;
+        v = v * 10 + (unsigned long long)(*s - '0');
+    }
+    if (*s == ' ')
+        s++;
+    else if (*s)
+        return 0;
+    *pp = s;
+    *pValue = v;
+    return 1;
+}
+
+/**
+ * A complete line (without its '\n'): a frame header or a "#sshfs-thumbs" line
+ */
+static int ParseLine(ThumbParser *p, const char *psz)
+{
+    unsigned long long mtime, cbName, cbData;
+
+    if (strncmp(psz, THUMBS_PREFIX, THUMBS_PREFIX_LEN) == 0)
+    {
+        psz += THUMBS_PREFIX_LEN;
+        if (strcmp(psz, "none") == 0)
+            p->bNoTool = 1;
+        else if (strcmp(psz, "end") == 0)
+            p->bEnd = 1;
+        else
+            snprintf(p->szTool, sizeof(p->szTool), "%s", psz);
+        return 1;
+    }
+
+    if ((psz[0] != THUMB_IMAGE && psz[0] != THUMB_FAILED) || psz[1] != ' ')
+        return 0;
+    p->kind = (ThumbKind)psz[0];
+    psz += 2;
+    if (!ParseNumber(&psz, &mtime) || !ParseNumber(&psz, &cbName) || !ParseNumber(&psz, &cbData) || *psz)
+        return 0;
+    if (cbName == 0 || cbName > THUMB_MAX_NAME || cbData > THUMB_MAX_DATA ||
+        (p->kind == THUMB_FAILED && cbData != 0) || (p->kind == THUMB_IMAGE && cbData == 0))
+        return 0;
+
+    p->mtime = (long long)mtime;
+    p->cbName = (size_t)cbName;
+    p->cbData = (size_t)cbData;
+    p->state = STATE_BODY;
+    return 1;
+}
+
+static void Emit(ThumbParser *p, const unsigned char *pBody, ThumbFrameFn pfn, void *pContext)
+{
+    ThumbFrame f;
+
+    f.kind = p->kind;
+    f.mtime = p->mtime;
+    f.pName = (const char *)pBody;
+    f.cbName = p->cbName;
+    f.pData = pBody + p->cbName;
+    f.cbData = p->cbData;
+    p->nFrames++;
+    p->state = STATE_LINE;
+    pfn(&f, pContext);
+}
+
+int ThumbParserFeed(ThumbParser *p, const void *data, size_t cb, ThumbFrameFn pfn, void *pContext)
+{
+    const unsigned char *s = (const unsigned char *)data;
+
+    while (cb > 0)
+    {
+        if (p->state == STATE_LINE)
+        {
+            const unsigned char *nl = memchr(s, '\n', cb);
+            size_t take = nl ? (size_t)(nl - s) + 1 : cb;
+
+            if (p->cbLine + take > sizeof(p->line))
+                return 0;
+            memcpy(p->line + p->cbLine, s, take);
+            p->cbLine += take;
+            s += take;
+            cb -= take;
+            if (!nl)
+                break;
+
+            p->line[p->cbLine - 1] = '\0';
+            p->cbLine = 0;
+            if (!ParseLine(p, p->line))
+                return 0;
+        }
+        else
+        {
+            size_t need = p->cbName + p->cbData;
+            size_t take;
+
+            /* The usual case with large reads: no copy */
+            if (p->cbBody == 0 && cb >= need)
+            {
+                Emit(p, s, pfn, pContext);
+                s += need;
+                cb -= need;
+                continue;
+            }
+
+            if (p->cbBodyAlloc < need)
+            {
+                unsigned char *pNew = realloc(p->pBody, need);
+                if (!pNew)
+                    return 0;
+                p->pBody = pNew;
+                p->cbBodyAlloc = need;
+            }
+            take = need - p->cbBody < cb ? need - p->cbBody : cb;
+            memcpy(p->pBody + p->cbBody, s, take);
+            p->cbBody += take;
+            s += take;
+            cb -= take;
+            if (p->cbBody == need)
+            {
+                p->cbBody = 0;
+                Emit(p, p->pBody, pfn, pContext);
+            }
+        }
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+size_t ThumbCacheKey(const char *pszUser, const char *pszHost, const char *pszPort,
+    const char *pszPath, char *out, size_t cbOut)
+{
+    int n = snprintf(out, cbOut, "%s@%s:%s:%s", pszUser, pszHost, pszPort[0] ? pszPort : "22", pszPath);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+unsigned long long ThumbHash(unsigned long long h, const void *p, size_t cb)
+{
+    const unsigned char *s = (const unsigned char *)p;
+
+    while (cb--)
+    {
+        h ^= *s++;
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+void ThumbCacheName(const char *pszKey, long long mtime, int size, char cSep, char *out)
+{
+    unsigned long long h;
+    char szTail[48];
+    int n;
+
+    n = snprintf(szTail, sizeof(szTail), "\n%lld\n%d", mtime, size);
+    h = ThumbHash(THUMB_HASH_INIT, pszKey, strlen(pszKey));
+    h = ThumbHash(h, szTail, (size_t)n);
+    snprintf(out, THUMB_CACHE_NAME_MAX, "%02x%c%014llx.thm",
+        (unsigned)(h >> 56), cSep, h & 0xffffffffffffffULL);
+}
+
+size_t ThumbCacheFormatHeader(const char *pszKey, long long mtime, int size, ThumbKind kind,
+    size_t cbData, char *out, size_t cbOut)
+{
+    int n = snprintf(out, cbOut, CACHE_MAGIC "%c %lld %d %lu %lu\n%s", (char)kind, mtime, size,
+        (unsigned long)cbData, (unsigned long)strlen(pszKey), pszKey);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+int ThumbCacheCheck(const void *p, size_t cb, const char *pszKey, long long mtime, int size,
+    ThumbKind *pKind, size_t *pcbOffset, size_t *pcbData)
+{
+    const char *s = (const char *)p;
+    const char *nl = memchr(s, '\n', cb < 128 ? cb : 128);
+    char szLine[128];
+    char cKind;
+    long long fileTime;
+    int fileSize;
+    unsigned long cbData, cbKey;
+    size_t cbHeader;
+
+    if (!nl)
+        return 0;
+    memcpy(szLine, s, (size_t)(nl - s));
+    szLine[nl - s] = '\0';
+    if (sscanf(szLine, CACHE_MAGIC "%c %lld %d %lu %lu", &cKind, &fileTime, &fileSize, &cbData, &cbKey) != 5)
+        return 0;
+    if (fileTime != mtime || fileSize != size || cbKey != strlen(pszKey) ||
+        (cKind != THUMB_IMAGE && cKind != THUMB_FAILED && cKind != THUMB_NO_TOOL))
+        return 0;
+
+    cbHeader = (size_t)(nl - s) + 1 + cbKey;
+    if (cbData > THUMB_MAX_DATA || cb != cbHeader + cbData || memcmp(nl + 1, pszKey, cbKey) != 0)
+        return 0;
+
+    *pKind = (ThumbKind)cKind;
+    *pcbOffset = cbHeader;
+    *pcbData = cbData;
+    return 1;
+}
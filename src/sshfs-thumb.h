@@ -0,0 +1,128 @@
+/**
+ * sshfs-thumb.h
+ *
+ * Pieces of the thumbnail provider in sshfs-ctx.dll and of the batch run
+ * by "sshfs-ssh.exe --thumbs" that do not depend on Windows: which names
+ * get thumbnails, the parser for the framed stream the server sends back
+ * (RemoteBuildThumbCommand()) and the on-disk cache entries.
+ *
+ * One ssh run makes the thumbnails for all the images of a folder that are
+ * not cached yet. The server answers with one frame per name it was given:
+ *
+ *   T <mtime> <name bytes> <data bytes>\n<name><JPEG data>
+ *   E <mtime> <name bytes> 0\n<name>           (no thumbnail for this one)
+ *
+ * between a "#sshfs-thumbs <tool>" line and "#sshfs-thumbs end", or just
+ * "#sshfs-thumbs none" if the server has nothing to make thumbnails with.
+ *
+ * Cache entries are files named by a hash of the remote file, its mtime
+ * and the thumbnail size, holding a header that repeats those (so a hash
+ * collision or a stale file is never shown) and the JPEG data.
+ */
+
+#ifndef SSHFS_THUMB_H
+#define SSHFS_THUMB_H
+
+#include <stddef.h>
+
+#define THUMB_DEFAULT_SIZE      256         /* Longest side in pixels */
+#define THUMB_MAX_DATA          (4 * 1024 * 1024)
+#define THUMB_MAX_NAME          4096
+#define THUMB_CACHE_NAME_MAX    24          /* "ab/0123456789abcd.thm" */
+#define THUMB_NO_TOOL_RETRY     (24 * 3600) /* Seconds before a server without a tool is asked again */
+
+typedef enum {
+    THUMB_IMAGE = 'T',          /* JPEG data follows */
+    THUMB_FAILED = 'E',         /* Not an image the server could read */
+    THUMB_NO_TOOL = 'N'         /* Cache only: the server has no thumbnailer */
+} ThumbKind;
+
+/**
+ * Extension number i (".jpg", ...) of the files thumbnails are made for,
+ * or NULL past the last
+ */
+const char *ThumbExtension(size_t i);
+
+/**
+ * 1 if pszName (a name in a folder, UTF-8) has one of those extensions,
+ * ignoring ASCII case, and can be sent to the server (no '/' or newline)
+ */
+int ThumbIsImageName(const char *pszName);
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct ThumbFrame {
+    ThumbKind kind;
+    long long mtime;                /* Server's modification time, Unix seconds */
+    const char *pName;              /* Not NUL terminated */
+    size_t cbName;
+    const unsigned char *pData;
+    size_t cbData;
+} ThumbFrame;
+
+typedef void (*ThumbFrameFn)(const ThumbFrame *pFrame, void *pContext);
+
+typedef struct ThumbParser {
+    int state;
+    char line[96];                  /* Header or "#sshfs-thumbs" line being read */
+    size_t cbLine;
+    ThumbKind kind;
+    long long mtime;
+    size_t cbName, cbData;
+    unsigned char *pBody;           /* Name and data of a frame cut by a read */
+    size_t cbBody, cbBodyAlloc;
+    char szTool[32];                /* From "#sshfs-thumbs <tool>" */
+    int bNoTool;
+    int bEnd;
+    unsigned long nFrames;
+} ThumbParser;
+
+void ThumbParserInit(ThumbParser *p);
+
+/**
+ * Parse the next cb bytes of the server's output, calling pfn for each
+ * complete frame (its pointers are valid during the call only). Frames
+ * that arrive whole in one call are passed without a copy. Returns 0 if
+ * the stream is not in this format or memory ran out.
+ */
+int ThumbParserFeed(ThumbParser *p, const void *data, size_t cb, ThumbFrameFn pfn, void *pContext);
+
+void ThumbParserFree(ThumbParser *p);
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Cache key of a remote file: "user@host:port:path" (pszPath may be "" for
+ * an entry about the server itself). snprintf-style return.
+ */
+size_t ThumbCacheKey(const char *pszUser, const char *pszHost, const char *pszPort,
+    const char *pszPath, char *out, size_t cbOut);
+
+/**
+ * 64-bit FNV-1a of cb bytes, continuing from h (start with THUMB_HASH_INIT)
+ */
+#define THUMB_HASH_INIT 0xCBF29CE484222325ULL
+unsigned long long ThumbHash(unsigned long long h, const void *p, size_t cb);
+
+/**
+ * File name of the entry for pszKey at mtime and size, relative to the
+ * cache folder, with cSep between the 256 subfolders and the file
+ * (out needs THUMB_CACHE_NAME_MAX)
+ */
+void ThumbCacheName(const char *pszKey, long long mtime, int size, char cSep, char *out);
+
+/**
+ * Header of an entry; the cbData bytes of data follow it. snprintf-style
+ * return.
+ */
+size_t ThumbCacheFormatHeader(const char *pszKey, long long mtime, int size, ThumbKind kind,
+    size_t cbData, char *out, size_t cbOut);
+
+/**
+ * Check a whole entry file read into p: 1 if it is for pszKey, mtime and
+ * size and complete, with its kind and the offset and length of its data
+ */
+int ThumbCacheCheck(const void *p, size_t cb, const char *pszKey, long long mtime, int size,
+    ThumbKind *pKind, size_t *pcbOffset, size_t *pcbData);
+
+#endif /* SSHFS_THUMB_H */
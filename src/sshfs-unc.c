@@ -0,0 +1,265 @@
+/**
+ * sshfs-unc.c
+ *
+ * SSHFS-Win UNC path handling (see sshfs-unc.h)
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <strsafe.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "sshfs-unc.h"
+#include "sshfs-path.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "mpr.lib")
+#endif
+
+/**
+ * Parse SSHFS UNC path to extract connection info (ParseSSHFSInstance())
+ */
+BOOL ParseSSHFSUNCPath(
+    LPCWSTR pszUNC,
+    LPWSTR pszUser, DWORD cchUser,
+    LPWSTR pszHost, DWORD cchHost,
+    LPWSTR pszPort, DWORD cchPort,
+    LPWSTR pszBasePath, DWORD cchBasePath,
+    MountType *pMountType)
+{
+    char szUNC[MAX_PATH * 6];
+    SSHFSInstance inst;
+
+    if (!pszUNC ||
+        !WideCharToMultiByte(CP_UTF8, 0, pszUNC, -1, szUNC, (int)sizeof(szUNC), NULL, NULL) ||
+        !ParseSSHFSInstance(szUNC, &inst))
+        return FALSE;
+
+    MultiByteToWideChar(CP_UTF8, 0, inst.szUser, -1, pszUser, (int)cchUser);
+    MultiByteToWideChar(CP_UTF8, 0, inst.szHost, -1, pszHost, (int)cchHost);
+    MultiByteToWideChar(CP_UTF8, 0, inst.szPort, -1, pszPort, (int)cchPort);
+    MultiByteToWideChar(CP_UTF8, 0, inst.szBasePath, -1, pszBasePath, (int)cchBasePath);
+    *pMountType = inst.mountType;
+    return TRUE;
+}
+
+/**
+ * Get the UNC path for a drive letter
+ */
+BOOL GetDriveUNCPath(WCHAR driveLetter, LPWSTR pszUNC, DWORD cchUNC)
+{
+    WCHAR szDrive[4] = {driveLetter, L':', L'\0'};
+    DWORD dwLen = cchUNC;
+    return WNetGetConnectionW(szDrive, pszUNC, &dwLen) == NO_ERROR;
+}
+
+/**
+ * Build the full remote path (BuildMountedRemotePath())
+ */
+void BuildFullRemotePath(
+    LPCWSTR pszLocalPath,
+    LPCWSTR pszUNCPath,
+    LPCWSTR pszUNCBasePath,
+    MountType mountType,
+    LPWSTR pszFullRemotePath,
+    DWORD cchFullRemotePath)
+{
+    char szLocalA[MAX_PATH * 3];
+    char szUNCA[MAX_PATH * 6] = "";
+    char szRemoteA[MAX_PATH * 6];
+    BOOL bRootMount = (mountType == MOUNT_TYPE_PASSWORD_ROOT || mountType == MOUNT_TYPE_KEY_ROOT);
+
+    WideCharToMultiByte(CP_UTF8, 0, pszLocalPath, -1, szLocalA, (int)sizeof(szLocalA), NULL, NULL);
+    if (pszUNCPath)
+        WideCharToMultiByte(CP_UTF8, 0, pszUNCPath, -1, szUNCA, (int)sizeof(szUNCA), NULL, NULL);
+
+    BuildMountedRemotePath(szLocalA, szUNCA, bRootMount, szRemoteA, sizeof(szRemoteA));
+    MultiByteToWideChar(CP_UTF8, 0, szRemoteA, -1, pszFullRemotePath, (int)cchFullRemotePath);
+}
+
+ResolveResult ResolveSSHFSPath(LPCWSTR pszPath, SSHFSLocation *pLoc)
+{
+    WCHAR szPath[MAX_PATH];
+    size_t len;
+
+    ZeroMemory(pLoc, sizeof(*pLoc));
+    StringCchCopyW(szPath, MAX_PATH, pszPath);
+
+    /* Remove trailing backslash if present */
+    len = wcslen(szPath);
+    if (len > 3 && (szPath[len - 1] == L'\\' || szPath[len - 1] == L'/'))
+        szPath[len - 1] = L'\0';
+
+    /* Get UNC path */
+    if (szPath[0] == L'\\' && szPath[1] == L'\\')
+    {
+        StringCchCopyW(pLoc->szUNCPath, MAX_PATH * 2, szPath);
+    }
+    else if (szPath[0] && szPath[1] == L':')
+    {
+        if (!GetDriveUNCPath(szPath[0], pLoc->szUNCPath, MAX_PATH * 2))
+            return RESOLVE_NOT_NETWORK_DRIVE;
+    }
+    else
+    {
+        return RESOLVE_BAD_FORMAT;
+    }
+
+    if (_wcsnicmp(pLoc->szUNCPath, L"\\\\sshfs", 7) != 0)
+        return RESOLVE_NOT_SSHFS;
+
+    if (!ParseSSHFSUNCPath(pLoc->szUNCPath,
+        pLoc->szUser, 128, pLoc->szHost, 256, pLoc->szPort, 16,
+        pLoc->szBasePath, MAX_PATH, &pLoc->mountType))
+        return RESOLVE_PARSE_FAILED;
+
+    BuildFullRemotePath(szPath, pLoc->szUNCPath, pLoc->szBasePath, pLoc->mountType,
+        pLoc->szRemotePath, MAX_PATH * 2);
+    return RESOLVE_OK;
+}
+
+BOOL SameSSHFSServer(const SSHFSLocation *pA, const SSHFSLocation *pB)
+{
+    /* User names and ports are compared exactly, host names are not case sensitive */
+    return wcscmp(pA->szUser, pB->szUser) == 0 &&
+        _wcsicmp(pA->szHost, pB->szHost) == 0 &&
+        wcscmp(pA->szPort, pB->szPort) == 0;
+}
+
+BOOL GetWatchEventName(LPCWSTR pszPath, LPWSTR pszName, DWORD cchName)
+{
+    WCHAR szUNC[MAX_PATH * 2];
+    WCHAR *p;
+    int nSlashes = 0;
+
+    /* The drive's connection, or \\server\share of a UNC path */
+    if (pszPath[0] && pszPath[1] == L':')
+    {
+        if (!GetDriveUNCPath(pszPath[0], szUNC, MAX_PATH * 2))
+            return FALSE;
+    }
+    else if (pszPath[0] == L'\\' && pszPath[1] == L'\\')
+    {
+        StringCchCopyW(szUNC, MAX_PATH * 2, pszPath);
+        for (p = szUNC; *p; p++)
+        {
+            if ((*p == L'\\' || *p == L'/') && ++nSlashes == 4)
+            {
+                *p = L'\0';
+                break;
+            }
+        }
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    /* Kernel object names cannot have more backslashes */
+    for (p = szUNC; *p; p++)
+        *p = (*p == L'\\') ? L'/' : towlower(*p);
+    return SUCCEEDED(StringCchPrintfW(pszName, cchName, L"Local\\SSHFS-Win-Watch-%s", szUNC));
+}
+
+DWORD GetThumbnailSetting(LPCWSTR pszName, DWORD dwDefault)
+{
+    HKEY hKey;
+    DWORD dwValue, dwType, dwSize = sizeof(DWORD);
+
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, L"SOFTWARE\\SSHFS-Win\\Thumbnails",
+        0, KEY_READ, &hKey) != ERROR_SUCCESS)
+        return dwDefault;
+
+    if (RegQueryValueExW(hKey, pszName, NULL, &dwType, (LPBYTE)&dwValue, &dwSize) != ERROR_SUCCESS ||
+        dwType != REG_DWORD)
+        dwValue = dwDefault;
+
+    RegCloseKey(hKey);
+    return dwValue;
+}
+
+int GetThumbnailSize(void)
+{
+    DWORD dwSize = GetThumbnailSetting(L"Size", THUMB_DEFAULT_SIZE);
+    return dwSize < 32 ? 32 : dwSize > 1024 ? 1024 : (int)dwSize;
+}
+
+BOOL GetThumbKey(const SSHFSLocation *pLoc, LPCWSTR pszRemotePath, char *pszKey, size_t cbKey)
+{
+    char szUser[128 * 3], szHost[256 * 3], szPort[16 * 3], szPath[MAX_PATH * 2 * 3];
+    char *p;
+
+    if (!WideCharToMultiByte(CP_UTF8, 0, pLoc->szUser, -1, szUser, (int)sizeof(szUser), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, pLoc->szHost, -1, szHost, (int)sizeof(szHost), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, pLoc->szPort, -1, szPort, (int)sizeof(szPort), NULL, NULL) ||
+        !WideCharToMultiByte(CP_UTF8, 0, pszRemotePath, -1, szPath, (int)sizeof(szPath), NULL, NULL))
+        return FALSE;
+
+    /* Host names are not case sensitive, so one server has one set of entries */
+    for (p = szHost; *p; p++)
+        *p = (*p >= 'A' && *p <= 'Z') ? (char)(*p + ('a' - 'A')) : *p;
+    return ThumbCacheKey(szUser, szHost, szPort, szPath, pszKey, cbKey) < cbKey;
+}
+
+BOOL GetThumbCacheFolder(LPWSTR pszFolder, DWORD cchFolder)
+{
+    DWORD cch = GetEnvironmentVariableW(L"LOCALAPPDATA", pszFolder, cchFolder);
+
+    if (cch == 0 || cch >= cchFolder)
+        return FALSE;
+    return SUCCEEDED(StringCchCatW(pszFolder, cchFolder, L"\\SSHFS-Win\\thumbs"));
+}
+
+BOOL GetThumbEntryPath(const char *pszKey, long long mtime, int size, LPWSTR pszFile, DWORD cchFile)
+{
+    char szName[THUMB_CACHE_NAME_MAX];
+    WCHAR szNameW[THUMB_CACHE_NAME_MAX];
+
+    ThumbCacheName(pszKey, mtime, size, '\\', szName);
+    MultiByteToWideChar(CP_UTF8, 0, szName, -1, szNameW, THUMB_CACHE_NAME_MAX);
+    return GetThumbCacheFolder(pszFile, cchFile) &&
+        SUCCEEDED(StringCchCatW(pszFile, cchFile, L"\\")) &&
+        SUCCEEDED(StringCchCatW(pszFile, cchFile, szNameW));
+}
+
+BOOL GetThumbBatchName(const SSHFSLocation *pFolder, LPWSTR pszName, DWORD cchName)
+{
+    char szKey[MAX_PATH * 9];
+
+    /* A hash: the folder's key can be longer than an object name may be */
+    if (!GetThumbKey(pFolder, pFolder->szRemotePath, szKey, sizeof(szKey)))
+        return FALSE;
+    return SUCCEEDED(StringCchPrintfW(pszName, cchName, L"Local\\SSHFS-Win-Thumbs-%016llx",
+        ThumbHash(THUMB_HASH_INIT, szKey, strlen(szKey))));
+}
+
+BOOL IsThumbToolMissing(const SSHFSLocation *pLoc)
+{
+    char szKey[MAX_PATH * 3];
+    WCHAR szFile[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    FILETIME ftNow;
+
+    if (!GetThumbKey(pLoc, L"", szKey, sizeof(szKey)) ||
+        !GetThumbEntryPath(szKey, 0, 0, szFile, MAX_PATH) ||
+        !GetFileAttributesExW(szFile, GetFileExInfoStandard, &fad))
+        return FALSE;
+    GetSystemTimeAsFileTime(&ftNow);
+    return FileTimeToUnixTime(&ftNow) - FileTimeToUnixTime(&fad.ftLastWriteTime) < THUMB_NO_TOOL_RETRY;
+}
+
+long long FileTimeToUnixTime(const FILETIME *pft)
+{
+    ULARGE_INTEGER li;
+
+    li.LowPart = pft->dwLowDateTime;
+    li.HighPart = pft->dwHighDateTime;
+    return (long long)(li.QuadPart / 10000000ULL) - 11644473600LL;
+}
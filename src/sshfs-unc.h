@@ -0,0 +1,124 @@
+/**
+ * sshfs-unc.h
+ *
+ * SSHFS-Win UNC path handling shared by sshfs-ssh.exe and the shell
+ * extension: \\sshfs[.r|.k|.kr]\user@host!port\path parsing and the
+ * mapping from a local path to the remote path on the server, and the names
+ * both agree on for watchers and the thumbnail cache. The parsing itself
+ * is portable UTF-8 code in sshfs-path.c; these are its WCHAR faces.
+ */
+
+#ifndef SSHFS_UNC_H
+#define SSHFS_UNC_H
+
+#include <windows.h>
+
+#include "sshfs-path.h"             /* MountType, the portable parser */
+#include "sshfs-thumb.h"
+
+/**
+ * A local path resolved to its server location
+ */
+typedef struct SSHFSLocation {
+    WCHAR szUNCPath[MAX_PATH * 2];
+    WCHAR szUser[128];
+    WCHAR szHost[256];
+    WCHAR szPort[16];
+    WCHAR szBasePath[MAX_PATH];
+    WCHAR szRemotePath[MAX_PATH * 2];   /* Path to use on the server */
+    MountType mountType;
+} SSHFSLocation;
+
+typedef enum {
+    RESOLVE_OK,
+    RESOLVE_NOT_NETWORK_DRIVE,  /* Drive letter without a network connection */
+    RESOLVE_BAD_FORMAT,         /* Neither X:\... nor a UNC path */
+    RESOLVE_NOT_SSHFS,          /* Network path, but not \\sshfs... */
+    RESOLVE_PARSE_FAILED        /* \\sshfs... without user@host */
+} ResolveResult;
+
+BOOL ParseSSHFSUNCPath(
+    LPCWSTR pszUNC,
+    LPWSTR pszUser, DWORD cchUser,
+    LPWSTR pszHost, DWORD cchHost,
+    LPWSTR pszPort, DWORD cchPort,
+    LPWSTR pszBasePath, DWORD cchBasePath,
+    MountType *pMountType);
+
+BOOL GetDriveUNCPath(WCHAR driveLetter, LPWSTR pszUNC, DWORD cchUNC);
+
+void BuildFullRemotePath(
+    LPCWSTR pszLocalPath,
+    LPCWSTR pszUNCPath,
+    LPCWSTR pszUNCBasePath,
+    MountType mountType,
+    LPWSTR pszFullRemotePath,
+    DWORD cchFullRemotePath);
+
+/**
+ * Resolve a drive letter or UNC path on an SSHFS mount (trailing slash allowed)
+ */
+ResolveResult ResolveSSHFSPath(LPCWSTR pszPath, SSHFSLocation *pLoc);
+
+/**
+ * TRUE if both locations are reached through the same user@host!port,
+ * regardless of mount type (root/home, password/key)
+ */
+BOOL SameSSHFSServer(const SSHFSLocation *pA, const SSHFSLocation *pB);
+
+/**
+ * Name of the event that marks a running watcher ("Watch server changes")
+ * for the mount pszPath is on: derived from the mount's UNC path, so the
+ * shell extension and sshfs-ssh.exe agree on it
+ */
+BOOL GetWatchEventName(LPCWSTR pszPath, LPWSTR pszName, DWORD cchName);
+
+/*
+ * Thumbnails from the server: the cache and the batch in flight, as the
+ * provider in the shell extension and "sshfs-ssh.exe --thumbs" both see
+ * them
+ */
+
+/**
+ * DWORD setting under HKCU\SOFTWARE\SSHFS-Win\Thumbnails
+ */
+DWORD GetThumbnailSetting(LPCWSTR pszName, DWORD dwDefault);
+
+/**
+ * Thumbnail size in pixels from the "Size" setting, within 32..1024
+ */
+int GetThumbnailSize(void);
+
+/**
+ * Cache key (ThumbCacheKey(), UTF-8) of pszRemotePath on pLoc's server
+ */
+BOOL GetThumbKey(const SSHFSLocation *pLoc, LPCWSTR pszRemotePath, char *pszKey, size_t cbKey);
+
+/**
+ * The cache folder, %LOCALAPPDATA%\SSHFS-Win\thumbs
+ */
+BOOL GetThumbCacheFolder(LPWSTR pszFolder, DWORD cchFolder);
+
+/**
+ * Entry file for pszKey in the cache folder (ThumbCacheName())
+ */
+BOOL GetThumbEntryPath(const char *pszKey, long long mtime, int size, LPWSTR pszFile, DWORD cchFile);
+
+/**
+ * TRUE if a batch found no thumbnailer on pLoc's server within the last
+ * day (THUMB_NO_TOOL entry), so there is no point in starting another
+ */
+BOOL IsThumbToolMissing(const SSHFSLocation *pLoc);
+
+/**
+ * Name of the mutex "--thumbs" holds while it fetches a folder's
+ * thumbnails (pFolder is the folder's location)
+ */
+BOOL GetThumbBatchName(const SSHFSLocation *pFolder, LPWSTR pszName, DWORD cchName);
+
+/**
+ * A file time as the server's Unix seconds
+ */
+long long FileTimeToUnixTime(const FILETIME *pft);
+
+#endif /* SSHFS_UNC_H */
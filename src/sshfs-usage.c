@@ -0,0 +1,320 @@
+/**
+ * sshfs-usage.c
+ *
+ * du output to a folder tree, and the usage cache header (see sshfs-usage.h)
+ */
+
+#include "sshfs-usage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define USAGE_CACHE_MAGIC   "SSHFSDU1"
+
+typedef struct SortKey {
+    unsigned long long cbSize;
+    unsigned int iNode;
+} SortKey;
+
+/**
+ * Make room for nNeed items of cbItem bytes, doubling
+ */
+static int Grow(void **pp, size_t *pnAlloc, size_t nNeed, size_t cbItem)
+{
+    size_t nAlloc = *pnAlloc ? *pnAlloc : 256;
+    void *p;
+
+    if (nNeed <= *pnAlloc)
+        return 1;
+    while (nAlloc < nNeed)
+        nAlloc *= 2;
+    p = realloc(*pp, nAlloc * cbItem);
+    if (!p)
+        return 0;
+    *pp = p;
+    *pnAlloc = nAlloc;
+    return 1;
+}
+
+int UsageTreeInit(UsageTree *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->serverTime = -1;
+    t->iRoot = USAGE_NONE;
+    t->pPending = malloc(USAGE_MAX_RECORD);
+    return t->pPending != NULL;
+}
+
+void UsageTreeFree(UsageTree *t)
+{
+    free(t->pNodes);
+    free(t->pKids);
+    free(t->pNames);
+    free(t->pStack);
+    free(t->pPending);
+    memset(t, 0, sizeof(*t));
+    t->iRoot = USAGE_NONE;
+}
+
+/* Largest first; equal sizes keep du's order */
+static int CompareSortKeys(const void *a, const void *b)
+{
+    const SortKey *ka = (const SortKey *)a;
+    const SortKey *kb = (const SortKey *)b;
+
+    if (ka->cbSize != kb->cbSize)
+        return ka->cbSize > kb->cbSize ? -1 : 1;
+    return ka->iNode < kb->iNode ? -1 : ka->iNode > kb->iNode;
+}
+
+/**
+ * Add a folder at the given depth; the finished folders deeper than it on
+ * the stack are its children
+ */
+static int AddFolder(UsageTree *t, const char *pszName, size_t cchName,
+    unsigned long long cbSize, unsigned int depth)
+{
+    unsigned int iNode = (unsigned int)t->nNodes;
+    UsageNode *n;
+    size_t nChildren = 0, i;
+
+    if (t->nNodes >= USAGE_NONE || t->cbNames + cchName + 1 >= USAGE_NONE)
+        return 0;
+    if (!Grow((void **)&t->pNodes, &t->nNodesAlloc, t->nNodes + 1, sizeof(UsageNode)) ||
+        !Grow((void **)&t->pNames, &t->cbNamesAlloc, t->cbNames + cchName + 1, 1))
+        return 0;
+
+    n = &t->pNodes[t->nNodes++];
+    n->cbSize = cbSize;
+    n->iName = (unsigned int)t->cbNames;
+    n->iParent = USAGE_NONE;
+    n->iKids = (unsigned int)t->nKids;
+    n->nKids = 0;
+    memcpy(t->pNames + t->cbNames, pszName, cchName);
+    t->pNames[t->cbNames + cchName] = '\0';
+    t->cbNames += cchName + 1;
+
+    /* Stack entries are (folder, depth) pairs */
+    while (nChildren < t->nStack && t->pStack[(t->nStack - nChildren - 1) * 2 + 1] > depth)
+        nChildren++;
+
+    if (nChildren > 0)
+    {
+        unsigned int *pTop = t->pStack + (t->nStack - nChildren) * 2;
+        SortKey *pKeys;
+
+        if (t->nKids + nChildren >= USAGE_NONE ||
+            !Grow((void **)&t->pKids, &t->nKidsAlloc, t->nKids + nChildren, sizeof(unsigned int)))
+            return 0;
+        pKeys = malloc(nChildren * sizeof(SortKey));
+        if (!pKeys)
+            return 0;
+        for (i = 0; i < nChildren; i++)
+        {
+            pKeys[i].iNode = pTop[i * 2];
+            pKeys[i].cbSize = t->pNodes[pTop[i * 2]].cbSize;
+        }
+        qsort(pKeys, nChildren, sizeof(SortKey), CompareSortKeys);
+        for (i = 0; i < nChildren; i++)
+        {
+            t->pKids[t->nKids + i] = pKeys[i].iNode;
+            t->pNodes[pKeys[i].iNode].iParent = iNode;
+        }
+        free(pKeys);
+
+        n = &t->pNodes[iNode];
+        n->nKids = (unsigned int)nChildren;
+        t->nKids += nChildren;
+        t->nStack -= nChildren;
+    }
+
+    if (!Grow((void **)&t->pStack, &t->nStackAlloc, (t->nStack + 1) * 2, sizeof(unsigned int)))
+        return 0;
+    t->pStack[t->nStack * 2] = iNode;
+    t->pStack[t->nStack * 2 + 1] = depth;
+    t->nStack++;
+    return 1;
+}
+
+/**
+ * One record without its terminator: "<KiB>\t<path>" or a "#" marker.
+ * Returns 0 only if out of memory.
+ */
+static int TakeRecord(UsageTree *t, const char *rec, size_t cb)
+{
+    const char *p = rec, *end = rec + cb;
+    const char *pszName;
+    unsigned long long kib = 0;
+    unsigned int depth = 0;
+
+    if (cb == 0)
+        return 1;
+
+    if (rec[0] == '#')
+    {
+        if (cb > 6 && memcmp(rec, "#time ", 6) == 0)
+        {
+            long long v = 0;
+            for (p = rec + 6; p < end && *p >= '0' && *p <= '9'; p++)
+                v = v * 10 + (*p - '0');
+            t->serverTime = v;
+        }
+        else if (cb == 6 && memcmp(rec, "#fresh", 6) == 0)
+            t->bFresh = 1;
+        else if (cb == 6 && memcmp(rec, "#lines", 6) == 0)
+            t->bLines = 1;
+        else
+            t->nSkipped++;
+        return 1;
+    }
+
+    while (p < end && *p >= '0' && *p <= '9')
+        kib = kib * 10 + (unsigned long long)(*p++ - '0');
+    if (p == rec || p >= end || *p != '\t')
+    {
+        t->nSkipped++;
+        return 1;
+    }
+    p++;
+
+    /* "." is the listed folder, everything else "./a/b" */
+    if (end - p == 1 && *p == '.')
+        return AddFolder(t, "", 0, kib * 1024, 0);
+    if (end - p >= 2 && p[0] == '.' && p[1] == '/')
+        p += 2;
+    if (p >= end)
+    {
+        t->nSkipped++;
+        return 1;
+    }
+
+    pszName = p;
+    for (depth = 1; p < end; p++)
+    {
+        if (*p == '/')
+        {
+            depth++;
+            pszName = p + 1;
+        }
+    }
+    return AddFolder(t, pszName, (size_t)(end - pszName), kib * 1024, depth);
+}
+
+int UsageTreeFeed(UsageTree *t, const char *data, size_t cb)
+{
+    while (cb > 0)
+    {
+        /* Read each record's end afresh: "#lines" switches it */
+        const char *pEnd = memchr(data, t->bLines ? '\n' : '\0', cb);
+        size_t n = pEnd ? (size_t)(pEnd - data) : cb;
+        int ok = 1;
+
+        if (t->cbPending > 0 || !pEnd)
+        {
+            /* A record cut by a read; one too long to keep is dropped */
+            if (t->cbPending + n <= USAGE_MAX_RECORD)
+                memcpy(t->pPending + t->cbPending, data, n);
+            t->cbPending += n;
+            if (pEnd)
+            {
+                if (t->cbPending <= USAGE_MAX_RECORD)
+                    ok = TakeRecord(t, t->pPending, t->cbPending);
+                else
+                    t->nSkipped++;
+                t->cbPending = 0;
+            }
+        }
+        else
+        {
+            ok = TakeRecord(t, data, n);
+        }
+        if (!ok)
+            return 0;
+        if (!pEnd)
+            break;
+        data += n + 1;
+        cb -= n + 1;
+    }
+    return 1;
+}
+
+int UsageTreeFinish(UsageTree *t)
+{
+    /* du lists the folder itself last, which claims everything left */
+    if (t->nStack == 1 && t->pStack[1] == 0)
+        t->iRoot = t->pStack[0];
+    else
+        t->iRoot = USAGE_NONE;
+    return t->iRoot != USAGE_NONE;
+}
+
+const char *UsageNodeName(const UsageTree *t, unsigned int i)
+{
+    return t->pNames + t->pNodes[i].iName;
+}
+
+unsigned long long UsageOwnFiles(const UsageTree *t, unsigned int i)
+{
+    const UsageNode *n = &t->pNodes[i];
+    unsigned long long cbKids = 0;
+    unsigned int k;
+
+    for (k = 0; k < n->nKids; k++)
+        cbKids += t->pNodes[t->pKids[n->iKids + k]].cbSize;
+    return n->cbSize > cbKids ? n->cbSize - cbKids : 0;
+}
+
+int UsageNodePath(const UsageTree *t, unsigned int i, char cSep, char *pszOut, size_t cchOut)
+{
+    size_t cch = 0, cchName;
+    unsigned int j;
+
+    if (cchOut == 0)
+        return 0;
+
+    /* Length first, then fill in from the end */
+    for (j = i; j != USAGE_NONE && t->pNodes[j].iParent != USAGE_NONE; j = t->pNodes[j].iParent)
+        cch += strlen(UsageNodeName(t, j)) + 1;
+    if (cch > 0)
+        cch--;
+    if (cch >= cchOut)
+    {
+        pszOut[0] = '\0';
+        return 0;
+    }
+
+    pszOut[cch] = '\0';
+    for (j = i; j != USAGE_NONE && t->pNodes[j].iParent != USAGE_NONE; j = t->pNodes[j].iParent)
+    {
+        cchName = strlen(UsageNodeName(t, j));
+        cch -= cchName;
+        memcpy(pszOut + cch, UsageNodeName(t, j), cchName);
+        if (cch > 0)
+            pszOut[--cch] = cSep;
+    }
+    return 1;
+}
+
+size_t UsageCacheFormatHeader(const char *pszRemote, char *out, size_t cbOut)
+{
+    size_t cbMagic = sizeof(USAGE_CACHE_MAGIC);     /* With its NUL */
+    size_t cbRemote = strlen(pszRemote) + 1;
+
+    if (out && cbMagic + cbRemote <= cbOut)
+    {
+        memcpy(out, USAGE_CACHE_MAGIC, cbMagic);
+        memcpy(out + cbMagic, pszRemote, cbRemote);
+    }
+    return cbMagic + cbRemote;
+}
+
+size_t UsageCacheCheckHeader(const char *p, size_t cb, const char *pszRemote)
+{
+    size_t cbMagic = sizeof(USAGE_CACHE_MAGIC);
+    size_t cbRemote = strlen(pszRemote) + 1;
+
+    if (cb < cbMagic + cbRemote || memcmp(p, USAGE_CACHE_MAGIC, cbMagic) != 0 ||
+        memcmp(p + cbMagic, pszRemote, cbRemote) != 0)
+        return 0;
+    return cbMagic + cbRemote;
+}
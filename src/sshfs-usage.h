@@ -0,0 +1,97 @@
+/**
+ * sshfs-usage.h
+ *
+ * Folder tree for "Disk usage on server" in sshfs-ssh.exe, built from the
+ * output of du run on the server, and the cache file that keeps it for the
+ * next look. Free of Windows so it can be run against real du output.
+ *
+ * du prints a folder after everything below it, so a folder's children
+ * are exactly the finished folders one level deeper that have not been
+ * claimed yet: the tree is built on a stack as the records stream in,
+ * without looking any path up.
+ *
+ * The cache is the du output itself behind a short header naming the
+ * remote folder. It starts with the server time of the run, which is what
+ * the freshness check on the server compares mtimes against.
+ */
+
+#ifndef SSHFS_USAGE_H
+#define SSHFS_USAGE_H
+
+#include <stddef.h>
+
+#define USAGE_MAX_RECORD    65536       /* Longer records are counted as skipped */
+#define USAGE_NONE          ((unsigned int)-1)
+
+typedef struct UsageNode {
+    unsigned long long cbSize;      /* On disk, this folder and everything below */
+    unsigned int iName;             /* Offset of the name in pNames ("" for the root) */
+    unsigned int iParent;           /* USAGE_NONE for the root */
+    unsigned int iKids;             /* First child in pKids, largest first */
+    unsigned int nKids;
+} UsageNode;
+
+typedef struct UsageTree {
+    UsageNode *pNodes;
+    size_t nNodes, nNodesAlloc;
+    unsigned int *pKids;
+    size_t nKids, nKidsAlloc;
+    char *pNames;
+    size_t cbNames, cbNamesAlloc;
+    unsigned int *pStack;           /* (folder, depth) pairs waiting for their parent */
+    size_t nStack, nStackAlloc;
+    char *pPending;                 /* Start of a record cut by the last read */
+    size_t cbPending;
+    int bLines;                     /* du without -0: records end at '\n' */
+    int bFresh;                     /* The server found nothing newer than the cache */
+    long long serverTime;           /* From "#time", -1 if none came */
+    unsigned long nSkipped;         /* Records that did not parse */
+    unsigned int iRoot;             /* Set by UsageTreeFinish() */
+} UsageTree;
+
+/**
+ * Returns 0 if out of memory
+ */
+int UsageTreeInit(UsageTree *t);
+
+/**
+ * Parse the next cb bytes of the server's output (RemoteBuildUsageCommand()).
+ * Returns 0 if out of memory.
+ */
+int UsageTreeFeed(UsageTree *t, const char *data, size_t cb);
+
+/**
+ * After the last Feed: returns 1 if the listing was complete (it ended
+ * with the listed folder itself, which becomes iRoot)
+ */
+int UsageTreeFinish(UsageTree *t);
+
+void UsageTreeFree(UsageTree *t);
+
+const char *UsageNodeName(const UsageTree *t, unsigned int i);
+
+/**
+ * Bytes in the files directly inside folder i (not in a subfolder)
+ */
+unsigned long long UsageOwnFiles(const UsageTree *t, unsigned int i);
+
+/**
+ * Path of folder i relative to the root, joined with cSep ("" for the
+ * root). Returns 0 if it did not fit.
+ */
+int UsageNodePath(const UsageTree *t, unsigned int i, char cSep, char *pszOut, size_t cchOut);
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Header of a cache file for the remote folder pszRemote; the server's
+ * output follows it unchanged. snprintf-style return.
+ */
+size_t UsageCacheFormatHeader(const char *pszRemote, char *out, size_t cbOut);
+
+/**
+ * Length of the header at the start of p if it is one for pszRemote, else 0
+ */
+size_t UsageCacheCheckHeader(const char *p, size_t cb, const char *pszRemote);
+
+#endif /* SSHFS_USAGE_H */
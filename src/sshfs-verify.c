@@ -0,0 +1,433 @@
+/**
+ * sshfs-verify.c
+ *
+ * File lists and the parallel local hasher (see sshfs-verify.h)
+ */
+
+#ifndef UNICODE
+#define UNICODE
+#endif
+#ifndef _UNICODE
+#define _UNICODE
+#endif
+
+#include <windows.h>
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sshfs-verify.h"
+
+/* Extended-length paths while walking, as in sshfs-pack.c */
+#define VERIFY_PATH_CCH 32768
+#define VERIFY_NAME_MAX 4096
+
+typedef struct Scan {
+    VerifyList *pList;
+    LPWSTR pszPath;                 /* \\?\ path of the current entry */
+    char szName[VERIFY_NAME_MAX];   /* Its name relative to the root, UTF-8 */
+    BOOL bNoMemory;
+} Scan;
+
+struct LocalHasher {
+    LPWSTR pszRoot;                 /* \\?\ form */
+    VerifyFile **ppFiles;           /* Own copy, largest first */
+    size_t nFiles;
+    volatile LONG nNext;
+    volatile LONG bCancel;
+    volatile LONGLONG cbDone;
+    volatile LONG nErrors;
+    HANDLE hThreads[VERIFY_MAX_WORKERS];
+    int nThreads;
+};
+
+static void RecordError(VerifyList *pList, LPCWSTR pszPath, DWORD dwError)
+{
+    pList->nErrors++;
+    if (!pList->szFirstError[0])
+    {
+        if (wcsncmp(pszPath, L"\\\\?\\UNC\\", 8) == 0)
+            StringCchPrintfW(pList->szFirstError, MAX_PATH + 64, L"\\\\%s (error %lu)", pszPath + 8, dwError);
+        else
+            StringCchPrintfW(pList->szFirstError, MAX_PATH + 64, L"%s (error %lu)",
+                wcsncmp(pszPath, L"\\\\?\\", 4) == 0 ? pszPath + 4 : pszPath, dwError);
+    }
+}
+
+/**
+ * "\\?\" (or "\\?\UNC\") form of a path, without a trailing backslash
+ */
+static BOOL MakeLongPath(LPCWSTR pszPath, LPWSTR pszOut)
+{
+    WCHAR szFull[MAX_PATH];
+    DWORD cch;
+    size_t len;
+
+    cch = GetFullPathNameW(pszPath, MAX_PATH, szFull, NULL);
+    if (cch == 0 || cch >= MAX_PATH)
+        return FALSE;
+    if (wcsncmp(szFull, L"\\\\", 2) == 0)
+        StringCchPrintfW(pszOut, VERIFY_PATH_CCH, L"\\\\?\\UNC\\%s", szFull + 2);
+    else
+        StringCchPrintfW(pszOut, VERIFY_PATH_CCH, L"\\\\?\\%s", szFull);
+    len = wcslen(pszOut);
+    if (len > 0 && pszOut[len - 1] == L'\\')
+        pszOut[len - 1] = L'\0';
+    return TRUE;
+}
+
+static BOOL AddFile(VerifyList *pList, const char *pszName, unsigned long long size)
+{
+    VerifyFile *pFile;
+
+    if (pList->nFiles == pList->nAlloc)
+    {
+        size_t nAlloc = pList->nAlloc ? pList->nAlloc * 2 : 1024;
+        VerifyFile *pFiles = realloc(pList->pFiles, nAlloc * sizeof(VerifyFile));
+        if (!pFiles)
+            return FALSE;
+        pList->pFiles = pFiles;
+        pList->nAlloc = nAlloc;
+    }
+
+    pFile = &pList->pFiles[pList->nFiles];
+    ZeroMemory(pFile, sizeof(*pFile));
+    pFile->pszName = _strdup(pszName);
+    if (!pFile->pszName)
+        return FALSE;
+    pFile->size = size;
+    pList->nFiles++;
+    pList->cbTotal += size;
+    return TRUE;
+}
+
+/**
+ * Append "\<name>" to the path and "/<name>" to the relative name
+ */
+static BOOL PushName(Scan *s, LPCWSTR pszName, size_t *pcchPath, size_t *pcbName)
+{
+    size_t cchName = wcslen(pszName);
+    int cb;
+
+    if (*pcchPath + cchName + 2 >= VERIFY_PATH_CCH)
+        return FALSE;
+    s->pszPath[(*pcchPath)++] = L'\\';
+    memcpy(s->pszPath + *pcchPath, pszName, (cchName + 1) * sizeof(WCHAR));
+    *pcchPath += cchName;
+
+    if (*pcbName > 0)
+        s->szName[(*pcbName)++] = '/';
+    cb = WideCharToMultiByte(CP_UTF8, 0, pszName, (int)cchName,
+        s->szName + *pcbName, (int)(VERIFY_NAME_MAX - *pcbName - 1), NULL, NULL);
+    if (cb <= 0)
+        return FALSE;
+    *pcbName += (size_t)cb;
+    s->szName[*pcbName] = '\0';
+    return TRUE;
+}
+
+static void Walk(Scan *s, size_t cchPath, size_t cbName, const WIN32_FIND_DATAW *pfd);
+
+static void WalkDirectory(Scan *s, size_t cchPath, size_t cbName)
+{
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind;
+
+    if (cchPath + 3 >= VERIFY_PATH_CCH)
+        return;
+    StringCchCopyW(s->pszPath + cchPath, VERIFY_PATH_CCH - cchPath, L"\\*");
+
+    hFind = FindFirstFileExW(s->pszPath, FindExInfoBasic, &fd, FindExSearchNameMatch,
+        NULL, FIND_FIRST_EX_LARGE_FETCH);
+    s->pszPath[cchPath] = L'\0';
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        RecordError(s->pList, s->pszPath, GetLastError());
+        return;
+    }
+
+    do
+    {
+        if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0)
+            continue;
+        Walk(s, cchPath, cbName, &fd);
+        s->pszPath[cchPath] = L'\0';
+        s->szName[cbName] = '\0';
+    } while (!s->bNoMemory && FindNextFileW(hFind, &fd));
+
+    FindClose(hFind);
+}
+
+static void Walk(Scan *s, size_t cchPath, size_t cbName, const WIN32_FIND_DATAW *pfd)
+{
+    if (!PushName(s, pfd->cFileName, &cchPath, &cbName))
+    {
+        RecordError(s->pList, pfd->cFileName, ERROR_FILENAME_EXCED_RANGE);
+        return;
+    }
+
+    if (pfd->dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+    {
+        s->pList->nSkipped++;
+        return;
+    }
+
+    if (pfd->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        WalkDirectory(s, cchPath, cbName);
+        return;
+    }
+
+    if (!AddFile(s->pList, s->szName,
+        ((unsigned long long)pfd->nFileSizeHigh << 32) | pfd->nFileSizeLow))
+        s->bNoMemory = TRUE;
+}
+
+static int CompareName(const void *a, const void *b)
+{
+    return strcmp(((const VerifyFile *)a)->pszName, ((const VerifyFile *)b)->pszName);
+}
+
+BOOL VerifyListScan(VerifyList *pList, LPCWSTR pszRoot, LPCWSTR const *ppszItems, int nItems)
+{
+    Scan *s;
+    size_t cchRoot;
+    BOOL bResult;
+
+    ZeroMemory(pList, sizeof(*pList));
+    s = calloc(1, sizeof(Scan));
+    if (s)
+        s->pszPath = malloc(VERIFY_PATH_CCH * sizeof(WCHAR));
+    if (!s || !s->pszPath)
+    {
+        free(s);
+        return FALSE;
+    }
+    s->pList = pList;
+
+    if (!MakeLongPath(pszRoot, s->pszPath))
+    {
+        RecordError(pList, pszRoot, ERROR_BAD_PATHNAME);
+    }
+    else if (!ppszItems)
+    {
+        WalkDirectory(s, wcslen(s->pszPath), 0);
+    }
+    else
+    {
+        cchRoot = wcslen(s->pszPath);
+        for (int i = 0; i < nItems && !s->bNoMemory; i++)
+        {
+            WIN32_FIND_DATAW fd;
+            HANDLE hFind;
+
+            if (FAILED(StringCchPrintfW(s->pszPath + cchRoot, VERIFY_PATH_CCH - cchRoot, L"\\%s", ppszItems[i])))
+                continue;
+            hFind = FindFirstFileExW(s->pszPath, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, 0);
+            if (hFind == INVALID_HANDLE_VALUE)
+            {
+                RecordError(pList, s->pszPath, GetLastError());
+                s->pszPath[cchRoot] = L'\0';
+                continue;
+            }
+            FindClose(hFind);
+            s->pszPath[cchRoot] = L'\0';
+            s->szName[0] = '\0';
+            Walk(s, cchRoot, 0, &fd);
+        }
+    }
+
+    bResult = !s->bNoMemory;
+    free(s->pszPath);
+    free(s);
+
+    if (pList->nFiles > 1)
+        qsort(pList->pFiles, pList->nFiles, sizeof(VerifyFile), CompareName);
+    return bResult;
+}
+
+VerifyFile *VerifyListFind(const VerifyList *pList, const char *pszName)
+{
+    VerifyFile key;
+
+    if (pList->nFiles == 0)
+        return NULL;
+    key.pszName = (char *)pszName;
+    return bsearch(&key, pList->pFiles, pList->nFiles, sizeof(VerifyFile), CompareName);
+}
+
+void VerifyListFree(VerifyList *pList)
+{
+    for (size_t i = 0; i < pList->nFiles; i++)
+        free(pList->pFiles[i].pszName);
+    free(pList->pFiles);
+    ZeroMemory(pList, sizeof(*pList));
+}
+
+/* ------------------------------------------------------------------------- */
+/* Local hasher                                                               */
+/* ------------------------------------------------------------------------- */
+
+static int CompareSizeDesc(const void *a, const void *b)
+{
+    unsigned long long x = (*(VerifyFile *const *)a)->size;
+    unsigned long long y = (*(VerifyFile *const *)b)->size;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static BOOL HashFile(LocalHasher *h, VerifyFile *pFile, LPWSTR pszPath, char *pBuffer)
+{
+    size_t cchRoot = wcslen(h->pszRoot);
+    HANDLE hFile;
+    Sha256 sha;
+    DWORD cbRead;
+    BOOL bOk = TRUE;
+    LPWSTR p;
+
+    memcpy(pszPath, h->pszRoot, cchRoot * sizeof(WCHAR));
+    pszPath[cchRoot] = L'\\';
+    if (!MultiByteToWideChar(CP_UTF8, 0, pFile->pszName, -1, pszPath + cchRoot + 1,
+        (int)(VERIFY_PATH_CCH - cchRoot - 1)))
+        return FALSE;
+    for (p = pszPath + cchRoot + 1; *p; p++)
+    {
+        if (*p == L'/')
+            *p = L'\\';
+    }
+
+    hFile = CreateFileW(pszPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    Sha256Init(&sha);
+    for (;;)
+    {
+        if (h->bCancel)
+        {
+            bOk = FALSE;
+            break;
+        }
+        if (!ReadFile(hFile, pBuffer, VERIFY_READ_SIZE, &cbRead, NULL))
+        {
+            bOk = FALSE;
+            break;
+        }
+        if (cbRead == 0)
+            break;
+        Sha256Update(&sha, pBuffer, cbRead);
+        InterlockedExchangeAdd64(&h->cbDone, (LONGLONG)cbRead);
+    }
+    CloseHandle(hFile);
+
+    if (bOk)
+    {
+        Sha256Final(&sha, pFile->digest);
+        pFile->bHashed = TRUE;
+    }
+    return bOk;
+}
+
+static DWORD WINAPI HashThread(LPVOID lpParam)
+{
+    LocalHasher *h = (LocalHasher *)lpParam;
+    char *pBuffer = malloc(VERIFY_READ_SIZE);
+    LPWSTR pszPath = malloc(VERIFY_PATH_CCH * sizeof(WCHAR));
+
+    while (pBuffer && pszPath && !h->bCancel)
+    {
+        LONG i = InterlockedIncrement(&h->nNext) - 1;
+
+        if ((size_t)i >= h->nFiles)
+            break;
+        if (!HashFile(h, h->ppFiles[i], pszPath, pBuffer) && !h->bCancel)
+            InterlockedIncrement(&h->nErrors);
+    }
+
+    free(pBuffer);
+    free(pszPath);
+    return 0;
+}
+
+static void FreeHasher(LocalHasher *h)
+{
+    free(h->pszRoot);
+    free(h->ppFiles);
+    free(h);
+}
+
+LocalHasher *LocalHasherStart(LPCWSTR pszRoot, VerifyFile **ppFiles, size_t nFiles)
+{
+    LocalHasher *h;
+    SYSTEM_INFO si;
+    int nWorkers;
+
+    h = calloc(1, sizeof(LocalHasher));
+    if (!h)
+        return NULL;
+    h->pszRoot = malloc(VERIFY_PATH_CCH * sizeof(WCHAR));
+    h->ppFiles = malloc((nFiles ? nFiles : 1) * sizeof(VerifyFile *));
+    if (!h->pszRoot || !h->ppFiles || !MakeLongPath(pszRoot, h->pszRoot))
+    {
+        FreeHasher(h);
+        return NULL;
+    }
+
+    /* Largest first: the long files start early and the small ones fill the gaps */
+    memcpy(h->ppFiles, ppFiles, nFiles * sizeof(VerifyFile *));
+    h->nFiles = nFiles;
+    qsort(h->ppFiles, nFiles, sizeof(VerifyFile *), CompareSizeDesc);
+
+    GetSystemInfo(&si);
+    nWorkers = (int)si.dwNumberOfProcessors;
+    if (nWorkers > VERIFY_MAX_WORKERS)
+        nWorkers = VERIFY_MAX_WORKERS;
+    if ((size_t)nWorkers > nFiles)
+        nWorkers = (int)nFiles;
+    if (nWorkers < 1)
+        nWorkers = 1;
+
+    for (int i = 0; i < nWorkers; i++)
+    {
+        h->hThreads[h->nThreads] = CreateThread(NULL, 0, HashThread, h, 0, NULL);
+        if (h->hThreads[h->nThreads])
+            h->nThreads++;
+    }
+    if (h->nThreads == 0)
+    {
+        FreeHasher(h);
+        return NULL;
+    }
+    return h;
+}
+
+BOOL LocalHasherWait(LocalHasher *h, DWORD dwMilliseconds)
+{
+    DWORD dwWait = WaitForMultipleObjects((DWORD)h->nThreads, h->hThreads, TRUE, dwMilliseconds);
+
+    return dwWait < WAIT_OBJECT_0 + (DWORD)h->nThreads;
+}
+
+unsigned long long LocalHasherGetProgress(LocalHasher *h)
+{
+    return (unsigned long long)InterlockedCompareExchange64(&h->cbDone, 0, 0);
+}
+
+void LocalHasherCancel(LocalHasher *h)
+{
+    InterlockedExchange(&h->bCancel, 1);
+}
+
+unsigned long LocalHasherFinish(LocalHasher *h)
+{
+    unsigned long nErrors;
+
+    WaitForMultipleObjects((DWORD)h->nThreads, h->hThreads, TRUE, INFINITE);
+    for (int i = 0; i < h->nThreads; i++)
+        CloseHandle(h->hThreads[i]);
+
+    nErrors = (unsigned long)h->nErrors;
+    FreeHasher(h);
+    return nErrors;
+}
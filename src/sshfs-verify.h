@@ -0,0 +1,84 @@
+/**
+ * sshfs-verify.h
+ *
+ * Local side of "Hash on server" and "Compare with local folder" in
+ * sshfs-ssh.exe: file lists of a tree (the mounted one is listed through
+ * the drive, which reads directories but no file content) and the
+ * multi-threaded hasher for the local copy.
+ *
+ * The hasher works through the files largest first, each worker taking the
+ * next one, so one big file does not end up last on a single thread.
+ */
+
+#ifndef SSHFS_VERIFY_H
+#define SSHFS_VERIFY_H
+
+#include <windows.h>
+
+#include "sshfs-hash.h"
+
+#define VERIFY_MAX_WORKERS  8
+#define VERIFY_READ_SIZE    (1024 * 1024)
+
+typedef struct VerifyFile {
+    char *pszName;                  /* UTF-8, '/' separated, relative to the root */
+    unsigned long long size;
+    unsigned char digest[HASH_SIZE];
+    BOOL bHashed;
+} VerifyFile;
+
+typedef struct VerifyList {
+    VerifyFile *pFiles;             /* Sorted by name after VerifyListScan() */
+    size_t nFiles;
+    size_t nAlloc;
+    unsigned long long cbTotal;
+    unsigned long nSkipped;         /* Links and junctions, not followed */
+    unsigned long nErrors;          /* Folders that could not be listed */
+    WCHAR szFirstError[MAX_PATH + 64];
+} VerifyList;
+
+/**
+ * List the files below pszRoot: the given items (names inside pszRoot,
+ * files or folders), or everything in it when ppszItems is NULL.
+ * Returns FALSE only when out of memory.
+ */
+BOOL VerifyListScan(VerifyList *pList, LPCWSTR pszRoot, LPCWSTR const *ppszItems, int nItems);
+
+/**
+ * File with the given name, NULL if not listed
+ */
+VerifyFile *VerifyListFind(const VerifyList *pList, const char *pszName);
+
+void VerifyListFree(VerifyList *pList);
+
+typedef struct LocalHasher LocalHasher;
+
+/**
+ * Hash ppFiles (names relative to pszRoot) on up to VERIFY_MAX_WORKERS
+ * threads. Each file gets its digest and bHashed when read completely.
+ * The array must stay valid until LocalHasherFinish().
+ */
+LocalHasher *LocalHasherStart(LPCWSTR pszRoot, VerifyFile **ppFiles, size_t nFiles);
+
+/**
+ * Wait up to dwMilliseconds. TRUE once all files are done.
+ */
+BOOL LocalHasherWait(LocalHasher *h, DWORD dwMilliseconds);
+
+/**
+ * Bytes hashed so far, safe to call while the workers run
+ */
+unsigned long long LocalHasherGetProgress(LocalHasher *h);
+
+/**
+ * Stop after the current reads
+ */
+void LocalHasherCancel(LocalHasher *h);
+
+/**
+ * Wait for the workers and free the hasher. Returns the number of files
+ * that could not be read.
+ */
+unsigned long LocalHasherFinish(LocalHasher *h);
+
+#endif /* SSHFS_VERIFY_H */
@@ -0,0 +1,390 @@
+/**
+ * sshfs-watch.c
+ *
+ * Event stream parser and coalescer (see sshfs-watch.h)
+ */
+
+#include "sshfs-watch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest record worth keeping: event names, tab, "./", path */
+#define PENDING_MAX (WATCH_MAX_PATH + 256)
+
+#define TABLE_SIZE  (WATCH_MAX_PENDING * 2)     /* Power of two */
+
+int WatchParserInit(WatchParser *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->pPending = malloc(PENDING_MAX);
+    return p->pPending != NULL;
+}
+
+void WatchParserFree(WatchParser *p)
+{
+    free(p->pPending);
+    p->pPending = NULL;
+}
+
+/**
+ * Flags for one event name; 0 for the ones that change nothing (OPEN,
+ * ACCESS, CLOSE_NOWRITE...), -1 for names that are not events at all
+ */
+static int EventFlag(const char *name, size_t n)
+{
+#define IS(s) (n == sizeof(s) - 1 && memcmp(name, s, n) == 0)
+    if (IS("CREATE") || IS("MOVED_TO"))
+        return WATCH_EV_CREATE;
+    if (IS("DELETE") || IS("MOVED_FROM"))
+        return WATCH_EV_DELETE;
+    if (IS("CLOSE_WRITE") || IS("MODIFY") || IS("ATTRIB") || IS("POLL"))
+        return WATCH_EV_MODIFY;
+    if (IS("ISDIR"))
+        return WATCH_EV_ISDIR;
+    if (IS("Q_OVERFLOW") || IS("DELETE_SELF") || IS("MOVE_SELF") || IS("UNMOUNT"))
+        return WATCH_EV_OVERFLOW;
+    if (IS("OPEN") || IS("ACCESS") || IS("CLOSE_NOWRITE") || IS("CLOSE") || IS("MOVE") || IS("IGNORED"))
+        return 0;
+    return -1;
+#undef IS
+}
+
+/**
+ * Hand out one complete record (without its newline)
+ */
+static void TakeRecord(WatchParser *p, const char *rec, size_t cb, WatchEventFn fn, void *pContext)
+{
+    const char *tab = memchr(rec, '\t', cb);
+    const char *name, *path, *end = rec + cb;
+    WatchEvent ev;
+    size_t cchPath;
+
+    if (!tab || tab == rec)
+    {
+        p->nSkipped++;
+        return;
+    }
+
+    ev.flags = 0;
+    for (name = rec; name < tab; )
+    {
+        const char *comma = memchr(name, ',', (size_t)(tab - name));
+        const char *nameEnd = comma ? comma : tab;
+        int flag = EventFlag(name, (size_t)(nameEnd - name));
+
+        if (flag < 0)
+        {
+            p->nSkipped++;
+            return;
+        }
+        ev.flags |= (unsigned int)flag;
+        name = nameEnd + 1;
+    }
+    if (ev.flags == 0 || ev.flags == WATCH_EV_ISDIR)
+        return;
+
+    /* "./a/b", "./a/" for the folder a itself, "./" or "." for the root */
+    path = tab + 1;
+    if (end - path >= 2 && path[0] == '.' && path[1] == '/')
+        path += 2;
+    else if (end - path == 1 && path[0] == '.')
+        path++;
+    while (end > path && end[-1] == '/')
+        end--;
+    cchPath = (size_t)(end - path);
+    if (cchPath > WATCH_MAX_PATH || memchr(path, '\0', cchPath))
+    {
+        p->nSkipped++;
+        return;
+    }
+    memcpy(p->szPath, path, cchPath);
+    p->szPath[cchPath] = '\0';
+    ev.pszPath = p->szPath;
+
+    p->nEvents++;
+    fn(&ev, pContext);
+}
+
+void WatchParserFeed(WatchParser *p, const char *data, size_t cb, WatchEventFn fn, void *pContext)
+{
+    while (cb > 0)
+    {
+        const char *nl = memchr(data, '\n', cb);
+        size_t n = nl ? (size_t)(nl - data) : cb;
+
+        if (p->cbPending > 0 || !nl)
+        {
+            /* A record cut by a read; one too long to keep is dropped */
+            if (p->cbPending + n <= PENDING_MAX)
+                memcpy(p->pPending + p->cbPending, data, n);
+            p->cbPending += n;
+            if (nl)
+            {
+                if (p->cbPending <= PENDING_MAX)
+                    TakeRecord(p, p->pPending, p->cbPending, fn, pContext);
+                else
+                    p->nSkipped++;
+                p->cbPending = 0;
+            }
+        }
+        else
+        {
+            TakeRecord(p, data, n, fn, pContext);
+        }
+        if (!nl)
+            break;
+        data += n + 1;
+        cb -= n + 1;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static unsigned int HashPath(const char *s, size_t n)
+{
+    unsigned int h = 2166136261u;   /* FNV-1a */
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+void WatchCoalescerInit(WatchCoalescer *c)
+{
+    memset(c, 0, sizeof(*c));
+}
+
+void WatchCoalescerFree(WatchCoalescer *c)
+{
+    free(c->pEntries);
+    free(c->pTable);
+    free(c->pPaths);
+    memset(c, 0, sizeof(*c));
+}
+
+/**
+ * Entry for a path, added if new. NULL when it cannot be kept (too many
+ * paths, out of memory), which makes the flush refresh everything.
+ */
+static WatchEntry *FindEntry(WatchCoalescer *c, const char *pszPath, int *pbNew)
+{
+    size_t cch = strlen(pszPath);
+    unsigned int hash = HashPath(pszPath, cch);
+    size_t slot;
+    WatchEntry *e;
+
+    if (!c->pTable)
+    {
+        c->pTable = calloc(TABLE_SIZE, sizeof(unsigned int));
+        if (!c->pTable)
+            return NULL;
+        c->nTable = TABLE_SIZE;
+    }
+
+    for (slot = hash & (c->nTable - 1); c->pTable[slot]; slot = (slot + 1) & (c->nTable - 1))
+    {
+        e = &c->pEntries[c->pTable[slot] - 1];
+        if (e->hash == hash && strcmp(c->pPaths + e->iPath, pszPath) == 0)
+        {
+            *pbNew = 0;
+            return e;
+        }
+    }
+
+    if (c->nEntries >= WATCH_MAX_PENDING)
+        return NULL;
+    if (c->nEntries == c->nEntriesAlloc)
+    {
+        size_t n = c->nEntriesAlloc ? c->nEntriesAlloc * 2 : 256;
+        WatchEntry *p = realloc(c->pEntries, n * sizeof(WatchEntry));
+        if (!p)
+            return NULL;
+        c->pEntries = p;
+        c->nEntriesAlloc = n;
+    }
+    if (c->cbPaths + cch + 1 > c->cbPathsAlloc)
+    {
+        size_t n = c->cbPathsAlloc ? c->cbPathsAlloc : 16384;
+        char *p;
+        while (n < c->cbPaths + cch + 1)
+            n *= 2;
+        p = realloc(c->pPaths, n);
+        if (!p)
+            return NULL;
+        c->pPaths = p;
+        c->cbPathsAlloc = n;
+    }
+
+    e = &c->pEntries[c->nEntries];
+    memset(e, 0, sizeof(*e));
+    e->iPath = (unsigned int)c->cbPaths;
+    e->hash = hash;
+    memcpy(c->pPaths + c->cbPaths, pszPath, cch + 1);
+    c->cbPaths += cch + 1;
+    c->pTable[slot] = (unsigned int)++c->nEntries;
+    *pbNew = 1;
+    return e;
+}
+
+void WatchCoalescerAdd(WatchCoalescer *c, const WatchEvent *pEvent, unsigned long long msNow)
+{
+    WatchEntry *e;
+    int bNew;
+
+    c->nEvents++;
+    if (c->nEntries == 0 && !c->bOverflow)
+        c->msFirst = msNow;
+    c->msLast = msNow;
+
+    /* Past an overflow everything is refreshed anyway */
+    if (c->bOverflow)
+        return;
+    if ((pEvent->flags & WATCH_EV_OVERFLOW) || !(e = FindEntry(c, pEvent->pszPath, &bNew)))
+    {
+        c->bOverflow = 1;
+        return;
+    }
+
+    if (pEvent->flags & WATCH_EV_ISDIR)
+        e->bDir = 1;
+
+    /* The first event tells whether the path was there before */
+    if (bNew)
+    {
+        e->bBefore = !(pEvent->flags & WATCH_EV_CREATE);
+        e->bNow = e->bBefore;
+    }
+    if (pEvent->flags & WATCH_EV_DELETE)
+    {
+        e->bNow = 0;
+    }
+    if (pEvent->flags & WATCH_EV_CREATE)
+    {
+        if (!bNew && !e->bNow && e->bBefore)
+            e->bChanged = 1;
+        e->bNow = 1;
+    }
+    if (pEvent->flags & WATCH_EV_MODIFY)
+        e->bChanged = 1;
+}
+
+unsigned long WatchCoalescerDue(const WatchCoalescer *c, unsigned long long msNow)
+{
+    unsigned long long due;
+
+    if (c->nEntries == 0 && !c->bOverflow)
+        return (unsigned long)-1;
+    due = c->msLast + WATCH_QUIET_MS;
+    if (due > c->msFirst + WATCH_MAX_DELAY_MS)
+        due = c->msFirst + WATCH_MAX_DELAY_MS;
+    return due <= msNow ? 0 : (unsigned long)(due - msNow);
+}
+
+/**
+ * Length of the parent folder's path ("" for a top level entry)
+ */
+static size_t ParentLength(const char *pszPath)
+{
+    const char *slash = strrchr(pszPath, '/');
+    return slash ? (size_t)(slash - pszPath) : 0;
+}
+
+typedef struct ParentCount {
+    unsigned int hash;
+    unsigned int iEntry;            /* An entry below it, + 1 (0: free slot) */
+    unsigned int nEntries;
+    int bNotified;
+} ParentCount;
+
+static ParentCount *FindParent(ParentCount *pTable, size_t nTable, const WatchCoalescer *c, size_t iEntry)
+{
+    const char *pszPath = c->pPaths + c->pEntries[iEntry].iPath;
+    size_t cch = ParentLength(pszPath);
+    unsigned int hash = HashPath(pszPath, cch);
+    size_t slot;
+
+    for (slot = hash & (nTable - 1); pTable[slot].iEntry; slot = (slot + 1) & (nTable - 1))
+    {
+        const char *pszOther = c->pPaths + c->pEntries[pTable[slot].iEntry - 1].iPath;
+        if (pTable[slot].hash == hash && ParentLength(pszOther) == cch && memcmp(pszOther, pszPath, cch) == 0)
+            return &pTable[slot];
+    }
+    pTable[slot].hash = hash;
+    pTable[slot].iEntry = (unsigned int)iEntry + 1;
+    return &pTable[slot];
+}
+
+static void Notify(WatchCoalescer *c, WatchNotify kind, const char *pszPath, WatchNotifyFn fn, void *pContext)
+{
+    c->nNotified++;
+    fn(kind, pszPath, pContext);
+}
+
+void WatchCoalescerFlush(WatchCoalescer *c, WatchNotifyFn fn, void *pContext)
+{
+    ParentCount *pParents = NULL;
+    size_t i;
+
+    if (!c->bOverflow && c->nEntries > WATCH_DIR_LIMIT)
+    {
+        pParents = calloc(TABLE_SIZE, sizeof(ParentCount));
+        if (!pParents)
+            c->bOverflow = 1;
+    }
+
+    if (c->bOverflow)
+    {
+        Notify(c, WATCH_NOTIFY_UPDATEDIR, "", fn, pContext);
+    }
+    else
+    {
+        if (pParents)
+        {
+            for (i = 0; i < c->nEntries; i++)
+                FindParent(pParents, TABLE_SIZE, c, i)->nEntries++;
+        }
+
+        for (i = 0; i < c->nEntries; i++)
+        {
+            WatchEntry *e = &c->pEntries[i];
+            char *pszPath = c->pPaths + e->iPath;
+
+            /* A busy folder is refreshed once instead of entry by entry */
+            if (pParents)
+            {
+                ParentCount *pc = FindParent(pParents, TABLE_SIZE, c, i);
+
+                if (pc->nEntries > WATCH_DIR_LIMIT)
+                {
+                    if (!pc->bNotified)
+                    {
+                        size_t cch = ParentLength(pszPath);
+                        char chSaved = pszPath[cch];
+
+                        pszPath[cch] = '\0';
+                        Notify(c, WATCH_NOTIFY_UPDATEDIR, pszPath, fn, pContext);
+                        pszPath[cch] = chSaved;
+                        pc->bNotified = 1;
+                    }
+                    continue;
+                }
+            }
+
+            if (!e->bBefore && e->bNow)
+                Notify(c, e->bDir ? WATCH_NOTIFY_MKDIR : WATCH_NOTIFY_CREATE, pszPath, fn, pContext);
+            else if (e->bBefore && !e->bNow)
+                Notify(c, e->bDir ? WATCH_NOTIFY_RMDIR : WATCH_NOTIFY_DELETE, pszPath, fn, pContext);
+            else if (e->bBefore && e->bChanged)
+                Notify(c, e->bDir ? WATCH_NOTIFY_UPDATEDIR : WATCH_NOTIFY_UPDATEITEM, pszPath, fn, pContext);
+        }
+    }
+
+    free(pParents);
+    if (c->pTable && c->nEntries > 0)
+        memset(c->pTable, 0, c->nTable * sizeof(unsigned int));
+    c->nEntries = 0;
+    c->cbPaths = 0;
+    c->bOverflow = 0;
+}
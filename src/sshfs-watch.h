@@ -0,0 +1,123 @@
+/**
+ * sshfs-watch.h
+ *
+ * Change events for "Watch server changes" in sshfs-ssh.exe: the parser
+ * for the event stream the server sends (inotifywait, or a find loop where
+ * it is missing) and the coalescer that turns it into few shell change
+ * notifications. Free of Windows so it can be run against event storms
+ * elsewhere.
+ *
+ * Events are collected per path until the stream has been quiet for
+ * WATCH_QUIET_MS (or WATCH_MAX_DELAY_MS has passed), and each path then
+ * gets at most one notification for its net change: a file created and
+ * deleted in between gets none. A folder with more than WATCH_DIR_LIMIT
+ * changed entries is refreshed as a whole, and past WATCH_MAX_PENDING
+ * paths (or when the server reports an overflow) the whole tree is.
+ */
+
+#ifndef SSHFS_WATCH_H
+#define SSHFS_WATCH_H
+
+#include <stddef.h>
+
+#define WATCH_MAX_PATH      4096        /* Longer records are counted as skipped */
+#define WATCH_QUIET_MS      200
+#define WATCH_MAX_DELAY_MS  1000
+#define WATCH_DIR_LIMIT     32
+#define WATCH_MAX_PENDING   16384
+
+/* Event flags, from inotifywait's event names */
+#define WATCH_EV_CREATE     0x0001      /* CREATE, MOVED_TO */
+#define WATCH_EV_DELETE     0x0002      /* DELETE, MOVED_FROM */
+#define WATCH_EV_MODIFY     0x0004      /* CLOSE_WRITE, MODIFY, ATTRIB, and POLL from the find loop */
+#define WATCH_EV_ISDIR      0x0008
+#define WATCH_EV_OVERFLOW   0x0010      /* Q_OVERFLOW, or the folder itself went away */
+
+typedef struct WatchEvent {
+    unsigned int flags;
+    const char *pszPath;            /* Relative to the watched folder, "" for itself */
+} WatchEvent;
+
+typedef void (*WatchEventFn)(const WatchEvent *pEvent, void *pContext);
+
+typedef struct WatchParser {
+    char *pPending;                 /* Start of a record cut by the last read */
+    size_t cbPending;
+    unsigned long nEvents;
+    unsigned long nSkipped;
+    char szPath[WATCH_MAX_PATH + 1];
+} WatchParser;
+
+/**
+ * Returns 0 if out of memory
+ */
+int WatchParserInit(WatchParser *p);
+
+/**
+ * Parse the next cb bytes of "EVENT[,EVENT...]\t./path\n" records, calling
+ * fn for each complete one
+ */
+void WatchParserFeed(WatchParser *p, const char *data, size_t cb, WatchEventFn fn, void *pContext);
+
+void WatchParserFree(WatchParser *p);
+
+/* ------------------------------------------------------------------------- */
+
+typedef enum WatchNotify {
+    WATCH_NOTIFY_CREATE,
+    WATCH_NOTIFY_DELETE,
+    WATCH_NOTIFY_MKDIR,
+    WATCH_NOTIFY_RMDIR,
+    WATCH_NOTIFY_UPDATEITEM,
+    WATCH_NOTIFY_UPDATEDIR
+} WatchNotify;
+
+/**
+ * Called by WatchCoalescerFlush() for each notification; pszPath is
+ * relative to the watched folder ('/' separated, "" for itself)
+ */
+typedef void (*WatchNotifyFn)(WatchNotify kind, const char *pszPath, void *pContext);
+
+typedef struct WatchEntry {
+    unsigned int iPath;             /* Offset in pPaths */
+    unsigned int hash;
+    unsigned char bBefore;          /* Existed before the first event */
+    unsigned char bNow;
+    unsigned char bDir;
+    unsigned char bChanged;         /* Modified, or deleted and created again */
+} WatchEntry;
+
+typedef struct WatchCoalescer {
+    WatchEntry *pEntries;
+    size_t nEntries, nEntriesAlloc;
+    unsigned int *pTable;           /* Open addressing, entry index + 1 */
+    size_t nTable;
+    char *pPaths;
+    size_t cbPaths, cbPathsAlloc;
+    unsigned long long msFirst;     /* First and last event since the last flush */
+    unsigned long long msLast;
+    int bOverflow;
+    unsigned long nEvents;          /* All events taken */
+    unsigned long nNotified;        /* All notifications given */
+} WatchCoalescer;
+
+void WatchCoalescerInit(WatchCoalescer *c);
+void WatchCoalescerFree(WatchCoalescer *c);
+
+/**
+ * Take an event seen at msNow (any monotonic clock)
+ */
+void WatchCoalescerAdd(WatchCoalescer *c, const WatchEvent *pEvent, unsigned long long msNow);
+
+/**
+ * Milliseconds until the pending events are due for a flush: 0 if they
+ * are, (unsigned long)-1 if there are none
+ */
+unsigned long WatchCoalescerDue(const WatchCoalescer *c, unsigned long long msNow);
+
+/**
+ * Hand out the notifications for everything pending and start over
+ */
+void WatchCoalescerFlush(WatchCoalescer *c, WatchNotifyFn fn, void *pContext);
+
+#endif /* SSHFS_WATCH_H */
@@ -41,13 +41,17 @@ echo   OK
 :: Step 2: Stop Explorer to release DLL
 echo [2/3] Stopping Explorer...
 taskkill /f /im explorer.exe >nul 2>&1
+:: The credential broker is a sshfs-ssh.exe that would keep the file in use
+taskkill /f /im sshfs-ssh.exe >nul 2>&1
 echo   OK
 
 :: Step 3: Remove files
 echo [3/3] Removing files...
 del /f "%TARGET_DIR%\sshfs-ctx.dll" >nul 2>&1
 del /f "%TARGET_DIR%\sshfs-ssh.exe" >nul 2>&1
+del /f "%TARGET_DIR%\sshfs-exec.exe" >nul 2>&1
 del /f "%TARGET_DIR%\sshfs-ssh-launcher.exe" >nul 2>&1
+del /f "%TARGET_DIR%\sshfs-ssh-connect.exe" >nul 2>&1
 echo   OK
 
 :: Restart Explorer